@@ -391,6 +391,7 @@ bool Audit::configure(void) {
             iterator->second->setEnabled(false);
         }
     }
+    update_event_filter();
     // create event to say done reconfiguration
     if (is_enabled_before_reconfig || config.is_auditd_enabled()) {
         auto evt = events.find(AUDITD_AUDIT_CONFIGURED_AUDIT_DAEMON);
@@ -433,6 +434,71 @@ bool Audit::configure(void) {
     return true;
 }
 
+void Audit::update_event_filter(void) {
+    // Build the new filter aside and publish it word by word. Each
+    // word is stored atomically so a concurrent reader sees either
+    // the old or the new verdict for an event, never garbage, and
+    // there is no window where every event is reported as filtered
+    // out during a reload.
+    std::array<uint32_t, event_filter_words> next;
+    next.fill(0);
+
+    for (const auto& event : events) {
+        if (event.second->isEnabled()) {
+            const uint32_t word = event.first / 32;
+            if (word < next.size()) {
+                next[word] |= uint32_t(1) << (event.first % 32);
+            }
+        }
+    }
+
+    for (size_t ii = 0; ii < event_filter_words; ++ii) {
+        event_filter[ii].store(next[ii], std::memory_order_relaxed);
+    }
+    filter_in_use.store(config.is_auditd_enabled(),
+                        std::memory_order_relaxed);
+}
+
+bool Audit::enqueue_event(Event* new_event) {
+    if (inbound_size.fetch_add(1, std::memory_order_relaxed) >=
+        max_audit_queue) {
+        inbound_size.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Event* old = inbound.load(std::memory_order_relaxed);
+    do {
+        new_event->next = old;
+    } while (!inbound.compare_exchange_weak(old, new_event,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+
+    if (old == nullptr) {
+        // The stack was empty so the consumer may be sleeping. The
+        // signal has to happen while holding the lock; the consumer
+        // rechecks the stack under the same lock before waiting so
+        // the wakeup can't get lost.
+        cb_mutex_enter(&producer_consumer_lock);
+        cb_cond_broadcast(&events_arrived);
+        cb_mutex_exit(&producer_consumer_lock);
+    }
+    return true;
+}
+
+Event* Audit::drain_events(void) {
+    Event* chain = inbound.exchange(nullptr, std::memory_order_acquire);
+
+    // The stack holds the events newest first; reverse the chain so
+    // they get processed (and written) in arrival order
+    Event* ordered = nullptr;
+    while (chain != nullptr) {
+        Event* next = chain->next;
+        chain->next = ordered;
+        ordered = chain;
+        chain = next;
+    }
+    return ordered;
+}
 
 bool Audit::add_to_filleventqueue(const uint32_t event_id,
                                   const char *payload,
@@ -442,44 +508,30 @@ bool Audit::add_to_filleventqueue(const uint32_t event_id,
     //       in the correct fields.. if not we should add an
     //       event to the audit trail saying it is one in an illegal
     //       format (or missing fields)
-    bool res;
     Event* new_event = new Event(event_id, payload, length);
-    cb_mutex_enter(&producer_consumer_lock);
-    if (filleventqueue->size() < max_audit_queue) {
-        filleventqueue->push(new_event);
-        cb_cond_broadcast(&events_arrived);
-        res = true;
-    } else {
+    if (!enqueue_event(new_event)) {
         logger->log(EXTENSION_LOG_WARNING, NULL,
                     "Audit: Dropping audit event %u: %s",
                     new_event->id, new_event->payload.c_str());
         dropped_events++;
         delete new_event;
-        res = false;
+        return false;
     }
-    cb_mutex_exit(&producer_consumer_lock);
-    return res;
+    return true;
 }
 
 
 bool Audit::add_reconfigure_event(const char* configfile, const void *cookie) {
-    bool res;
     ConfigureEvent* new_event = new ConfigureEvent(configfile, cookie);
-    cb_mutex_enter(&producer_consumer_lock);
-    if (filleventqueue->size() < max_audit_queue) {
-        filleventqueue->push(new_event);
-        cb_cond_broadcast(&events_arrived);
-        res = true;
-    } else {
+    if (!enqueue_event(new_event)) {
         Audit::logger->log(EXTENSION_LOG_WARNING, NULL,
                            "Audit: Dropping configure event: %s",
                            new_event->payload.c_str());
         dropped_events++;
         delete new_event;
-        res = false;
+        return false;
     }
-    cb_mutex_exit(&producer_consumer_lock);
-    return res;
+    return true;
 }
 
 
@@ -493,15 +545,12 @@ void Audit::clear_events_map(void) {
 
 
 void Audit::clear_events_queues(void) {
-    while(!processeventqueue->empty()) {
-        Event *event = processeventqueue->front();
-        processeventqueue->pop();
-        delete event;
-    }
-    while(!filleventqueue->empty()) {
-        Event *event = filleventqueue->front();
-        filleventqueue->pop();
-        delete event;
+    Event* chain = drain_events();
+    while (chain != nullptr) {
+        Event* next = chain->next;
+        delete chain;
+        chain = next;
+        inbound_size.fetch_sub(1, std::memory_order_relaxed);
     }
 }
 
@@ -17,6 +17,7 @@
 #ifndef AUDIT_H
 #define AUDIT_H
 
+#include <array>
 #include <inttypes.h>
 #include <map>
 #include <memory>
@@ -38,11 +39,15 @@ public:
     AuditConfig config;
     std::map<uint32_t,EventDescriptor*> events;
 
-    // We maintain two Event queues. At any one time one will be used to accept
-    // new events, and the other will be processed. The two queues are swapped
-    // periodically.
-    std::unique_ptr<std::queue<Event*>> processeventqueue;
-    std::unique_ptr<std::queue<Event*>> filleventqueue;
+    // The producers push new events onto this intrusive lock-free
+    // stack (linked through Event::next, newest first) and the
+    // consumer thread grabs the whole chain with a single exchange
+    // (see drain_events). Pushing never takes a lock, and the
+    // condition variable is only signalled on an empty to non-empty
+    // transition, so a steady stream of events doesn't pay for a
+    // mutex and a wakeup per event.
+    std::atomic<Event*> inbound;
+    std::atomic<size_t> inbound_size;
 
     bool terminate_audit_daemon;
     std::string configfile;
@@ -59,10 +64,12 @@ public:
     std::atomic<uint32_t> dropped_events;
 
     Audit()
-        : processeventqueue(new std::queue<Event*>()),
-          filleventqueue(new std::queue<Event*>()),
+        : inbound(nullptr),
+          inbound_size(0),
           terminate_audit_daemon(false),
           dropped_events(0),
+          event_filter(),
+          filter_in_use(false),
           max_audit_queue(50000) {
         consumer_thread_running.store(false);
         cb_cond_initialize(&processeventqueue_empty);
@@ -90,6 +97,57 @@ public:
                                      payload.length());
     }
 
+    /**
+     * Push an event onto the inbound stack, waking the consumer if it
+     * was empty. Takes ownership of the event on success; the caller
+     * keeps it (and should drop it) on failure.
+     *
+     * @param new_event the event to queue
+     * @return true if queued, false if the queue is full
+     */
+    bool enqueue_event(Event* new_event);
+
+    /**
+     * Grab the entire chain of pending events (in arrival order), or
+     * nullptr if none are pending. Only called by the consumer thread.
+     */
+    Event* drain_events(void);
+
+    /**
+     * Are there events pending on the inbound stack?
+     */
+    bool has_pending_events(void) const {
+        return inbound.load(std::memory_order_acquire) != nullptr;
+    }
+
+    /**
+     * Check if the given event would be thrown away if it was put
+     * into the audit trail right now.
+     *
+     * This is the fast path the frontend may use to avoid building
+     * the event payload at all; it is two relaxed atomic loads with
+     * no locking. The filter is advisory (it is rebuilt word by word
+     * by update_event_filter when the configuration is reloaded), and
+     * the consumer thread still performs the authoritative check when
+     * the event is processed.
+     *
+     * @param id the event id to check
+     * @return true if the event is known to be thrown away
+     */
+    bool is_event_filtered_out(uint32_t id) const {
+        if (!filter_in_use.load(std::memory_order_relaxed)) {
+            // auditing is disabled; everything is thrown away
+            return true;
+        }
+        const uint32_t word = id / 32;
+        if (word >= event_filter.size()) {
+            // Unknown event id; let the consumer thread decide
+            return false;
+        }
+        return (event_filter[word].load(std::memory_order_relaxed) &
+                (uint32_t(1) << (id % 32))) == 0;
+    }
+
     bool add_reconfigure_event(const char *configfile, const void *cookie);
     bool create_audit_event(uint32_t event_id, cJSON *payload);
     bool terminate_consumer_thread(void);
@@ -102,6 +160,24 @@ public:
     static std::string load_file(const char *file);
 
 private:
+    /**
+     * Rebuild the event filter from the events map. Called by
+     * configure() every time the configuration is (re)loaded.
+     */
+    void update_event_filter(void);
+
+    // The event filter is a flat bitset with one bit per event id
+    // (bit set means the event is enabled). The generator hands out
+    // event ids in blocks of 4096 starting at 4096, so a filter
+    // covering [0, 65536) holds all of the modules with room to
+    // spare at a cost of 8kB.
+    static const size_t event_filter_words = 65536 / 32;
+    std::array<std::atomic<uint32_t>, event_filter_words> event_filter;
+
+    // Set when auditing is enabled and the event filter holds the
+    // current configuration.
+    std::atomic<bool> filter_in_use;
+
     size_t max_audit_queue;
 };
 
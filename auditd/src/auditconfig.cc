@@ -84,6 +84,8 @@ AuditConfig::AuditConfig(const cJSON *json) : AuditConfig() {
     set_rotate_interval(getObject(json, "rotate_interval", cJSON_Number));
     set_auditd_enabled(getObject(json, "auditd_enabled", -1));
     set_buffered(cJSON_GetObjectItem(const_cast<cJSON*>(json), "buffered"));
+    set_compress_archives(cJSON_GetObjectItem(const_cast<cJSON*>(json),
+                                              "compress_archives"));
     set_log_directory(getObject(json, "log_path", cJSON_String));
     set_descriptors_path(getObject(json, "descriptors_path", cJSON_String));
     set_sync(getObject(json, "sync", cJSON_Array));
@@ -95,6 +97,7 @@ AuditConfig::AuditConfig(const cJSON *json) : AuditConfig() {
     tags["rotate_interval"] = 1;
     tags["auditd_enabled"] = 1;
     tags["buffered"] = 1;
+    tags["compress_archives"] = 1;
     tags["log_path"] = 1;
     tags["descriptors_path"] = 1;
     tags["sync"] = 1;
@@ -159,6 +162,14 @@ bool AuditConfig::is_buffered(void) const {
     return buffered;
 }
 
+void AuditConfig::set_compress_archives(bool enable) {
+    compress_archives = enable;
+}
+
+bool AuditConfig::is_compress_archives(void) const {
+    return compress_archives;
+}
+
 void AuditConfig::set_log_directory(const std::string &directory) {
     std::lock_guard<std::mutex> guard(log_path_mutex);
     /* Sanitize path */
@@ -249,6 +260,21 @@ void AuditConfig::set_buffered(cJSON *obj) {
     }
 }
 
+void AuditConfig::set_compress_archives(cJSON *obj) {
+    if (obj) {
+        if (obj->type == cJSON_True) {
+            set_compress_archives(true);
+        } else if (obj->type == cJSON_False) {
+            set_compress_archives(false);
+        } else {
+            std::stringstream ss;
+            ss << "Incorrect type (" << obj->type
+               << ") for \"compress_archives\". Should be boolean";
+            throw ss.str();
+        }
+    }
+}
+
 void AuditConfig::set_log_directory(cJSON *obj) {
     set_log_directory(obj->valuestring);
 }
@@ -293,6 +319,7 @@ unique_cJSON_ptr AuditConfig::to_json() const {
     cJSON_AddNumberToObject(root, "rotate_size", get_rotate_size());
     cJSON_AddNumberToObject(root, "rotate_interval", get_rotate_interval());
     cJSON_AddBoolToObject(root, "buffered", is_buffered());
+    cJSON_AddBoolToObject(root, "compress_archives", is_compress_archives());
     cJSON_AddStringToObject(root, "log_path", get_log_directory().c_str());
     cJSON_AddStringToObject(root, "descriptors_path", get_descriptors_path().c_str());
 
@@ -318,6 +345,7 @@ void AuditConfig::initialize_config(const cJSON* json) {
     rotate_interval = other.rotate_interval;
     rotate_size = other.rotate_size;
     buffered = other.buffered;
+    compress_archives = other.compress_archives;
     {
         std::lock_guard<std::mutex> guard(log_path_mutex);
         log_path = other.log_path;
@@ -35,6 +35,7 @@ public:
         rotate_interval(900),
         rotate_size(20 * 1024 * 1024),
         buffered(true),
+        compress_archives(false),
         min_file_rotation_time(900), // 15 minutes
         max_file_rotation_time(604800), // 1 week
         max_rotate_file_size(500 * 1024 * 1024)
@@ -65,6 +66,8 @@ public:
     uint32_t get_rotate_interval(void) const;
     void set_buffered(bool enable);
     bool is_buffered(void) const;
+    void set_compress_archives(bool enable);
+    bool is_compress_archives(void) const;
     void set_log_directory(const std::string &directory);
     std::string get_log_directory(void) const;
     void set_descriptors_path(const std::string &directory);
@@ -105,6 +108,7 @@ protected:
     void set_rotate_interval(cJSON *obj);
     void set_auditd_enabled(cJSON *obj);
     void set_buffered(cJSON *obj);
+    void set_compress_archives(cJSON *obj);
     void set_log_directory(cJSON *obj);
     void set_descriptors_path(cJSON *obj);
     void add_array(std::vector<uint32_t> &vec, cJSON *array, const char *name);
@@ -115,6 +119,7 @@ protected:
     Couchbase::RelaxedAtomic<uint32_t> rotate_interval;
     Couchbase::RelaxedAtomic<size_t> rotate_size;
     Couchbase::RelaxedAtomic<bool> buffered;
+    Couchbase::RelaxedAtomic<bool> compress_archives;
 
     mutable std::mutex log_path_mutex;
     std::string log_path;
@@ -53,33 +53,36 @@ static void consume_events(void* arg) {
 
     cb_mutex_enter(&audit.producer_consumer_lock);
     while (!audit.terminate_audit_daemon) {
-        if (audit.filleventqueue->empty()) {
+        if (!audit.has_pending_events()) {
             cb_cond_timedwait(&audit.events_arrived,
                               &audit.producer_consumer_lock,
                               audit.auditfile.get_seconds_to_rotation() * 1000);
-            if (audit.filleventqueue->empty()) {
+            if (!audit.has_pending_events()) {
                 // We timed out, so just rotate the files
                 audit.auditfile.maybe_rotate_files();
             }
         }
-        /* now have producer_consumer lock!
-         * event(s) have arrived or shutdown requested
-         */
-        swap(audit.processeventqueue, audit.filleventqueue);
+        /* event(s) have arrived or shutdown requested */
         cb_mutex_exit(&audit.producer_consumer_lock);
         // Now outside of the producer_consumer_lock
 
-        while (!audit.processeventqueue->empty()) {
-            Event* event = audit.processeventqueue->front();
+        Event* event = audit.drain_events();
+        size_t batch_size = 0;
+        while (event != nullptr) {
+            Event* next = event->next;
             if (!event->process(audit)) {
                 audit.dropped_events++;
             }
-            audit.processeventqueue->pop();
             delete event;
+            event = next;
+            ++batch_size;
             if (audit_processed_listener) {
                 audit_processed_listener();
             }
         }
+        audit.inbound_size.fetch_sub(batch_size, std::memory_order_relaxed);
+        // The events above were buffered as they were serialized;
+        // write the whole batch with a single flush (group commit)
         audit.auditfile.flush();
         cb_mutex_enter(&audit.producer_consumer_lock);
     }
@@ -201,6 +204,14 @@ AUDIT_ERROR_CODE put_json_audit_event(Audit* handle,
     return put_audit_event(handle, id, text.data(), text.length());
 }
 
+MEMCACHED_PUBLIC_API
+bool audit_event_enabled(Audit* handle, const uint32_t id) {
+    if (handle == nullptr) {
+        return false;
+    }
+    return !handle->is_event_filtered_out(id);
+}
+
 MEMCACHED_PUBLIC_API
 AUDIT_ERROR_CODE shutdown_auditdaemon(Audit* handle) {
     if (handle == nullptr) {
@@ -20,6 +20,8 @@
 #include <cJSON.h>
 #include <sys/stat.h>
 #include <cstring>
+#include <vector>
+#include <platform/compress.h>
 #include <platform/dirutils.h>
 #include <memcached/isotime.h>
 #include <JSON_checker.h>
@@ -110,6 +112,10 @@ bool AuditFile::open(void) {
 
 void AuditFile::close_and_rotate_log(void) {
     cb_assert(file != NULL);
+    // Hand any events still sitting in the write buffer to the old
+    // file before it is closed (write_pending resets the buffer, so
+    // this can't recurse more than once on a write error)
+    write_pending();
     fclose(file);
     file = NULL;
     if (current_size == 0) {
@@ -139,14 +145,106 @@ void AuditFile::close_and_rotate_log(void) {
         archive_file << "-audit.log";
         fname.assign(archive_file.str());
         ++count;
-    } while (file_exists(fname));
+        // The archiver replaces an archive with a compressed version
+        // of itself, so a name is taken if either variant exists
+    } while (file_exists(fname) || file_exists(fname + ".snappy"));
 
     if (rename(open_file_name.c_str(), fname.c_str()) != 0) {
         log_error(AuditErrorCode::FILE_RENAME_ERROR, open_file_name.c_str());
+    } else if (compress_archives) {
+        start_archiver(fname);
     }
     open_time = 0;
 }
 
+void AuditFile::start_archiver(const std::string &fname) {
+    wait_for_archiver();
+
+    std::string *arg = new std::string(fname);
+    if (cb_create_named_thread(&archiver_tid, archive_thread_main, arg, 0,
+                               "mc:audit_arch") != 0) {
+        // Failed to spawn the worker. The uncompressed archive is
+        // already in place, so nothing is lost.
+        log_error(AuditErrorCode::CB_CREATE_THREAD_ERROR, fname.c_str());
+        delete arg;
+    } else {
+        archiver_running = true;
+    }
+}
+
+void AuditFile::wait_for_archiver(void) {
+    if (archiver_running) {
+        cb_join_thread(archiver_tid);
+        archiver_running = false;
+    }
+}
+
+void AuditFile::archive_thread_main(void *arg) {
+    std::string *fname = reinterpret_cast<std::string*>(arg);
+    compress_archive(*fname);
+    delete fname;
+}
+
+void AuditFile::compress_archive(const std::string &name) {
+    const std::string zname = name + ".snappy";
+
+    FILE *in = fopen(name.c_str(), "rb");
+    if (in == NULL) {
+        log_error(AuditErrorCode::FILE_OPEN_ERROR, name.c_str());
+        return;
+    }
+    FILE *out = fopen(zname.c_str(), "wb");
+    if (out == NULL) {
+        log_error(AuditErrorCode::FILE_OPEN_ERROR, zname.c_str());
+        fclose(in);
+        return;
+    }
+
+    std::vector<char> block(archive_block_size);
+    bool success = true;
+    size_t nr;
+    while (success && (nr = fread(block.data(), 1, block.size(), in)) > 0) {
+        cb::compression::Buffer deflated;
+        if (!cb::compression::deflate(cb::compression::Algorithm::Snappy,
+                                      block.data(), nr, deflated)) {
+            success = false;
+            break;
+        }
+
+        // Each block is prefixed with its compressed length (32 bit,
+        // network byte order) so that a reader can inflate the file
+        // block by block without slurping it into memory.
+        uint8_t frame[4];
+        frame[0] = static_cast<uint8_t>(deflated.len >> 24);
+        frame[1] = static_cast<uint8_t>(deflated.len >> 16);
+        frame[2] = static_cast<uint8_t>(deflated.len >> 8);
+        frame[3] = static_cast<uint8_t>(deflated.len);
+        if (fwrite(frame, 1, sizeof(frame), out) != sizeof(frame) ||
+            fwrite(deflated.data.get(), 1, deflated.len, out) !=
+            deflated.len) {
+            success = false;
+        }
+    }
+    if (ferror(in)) {
+        success = false;
+    }
+    fclose(in);
+    if (fclose(out) != 0) {
+        success = false;
+    }
+
+    if (success) {
+        if (remove(name.c_str()) != 0) {
+            // Both copies remain on disk; wasteful, but nothing lost
+            log_error(AuditErrorCode::FILE_REMOVE_ERROR, name.c_str());
+        }
+    } else {
+        // Drop the partial compressed file and keep the raw archive
+        log_error(AuditErrorCode::WRITING_TO_DISK_ERROR, zname.c_str());
+        remove(zname.c_str());
+    }
+}
+
 
 void AuditFile::cleanup_old_logfile(const std::string& log_path) {
     std::stringstream file;
@@ -251,15 +349,19 @@ bool AuditFile::write_event_to_disk(cJSON *output) {
     char *content = cJSON_PrintUnformatted(output);
     bool ret = true;
     if (content) {
-        current_size += fprintf(file, "%s\n", content);
-        if (ferror(file)) {
-            log_error(AuditErrorCode::WRITING_TO_DISK_ERROR, strerror(errno));
-            ret = false;
-            close_and_rotate_log();
-        } else if (!buffered) {
+        const size_t length = strlen(content);
+        write_buffer.append(content, length);
+        write_buffer.push_back('\n');
+        current_size += length + 1;
+        cJSON_Free(content);
+
+        if (write_buffer.size() >= write_buffer_capacity) {
+            ret = write_pending();
+        }
+        if (ret && !buffered) {
+            // Unbuffered mode keeps the per-event durability
             ret = flush();
         }
-        cJSON_Free(content);
     } else {
         log_error(AuditErrorCode::MEMORY_ALLOCATION_ERROR,
                   "failed to convert audit event");
@@ -268,6 +370,21 @@ bool AuditFile::write_event_to_disk(cJSON *output) {
     return ret;
 }
 
+bool AuditFile::write_pending(void) {
+    if (write_buffer.empty()) {
+        return true;
+    }
+
+    fwrite(write_buffer.data(), 1, write_buffer.size(), file);
+    write_buffer.clear();
+    if (ferror(file)) {
+        log_error(AuditErrorCode::WRITING_TO_DISK_ERROR, strerror(errno));
+        close_and_rotate_log();
+        return false;
+    }
+    return true;
+}
+
 
 void AuditFile::set_log_directory(const std::string &new_directory) {
     if (log_directory == new_directory) {
@@ -295,10 +412,14 @@ void AuditFile::reconfigure(const AuditConfig &config) {
     set_log_directory(config.get_log_directory());
     max_log_size = config.get_rotate_size();
     buffered = config.is_buffered();
+    compress_archives = config.is_compress_archives();
 }
 
 bool AuditFile::flush(void) {
     if (is_open()) {
+        if (!write_pending()) {
+            return false;
+        }
         if (fflush(file) != 0) {
             log_error(AuditErrorCode::WRITING_TO_DISK_ERROR,
                       strerror(errno));
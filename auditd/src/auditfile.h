@@ -22,6 +22,7 @@
 #include <string>
 #include <cJSON.h>
 #include <time.h>
+#include <platform/platform.h>
 #include "auditconfig.h"
 #include "auditd.h"
 
@@ -34,8 +35,11 @@ public:
         current_size(0),
         max_log_size(20 * 1024 * 1024),
         rotate_interval(900),
-        buffered(true)
+        buffered(true),
+        compress_archives(false),
+        archiver_running(false)
     {
+        write_buffer.reserve(write_buffer_capacity);
     }
 
     ~AuditFile() {
@@ -78,6 +82,7 @@ public:
         if (is_open()) {
             close_and_rotate_log();
         }
+        wait_for_archiver();
     }
 
     /**
@@ -90,7 +95,10 @@ public:
     void cleanup_old_logfile(const std::string& log_path);
 
     /**
-     * Write a json formatted object to the disk
+     * Serialize a json formatted object into the write buffer. The
+     * buffer is handed to the disk as one write when it fills up, when
+     * the file is rotated or when the consumer flushes the batch it
+     * just drained (group commit).
      *
      * @param output the data to write
      * @return true if success, false otherwise
@@ -142,6 +150,45 @@ private:
     void set_log_directory(const std::string &new_directory);
     bool is_timestamp_format_correct(std::string& str);
 
+    /**
+     * Hand the named archive file to a background thread which
+     * compresses it into "<name>.snappy" and removes the original.
+     * The archive is no longer referenced by the writer so the worker
+     * owns the file; the rename itself stays on the calling thread
+     * (it has to complete before the next open may recreate
+     * "audit.log").
+     *
+     * @param fname the archive file to compress
+     */
+    void start_archiver(const std::string &fname);
+
+    /**
+     * Reap the archiver thread (if one was ever started). Rotations
+     * are minutes apart so the worker is normally long gone and the
+     * join just collects the thread.
+     */
+    void wait_for_archiver(void);
+
+    static void archive_thread_main(void *arg);
+
+    /**
+     * Compress the named file block by block into "<name>.snappy"
+     * and remove the original. On any failure the partially written
+     * compressed file is removed and the uncompressed archive is
+     * kept; better fat than lost.
+     *
+     * @param name the file to compress
+     */
+    static void compress_archive(const std::string &name);
+
+    /**
+     * Hand the content of the write buffer to the file with a single
+     * write and reset the buffer (the capacity stays reserved).
+     *
+     * @return true if success, false otherwise
+     */
+    bool write_pending(void);
+
     static time_t auditd_time();
 
     FILE *file;
@@ -152,6 +199,22 @@ private:
     size_t max_log_size;
     uint32_t rotate_interval;
     bool buffered;
+    bool compress_archives;
+
+    /** Set when archiver_tid holds a thread which must be joined */
+    bool archiver_running;
+    cb_thread_t archiver_tid;
+
+    /**
+     * The preallocated buffer the events are serialized into before
+     * being written as a batch
+     */
+    std::string write_buffer;
+    static const size_t write_buffer_capacity = 64 * 1024;
+
+    /** The unit of compression for archived files (each block is
+     * deflated on its own and framed with its compressed length) */
+    static const size_t archive_block_size = 64 * 1024;
 };
 
 #endif
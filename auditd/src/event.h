@@ -27,14 +27,23 @@ public:
     const uint32_t id;
     const std::string payload;
 
+    /**
+     * The link used by the inbound event stack (the producers push
+     * the events onto a lock-free list threaded through this member;
+     * see Audit::enqueue_event)
+     */
+    Event* next;
+
     // Constructor required for ConfigureEvent
     Event()
-        : id(0) {}
+        : id(0),
+          next(nullptr) {}
 
     Event(const uint32_t event_id, const char* p,
           size_t length)
         : id(event_id),
-          payload(p,length) {}
+          payload(p,length),
+          next(nullptr) {}
 
     virtual bool process(Audit& audit);
 
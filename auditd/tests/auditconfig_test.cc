@@ -256,6 +256,38 @@ TEST_F(AuditConfigTest, TestLegalBuffered) {
     EXPECT_NO_THROW(config.initialize_config(json));
 }
 
+// compress_archives
+
+TEST_F(AuditConfigTest, TestNoCompressArchives) {
+    // compress_archives is optional, and disabled unless explicitly
+    // enabled (the compressed archives need different tooling to read)
+    EXPECT_NO_THROW(config.initialize_config(json));
+    EXPECT_FALSE(config.is_compress_archives());
+}
+
+TEST_F(AuditConfigTest, TestGetSetCompressArchives) {
+    config.set_compress_archives(true);
+    EXPECT_TRUE(config.is_compress_archives());
+    config.set_compress_archives(false);
+    EXPECT_FALSE(config.is_compress_archives());
+}
+
+TEST_F(AuditConfigTest, TestIllegalDatatypeCompressArchives) {
+    cJSON_AddStringToObject(json, "compress_archives", "foobar");
+    EXPECT_THROW(config.initialize_config(json), std::string);
+}
+
+TEST_F(AuditConfigTest, TestLegalCompressArchives) {
+    cJSON_AddTrueToObject(json, "compress_archives");
+    EXPECT_NO_THROW(config.initialize_config(json));
+    EXPECT_TRUE(config.is_compress_archives());
+
+    cJSON_ReplaceItemInObject(json, "compress_archives",
+                              cJSON_CreateFalse());
+    EXPECT_NO_THROW(config.initialize_config(json));
+    EXPECT_FALSE(config.is_compress_archives());
+}
+
 // log_path
 TEST_F(AuditConfigTest, TestNoLogPath) {
     cJSON *obj = cJSON_DetachItemFromObject(json, "log_path");
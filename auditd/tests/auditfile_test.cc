@@ -18,11 +18,13 @@
 
 #include "auditfile.h"
 #include <iostream>
+#include <fstream>
 #include <map>
 #include <atomic>
 #include <cstring>
 #include <time.h>
 #include <gtest/gtest.h>
+#include <platform/compress.h>
 #include <platform/platform.h>
 
 using CouchbaseDirectoryUtilities::findFilesWithPrefix;
@@ -133,6 +135,62 @@ TEST_F(AuditFileTest, TestSizeRotate) {
     EXPECT_EQ(10, files.size());
 }
 
+/**
+ * Test that the archives are compressed (and may be inflated back to
+ * the original events) when compress_archives is enabled
+ */
+TEST_F(AuditFileTest, TestCompressedRotation) {
+    AuditConfig defaultvalue;
+    config.set_rotate_interval(defaultvalue.get_max_file_rotation_time());
+    config.set_rotate_size(10);
+    config.set_compress_archives(true);
+
+    AuditFile auditfile;
+    auditfile.reconfigure(config);
+
+    cJSON_AddStringToObject(event, "log_path", "fooo");
+    char *content = cJSON_PrintUnformatted(event);
+    const std::string expected = std::string(content) + "\n";
+    cJSON_Free(content);
+
+    for (int ii = 0; ii < 4; ++ii) {
+        auditfile.ensure_open();
+        auditfile.write_event_to_disk(event);
+    }
+
+    // close() waits for the background compression to complete
+    auditfile.close();
+
+    auto files = findFilesWithPrefix(testdir + "/testing");
+    EXPECT_EQ(4, files.size());
+
+    for (const auto& file : files) {
+        const std::string suffix = ".snappy";
+        ASSERT_GT(file.size(), suffix.size());
+        EXPECT_EQ(suffix, file.substr(file.size() - suffix.size()));
+
+        // Each file should contain a single framed block (the events
+        // are way smaller than the block size) which inflates back
+        // to the event
+        std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+        std::string blob((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+        ASSERT_GT(blob.size(), 4u);
+        const size_t len =
+            (size_t(uint8_t(blob[0])) << 24) |
+            (size_t(uint8_t(blob[1])) << 16) |
+            (size_t(uint8_t(blob[2])) << 8) |
+            size_t(uint8_t(blob[3]));
+        EXPECT_EQ(blob.size() - 4, len);
+
+        cb::compression::Buffer inflated;
+        ASSERT_TRUE(cb::compression::inflate(
+            cb::compression::Algorithm::Snappy,
+            blob.data() + 4, len, inflated));
+        EXPECT_EQ(expected, std::string(inflated.data.get(), inflated.len));
+    }
+}
+
 /**
  * Test that the time rollover starts from the time the file was
  * opened, and not from the instance was configured
@@ -16,12 +16,12 @@
  */
 #include "config.h"
 #include <cbcrypto/cbcrypto.h>
+#include <cbcrypto/codec.h>
 
-#include <iomanip>
+#include <array>
 #include <memory>
 #include <openssl/evp.h>
 #include <platform/base64.h>
-#include <sstream>
 #include <stdexcept>
 
 #ifdef __APPLE__
@@ -152,46 +152,124 @@ static std::vector<uint8_t> digest_sha512(const std::vector<uint8_t>& data) {
 
 // OpenSSL
 
-static std::vector<uint8_t> HMAC_MD5(const std::vector<uint8_t>& key,
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+// Compat shims; the pre 1.1 API keeps the HMAC_CTX by value
+static HMAC_CTX* HMAC_CTX_new() {
+    auto* ctx = new HMAC_CTX;
+    HMAC_CTX_init(ctx);
+    return ctx;
+}
+
+static void HMAC_CTX_free(HMAC_CTX* ctx) {
+    HMAC_CTX_cleanup(ctx);
+    delete ctx;
+}
+#endif
+
+/**
+ * A per-thread cache of initialized OpenSSL contexts. SCRAM runs
+ * several HMACs on every authentication leg, so instead of having
+ * OpenSSL allocate, initialize and tear down a context per operation
+ * the contexts are created on first use and reinitialized in place.
+ * One context is kept per algorithm so that switching between
+ * algorithms doesn't force OpenSSL to resize the internal digest
+ * state either.
+ */
+class EvpContextCache {
+public:
+    EvpContextCache() {
+        md_ctx.fill(nullptr);
+        hmac_ctx.fill(nullptr);
+    }
+
+    ~EvpContextCache() {
+        for (auto* ctx : md_ctx) {
+            if (ctx != nullptr) {
+                EVP_MD_CTX_destroy(ctx);
+            }
+        }
+        for (auto* ctx : hmac_ctx) {
+            if (ctx != nullptr) {
+                HMAC_CTX_free(ctx);
+            }
+        }
+    }
+
+    EVP_MD_CTX* getDigestContext(size_t index) {
+        if (md_ctx[index] == nullptr) {
+            md_ctx[index] = EVP_MD_CTX_create();
+            if (md_ctx[index] == nullptr) {
+                throw std::bad_alloc();
+            }
+        }
+        return md_ctx[index];
+    }
+
+    HMAC_CTX* getHmacContext(size_t index) {
+        if (hmac_ctx[index] == nullptr) {
+            hmac_ctx[index] = HMAC_CTX_new();
+            if (hmac_ctx[index] == nullptr) {
+                throw std::bad_alloc();
+            }
+        }
+        return hmac_ctx[index];
+    }
+
+private:
+    std::array<EVP_MD_CTX*, 4> md_ctx;
+    std::array<HMAC_CTX*, 4> hmac_ctx;
+};
+
+static thread_local EvpContextCache context_cache;
+
+/** The slot in the context cache for each algorithm */
+enum class CacheSlot : size_t {
+    MD5 = 0, SHA1 = 1, SHA256 = 2, SHA512 = 3
+};
+
+static std::vector<uint8_t> evp_hmac(CacheSlot slot,
+                                     const EVP_MD* md,
+                                     size_t digest_size,
+                                     const std::vector<uint8_t>& key,
                                      const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> ret(cb::crypto::MD5_DIGEST_SIZE);
-    if (HMAC(EVP_md5(), key.data(), key.size(), data.data(), data.size(),
-             ret.data(), nullptr) == nullptr) {
-        throw std::runtime_error("cb::crypto::HMAC(MD5): HMAC failed");
+    std::vector<uint8_t> ret(digest_size);
+    auto* ctx = context_cache.getHmacContext(size_t(slot));
+
+    // An empty key must still be passed as a non-null pointer;
+    // HMAC_Init_ex treats a null key as "reuse the previous key"
+    const void* keyptr = key.empty() ? "" : static_cast<const void*>(
+        key.data());
+
+    if (HMAC_Init_ex(ctx, keyptr, int(key.size()), md, nullptr) != 1 ||
+        HMAC_Update(ctx, data.data(), data.size()) != 1 ||
+        HMAC_Final(ctx, ret.data(), nullptr) != 1) {
+        throw std::runtime_error("cb::crypto::HMAC: HMAC failed");
     }
     return ret;
 }
 
+static std::vector<uint8_t> HMAC_MD5(const std::vector<uint8_t>& key,
+                                     const std::vector<uint8_t>& data) {
+    return evp_hmac(CacheSlot::MD5, EVP_md5(), cb::crypto::MD5_DIGEST_SIZE,
+                    key, data);
+}
+
 static std::vector<uint8_t> HMAC_SHA1(const std::vector<uint8_t>& key,
                                       const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> ret(cb::crypto::SHA1_DIGEST_SIZE);
-    if (HMAC(EVP_sha1(), key.data(), key.size(), data.data(), data.size(),
-             ret.data(), nullptr) == nullptr) {
-        throw std::runtime_error("cb::crypto::HMAC(SHA1): HMAC failed");
-    }
-    return ret;
+    return evp_hmac(CacheSlot::SHA1, EVP_sha1(), cb::crypto::SHA1_DIGEST_SIZE,
+                    key, data);
 }
 
 static std::vector<uint8_t> HMAC_SHA256(const std::vector<uint8_t>& key,
                                         const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> ret(cb::crypto::SHA256_DIGEST_SIZE);
-    if (HMAC(EVP_sha256(), key.data(), key.size(), data.data(), data.size(),
-             ret.data(), nullptr) == nullptr) {
-        throw std::runtime_error(
-            "cb::crypto::HMAC(SHA256): HMAC failed");
-    }
-    return ret;
+    return evp_hmac(CacheSlot::SHA256, EVP_sha256(),
+                    cb::crypto::SHA256_DIGEST_SIZE, key, data);
 }
 
 static std::vector<uint8_t> HMAC_SHA512(const std::vector<uint8_t>& key,
                                         const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> ret(cb::crypto::SHA512_DIGEST_SIZE);
-    if (HMAC(EVP_sha512(), key.data(), key.size(), data.data(), data.size(),
-             ret.data(), nullptr) == nullptr) {
-        throw std::runtime_error(
-            "cb::crypto::HMAC(SHA512): HMAC failed");
-    }
-    return ret;
+    return evp_hmac(CacheSlot::SHA512, EVP_sha512(),
+                    cb::crypto::SHA512_DIGEST_SIZE, key, data);
 }
 
 static std::vector<uint8_t> PBKDF2_HMAC_SHA1(const std::string& pass,
@@ -275,28 +353,39 @@ static std::vector<uint8_t> PBKDF2_HMAC_SHA512(const std::string& pass,
     return ret;
 }
 
-static std::vector<uint8_t> digest_md5(const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> ret(cb::crypto::MD5_DIGEST_SIZE);
-    MD5(data.data(), data.size(), ret.data());
+static std::vector<uint8_t> evp_digest(CacheSlot slot,
+                                       const EVP_MD* md,
+                                       size_t digest_size,
+                                       const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> ret(digest_size);
+    auto* ctx = context_cache.getDigestContext(size_t(slot));
+
+    if (EVP_DigestInit_ex(ctx, md, nullptr) != 1 ||
+        EVP_DigestUpdate(ctx, data.data(), data.size()) != 1 ||
+        EVP_DigestFinal_ex(ctx, ret.data(), nullptr) != 1) {
+        throw std::runtime_error("cb::crypto::digest: EVP digest failed");
+    }
     return ret;
 }
 
+static std::vector<uint8_t> digest_md5(const std::vector<uint8_t>& data) {
+    return evp_digest(CacheSlot::MD5, EVP_md5(), cb::crypto::MD5_DIGEST_SIZE,
+                      data);
+}
+
 static std::vector<uint8_t> digest_sha1(const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> ret(cb::crypto::SHA1_DIGEST_SIZE);
-    SHA1(data.data(), data.size(), ret.data());
-    return ret;
+    return evp_digest(CacheSlot::SHA1, EVP_sha1(),
+                      cb::crypto::SHA1_DIGEST_SIZE, data);
 }
 
 static std::vector<uint8_t> digest_sha256(const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> ret(cb::crypto::SHA256_DIGEST_SIZE);
-    SHA256(data.data(), data.size(), ret.data());
-    return ret;
+    return evp_digest(CacheSlot::SHA256, EVP_sha256(),
+                      cb::crypto::SHA256_DIGEST_SIZE, data);
 }
 
 static std::vector<uint8_t> digest_sha512(const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> ret(cb::crypto::SHA512_DIGEST_SIZE);
-    SHA512(data.data(), data.size(), ret.data());
-    return ret;
+    return evp_digest(CacheSlot::SHA512, EVP_sha512(),
+                      cb::crypto::SHA512_DIGEST_SIZE, data);
 }
 
 #endif
@@ -602,11 +691,5 @@ std::string cb::crypto::digest(const Algorithm algorithm,
     std::vector<uint8_t> data(passwd.size());
     memcpy(data.data(), passwd.data(), passwd.size());
     auto digest = cb::crypto::digest(algorithm, data);
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    for (const auto& c : digest) {
-        ss << std::setw(2) << uint32_t(c);
-    }
-
-    return ss.str();
+    return cb::codec::hexEncode(digest.data(), digest.size());
 }
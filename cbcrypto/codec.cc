@@ -0,0 +1,383 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include <cbcrypto/codec.h>
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__GNUC__) || defined(__clang__)
+#define CB_CODEC_HAVE_SSSE3 1
+#include <tmmintrin.h>
+#endif
+#endif
+
+namespace cb {
+namespace codec {
+
+static const char encode_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* 0xff = invalid, 0xfe = padding */
+static uint8_t build_decode_entry(char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return uint8_t(c - 'A');
+    }
+    if (c >= 'a' && c <= 'z') {
+        return uint8_t(c - 'a' + 26);
+    }
+    if (c >= '0' && c <= '9') {
+        return uint8_t(c - '0' + 52);
+    }
+    if (c == '+') {
+        return 62;
+    }
+    if (c == '/') {
+        return 63;
+    }
+    if (c == '=') {
+        return 0xfe;
+    }
+    return 0xff;
+}
+
+class DecodeTable {
+public:
+    DecodeTable() {
+        for (int ii = 0; ii < 256; ++ii) {
+            entries[ii] = build_decode_entry(char(ii));
+        }
+    }
+    uint8_t operator[](uint8_t c) const {
+        return entries[c];
+    }
+
+private:
+    uint8_t entries[256];
+};
+
+static const DecodeTable decode_table;
+
+/*
+ * Scalar kernels. These handle everything when no SIMD kernel is
+ * available, and always handle the tail (and the error reporting for
+ * malformed input) behind the vector loops.
+ */
+static void encode_scalar(const uint8_t* in, size_t len, char* out) {
+    while (len >= 3) {
+        uint32_t triple = (uint32_t(in[0]) << 16) |
+                          (uint32_t(in[1]) << 8) |
+                          uint32_t(in[2]);
+        out[0] = encode_table[(triple >> 18) & 0x3f];
+        out[1] = encode_table[(triple >> 12) & 0x3f];
+        out[2] = encode_table[(triple >> 6) & 0x3f];
+        out[3] = encode_table[triple & 0x3f];
+        in += 3;
+        out += 4;
+        len -= 3;
+    }
+    if (len == 2) {
+        uint32_t triple = (uint32_t(in[0]) << 16) | (uint32_t(in[1]) << 8);
+        out[0] = encode_table[(triple >> 18) & 0x3f];
+        out[1] = encode_table[(triple >> 12) & 0x3f];
+        out[2] = encode_table[(triple >> 6) & 0x3f];
+        out[3] = '=';
+    } else if (len == 1) {
+        uint32_t triple = uint32_t(in[0]) << 16;
+        out[0] = encode_table[(triple >> 18) & 0x3f];
+        out[1] = encode_table[(triple >> 12) & 0x3f];
+        out[2] = '=';
+        out[3] = '=';
+    }
+}
+
+/*
+ * Decode a whole-quad region with no padding allowed (padding may only
+ * appear in the final quad, which the caller keeps out of this loop).
+ * Returns the number of bytes produced.
+ */
+static size_t decode_scalar(const uint8_t* in, size_t quads, uint8_t* out) {
+    uint8_t* start = out;
+    while (quads > 0) {
+        uint8_t a = decode_table[in[0]];
+        uint8_t b = decode_table[in[1]];
+        uint8_t c = decode_table[in[2]];
+        uint8_t d = decode_table[in[3]];
+        if (((a | b | c | d) & 0xc0) != 0) {
+            throw std::invalid_argument("cb::codec::base64Decode: invalid"
+                                        " character in input");
+        }
+        uint32_t triple = (uint32_t(a) << 18) | (uint32_t(b) << 12) |
+                          (uint32_t(c) << 6) | uint32_t(d);
+        out[0] = uint8_t(triple >> 16);
+        out[1] = uint8_t(triple >> 8);
+        out[2] = uint8_t(triple);
+        in += 4;
+        out += 3;
+        quads--;
+    }
+    return size_t(out - start);
+}
+
+#ifdef CB_CODEC_HAVE_SSSE3
+/*
+ * SSSE3 kernels, after Muła & Lemire ("Faster Base64 Encoding and
+ * Decoding Using AVX2 Instructions" - the SSE variant). The encoder
+ * turns 12 input bytes into 16 output characters per step; the decoder
+ * turns 16 characters into 12 bytes and falls back to the scalar path
+ * the moment it sees anything outside the alphabet so the error message
+ * (and padding handling) stays in one place.
+ */
+__attribute__((target("ssse3")))
+static size_t encode_ssse3(const uint8_t* in, size_t len, char* out) {
+    size_t consumed = 0;
+    /* each step loads 16 bytes but only consumes 12 */
+    while (len - consumed >= 16) {
+        __m128i data = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(in + consumed));
+
+        const __m128i shuf = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                           7, 6, 8, 7, 10, 9, 11, 10);
+        data = _mm_shuffle_epi8(data, shuf);
+
+        const __m128i t0 = _mm_and_si128(data, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(data, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        const __m128i indices = _mm_or_si128(t1, t3);
+
+        /* map the 6-bit indices to ASCII via an offset lookup: slot 0
+           covers 0-25, slot 1 covers 26-51, slots 2-11 cover the digits
+           and the last two slots '+' and '/' */
+        __m128i slots = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        const __m128i over = _mm_cmpgt_epi8(indices, _mm_set1_epi8(25));
+        slots = _mm_sub_epi8(slots, over);
+        const __m128i lut = _mm_setr_epi8('A', 'a' - 26, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 0, 0);
+        const __m128i result =
+            _mm_add_epi8(_mm_shuffle_epi8(lut, slots), indices);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), result);
+        consumed += 12;
+        out += 16;
+    }
+    return consumed;
+}
+
+__attribute__((target("ssse3")))
+static size_t decode_ssse3(const uint8_t* in, size_t quads, uint8_t* out,
+                           size_t* produced) {
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2F = _mm_set1_epi8(0x2f);
+
+    size_t consumed = 0;
+    *produced = 0;
+    /* each step consumes 16 characters (4 quads) and writes a 16 byte
+       register of which 12 bytes are output, so stay a full register
+       away from the end of the destination */
+    while (quads - consumed >= 5) {
+        const __m128i data = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(in + consumed * 4));
+
+        const __m128i hi_nibbles = _mm_and_si128(
+            _mm_srli_epi32(data, 4), _mm_set1_epi8(0x0f));
+        const __m128i lo_nibbles = _mm_and_si128(data, _mm_set1_epi8(0x0f));
+        const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                                             _mm_setzero_si128())) != 0) {
+            /* something outside the alphabet; let the scalar loop deal
+               with it (and throw with a proper message) */
+            break;
+        }
+
+        const __m128i eq_2F = _mm_cmpeq_epi8(data, mask_2F);
+        const __m128i roll = _mm_shuffle_epi8(
+            lut_roll, _mm_add_epi8(eq_2F, hi_nibbles));
+        const __m128i decoded = _mm_add_epi8(data, roll);
+
+        /* pack the 16 6-bit values down to 12 bytes */
+        const __m128i merged = _mm_maddubs_epi16(
+            decoded, _mm_set1_epi32(0x01400140));
+        const __m128i packed = _mm_madd_epi16(
+            merged, _mm_set1_epi32(0x00011000));
+        const __m128i shuffled = _mm_shuffle_epi8(
+            packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                  14, 13, 12, -1, -1, -1, -1));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + *produced),
+                         shuffled);
+        consumed += 4;
+        *produced += 12;
+    }
+    return consumed;
+}
+#endif /* CB_CODEC_HAVE_SSSE3 */
+
+/*
+ * Runtime dispatch. The CPU probe runs once; the test-only override
+ * lets the unit tests drive both paths on the same data. Additional
+ * kernels (AVX2, NEON) can slot in here without touching the callers.
+ */
+static bool simd_available() {
+#ifdef CB_CODEC_HAVE_SSSE3
+    static const bool available = __builtin_cpu_supports("ssse3");
+    return available;
+#else
+    return false;
+#endif
+}
+
+static bool simd_enabled = true;
+
+bool isBase64SimdAvailable() {
+    return simd_available();
+}
+
+void setBase64SimdEnabled(bool enabled) {
+    simd_enabled = enabled;
+}
+
+static bool use_simd() {
+    return simd_enabled && simd_available();
+}
+
+std::string base64Encode(const std::string& source) {
+    const size_t outlen = ((source.size() + 2) / 3) * 4;
+    std::string ret;
+    ret.resize(outlen);
+
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(source.data());
+    char* out = &ret[0];
+    size_t len = source.size();
+
+#ifdef CB_CODEC_HAVE_SSSE3
+    if (use_simd() && len >= 16) {
+        size_t consumed = encode_ssse3(in, len, out);
+        in += consumed;
+        out += (consumed / 3) * 4;
+        len -= consumed;
+    }
+#endif
+    encode_scalar(in, len, out);
+    return ret;
+}
+
+std::string base64Decode(const std::string& source) {
+    if (source.empty()) {
+        return std::string();
+    }
+    if (source.size() % 4 != 0) {
+        throw std::invalid_argument("cb::codec::base64Decode: invalid"
+                                    " input length");
+    }
+
+    const size_t quads = source.size() / 4;
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(source.data());
+
+    /* padding ('=') may only occur at the very end */
+    size_t padding = 0;
+    if (in[source.size() - 1] == '=') {
+        padding = (in[source.size() - 2] == '=') ? 2 : 1;
+    }
+
+    std::string ret;
+    ret.resize(quads * 3);
+    uint8_t* out = reinterpret_cast<uint8_t*>(&ret[0]);
+
+    /* the final quad carries the padding; keep it for the scalar tail */
+    size_t bulk = quads - 1;
+    size_t done = 0;
+    size_t written = 0;
+
+#ifdef CB_CODEC_HAVE_SSSE3
+    if (use_simd()) {
+        size_t produced;
+        done = decode_ssse3(in, bulk, out, &produced);
+        written = produced;
+    }
+#endif
+    written += decode_scalar(in + done * 4, bulk - done, out + written);
+
+    /* decode the final quad into a spill buffer so the padding logic
+       stays simple */
+    {
+        uint8_t a = decode_table[in[bulk * 4]];
+        uint8_t b = decode_table[in[bulk * 4 + 1]];
+        uint8_t c = decode_table[in[bulk * 4 + 2]];
+        uint8_t d = decode_table[in[bulk * 4 + 3]];
+        bool valid;
+        switch (padding) {
+        case 2:
+            valid = ((a | b) & 0xc0) == 0 && c == 0xfe && d == 0xfe;
+            c = d = 0;
+            break;
+        case 1:
+            valid = ((a | b | c) & 0xc0) == 0 && d == 0xfe;
+            d = 0;
+            break;
+        default:
+            valid = ((a | b | c | d) & 0xc0) == 0;
+            break;
+        }
+        if (!valid) {
+            throw std::invalid_argument("cb::codec::base64Decode: invalid"
+                                        " character in input");
+        }
+        uint32_t triple = (uint32_t(a) << 18) | (uint32_t(b) << 12) |
+                          (uint32_t(c) << 6) | uint32_t(d);
+        out[written++] = uint8_t(triple >> 16);
+        if (padding < 2) {
+            out[written++] = uint8_t(triple >> 8);
+        }
+        if (padding < 1) {
+            out[written++] = uint8_t(triple);
+        }
+    }
+
+    ret.resize(written);
+    return ret;
+}
+
+std::string hexEncode(const void* data, size_t size) {
+    static const char lookup[] = "0123456789abcdef";
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+    std::string ret;
+    ret.resize(size * 2);
+    for (size_t ii = 0; ii < size; ++ii) {
+        ret[ii * 2] = lookup[in[ii] >> 4];
+        ret[ii * 2 + 1] = lookup[in[ii] & 0x0f];
+    }
+    return ret;
+}
+
+} // namespace codec
+} // namespace cb
@@ -18,8 +18,37 @@
 #include "pwconv.h"
 
 #include <cJSON_utils.h>
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <vector>
+
+/*
+ * The layout of the precompiled database:
+ *
+ *   [ magic (8 bytes) ]
+ *   [ version (uint32_t) ]
+ *   [ number of entries (uint32_t) ]
+ *   [ index entry ] * entries        (sorted by username)
+ *   [ username and JSON blobs ]
+ *
+ * All integers use the host byte order, all offsets are relative to
+ * the start of the file and each JSON blob is nul terminated so it
+ * may be handed directly to cJSON_Parse.
+ */
+static const char precompiled_magic[8] = {'C', 'B', 'S', 'A',
+                                          'S', 'L', 'D', 'B'};
+static const uint32_t precompiled_version = 1;
+static const size_t precompiled_header_size = sizeof(precompiled_magic) +
+                                              2 * sizeof(uint32_t);
+
+struct PrecompiledIndexEntry {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t blob_offset;
+    uint32_t blob_length;
+};
 
 
 Couchbase::PasswordDatabase::PasswordDatabase(const std::string& content,
@@ -84,3 +113,157 @@ std::string Couchbase::PasswordDatabase::to_string() const {
     cJSON_Free(ptr);
     return ret;
 }
+
+/**
+ * Append the raw bytes of an integer to the blob being built
+ */
+static void append_uint32(std::string& blob, uint32_t value) {
+    blob.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+std::string Couchbase::PasswordDatabase::to_compiled() const {
+    // Serialize each user (and sort the names so that find may use
+    // a binary search)
+    std::vector<std::pair<std::string, std::string>> users;
+    users.reserve(db.size());
+    for (const auto& u : db) {
+        auto json = u.second.to_json();
+        char* ptr = cJSON_PrintUnformatted(json.get());
+        users.emplace_back(u.first, std::string(ptr));
+        cJSON_Free(ptr);
+    }
+    std::sort(users.begin(), users.end());
+
+    std::string ret;
+    ret.append(precompiled_magic, sizeof(precompiled_magic));
+    append_uint32(ret, precompiled_version);
+    append_uint32(ret, uint32_t(users.size()));
+
+    // The blobs start right after the index
+    uint32_t offset = uint32_t(precompiled_header_size +
+                               users.size() * sizeof(PrecompiledIndexEntry));
+    for (const auto& u : users) {
+        append_uint32(ret, offset);
+        append_uint32(ret, uint32_t(u.first.size()));
+        offset += uint32_t(u.first.size());
+        append_uint32(ret, offset);
+        append_uint32(ret, uint32_t(u.second.size()));
+        offset += uint32_t(u.second.size()) + 1; // keep the nul
+    }
+
+    for (const auto& u : users) {
+        ret.append(u.first);
+        ret.append(u.second);
+        ret.push_back('\0');
+    }
+
+    return ret;
+}
+
+bool Couchbase::PrecompiledPasswordDatabase::isPrecompiled(
+    const std::string& filename) {
+    char header[sizeof(precompiled_magic)];
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool ret = fread(header, sizeof(header), 1, fp) == 1 &&
+               memcmp(header, precompiled_magic, sizeof(header)) == 0;
+    fclose(fp);
+    return ret;
+}
+
+Couchbase::PrecompiledPasswordDatabase::PrecompiledPasswordDatabase(
+    const std::string& filename)
+    : map(new MemoryMappedFile(filename.c_str(), false, true)),
+      data(nullptr),
+      size(0),
+      entries(0) {
+    map->open();
+    data = reinterpret_cast<const char*>(map->getRoot());
+    size = map->getSize();
+    validate(filename);
+}
+
+Couchbase::PrecompiledPasswordDatabase::~PrecompiledPasswordDatabase() {
+    // The MemoryMappedFile tears down the mapping
+}
+
+/**
+ * Fetch (a copy of) the given index entry. The entries are packed in
+ * the file so copy them out instead of aliasing them.
+ */
+static PrecompiledIndexEntry load_index_entry(const char* data,
+                                              uint32_t index) {
+    PrecompiledIndexEntry entry;
+    memcpy(&entry,
+           data + precompiled_header_size + index * sizeof(entry),
+           sizeof(entry));
+    return entry;
+}
+
+void Couchbase::PrecompiledPasswordDatabase::validate(
+    const std::string& filename) {
+    if (size < precompiled_header_size ||
+        memcmp(data, precompiled_magic, sizeof(precompiled_magic)) != 0) {
+        throw std::runtime_error(
+            "PrecompiledPasswordDatabase: " + filename +
+            " is not a precompiled password database");
+    }
+
+    uint32_t version;
+    memcpy(&version, data + sizeof(precompiled_magic), sizeof(version));
+    if (version != precompiled_version) {
+        throw std::runtime_error(
+            "PrecompiledPasswordDatabase: unsupported version in " +
+            filename);
+    }
+    memcpy(&entries, data + sizeof(precompiled_magic) + sizeof(version),
+           sizeof(entries));
+
+    if (precompiled_header_size +
+        size_t(entries) * sizeof(PrecompiledIndexEntry) > size) {
+        throw std::runtime_error(
+            "PrecompiledPasswordDatabase: truncated index in " + filename);
+    }
+
+    for (uint32_t ii = 0; ii < entries; ++ii) {
+        const auto entry = load_index_entry(data, ii);
+        if (size_t(entry.name_offset) + entry.name_length > size ||
+            size_t(entry.blob_offset) + entry.blob_length >= size ||
+            data[entry.blob_offset + entry.blob_length] != '\0') {
+            throw std::runtime_error(
+                "PrecompiledPasswordDatabase: corrupt index in " + filename);
+        }
+    }
+}
+
+Couchbase::User Couchbase::PrecompiledPasswordDatabase::find(
+    const std::string& username) {
+    uint32_t low = 0;
+    uint32_t high = entries;
+
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
+        const auto entry = load_index_entry(data, mid);
+        const int cmp = username.compare(0, username.size(),
+                                         data + entry.name_offset,
+                                         entry.name_length);
+        if (cmp == 0) {
+            unique_cJSON_ptr json(cJSON_Parse(data + entry.blob_offset));
+            if (json.get() == nullptr) {
+                throw std::runtime_error(
+                    "PrecompiledPasswordDatabase: corrupt entry for " +
+                    username);
+            }
+            return UserFactory::create(json.get());
+        } else if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    // Return a dummy user (see PasswordDatabase::find)
+    return Couchbase::User();
+}
@@ -16,6 +16,9 @@
  */
 #pragma once
 
+#include <platform/memorymap.h>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include "user.h"
@@ -42,13 +45,17 @@ namespace Couchbase {
          */
         PasswordDatabase(const std::string& content, bool file = true);
 
+        virtual ~PasswordDatabase() {
+            // Empty
+        }
+
         /**
          * Try to locate the user in the password database
          *
          * @param username the username to look up
          * @return a copy of the user object
          */
-        Couchbase::User find(const std::string& username) {
+        virtual Couchbase::User find(const std::string& username) {
             auto it = db.find(username);
             if (it != db.end()) {
                 return it->second;
@@ -70,6 +77,18 @@ namespace Couchbase {
          */
         std::string to_string() const;
 
+        /**
+         * Create the precompiled (binary) representation of the
+         * password database (see CBSASL.md). The format keeps one
+         * JSON blob per user behind a sorted index so that a lookup
+         * only has to parse the entry it is interested in, instead of
+         * the whole file up front.
+         *
+         * The format uses the host byte order; the file is a local
+         * cache of the JSON database and is not meant to be copied
+         * between machines.
+         */
+        std::string to_compiled() const;
 
     private:
         /**
@@ -77,4 +96,56 @@ namespace Couchbase {
          */
         std::unordered_map<std::string, Couchbase::User> db;
     };
+
+    /**
+     * A read only view of a precompiled password database (the format
+     * written by to_compiled() / cbsasl_pwcompile). The file is mapped
+     * into memory as is; a lookup binary searches the sorted index and
+     * parses just the JSON blob for that user. This keeps a refresh of
+     * a big user database from stalling on a full JSON parse.
+     *
+     * The precompiled format is plain text only (it exists to be
+     * mapped directly; use the JSON database if the file needs to be
+     * encrypted).
+     */
+    class PrecompiledPasswordDatabase : public PasswordDatabase {
+    public:
+        /**
+         * Map the named precompiled database
+         *
+         * @param filename the file to map
+         * @throws std::runtime_error if the file can't be mapped or
+         *                            fails validation
+         */
+        explicit PrecompiledPasswordDatabase(const std::string& filename);
+
+        virtual ~PrecompiledPasswordDatabase();
+
+        virtual Couchbase::User find(const std::string& username) override;
+
+        /**
+         * Does the named file start with the precompiled database
+         * magic?
+         */
+        static bool isPrecompiled(const std::string& filename);
+
+    private:
+        /**
+         * Verify the header and that every index entry stays within
+         * the mapping (so that find never has to range check)
+         */
+        void validate(const std::string& filename);
+
+        /** The mapping of the file */
+        std::unique_ptr<MemoryMappedFile> map;
+
+        /** The start of the mapping */
+        const char* data;
+
+        /** The size of the mapping */
+        size_t size;
+
+        /** The number of entries in the index */
+        uint32_t entries;
+    };
 }
\ No newline at end of file
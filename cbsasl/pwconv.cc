@@ -15,6 +15,7 @@
  *   limitations under the License.
  */
 #include "pwconv.h"
+#include "password_database.h"
 #include "user.h"
 
 #include <fstream>
@@ -73,6 +74,21 @@ void cbsasl_pwconv(const std::string& ifile, const std::string& ofile) {
     cbsasl_write_password_file(ofile, outputstream.str());
 }
 
+void cbsasl_pwcompile(const std::string& ifile, const std::string& ofile) {
+    Couchbase::PasswordDatabase db(ifile, true);
+
+    std::ofstream of(ofile, std::ios::binary | std::ios::trunc);
+    if (!of.is_open()) {
+        throw std::runtime_error("cbsasl_pwcompile: Failed to open " + ofile);
+    }
+    const auto blob = db.to_compiled();
+    of.write(blob.data(), blob.size());
+    of.close();
+    if (!of.good()) {
+        throw std::runtime_error("cbsasl_pwcompile: Failed to write " + ofile);
+    }
+}
+
 std::string cbsasl_read_password_file(const std::string& filename) {
     Couchbase::MemoryMappedFile map(filename.c_str(), false, true);
     map.open();
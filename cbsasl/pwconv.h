@@ -41,6 +41,21 @@ void cbsasl_pwconv(const std::string& ifile, const std::string& ofile);
  */
 void cbsasl_pwconv(std::istream& is, std::ostream& os);
 
+/**
+ * Compile a json-style password database into the precompiled
+ * (binary) format which the server maps directly instead of parsing
+ * the whole file during a refresh (see CBSASL.md).
+ *
+ * The output file is always written as plain text (the point of the
+ * format is to be mapped as is, which rules out encryption).
+ *
+ * @param ifile the json-style password database to read
+ * @param ofile the precompiled database to write
+ * @throws std::runtime_error if we're failing to open or parse files
+ * @throws std::bad_alloc for memory issues
+ */
+void cbsasl_pwcompile(const std::string& ifile, const std::string& ofile);
+
 /**
  * Read the password file from the specified filename.
  *
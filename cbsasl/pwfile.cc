@@ -18,42 +18,46 @@
 #include "password_database.h"
 #include "pwconv.h"
 
-#include <mutex>
+#include <memory>
 #include <platform/timeutils.h>
 #include <sstream>
 
+/**
+ * The password database is an immutable snapshot: a refresh builds a
+ * complete new instance (on the refresh thread) and publishes it with
+ * an atomic pointer swap. A lookup grabs its own reference to the
+ * current snapshot, so an in-flight authentication keeps the old
+ * database alive until it's done with it (the shared_ptr refcount
+ * provides the grace period) and never contends with other lookups
+ * or with a refresh.
+ */
 class PasswordDatabaseManager {
 public:
     PasswordDatabaseManager()
-        : db(new Couchbase::PasswordDatabase) {
+        : db(std::make_shared<Couchbase::PasswordDatabase>()) {
 
     }
 
-    void swap(std::unique_ptr<Couchbase::PasswordDatabase>& ndb) {
-        std::lock_guard<std::mutex> lock(dbmutex);
-        db.swap(ndb);
+    void publish(std::shared_ptr<Couchbase::PasswordDatabase> ndb) {
+        std::atomic_store(&db, std::move(ndb));
     }
 
-    Couchbase::User find(const std::string& username) {
-        std::lock_guard<std::mutex> lock(dbmutex);
-        return db->find(username);
+    std::shared_ptr<Couchbase::PasswordDatabase> acquire() {
+        return std::atomic_load(&db);
     }
 
 private:
-    std::mutex dbmutex;
-    std::unique_ptr<Couchbase::PasswordDatabase> db;
+    std::shared_ptr<Couchbase::PasswordDatabase> db;
 };
 
 static PasswordDatabaseManager pwmgr;
 
 void free_user_ht(void) {
-    std::unique_ptr<Couchbase::PasswordDatabase> ndb(
-        new Couchbase::PasswordDatabase);
-    pwmgr.swap(ndb);
+    pwmgr.publish(std::make_shared<Couchbase::PasswordDatabase>());
 }
 
 bool find_user(const std::string& username, Couchbase::User& user) {
-    user = pwmgr.find(username);
+    user = pwmgr.acquire()->find(username);
     return !user.isDummy();
 }
 
@@ -61,14 +65,18 @@ cbsasl_error_t parse_user_db(const std::string content, bool file) {
     try {
         using namespace Couchbase;
         auto start = gethrtime();
-        std::unique_ptr<PasswordDatabase> db(
-            new PasswordDatabase(content, file));
+        std::shared_ptr<PasswordDatabase> db;
+        if (file && PrecompiledPasswordDatabase::isPrecompiled(content)) {
+            db = std::make_shared<PrecompiledPasswordDatabase>(content);
+        } else {
+            db = std::make_shared<PasswordDatabase>(content, file);
+        }
 
         std::string logmessage(
             "Loading [" + content + "] took " +
             Couchbase::hrtime2text(gethrtime() - start));
             cbsasl_log(nullptr, cbsasl_loglevel_t::Debug, logmessage);
-        pwmgr.swap(db);
+        pwmgr.publish(db);
     } catch (std::exception& e) {
         std::string message("Failed loading [");
         message.append(content);
@@ -30,7 +30,7 @@
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <openssl/sha.h>
-#include <platform/base64.h>
+#include <cbcrypto/codec.h>
 #include <platform/random.h>
 #include <set>
 #include <sstream>
@@ -39,13 +39,7 @@
 typedef std::map<char, std::string> AttributeMap;
 
 static std::string hex_encode_nonce(const std::array<char, 8>& nonce) {
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    for (const auto& c : nonce) {
-        ss << std::setw(2) << uint32_t(c);
-    }
-
-    return ss.str();
+    return cb::codec::hexEncode(nonce.data(), nonce.size());
 }
 
 /**
@@ -149,7 +143,7 @@ void ScramShaBackend::addAttribute(std::ostream& out, char key,
     case 's' : // base64 encoded salt
     case 'p' : // base64 encoded client proof
     case 'v' : // base64 encoded server signature
-        out << Couchbase::Base64::encode(value);
+        out << cb::codec::base64Encode(value);
         break;
 
     case 'i' : // iterator count
@@ -232,10 +226,17 @@ static std::vector<uint8_t> string2vector(const std::string& str) {
  * ServerSignature := HMAC(ServerKey, AuthMessage)
  */
 std::string ScramShaBackend::getServerSignature() {
-    std::vector<uint8_t> saltedPassword;
-    getSaltedPassword(saltedPassword);
-    auto serverKey = cb::crypto::HMAC(algorithm, saltedPassword,
-                                      string2vector("Server Key"));
+    std::vector<uint8_t> serverKey;
+
+    const auto* cache = getDerivedKeyCache();
+    if (cache != nullptr) {
+        serverKey = string2vector(cache->getServerKey());
+    } else {
+        std::vector<uint8_t> saltedPassword;
+        getSaltedPassword(saltedPassword);
+        serverKey = cb::crypto::HMAC(algorithm, saltedPassword,
+                                     string2vector("Server Key"));
+    }
 
     std::string authMessage = getAuthMessage();
     auto serverSignature = cb::crypto::HMAC(algorithm, serverKey,
@@ -258,13 +259,20 @@ std::string ScramShaBackend::getServerSignature() {
  * ClientProof     := ClientKey XOR ClientSignature
  */
 std::string ScramShaBackend::getClientProof() {
-    std::vector<uint8_t> saltedPassword;
-
-    getSaltedPassword(saltedPassword);
+    std::vector<uint8_t> clientKey;
+    std::vector<uint8_t> storedKey;
 
-    auto clientKey = cb::crypto::HMAC(algorithm, saltedPassword,
-                                             string2vector("Client Key"));
-    auto storedKey = cb::crypto::digest(algorithm, clientKey);
+    const auto* cache = getDerivedKeyCache();
+    if (cache != nullptr) {
+        clientKey = string2vector(cache->getClientKey());
+        storedKey = string2vector(cache->getStoredKey());
+    } else {
+        std::vector<uint8_t> saltedPassword;
+        getSaltedPassword(saltedPassword);
+        clientKey = cb::crypto::HMAC(algorithm, saltedPassword,
+                                     string2vector("Client Key"));
+        storedKey = cb::crypto::digest(algorithm, clientKey);
+    }
     std::string authMessage = getAuthMessage();
     auto clientSignature = cb::crypto::HMAC(algorithm, storedKey,
                                                    string2vector(authMessage));
@@ -430,7 +438,7 @@ cbsasl_error_t ScramShaServerBackend::start(cbsasl_conn_t* conn,
     // build up the server-first-message
     std::ostringstream out;
     addAttribute(out, 'r', nonce, true);
-    addAttribute(out, 's', Couchbase::Base64::decode(passwordMeta.getSalt()),
+    addAttribute(out, 's', cb::codec::base64Decode(passwordMeta.getSalt()),
                  true);
     addAttribute(out, 'i', passwordMeta.getIterationCount(), false);
     server_first_message = out.str();
@@ -489,7 +497,7 @@ cbsasl_error_t ScramShaServerBackend::step(cbsasl_conn_t* conn,
     (*outputlen) = server_final_message.length();
 
     std::string clientproof = iter->second;
-    std::string my_clientproof = Couchbase::Base64::encode(getClientProof());
+    std::string my_clientproof = cb::codec::base64Encode(getClientProof());
 
     int fail = cbsasl_secure_compare(clientproof.c_str(), clientproof.length(),
                                      my_clientproof.c_str(),
@@ -628,7 +636,7 @@ cbsasl_error_t ScramShaClientBackend::step(cbsasl_conn_t* conn,
                 nonce = attribute.second;
                 break;
             case 's' :
-                salt = Couchbase::Base64::decode(attribute.second);
+                salt = cb::codec::base64Decode(attribute.second);
                 break;
             case 'i' :
                 try {
@@ -706,7 +714,7 @@ cbsasl_error_t ScramShaClientBackend::step(cbsasl_conn_t* conn,
             return CBSASL_BADPARAM;
         }
 
-        auto encoded = Couchbase::Base64::encode(getServerSignature());
+        auto encoded = cb::codec::base64Encode(getServerSignature());
         if (encoded != attributes['v']) {
             cbsasl_log(conn, cbsasl_loglevel_t::Trace,
                        "Incorrect ServerKey received");
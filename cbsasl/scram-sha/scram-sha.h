@@ -90,6 +90,17 @@ protected:
 
     virtual void getSaltedPassword(std::vector<uint8_t>& dest) = 0;
 
+    /**
+     * Get the password metadata carrying precomputed derived keys
+     * (ServerKey / ClientKey / StoredKey), if any. The server side
+     * overrides this with the cached keys from the user database so
+     * an authentication doesn't have to run the HMACs again; the
+     * client side has nothing precomputed and uses the default.
+     */
+    virtual const Couchbase::User::PasswordMetaData* getDerivedKeyCache() {
+        return nullptr;
+    }
+
     /**
      * Get the AUTH message (as specified in the RFC)
      */
@@ -137,6 +148,12 @@ public:
         std::copy(pw.begin(), pw.end(), std::back_inserter(dest));
     }
 
+    virtual const Couchbase::User::PasswordMetaData*
+    getDerivedKeyCache() override {
+        const auto& meta = user.getPassword(mechanism);
+        return meta.hasDerivedKeys() ? &meta : nullptr;
+    }
+
     Couchbase::User user;
 };
 
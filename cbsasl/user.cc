@@ -139,12 +139,15 @@ Couchbase::User Couchbase::UserFactory::create(const cJSON* obj) {
             // skip. we've already processed this
         } else if (label == "sha512") {
             User::PasswordMetaData pd(o);
+            pd.generateDerivedKeys(cb::crypto::Algorithm::SHA512);
             ret.password[Mechanism::SCRAM_SHA512] = pd;
         } else if (label == "sha256") {
             User::PasswordMetaData pd(o);
+            pd.generateDerivedKeys(cb::crypto::Algorithm::SHA256);
             ret.password[Mechanism::SCRAM_SHA256] = pd;
         } else if (label == "sha1") {
             User::PasswordMetaData pd(o);
+            pd.generateDerivedKeys(cb::crypto::Algorithm::SHA1);
             ret.password[Mechanism::SCRAM_SHA1] = pd;
         } else if (label == "plain") {
             User::PasswordMetaData pd(Couchbase::Base64::decode(o->valuestring));
@@ -217,6 +220,27 @@ void Couchbase::User::generateSecrets(const Mechanism& mech,
     password[mech] =
         PasswordMetaData(std::string((const char*)digest.data(), digest.size()),
                          encodedSalt, IterationCount);
+    password[mech].generateDerivedKeys(algorithm);
+}
+
+void Couchbase::User::PasswordMetaData::generateDerivedKeys(
+    cb::crypto::Algorithm algorithm) {
+
+    auto string2vector = [](const std::string& str) {
+        return std::vector<uint8_t>(str.begin(), str.end());
+    };
+    const auto saltedPassword = string2vector(password);
+
+    auto sk = cb::crypto::HMAC(algorithm, saltedPassword,
+                               string2vector("Server Key"));
+    server_key.assign(reinterpret_cast<const char*>(sk.data()), sk.size());
+
+    auto ck = cb::crypto::HMAC(algorithm, saltedPassword,
+                               string2vector("Client Key"));
+    client_key.assign(reinterpret_cast<const char*>(ck.data()), ck.size());
+
+    auto st = cb::crypto::digest(algorithm, ck);
+    stored_key.assign(reinterpret_cast<const char*>(st.data()), st.size());
 }
 
 Couchbase::User::PasswordMetaData::PasswordMetaData(cJSON* obj) {
@@ -93,6 +93,36 @@ namespace Couchbase {
                 return iteration_count;
             }
 
+            /**
+             * Precompute the SCRAM keys derived from the salted
+             * password (ServerKey, ClientKey and StoredKey, see
+             * RFC 5802) so an authentication exchange doesn't have to
+             * derive them over and over again. The cache is tied to
+             * this object's salt and iteration count; a password
+             * refresh replaces the whole object (and with it the
+             * cache), so it can never go stale.
+             *
+             * @param algorithm the SHA algorithm of the mechanism this
+             *                  metadata belongs to
+             */
+            void generateDerivedKeys(cb::crypto::Algorithm algorithm);
+
+            bool hasDerivedKeys() const {
+                return !server_key.empty();
+            }
+
+            const std::string& getServerKey() const {
+                return server_key;
+            }
+
+            const std::string& getClientKey() const {
+                return client_key;
+            }
+
+            const std::string& getStoredKey() const {
+                return stored_key;
+            }
+
         private:
             // Base 64 encoded version of the salt
             std::string salt;
@@ -102,6 +132,13 @@ namespace Couchbase {
 
             // The iteration count used for generating the password
             int iteration_count;
+
+            // Cached keys derived from the salted password (empty
+            // until generateDerivedKeys is called; not part of the
+            // JSON representation)
+            std::string server_key;
+            std::string client_key;
+            std::string stored_key;
         };
 
         /**
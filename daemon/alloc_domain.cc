@@ -0,0 +1,152 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+
+#include "alloc_domain.h"
+#include "alloc_hooks.h"
+
+#include <atomic>
+
+/*
+ * The domain the current thread is allocating on behalf of, and (for
+ * the Engine domain) the bucket index. Only plain stores/loads of
+ * trivial types so the hooks never allocate themselves.
+ */
+static thread_local AllocationDomain current_domain = AllocationDomain::None;
+static thread_local size_t current_bucket = 0;
+
+/**
+ * The internal (atomic) representation of AllocDomain::Counters.
+ * Relaxed ordering is sufficient; the counters are statistics and
+ * carry no synchronization.
+ */
+struct AtomicCounters {
+    std::atomic<uint64_t> allocated;
+    std::atomic<uint64_t> freed;
+    std::atomic<uint64_t> malloc_count;
+    std::atomic<uint64_t> free_count;
+
+    void add(uint64_t size) {
+        allocated.fetch_add(size, std::memory_order_relaxed);
+        malloc_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void sub(uint64_t size) {
+        freed.fetch_add(size, std::memory_order_relaxed);
+        free_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    AllocDomain::Counters snapshot() const {
+        AllocDomain::Counters ret;
+        ret.allocated = allocated.load(std::memory_order_relaxed);
+        ret.freed = freed.load(std::memory_order_relaxed);
+        ret.malloc_count = malloc_count.load(std::memory_order_relaxed);
+        ret.free_count = free_count.load(std::memory_order_relaxed);
+        return ret;
+    }
+};
+
+static AtomicCounters domain_counters[AllocDomain::NUM_DOMAINS];
+
+/*
+ * Engine usage per bucket index. all_buckets is sized to
+ * COUCHBASE_MAX_NUM_BUCKETS + 1 at runtime (entry 0 is "no bucket"),
+ * so a statically sized array lets the hooks run without ever
+ * allocating.
+ */
+static AtomicCounters bucket_counters[COUCHBASE_MAX_NUM_BUCKETS + 1];
+
+static void domain_new_hook(const void* ptr, size_t size) {
+    const auto domain = current_domain;
+    if (domain == AllocationDomain::None) {
+        return;
+    }
+
+    // Prefer the allocator's view of the allocation size (which
+    // includes rounding to the size class) so that the new and delete
+    // hooks count the same number of bytes for an allocation. Not all
+    // allocators can report it; fall back to the requested size.
+    const size_t actual = mc_get_allocation_size(ptr);
+    const uint64_t nbytes = (actual != 0) ? actual : size;
+
+    domain_counters[size_t(domain)].add(nbytes);
+    if (domain == AllocationDomain::Engine) {
+        bucket_counters[current_bucket].add(nbytes);
+    }
+}
+
+static void domain_delete_hook(const void* ptr) {
+    const auto domain = current_domain;
+    if (domain == AllocationDomain::None) {
+        return;
+    }
+
+    const uint64_t nbytes = mc_get_allocation_size(ptr);
+    domain_counters[size_t(domain)].sub(nbytes);
+    if (domain == AllocationDomain::Engine) {
+        bucket_counters[current_bucket].sub(nbytes);
+    }
+}
+
+void AllocDomain::initialize() {
+    mc_add_new_hook(domain_new_hook);
+    mc_add_delete_hook(domain_delete_hook);
+}
+
+AllocDomain::Counters AllocDomain::getCounters(AllocationDomain domain) {
+    return domain_counters[size_t(domain)].snapshot();
+}
+
+AllocDomain::Counters AllocDomain::getBucketCounters(size_t bucket) {
+    return bucket_counters[bucket].snapshot();
+}
+
+const char* to_string(AllocationDomain domain) {
+    switch (domain) {
+    case AllocationDomain::None:
+        return "untracked";
+    case AllocationDomain::Connection:
+        return "connection";
+    case AllocationDomain::Engine:
+        return "engine";
+    case AllocationDomain::Audit:
+        return "audit";
+    case AllocationDomain::Sasl:
+        return "sasl";
+    case AllocationDomain::Logging:
+        return "logging";
+    }
+    return "invalid";
+}
+
+ScopedAllocDomain::ScopedAllocDomain(AllocationDomain domain)
+    : prev_domain(current_domain),
+      prev_bucket(current_bucket) {
+    current_domain = domain;
+}
+
+ScopedAllocDomain::ScopedAllocDomain(AllocationDomain domain, size_t bucket)
+    : prev_domain(current_domain),
+      prev_bucket(current_bucket) {
+    current_domain = domain;
+    current_bucket = bucket;
+}
+
+ScopedAllocDomain::~ScopedAllocDomain() {
+    current_domain = prev_domain;
+    current_bucket = prev_bucket;
+}
@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Allocation-domain tagging.
+ *
+ * The allocator hooks (see alloc_hooks.h) can tell us how much memory
+ * the process has allocated, but not on behalf of whom. When the RSS
+ * of a node grows we'd like to be able to tell connection buffers from
+ * engine data from the various support subsystems. To do that the code
+ * paths belonging to a subsystem mark themselves with a scoped domain
+ * marker (ScopedAllocDomain), and a pair of new/delete hooks registered
+ * through the normal alloc_hooks machinery charge every allocation and
+ * deallocation performed while the marker is active to a set of
+ * per-domain counters. Allocations made while no marker is active are
+ * left unattributed.
+ *
+ * For the Engine domain the marker also carries the bucket index, so
+ * the engine usage can be attributed per bucket. The counters are
+ * exposed through "stats memory" (see stat_memory_executor).
+ *
+ * Note that this is sampling by _call path_, not by ownership: memory
+ * allocated on an engine path but released on a connection path is
+ * charged as an engine allocation and a connection deallocation. Over
+ * time the per-domain (allocated - freed) deltas are therefore an
+ * approximation, but in practice a good one as the subsystems mostly
+ * release what they allocate.
+ */
+enum class AllocationDomain : uint8_t {
+    /** No marker active; the allocation is not attributed */
+    None = 0,
+    /** Connection objects and their network buffers */
+    Connection,
+    /** Calls into the engine serving a bucket */
+    Engine,
+    /** The audit daemon integration */
+    Audit,
+    /** SASL authentication */
+    Sasl,
+    /** The logging subsystem */
+    Logging
+};
+
+const char* to_string(AllocationDomain domain);
+
+class AllocDomain {
+public:
+    /** The number of entries in AllocationDomain (including None) */
+    static const size_t NUM_DOMAINS = 6;
+
+    /**
+     * The counters recorded for a domain (or for the engine usage of
+     * a single bucket).
+     */
+    struct Counters {
+        /** Bytes allocated on paths marked with the domain */
+        uint64_t allocated;
+        /** Bytes released on paths marked with the domain */
+        uint64_t freed;
+        /** Number of allocations */
+        uint64_t malloc_count;
+        /** Number of deallocations */
+        uint64_t free_count;
+    };
+
+    /**
+     * Register the new/delete hooks with the allocator. Called once
+     * during startup (right after AllocHooks::initialize()).
+     */
+    static void initialize();
+
+    /** Get a snapshot of the counters for the given domain */
+    static Counters getCounters(AllocationDomain domain);
+
+    /**
+     * Get a snapshot of the engine-domain counters for the given
+     * bucket index
+     */
+    static Counters getBucketCounters(size_t bucket);
+};
+
+/**
+ * RAII marker which tags all allocations performed by the current
+ * thread with the given domain for the duration of its scope. Markers
+ * nest; the previous domain is restored on destruction.
+ */
+class ScopedAllocDomain {
+public:
+    ScopedAllocDomain(AllocationDomain domain);
+
+    /**
+     * Mark an engine call on behalf of the given bucket index, so
+     * that the usage is also attributed to the bucket.
+     */
+    ScopedAllocDomain(AllocationDomain domain, size_t bucket);
+
+    ~ScopedAllocDomain();
+
+    ScopedAllocDomain(const ScopedAllocDomain&) = delete;
+
+private:
+    AllocationDomain prev_domain;
+    size_t prev_bucket;
+};
@@ -49,3 +49,19 @@ static inline void mc_release_free_memory(void) {
 static inline bool mc_enable_thread_cache(bool enable) {
     return AllocHooks::enable_thread_cache(enable);
 }
+static inline unsigned mc_arena_create(void) {
+    return AllocHooks::arena_create();
+}
+static inline void mc_arena_destroy(unsigned arena) {
+    AllocHooks::arena_destroy(arena);
+}
+static inline void mc_arena_purge(unsigned arena) {
+    AllocHooks::arena_purge(arena);
+}
+static inline unsigned mc_arena_switch_thread(unsigned arena) {
+    return AllocHooks::arena_switch_thread(arena);
+}
+static inline bool mc_set_arena_decay_time(unsigned arena,
+                                           ssize_t decay_time) {
+    return AllocHooks::set_arena_decay_time(arena, decay_time);
+}
@@ -230,3 +230,23 @@ bool mc_get_allocator_property(const char* name, size_t* value) {
 bool mc_set_allocator_property(const char* name, size_t value) {
     return false;
 }
+
+unsigned mc_arena_create() {
+    return 0;
+}
+
+void mc_arena_destroy(unsigned arena) {
+    // empty
+}
+
+void mc_arena_purge(unsigned arena) {
+    // empty
+}
+
+unsigned mc_arena_switch_thread(unsigned arena) {
+    return 0;
+}
+
+bool mc_set_arena_decay_time(unsigned arena, ssize_t decay_time) {
+    return false;
+}
@@ -78,3 +78,24 @@ bool DummyAllocHooks::get_allocator_property(const char* name, size_t* value) {
 bool DummyAllocHooks::set_allocator_property(const char* name, size_t value) {
     return false;
 }
+
+unsigned DummyAllocHooks::arena_create() {
+    return 0;
+}
+
+void DummyAllocHooks::arena_destroy(unsigned arena) {
+    // empty
+}
+
+void DummyAllocHooks::arena_purge(unsigned arena) {
+    // empty
+}
+
+unsigned DummyAllocHooks::arena_switch_thread(unsigned arena) {
+    return 0;
+}
+
+bool DummyAllocHooks::set_arena_decay_time(unsigned arena,
+                                           ssize_t decay_time) {
+    return false;
+}
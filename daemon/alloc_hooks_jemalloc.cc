@@ -17,6 +17,8 @@
 #include "config.h"
 #include "alloc_hooks.h"
 #include <stdbool.h>
+#include <mutex>
+#include <vector>
 
 #include "memcached/visibility.h"
 #include <memcached/extension_loggers.h>
@@ -241,3 +243,85 @@ bool JemallocHooks::set_allocator_property(const char* name, size_t value) {
     /* Not yet implemented */
     return 0;
 }
+
+/* Arena indices already created but currently without an owner.
+ * jemalloc can't remove an arena once it has been created, so instead
+ * of growing the arena count forever when buckets are deleted and
+ * recreated, arena_destroy() purges the arena and parks the index
+ * here for the next arena_create() to reuse.
+ */
+static std::vector<unsigned> arena_free_list;
+static std::mutex arena_free_list_mutex;
+
+unsigned JemallocHooks::arena_create() {
+    {
+        std::lock_guard<std::mutex> guard(arena_free_list_mutex);
+        if (!arena_free_list.empty()) {
+            unsigned arena = arena_free_list.back();
+            arena_free_list.pop_back();
+            return arena;
+        }
+    }
+
+    unsigned arena;
+    size_t sz = sizeof(arena);
+    int err = je_mallctl("arenas.extend", &arena, &sz, NULL, 0);
+    if (err != 0) {
+        get_stderr_logger()->log(EXTENSION_LOG_WARNING, NULL,
+                                 "jemalloc arena_create() error %d - "
+                                     "could not extend arenas.", err);
+        return 0;
+    }
+    return arena;
+}
+
+void JemallocHooks::arena_purge(unsigned arena) {
+    if (arena == 0) {
+        /* Arena 0 is the shared default arena; purging it is the job
+         * of release_free_memory(). */
+        return;
+    }
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "arena.%u.purge", arena);
+    int err = je_mallctl(cmd, NULL, NULL, NULL, 0);
+    if (err != 0) {
+        get_stderr_logger()->log(EXTENSION_LOG_WARNING, NULL,
+                                 "jemalloc arena_purge(%u) error %d.",
+                                 arena, err);
+    }
+}
+
+void JemallocHooks::arena_destroy(unsigned arena) {
+    if (arena == 0) {
+        return;
+    }
+    /* Return the dirty pages to the OS right away; anything the owner
+     * leaked stays mapped but contained within this arena. */
+    arena_purge(arena);
+
+    std::lock_guard<std::mutex> guard(arena_free_list_mutex);
+    arena_free_list.push_back(arena);
+}
+
+unsigned JemallocHooks::arena_switch_thread(unsigned arena) {
+    unsigned old = 0;
+    size_t sz = sizeof(old);
+    int err = je_mallctl("thread.arena", &old, &sz, &arena, sizeof(arena));
+    if (err != 0) {
+        get_stderr_logger()->log(EXTENSION_LOG_WARNING, NULL,
+                                 "jemalloc arena_switch_thread(%u) error %d.",
+                                 arena, err);
+        return 0;
+    }
+    return old;
+}
+
+bool JemallocHooks::set_arena_decay_time(unsigned arena, ssize_t decay_time) {
+    /* Requires jemalloc built with opt.purge:decay (4.1 or newer);
+     * on older versions the mallctl doesn't exist and we report the
+     * property as unsupported. */
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "arena.%u.decay_time", arena);
+    return je_mallctl(cmd, NULL, NULL, &decay_time,
+                      sizeof(decay_time)) == 0;
+}
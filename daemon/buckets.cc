@@ -15,6 +15,46 @@
  *   limitations under the License.
  */
 #include "buckets.h"
+#include "settings.h"
+
+std::atomic<int> buckets_with_topkeys(0);
+
+void bucket_set_topkeys_budget(Bucket& bucket, int budget) {
+    TopKeys* replacement = nullptr;
+    if (budget > 0) {
+        replacement = new TopKeys(budget, settings.isTopkeysSketchEnabled());
+    }
+
+    cb_mutex_enter(&bucket.mutex);
+    TopKeys* old = bucket.topkeys.exchange(replacement);
+    if (old != nullptr) {
+        /* An in-flight operation may still hold the old pointer, so
+         * park the instance until the bucket is destroyed instead of
+         * freeing it here */
+        bucket.retired_topkeys.push_back(old);
+    }
+    bucket.topkeys_budget = budget;
+    cb_mutex_exit(&bucket.mutex);
+
+    if (old == nullptr && replacement != nullptr) {
+        buckets_with_topkeys++;
+    } else if (old != nullptr && replacement == nullptr) {
+        buckets_with_topkeys--;
+    }
+}
+
+void bucket_destroy_topkeys(Bucket& bucket) {
+    TopKeys* tk = bucket.topkeys.exchange(nullptr);
+    if (tk != nullptr) {
+        delete tk;
+        buckets_with_topkeys--;
+    }
+    for (auto* retired : bucket.retired_topkeys) {
+        delete retired;
+    }
+    bucket.retired_topkeys.clear();
+    bucket.topkeys_budget = 0;
+}
 
 Bucket::Bucket(const Bucket& other)
 {
@@ -22,17 +62,28 @@ Bucket::Bucket(const Bucket& other)
 
     cb_mutex_initialize(&mutex);
     cb_cond_initialize(&cond);
-    clients = other.clients;
+    clients = other.clients.load();
     state = other.state.load();
     type = other.type;
     std::copy(std::begin(other.name), std::end(other.name),
               std::begin(name));
     engine_event_handlers = other.engine_event_handlers;
     engine = other.engine;
+    arena = other.arena;
     stats = other.stats;
+    stats_baseline = other.stats_baseline;
     timings = other.timings;
+    ops_throttle = other.ops_throttle;
+    bytes_throttle = other.bytes_throttle;
+    throttle_events = other.throttle_events;
+    opcode_filter = other.opcode_filter;
+    rejected_ops = other.rejected_ops;
+    sched_ns = other.sched_ns;
+    sched_deferrals = other.sched_deferrals;
     subjson_operation_times = other.subjson_operation_times;
-    topkeys = other.topkeys;
+    topkeys = other.topkeys.load();
+    topkeys_budget = other.topkeys_budget;
+    retired_topkeys = other.retired_topkeys;
 
     cb_mutex_exit(&other.mutex);
 }
@@ -18,15 +18,23 @@
 
 #include <memcached/engine.h>
 #include <array>
+#include <atomic>
 #include <cstring>
+#include <memory>
 #include <vector>
 #include <platform/thread.h>
 
+#include "alloc_hooks.h"
 #include "connection.h"
 #include "cookie.h"
 #include "function_chain.h"
 #include "mcbp_validators.h"
+#include "opcode_filter.h"
+#include "resource_accounting.h"
+#include "stats.h"
+#include "stats_snapshot.h"
 #include "timings.h"
+#include "token_bucket.h"
 #include "topkeys.h"
 #include "task.h"
 
@@ -53,7 +61,8 @@ enum class BucketType : uint8_t {
     NoBucket,
     Memcached,
     Couchstore,
-    EWouldBlock
+    EWouldBlock,
+    Crash
 };
 
 inline const char *to_string(const BucketType &type) {
@@ -64,6 +73,8 @@ inline const char *to_string(const BucketType &type) {
         return "Couchstore";
     case BucketType::EWouldBlock:
         return "EWouldBlock";
+    case BucketType::Crash:
+        return "Crash";
     case BucketType::NoBucket:
         return "No Bucket";
     case BucketType::Unknown:
@@ -89,8 +100,10 @@ public:
         : clients(0),
           state(BucketState::None),
           type(BucketType::Unknown),
+          arena(0),
           stats(nullptr),
-          topkeys(nullptr)
+          topkeys(nullptr),
+          topkeys_budget(0)
     {
         std::memset(name, 0, sizeof(name));
         cb_mutex_initialize(&mutex);
@@ -121,6 +134,15 @@ public:
                                                 protocol_binary_command command,
                                                 Cookie& cookie);
 
+    /**
+     * Check if the connected bucket has registered additional (non
+     * default) validators for the given command. When it has, the
+     * fused dispatch entries in mcbp_executors.cc can't validate the
+     * header inline and fall back to running the full chain.
+     */
+    static bool mcbpCommandHasExtraValidators(const Connection* c,
+                                              protocol_binary_command command);
+
     /**
      * Mutex protecting the state and refcount. (@todo move to std::mutex).
      */
@@ -129,9 +151,11 @@ public:
 
     /**
      * The number of clients currently connected to the bucket (performed
-     * a SASL_AUTH to the bucket.
+     * a SASL_AUTH to the bucket. Atomic so that connections may register
+     * and deregister without acquiring the mutex (see associate_bucket()
+     * for the protocol used on the lock free path).
      */
-    uint32_t clients;
+    std::atomic<uint32_t> clients;
 
     /**
      * The current state of the bucket. Atomic as we permit it to be
@@ -164,25 +188,185 @@ public:
      */
     ENGINE_HANDLE_V1 *engine; /* Pointer to the bucket */
 
+    /**
+     * The allocator arena dedicated to the engine of this bucket (0
+     * when the bucket has none, or the allocator doesn't support
+     * arenas). Giving each bucket its own arena contains the heap
+     * fragmentation its workload causes, and lets deleting the bucket
+     * return the memory to the OS by purging the arena. The calling
+     * thread is bound to the arena around engine calls by
+     * ScopedBucketArena (see the bucket_* wrappers in memcached.h).
+     */
+    unsigned arena;
+
     /**
      * Statistics array, one per front-end thread.
      */
     struct thread_stats *stats;
 
+    /**
+     * The aggregated value of the counters above at the last
+     * "stats reset" for this bucket. Resetting takes a snapshot here
+     * instead of zeroing every worker's slice - which would write to
+     * every worker's (contended, cache line aligned) counters and
+     * race their increments - and the reporting side differences the
+     * current aggregate against the snapshot. See stats_reset().
+     */
+    struct thread_stats stats_baseline;
+
     /**
      * Command timing data
      */
     Timings timings;
 
+    /**
+     * Per-opcode resource accounting (operation counts, bytes in/out
+     * and the engine/daemon time split). Not copied by the copy
+     * constructor; the aggregated view in bucket 0 is maintained
+     * directly by mcbp_collect_timings.
+     */
+    ResourceAccounting rusage;
+
+    /**
+     * Token buckets limiting the operations per second and the bytes
+     * (in + out) per second the bucket's clients may consume on this
+     * node, so one tenant can't monopolize it. The limits default to
+     * 0 (unlimited) and are set over ioctl (bucket.throttle.*).
+     * Enforced at the command boundary in conn_new_cmd; a connection
+     * hitting an empty bucket backs off with a timed event instead of
+     * burning the worker thread.
+     */
+    TokenBucket ops_throttle;
+    TokenBucket bytes_throttle;
+
+    /**
+     * The number of times a connection entered a throttle backoff
+     * because one of the token buckets above ran empty.
+     */
+    Couchbase::RelaxedAtomic<uint64_t> throttle_events;
+
+    /**
+     * The opcodes the bucket's clients may issue. Defaults to all of
+     * them; restricted over ioctl (bucket.opcode_filter) for buckets
+     * fronted with a reduced protocol surface. Checked with a single
+     * load and bit test before the validator and privilege chains run
+     * (see process_bin_packet), and commands rejected that way are
+     * counted in rejected_ops below.
+     */
+    OpcodeFilter opcode_filter;
+
+    /**
+     * The number of commands rejected by the opcode filters (the
+     * bucket's own or the listening interface's).
+     */
+    Couchbase::RelaxedAtomic<uint64_t> rejected_ops;
+
+    /**
+     * May the bucket's clients be handed more work at the given time?
+     */
+    bool throttleGate(rel_time_t now) {
+        return ops_throttle.gate(now) && bytes_throttle.gate(now);
+    }
+
+    /**
+     * The worker-thread time (in nanoseconds) consumed driving this
+     * bucket's connections from the pending io queues, and the number
+     * of times the fair scheduler pushed the remainder of the
+     * bucket's queue back because it had used up its quantum (see
+     * scheduler_quantum_us and drain_pending_io() in thread.cc).
+     * Reported by "stats scheduler".
+     */
+    Couchbase::RelaxedAtomic<uint64_t> sched_ns;
+    Couchbase::RelaxedAtomic<uint64_t> sched_deferrals;
+
     /**
      *  Sub-document JSON parser (subjson) operation execution time histogram.
      */
     TimingHistogram subjson_operation_times;
 
     /**
-     * Topkeys
+     * Topkeys. Tracking is optional per bucket: the pointer is null
+     * while tracking is disabled (the hot-path hook never goes past a
+     * counter check in that case), and it may be swapped at runtime
+     * through ioctl (bucket.topkeys.size). Readers load it without
+     * the bucket mutex, so a replaced instance is parked on
+     * retired_topkeys below rather than freed in place.
+     */
+    std::atomic<TopKeys*> topkeys;
+
+    /**
+     * The key budget the current topkeys instance was created with
+     * (keys per shard / sketch); 0 while tracking is disabled.
+     * Guarded by the bucket mutex - the hot path follows the pointer
+     * above instead.
+     */
+    int topkeys_budget;
+
+    /**
+     * TopKeys instances replaced over ioctl while the bucket was live.
+     * An in-flight operation may still be updating the old instance
+     * when it is swapped out, so it is kept (guarded by the bucket
+     * mutex) until the bucket is destroyed.
+     */
+    std::vector<TopKeys*> retired_topkeys;
+
+    /**
+     * Cached rendering of the "stats topkeys_json" document. The
+     * renderer visits every shard under its lock (or merges the
+     * per-worker sketches), and monitoring polls the command at a
+     * fixed cadence on every node - so requests within the
+     * stats_snapshot_age window are served from this cache and never
+     * touch the shard locks. Not copied by the copy constructor.
+     */
+    struct TopkeysJsonSnapshot {
+        TopkeysJsonSnapshot() : timestamp(0) {}
+
+        /** Throw away the cached document (bucket deleted etc) */
+        void invalidate() {
+            std::lock_guard<std::mutex> guard(mutex);
+            payload.clear();
+            timestamp = 0;
+        }
+
+        std::mutex mutex;
+        /** The rendered document ("" = nothing cached) */
+        std::string payload;
+        /** When the payload was rendered */
+        rel_time_t timestamp;
+    } topkeys_json_snapshot;
+
+    /**
+     * Cached serialization of the plain "stats" response (see
+     * StatsSnapshot). Not copied by the copy constructor - a copy
+     * starts with a cold cache.
      */
-    TopKeys *topkeys;
+    StatsSnapshot stats_snapshot;
+
+    /**
+     * Cached copy of the cluster map blob shipped with NOT_MY_VBUCKET
+     * errors (see get_vb_map_cb). During a rebalance every misdirected
+     * request gets the very same map, so the first response for a
+     * given map revision renders the immutable blob once and everybody
+     * else just references it from their iovecs. Not copied by the
+     * copy constructor - a copy starts with a cold cache.
+     */
+    struct NmvbMapSnapshot {
+        NmvbMapSnapshot() : revno(-1) {}
+
+        /** Throw away the cached map (bucket deleted etc); in-flight
+         * responses keep their reference alive */
+        void invalidate() {
+            std::lock_guard<std::mutex> guard(mutex);
+            payload.reset();
+            revno = -1;
+        }
+
+        std::mutex mutex;
+        /** The cached map (nullptr = nothing cached) */
+        std::shared_ptr<const std::string> payload;
+        /** The clustermap revision the payload describes (-1: none) */
+        int revno;
+    } nmvb_map_snapshot;
 
     /**
      * The validator chains to use for this bucket when receiving MCBP commands.
@@ -210,6 +394,58 @@ extern const char* getBucketName(const Connection* c);
  */
 extern std::vector<Bucket> all_buckets;
 
+/**
+ * The number of buckets currently tracking topkeys. The hot-path hook
+ * (update_topkeys) bails out on a single relaxed load of this counter
+ * when it is zero, so deployments with tracking disabled pay one
+ * perfectly predicted branch per operation and nothing else.
+ */
+extern std::atomic<int> buckets_with_topkeys;
+
+/**
+ * Enable, resize or disable (budget 0) topkeys tracking for a bucket.
+ * Takes the bucket mutex; a replaced instance is retired rather than
+ * freed (see Bucket::retired_topkeys). May throw std::bad_alloc.
+ */
+void bucket_set_topkeys_budget(Bucket& bucket, int budget);
+
+/**
+ * Free the bucket's topkeys instance (if any) together with the
+ * retired ones. Only to be called when no operations can be in flight
+ * for the bucket (i.e. while it is being destroyed).
+ */
+void bucket_destroy_topkeys(Bucket& bucket);
+
+/**
+ * RAII helper binding the calling thread to the allocator arena of the
+ * given bucket (see Bucket::arena) for the duration of its scope, so
+ * that the memory the engine allocates comes from (and returns to) the
+ * bucket's own arena. A no-op when the bucket has no arena.
+ */
+class ScopedBucketArena {
+public:
+    ScopedBucketArena(size_t bucket)
+        : prev(0), switched(false) {
+        const unsigned arena = all_buckets[bucket].arena;
+        if (arena != 0) {
+            prev = mc_arena_switch_thread(arena);
+            switched = true;
+        }
+    }
+
+    ~ScopedBucketArena() {
+        if (switched) {
+            mc_arena_switch_thread(prev);
+        }
+    }
+
+    ScopedBucketArena(const ScopedBucketArena&) = delete;
+
+private:
+    unsigned prev;
+    bool switched;
+};
+
 cJSON *get_bucket_details(int idx);
 
 /**
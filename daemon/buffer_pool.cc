@@ -0,0 +1,119 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "buffer_pool.h"
+
+#include <platform/cb_malloc.h>
+
+#include <cstdint>
+
+/**
+ * Bookkeeping preceding the data area of every segment. While a
+ * segment sits in a free list the header doubles as the list link, so
+ * pooling a segment needs no allocation of its own.
+ */
+struct SegmentHeader {
+    /** Next segment in the free list (only while pooled) */
+    SegmentHeader* next;
+    /** Usable bytes in the data area following the header */
+    size_t size;
+};
+
+/* Size classes cover MIN_SEGMENT_SIZE .. MAX_POOLED_SIZE */
+static const int MIN_CLASS_SHIFT = 10;
+static const int MAX_CLASS_SHIFT = 20;
+static const int NUM_CLASSES = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+
+/*
+ * The per-thread free lists. Thread local so the hot path is lock
+ * free; a connection is always served by its worker thread, so a
+ * segment is released on the thread that allocated it.
+ */
+static thread_local SegmentHeader* free_list[NUM_CLASSES];
+static thread_local unsigned free_count[NUM_CLASSES];
+
+/** Map a (power of two) segment size to its class index */
+static int size_class(size_t size) {
+    int cls = 0;
+    size_t span = BufferPool::MIN_SEGMENT_SIZE;
+    while (span < size) {
+        span <<= 1;
+        ++cls;
+    }
+    return cls;
+}
+
+/**
+ * How many idle segments of the given size a thread may keep. The big
+ * classes are capped harder so an occasional huge stats response
+ * doesn't leave megabytes parked on every worker.
+ */
+static unsigned free_list_limit(size_t size) {
+    return size <= 64 * 1024 ? 8 : 2;
+}
+
+char* BufferPool::allocate(size_t& size) {
+    size_t nsize = MIN_SEGMENT_SIZE;
+    while (nsize < size) {
+        if (nsize > (SIZE_MAX >> 1)) {
+            return nullptr;
+        }
+        nsize <<= 1;
+    }
+
+    SegmentHeader* header = nullptr;
+    if (nsize <= MAX_POOLED_SIZE) {
+        const int cls = size_class(nsize);
+        if (free_list[cls] != nullptr) {
+            header = free_list[cls];
+            free_list[cls] = header->next;
+            --free_count[cls];
+        }
+    }
+
+    if (header == nullptr) {
+        header = reinterpret_cast<SegmentHeader*>(
+            cb_malloc(sizeof(SegmentHeader) + nsize));
+        if (header == nullptr) {
+            return nullptr;
+        }
+        header->size = nsize;
+    }
+
+    header->next = nullptr;
+    size = nsize;
+    return reinterpret_cast<char*>(header + 1);
+}
+
+void BufferPool::release(char* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    auto* header = reinterpret_cast<SegmentHeader*>(ptr) - 1;
+    if (header->size <= MAX_POOLED_SIZE) {
+        const int cls = size_class(header->size);
+        if (free_count[cls] < free_list_limit(header->size)) {
+            header->next = free_list[cls];
+            free_list[cls] = header;
+            ++free_count[cls];
+            return;
+        }
+    }
+
+    cb_free(header);
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+
+/**
+ * A recycler for the power-of-two sized segments backing response
+ * buffers (see DynamicBuffer).
+ *
+ * Large responses (stats, cluster maps) used to be allocated and freed
+ * per request, so every connection paid the allocator for memory an
+ * identically sized response released moments earlier. The pool keeps
+ * a small free list per size class on each thread; since a connection
+ * is always driven by its worker thread, both allocate and release
+ * happen on the owning thread and the free lists need no locking.
+ *
+ * Segments are self-describing (a header precedes the data area), so
+ * ownership of a segment may be passed around as a plain pointer and
+ * handed back with release() alone.
+ */
+class BufferPool {
+public:
+    /** Segments are never smaller than this (must be a power of two) */
+    static const size_t MIN_SEGMENT_SIZE = 1024;
+
+    /**
+     * Segments above this size are still served (rounded to a power of
+     * two), but go straight back to the allocator on release rather
+     * than sitting idle in a free list.
+     */
+    static const size_t MAX_POOLED_SIZE = 1024 * 1024;
+
+    /**
+     * Allocate a segment with at least <em>size</em> usable bytes.
+     *
+     * @param size in: the number of bytes needed; out: the usable size
+     *             of the returned segment (the next power of two)
+     * @return pointer to the data area, or nullptr on allocation
+     *         failure (size is left untouched)
+     */
+    static char* allocate(size_t& size);
+
+    /**
+     * Hand a segment obtained from allocate() back to the pool (or the
+     * allocator, if the thread's free list for its size class is full).
+     */
+    static void release(char* ptr);
+};
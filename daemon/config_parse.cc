@@ -79,6 +79,20 @@ bool validate_proposed_config_changes(const char* new_cfg, cJSON* errors) {
     return false;
 }
 
+void apply_config_delta(const std::string& delta) {
+    unique_cJSON_ptr json(cJSON_Parse(delta.c_str()));
+    if (!json) {
+        throw std::invalid_argument("JSON parse error");
+    }
+
+    /* The Settings constructor runs the per-key handler (and its
+     * validation) for exactly the keys present in the delta, and
+     * updateSettings only applies the fields flagged as present - so
+     * a delta push never revisits the unchanged configuration. */
+    Settings new_settings(json);
+    settings.updateSettings(new_settings, true);
+}
+
 void reload_config_file(void) {
     LOG_NOTICE(NULL, "Reloading config file %s", get_config_file());
 
@@ -43,4 +43,17 @@ bool validate_proposed_config_changes(const char* new_cfg, cJSON* errors);
  */
 void reload_config_file(void);
 
+/* Apply a configuration delta pushed over the admin surface (ioctl
+ * "config.push"). The delta is a JSON object holding only the keys
+ * which changed; each key is validated by its own settings handler and
+ * applied through the normal change-listener machinery. Unlike
+ * reload_config_file this neither touches the disk nor revisits the
+ * unchanged part of the configuration.
+ *
+ * Throws (std::invalid_argument and friends) on malformed JSON, failed
+ * validation or an attempt to change a setting which can't be changed
+ * at runtime.
+ */
+void apply_config_delta(const std::string& delta);
+
 #endif /* CONFIG_PARSE_H */
@@ -16,6 +16,7 @@
  */
 #include "config.h"
 #include "memcached.h"
+#include "connections.h"
 #include "runtime.h"
 #include "statemachine_mcbp.h"
 
@@ -64,13 +65,20 @@ Connection::Connection(SOCKET sfd, event_base* b)
       engine_storage(nullptr),
       next(nullptr),
       thread(nullptr),
+      thread_registry_slot(0),
       parent_port(0),
+      experiment_eligible(0),
+      experiment_treatment(0),
+      iface_opcode_filter(nullptr),
       bucketEngine(nullptr),
       peername("unknown"),
       sockname("unknown"),
       priority(Priority::Medium),
       clustermap_revno(-2),
-      trace_enabled(false) {
+      trace_enabled(false),
+      privilegeCheckEpoch(0),
+      privilegeCheckKnown(),
+      privilegeCheckOk() {
     MEMCACHED_CONN_CREATE(this);
     bucketIndex.store(0);
 }
@@ -80,6 +88,9 @@ Connection::Connection(SOCKET sock,
                        const struct listening_port& interface)
     : Connection(sock, b) {
     parent_port = interface.port;
+    /* The interface lives in stats.listening_ports which is only
+     * built during startup, so the pointer stays valid */
+    iface_opcode_filter = &interface.opcode_filter;
     resolveConnectionName(false);
     setTcpNoDelay(interface.tcp_nodelay);
 }
@@ -92,6 +103,15 @@ Connection::~Connection() {
     }
 }
 
+void Connection::setThread(LIBEVENT_THREAD* thread) {
+    auto* old = Connection::thread.load(std::memory_order_relaxed);
+    if (old != thread) {
+        conn_update_thread_registration(this, old, thread);
+    }
+    Connection::thread.store(thread,
+                             std::memory_order::memory_order_relaxed);
+}
+
 /**
  * Convert a sockaddr_storage to a textual string (no name lookup).
  *
@@ -220,6 +240,21 @@ const char* to_string(const Protocol& protocol) {
     }
 }
 
+const char* to_string(const EventPriority& priority) {
+    switch (priority) {
+    case EventPriority::High:
+        return "high";
+    case EventPriority::Medium:
+        return "medium";
+    case EventPriority::Low:
+        return "low";
+    case EventPriority::Default:
+        return "default";
+    }
+    throw std::invalid_argument("to_string(EventPriority): unknown value " +
+                                std::to_string(int(priority)));
+}
+
 const char* to_string(const ConnectionState& connectionState) {
     switch (connectionState) {
     case ConnectionState::ESTABLISHED:
@@ -295,6 +330,52 @@ void Connection::restartAuthentication() {
     admin = false;
     authenticated = false;
     username = "";
+    invalidatePrivilegeCache();
+}
+
+bool Connection::getCachedPrivilegeCheck(uint8_t opcode,
+                                         PrivilegeAccess& access) const {
+    const uint64_t epoch = get_privilege_epoch();
+    if (epoch != privilegeCheckEpoch) {
+        /* Someone (re)authenticated or switched bucket since the
+         * results were recorded; drop them all */
+        privilegeCheckKnown.fill(0);
+        privilegeCheckEpoch = epoch;
+        return false;
+    }
+
+    const uint32_t bit = uint32_t(1) << (opcode % 32);
+    if ((privilegeCheckKnown[opcode / 32] & bit) == 0) {
+        return false;
+    }
+
+    access = (privilegeCheckOk[opcode / 32] & bit) ? PrivilegeAccess::Ok
+                                                   : PrivilegeAccess::Fail;
+    return true;
+}
+
+void Connection::setCachedPrivilegeCheck(uint8_t opcode,
+                                         PrivilegeAccess access) const {
+    if (access == PrivilegeAccess::Stale) {
+        return;
+    }
+
+    /* If the epoch moved between the lookup and this store the result
+     * is recorded under the old epoch and thrown away on the next
+     * lookup. That is safe: our own privileges can only change from
+     * the thread running the connection, so a concurrent bump can
+     * never refer to a change affecting this connection. */
+    const uint32_t bit = uint32_t(1) << (opcode % 32);
+    privilegeCheckKnown[opcode / 32] |= bit;
+    if (access == PrivilegeAccess::Ok) {
+        privilegeCheckOk[opcode / 32] |= bit;
+    } else {
+        privilegeCheckOk[opcode / 32] &= ~bit;
+    }
+}
+
+void Connection::invalidatePrivilegeCache() {
+    bump_privilege_epoch();
 }
 
 /**
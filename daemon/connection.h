@@ -18,10 +18,12 @@
 
 #include "config.h"
 
+#include "opcode_filter.h"
 #include "settings.h"
 
 #include <cJSON.h>
 #include <cbsasl/cbsasl.h>
+#include <array>
 #include <string>
 
 struct LIBEVENT_THREAD;
@@ -126,6 +128,7 @@ public:
 
     void setAdmin(bool admin) {
         Connection::admin = admin;
+        invalidatePrivilegeCache();
     }
 
     bool isAuthenticated() const {
@@ -144,6 +147,19 @@ public:
         }
 
         username.assign(reinterpret_cast<const char*>(unm));
+        invalidatePrivilegeCache();
+    }
+
+    /**
+     * Restore an authenticated identity without a SASL exchange. Used
+     * by session resumption, where the identity comes from a token the
+     * server itself sealed when the user originally authenticated
+     * (and whose MAC has already been verified).
+     */
+    void restoreAuthentication(const std::string& user) {
+        authenticated = true;
+        username = user;
+        invalidatePrivilegeCache();
     }
 
 
@@ -210,9 +226,24 @@ public:
         return thread.load(std::memory_order_relaxed);
     }
 
-    void setThread(LIBEVENT_THREAD* thread) {
-        Connection::thread.store(thread,
-                                 std::memory_order::memory_order_relaxed);
+    /**
+     * Hand the connection over to (or take it away from) a worker
+     * thread. Also keeps the per-thread connection registries in sync
+     * (see connections.cc), which is why it isn't inline.
+     */
+    void setThread(LIBEVENT_THREAD* thread);
+
+    /**
+     * The slot this connection occupies in its owning thread's
+     * connection registry; only the registry code in connections.cc
+     * should touch this.
+     */
+    uint32_t getThreadRegistrySlot() const {
+        return thread_registry_slot;
+    }
+
+    void setThreadRegistrySlot(uint32_t slot) {
+        thread_registry_slot = slot;
     }
 
     /**
@@ -244,6 +275,39 @@ public:
         Connection::parent_port = parent_port;
     }
 
+    /**
+     * The connection's A/B experiment eligibility mask (bit ii set
+     * when the connection counts towards experiment ii; see
+     * experiments.h). Evaluated once at accept.
+     */
+    uint32_t getExperimentEligible() const {
+        return experiment_eligible;
+    }
+
+    /**
+     * The connection's A/B experiment treatment mask (bit ii set when
+     * the connection is in the treatment arm of experiment ii).
+     * Feature code gates its experimental path on this.
+     */
+    uint32_t getExperimentTreatment() const {
+        return experiment_treatment;
+    }
+
+    void setExperiments(uint32_t eligible, uint32_t treatment) {
+        experiment_eligible = eligible;
+        experiment_treatment = treatment;
+    }
+
+    /**
+     * The opcode acceptance filter of the interface the connection was
+     * accepted on, or nullptr when there is none (e.g. the pipe
+     * connection). Cached here so the packet path doesn't have to look
+     * the listening port up by number.
+     */
+    const OpcodeFilter* getInterfaceOpcodeFilter() const {
+        return iface_opcode_filter;
+    }
+
     virtual bool isTAP() const {
         return false;
     }
@@ -262,6 +326,36 @@ public:
      */
     PrivilegeAccess checkPrivilege(const Privilege& privilege) const;
 
+    /**
+     * Look up the memoized result of the per-opcode privilege chain
+     * for the given opcode. The memoized results are dropped whenever
+     * the privilege epoch moves (a connection authenticated, selected
+     * another bucket etc; see get_privilege_epoch()), so in the common
+     * case the privilege check for a command boils down to a bitmap
+     * test instead of walking the function chain.
+     *
+     * @param opcode the opcode to look up
+     * @param access where to store the memoized result
+     * @return true if a memoized result existed
+     */
+    bool getCachedPrivilegeCheck(uint8_t opcode, PrivilegeAccess& access) const;
+
+    /**
+     * Memoize the result of the privilege chain for the given opcode.
+     * Stale results are not memoized as they should be re-evaluated
+     * every time.
+     *
+     * @param opcode the opcode the chain was evaluated for
+     * @param access the result of the evaluation
+     */
+    void setCachedPrivilegeCheck(uint8_t opcode, PrivilegeAccess access) const;
+
+    /**
+     * Throw away all memoized privilege check results (for every
+     * connection) by bumping the privilege epoch.
+     */
+    void invalidatePrivilegeCache();
+
     int getBucketIndex() const {
         return bucketIndex.load(std::memory_order_relaxed);
     }
@@ -377,9 +471,22 @@ protected:
     /** Pointer to the thread object serving this connection */
     std::atomic<LIBEVENT_THREAD*> thread;
 
+    /** Index of this connection's slot in the owning thread's
+     * connection registry (see connections.cc); only meaningful while
+     * thread is non-null. */
+    uint32_t thread_registry_slot;
+
     /** Listening port that creates this connection instance */
     in_port_t parent_port;
 
+    /** A/B experiment masks, evaluated at accept (see experiments.h) */
+    uint32_t experiment_eligible;
+    uint32_t experiment_treatment;
+
+    /** The opcode acceptance filter of that listening port (nullptr
+     * when the connection wasn't accepted on one) */
+    const OpcodeFilter* iface_opcode_filter;
+
     /**
      * The index of the connected bucket
      */
@@ -414,6 +521,18 @@ protected:
      * stripped off before sending on the wire)
      */
      bool dcp_xattr_support;
+
+    /**
+     * The memoized per-opcode privilege check results (one bit telling
+     * if an entry is recorded, one with its outcome) and the privilege
+     * epoch they were recorded under. Only touched by the worker
+     * thread currently running the connection, hence no locking
+     * (mutable since recording a result doesn't change the observable
+     * state of the connection).
+     */
+    mutable uint64_t privilegeCheckEpoch;
+    mutable std::array<uint32_t, 8> privilegeCheckKnown;
+    mutable std::array<uint32_t, 8> privilegeCheckOk;
 };
 
 /**
@@ -18,6 +18,8 @@
 
 #include "connection.h"
 
+#include <vector>
+
 /**
  * The state of the connection.
  */
@@ -78,8 +80,21 @@ public:
 
     virtual void runEventLoop(short) override;
 
+    /**
+     * Get the connection's frame encode buffer. Responses are encoded
+     * into this buffer (which keeps its allocation from message to
+     * message) instead of a fresh vector per response, so steady state
+     * encoding doesn't allocate.
+     */
+    std::vector<uint8_t>& getFrameEncodeBuffer() {
+        return frameEncodeBuffer;
+    }
+
 protected:
 
     /** The state of the connection (used by greenstack only) */
     ConnectionState connectionState;
+
+    /** Reusable buffer response frames are encoded into */
+    std::vector<uint8_t> frameEncodeBuffer;
 };
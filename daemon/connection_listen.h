@@ -36,7 +36,8 @@ public:
                      event_base* b,
                      in_port_t port,
                      sa_family_t fam,
-                     const struct interface &interf);
+                     const struct interface &interf,
+                     LIBEVENT_THREAD* workerThread = nullptr);
 
     virtual ~ListenConnection();
 
@@ -54,6 +55,28 @@ public:
         return management;
     }
 
+    /**
+     * Get the worker thread owning this listener when listener sharding
+     * (SO_REUSEPORT) is in use. Connections accepted on such a listener
+     * are created directly on the owning thread, bypassing the
+     * dispatcher. Returns nullptr for the traditional dispatcher-owned
+     * listeners.
+     */
+    LIBEVENT_THREAD* getWorker() const {
+        return worker;
+    }
+
+    /**
+     * Unregister and free the libevent event while the event base is
+     * still alive. Used during shutdown for the sharded listeners as
+     * their worker's event base is torn down before the connection
+     * objects are destroyed.
+     */
+    void releaseEvent() {
+        disable();
+        ev.reset();
+    }
+
     /**
      * Get the details for this connection to put in the portnumber
      * file so that the test framework may pick up the port numbers
@@ -68,6 +91,9 @@ protected:
     const bool management;
     const Protocol protocol;
 
+    /** The worker thread owning this listener (nullptr unless sharded) */
+    LIBEVENT_THREAD* const worker;
+
     struct EventDeleter {
         void operator()(struct event* ev) {
             if (ev != nullptr) {
@@ -83,23 +83,13 @@ bool McbpConnection::registerEvent() {
         return false;
     }
 
-    struct timeval tv;
-    struct timeval* tp = nullptr;
-
-    if (settings.getConnectionIdleTime() == 0 || isAdmin() || isDCP() || isTAP()) {
-        tp = nullptr;
-        ev_timeout_enabled = false;
-    } else {
-        tv.tv_sec = settings.getConnectionIdleTime();
-        tv.tv_usec = 0;
-        tp = &tv;
-        ev_timeout_enabled = true;
-        ev_timeout = settings.getConnectionIdleTime();
-    }
-
-    ev_insert_time = mc_time_get_current_time();
-
-    if (event_add(&event, tp) == -1) {
+    /* Note: we don't pass a timeout to libevent. Idle connections are
+     * disconnected by the owning worker's timer wheel (see
+     * ConnectionTimerWheel); with a per-event timeout every connection
+     * would occupy a node in libevent's timer heap, which gets
+     * expensive once we're serving a hundred thousand connections.
+     */
+    if (event_add(&event, nullptr) == -1) {
         log_system_error(EXTENSION_LOG_WARNING, nullptr,
                          "Failed to add connection to libevent: %s");
         return false;
@@ -109,6 +99,27 @@ bool McbpConnection::registerEvent() {
     return true;
 }
 
+/**
+ * Map a connection's event priority class onto the libevent priority
+ * lanes configured on the worker event bases (see setup_thread). To
+ * libevent a lower number means serviced first, so the high class gets
+ * lane 0 and the low class the last lane. Medium and Default share the
+ * middle lane - Default only differs from Medium in its reqs-per-event
+ * and time-budget tiers.
+ */
+static int libevent_priority(const EventPriority& priority) {
+    switch (priority) {
+    case EventPriority::High:
+        return 0;
+    case EventPriority::Medium:
+    case EventPriority::Default:
+        return 1;
+    case EventPriority::Low:
+        return 2;
+    }
+    return 1;
+}
+
 bool McbpConnection::updateEvent(const short new_flags) {
     struct event_base* base = event.ev_base;
 
@@ -131,27 +142,10 @@ bool McbpConnection::updateEvent(const short new_flags) {
 
     if (ev_flags == new_flags) {
         // We do "cache" the current libevent state (using EV_PERSIST) to avoid
-        // having to re-register it when it doesn't change (which it mostly don't).
-        // In order to avoid having clients to falsely "time out" due to that they
-        // never update their libevent state we'll forcibly re-enter it half way
-        // into the timeout.
-
-        if (ev_timeout_enabled && (isAdmin() || isDCP() || isTAP())) {
-            LOG_DEBUG(this,
-                      "%u: Forcibly reset the event connection flags to"
-                          " disable timeout", getId());
-        } else {
-            rel_time_t now = mc_time_get_current_time();
-            const int reinsert_time = settings.getConnectionIdleTime() / 2;
-
-            if ((ev_insert_time + reinsert_time) > now) {
-                return true;
-            } else {
-                LOG_DEBUG(this,
-                          "%u: Forcibly reset the event connection flags to"
-                              " avoid premature timeout", getId());
-            }
-        }
+        // having to re-register it when it doesn't change (which it mostly
+        // don't). The event carries no timeout (idle handling lives in the
+        // timer wheel), so there is nothing to refresh.
+        return true;
     }
 
     LOG_DEBUG(NULL, "%u: Updated event to read=%s, write=%s\n",
@@ -176,6 +170,11 @@ bool McbpConnection::updateEvent(const short new_flags) {
     }
     ev_flags = new_flags;
 
+    /* The priority has to be (re)applied between assign and add. A
+     * failure just leaves the event in the base's default lane (e.g.
+     * a base which wasn't set up with multiple lanes). */
+    event_priority_set(&event, libevent_priority(event_priority));
+
     if (!registerEvent()) {
         LOG_WARNING(this,
                     "Failed to add connection to the event notification "
@@ -187,8 +186,87 @@ bool McbpConnection::updateEvent(const short new_flags) {
     return true;
 }
 
-bool McbpConnection::reapplyEventmask() {
-    return updateEvent(ev_flags);
+bool McbpConnection::coalesceBufferAck(uint32_t opaque, uint16_t vbucket,
+                                       uint32_t buffer_bytes) {
+    if (dcp_ack_end == nullptr || dcp_ack_end != write.curr ||
+        dcp_ack_opaque != opaque || dcp_ack_vbucket != vbucket) {
+        return false;
+    }
+
+    auto* packet =
+        reinterpret_cast<protocol_binary_request_dcp_buffer_acknowledgement*>(
+            dcp_ack_end - sizeof(protocol_binary_request_dcp_buffer_acknowledgement));
+    packet->message.body.buffer_bytes =
+        htonl(ntohl(packet->message.body.buffer_bytes) + buffer_bytes);
+    dcp_acks_coalesced++;
+    return true;
+}
+
+bool McbpConnection::throttleBackoff() {
+    if (registered_in_libevent && !unregisterEvent()) {
+        return false;
+    }
+
+    /* The token buckets are refilled on the second; a 100ms retry
+     * keeps the backoff responsive without the wakeups amounting to
+     * anything. With EV_PERSIST the timeout re-arms itself on every
+     * activation, so a still-throttled connection keeps polling the
+     * gate until it's admitted (and clearEventTimeout() is called). */
+    struct timeval tv = { 0, 100000 };
+    if (event_add(&event, &tv) == -1) {
+        log_system_error(EXTENSION_LOG_WARNING, nullptr,
+                         "Failed to add connection to libevent: %s");
+        return false;
+    }
+
+    registered_in_libevent = true;
+    event_timeout_armed = true;
+    return true;
+}
+
+void McbpConnection::clearEventTimeout() {
+    if (registered_in_libevent && unregisterEvent()) {
+        registerEvent();
+    }
+    event_timeout_armed = false;
+}
+
+bool McbpConnection::isMigratable() {
+    // conn_read is the state connections rest in while waiting for
+    // input from the network (conn_waiting is just the transient hop
+    // into it)
+    return (getState() == conn_read || getState() == conn_waiting) &&
+           !isEwouldblock() &&
+           !isDCP() && !isTAP() &&
+           read.bytes == 0 &&
+           isRegisteredInLibevent() &&
+           socketDescriptor != INVALID_SOCKET;
+}
+
+bool McbpConnection::isSheddable() {
+    return !isAdmin() && isMigratable();
+}
+
+bool McbpConnection::migrateEventBase(struct event_base* new_base) {
+    if (registered_in_libevent) {
+        throw std::logic_error("McbpConnection::migrateEventBase: still "
+                                   "registered with the old event base");
+    }
+
+    base = new_base;
+    return initializeEvent();
+}
+
+rel_time_t McbpConnection::getIdleDeadline() const {
+    if (settings.getConnectionIdleTime() == 0 || isAdmin() || isDCP() ||
+        isTAP() || !registered_in_libevent) {
+        /* A connection which isn't registered in libevent is waiting
+         * for an engine operation (or being torn down) and shouldn't
+         * be disconnected underneath it. */
+        return 0;
+    }
+
+    return last_activity + rel_time_t(settings.getConnectionIdleTime());
 }
 
 bool McbpConnection::initializeEvent() {
@@ -200,16 +278,23 @@ bool McbpConnection::initializeEvent() {
     }
     ev_flags = event_flags;
 
+    /* See updateEvent; failure leaves the event in the default lane */
+    event_priority_set(&event, libevent_priority(event_priority));
+
     return registerEvent();
 }
 
 void McbpConnection::shrinkBuffers() {
     if (read.size > READ_BUFFER_HIGHWAT && read.bytes < DATA_BUFFER_SIZE) {
+        /* Stashed lookup results hold key pointers into the buffer
+         * we're about to move */
+        releasePrefetchedGets();
         if (read.curr != read.buf) {
             /* Pack the buffer */
             memmove(read.buf, read.curr, (size_t)read.bytes);
         }
 
+        ScopedAllocDomain domain(AllocationDomain::Connection);
         void* ptr = cb_realloc(read.buf, DATA_BUFFER_SIZE);
         char* newbuf = reinterpret_cast<char*>(ptr);
         if (newbuf) {
@@ -250,11 +335,84 @@ void McbpConnection::shrinkBuffers() {
         }
     }
 
-    // The DynamicBuffer is only occasionally used - free the whole thing
-    // if it's still allocated.
+    // The DynamicBuffer is only occasionally used - hand its segments
+    // back to the pool if any are still allocated.
     dynamicBuffer.clear();
 }
 
+void McbpConnection::maybeResetScratchArena() {
+    /* Anything allocated from the arena is dead once no responses are
+       corked in msglist and no staged response buffers are waiting for
+       transmit to drain. */
+    if (getPendingResponses() == 0 && temp_alloc.empty()) {
+        /* Drop any half-built staging left in the dynamic buffer so it
+           can't alias memory the arena is about to hand out again */
+        dynamicBuffer.clear();
+        STATS_MAX(this, scratch_arena_high_watermark,
+                  int(scratchArena.getHighWatermark()));
+        scratchArena.reset();
+    }
+}
+
+bool McbpConnection::accountCommandMemory(size_t nbytes) {
+    const size_t budget = settings_snapshot().per_op_memory_budget;
+    if (budget > 0 &&
+        (cmd_mem_allocated >= budget ||
+         nbytes > budget - cmd_mem_allocated)) {
+        cmd_budget_exceeded = true;
+        return false;
+    }
+    cmd_mem_allocated += nbytes;
+    return true;
+}
+
+bool McbpConnection::havePendingCompleteRequest() {
+    protocol_binary_request_header req;
+
+    if (read.bytes < sizeof(req)) {
+        return false;
+    }
+
+    // The current read position isn't necessarily aligned, so copy the
+    // header out before looking at the body length.
+    memcpy(&req, read.curr, sizeof(req));
+    return read.bytes >= sizeof(req) + uint64_t(ntohl(req.request.bodylen));
+}
+
+bool McbpConnection::maybeCorkResponse() {
+    const bool eligible = corkableResponse;
+    corkableResponse = false;
+
+    if (!eligible || getState() != conn_mwrite ||
+        write_and_go != conn_new_cmd) {
+        return false;
+    }
+
+    /* Only keep accumulating while the next request is already fully
+     * received in the input buffer (so we know we're draining a
+     * pipelined burst), and while there is enough headroom left in the
+     * write buffer for the next response to stage its header (and
+     * whatever it puts right behind it). */
+    if (!havePendingCompleteRequest() ||
+        write.bytes + CORK_BUFFER_RESERVED > write.size) {
+        return false;
+    }
+
+    if (item != nullptr) {
+        /* The response points into the item's memory. Move the
+         * reference over to the reserved list so it survives past the
+         * end of this command (reset_cmd_handler would otherwise
+         * release it before the data is transmitted). */
+        if (!reserveItem(item)) {
+            return false;
+        }
+        item = nullptr;
+    }
+
+    ++pendingResponses;
+    get_thread_stats(this)->responses_corked++;
+    return true;
+}
 
 int McbpConnection::sslPreConnection() {
     int r = ssl.accept();
@@ -319,18 +477,73 @@ int McbpConnection::recv(char* dest, size_t nbytes) {
         }
     }
 
+    if (res > 0) {
+        readSizes.add(size_t(res));
+    }
+
     return res;
 }
 
 int McbpConnection::sendmsg(struct msghdr* m) {
     int res = 0;
     if (ssl.isEnabled()) {
+        // Each SSL_write() produces (at least) one TLS record, so writing
+        // the scatter/gather array one entry at a time would frame every
+        // response header as its own record and pay the per-record
+        // overhead over and over. Coalesce adjacent entries into larger
+        // chunks; entries which already fill a chunk are passed through
+        // directly without the extra copy.
+        const size_t chunksize = settings.getBioDrainBufferSize();
+        if (sslGatherBuf.size() != chunksize) {
+            sslGatherBuf.resize(chunksize);
+        }
+
+        size_t gathered = 0;
         for (int ii = 0; ii < int(m->msg_iovlen); ++ii) {
-            int n = sslWrite(reinterpret_cast<char*>(m->msg_iov[ii].iov_base),
-                             m->msg_iov[ii].iov_len);
+            const char* data = static_cast<const char*>(
+                m->msg_iov[ii].iov_base);
+            const size_t len = m->msg_iov[ii].iov_len;
+
+            if (len < chunksize) {
+                if (gathered + len > chunksize) {
+                    int n = sslWrite(sslGatherBuf.data(), gathered);
+                    if (n > 0) {
+                        res += n;
+                    }
+                    if (n != int(gathered)) {
+                        return res > 0 ? res : -1;
+                    }
+                    gathered = 0;
+                }
+                memcpy(sslGatherBuf.data() + gathered, data, len);
+                gathered += len;
+            } else {
+                if (gathered > 0) {
+                    int n = sslWrite(sslGatherBuf.data(), gathered);
+                    if (n > 0) {
+                        res += n;
+                    }
+                    if (n != int(gathered)) {
+                        return res > 0 ? res : -1;
+                    }
+                    gathered = 0;
+                }
+                int n = sslWrite(data, len);
+                if (n > 0) {
+                    res += n;
+                }
+                if (n != int(len)) {
+                    return res > 0 ? res : -1;
+                }
+            }
+        }
+
+        if (gathered > 0) {
+            int n = sslWrite(sslGatherBuf.data(), gathered);
             if (n > 0) {
                 res += n;
-            } else {
+            }
+            if (n != int(gathered)) {
                 return res > 0 ? res : -1;
             }
         }
@@ -381,7 +594,12 @@ McbpConnection::TransmitResult McbpConnection::transmit() {
         res = sendmsg(m);
         auto error = GetLastNetworkError();
         if (res > 0) {
-            get_thread_stats(this)->bytes_written += res;
+            auto* ts = get_thread_stats(this);
+            ts->bytes_written += res;
+            /* Together with bytes_written this gives the average number
+               of bytes shipped per system call (the response corking
+               win). */
+            ts->sendmsg_calls++;
 
             /* We've written some of the data. Remove the completed
                iovec entries from the list of pending writes. */
@@ -455,6 +673,13 @@ McbpConnection::TransmitResult McbpConnection::transmit() {
     }
 }
 
+/**
+ * The step (in bytes) the input buffer is grown with when greedy reads
+ * are enabled. A linear step keeps the buffer size proportional to what
+ * the client actually sends instead of doubling past it.
+ */
+static const size_t GREEDY_READ_BUFFER_STEP = 64 * 1024;
+
 /**
  * To protect us from someone flooding a connection with bogus data causing
  * the connection to eat up all available memory, break out and start
@@ -464,6 +689,15 @@ McbpConnection::TryReadResult McbpConnection::tryReadNetwork() {
     TryReadResult gotdata = TryReadResult::NoDataReceived;
     int res;
     int num_allocs = 0;
+    const size_t budget = settings_snapshot().greedy_read_budget;
+    size_t nread = 0;
+
+    /* Stashed lookup results hold key pointers into the read buffer,
+     * which is compacted below and may be reallocated by the read
+     * loop. They only exist while complete requests are still pending
+     * (in which case we don't get here), so this is a no-op in the
+     * normal flow. */
+    releasePrefetchedGets();
 
     if (read.curr != read.buf) {
         if (read.bytes != 0) { /* otherwise there's nothing to copy */
@@ -475,12 +709,23 @@ McbpConnection::TryReadResult McbpConnection::tryReadNetwork() {
     while (1) {
         int avail;
         if (read.bytes >= read.size) {
-            if (num_allocs == 4) {
-                return gotdata;
+            size_t newsize;
+            if (budget > 0) {
+                /* In greedy mode the budget (and not a realloc count)
+                 * bounds how much we'll consume in one go, and doubling
+                 * a buffer which has already grown big overshoots badly.
+                 * Grow linearly instead. */
+                newsize = read.size + GREEDY_READ_BUFFER_STEP;
+            } else {
+                if (num_allocs == 4) {
+                    return gotdata;
+                }
+                ++num_allocs;
+                newsize = read.size * 2;
             }
-            ++num_allocs;
+            ScopedAllocDomain domain(AllocationDomain::Connection);
             char* new_rbuf = reinterpret_cast<char*>(cb_realloc(read.buf,
-                                                             read.size * 2));
+                                                                newsize));
             if (!new_rbuf) {
                 LOG_WARNING(this, "Couldn't realloc input buffer");
                 read.bytes = 0; /* ignore what we read */
@@ -488,7 +733,7 @@ McbpConnection::TryReadResult McbpConnection::tryReadNetwork() {
                 return TryReadResult::MemoryError;
             }
             read.curr = read.buf = new_rbuf;
-            read.size *= 2;
+            read.size = newsize;
         }
 
         avail = read.size - read.bytes;
@@ -497,6 +742,17 @@ McbpConnection::TryReadResult McbpConnection::tryReadNetwork() {
             get_thread_stats(this)->bytes_read += res;
             gotdata = TryReadResult::DataReceived;
             read.bytes += res;
+            nread += res;
+            if (budget > 0) {
+                /* Greedy mode: keep reading until the transport would
+                 * block or we've used up the budget for this event,
+                 * even if the last read returned less than we asked
+                 * for (more data may have arrived in the meantime). */
+                if (nread >= budget) {
+                    break;
+                }
+                continue;
+            }
             if (res == avail) {
                 continue;
             } else {
@@ -640,32 +896,36 @@ SslContext::~SslContext() {
 }
 
 bool SslContext::enable(const std::string& cert, const std::string& pkey) {
-    ctx = SSL_CTX_new(SSLv23_server_method());
-    set_ssl_ctx_protocol_mask(ctx);
-
-    /* @todo don't read files, but use in-memory-copies */
-    if (!SSL_CTX_use_certificate_chain_file(ctx, cert.c_str()) ||
-        !SSL_CTX_use_PrivateKey_file(ctx, pkey.c_str(), SSL_FILETYPE_PEM)) {
-        LOG_WARNING(nullptr, "Failed to use SSL cert %s and pkey %s",
-                    cert.c_str(), pkey.c_str());
+    // The context is shared with the other connections using the same
+    // cert/pkey pair so that clients may resume earlier TLS sessions
+    // instead of paying for a full handshake on every reconnect.
+    ctx = acquire_ssl_server_ctx(cert, pkey);
+    if (ctx == nullptr) {
         return false;
     }
 
-    set_ssl_ctx_cipher_list(ctx);
-
     enabled = true;
     error = false;
     client = NULL;
 
-    try {
-        in.buffer.resize(settings.getBioDrainBufferSize());
-        out.buffer.resize(settings.getBioDrainBufferSize());
-    } catch (std::bad_alloc) {
+    if (in.buffer == nullptr) {
+        in.buffsize = settings.getBioDrainBufferSize();
+        in.buffer = BufferPool::allocate(in.buffsize);
+    }
+    if (out.buffer == nullptr) {
+        out.buffsize = settings.getBioDrainBufferSize();
+        out.buffer = BufferPool::allocate(out.buffsize);
+    }
+    if (in.buffer == nullptr || out.buffer == nullptr) {
+        // disable() releases whichever one made it
         return false;
     }
 
-    BIO_new_bio_pair(&application, in.buffer.size(),
-                     &network, out.buffer.size());
+    // Size the BIO pair like the staging buffers, so one drain of the
+    // socket can hand the whole burst to the SSL machinery and each
+    // SSL_read gets to chew through it in one go
+    BIO_new_bio_pair(&application, in.buffsize,
+                     &network, out.buffsize);
 
     client = SSL_new(ctx);
     SSL_set_bio(client, application, application);
@@ -682,8 +942,19 @@ void SslContext::disable() {
     }
     error = false;
     if (ctx != nullptr) {
+        /* Release our reference to the shared server context */
         SSL_CTX_free(ctx);
     }
+    if (in.buffer != nullptr) {
+        BufferPool::release(in.buffer);
+        in.buffer = nullptr;
+        in.buffsize = in.total = in.current = 0;
+    }
+    if (out.buffer != nullptr) {
+        BufferPool::release(out.buffer);
+        out.buffer = nullptr;
+        out.buffsize = out.total = out.current = 0;
+    }
     enabled = false;
 }
 
@@ -693,7 +964,7 @@ void SslContext::drainBioRecvPipe(SOCKET sfd) {
 
     do {
         if (in.current < in.total) {
-            n = BIO_write(network, in.buffer.data() + in.current,
+            n = BIO_write(network, in.buffer + in.current,
                           int(in.total - in.current));
             if (n > 0) {
                 in.current += n;
@@ -708,9 +979,9 @@ void SslContext::drainBioRecvPipe(SOCKET sfd) {
             }
         }
 
-        if (in.total < in.buffer.size()) {
-            n = recv(sfd, in.buffer.data() + in.total,
-                     in.buffer.size() - in.total, 0);
+        if (in.total < in.buffsize) {
+            n = recv(sfd, in.buffer + in.total,
+                     in.buffsize - in.total, 0);
             if (n > 0) {
                 in.total += n;
                 totalRecv += n;
@@ -734,7 +1005,7 @@ void SslContext::drainBioSendPipe(SOCKET sfd) {
 
     do {
         if (out.current < out.total) {
-            n = send(sfd, out.buffer.data() + out.current,
+            n = send(sfd, out.buffer + out.current,
                      out.total - out.current, 0);
             if (n > 0) {
                 out.current += n;
@@ -755,7 +1026,7 @@ void SslContext::drainBioSendPipe(SOCKET sfd) {
         }
 
         if (out.total == 0) {
-            n = BIO_read(network, out.buffer.data(), int(out.buffer.size()));
+            n = BIO_read(network, out.buffer, int(out.buffsize));
             if (n > 0) {
                 out.total = n;
             } else {
@@ -819,58 +1090,65 @@ bool McbpConnection::addMsgHdr(bool reset) {
 }
 
 bool McbpConnection::addIov(const void* buf, size_t len) {
-
-    size_t leftover;
-    bool limit_to_mtu;
-
     if (len == 0) {
         return true;
     }
 
-    do {
-        struct msghdr* m = &msglist.back();
-
-        /*
-         * Limit the first payloads of TCP replies, to
-         * UDP_MAX_PAYLOAD_SIZE bytes.
-         */
-        limit_to_mtu = (1 == msglist.size());
-
-        /* We may need to start a new msghdr if this one is full. */
-        if (m->msg_iovlen == IOV_MAX ||
-            (limit_to_mtu && msgbytes >= UDP_MAX_PAYLOAD_SIZE)) {
-            if (!addMsgHdr(false)) {
-                return false;
-            }
-        }
-
-        if (!ensureIovSpace()) {
+    /* We may need to start a new msghdr if this one is full. The old
+     * code also split the first msghdr at the UDP datagram size, a
+     * leftover from the UDP days; on our TCP-only transport that just
+     * cut every large reply (and every DCP ship batch) into an extra
+     * sendmsg call for no benefit. */
+    if (msglist.back().msg_iovlen == IOV_MAX) {
+        if (!addMsgHdr(false)) {
             return false;
         }
+    }
 
-        /* If the fragment is too big to fit in the datagram, split it up */
-        if (limit_to_mtu && len + msgbytes > UDP_MAX_PAYLOAD_SIZE) {
-            leftover = len + msgbytes - UDP_MAX_PAYLOAD_SIZE;
-            len -= leftover;
-        } else {
-            leftover = 0;
-        }
+    if (!ensureIovSpace()) {
+        return false;
+    }
 
-        // Update 'm' as we may have added an additional msghdr
-        m = &msglist.back();
+    struct msghdr* m = &msglist.back();
+    m->msg_iov[m->msg_iovlen].iov_base = (void*)buf;
+    m->msg_iov[m->msg_iovlen].iov_len = len;
 
-        m->msg_iov[m->msg_iovlen].iov_base = (void*)buf;
-        m->msg_iov[m->msg_iovlen].iov_len = len;
+    msgbytes += len;
+    ++iovused;
+    STATS_MAX(this, iovused_high_watermark, getIovUsed());
+    m->msg_iovlen++;
 
-        msgbytes += len;
-        ++iovused;
-        STATS_MAX(this, iovused_high_watermark, getIovUsed());
-        m->msg_iovlen++;
+    return true;
+}
 
-        buf = ((char*)buf) + len;
-        len = leftover;
-    } while (leftover > 0);
+bool McbpConnection::takeBufferOwnership(DynamicBuffer& buf) {
+    const auto& segments = buf.getSegments();
 
+    try {
+        pooled_alloc.reserve(pooled_alloc.size() + segments.size());
+        temp_alloc.reserve(temp_alloc.size() + segments.size());
+    } catch (const std::bad_alloc&) {
+        LOG_WARNING(this,
+                    "%u: FATAL: failed to allocate space to keep response "
+                        "buffer segments",
+                    getId());
+        return false;
+    }
+
+    /* The push_backs can't throw with the space reserved, so the
+       transfer is all-or-nothing. */
+    for (const auto& segment : segments) {
+        if (segment.pooled) {
+            pooled_alloc.push_back(segment.data);
+        } else {
+            /* Arena backed; freeing is the arena reset's job, but the
+               entry keeps the arena pinned while the data is in use
+               (see maybeResetScratchArena) */
+            temp_alloc.push_back(segment.data);
+        }
+    }
+
+    buf.takeOwnership();
     return true;
 }
 
@@ -903,13 +1181,28 @@ McbpConnection::McbpConnection(SOCKET sfd, event_base *b)
       stateMachine(new McbpStateMachine(conn_immediate_close)),
       tap_iterator(nullptr),
       dcp(false),
+      dcp_ack_end(nullptr),
+      dcp_ack_opaque(0),
+      dcp_ack_vbucket(0),
+      dcp_messages(0),
+      dcp_batches(0),
+      dcp_acks_coalesced(0),
+      compressed_responses(0),
+      compression_bytes_saved(0),
+      event_priority(EventPriority::Default),
       max_reqs_per_event(settings.getRequestsPerEventNotification(EventPriority::Default)),
       numEvents(0),
+      time_budget(hrtime_t(settings.getEventTimeBudget(EventPriority::Default)) * 1000),
+      slice_start(0),
+      ship_bytes_slice(0),
+      event_settings_generation(eventSettingsGeneration.load()),
       cmd(PROTOCOL_BINARY_CMD_INVALID),
       registered_in_libevent(false),
+      event_timeout_armed(false),
       ev_flags(0),
       currentEvent(0),
-      ev_timeout_enabled(false),
+      last_activity(mc_time_get_current_time()),
+      timer_wheel_slot(-1),
       write_and_go(conn_new_cmd),
       ritem(nullptr),
       rlbytes(0),
@@ -919,10 +1212,24 @@ McbpConnection::McbpConnection(SOCKET sfd, event_base *b)
       msglist(),
       msgcurr(0),
       msgbytes(0),
+      corkableResponse(false),
+      pendingResponses(0),
+      prevalidatedHeaders(0),
+      currentHeaderPrevalidated(false),
+      decodedHeaderHead(0),
+      decodedHeaderCount(0),
+      prefetchedGetCursor(0),
       noreply(false),
       supports_datatype(false),
       supports_mutation_extras(false),
+      supports_server_timings(false),
+      cmd_mem_allocated(0),
+      cmd_budget_exceeded(false),
+      dynamicBuffer(scratchArena),
       start(0),
+      opDeadline(0),
+      engineTime(0),
+      responseBytes(0),
       cas(0),
       aiostat(ENGINE_SUCCESS),
       ewouldblock(false),
@@ -948,13 +1255,28 @@ McbpConnection::McbpConnection(SOCKET sfd,
       stateMachine(new McbpStateMachine(conn_new_cmd)),
       tap_iterator(nullptr),
       dcp(false),
-      max_reqs_per_event(settings.getRequestsPerEventNotification(EventPriority::Default)),
+      dcp_ack_end(nullptr),
+      dcp_ack_opaque(0),
+      dcp_ack_vbucket(0),
+      dcp_messages(0),
+      dcp_batches(0),
+      dcp_acks_coalesced(0),
+      compressed_responses(0),
+      compression_bytes_saved(0),
+      event_priority(ifc.priority),
+      max_reqs_per_event(settings.getRequestsPerEventNotification(ifc.priority)),
       numEvents(0),
+      time_budget(hrtime_t(settings.getEventTimeBudget(ifc.priority)) * 1000),
+      slice_start(0),
+      ship_bytes_slice(0),
+      event_settings_generation(eventSettingsGeneration.load()),
       cmd(PROTOCOL_BINARY_CMD_INVALID),
       registered_in_libevent(false),
+      event_timeout_armed(false),
       ev_flags(0),
       currentEvent(0),
-      ev_timeout_enabled(false),
+      last_activity(mc_time_get_current_time()),
+      timer_wheel_slot(-1),
       write_and_go(conn_new_cmd),
       ritem(nullptr),
       rlbytes(0),
@@ -964,10 +1286,24 @@ McbpConnection::McbpConnection(SOCKET sfd,
       msglist(),
       msgcurr(0),
       msgbytes(0),
+      corkableResponse(false),
+      pendingResponses(0),
+      prevalidatedHeaders(0),
+      currentHeaderPrevalidated(false),
+      decodedHeaderHead(0),
+      decodedHeaderCount(0),
+      prefetchedGetCursor(0),
       noreply(false),
       supports_datatype(false),
       supports_mutation_extras(false),
+      supports_server_timings(false),
+      cmd_mem_allocated(0),
+      cmd_budget_exceeded(false),
+      dynamicBuffer(scratchArena),
       start(0),
+      opDeadline(0),
+      engineTime(0),
+      responseBytes(0),
       cas(0),
       aiostat(ENGINE_SUCCESS),
       ewouldblock(false),
@@ -1002,6 +1338,7 @@ McbpConnection::~McbpConnection() {
     cb_free(write.buf);
 
     releaseReservedItems();
+    releasePrefetchedGets();
     for (auto* ptr : temp_alloc) {
         cb_free(ptr);
     }
@@ -1076,11 +1413,33 @@ cJSON* McbpConnection::toJSON() const {
     if (obj != nullptr) {
         json_add_bool_to_object(obj, "tap", isTAP());
         json_add_bool_to_object(obj, "dcp", isDCP());
+        if (isDCP()) {
+            /* Per-stream ship throughput (pair the message/batch
+             * counts with total_send to judge the syscall savings) */
+            cJSON* ship = cJSON_CreateObject();
+            cJSON_AddNumberToObject(ship, "messages", double(dcp_messages));
+            cJSON_AddNumberToObject(ship, "batches", double(dcp_batches));
+            cJSON_AddNumberToObject(ship, "acks_coalesced",
+                                    double(dcp_acks_coalesced));
+            cJSON_AddItemToObject(obj, "dcp_ship", ship);
+        }
+        if (compressed_responses > 0) {
+            /* Values compressed on the client's behalf (see
+             * response_compression_threshold) */
+            cJSON* comp = cJSON_CreateObject();
+            cJSON_AddNumberToObject(comp, "responses",
+                                    double(compressed_responses));
+            cJSON_AddNumberToObject(comp, "bytes_saved",
+                                    double(compression_bytes_saved));
+            cJSON_AddItemToObject(obj, "response_compression", comp);
+        }
         json_add_uintptr_to_object(obj, "opaque", getOpaque());
         cJSON_AddNumberToObject(obj, "max_reqs_per_event",
                                 max_reqs_per_event);
         cJSON_AddNumberToObject(obj, "nevents", numEvents);
         cJSON_AddStringToObject(obj, "state", getStateName());
+        cJSON_AddNumberToObject(obj, "seconds_idle",
+                                mc_time_get_current_time() - last_activity);
 
         const char* cmd_name = memcached_opcode_2_text(cmd);
         if (cmd_name == nullptr) {
@@ -1095,16 +1454,6 @@ cJSON* McbpConnection::toJSON() const {
                                     isRegisteredInLibevent());
             cJSON_AddItemToObject(o, "ev_flags", event_mask_to_json(ev_flags));
             cJSON_AddItemToObject(o, "which", event_mask_to_json(currentEvent));
-
-            if (ev_timeout_enabled) {
-                cJSON* timeout = cJSON_CreateObject();
-                cJSON_AddNumberToObject(timeout, "value", ev_timeout);
-                cJSON_AddNumberToObject(timeout, "remaining",
-                                        ev_insert_time + ev_timeout -
-                                        mc_time_get_current_time());
-                cJSON_AddItemToObject(o, "timeout", timeout);
-            }
-
             cJSON_AddItemToObject(obj, "libevent", o);
         }
 
@@ -1159,6 +1508,11 @@ cJSON* McbpConnection::toJSON() const {
             cJSON_AddNumberToObject(talloc, "size", temp_alloc.size());
             cJSON_AddItemToObject(obj, "temp_alloc_list", talloc);
         }
+        {
+            cJSON* palloc = cJSON_CreateObject();
+            cJSON_AddNumberToObject(palloc, "size", pooled_alloc.size());
+            cJSON_AddItemToObject(obj, "pooled_alloc_list", palloc);
+        }
         json_add_bool_to_object(obj, "noreply", noreply);
         {
             cJSON* dy_buf = cJSON_CreateObject();
@@ -1179,6 +1533,7 @@ cJSON* McbpConnection::toJSON() const {
         cJSON_AddItemToObject(obj, "ssl", ssl.toJSON());
         cJSON_AddNumberToObject(obj, "total_recv", totalRecv);
         cJSON_AddNumberToObject(obj, "total_send", totalSend);
+        cJSON_AddItemToObject(obj, "read_sizes", readSizes.toJSON());
     }
 
     return obj;
@@ -1301,10 +1656,40 @@ bool McbpConnection::shouldDelete() {
     return getState() == conn_destroyed;
 }
 
+bool McbpConnection::isTimesliceExhausted() const {
+    if (time_budget == 0) {
+        return false;
+    }
+
+    return (gethrtime() - slice_start) > time_budget;
+}
+
+bool McbpConnection::isShipBudgetExhausted() const {
+    const uint64_t limit = settings.getShipLogByteLimit();
+    if (limit == 0) {
+        return false;
+    }
+
+    return ship_bytes_slice >= limit;
+}
+
 void McbpConnection::runEventLoop(short which) {
     conn_loan_buffers(this);
     currentEvent = which;
+
+    /* Pick up dynamically changed reqs-per-event / time-budget
+       settings; a relaxed compare against the global generation is
+       all this costs on the hot path. */
+    const uint32_t generation =
+        eventSettingsGeneration.load(std::memory_order_acquire);
+    if (generation != event_settings_generation) {
+        event_settings_generation = generation;
+        updateEventSettings();
+    }
+
     numEvents = max_reqs_per_event;
+    slice_start = gethrtime();
+    ship_bytes_slice = 0;
     try {
         runStateMachinery();
     } catch (std::exception& e) {
@@ -1368,23 +1753,48 @@ void McbpConnection::signalIfIdle(bool logbusy, int workerthread) {
     }
 }
 
+std::atomic<uint32_t> McbpConnection::eventSettingsGeneration{0};
+
+void McbpConnection::updateEventSettings() {
+    max_reqs_per_event =
+        settings.getRequestsPerEventNotification(event_priority);
+    time_budget = hrtime_t(settings.getEventTimeBudget(event_priority)) * 1000;
+}
+
 void McbpConnection::setPriority(const Connection::Priority& priority) {
     Connection::setPriority(priority);
     switch (priority) {
     case Priority::High:
-        max_reqs_per_event = settings.getRequestsPerEventNotification(EventPriority::High);
+        event_priority = EventPriority::High;
+        updateEventSettings();
+        updateEventLane();
         return;
     case Priority::Medium:
-        max_reqs_per_event = settings.getRequestsPerEventNotification(EventPriority::Medium);
+        event_priority = EventPriority::Medium;
+        updateEventSettings();
+        updateEventLane();
         return;
     case Priority::Low:
-        max_reqs_per_event = settings.getRequestsPerEventNotification(EventPriority::Low);
+        event_priority = EventPriority::Low;
+        updateEventSettings();
+        updateEventLane();
         return;
     }
     throw std::invalid_argument(
         "Unkown priority: " + std::to_string(int(priority)));
 }
 
+void McbpConnection::updateEventLane() {
+    /* libevent refuses to change the priority of a pending event, so
+     * briefly pull the event out of the base. We're called from the
+     * worker thread owning the connection, so nobody can fire the
+     * event in the window. */
+    if (registered_in_libevent && unregisterEvent()) {
+        event_priority_set(&event, libevent_priority(event_priority));
+        registerEvent();
+    }
+}
+
 protocol_binary_response_status McbpConnection::validateCommand(protocol_binary_command command) {
     return Bucket::validateMcbpCommand(this, command, cookie);
 }
@@ -21,7 +21,9 @@
 #include "config.h"
 
 #include "buffer.h"
+#include "buffer_pool.h"
 #include "dynamic_buffer.h"
+#include "scratch_arena.h"
 #include "log_macros.h"
 #include "net_buf.h"
 #include "settings.h"
@@ -30,14 +32,19 @@
 #include <cJSON.h>
 #include <cbsasl/cbsasl.h>
 #include <chrono>
+#include <cstring>
 #include <memcached/openssl.h>
 #include <memory>
 #include <platform/cb_malloc.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "connection.h"
 #include "cookie.h"
+#include "phase_timings.h"
+#include "size_histogram.h"
+#include "timing_histogram.h"
 #include "task.h"
 
 /**
@@ -56,8 +63,12 @@ public:
           client(nullptr),
           totalRecv(0),
           totalSend(0) {
+        in.buffer = nullptr;
+        in.buffsize = 0;
         in.total = 0;
         in.current = 0;
+        out.buffer = nullptr;
+        out.buffsize = 0;
         out.total = 0;
         out.current = 0;
     }
@@ -171,8 +182,13 @@ protected:
     SSL_CTX* ctx;
     SSL* client;
     struct {
-        // The data located in the buffer
-        std::vector<char> buffer;
+        // The ciphertext staging area between the socket and the BIO
+        // pair. Comes from the worker's BufferPool (sized by
+        // bio_drain_buffer_sz) so the memory is recycled across TLS
+        // (re)connects instead of allocated per connection.
+        char* buffer;
+        // The usable size of the buffer
+        size_t buffsize;
         // The number of bytes currently stored in the buffer
         size_t total;
         // The current offset of the buffer
@@ -185,6 +201,97 @@ protected:
     size_t totalSend;
 };
 
+/**
+ * The InflatedDocCache class holds the last document inflated for a
+ * sub-document command, retained across commands on the connection.
+ * Clients commonly issue a run of subdoc operations against the same
+ * (Snappy compressed) document; as long as the document's CAS is
+ * unchanged the cached copy may be reused, skipping the inflate. Any
+ * mutation gives the document a new CAS, so a stale entry simply never
+ * matches. See get_document_for_searching() in subdocument.cc.
+ */
+class InflatedDocCache {
+public:
+    InflatedDocCache()
+        : bucket(-1),
+          cas(0),
+          length(0),
+          capacity(0) {
+    }
+
+    /**
+     * Check if the cache holds the given revision of the given document.
+     */
+    bool matches(int bucket_, const char* key_, size_t nkey,
+                 uint64_t cas_) const {
+        return bucket == bucket_ && cas == cas_ && key.size() == nkey &&
+               std::memcmp(key.data(), key_, nkey) == 0;
+    }
+
+    const char* getData() const {
+        return buffer.get();
+    }
+
+    size_t getLength() const {
+        return length;
+    }
+
+    /**
+     * Prepare the cache for a new document of (at most) the given size,
+     * reusing the current allocation when it is big enough. The current
+     * entry is invalidated.
+     *
+     * @return the buffer to fill, or nullptr if memory could not be
+     *         allocated.
+     */
+    char* allocate(size_t size) {
+        bucket = -1;
+        if (capacity < size) {
+            try {
+                buffer.reset(new char[size]);
+                capacity = size;
+            } catch (const std::bad_alloc&) {
+                buffer.reset();
+                capacity = 0;
+                return nullptr;
+            }
+        }
+        return buffer.get();
+    }
+
+    /**
+     * Record the identity of the document just written to the buffer
+     * returned from allocate(), making the entry valid.
+     */
+    void set(int bucket_, const char* key_, size_t nkey, uint64_t cas_,
+             size_t length_) {
+        try {
+            key.assign(key_, nkey);
+        } catch (const std::bad_alloc&) {
+            // Not enough memory to remember the key; the entry just
+            // stays invalid.
+            return;
+        }
+        bucket = bucket_;
+        cas = cas_;
+        length = length_;
+    }
+
+private:
+    // Bucket index the cached document belongs to (-1 for no entry).
+    int bucket;
+    // Key of the cached document.
+    std::string key;
+    // CAS of the revision of the document which was inflated.
+    uint64_t cas;
+    // The inflated document.
+    std::unique_ptr<char[]> buffer;
+    // Number of bytes of document stored in {buffer}.
+    size_t length;
+    // Allocated size of {buffer}.
+    size_t capacity;
+};
+
 /**
  *  A command may need to store command specific context during the duration
  *  of a command (you might for instance want to keep state between multiple
@@ -224,6 +331,25 @@ public:
 
     virtual void setPriority(const Priority& priority) override;
 
+    /**
+     * Get the event priority class the connection belongs to (seeded
+     * from the "priority" attribute of the interface it was accepted
+     * on, and changed by setPriority).
+     */
+    const EventPriority& getEventPriority() const {
+        return event_priority;
+    }
+
+    /**
+     * Invalidate the event-loop settings (reqs per event, time budget)
+     * cached by every connection; each connection re-derives its
+     * values at the start of its next event. Called by the settings
+     * change listeners when one of the backing settings changes.
+     */
+    static void bumpEventSettingsGeneration() {
+        eventSettingsGeneration.fetch_add(1, std::memory_order_release);
+    }
+
     void setState(TaskFunction next_state);
 
     TaskFunction getState() const {
@@ -254,6 +380,75 @@ public:
         McbpConnection::dcp = dcp;
     }
 
+    /**
+     * Try to merge a DCP buffer-acknowledgement into the previous
+     * message queued in the current ship batch. Succeeds when that
+     * message was an acknowledgement for the same stream (vbucket +
+     * opaque); the byte counts are simply summed, so consecutive
+     * per-message acks collapse into a single packet on the wire.
+     *
+     * @return true when the ack was folded into the queued packet
+     */
+    bool coalesceBufferAck(uint32_t opaque, uint16_t vbucket,
+                           uint32_t buffer_bytes);
+
+    /**
+     * Remember the buffer-acknowledgement just appended to the write
+     * buffer as a candidate for coalescing (see coalesceBufferAck).
+     */
+    void noteBufferAck(uint32_t opaque, uint16_t vbucket) {
+        dcp_ack_end = write.curr;
+        dcp_ack_opaque = opaque;
+        dcp_ack_vbucket = vbucket;
+    }
+
+    /**
+     * Invalidate any buffer-acknowledgement coalescing candidate
+     * (called when the write buffer is recycled for a new batch).
+     */
+    void resetBufferAckCoalescing() {
+        dcp_ack_end = nullptr;
+    }
+
+    /**
+     * Account a shipped DCP batch (see ship_mcbp_dcp_log) for the
+     * per-stream throughput stats in toJSON.
+     */
+    void accountDcpBatch(int messages) {
+        dcp_batches++;
+        dcp_messages += messages;
+    }
+
+    /**
+     * Sum the bytes staged in the message list so far (headers in the
+     * write buffer plus every iovec referencing engine memory). The
+     * ship-log path uses this to charge a whole batch against the
+     * connection's per-timeslice byte budget and the worker's
+     * backfill byte share.
+     */
+    size_t getStagedSendBytes() const {
+        size_t total = 0;
+        for (size_t ii = 0; ii < msglist.size(); ++ii) {
+            const struct msghdr& m = msglist[ii];
+            for (size_t jj = 0; jj < size_t(m.msg_iovlen); ++jj) {
+                total += m.msg_iov[jj].iov_len;
+            }
+        }
+        return total;
+    }
+
+    /**
+     * Account a response value compressed on the client's behalf (see
+     * process_bin_get) for the per-connection bandwidth stats in
+     * toJSON.
+     *
+     * @param saved the number of body bytes the compression shaved off
+     */
+    void accountCompressedResponse(size_t saved) {
+        compressed_responses++;
+        compression_bytes_saved += saved;
+    }
+
     virtual cJSON* toJSON() const override;
 
 
@@ -333,6 +528,34 @@ public:
         return max_reqs_per_event;
     }
 
+    /**
+     * Check if the connection has used up the time budget of its
+     * current timeslice (counting requests treats a multi-megabyte
+     * mutation the same as a tiny get; the time budget catches the
+     * expensive ones). Always false when no budget is configured for
+     * the connection's priority.
+     */
+    bool isTimesliceExhausted() const;
+
+    /**
+     * Account bytes staged by the ship-log path towards the
+     * connection's per-timeslice byte budget (see
+     * isShipBudgetExhausted).
+     */
+    void accountShipBytes(size_t nbytes) {
+        ship_bytes_slice += nbytes;
+    }
+
+    /**
+     * Check if the connection has staged its ship_log_byte_limit worth
+     * of TAP/DCP traffic in the current timeslice. A backfill-driven
+     * stream always has more to ship, so without a byte budget it
+     * keeps its worker thread busy for the whole reqs-per-event
+     * allowance while frontend connections queue behind it. Always
+     * false when no limit is configured.
+     */
+    bool isShipBudgetExhausted() const;
+
     /**
      * Update the settings in libevent for this connection
      *
@@ -340,12 +563,6 @@ public:
      */
     bool updateEvent(const short new_flags);
 
-    /**
-     * Reapply the event mask (in case of a timeout we might want to do
-     * that)
-     */
-    bool reapplyEventmask();
-
     /**
      * Unregister the event structure from libevent
      * @return true if success, false otherwise
@@ -362,6 +579,85 @@ public:
         return registered_in_libevent;
     }
 
+    /**
+     * Re-register the event with a short timeout so the connection
+     * retries the bucket's throttle gate when it fires, instead of
+     * spinning on the gate in the worker thread.
+     *
+     * @return true if success, false otherwise
+     */
+    bool throttleBackoff();
+
+    /**
+     * Go back to a plain (timeout free) event after a throttle
+     * backoff ended.
+     */
+    void clearEventTimeout();
+
+    bool isEventTimeoutArmed() const {
+        return event_timeout_armed;
+    }
+
+    /**
+     * May the connection be handed over to another worker thread right
+     * now? Only completely quiescent connections can be moved safely:
+     * resting in conn_read (waiting for input) with no buffered data,
+     * no outstanding engine operation and no long-lived mode
+     * (DCP / TAP).
+     */
+    bool isMigratable();
+
+    /**
+     * May the connection be disconnected to make room for a new client
+     * when the server is running out of connection slots? Requires the
+     * same quiescence as a migration, and admin connections are off
+     * limits.
+     */
+    bool isSheddable();
+
+    /**
+     * Re-home the connection onto another thread's event base as the
+     * final step of a connection migration. The event must have been
+     * unregistered from the old base (by the thread owning it) before
+     * the connection was handed over.
+     *
+     * @param new_base the receiving thread's event base
+     * @return true if the event got registered with the new base
+     */
+    bool migrateEventBase(struct event_base* new_base);
+
+    /**
+     * Record that the client just issued a command. Feeds the idle
+     * timeout handling in the owning worker's timer wheel; updating
+     * the timestamp is all there is to it (the wheel re-hashes the
+     * connection lazily when it gets to its slot).
+     */
+    void setLastActivity(rel_time_t now) {
+        last_activity = now;
+    }
+
+    /** Get the time the client last issued a command */
+    rel_time_t getLastActivity() const {
+        return last_activity;
+    }
+
+    /**
+     * Get the time this connection should be disconnected as idle, or
+     * 0 if it should not be timed out at all (timeouts disabled, an
+     * admin / DCP / TAP connection, or blocked on an engine operation).
+     */
+    rel_time_t getIdleDeadline() const;
+
+    /** The slot the connection occupies in the owning worker's timer
+        wheel (-1 when not enlisted). Maintained by ConnectionTimerWheel. */
+    int getTimerWheelSlot() const {
+        return timer_wheel_slot;
+    }
+
+    void setTimerWheelSlot(int slot) {
+        timer_wheel_slot = slot;
+    }
+
     short getEventFlags() const {
         return ev_flags;
     }
@@ -537,11 +833,85 @@ public:
         }
     }
 
+    /**
+     * Stash the result of a batched lookup (see bucket_get_multi) for a
+     * request which is still waiting unparsed in the read buffer. The
+     * key pointer points into the read buffer; the stash must be
+     * dropped (releasePrefetchedGets) whenever the buffer contents may
+     * move. On failure the caller still owns the item reference.
+     */
+    bool stashPrefetchedGet(const void* key, uint16_t nkey,
+                            void* it, ENGINE_ERROR_CODE status) {
+        try {
+            prefetchedGets.push_back(PrefetchedGet{key, nkey, it, status});
+            return true;
+        } catch (std::bad_alloc) {
+            return false;
+        }
+    }
+
+    bool hasPrefetchedGets() const {
+        return prefetchedGetCursor < prefetchedGets.size();
+    }
+
+    /**
+     * Pop the next stashed lookup result. Returns false (and drops the
+     * whole stash) if the stash is empty or the next entry doesn't
+     * match the key being executed; the caller then performs a normal
+     * per-key lookup.
+     */
+    bool consumePrefetchedGet(const void* key, uint16_t nkey,
+                              void** it, ENGINE_ERROR_CODE* status) {
+        if (!hasPrefetchedGets()) {
+            return false;
+        }
+        const auto& entry = prefetchedGets[prefetchedGetCursor];
+        if (entry.nkey != nkey || memcmp(entry.key, key, nkey) != 0) {
+            /* The command stream didn't line up with the batch (e.g. a
+             * request in between was rejected by its validator); throw
+             * the remaining results away. */
+            releasePrefetchedGets();
+            return false;
+        }
+        *it = entry.item;
+        *status = entry.status;
+        if (++prefetchedGetCursor == prefetchedGets.size()) {
+            prefetchedGets.clear();
+            prefetchedGetCursor = 0;
+        }
+        return true;
+    }
+
+    /**
+     * Release all item references held by unconsumed stashed lookup
+     * results.
+     */
+    void releasePrefetchedGets() {
+        ENGINE_HANDLE* handle = reinterpret_cast<ENGINE_HANDLE*>(bucketEngine);
+        for (size_t ii = prefetchedGetCursor; ii < prefetchedGets.size(); ++ii) {
+            if (prefetchedGets[ii].item != nullptr) {
+                bucketEngine->release(handle, this, prefetchedGets[ii].item);
+            }
+        }
+        prefetchedGets.clear();
+        prefetchedGetCursor = 0;
+    }
+
     void releaseTempAlloc() {
         for (auto* ptr : temp_alloc) {
-            cb_free(ptr);
+            /* Arena memory is reclaimed wholesale by the arena reset */
+            if (!scratchArena.owns(ptr)) {
+                cb_free(ptr);
+            }
         }
         temp_alloc.resize(0);
+
+        for (auto* ptr : pooled_alloc) {
+            BufferPool::release(ptr);
+        }
+        pooled_alloc.resize(0);
+
+        blob_refs.clear();
     }
 
     bool pushTempAlloc(char* ptr) {
@@ -556,6 +926,33 @@ public:
         }
     }
 
+    /**
+     * Pin a shared immutable payload (e.g. the cached cluster map for
+     * NOT_MY_VBUCKET) referenced by the current response's iovecs. The
+     * reference is dropped alongside the temp_alloc cleanup once the
+     * response has been transmitted.
+     */
+    bool retainBlobReference(std::shared_ptr<const std::string> blob) {
+        try {
+            blob_refs.push_back(std::move(blob));
+            return true;
+        } catch (std::bad_alloc) {
+            LOG_WARNING(this,
+                        "%u: FATAL: failed to allocate space to keep blob reference",
+                        getId());
+            return false;
+        }
+    }
+
+    /**
+     * Take over the segments backing the given buffer; they stay alive
+     * until the command is done with them (releaseTempAlloc), when the
+     * pooled segments go back to the BufferPool and the arena segments
+     * are left for the arena reset. On failure nothing is transferred
+     * and the buffer keeps ownership.
+     */
+    bool takeBufferOwnership(DynamicBuffer& buf);
+
     bool isNoReply() const {
         return noreply;
     }
@@ -580,6 +977,14 @@ public:
         McbpConnection::supports_mutation_extras = supports_mutation_extras;
     }
 
+    bool isSupportsServerTimings() const {
+        return supports_server_timings;
+    }
+
+    void setSupportsServerTimings(bool supports_server_timings) {
+        McbpConnection::supports_server_timings = supports_server_timings;
+    }
+
     /**
      * Clear the dynamic buffer
      */
@@ -591,13 +996,61 @@ public:
      * Grow the dynamic buffer to
      */
     bool growDynamicBuffer(size_t needed) {
+        if (!accountCommandMemory(needed)) {
+            return false;
+        }
         return dynamicBuffer.grow(needed);
     }
 
+    /**
+     * Account scratch memory about to be allocated on behalf of the
+     * current command against the per-operation memory budget (the
+     * per_op_memory_budget setting). Returns false - without
+     * committing the bytes - when the allocation would push the
+     * command over its budget; the caller should fail the command
+     * with a temporary failure rather than keep allocating.
+     */
+    bool accountCommandMemory(size_t nbytes);
+
+    /**
+     * Has the current command been refused memory by the
+     * per-operation budget? Lets error paths distinguish a budget
+     * refusal (temporary failure) from a genuine allocation failure
+     * (out of memory). Cleared between commands.
+     */
+    bool isCommandBudgetExceeded() const {
+        return cmd_budget_exceeded;
+    }
+
+    /**
+     * Forget the current command's memory accounting; called between
+     * commands (see reset_cmd_handler).
+     */
+    void resetCommandMemory() {
+        cmd_mem_allocated = 0;
+        cmd_budget_exceeded = false;
+    }
+
     DynamicBuffer& getDynamicBuffer() {
         return dynamicBuffer;
     }
 
+    ScratchArena& getScratchArena() {
+        return scratchArena;
+    }
+
+    /**
+     * Reclaim the command scratch arena if nothing allocated from it can
+     * still be live: no responses corked in msglist and no staged
+     * response buffers waiting for transmit to drain. Called between
+     * commands (see reset_cmd_handler).
+     */
+    void maybeResetScratchArena();
+
+    InflatedDocCache& getInflatedDocCache() {
+        return inflatedDocCache;
+    }
+
     hrtime_t getStart() const {
         return start;
     }
@@ -606,6 +1059,63 @@ public:
         McbpConnection::start = start;
     }
 
+    uint64_t getOpDeadline() const {
+        return opDeadline;
+    }
+
+    /**
+     * Set the operation deadline for the connection (in nanoseconds,
+     * 0 disables the deadline). See SET_OP_DEADLINE.
+     */
+    void setOpDeadline(uint64_t deadline) {
+        opDeadline = deadline;
+    }
+
+    hrtime_t getEngineTime() const {
+        return engineTime;
+    }
+
+    /**
+     * Account time spent inside the engine interface for the
+     * current command
+     */
+    void accountEngineTime(hrtime_t nsec) {
+        engineTime += nsec;
+    }
+
+    size_t getResponseBytes() const {
+        return responseBytes;
+    }
+
+    /**
+     * Account response bytes queued for transmission for the
+     * current command
+     */
+    void accountResponseBytes(size_t nbytes) {
+        responseBytes += nbytes;
+    }
+
+    /**
+     * Reset the per-command resource accounting accumulators (called
+     * when the timer for a new command is started)
+     */
+    void resetCommandAccounting() {
+        engineTime = 0;
+        responseBytes = 0;
+    }
+
+    /**
+     * Get this connection's timings cursor for an opcode: the snapshot
+     * of the histogram returned by the last delta-mode
+     * CMD_GET_CMD_TIMER for the opcode (zeroed until the first delta
+     * request, so the first delta equals the full histogram). Entries
+     * are created on demand; connections which never use delta mode
+     * pay nothing.
+     */
+    TimingHistogram& getTimingsCursor(uint8_t opcode) {
+        return timingsCursor[opcode];
+    }
+
     uint64_t getCAS() const {
         return cas;
     }
@@ -682,6 +1192,13 @@ public:
         ssl.disable();
     }
 
+    /**
+     * Is this connection talking SSL?
+     */
+    bool isSsl() const {
+        return ssl.isEnabled();
+    }
+
     /**
      * Do we have any pending input data on this connection?
      */
@@ -696,6 +1213,161 @@ public:
         return block != 0;
     }
 
+    /**
+     * Do we have the next request fully received (header and body) in
+     * the input buffer? When this is true the next command can be
+     * executed without going back to the network, so we're in the
+     * middle of draining a pipelined burst.
+     */
+    bool havePendingCompleteRequest();
+
+    /**
+     * Flag the response currently being built as safe to cork. A
+     * corkable response may only reference memory which stays valid
+     * until transmit time: data staged in the write buffer, engine
+     * items held on the reserved list, or static text. The flag is
+     * consumed (and cleared) by maybeCorkResponse() for every response.
+     */
+    void setCorkableResponse(bool corkable) {
+        corkableResponse = corkable;
+    }
+
+    /**
+     * The number of responses currently corked (accumulated in msglist
+     * without having been transmitted).
+     */
+    uint32_t getPendingResponses() const {
+        return pendingResponses;
+    }
+
+    /**
+     * Where the next response header (and any extras/body bytes the
+     * executor wants to stage in the write buffer right behind it)
+     * should be placed. While responses are corked the write buffer
+     * acts as a bump allocator with write.bytes as the allocation
+     * offset; the first response of a batch resets it.
+     */
+    char* getResponseHeaderSlot() {
+        if (pendingResponses == 0) {
+            write.curr = write.buf;
+            write.bytes = 0;
+        }
+        return write.buf + write.bytes;
+    }
+
+    /**
+     * Everything queued in msglist is on the wire; leave the corked
+     * state and hand the full write buffer back to the next response.
+     */
+    void resetResponseStaging() {
+        pendingResponses = 0;
+        write.curr = write.buf;
+        write.bytes = 0;
+    }
+
+    /**
+     * The number of request headers (counting the one about to be
+     * parsed) which passed the batch pre-validation scan of the read
+     * buffer; see mcbp_prescan_headers() in mcbp_executors.cc.
+     */
+    uint32_t getPrevalidatedHeaders() const {
+        return prevalidatedHeaders;
+    }
+
+    void setPrevalidatedHeaders(uint32_t count) {
+        prevalidatedHeaders = count;
+    }
+
+    /**
+     * Consume one pre-validated header for the command being parsed.
+     *
+     * @return true if the current header was covered by the batch
+     *         scan (so the per-command sanity checks may be skipped)
+     */
+    bool consumePrevalidatedHeader() {
+        if (prevalidatedHeaders > 0) {
+            --prevalidatedHeaders;
+            currentHeaderPrevalidated = true;
+        } else {
+            currentHeaderPrevalidated = false;
+        }
+        return currentHeaderPrevalidated;
+    }
+
+    /**
+     * Did the header of the command currently being processed pass
+     * the batch pre-validation scan?
+     */
+    bool isCurrentHeaderPrevalidated() const {
+        return currentHeaderPrevalidated;
+    }
+
+    /** Capacity of the decoded header ring below */
+    static const size_t DECODED_HEADER_RING_SIZE = 8;
+
+    /**
+     * Throw away any speculatively decoded headers (the batch scan is
+     * about to walk the read buffer again).
+     */
+    void clearDecodedHeaders() {
+        decodedHeaderHead = 0;
+        decodedHeaderCount = 0;
+    }
+
+    /**
+     * Stash a header the batch scan already validated and byte
+     * swapped, to be picked up by the parse stage in stream order.
+     * Silently drops the header when the ring is full; the parse
+     * stage falls back to decoding in place.
+     */
+    void pushDecodedHeader(const protocol_binary_request_header& header) {
+        if (decodedHeaderCount < DECODED_HEADER_RING_SIZE) {
+            const size_t slot = (decodedHeaderHead + decodedHeaderCount) %
+                                DECODED_HEADER_RING_SIZE;
+            decodedHeaders[slot] = header;
+            ++decodedHeaderCount;
+        }
+    }
+
+    /**
+     * Pop the speculatively decoded (native endian) header for the
+     * command about to be parsed.
+     *
+     * @return the decoded header, or nullptr if the ring ran dry (the
+     *         burst was longer than the ring)
+     */
+    const protocol_binary_request_header* popDecodedHeader() {
+        if (decodedHeaderCount == 0) {
+            return nullptr;
+        }
+        const protocol_binary_request_header* ret =
+            &decodedHeaders[decodedHeaderHead];
+        decodedHeaderHead = (decodedHeaderHead + 1) %
+                            DECODED_HEADER_RING_SIZE;
+        --decodedHeaderCount;
+        return ret;
+    }
+
+    /**
+     * Get the sampler driving the per-phase command timings for this
+     * connection (see PhaseSampler)
+     */
+    PhaseSampler& getPhaseSampler() {
+        return phaseSampler;
+    }
+
+    /**
+     * Try to cork the response we just finished building instead of
+     * transmitting it right away. Corking is only performed when the
+     * executor flagged the response as corkable, the next request is
+     * already fully received in the input buffer and there is headroom
+     * left in the write buffer for the next response to stage its
+     * header.
+     *
+     * @return true if the response was corked (the caller should go
+     *         pick up the next command rather than transmit)
+     */
+    bool maybeCorkResponse();
 
     virtual bool shouldDelete() override;
 
@@ -732,6 +1404,25 @@ public:
 protected:
     void runStateMachinery();
 
+    /**
+     * Re-derive max_reqs_per_event and time_budget from the settings
+     * for the connection's event priority tier.
+     */
+    void updateEventSettings();
+
+    /**
+     * Move the libevent event over to the lane matching the
+     * connection's event priority. Must be called from the worker
+     * thread owning the connection.
+     */
+    void updateEventLane();
+
+    /**
+     * Bumped by bumpEventSettingsGeneration() whenever the settings
+     * backing max_reqs_per_event / time_budget change.
+     */
+    static std::atomic<uint32_t> eventSettingsGeneration;
+
     /**
      * Initialize the event structure and add it to libevent
      *
@@ -750,6 +1441,33 @@ protected:
     /** Is this connection used by a DCP connection? */
     bool dcp;
 
+    /**
+     * Where the last DCP buffer-acknowledgement queued in the current
+     * ship batch ends in the write buffer (nullptr: none). Used
+     * together with the stream identity below to coalesce consecutive
+     * acks in place; any other message appended afterwards moves
+     * write.curr past it and invalidates the candidate.
+     */
+    char* dcp_ack_end;
+    uint32_t dcp_ack_opaque;
+    uint16_t dcp_ack_vbucket;
+
+    /* Per-stream ship accounting (single threaded; see toJSON) */
+    uint64_t dcp_messages;
+    uint64_t dcp_batches;
+    uint64_t dcp_acks_coalesced;
+
+    /* Server-side response compression accounting (single threaded;
+     * see toJSON) */
+    uint64_t compressed_responses;
+    uint64_t compression_bytes_saved;
+
+    /**
+     * The event priority tier this connection draws its reqs-per-event
+     * and time-budget settings from (see setPriority).
+     */
+    EventPriority event_priority;
+
     int max_reqs_per_event; /** The maximum requests we can process in a worker
                                 thread timeslice */
     /**
@@ -758,6 +1476,31 @@ protected:
      */
     int numEvents;
 
+    /**
+     * Nanoseconds of worker thread time this connection may consume in
+     * a single timeslice before it has to yield, or 0 when only the
+     * request count above applies. Derived from the event_time_budget
+     * settings for the connection's priority.
+     */
+    hrtime_t time_budget;
+
+    /** When the current timeslice started (set when the event fires,
+        see runEventLoop) */
+    hrtime_t slice_start;
+
+    /** Bytes staged by the ship-log path during the current timeslice
+        (reset when the event fires, see runEventLoop) */
+    uint64_t ship_bytes_slice;
+
+    /**
+     * The eventSettingsGeneration value max_reqs_per_event and
+     * time_budget were derived from. When a settings change listener
+     * bumps the global generation, the connection re-derives both at
+     * the top of its next event - dynamic settings changes reach every
+     * live connection without any locking on the hot path.
+     */
+    uint32_t event_settings_generation;
+
     /** current command being processed */
     uint8_t cmd;
 
@@ -765,18 +1508,19 @@ protected:
 
     /** Is the connection currently registered in libevent? */
     bool registered_in_libevent;
+    /** Is the event registered with a throttle backoff timeout? */
+    bool event_timeout_armed;
     /** The libevent object */
     struct event event;
     /** The current flags we've registered in libevent */
     short ev_flags;
     /** which events were just triggered */
     short currentEvent;
-    /** When we inserted the object in libevent */
-    rel_time_t ev_insert_time;
-    /** Do we have an event timeout or not */
-    bool ev_timeout_enabled;
-    /** If ev_timeout_enabled is true, the current timeout in libevent */
-    rel_time_t ev_timeout;
+    /** When the client last issued a command (see setLastActivity) */
+    rel_time_t last_activity;
+    /** Slot in the owning worker's timer wheel, or -1 when not
+        enlisted (see ConnectionTimerWheel) */
+    int timer_wheel_slot;
 
     /** which state to go into after finishing current write */
     TaskFunction write_and_go;
@@ -808,12 +1552,76 @@ protected:
     /** number of bytes in current msg */
     int msgbytes;
 
+    /**
+     * Did the executor flag the current response as safe to cork?
+     * See setCorkableResponse().
+     */
+    bool corkableResponse;
+
+    /**
+     * Number of responses corked in msglist awaiting transmission.
+     * While non-zero the write buffer acts as a bump allocator for
+     * response headers; see getResponseHeaderSlot().
+     */
+    uint32_t pendingResponses;
+
+    /**
+     * Number of request headers in the read buffer which passed the
+     * batch pre-validation scan but haven't been parsed yet; see
+     * getPrevalidatedHeaders().
+     */
+    uint32_t prevalidatedHeaders;
+
+    /**
+     * Was the header of the command currently being processed covered
+     * by the batch pre-validation scan?
+     */
+    bool currentHeaderPrevalidated;
+
+    /**
+     * Ring of request headers decoded (validated and byte swapped to
+     * native endian) by the batch scan ahead of the parse stage, so
+     * the decode overlaps with draining the socket instead of running
+     * inside conn_parse_cmd; see mcbp_prescan_headers(). Entries
+     * follow the stream order and are consumed in lockstep with the
+     * pre-validation counter above.
+     */
+    protocol_binary_request_header decodedHeaders[DECODED_HEADER_RING_SIZE];
+    size_t decodedHeaderHead;
+    size_t decodedHeaderCount;
+
+    /**
+     * The 1-in-N sampler feeding the per-phase command timings
+     */
+    PhaseSampler phaseSampler;
+
     /**
      * List of items we've reserved during the command (should call
      * item_release when transmit is complete)
      */
     std::vector<void*> reservedItems;
 
+    /**
+     * One stashed result of a batched lookup; see stashPrefetchedGet()
+     */
+    struct PrefetchedGet {
+        const void* key;
+        uint16_t nkey;
+        void* item;
+        ENGINE_ERROR_CODE status;
+    };
+
+    /**
+     * Lookup results resolved ahead of time for pipelined get requests
+     * still sitting in the read buffer, consumed in request order
+     */
+    std::vector<PrefetchedGet> prefetchedGets;
+
+    /**
+     * Index of the next unconsumed entry in prefetchedGets
+     */
+    size_t prefetchedGetCursor;
+
     /**
      * A vector of temporary allocations that should be freed when the
      * the connection is done sending all of the data. Use pushTempAlloc to
@@ -822,6 +1630,20 @@ protected:
      */
     std::vector<char*> temp_alloc;
 
+    /**
+     * Segments from the BufferPool whose ownership was taken over from
+     * a DynamicBuffer (see takeBufferOwnership); handed back to the
+     * pool alongside the temp_alloc cleanup.
+     */
+    std::vector<char*> pooled_alloc;
+
+    /**
+     * Shared immutable payloads referenced by the current response's
+     * iovecs (see retainBlobReference); released alongside the
+     * temp_alloc cleanup.
+     */
+    std::vector<std::shared_ptr<const std::string>> blob_refs;
+
     /** True if the reply should not be sent (unless there is an error) */
     bool noreply;
 
@@ -838,18 +1660,78 @@ protected:
      */
     bool supports_mutation_extras;
 
+    /**
+     * If the client enabled the server timings feature the responses
+     * of sampled commands carry the server's processing timestamps in
+     * their extras (see mcbp_add_header).
+     */
+    bool supports_server_timings;
+
+    /**
+     * Bump allocator for per-command scratch memory; reset between
+     * commands once nothing allocated from it can still be referenced
+     * (see maybeResetScratchArena). Declared before the dynamic buffer,
+     * which borrows its backing store from it.
+     */
+    ScratchArena scratchArena;
+
+    /**
+     * Bytes of scratch memory the current command has been granted so
+     * far; compared against the per_op_memory_budget setting.
+     */
+    size_t cmd_mem_allocated;
+
+    /** Set when the current command has hit the budget */
+    bool cmd_budget_exceeded;
+
     /**
      * The dynamic buffer is used to format output packets to be sent on
      * the wire.
      */
     DynamicBuffer dynamicBuffer;
 
+    /**
+     * Cache of the last document inflated for a sub-document command,
+     * retained across commands on this connection.
+     */
+    InflatedDocCache inflatedDocCache;
+
     /**
      * The high resolution timer value for when we started executing the
      * current command.
      */
     hrtime_t start;
 
+    /**
+     * The operation deadline set by the client via SET_OP_DEADLINE
+     * (in nanoseconds, 0 means no deadline). Commands whose age
+     * (relative to start) exceeds the deadline are dropped with
+     * DEADLINE_EXCEEDED instead of being dispatched (or resumed)
+     * by process_bin_packet.
+     */
+    uint64_t opDeadline;
+
+    /**
+     * The time spent inside the engine interface for the current
+     * command (accumulated by the bucket_* wrappers in memcached.h,
+     * consumed by mcbp_collect_timings).
+     */
+    hrtime_t engineTime;
+
+    /**
+     * The number of response bytes queued for the current command
+     * (accumulated by mcbp_add_header, consumed by
+     * mcbp_collect_timings).
+     */
+    size_t responseBytes;
+
+    /**
+     * The per-opcode histogram snapshots returned by the last
+     * delta-mode CMD_GET_CMD_TIMER (see getTimingsCursor). Empty
+     * unless the client uses delta mode.
+     */
+    std::unordered_map<uint8_t, TimingHistogram> timingsCursor;
+
     /** the cas to return */
     uint64_t cas;
 
@@ -878,6 +1760,13 @@ protected:
      */
     SslContext ssl;
 
+    /**
+     * Scratch buffer used by sendmsg() to coalesce the entries of the
+     * scatter/gather array into larger chunks before they're encrypted
+     * (only allocated when SSL is in use).
+     */
+    std::vector<char> sslGatherBuf;
+
     /**
      * Ensures that there is room for another struct iovec in a connection's
      * iov list.
@@ -913,6 +1802,10 @@ protected:
     // Total number of bytes sent to the network
     size_t totalSend;
 
+    // Histogram of the number of bytes returned by each read from
+    // the network (useful to see how well reads get batched up)
+    SizeHistogram readSizes;
+
     Cookie cookie;
 };
 
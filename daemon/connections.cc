@@ -16,7 +16,10 @@
  */
 
 #include "connections.h"
+#include "alloc_domain.h"
+#include "experiments.h"
 #include "runtime.h"
+#include "timer_wheel.h"
 #include "utilities/protocol2text.h"
 #include "settings.h"
 #include "stats.h"
@@ -24,15 +27,102 @@
 #include <cJSON.h>
 #include <list>
 #include <algorithm>
+#include <functional>
+#include <vector>
 #include <platform/cb_malloc.h>
 
 /*
- * Free list management for connections.
+ * List management for connections.
+ *
+ * The list exists for the walkers (stats, trace masks, shutdown); the
+ * hot paths are the insert in conn_new and the erase when a connection
+ * dies, which used to serialize every worker thread on a single global
+ * mutex. The list is therefore sharded with a mutex per shard. Shards
+ * are picked by hashing the connection pointer rather than by owning
+ * worker: the thread isn't known yet when the object is allocated, and
+ * connection rebalancing may re-home a connection later, so a
+ * thread-keyed entry would have to move around. A pointer-keyed entry
+ * never moves.
  */
-struct connections {
+struct connection_shard {
     std::mutex mutex;
     std::list<Connection*> conns;
-} connections;
+};
+
+const size_t NUM_CONNECTION_SHARDS = 16;
+static connection_shard conn_shards[NUM_CONNECTION_SHARDS];
+
+static connection_shard& get_shard(const Connection* c) {
+    return conn_shards[std::hash<const Connection*>()(c) %
+                       NUM_CONNECTION_SHARDS];
+}
+
+/*
+ * Per-thread registry of the connections a worker currently owns, kept
+ * in sync by Connection::setThread. The slots form a dense array so
+ * the walks which run on the owning thread (signal_idle_clients, once
+ * a second per worker for the whole lifetime of a bucket deletion)
+ * are a sequential scan of one small array rather than a pointer
+ * chase over every shard of the global list with every other thread's
+ * connections filtered out. Slots are index-based (the connection
+ * remembers its slot so release is O(1)) and generation-counted so a
+ * stale index can never be mistaken for the slot's current occupant.
+ *
+ * The mutex is all but uncontended: it is taken by the owning thread
+ * and, briefly, by another worker completing a connection migration.
+ * The global sharded list stays as-is for lifetime management and the
+ * rare whole-process walkers (shutdown, stats, the debug dump signal
+ * handler).
+ */
+struct thread_conn_slot {
+    Connection* conn;
+    uint32_t generation;
+};
+
+struct thread_conn_registry {
+    std::mutex mutex;
+    std::vector<thread_conn_slot> slots;
+    /* LIFO of vacant slot indices; keeps the occupied prefix dense-ish
+     * under connection churn */
+    std::vector<uint32_t> free_slots;
+};
+
+struct thread_conn_registry* conn_registry_create(void) {
+    return new thread_conn_registry;
+}
+
+void conn_registry_destroy(struct thread_conn_registry* registry) {
+    delete registry;
+}
+
+void conn_update_thread_registration(Connection* c,
+                                     LIBEVENT_THREAD* old_thread,
+                                     LIBEVENT_THREAD* new_thread) {
+    if (old_thread != nullptr && old_thread->conn_registry != nullptr) {
+        auto* registry = old_thread->conn_registry;
+        std::lock_guard<std::mutex> lock(registry->mutex);
+        const uint32_t slot = c->getThreadRegistrySlot();
+        cb_assert(slot < registry->slots.size());
+        cb_assert(registry->slots[slot].conn == c);
+        registry->slots[slot].conn = nullptr;
+        registry->slots[slot].generation++;
+        registry->free_slots.push_back(slot);
+    }
+    if (new_thread != nullptr && new_thread->conn_registry != nullptr) {
+        auto* registry = new_thread->conn_registry;
+        std::lock_guard<std::mutex> lock(registry->mutex);
+        uint32_t slot;
+        if (registry->free_slots.empty()) {
+            slot = uint32_t(registry->slots.size());
+            registry->slots.push_back({c, 0});
+        } else {
+            slot = registry->free_slots.back();
+            registry->free_slots.pop_back();
+            registry->slots[slot].conn = c;
+        }
+        c->setThreadRegistrySlot(slot);
+    }
+}
 
 
 /** Types ********************************************************************/
@@ -46,9 +136,11 @@ enum class BufferLoan {
 
 /** Function prototypes ******************************************************/
 
-static BufferLoan conn_loan_single_buffer(McbpConnection *c, struct net_buf *thread_buf,
-                                             struct net_buf *conn_buf);
-static void conn_return_single_buffer(Connection *c, struct net_buf *thread_buf,
+static BufferLoan conn_loan_single_buffer(McbpConnection *c,
+                                          struct net_buf_pool *thread_pool,
+                                          struct net_buf *conn_buf);
+static void conn_return_single_buffer(Connection *c,
+                                      struct net_buf_pool *thread_pool,
                                       struct net_buf *conn_buf);
 static void conn_destructor(Connection *c);
 static Connection *allocate_connection(SOCKET sfd,
@@ -59,7 +151,8 @@ static ListenConnection* allocate_listen_connection(SOCKET sfd,
                                                     event_base* base,
                                                     in_port_t port,
                                                     sa_family_t family,
-                                                    const struct interface& interf);
+                                                    const struct interface& interf,
+                                                    LIBEVENT_THREAD* worker);
 
 static Connection *allocate_pipe_connection(int fd, event_base *base);
 static void release_connection(Connection *c);
@@ -72,44 +165,82 @@ int signal_idle_clients(LIBEVENT_THREAD *me, int bucket_idx, bool logging)
     // information until we solve the bug.
     logging = true;
 
+    /*
+     * Snapshot this thread's registry instead of signalling while
+     * holding its lock. A bucket deletion runs this walk once a
+     * second on every worker, and we don't want a migration landing
+     * on this thread to stall behind it. The snapshot remains valid
+     * after the lock is dropped because a connection is only ever
+     * released by the thread owning it, and this function runs on
+     * that thread.
+     */
+    std::vector<Connection *> victims;
     int connected = 0;
-    std::lock_guard<std::mutex> lock(connections.mutex);
-    for (auto* c : connections.conns) {
-        if (c->getThread() == me) {
+    {
+        auto* registry = me->conn_registry;
+        std::lock_guard<std::mutex> lock(registry->mutex);
+        for (auto& slot : registry->slots) {
+            auto* c = slot.conn;
+            if (c == nullptr) {
+                continue;
+            }
             ++connected;
             if (bucket_idx == -1 || c->getBucketIndex() == bucket_idx) {
-                c->signalIfIdle(logging, me->index);
+                victims.push_back(c);
             }
         }
     }
 
+    for (auto* c : victims) {
+        c->signalIfIdle(logging, me->index);
+    }
+
     return connected;
 }
 
+int count_drainable_connections(void)
+{
+    int count = 0;
+    for (auto& shard : conn_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto* c : shard.conns) {
+            if (!c->isAdmin() &&
+                dynamic_cast<ListenConnection*>(c) == nullptr) {
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
 void assert_no_associations(int bucket_idx)
 {
-    std::lock_guard<std::mutex> lock(connections.mutex);
-    for (auto* c : connections.conns) {
-        cb_assert(c->getBucketIndex() != bucket_idx);
+    for (auto& shard : conn_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto* c : shard.conns) {
+            cb_assert(c->getBucketIndex() != bucket_idx);
+        }
     }
 }
 
 void destroy_connections(void)
 {
-    std::lock_guard<std::mutex> lock(connections.mutex);
-    /* traverse the list of connections. */
-    for (auto* c : connections.conns) {
-        conn_destructor(c);
+    for (auto& shard : conn_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        /* traverse the list of connections. */
+        for (auto* c : shard.conns) {
+            conn_destructor(c);
+        }
+        shard.conns.clear();
     }
-    connections.conns.clear();
 }
 
 void close_all_connections(void)
 {
     /* traverse the list of connections. */
-    {
-        std::lock_guard<std::mutex> lock(connections.mutex);
-        for (auto* c : connections.conns) {
+    for (auto& shard : conn_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto* c : shard.conns) {
             if (!c->isSocketClosed()) {
                 safe_close(c->getSocketDescriptor());
                 c->setSocketDescriptor(INVALID_SOCKET);
@@ -134,14 +265,17 @@ void close_all_connections(void)
     bool done;
     do {
         done = true;
-        {
-            std::lock_guard<std::mutex> lock(connections.mutex);
-            for (auto* c : connections.conns) {
+        for (auto& shard : conn_shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto* c : shard.conns) {
                 if (c->getRefcount() > 1) {
                     done = false;
                     break;
                 }
             }
+            if (!done) {
+                break;
+            }
         }
 
         if (!done) {
@@ -154,6 +288,11 @@ void run_event_loop(Connection* c, short which) {
     c->runEventLoop(which);
     if (c->shouldDelete()) {
         release_connection(c);
+        return;
+    }
+
+    if (settings.isConnectionRebalance()) {
+        maybe_migrate_connection(c);
     }
 }
 
@@ -161,8 +300,10 @@ ListenConnection* conn_new_server(const SOCKET sfd,
                                   in_port_t parent_port,
                                   sa_family_t family,
                                   const struct interface& interf,
-                                  struct event_base* base) {
-    auto* c = allocate_listen_connection(sfd, base, parent_port, family, interf);
+                                  struct event_base* base,
+                                  LIBEVENT_THREAD* worker) {
+    auto* c = allocate_listen_connection(sfd, base, parent_port, family,
+                                         interf, worker);
     if (c == nullptr) {
         return nullptr;
     }
@@ -204,9 +345,29 @@ Connection* conn_new(const SOCKET sfd, in_port_t parent_port,
 
     c->incrementRefcount();
 
+    {
+        // Place the connection in its A/B experiment arms; evaluated
+        // once here so the assignment sticks for the connection's
+        // lifetime
+        uint32_t eligible;
+        uint32_t treatment;
+        assign_experiments(c->getId(), parent_port, eligible, treatment);
+        c->setExperiments(eligible, treatment);
+    }
+
     associate_initial_bucket(c);
 
     c->setThread(thread);
+
+    auto* mcbp = dynamic_cast<McbpConnection*>(c);
+    if (mcbp != nullptr) {
+        thread->timer_wheel->add(mcbp);
+    }
+
+    if (settings.getBusyPollUsec(parent_port) > 0) {
+        thread->busy_poll_conns++;
+    }
+
     MEMCACHED_CONN_ALLOCATE(c->getId());
 
     if (settings.getVerbose() > 1) {
@@ -228,6 +389,12 @@ Connection* conn_pipe_new(const int fd,
     c->incrementRefcount();
     c->setThread(thread);
     associate_initial_bucket(c);
+
+    auto* mcbp = dynamic_cast<McbpConnection*>(c);
+    if (mcbp != nullptr) {
+        thread->timer_wheel->add(mcbp);
+    }
+
     MEMCACHED_CONN_ALLOCATE(c->getId());
 
     return c;
@@ -242,6 +409,7 @@ void conn_cleanup_engine_allocations(McbpConnection * c) {
     }
 
     c->releaseReservedItems();
+    c->releasePrefetchedGets();
 }
 
 static void conn_cleanup(Connection *c) {
@@ -277,6 +445,7 @@ static void conn_cleanup(Connection *c) {
     c->setSocketDescriptor(INVALID_SOCKET);
     if (mcbpc != nullptr) {
         mcbpc->setStart(0);
+        mcbpc->setOpDeadline(0);
         mcbpc->disableSSL();
     }
 }
@@ -304,6 +473,10 @@ void conn_close(McbpConnection *c) {
                     "Current connection was in the pending-io list.. Nuking it");
     }
     thread->pending_io = list_remove(thread->pending_io, c);
+    thread->timer_wheel->remove(c);
+    if (settings.getBusyPollUsec(c->getParentPort()) > 0) {
+        thread->busy_poll_conns--;
+    }
 
     conn_cleanup(c);
 
@@ -324,9 +497,12 @@ struct listening_port *get_listening_port_instance(const in_port_t port) {
 }
 
 void connection_stats(ADD_STAT add_stats, const void* cookie, const int64_t fd) {
-    std::lock_guard<std::mutex> lock(connections.mutex);
-    for (auto *c : connections.conns) {
-        if (c->getSocketDescriptor() == fd || fd == -1) {
+    for (auto& shard : conn_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto *c : shard.conns) {
+            if (c->getSocketDescriptor() != fd && fd != -1) {
+                continue;
+            }
             cJSON* stats = c->toJSON();
             // no key, JSON value contains all properties of the connection.
             char *stats_str = cJSON_PrintUnformatted(stats);
@@ -346,17 +522,19 @@ void connection_stats(ADD_STAT add_stats, const void* cookie, const int64_t fd)
  * for a bug.
  */
 void dump_connection_stat_signal_handler(evutil_socket_t, short, void *) {
-    std::lock_guard<std::mutex> lock(connections.mutex);
-    for (auto *c : connections.conns) {
-        try {
-            cJSON* json = c->toJSON();
-            char* info = cJSON_PrintUnformatted(json);
-            LOG_NOTICE(c, "Connection: %s", info);
-            cJSON_Free(info);
-            cJSON_Delete(json);
-        } catch (const std::bad_alloc&) {
-            LOG_NOTICE(c, "Failed to allocate memory to dump info for %u",
-                       c->getId());
+    for (auto& shard : conn_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto *c : shard.conns) {
+            try {
+                cJSON* json = c->toJSON();
+                char* info = cJSON_PrintUnformatted(json);
+                LOG_NOTICE(c, "Connection: %s", info);
+                cJSON_Free(info);
+                cJSON_Delete(json);
+            } catch (const std::bad_alloc&) {
+                LOG_NOTICE(c, "Failed to allocate memory to dump info for %u",
+                           c->getId());
+            }
         }
     }
 }
@@ -431,6 +609,7 @@ static Connection *allocate_connection(SOCKET sfd,
                                        event_base *base,
                                        const struct listening_port &interface) {
     Connection *ret = nullptr;
+    ScopedAllocDomain domain(AllocationDomain::Connection);
 
     try {
         switch (interface.protocol) {
@@ -441,8 +620,9 @@ static Connection *allocate_connection(SOCKET sfd,
             ret = new GreenstackConnection(sfd, base, interface);
         }
 
-        std::lock_guard<std::mutex> lock(connections.mutex);
-        connections.conns.push_back(ret);
+        auto& shard = get_shard(ret);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.conns.push_back(ret);
         stats.conn_structs++;
         return ret;
     } catch (std::bad_alloc) {
@@ -461,13 +641,15 @@ static ListenConnection* allocate_listen_connection(SOCKET sfd,
                                                     event_base* base,
                                                     in_port_t port,
                                                     sa_family_t family,
-                                                    const struct interface& interf) {
+                                                    const struct interface& interf,
+                                                    LIBEVENT_THREAD* worker) {
     ListenConnection *ret = nullptr;
 
     try {
-        ret = new ListenConnection(sfd, base, port, family, interf);
-        std::lock_guard<std::mutex> lock(connections.mutex);
-        connections.conns.push_back(ret);
+        ret = new ListenConnection(sfd, base, port, family, interf, worker);
+        auto& shard = get_shard(ret);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.conns.push_back(ret);
         stats.conn_structs++;
         return ret;
     } catch (std::bad_alloc) {
@@ -494,8 +676,9 @@ static Connection *allocate_pipe_connection(int fd, event_base *base) {
     try {
         ret = new PipeConnection(static_cast<SOCKET>(fd), base);
 
-        std::lock_guard<std::mutex> lock(connections.mutex);
-        connections.conns.push_back(ret);
+        auto& shard = get_shard(ret);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.conns.push_back(ret);
         stats.conn_structs++;
         return ret;
     } catch (std::bad_alloc) {
@@ -515,11 +698,12 @@ static Connection *allocate_pipe_connection(int fd, event_base *base) {
  */
 static void release_connection(Connection *c) {
     {
-        std::lock_guard<std::mutex> lock(connections.mutex);
-        auto iter = std::find(connections.conns.begin(), connections.conns.end(), c);
+        auto& shard = get_shard(c);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto iter = std::find(shard.conns.begin(), shard.conns.end(), c);
         // I should assert
-        cb_assert(iter != connections.conns.end());
-        connections.conns.erase(iter);
+        cb_assert(iter != shard.conns.end());
+        shard.conns.erase(iter);
     }
 
     // Finally free it
@@ -528,26 +712,26 @@ static void release_connection(Connection *c) {
 
 /**
  * If the connection doesn't already have a populated conn_buff, ensure that
- * it does by either loaning out the threads, or allocating a new one if
- * necessary.
+ * it does by either leasing a spare buffer from the thread's pool, or
+ * allocating a new one if the pool is empty.
  */
-static BufferLoan conn_loan_single_buffer(McbpConnection *c, struct net_buf *thread_buf,
-                                    struct net_buf *conn_buf)
+static BufferLoan conn_loan_single_buffer(McbpConnection *c,
+                                          struct net_buf_pool *thread_pool,
+                                          struct net_buf *conn_buf)
 {
     /* Already have a (partial) buffer - nothing to do. */
     if (conn_buf->buf != NULL) {
         return BufferLoan::Existing;
     }
 
-    if (thread_buf->buf != NULL) {
-        /* Loan thread's buffer to connection. */
-        *conn_buf = *thread_buf;
-
-        thread_buf->buf = NULL;
-        thread_buf->size = 0;
+    if (thread_pool->count > 0) {
+        /* Lease the most recently returned spare buffer (LIFO keeps the
+         * working set of buffers warm in cache). */
+        *conn_buf = thread_pool->bufs[--thread_pool->count];
         return BufferLoan::Loaned;
     } else {
         /* Need to allocate a new buffer. */
+        ScopedAllocDomain domain(AllocationDomain::Connection);
         conn_buf->buf = reinterpret_cast<char*>(cb_malloc(DATA_BUFFER_SIZE));
         if (conn_buf->buf == NULL) {
             /* Unable to alloc a buffer for the thread. Not much we can do here
@@ -570,9 +754,10 @@ static BufferLoan conn_loan_single_buffer(McbpConnection *c, struct net_buf *thr
 }
 
 /**
- * Return an empty read buffer back to the owning worker thread.
+ * Return an empty buffer back to the owning worker thread's pool.
  */
-static void conn_return_single_buffer(Connection *c, struct net_buf *thread_buf,
+static void conn_return_single_buffer(Connection *c,
+                                      struct net_buf_pool *thread_pool,
                                       struct net_buf *conn_buf) {
     if (conn_buf->buf == NULL) {
         /* No buffer - nothing to do. */
@@ -581,10 +766,16 @@ static void conn_return_single_buffer(Connection *c, struct net_buf *thread_buf,
 
     if ((conn_buf->curr == conn_buf->buf) && (conn_buf->bytes == 0)) {
         /* Buffer clean, dispose of it. */
-        if (thread_buf->buf == NULL) {
-            /* Give back to thread. */
-            *thread_buf = *conn_buf;
+        if (conn_buf->size == DATA_BUFFER_SIZE &&
+            thread_pool->count < BUFFER_POOL_DEPTH) {
+            /* Give back to the thread's pool. */
+            thread_pool->bufs[thread_pool->count++] = *conn_buf;
         } else {
+            /* The pool is full, or the buffer was grown beyond the default
+             * size by a large request which has now drained. Free it; the
+             * connection leases a default sized buffer when it next goes
+             * active, shrinking its footprint back down.
+             */
             cb_free(conn_buf->buf);
         }
         conn_buf->buf = conn_buf->curr = NULL;
@@ -606,11 +797,11 @@ ENGINE_ERROR_CODE apply_connection_trace_mask(const std::string& connid,
     bool enable = mask != "0";
     bool found = false;
 
-    {
-        // Lock the connection array to avoid race conditions with
-        // connections being added / removed / destroyed
-        std::unique_lock<std::mutex> lock(connections.mutex);
-        for (auto* c : connections.conns) {
+    for (auto& shard : conn_shards) {
+        // Lock the shard to avoid race conditions with connections
+        // being added / removed / destroyed
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        for (auto* c : shard.conns) {
             if (c->getId() == id) {
                 c->setTraceEnabled(enable);
                 found = true;
@@ -30,6 +30,25 @@
 extern "C" {
 #endif
 
+/**
+ * Create / destroy the per-thread connection registry: a dense,
+ * generation-counted slot array of the connections a worker currently
+ * owns, kept in sync by Connection::setThread. Per-thread maintenance
+ * walks (signal_idle_clients) scan it sequentially instead of chasing
+ * the global connection list.
+ */
+struct thread_conn_registry* conn_registry_create(void);
+void conn_registry_destroy(struct thread_conn_registry* registry);
+
+/**
+ * Move a connection's registry entry when its thread ownership
+ * changes; called by Connection::setThread (either thread may be
+ * null).
+ */
+void conn_update_thread_registration(Connection* c,
+                                     LIBEVENT_THREAD* old_thread,
+                                     LIBEVENT_THREAD* new_thread);
+
 /* Destroy all connections and reset connection management */
 void destroy_connections(void);
 
@@ -43,11 +62,12 @@ void run_event_loop(Connection* c, short which);
  * If the connection doesn't already have read/write buffers, ensure that it
  * does.
  *
- * In the common case, only one read/write buffer is created per worker thread,
- * and this buffer is loaned to the connection the worker is currently
- * handling. As long as the connection doesn't have a partial read/write (i.e.
- * the buffer is totally consumed) when it goes idle, the buffer is simply
- * returned back to the worker thread.
+ * In the common case the buffers are leased from a small pool of spares
+ * owned by the worker thread, so buffer memory is proportional to the
+ * number of connections the worker is actively handling rather than the
+ * number connected. As long as the connection doesn't have a partial
+ * read/write (i.e. the buffer is totally consumed) when it goes idle, the
+ * buffer is simply returned back to the worker thread's pool.
  *
  * If there is a partial read/write, then the buffer is left loaned to that
  * connection and the worker thread will allocate a new one.
@@ -85,12 +105,16 @@ Connection* conn_new(const SOCKET sfd,
  * @param family the address family used for the port
  * @param interf the interface description
  * @param base the event base to use for the socket
+ * @param worker the worker thread owning the socket when listener
+ *               sharding (SO_REUSEPORT) is in use, nullptr for the
+ *               traditional dispatcher-owned listeners
  */
 ListenConnection* conn_new_server(const SOCKET sfd,
                                   in_port_t parent_port,
                                   sa_family_t family,
                                   const struct interface& interf,
-                                  struct event_base* base);
+                                  struct event_base* base,
+                                  LIBEVENT_THREAD* worker = nullptr);
 
 /*
  * Creates a new connection to a pipe, e.g. stdin.
@@ -136,6 +160,13 @@ void conn_cleanup_engine_allocations(McbpConnection * c);
  */
 int signal_idle_clients(LIBEVENT_THREAD *me, int bucket_idx, bool logging);
 
+/**
+ * Count the connections a drain is still waiting for: the client
+ * connections, excluding the listeners and the admin connections
+ * (which are exempt from a drain so it can be monitored over one).
+ */
+int count_drainable_connections(void);
+
 /**
  * Assert that none of the connections is assciated with
  * the given bucket (debug function).
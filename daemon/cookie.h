@@ -22,6 +22,8 @@ class Command;
 
 class Connection;
 
+class McbpConnection;
+
 /**
  * The Cookie class represents the cookie passed from the memcached core
  * down through the engine interface to the engine.
@@ -36,15 +38,27 @@ class Connection;
  */
 class Cookie {
 public:
+    /**
+     * The type of the function to resume a suspended MCBP command in.
+     * It matches the mcbp_package_execute typedef in mcbp_executors.h
+     * (which we can't include from here without creating a cyclic
+     * dependency between the headers).
+     */
+    typedef void (* PacketExecutor)(McbpConnection* connection, void* packet);
+
     Cookie(Command* cmd)
         : magic(0xdeadcafe),
           connection(nullptr),
-          command(cmd) { }
+          command(cmd),
+          continuation(nullptr),
+          continuationPacket(nullptr) { }
 
     Cookie(Connection* conn)
         : magic(0xdeadcafe),
           connection(conn),
-          command(nullptr) { }
+          command(nullptr),
+          continuation(nullptr),
+          continuationPacket(nullptr) { }
 
     void validate() const {
         if (magic != 0xdeadcafe) {
@@ -53,6 +67,39 @@ public:
         }
     }
 
+    /**
+     * Remember where a command the engine completed asynchronously (by
+     * returning EWOULDBLOCK) should pick up when the engine calls
+     * notify_io_complete. The executor is re-entered directly with the
+     * original packet, skipping the access check and packet validation
+     * which was already performed before the command was handed to the
+     * engine.
+     *
+     * @param executor the executor to re-enter
+     * @param packet the packet the executor was invoked with
+     */
+    void setContinuation(PacketExecutor executor, void* packet) {
+        continuation = executor;
+        continuationPacket = packet;
+    }
+
+    void clearContinuation() {
+        continuation = nullptr;
+        continuationPacket = nullptr;
+    }
+
+    bool hasContinuation() const {
+        return continuation != nullptr;
+    }
+
+    PacketExecutor getContinuation() const {
+        return continuation;
+    }
+
+    void* getContinuationPacket() const {
+        return continuationPacket;
+    }
+
     /**
      * The magic byte is used for development only and will be removed when
      * we've successfully verified that we don't have any calls through the
@@ -65,4 +112,14 @@ public:
     uint64_t magic;
     Connection* const connection;
     Command* const command;
+
+    /**
+     * The executor (and the packet it was processing) to resume in when
+     * the engine notifies us that a command it returned EWOULDBLOCK for
+     * may be completed. Only set for commands which block from within
+     * the packet execution (and not the ones which block into a
+     * dedicated connection state like sasl auth and bucket management).
+     */
+    PacketExecutor continuation;
+    void* continuationPacket;
 };
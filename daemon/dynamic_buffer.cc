@@ -15,43 +15,69 @@
  *   limitations under the License.
  */
 #include "config.h"
+#include "alloc_domain.h"
+#include "buffer_pool.h"
 #include "dynamic_buffer.h"
-
-#include <platform/cb_malloc.h>
+#include "scratch_arena.h"
 
 bool DynamicBuffer::grow(size_t needed) {
-    size_t nsize = size;
-    size_t available = nsize - offset;
-    bool rv = true;
-
-    /* Special case: No buffer -- need to allocate fresh */
-    if (buffer == NULL) {
-        nsize = 1024;
-        available = size = offset = 0;
+    if (!segments.empty()) {
+        const Segment& tail = segments.back();
+        if (tail.size - tail.used >= needed) {
+            return true;
+        }
+    }
+
+    ScopedAllocDomain domain(AllocationDomain::Connection);
+
+    /* Open a fresh segment; what's already written stays where it is
+       (the write path scatter-gathers the chain) so growing never
+       copies. Ask for at least double the previous segment so a
+       writer appending in small pieces still produces a short chain. */
+    size_t nsize = needed;
+    if (!segments.empty() && segments.back().size * 2 > nsize) {
+        nsize = segments.back().size * 2;
+    }
+
+    Segment segment;
+    segment.used = 0;
+    segment.data = nullptr;
+
+    if (arena != nullptr) {
+        segment.data = arena->alloc(nsize);
+        if (segment.data != nullptr) {
+            segment.size = nsize;
+            segment.pooled = false;
+        }
     }
 
-    while (needed > available) {
-        cb_assert(nsize > 0);
-        nsize = nsize << 1;
-        available = nsize - offset;
+    if (segment.data == nullptr) {
+        segment.data = BufferPool::allocate(nsize);
+        if (segment.data == nullptr) {
+            return false;
+        }
+        segment.size = nsize;
+        segment.pooled = true;
     }
 
-    if (nsize != size) {
-        char* ptr = reinterpret_cast<char*>(cb_realloc(buffer, nsize));
-        if (ptr) {
-            buffer = ptr;
-            size = nsize;
-        } else {
-            rv = false;
+    try {
+        segments.push_back(segment);
+    } catch (const std::bad_alloc&) {
+        if (segment.pooled) {
+            BufferPool::release(segment.data);
         }
+        return false;
     }
 
-    return rv;
+    return true;
 }
 
 void DynamicBuffer::clear() {
-    cb_free(buffer);
-    buffer = nullptr;
-    size = 0;
-    offset = 0;
+    for (auto& segment : segments) {
+        if (segment.pooled) {
+            BufferPool::release(segment.data);
+        }
+    }
+    segments.clear();
+    total = 0;
 }
@@ -19,13 +19,55 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
+class ScratchArena;
+
+/**
+ * A growable staging area for response data.
+ *
+ * The buffer is a chain of segments rather than one contiguous
+ * allocation: each grow() that doesn't fit in the current segment
+ * simply opens a new one (drawn from the per-thread BufferPool, or
+ * from the connection's scratch arena while the data fits there), so
+ * growth never copies what has already been written and pointers into
+ * the buffer stay valid. The write path scatter-gathers the chain
+ * (see mcbp_write_and_free).
+ *
+ * Writers see contiguity per reservation, not per buffer: after a
+ * successful grow(n), getCurrent() points at n contiguous writable
+ * bytes, and the writer commits what it wrote with moveOffset().
+ */
 class DynamicBuffer {
 public:
+    /** One contiguous piece of the chain */
+    struct Segment {
+        /** Start of the data area */
+        char* data;
+        /** Usable capacity of the data area */
+        size_t size;
+        /** Number of bytes written so far */
+        size_t used;
+        /** Did the segment come from the BufferPool (as opposed to
+         * the scratch arena, which reclaims its memory wholesale)? */
+        bool pooled;
+    };
+
     DynamicBuffer()
-        : buffer(nullptr),
-          offset(0),
-          size(0) {
+        : total(0),
+          arena(nullptr) {
+        // empty
+    }
+
+    /**
+     * Create a buffer drawing its backing store from the given arena
+     * when it fits (falling back to the segment pool when it doesn't).
+     * The arena must outlive the buffer, and must only be reset once
+     * any segment handed over via takeOwnership() is dead.
+     */
+    explicit DynamicBuffer(ScratchArena& arena_)
+        : total(0),
+          arena(&arena_) {
         // empty
     }
 
@@ -36,7 +78,8 @@ public:
     }
 
     /**
-     * Grow the buffer to have at least <em>needed</em> bytes
+     * Ensure that the buffer can take <em>needed</em> more bytes as one
+     * contiguous write starting at getCurrent()
      *
      * @param needed the number of bytes needed in the buffer
      * @return true if success, false otherwise
@@ -49,24 +92,30 @@ public:
     void clear();
 
     /**
-     * Get the root of the buffer
+     * Get the root of the buffer (the first segment's data; nullptr
+     * when nothing has been allocated - the common "anything staged?"
+     * test)
      */
     char *getRoot() const {
-        return buffer;
+        return segments.empty() ? nullptr : segments.front().data;
     }
 
     /**
-     * Get the "current" pointer (root + offset)
+     * Get the "current" pointer (where the next write goes)
      */
     char *getCurrent() const {
-        return buffer + offset;
+        if (segments.empty()) {
+            return nullptr;
+        }
+        const Segment& tail = segments.back();
+        return tail.data + tail.used;
     }
 
     /**
-     * Get the current offset in the buffer
+     * Get the total number of bytes written into the buffer
      */
     size_t getOffset() const {
-        return offset;
+        return total;
     }
 
     /**
@@ -74,38 +123,57 @@ public:
      * the buffer)
      */
     void moveOffset(size_t num) {
-        offset += num;
-        // Validate that we've not run over the buffer size
-        if (offset > size) {
-            throw std::out_of_range("DynamicBuffer::moveOffset: offset (" +
-                                    std::to_string(offset) + ") > size (" +
-                                    std::to_string(size) + ")");
+        if (segments.empty()) {
+            throw std::out_of_range(
+                "DynamicBuffer::moveOffset: no segment allocated");
+        }
+        Segment& tail = segments.back();
+        tail.used += num;
+        total += num;
+        // Validate that we've not run over the segment size
+        if (tail.used > tail.size) {
+            throw std::out_of_range("DynamicBuffer::moveOffset: used (" +
+                                    std::to_string(tail.used) + ") > size (" +
+                                    std::to_string(tail.size) + ")");
         }
     }
 
     /**
-     * Transfer the ownership of the underlying buffer. The caller is
-     * responsible for freeing the underlying data
+     * Transfer the ownership of the underlying segments. The caller is
+     * responsible for handing pooled segments back to the BufferPool
+     * (and for not outliving the arena for the rest); grab the chain
+     * with getSegments() before calling this.
      */
     void takeOwnership() {
-        buffer = nullptr;
-        size = 0;
-        offset = 0;
+        segments.clear();
+        total = 0;
     }
 
     /**
-     * Get the total size of the allocated buffer. Note that the bytes in
-     * the range [offset, size> is not initialized or used.
+     * Get the total capacity of the allocated segments. Note that the
+     * bytes beyond each segment's used count are not initialized.
      */
     size_t getSize() const {
-        return size;
+        size_t ret = 0;
+        for (const auto& segment : segments) {
+            ret += segment.size;
+        }
+        return ret;
+    }
+
+    /**
+     * The chain of segments making up the buffer, in write order.
+     */
+    const std::vector<Segment>& getSegments() const {
+        return segments;
     }
 
 private:
-    /** Start of the allocated buffer */
-    char* buffer;
-    /** How much of the buffer has been used so far. */
-    size_t offset;
-    /** Total allocated size */
-    size_t size;
+    /** The chain of segments; the last one is the write target */
+    std::vector<Segment> segments;
+    /** Total number of bytes written across all segments */
+    size_t total;
+    /** Arena backing the buffer when set (see the arena constructor);
+     * nullptr means every segment comes from the pool. */
+    ScratchArena* arena;
 };
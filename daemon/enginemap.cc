@@ -117,6 +117,12 @@ bool initialize_engine_map(char **msg, EXTENSION_LOGGER_DESCRIPTOR *logger)
             map[BucketType::EWouldBlock] = createEngine("ewouldblock_engine.so",
                                                         "create_instance",
                                                         logger);
+            // Without MEMCACHED_CRASH_TEST the crash engine runs as a
+            // fault/perf harness serving synthetic items, so make it
+            // creatable as a bucket for benchmark runs
+            map[BucketType::Crash] = createEngine("crash_engine.so",
+                                                  "create_instance",
+                                                  logger);
         } else {
             map[BucketType::Couchstore] = createEngine("ep.so",
                                                        "create_instance",
@@ -16,19 +16,29 @@
  */
 
 #include "executor.h"
+#include "executorpool.h"
+#include "sched_trace.h"
 #include "task.h"
 
 #include <iostream>
 
 Executor::~Executor() {
-    std::unique_lock<std::mutex> lock(mutex);
+    requestShutdown();
+    waitUntilStopped();
+    waitForState(Couchbase::ThreadState::Zombie);
+}
+
+void Executor::requestShutdown() {
+    std::lock_guard<std::mutex> guard(mutex);
     shutdown = true;
     idlecond.notify_all();
-    // Wait until the thread stops
+}
+
+void Executor::waitUntilStopped() {
+    std::unique_lock<std::mutex> lock(mutex);
     while (running) {
         shutdowncond.wait(lock);
     }
-    waitForState(Couchbase::ThreadState::Zombie);
 }
 
 void Executor::run() {
@@ -39,20 +49,46 @@ void Executor::run() {
 
     while (true) {
         std::unique_lock<std::mutex> lock(mutex);
-        while (!shutdown && runq.empty()) {
-            idlecond.wait(lock);
+        while (!shutdown && hiprio_runq.empty() && runq.empty()) {
+            // Before going to sleep, have a look at the siblings in
+            // the pool. They may have tasks queued up behind a
+            // long-running task while we've got nothing to do.
+            lock.unlock();
+            auto stolen = tryStealTask();
+            lock.lock();
+            if (stolen) {
+                stolen->setExecutor(this);
+                getRunQueue(*stolen).push_back(stolen);
+            } else if (!shutdown && hiprio_runq.empty() && runq.empty()) {
+                // (something may have been scheduled while we didn't
+                // hold the lock, so we have to recheck the queues
+                // before blocking)
+                idlecond.wait(lock);
+            }
         }
 
         if (shutdown) {
             break;
         }
 
-        auto task = runq.front();
-        runq.pop();
+        std::shared_ptr<Task> task;
+        if (hiprio_runq.empty()) {
+            task = runq.front();
+            runq.pop_front();
+        } else {
+            task = hiprio_runq.front();
+            hiprio_runq.pop_front();
+        }
+
+        executing = true;
 
         // Release the lock so that others may schedule new events
         lock.unlock();
 
+        // The replay gate has to run without the executor lock held;
+        // a task waiting for its turn must not block schedule()
+        sched_trace_task_execute();
+
         // Lock the task so no one else can touch it and we won't
         // have any races..
         task->getMutex().lock();
@@ -79,6 +115,8 @@ void Executor::run() {
             // using it
             task->getMutex().unlock();
         }
+
+        executing = false;
     }
 
     // wait for the wait-queue to drain...
@@ -96,13 +134,60 @@ void Executor::schedule(const std::shared_ptr<Task>& task, bool runnable) {
     task->setExecutor(this);
 
     if (runnable) {
-        runq.push(task);
+        getRunQueue(*task).push_back(task);
         idlecond.notify_all();
     } else {
         waitq[task.get()] = task;
     }
 }
 
+std::deque<std::shared_ptr<Task> >& Executor::getRunQueue(const Task& task) {
+    if (task.getPriority() == TaskPriority::High) {
+        return hiprio_runq;
+    }
+    return runq;
+}
+
+std::shared_ptr<Task> Executor::tryStealTask() {
+    for (const auto& other : pool.executors) {
+        if (other.get() == this) {
+            continue;
+        }
+        auto task = other->tryDonateTask();
+        if (task) {
+            return task;
+        }
+    }
+
+    return std::shared_ptr<Task>();
+}
+
+std::shared_ptr<Task> Executor::tryDonateTask() {
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        // Someone else is touching my queues right now. The thief
+        // should just move on to the next sibling instead of waiting
+        // for me (and we can't block here anyway; two executors
+        // stealing from each other would deadlock).
+        return std::shared_ptr<Task>();
+    }
+
+    // Hand out the most recently queued entry (the one the longest
+    // away from being picked up by this thread). Tasks sitting in a
+    // run queue aren't being executed and aren't in any wait queue,
+    // so it is safe for the thief to re-pin them to itself.
+    std::shared_ptr<Task> task;
+    if (!hiprio_runq.empty()) {
+        task = hiprio_runq.back();
+        hiprio_runq.pop_back();
+    } else if (!runq.empty()) {
+        task = runq.back();
+        runq.pop_back();
+    }
+
+    return task;
+}
+
 void Executor::makeRunnable(Task* task) {
     if (task->getMutex().try_lock()) {
         task->getMutex().unlock();
@@ -115,13 +200,7 @@ void Executor::makeRunnable(Task* task) {
     if (iter == waitq.end()) {
         throw std::runtime_error("Internal error object is not in the waitq");
     }
-    runq.push(iter->second);
+    getRunQueue(*task).push_back(iter->second);
     waitq.erase(iter);
     idlecond.notify_all();
 }
-
-std::unique_ptr<Executor> createWorker() {
-    auto *executor = new Executor;
-    executor->start();
-    return std::unique_ptr<Executor>(executor);
-}
@@ -18,10 +18,10 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <memory>
 #include <platform/platform.h>
 #include <platform/thread.h>
-#include <queue>
 #include <unordered_map>
 
 /**
@@ -29,6 +29,13 @@
  */
 class Task;
 
+/**
+ * Forward decl of the ExecutorPool. The executors look at the other
+ * members of the pool when they run out of work themselves (in order
+ * to try to steal work from them).
+ */
+class ExecutorPool;
+
 /**
  * The Executor class represents a single executor thread. It keeps
  * working on items in the runq and whenever a request can't be completed
@@ -41,10 +48,16 @@ class Executor : public Couchbase::Thread {
 public:
     /**
      * Initialize the Executor object
+     *
+     * @param pool_ the pool the executor belongs to (the executor tries
+     *              to steal work from its siblings when it runs idle)
      */
-    Executor() : Couchbase::Thread("mc:executor") {
+    Executor(ExecutorPool& pool_)
+        : Couchbase::Thread("mc:executor"),
+          pool(pool_) {
         shutdown.store(false);
         running.store(false);
+        executing.store(false);
     }
 
     Executor(const Executor&) = delete;
@@ -64,9 +77,51 @@ public:
      */
     void makeRunnable(Task* task);
 
+    /**
+     * Is the executor currently executing a task? Used by the pool to
+     * avoid queuing new tasks behind a long-running one when there are
+     * idle executors available.
+     */
+    bool isBusy() const {
+        return executing.load();
+    }
+
+    /**
+     * Ask the executor to shut down, but don't wait for the thread to
+     * stop (see waitUntilStopped). The pool signals all of the
+     * executors before reaping any of them, as an executor may be
+     * inspecting its siblings (trying to steal work) right up until
+     * its thread stops.
+     */
+    void requestShutdown();
+
+    /**
+     * Wait for the executor thread to stop running
+     */
+    void waitUntilStopped();
+
 protected:
     virtual void run() override;
 
+    /**
+     * Get the run queue matching the priority class of the given task
+     */
+    std::deque<std::shared_ptr<Task> >& getRunQueue(const Task& task);
+
+    /**
+     * Try to steal a task from one of the other executors in the pool.
+     * Returns an empty pointer if no task could be obtained.
+     */
+    std::shared_ptr<Task> tryStealTask();
+
+    /**
+     * Try to give away the task at the back of one of my run queues to
+     * an idle sibling. The method backs off immediately (returning an
+     * empty pointer) if the mutex is contended; two executors trying
+     * to steal from each other must not deadlock.
+     */
+    std::shared_ptr<Task> tryDonateTask();
+
     /**
      * Is shutdown requested?
      */
@@ -76,6 +131,17 @@ protected:
      */
     std::atomic_bool running;
 
+    /**
+     * Is the thread currently executing a task?
+     */
+    std::atomic_bool executing;
+
+    /**
+     * The pool the executor belongs to. The other members of the pool
+     * are only inspected when the executor runs out of work itself.
+     */
+    ExecutorPool& pool;
+
     /**
      * All the data structures (and condition variables) is using this
      * single lock...
@@ -84,10 +150,19 @@ protected:
      */
     std::mutex mutex;
 
+    /**
+     * The FIFO queue of high priority commands ready to run. It is
+     * always drained before the normal run queue so that latency
+     * sensitive tasks never queue up behind bulk work. The queues are
+     * deques (and not plain queues) because the owning thread consumes
+     * from the front while a stealing sibling takes from the back.
+     */
+    std::deque<std::shared_ptr<Task> > hiprio_runq;
+
     /**
      * The FIFO queue of commands ready to run
      */
-    std::queue<std::shared_ptr<Task> > runq;
+    std::deque<std::shared_ptr<Task> > runq;
 
     /**
      * When a task is being served by a backend thread it is put in
@@ -111,5 +186,3 @@ protected:
      */
     std::condition_variable shutdowncond;
 };
-
-std::unique_ptr<Executor> createWorker();
@@ -26,7 +26,23 @@ ExecutorPool::ExecutorPool(size_t sz) {
     roundRobin.store(0);
     executors.reserve(sz);
     for (size_t ii = 0; ii < sz; ++ii) {
-        executors.emplace_back(createWorker());
+        executors.emplace_back(new Executor(*this));
+    }
+
+    // Don't start any of the threads before the vector is fully
+    // populated; the executors look at their siblings when they try
+    // to steal work.
+    for (auto& executor : executors) {
+        executor->start();
+    }
+}
+
+ExecutorPool::~ExecutorPool() {
+    for (auto& executor : executors) {
+        executor->requestShutdown();
+    }
+    for (auto& executor : executors) {
+        executor->waitUntilStopped();
     }
 }
 
@@ -37,5 +53,18 @@ void ExecutorPool::schedule(std::shared_ptr<Task>& task, bool runnable) {
             "The mutex should be held when trying to schedule a event");
     }
 
-    executors[++roundRobin % executors.size()]->schedule(task, runnable);
+    // Prefer an executor which isn't executing anything right now so
+    // that the task won't end up waiting behind a long-running task.
+    // The round robin counter makes us spread the load when all of
+    // them are busy.
+    const auto start = size_t(++roundRobin);
+    for (size_t ii = 0; ii < executors.size(); ++ii) {
+        auto& candidate = executors[(start + ii) % executors.size()];
+        if (!candidate->isBusy()) {
+            candidate->schedule(task, runnable);
+            return;
+        }
+    }
+
+    executors[start % executors.size()]->schedule(task, runnable);
 }
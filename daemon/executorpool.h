@@ -24,8 +24,11 @@
 
 /**
  * As the name implies the ExecutorPool is pool of executors to execute
- * tasks. A task is pinned to a thread when it is being scheduled
- * (by using round robin) and never switch the thread.
+ * tasks. A task is initially handed to one of the executors (preferring
+ * an idle one, falling back to round robin when they're all busy), but
+ * an executor which runs out of work may steal queued (not yet started)
+ * tasks from its siblings. Once a task has started executing it never
+ * switch the thread.
  */
 class ExecutorPool {
 public:
@@ -34,6 +37,13 @@ public:
      */
     ExecutorPool(size_t sz);
 
+    /**
+     * Shut down all of the executors and wait for their threads to
+     * stop before any of them is destroyed (an executor may be trying
+     * to steal work from a sibling right up until its thread stops).
+     */
+    ~ExecutorPool();
+
     ExecutorPool(const ExecutorPool &) = delete;
 
     /**
@@ -47,6 +57,12 @@ public:
     void schedule(std::shared_ptr<Task>& task, bool runnable = true);
 
 private:
+    /**
+     * The executors inspect the other members of the pool when they
+     * try to steal work
+     */
+    friend class Executor;
+
     /**
      * The actual list of executors
      */
@@ -0,0 +1,125 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "experiments.h"
+#include "settings.h"
+#include "timings.h"
+
+#include <platform/crc32c.h>
+
+#include <atomic>
+#include <stdexcept>
+
+/**
+ * The runtime state of one configured experiment. The seed mixes the
+ * experiment name into the connection-id hash so two experiments at
+ * the same percentage don't select the same population.
+ */
+struct Experiment {
+    Experiment() {
+        arm_size[0] = 0;
+        arm_size[1] = 0;
+    }
+
+    std::string name;
+    int percentage = 0;
+    in_port_t port = 0;
+    uint32_t seed = 0;
+    /** arm histograms: [0] = control, [1] = treatment */
+    Timings timings[2];
+    /** connections placed in each arm since startup */
+    std::atomic<uint64_t> arm_size[2];
+};
+
+static Experiment experiments[MAX_EXPERIMENTS];
+static size_t num_experiments = 0;
+
+void initialize_experiments() {
+    const auto& configured = settings.getExperiments();
+    if (configured.size() > MAX_EXPERIMENTS) {
+        throw std::invalid_argument(
+            "Only " + std::to_string(MAX_EXPERIMENTS) +
+            " experiments may be configured at a time");
+    }
+
+    for (const auto& exp : configured) {
+        auto& slot = experiments[num_experiments++];
+        slot.name = exp.name;
+        slot.percentage = exp.percentage;
+        slot.port = exp.port;
+        slot.seed = crc32c(reinterpret_cast<const uint8_t*>(exp.name.data()),
+                           exp.name.size(), 0);
+    }
+}
+
+size_t experiments_count() {
+    return num_experiments;
+}
+
+const std::string& experiment_name(size_t index) {
+    return experiments[index].name;
+}
+
+void assign_experiments(uint32_t id, in_port_t port,
+                        uint32_t& eligible, uint32_t& treatment) {
+    eligible = 0;
+    treatment = 0;
+
+    for (size_t ii = 0; ii < num_experiments; ++ii) {
+        auto& exp = experiments[ii];
+        if (exp.port != 0 && exp.port != port) {
+            // a port-scoped experiment counts connections on other
+            // ports towards neither arm
+            continue;
+        }
+        eligible |= uint32_t(1) << ii;
+
+        const auto hash = crc32c(reinterpret_cast<const uint8_t*>(&id),
+                                 sizeof(id), exp.seed);
+        const bool in_arm = int(hash % 100) < exp.percentage;
+        if (in_arm) {
+            treatment |= uint32_t(1) << ii;
+        }
+        exp.arm_size[in_arm ? 1 : 0]++;
+    }
+}
+
+void collect_experiment_timings(uint32_t eligible, uint32_t treatment,
+                                uint8_t opcode, hrtime_t nsec, size_t shard) {
+    for (size_t ii = 0; ii < num_experiments; ++ii) {
+        const uint32_t bit = uint32_t(1) << ii;
+        if ((eligible & bit) == 0) {
+            continue;
+        }
+        const size_t arm = (treatment & bit) != 0 ? 1 : 0;
+        experiments[ii].timings[arm].collect(opcode, nsec, shard);
+    }
+}
+
+Timings& experiment_timings(size_t index, bool treatment) {
+    return experiments[index].timings[treatment ? 1 : 0];
+}
+
+uint64_t experiment_arm_size(size_t index, bool treatment) {
+    return experiments[index].arm_size[treatment ? 1 : 0].load();
+}
+
+void reset_experiment_timings() {
+    for (size_t ii = 0; ii < num_experiments; ++ii) {
+        experiments[ii].timings[0].reset();
+        experiments[ii].timings[1].reset();
+    }
+}
@@ -0,0 +1,111 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <platform/platform.h>
+
+class Timings;
+
+/**
+ * Built-in A/B experiments ("experiments" in the settings).
+ *
+ * Rolling a performance feature out behind a flag only answers "does
+ * it work"; answering "does it help" requires comparing the latency
+ * of traffic with and without the feature, which so far needed
+ * external orchestration. An experiment splits real connections into
+ * a treatment and a control arm at accept time - the hash of the
+ * connection id (mixed with the experiment name, so concurrent
+ * experiments decorrelate) selects the configured percentage - and
+ * the command timings of the two arms are recorded into separate
+ * per-opcode histograms, reported by "stats experiments".
+ *
+ * An experiment may be restricted to one interface ("port" in the
+ * config); connections on other ports then count towards neither arm,
+ * so a port-scoped canary isn't compared against traffic with a
+ * different workload mix.
+ *
+ * The assignment itself is advisory: the code being experimented on
+ * asks its connection (getExperimentTreatment) whether to take the
+ * new path. Assignment is evaluated once per connection and the
+ * configuration is frozen at startup, because reshuffling the
+ * populations mid-run would poison the measurements.
+ */
+
+/** The maximum number of concurrently configured experiments */
+const size_t MAX_EXPERIMENTS = 4;
+
+/**
+ * Snapshot the configured experiments from the settings into the
+ * runtime assignment table. Called once at startup, after the
+ * configuration has been parsed and before any connection is
+ * accepted.
+ */
+void initialize_experiments();
+
+/** Get the number of configured experiments */
+size_t experiments_count();
+
+/** Get the name of the given experiment (index < experiments_count()) */
+const std::string& experiment_name(size_t index);
+
+/**
+ * Evaluate the arm assignment for a newly accepted connection.
+ *
+ * @param id the connection id
+ * @param port the port the connection was accepted on
+ * @param eligible out: bit ii set when the connection counts towards
+ *                 experiment ii at all (it was accepted on the right
+ *                 port)
+ * @param treatment out: bit ii set when the connection is in the
+ *                  treatment arm of experiment ii (implies eligible)
+ */
+void assign_experiments(uint32_t id, in_port_t port,
+                        uint32_t& eligible, uint32_t& treatment);
+
+/**
+ * Charge a completed command to the arm histograms of every
+ * experiment the connection is eligible for.
+ *
+ * @param eligible the connection's eligibility mask
+ * @param treatment the connection's treatment mask
+ * @param opcode the opcode of the completed command
+ * @param nsec the duration of the operation
+ * @param shard the calling worker's thread index
+ */
+void collect_experiment_timings(uint32_t eligible, uint32_t treatment,
+                                uint8_t opcode, hrtime_t nsec, size_t shard);
+
+/**
+ * Get the per-opcode timings of one arm of an experiment (used by the
+ * "stats experiments" group).
+ */
+Timings& experiment_timings(size_t index, bool treatment);
+
+/**
+ * Get the number of connections placed in the treatment (arm = true)
+ * or control (arm = false) arm of the given experiment since startup.
+ */
+uint64_t experiment_arm_size(size_t index, bool treatment);
+
+/** Reset the arm histograms of every experiment ("stats reset") */
+void reset_experiment_timings();
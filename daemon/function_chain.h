@@ -120,6 +120,10 @@ public:
         return chain.empty();
     }
 
+    size_t size() const {
+        return chain.size();
+    }
+
 private:
     /*
      * Vector to store the chain of Function objects.
@@ -83,10 +83,15 @@ static void sendResponse(GreenstackConnection* c, Greenstack::Message& message,
         throw std::runtime_error("Flex header not implemented.");
     }
 
-    // @todo optimize me. We don't want to copy between all of these
-    //       temporary buffers.
-    std::vector<uint8_t> data;
-    Greenstack::Frame::encode(message, data);
+    // Encode into the connection's reusable frame buffer; the buffer
+    // keeps its allocation from response to response so steady state
+    // encoding allocates nothing.
+    // @todo the remaining copy into the dynamic buffer goes away once
+    //       the connection gets vectored output (pointing an iovec
+    //       straight at the encode buffer).
+    auto& data = c->getFrameEncodeBuffer();
+    data.clear();
+    Greenstack::Frame::encode(&message, data);
 
     if (!c->growDynamicBuffer(data.size())) {
         if (settings.verbose > 0) {
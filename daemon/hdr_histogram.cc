@@ -0,0 +1,193 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "hdr_histogram.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <cJSON.h>
+#include <cJSON_utils.h>
+
+HdrHistogram::HdrHistogram(int significant_digits)
+    : significant_digits(significant_digits) {
+    if (significant_digits < 1 || significant_digits > 3) {
+        throw std::invalid_argument(
+            "HdrHistogram: significant_digits must be 1-3");
+    }
+
+    // The first (linear) bucket must resolve 2 * 10^digits distinct
+    // values so every power-of-two range above it preserves the
+    // requested precision.
+    uint64_t largest = 2;
+    for (int ii = 0; ii < significant_digits; ++ii) {
+        largest *= 10;
+    }
+
+    sub_bucket_bits = 1;
+    while ((uint64_t(1) << sub_bucket_bits) < largest) {
+        ++sub_bucket_bits;
+    }
+    sub_bucket_count = size_t(1) << sub_bucket_bits;
+    sub_bucket_half_count = sub_bucket_count / 2;
+
+    bucket_count = 1;
+    while ((uint64_t(sub_bucket_count) << (bucket_count - 1)) <
+           highest_trackable) {
+        ++bucket_count;
+    }
+
+    counts = std::vector<std::atomic<uint32_t>>(
+        (bucket_count + 1) * sub_bucket_half_count);
+
+    reset();
+}
+
+void HdrHistogram::reset(void) {
+    for (auto& count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    max_value.store(0, std::memory_order_relaxed);
+}
+
+size_t HdrHistogram::value_to_index(uint64_t usec) const {
+    if (usec > highest_trackable) {
+        usec = highest_trackable;
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    const int msb = 63 - __builtin_clzll(usec | (sub_bucket_count - 1));
+    const size_t bucket = size_t(msb) - size_t(sub_bucket_bits - 1);
+#else
+    size_t bucket = 0;
+    while ((usec >> bucket) >= sub_bucket_count) {
+        ++bucket;
+    }
+#endif
+
+    const size_t sub = size_t(usec >> bucket);
+    size_t index = (bucket + 1) * sub_bucket_half_count +
+                   (sub - sub_bucket_half_count);
+    if (index >= counts.size()) {
+        index = counts.size() - 1;
+    }
+    return index;
+}
+
+uint64_t HdrHistogram::index_to_value(size_t index) const {
+    size_t bucket;
+    size_t sub;
+    if (index < sub_bucket_count) {
+        bucket = 0;
+        sub = index;
+    } else {
+        bucket = (index / sub_bucket_half_count) - 1;
+        sub = (index % sub_bucket_half_count) + sub_bucket_half_count;
+    }
+
+    return ((uint64_t(sub) + 1) << bucket) - 1;
+}
+
+void HdrHistogram::add(const hrtime_t nsec) {
+    const uint64_t usec = uint64_t(nsec) / 1000;
+
+    counts[value_to_index(usec)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t prev = max_value.load(std::memory_order_relaxed);
+    while (usec > prev &&
+           !max_value.compare_exchange_weak(prev, usec,
+                                            std::memory_order_relaxed)) {
+        // prev reloaded by compare_exchange_weak
+    }
+}
+
+HdrHistogram& HdrHistogram::operator+=(const HdrHistogram& other) {
+    if (sub_bucket_bits != other.sub_bucket_bits ||
+        counts.size() != other.counts.size()) {
+        throw std::logic_error(
+            "HdrHistogram::operator+=: incompatible configuration");
+    }
+
+    for (size_t ii = 0; ii < counts.size(); ++ii) {
+        counts[ii].fetch_add(other.counts[ii].load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+    }
+    total.fetch_add(other.total.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+
+    uint64_t omax = other.max_value.load(std::memory_order_relaxed);
+    uint64_t prev = max_value.load(std::memory_order_relaxed);
+    while (omax > prev &&
+           !max_value.compare_exchange_weak(prev, omax,
+                                            std::memory_order_relaxed)) {
+    }
+
+    return *this;
+}
+
+uint64_t HdrHistogram::get_total() const {
+    return total.load(std::memory_order_relaxed);
+}
+
+uint64_t HdrHistogram::get_max() const {
+    return max_value.load(std::memory_order_relaxed);
+}
+
+uint64_t HdrHistogram::get_percentile(double pct) const {
+    const uint64_t count = get_total();
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t target = uint64_t(std::ceil((pct / 100.0) * double(count)));
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t ii = 0; ii < counts.size(); ++ii) {
+        seen += counts[ii].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return index_to_value(ii);
+        }
+    }
+
+    return get_max();
+}
+
+std::string HdrHistogram::to_string(void) {
+    unique_cJSON_ptr json(cJSON_CreateObject());
+    cJSON* root = json.get();
+
+    if (root == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    cJSON_AddNumberToObject(root, "total", double(get_total()));
+    cJSON_AddNumberToObject(root, "p50", double(get_percentile(50.0)));
+    cJSON_AddNumberToObject(root, "p90", double(get_percentile(90.0)));
+    cJSON_AddNumberToObject(root, "p99", double(get_percentile(99.0)));
+    cJSON_AddNumberToObject(root, "p99.9", double(get_percentile(99.9)));
+    cJSON_AddNumberToObject(root, "max", double(get_max()));
+
+    char* ptr = cJSON_PrintUnformatted(root);
+    std::string ret(ptr);
+    cJSON_Free(ptr);
+
+    return ret;
+}
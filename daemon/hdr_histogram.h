@@ -0,0 +1,98 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+ * A high dynamic range latency histogram in the style of HdrHistogram:
+ * values (in microseconds) are recorded into log-linear buckets, i.e.
+ * power-of-two ranges each split into enough linear sub-buckets to
+ * preserve the configured number of significant decimal digits. Unlike
+ * the coarse fixed ranges in TimingHistogram this resolves e.g. 400us
+ * from 800us at the high percentiles.
+ *
+ * Recording is a relaxed atomic increment of a single counter (plus a
+ * relaxed max update), so a histogram may be shared or sharded the
+ * same way as TimingHistogram.
+ */
+class HdrHistogram {
+public:
+    /**
+     * Create a histogram
+     *
+     * @param significant_digits the number of significant decimal
+     *        digits to preserve (1-3); more digits means more
+     *        sub-buckets and a bigger counter array
+     * @throws std::invalid_argument for an unsupported digit count
+     */
+    explicit HdrHistogram(int significant_digits = 2);
+
+    /** Record a timing sample */
+    void add(const hrtime_t nsec);
+
+    void reset(void);
+
+    /**
+     * Merge the samples of the other histogram into this one. Both
+     * histograms must be created with the same number of significant
+     * digits.
+     */
+    HdrHistogram& operator+=(const HdrHistogram& other);
+
+    /** The number of recorded samples */
+    uint64_t get_total() const;
+
+    /** The largest recorded value (in usec, exact) */
+    uint64_t get_max() const;
+
+    /**
+     * Get the value (in usec) at the given percentile (0 < pct <= 100),
+     * e.g. 99.9 for p99.9. The value is the upper bound of the bucket
+     * the percentile falls in.
+     */
+    uint64_t get_percentile(double pct) const;
+
+    /**
+     * Generate a JSON representation with the total sample count and
+     * the p50/p90/p99/p99.9/max values in usec
+     */
+    std::string to_string(void);
+
+private:
+    /** Get the counter slot for a value (clamped to the trackable range) */
+    size_t value_to_index(uint64_t usec) const;
+
+    /** Get the highest value (in usec) mapping to a counter slot */
+    uint64_t index_to_value(size_t index) const;
+
+    /** Values above this (100 seconds, in usec) all land in the top bucket */
+    static const uint64_t highest_trackable = 100000000;
+
+    int significant_digits;
+    int sub_bucket_bits;
+    size_t sub_bucket_count;
+    size_t sub_bucket_half_count;
+    size_t bucket_count;
+
+    std::vector<std::atomic<uint32_t>> counts;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> max_value;
+};
@@ -19,10 +19,19 @@
 
 #include "config.h"
 #include "alloc_hooks.h"
+#include "buckets.h"
+#include "config_parse.h"
 #include "connections.h"
+#include "mc_time.h"
+#include "settings.h"
+#include "utilities/protocol2text.h"
 #include "utilities/string_utilities.h"
+#include "profiler.h"
+#include "slow_log.h"
 #include "tracing.h"
 
+#include <cJSON.h>
+
 /*
  * Implement ioctl-style memcached commands (ioctl_get / ioctl_set).
  */
@@ -54,6 +63,754 @@ static ENGINE_ERROR_CODE setReleaseFreeMemory(Connection* c,
     return ENGINE_SUCCESS;
 }
 
+/**
+ * Find the allocator arena of the bucket named in the "bucket"
+ * argument, or of the connected bucket when no argument is given.
+ *
+ * @return false when no such (ready) bucket exists, or when it has no
+ *         dedicated arena
+ */
+static bool lookupBucketArena(Connection* c,
+                              const StrToStrMap& arguments,
+                              unsigned& arena) {
+    auto entry = arguments.find("bucket");
+    if (entry == arguments.end()) {
+        arena = all_buckets[c->getBucketIndex()].arena;
+        return arena != 0;
+    }
+
+    for (auto& bucket : all_buckets) {
+        bool match = false;
+        cb_mutex_enter(&bucket.mutex);
+        if (bucket.state == BucketState::Ready &&
+            entry->second == bucket.name) {
+            match = true;
+            arena = bucket.arena;
+        }
+        cb_mutex_exit(&bucket.mutex);
+        if (match) {
+            return arena != 0;
+        }
+    }
+    return false;
+}
+
+/**
+ * Callback for purging the allocator arena of a bucket, handing the
+ * dirty pages the arena sits on back to the OS
+ */
+static ENGINE_ERROR_CODE setArenaPurge(Connection* c,
+                                       const StrToStrMap& arguments,
+                                       const std::string&) {
+    unsigned arena;
+    if (!lookupBucketArena(c, arguments, arena)) {
+        return ENGINE_KEY_ENOENT;
+    }
+    mc_arena_purge(arena);
+    LOG_NOTICE(c, "%u: IOCTL_SET: alloc.arena.purge on arena %u",
+               c->getId(), arena);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for tuning the decay time (in seconds; -1 disables decay)
+ * of the allocator arena of a bucket, controlling how aggressively
+ * unused dirty pages are returned to the OS
+ */
+static ENGINE_ERROR_CODE setArenaDecayTime(Connection* c,
+                                           const StrToStrMap& arguments,
+                                           const std::string& value) {
+    unsigned arena;
+    if (!lookupBucketArena(c, arguments, arena)) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    ssize_t decay_time;
+    try {
+        decay_time = ssize_t(std::stol(value));
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+
+    if (!mc_set_arena_decay_time(arena, decay_time)) {
+        return ENGINE_ENOTSUP;
+    }
+    LOG_NOTICE(c, "%u: IOCTL_SET: alloc.arena.decay_time on arena %u "
+                  "set to %ld", c->getId(), arena, long(decay_time));
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Map the optional "priority" argument to the event priority tier it
+ * names; the default tier is used when the argument is absent.
+ *
+ * @return false when the argument names no known tier
+ */
+static bool lookupEventPriority(const StrToStrMap& arguments,
+                                EventPriority& priority) {
+    auto entry = arguments.find("priority");
+    if (entry == arguments.end() || entry->second == "default") {
+        priority = EventPriority::Default;
+    } else if (entry->second == "high") {
+        priority = EventPriority::High;
+    } else if (entry->second == "medium") {
+        priority = EventPriority::Medium;
+    } else if (entry->second == "low") {
+        priority = EventPriority::Low;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Callback for reading the reqs-per-event limit of a priority tier
+ * (selected with the "priority" argument; default tier when absent)
+ */
+static ENGINE_ERROR_CODE getReqsPerEvent(Connection* c,
+                                         const StrToStrMap& arguments,
+                                         std::string& value) {
+    EventPriority priority;
+    if (!lookupEventPriority(arguments, priority)) {
+        return ENGINE_EINVAL;
+    }
+    value = std::to_string(settings.getRequestsPerEventNotification(priority));
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for changing the reqs-per-event limit of a priority tier at
+ * runtime. The settings change listener invalidates the copy cached by
+ * every live connection.
+ */
+static ENGINE_ERROR_CODE setReqsPerEvent(Connection* c,
+                                         const StrToStrMap& arguments,
+                                         const std::string& value) {
+    EventPriority priority;
+    if (!lookupEventPriority(arguments, priority)) {
+        return ENGINE_EINVAL;
+    }
+
+    int reqs;
+    try {
+        reqs = std::stoi(value);
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+    if (reqs < 1) {
+        return ENGINE_EINVAL;
+    }
+
+    settings.setRequestsPerEventNotification(reqs, priority);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for reading the per-event time budget (in microseconds) of
+ * a priority tier
+ */
+static ENGINE_ERROR_CODE getEventTimeBudget(Connection* c,
+                                            const StrToStrMap& arguments,
+                                            std::string& value) {
+    EventPriority priority;
+    if (!lookupEventPriority(arguments, priority)) {
+        return ENGINE_EINVAL;
+    }
+    value = std::to_string(settings.getEventTimeBudget(priority));
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for changing the per-event time budget (in microseconds;
+ * 0 disables the budget) of a priority tier at runtime
+ */
+static ENGINE_ERROR_CODE setEventTimeBudget(Connection* c,
+                                            const StrToStrMap& arguments,
+                                            const std::string& value) {
+    EventPriority priority;
+    if (!lookupEventPriority(arguments, priority)) {
+        return ENGINE_EINVAL;
+    }
+
+    int us;
+    try {
+        us = std::stoi(value);
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+    if (us < 0) {
+        return ENGINE_EINVAL;
+    }
+
+    settings.setEventTimeBudget(us, priority);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for reading the greedy read budget (bytes per event; 0
+ * means greedy reads are disabled)
+ */
+static ENGINE_ERROR_CODE getGreedyReadBudget(Connection* c,
+                                             const StrToStrMap& arguments,
+                                             std::string& value) {
+    value = std::to_string(settings.getGreedyReadBudget());
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for changing the greedy read budget at runtime. The budget
+ * is read from the settings on every event, so no further propagation
+ * is needed.
+ */
+static ENGINE_ERROR_CODE setGreedyReadBudget(Connection* c,
+                                             const StrToStrMap& arguments,
+                                             const std::string& value) {
+    size_t budget;
+    try {
+        budget = size_t(std::stoul(value));
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+
+    settings.setGreedyReadBudget(budget);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for initiating a drain ahead of a planned restart: stop
+ * accepting new clients and disconnect the connected ones at their
+ * next command boundary. The value is the grace period in seconds;
+ * connections still around when it expires are disconnected regardless
+ * of state. Issuing the command again just moves the deadline.
+ */
+static ENGINE_ERROR_CODE setDrainStart(Connection* c,
+                                       const StrToStrMap&,
+                                       const std::string& value) {
+    int grace;
+    try {
+        grace = std::stoi(value);
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+    if (grace < 1) {
+        return ENGINE_EINVAL;
+    }
+
+    LOG_NOTICE(c, "%u: IOCTL_SET: drain.start with a %d second grace period",
+               c->getId(), grace);
+    initiate_drain(rel_time_t(grace));
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for reporting drain progress as a JSON object: the state
+ * ("running", "draining" or "drained"), the number of client
+ * connections the drain is still waiting for, and - while draining -
+ * the number of seconds left until remaining connections are forcibly
+ * disconnected.
+ */
+static ENGINE_ERROR_CODE getDrainStatus(Connection* c,
+                                        const StrToStrMap&,
+                                        std::string& value) {
+    const int remaining = count_drainable_connections();
+
+    cJSON* json = cJSON_CreateObject();
+    if (is_draining()) {
+        cJSON_AddStringToObject(json, "state",
+                                remaining == 0 ? "drained" : "draining");
+        const rel_time_t now = mc_time_get_current_time();
+        const rel_time_t deadline = get_drain_deadline();
+        cJSON_AddNumberToObject(json, "deadline_in",
+                                deadline > now ? double(deadline - now) : 0);
+    } else {
+        cJSON_AddStringToObject(json, "state", "running");
+    }
+    cJSON_AddNumberToObject(json, "connections", remaining);
+
+    char* ptr = cJSON_PrintUnformatted(json);
+    value.assign(ptr);
+    cJSON_Free(ptr);
+    cJSON_Delete(json);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Find the index of the bucket named in the "bucket" argument, or of
+ * the connected bucket when no argument is given.
+ *
+ * @return -1 when no such (ready) bucket exists
+ */
+static int lookupBucketIndex(Connection* c, const StrToStrMap& arguments) {
+    auto entry = arguments.find("bucket");
+    if (entry == arguments.end()) {
+        return c->getBucketIndex();
+    }
+
+    int ii = 0;
+    for (auto& bucket : all_buckets) {
+        bool match;
+        cb_mutex_enter(&bucket.mutex);
+        match = (bucket.state == BucketState::Ready &&
+                 entry->second == bucket.name);
+        cb_mutex_exit(&bucket.mutex);
+        if (match) {
+            return ii;
+        }
+        ++ii;
+    }
+    return -1;
+}
+
+/**
+ * Look up the throttle token bucket named by the "resource" argument
+ * ("ops" or "bytes") of the bucket selected by the "bucket" argument
+ * (default: the connected bucket).
+ *
+ * @return nullptr when the bucket or the resource doesn't exist
+ */
+static TokenBucket* lookupThrottle(Connection* c,
+                                   const StrToStrMap& arguments) {
+    const int idx = lookupBucketIndex(c, arguments);
+    if (idx <= 0) {
+        /* index 0 (the "no bucket") can't be throttled; unauthenticated
+         * connections would end up wedged before they can sasl auth */
+        return nullptr;
+    }
+
+    auto entry = arguments.find("resource");
+    if (entry == arguments.end() || entry->second == "ops") {
+        return &all_buckets[idx].ops_throttle;
+    }
+    if (entry->second == "bytes") {
+        return &all_buckets[idx].bytes_throttle;
+    }
+    return nullptr;
+}
+
+/**
+ * Callback for reading the per-second throttle limit of one of a
+ * bucket's token buckets (see lookupThrottle for the arguments).
+ * 0 means unlimited.
+ */
+static ENGINE_ERROR_CODE getThrottleLimit(Connection* c,
+                                          const StrToStrMap& arguments,
+                                          std::string& value) {
+    auto* throttle = lookupThrottle(c, arguments);
+    if (throttle == nullptr) {
+        return ENGINE_KEY_ENOENT;
+    }
+    value = std::to_string(throttle->getLimit());
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for setting the per-second throttle limit of one of a
+ * bucket's token buckets (see lookupThrottle for the arguments). The
+ * value is the number of operations (resp. bytes in + out) allowed
+ * per second; 0 removes the limit.
+ */
+static ENGINE_ERROR_CODE setThrottleLimit(Connection* c,
+                                          const StrToStrMap& arguments,
+                                          const std::string& value) {
+    uint64_t limit;
+    try {
+        limit = std::stoull(value);
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+
+    auto* throttle = lookupThrottle(c, arguments);
+    if (throttle == nullptr) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    throttle->setLimit(limit);
+    LOG_NOTICE(c, "%u: IOCTL_SET: bucket.throttle.limit set to %s",
+               c->getId(), value.c_str());
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for reading the topkeys budget of a bucket (see
+ * lookupBucketIndex for the "bucket" argument). 0 means tracking is
+ * disabled.
+ */
+static ENGINE_ERROR_CODE getTopkeysSize(Connection* c,
+                                        const StrToStrMap& arguments,
+                                        std::string& value) {
+    const int idx = lookupBucketIndex(c, arguments);
+    if (idx <= 0) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    auto& bucket = all_buckets[idx];
+    cb_mutex_enter(&bucket.mutex);
+    value = std::to_string(bucket.topkeys_budget);
+    cb_mutex_exit(&bucket.mutex);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for enabling, resizing or disabling topkeys tracking for a
+ * bucket (see lookupBucketIndex for the "bucket" argument). The value
+ * is the number of keys to track per shard; 0 disables tracking.
+ */
+static ENGINE_ERROR_CODE setTopkeysSize(Connection* c,
+                                        const StrToStrMap& arguments,
+                                        const std::string& value) {
+    int budget;
+    try {
+        budget = std::stoi(value);
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+    if (budget < 0) {
+        return ENGINE_EINVAL;
+    }
+
+    const int idx = lookupBucketIndex(c, arguments);
+    if (idx <= 0) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    try {
+        bucket_set_topkeys_budget(all_buckets[idx], budget);
+    } catch (const std::bad_alloc&) {
+        return ENGINE_ENOMEM;
+    }
+
+    LOG_NOTICE(c, "%u: IOCTL_SET: bucket.topkeys.size set to %s",
+               c->getId(), value.c_str());
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Render an opcode filter as a comma separated list of the accepted
+ * opcode names ("all" when it is unrestricted).
+ */
+static std::string formatOpcodeFilter(const OpcodeFilter& filter) {
+    if (filter.isUnrestricted()) {
+        return "all";
+    }
+
+    std::string ret;
+    for (int ii = 0; ii < 0x100; ++ii) {
+        if (filter.isAllowed(uint8_t(ii))) {
+            if (!ret.empty()) {
+                ret.append(",");
+            }
+            const char* name = memcached_opcode_2_text(uint8_t(ii));
+            if (name != nullptr) {
+                ret.append(name);
+            } else {
+                ret.append(std::to_string(ii));
+            }
+        }
+    }
+    return ret;
+}
+
+/**
+ * Parse a comma separated allow-list of opcode names (or decimal
+ * opcode numbers) into a filter; the word "all" lifts every
+ * restriction.
+ *
+ * @return false when a token names no known opcode
+ */
+static bool parseOpcodeFilter(const std::string& value,
+                              OpcodeFilter& filter) {
+    if (value == "all") {
+        filter.allowAll();
+        return true;
+    }
+
+    OpcodeFilter next;
+    next.denyAll();
+
+    for (auto& token : split_string(value, ",")) {
+        if (token.empty()) {
+            return false;
+        }
+        const uint8_t opcode = memcached_text_2_opcode(token.c_str());
+        if (opcode == 0xff && token != "255") {
+            /* 0xff doubles as the "no such opcode" return */
+            return false;
+        }
+        next.allow(opcode);
+    }
+
+    filter = next;
+    return true;
+}
+
+/**
+ * Callback for reading the opcode acceptance filter of a bucket (see
+ * lookupBucketIndex for the "bucket" argument)
+ */
+static ENGINE_ERROR_CODE getBucketOpcodeFilter(Connection* c,
+                                               const StrToStrMap& arguments,
+                                               std::string& value) {
+    const int idx = lookupBucketIndex(c, arguments);
+    if (idx <= 0) {
+        return ENGINE_KEY_ENOENT;
+    }
+    value = formatOpcodeFilter(all_buckets[idx].opcode_filter);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for restricting the protocol surface of a bucket (see
+ * lookupBucketIndex for the "bucket" argument). The value is a comma
+ * separated allow-list of opcode names, or "all" to lift the
+ * restriction. Rejected commands are answered with NOT_SUPPORTED and
+ * counted in the bucket's rejected_ops. Index 0 (the "no bucket") is
+ * refused - filtering it would wedge unauthenticated connections
+ * before they can sasl auth.
+ */
+static ENGINE_ERROR_CODE setBucketOpcodeFilter(Connection* c,
+                                               const StrToStrMap& arguments,
+                                               const std::string& value) {
+    const int idx = lookupBucketIndex(c, arguments);
+    if (idx <= 0) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    if (!parseOpcodeFilter(value, all_buckets[idx].opcode_filter)) {
+        return ENGINE_EINVAL;
+    }
+
+    LOG_NOTICE(c, "%u: IOCTL_SET: bucket.opcode_filter set to %s",
+               c->getId(), value.c_str());
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Find the listening port named by the "port" argument, or the one the
+ * connection came in on when no argument is given.
+ *
+ * @return nullptr when there is no such port
+ */
+static listening_port* lookupInterface(Connection* c,
+                                       const StrToStrMap& arguments) {
+    in_port_t port = c->getParentPort();
+    auto entry = arguments.find("port");
+    if (entry != arguments.end()) {
+        try {
+            port = in_port_t(std::stoi(entry->second));
+        } catch (const std::exception&) {
+            return nullptr;
+        }
+    }
+
+    for (auto& interface : stats.listening_ports) {
+        if (interface.port == port) {
+            return &interface;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Callback for reading the opcode acceptance filter of a listening
+ * interface (see lookupInterface for the "port" argument)
+ */
+static ENGINE_ERROR_CODE getInterfaceOpcodeFilter(Connection* c,
+                                                  const StrToStrMap& arguments,
+                                                  std::string& value) {
+    auto* interface = lookupInterface(c, arguments);
+    if (interface == nullptr) {
+        return ENGINE_KEY_ENOENT;
+    }
+    value = formatOpcodeFilter(interface->opcode_filter);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for restricting the protocol surface of a listening
+ * interface (see lookupInterface for the "port" argument). The value
+ * format matches bucket.opcode_filter. Blocking SASL_AUTH or the
+ * ioctl commands on the management interface will lock you out, so
+ * the allow-list is applied exactly as given - no opcode is implied.
+ */
+static ENGINE_ERROR_CODE setInterfaceOpcodeFilter(Connection* c,
+                                                  const StrToStrMap& arguments,
+                                                  const std::string& value) {
+    auto* interface = lookupInterface(c, arguments);
+    if (interface == nullptr) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    if (!parseOpcodeFilter(value, interface->opcode_filter)) {
+        return ENGINE_EINVAL;
+    }
+
+    LOG_NOTICE(c, "%u: IOCTL_SET: interface.opcode_filter on port %u "
+                  "set to %s",
+               c->getId(), unsigned(interface->port), value.c_str());
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Callback for setting the resident-memory target of the connected
+ * bucket's engine. The value is the target in bytes; 0 removes the
+ * target. The engine consolidates and releases idle memory in the
+ * background until it is back under the target - unlike shrinking the
+ * memory quota, nothing is evicted to get there.
+ */
+static ENGINE_ERROR_CODE setBucketRssTarget(Connection* c,
+                                            const StrToStrMap&,
+                                            const std::string& value) {
+    uint64_t target;
+    try {
+        target = std::stoull(value);
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+
+    if (c->getBucketEngine()->set_memory_target == nullptr) {
+        return ENGINE_ENOTSUP;
+    }
+
+    auto ret = c->getBucketEngine()->set_memory_target(
+            c->getBucketEngineAsV0(), size_t(target));
+    if (ret == ENGINE_SUCCESS) {
+        LOG_NOTICE(c, "%u: IOCTL_SET: bucket.rss_target set to %s",
+                   c->getId(), value.c_str());
+    }
+    return ret;
+}
+
+/**
+ * Callback for applying a configuration delta pushed by the
+ * orchestrator. The value is a JSON object holding only the changed
+ * keys; unlike CONFIG_RELOAD nothing is read from disk and the
+ * unchanged part of the configuration is never revisited.
+ */
+static ENGINE_ERROR_CODE setConfigPush(Connection* c,
+                                       const StrToStrMap&,
+                                       const std::string& value) {
+    try {
+        apply_config_delta(value);
+    } catch (const std::bad_alloc&) {
+        return ENGINE_ENOMEM;
+    } catch (const std::exception& exception) {
+        LOG_WARNING(c, "%u: IOCTL_SET: config.push rejected: %s",
+                    c->getId(), exception.what());
+        return ENGINE_EINVAL;
+    }
+
+    LOG_NOTICE(c, "%u: IOCTL_SET: config.push applied", c->getId());
+    return ENGINE_SUCCESS;
+}
+
+/* Defined below ioctl_set_map, which it needs to consult */
+static bool isBatchableProperty(const std::string& property);
+
+/**
+ * Parse one line of a property script into a property (everything up
+ * to the first whitespace; may carry ?arguments) and a value (the
+ * remainder, with the surrounding whitespace stripped; may be empty).
+ *
+ * @return false when the line is blank or a '#' comment
+ */
+static bool parseBatchLine(const std::string& line,
+                           std::string& property,
+                           std::string& value) {
+    const auto start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#') {
+        return false;
+    }
+
+    const auto sep = line.find_first_of(" \t\r", start);
+    property = line.substr(start, sep - start);
+
+    value.clear();
+    if (sep != std::string::npos) {
+        const auto vstart = line.find_first_not_of(" \t\r", sep);
+        if (vstart != std::string::npos) {
+            const auto vend = line.find_last_not_of(" \t\r");
+            value = line.substr(vstart, vend - vstart + 1);
+        }
+    }
+    return true;
+}
+
+/**
+ * Callback for applying a batch of property sets as one command. The
+ * value is a property script: one "property [value]" per line, with
+ * blank lines and '#' comments skipped. Every property name is
+ * checked against the set map before anything is applied, so a typo
+ * rejects the whole script untouched, and the settings change
+ * listeners are deferred until the batch is done - related knobs are
+ * recomputed against the final state once instead of after every
+ * line. A value rejected mid-batch stops the batch at that line (the
+ * lines before it stay applied) and the failure is logged with its
+ * line number.
+ */
+static ENGINE_ERROR_CODE setPropertyBatch(Connection* c,
+                                          const StrToStrMap&,
+                                          const std::string& value) {
+    struct batch_entry {
+        int line;
+        std::string property;
+        std::string value;
+    };
+    std::vector<batch_entry> batch;
+
+    int lineno = 0;
+    size_t pos = 0;
+    while (pos < value.size()) {
+        auto eol = value.find('\n', pos);
+        if (eol == std::string::npos) {
+            eol = value.size();
+        }
+        const std::string line = value.substr(pos, eol - pos);
+        pos = eol + 1;
+        ++lineno;
+
+        batch_entry entry;
+        entry.line = lineno;
+        if (!parseBatchLine(line, entry.property, entry.value)) {
+            continue;
+        }
+
+        try {
+            if (!isBatchableProperty(decode_query(entry.property).first)) {
+                throw std::invalid_argument("unknown property");
+            }
+        } catch (const std::invalid_argument&) {
+            LOG_WARNING(c, "%u: IOCTL_SET: batch.apply rejected: "
+                           "unknown property \"%s\" on line %d",
+                        c->getId(), entry.property.c_str(), lineno);
+            return ENGINE_EINVAL;
+        }
+        batch.push_back(std::move(entry));
+    }
+
+    if (batch.empty()) {
+        return ENGINE_EINVAL;
+    }
+
+    settings.beginNotificationBatch();
+    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+    for (const auto& entry : batch) {
+        ret = ioctl_set_property(c, entry.property, entry.value);
+        if (ret != ENGINE_SUCCESS) {
+            LOG_WARNING(c, "%u: IOCTL_SET: batch.apply stopped: "
+                           "\"%s\" on line %d failed",
+                        c->getId(), entry.property.c_str(), entry.line);
+            break;
+        }
+    }
+    settings.endNotificationBatch();
+
+    if (ret == ENGINE_SUCCESS) {
+        LOG_NOTICE(c, "%u: IOCTL_SET: batch.apply applied %u properties",
+                   c->getId(), unsigned(batch.size()));
+    }
+    return ret;
+}
+
 /**
  * Callback for setting the trace status of a specific connection
  */
@@ -68,6 +825,17 @@ static ENGINE_ERROR_CODE setTraceConnection(Connection* c,
 }
 
 static const std::unordered_map<std::string, GetCallbackFunc> ioctl_get_map {
+    {"bucket.opcode_filter", getBucketOpcodeFilter},
+    {"bucket.throttle.limit", getThrottleLimit},
+    {"bucket.topkeys.size", getTopkeysSize},
+    {"drain.status", getDrainStatus},
+    {"interface.opcode_filter", getInterfaceOpcodeFilter},
+    {"profiler.dump", ioctlGetProfilerDump},
+    {"profiler.status", ioctlGetProfilerStatus},
+    {"settings.event_time_budget", getEventTimeBudget},
+    {"settings.greedy_read_budget", getGreedyReadBudget},
+    {"settings.reqs_per_event", getReqsPerEvent},
+    {"slow_op_log.threshold", ioctlGetSlowOpLogThreshold},
     {"trace.config", ioctlGetTracingConfig},
     {"trace.status", ioctlGetTracingStatus},
     {"trace.dump", ioctlGetTracingDump},
@@ -95,12 +863,37 @@ ENGINE_ERROR_CODE ioctl_get_property(Connection* c,
 
 static const std::unordered_map<std::string, SetCallbackFunc> ioctl_set_map {
     {"release_free_memory", setReleaseFreeMemory},
+    {"alloc.arena.purge", setArenaPurge},
+    {"alloc.arena.decay_time", setArenaDecayTime},
+    {"batch.apply", setPropertyBatch},
+    {"bucket.opcode_filter", setBucketOpcodeFilter},
+    {"bucket.rss_target", setBucketRssTarget},
+    {"bucket.throttle.limit", setThrottleLimit},
+    {"bucket.topkeys.size", setTopkeysSize},
+    {"config.push", setConfigPush},
+    {"drain.start", setDrainStart},
+    {"interface.opcode_filter", setInterfaceOpcodeFilter},
+    {"profiler.start", ioctlSetProfilerStart},
+    {"profiler.stop", ioctlSetProfilerStop},
+    {"settings.event_time_budget", setEventTimeBudget},
+    {"settings.greedy_read_budget", setGreedyReadBudget},
+    {"settings.reqs_per_event", setReqsPerEvent},
+    {"slow_op_log.threshold", ioctlSetSlowOpLogThreshold},
     {"trace.connection", setTraceConnection},
     {"trace.config", ioctlSetTracingConfig},
     {"trace.start", ioctlSetTracingStart},
     {"trace.stop", ioctlSetTracingStop},
 };
 
+/**
+ * @return true when the property may appear in a batch.apply script:
+ *         it must exist, and must not be the batch property itself
+ */
+static bool isBatchableProperty(const std::string& property) {
+    return property != "batch.apply" &&
+           ioctl_set_map.find(property) != ioctl_set_map.end();
+}
+
 ENGINE_ERROR_CODE ioctl_set_property(Connection* c,
                                      const std::string& key,
                                      const std::string& value) {
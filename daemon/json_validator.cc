@@ -0,0 +1,416 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "json_validator.h"
+
+#include <cctype>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JSON_VALIDATOR_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+// AVX2 is only used on compilers supporting per-function target
+// attributes; elsewhere (MSVC) the SSE2 path is used unconditionally.
+#define JSON_VALIDATOR_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/*
+ * The validator is a conventional recursive descent parser, except that
+ * the inner loop of string parsing - where almost all of the bytes of a
+ * typical document live - advances over runs of "plain" characters
+ * (anything but '"', '\', a control character or a non-ASCII byte) a
+ * whole vector register at a time. Only the rare special characters are
+ * then handled individually.
+ */
+
+static size_t scan_plain_scalar(const uint8_t* p, const uint8_t* end) {
+    const uint8_t* cur = p;
+    while (cur < end) {
+        const uint8_t b = *cur;
+        if (b == '"' || b == '\\' || b < 0x20 || b >= 0x80) {
+            break;
+        }
+        ++cur;
+    }
+    return cur - p;
+}
+
+#if defined(JSON_VALIDATOR_SSE2)
+
+static int first_set_bit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static size_t scan_plain_sse2(const uint8_t* p, const uint8_t* end) {
+    const uint8_t* cur = p;
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+
+    while (end - cur >= 16) {
+        const __m128i chunk =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+        const __m128i special =
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                          _mm_cmpeq_epi8(chunk, backslash)),
+                             _mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl));
+        // The movemask of the chunk itself catches bytes >= 0x80.
+        const uint32_t mask = uint32_t(_mm_movemask_epi8(special)) |
+                              uint32_t(_mm_movemask_epi8(chunk));
+        if (mask != 0) {
+            return (cur - p) + first_set_bit(mask);
+        }
+        cur += 16;
+    }
+    return (cur - p) + scan_plain_scalar(cur, end);
+}
+
+#endif // JSON_VALIDATOR_SSE2
+
+#if defined(JSON_VALIDATOR_AVX2)
+
+__attribute__((target("avx2")))
+static size_t scan_plain_avx2(const uint8_t* p, const uint8_t* end) {
+    const uint8_t* cur = p;
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i ctrl = _mm256_set1_epi8(0x1f);
+
+    while (end - cur >= 32) {
+        const __m256i chunk =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur));
+        const __m256i special = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                                _mm256_cmpeq_epi8(chunk, backslash)),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, ctrl), ctrl));
+        const uint32_t mask = uint32_t(_mm256_movemask_epi8(special)) |
+                              uint32_t(_mm256_movemask_epi8(chunk));
+        if (mask != 0) {
+            return (cur - p) + first_set_bit(mask);
+        }
+        cur += 32;
+    }
+    return (cur - p) + scan_plain_sse2(cur, end);
+}
+
+#endif // JSON_VALIDATOR_AVX2
+
+typedef size_t (*scan_plain_fn)(const uint8_t*, const uint8_t*);
+
+static scan_plain_fn select_scan_plain(void) {
+#if defined(JSON_VALIDATOR_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_plain_avx2;
+    }
+#endif
+#if defined(JSON_VALIDATOR_SSE2)
+    return scan_plain_sse2;
+#else
+    return scan_plain_scalar;
+#endif
+}
+
+// Resolved once at startup for the CPU we're running on.
+static const scan_plain_fn scan_plain = select_scan_plain();
+
+namespace {
+
+class JsonParser {
+public:
+    JsonParser(const uint8_t* data, size_t size)
+        : p(data),
+          end(data + size) {
+    }
+
+    bool parse() {
+        skipWhitespace();
+        if (!parseValue(0)) {
+            return false;
+        }
+        skipWhitespace();
+        return p == end;
+    }
+
+private:
+    // Nesting deeper than this is rejected to bound the recursion.
+    static const int MaxDepth = 100;
+
+    bool parseValue(int depth) {
+        if (depth >= MaxDepth || p == end) {
+            return false;
+        }
+        switch (*p) {
+        case '{':
+            return parseObject(depth + 1);
+        case '[':
+            return parseArray(depth + 1);
+        case '"':
+            return parseString();
+        case 't':
+            return parseLiteral("true", 4);
+        case 'f':
+            return parseLiteral("false", 5);
+        case 'n':
+            return parseLiteral("null", 4);
+        default:
+            return parseNumber();
+        }
+    }
+
+    bool parseObject(int depth) {
+        ++p; // skip '{'
+        skipWhitespace();
+        if (p != end && *p == '}') {
+            ++p;
+            return true;
+        }
+        while (p != end) {
+            if (*p != '"' || !parseString()) {
+                return false;
+            }
+            skipWhitespace();
+            if (p == end || *p != ':') {
+                return false;
+            }
+            ++p;
+            skipWhitespace();
+            if (!parseValue(depth)) {
+                return false;
+            }
+            skipWhitespace();
+            if (p == end) {
+                return false;
+            }
+            if (*p == '}') {
+                ++p;
+                return true;
+            }
+            if (*p != ',') {
+                return false;
+            }
+            ++p;
+            skipWhitespace();
+        }
+        return false;
+    }
+
+    bool parseArray(int depth) {
+        ++p; // skip '['
+        skipWhitespace();
+        if (p != end && *p == ']') {
+            ++p;
+            return true;
+        }
+        while (p != end) {
+            if (!parseValue(depth)) {
+                return false;
+            }
+            skipWhitespace();
+            if (p == end) {
+                return false;
+            }
+            if (*p == ']') {
+                ++p;
+                return true;
+            }
+            if (*p != ',') {
+                return false;
+            }
+            ++p;
+            skipWhitespace();
+        }
+        return false;
+    }
+
+    bool parseString() {
+        ++p; // skip opening '"'
+        while (p != end) {
+            p += scan_plain(p, end);
+            if (p == end) {
+                return false;
+            }
+            const uint8_t b = *p;
+            if (b == '"') {
+                ++p;
+                return true;
+            }
+            if (b == '\\') {
+                if (!parseEscape()) {
+                    return false;
+                }
+            } else if (b >= 0x80) {
+                if (!parseUtf8Sequence()) {
+                    return false;
+                }
+            } else {
+                // Unescaped control character.
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool parseEscape() {
+        if (++p == end) {
+            return false;
+        }
+        switch (*p) {
+        case '"':
+        case '\\':
+        case '/':
+        case 'b':
+        case 'f':
+        case 'n':
+        case 'r':
+        case 't':
+            ++p;
+            return true;
+        case 'u':
+            ++p;
+            if (end - p < 4) {
+                return false;
+            }
+            for (int ii = 0; ii < 4; ++ii, ++p) {
+                if (!isxdigit(*p)) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool parseUtf8Sequence() {
+        const uint8_t b = *p;
+        uint32_t codepoint;
+        int trailing;
+        if (b < 0xc2) {
+            // Stray continuation byte or overlong 2-byte sequence.
+            return false;
+        } else if (b < 0xe0) {
+            trailing = 1;
+            codepoint = b & 0x1f;
+        } else if (b < 0xf0) {
+            trailing = 2;
+            codepoint = b & 0x0f;
+        } else if (b < 0xf5) {
+            trailing = 3;
+            codepoint = b & 0x07;
+        } else {
+            return false;
+        }
+        if (end - p <= trailing) {
+            return false;
+        }
+        for (int ii = 1; ii <= trailing; ++ii) {
+            const uint8_t c = p[ii];
+            if ((c & 0xc0) != 0x80) {
+                return false;
+            }
+            codepoint = (codepoint << 6) | (c & 0x3f);
+        }
+        if (trailing == 2 &&
+            (codepoint < 0x800 ||
+             (codepoint >= 0xd800 && codepoint <= 0xdfff))) {
+            // Overlong encoding or UTF-16 surrogate.
+            return false;
+        }
+        if (trailing == 3 && (codepoint < 0x10000 || codepoint > 0x10ffff)) {
+            // Overlong encoding or beyond the Unicode range.
+            return false;
+        }
+        p += trailing + 1;
+        return true;
+    }
+
+    bool parseNumber() {
+        if (*p == '-' && ++p == end) {
+            return false;
+        }
+        if (*p == '0') {
+            ++p;
+        } else if (*p >= '1' && *p <= '9') {
+            do {
+                ++p;
+            } while (p != end && isdigit(*p));
+        } else {
+            return false;
+        }
+        if (p != end && *p == '.') {
+            ++p;
+            if (p == end || !isdigit(*p)) {
+                return false;
+            }
+            do {
+                ++p;
+            } while (p != end && isdigit(*p));
+        }
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            if (p != end && (*p == '+' || *p == '-')) {
+                ++p;
+            }
+            if (p == end || !isdigit(*p)) {
+                return false;
+            }
+            do {
+                ++p;
+            } while (p != end && isdigit(*p));
+        }
+        return true;
+    }
+
+    bool parseLiteral(const char* literal, size_t len) {
+        if (size_t(end - p) < len) {
+            return false;
+        }
+        for (size_t ii = 0; ii < len; ++ii) {
+            if (p[ii] != uint8_t(literal[ii])) {
+                return false;
+            }
+        }
+        p += len;
+        return true;
+    }
+
+    void skipWhitespace() {
+        while (p != end &&
+               (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            ++p;
+        }
+    }
+
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+} // namespace
+
+bool is_valid_json(const uint8_t* data, size_t size) {
+    if (data == nullptr || size == 0) {
+        return false;
+    }
+    return JsonParser(data, size).parse();
+}
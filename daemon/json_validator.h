@@ -0,0 +1,40 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Check if the given data is a valid JSON document (any JSON value is
+ * accepted at top level, as per RFC 7159) encoded in strict UTF-8.
+ *
+ * This is used on the store path (and by TAP) to decide if a value
+ * should be flagged with PROTOCOL_BINARY_DATATYPE_JSON when the client
+ * doesn't speak datatypes, which makes it one of the hottest functions
+ * for store-heavy workloads. The bulk of a typical document consists of
+ * string characters which need no individual inspection, so those are
+ * scanned a vector register at a time (SSE2, or AVX2 when the CPU
+ * supports it - selected at runtime) rather than byte by byte.
+ *
+ * The function performs no allocation and does not throw.
+ *
+ * @param data the document to inspect
+ * @param size number of bytes in the document
+ * @return true if the data is a valid JSON document
+ */
+bool is_valid_json(const uint8_t* data, size_t size);
@@ -16,15 +16,20 @@
  */
 #pragma once
 
+#include "alloc_domain.h"
 #include "settings.h"
+#include "settings_snapshot.h"
 
 // Helper macros to make it nicer to write log messages
+// (the calls are tagged with the Logging allocation domain so that any
+// memory the logger allocates is attributed to it; see alloc_domain.h)
 #define LOGGER settings.extensions.logger->log
 
 // Detail should be printed if verbose > 2
 #define LOG_DETAIL(COOKIE, ...) \
     do { \
-        if (settings.getVerbose() > 2) { \
+        if (settings_snapshot().verbose > 2) { \
+            ScopedAllocDomain logDomain(AllocationDomain::Logging); \
             LOGGER(EXTENSION_LOG_DETAIL, COOKIE, __VA_ARGS__); \
         } \
     } while (0)
@@ -33,7 +38,8 @@
 // Debug should be printed if verbose > 1
 #define LOG_DEBUG(COOKIE, ...) \
     do { \
-        if (settings.getVerbose() > 1) { \
+        if (settings_snapshot().verbose > 1) { \
+            ScopedAllocDomain logDomain(AllocationDomain::Logging); \
             LOGGER(EXTENSION_LOG_DEBUG, COOKIE, __VA_ARGS__); \
         } \
     } while (0)
@@ -42,7 +48,8 @@
 // Info should be printed if verbose > 0
 #define LOG_INFO(COOKIE, ...) \
     do { \
-        if (settings.getVerbose() > 0) { \
+        if (settings_snapshot().verbose > 0) { \
+            ScopedAllocDomain logDomain(AllocationDomain::Logging); \
             LOGGER(EXTENSION_LOG_INFO, COOKIE, __VA_ARGS__); \
         } \
     } while (0)
@@ -50,12 +57,14 @@
 // Notice should always be printed
 #define LOG_NOTICE(COOKIE, ...) \
     do { \
+        ScopedAllocDomain logDomain(AllocationDomain::Logging); \
         LOGGER(EXTENSION_LOG_NOTICE, COOKIE, __VA_ARGS__); \
     } while (0)
 
 // Warnings should always be printed
 #define LOG_WARNING(COOKIE, ...) \
     do { \
+        ScopedAllocDomain logDomain(AllocationDomain::Logging); \
         LOGGER(EXTENSION_LOG_WARNING, COOKIE, __VA_ARGS__); \
     } while (0)
 
@@ -28,6 +28,8 @@
 #include "memcached.h"
 #include "mc_time.h"
 
+#include <memcached/isotime.h>
+
 #include <atomic>
 
 extern std::atomic<bool> memcached_shutdown;
@@ -55,6 +57,59 @@ static volatile time_t memcached_epoch = 0;
 static volatile uint64_t memcached_monotonic_start = 0;
 static struct event_base* main_ev_base = NULL;
 
+/*
+ * The coarse clock page. The clock tick publishes the epoch, the
+ * uptime and a preformatted timestamp here so that subsystems which
+ * only need second resolution (audit records, token issue times, ...)
+ * never have to make a time syscall or reformat a timestamp on the
+ * data path.
+ *
+ * The page is guarded by a sequence counter (odd while the publisher
+ * is mid-update); readers copy the snapshot and retry on a torn read.
+ * With one writer a second the retry is all but theoretical. The
+ * struct is cache-line aligned so the readers don't false-share with
+ * neighbouring globals.
+ */
+struct alignas(64) mc_coarse_clock_page {
+    std::atomic<uint64_t> sequence;
+    mc_coarse_time_t snapshot;
+};
+
+static mc_coarse_clock_page coarse_clock;
+
+static void mc_time_publish_coarse_clock(void) {
+    mc_coarse_time_t next;
+    next.epoch = memcached_epoch + memcached_uptime;
+    next.uptime = memcached_uptime;
+
+    ISOTime::ISO8601String timestamp;
+    ISOTime::generatetimestamp(timestamp, next.epoch, 0);
+    strncpy(next.timestamp, timestamp.data(), sizeof(next.timestamp));
+    next.timestamp[sizeof(next.timestamp) - 1] = '\0';
+
+    const uint64_t seq = coarse_clock.sequence.load(std::memory_order_relaxed);
+    coarse_clock.sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    coarse_clock.snapshot = next;
+    std::atomic_thread_fence(std::memory_order_release);
+    coarse_clock.sequence.store(seq + 2, std::memory_order_relaxed);
+}
+
+void mc_time_get_coarse(mc_coarse_time_t* snapshot) {
+    uint64_t before;
+    uint64_t after;
+    do {
+        before = coarse_clock.sequence.load(std::memory_order_acquire);
+        *snapshot = coarse_clock.snapshot;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = coarse_clock.sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+time_t mc_time_get_epoch_seconds(void) {
+    return memcached_epoch + memcached_uptime;
+}
+
 static void mc_time_clock_event_handler(evutil_socket_t fd, short which, void *arg);
 static void mc_time_clock_tick(void);
 static void mc_time_init_epoch(void);
@@ -206,4 +261,12 @@ static void mc_time_clock_tick(void) {
         previous_time_valid = true;
         previous_time = timeofday;
     }
+
+    /* republish the coarse clock page with the (possibly adjusted)
+       epoch and the new uptime */
+    mc_time_publish_coarse_clock();
+
+    /* wake the worker threads so that they advance their timer wheels
+       (idle-connection handling) */
+    threads_notify_clock_tick();
 }
@@ -38,6 +38,34 @@ time_t mc_time_convert_to_abs_time(const rel_time_t rel_time);
  */
 rel_time_t mc_time_convert_to_real_time(const time_t t);
 
+/*
+ * A snapshot of the coarse clock page published by the clock tick.
+ * Reading one never makes a time syscall; the resolution is the tick
+ * interval (one second).
+ */
+typedef struct mc_coarse_time {
+    /* The system clock in seconds since the unix epoch */
+    time_t epoch;
+    /* Seconds since memcached started (mc_time_get_current_time) */
+    rel_time_t uptime;
+    /* The system clock preformatted as an ISO8601 local timestamp
+       (second resolution); always '\0' terminated */
+    char timestamp[33];
+} mc_coarse_time_t;
+
+/*
+ * Copy out the current coarse clock snapshot (lock free; may spin
+ * briefly if it races with the once-a-second publisher).
+ */
+void mc_time_get_coarse(mc_coarse_time_t* snapshot);
+
+/*
+ * Return the system clock in seconds since the unix epoch without
+ * making a time syscall (equivalent to
+ * mc_time_convert_to_abs_time(mc_time_get_current_time())).
+ */
+time_t mc_time_get_epoch_seconds(void);
+
 #ifdef __cplusplus
 }
 #endif
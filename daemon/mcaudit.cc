@@ -21,10 +21,24 @@
 #include "buckets.h"
 #include "debug_helpers.h"
 #include "runtime.h"
+#include "mc_time.h"
 
 #include <memcached/audit_interface.h>
 #include <cJSON.h>
-#include <memcached/isotime.h>
+
+/**
+ * Check that the audit daemon actually cares about the event before
+ * spending time building the payload for it. The check boils down to
+ * two relaxed atomic loads against a filter the audit daemon rebuilds
+ * when it is reconfigured, so it is cheap enough for hot paths like
+ * the authentication handlers.
+ *
+ * @param id the audit event identifier
+ * @return true if the event should be built and submitted
+ */
+static bool audit_enabled(uint32_t id) {
+    return audit_event_enabled(get_audit_handle(), id);
+}
 
 /**
  * Create the typical memcached audit object. It constists of a
@@ -37,8 +51,12 @@
 static unique_cJSON_ptr create_memcached_audit_object(const Connection *c) {
     cJSON *root = cJSON_CreateObject();
 
-    std::string timestamp = ISOTime::generatetimestamp();
-    cJSON_AddStringToObject(root, "timestamp", timestamp.c_str());
+    /* The coarse clock avoids a time syscall and a timestamp format
+       per audit event; audit records don't need sub-second
+       resolution. */
+    mc_coarse_time_t now;
+    mc_time_get_coarse(&now);
+    cJSON_AddStringToObject(root, "timestamp", now.timestamp);
 
     cJSON_AddStringToObject(root, "peername", c->getPeername().c_str());
     cJSON_AddStringToObject(root, "sockname", c->getSockname().c_str());
@@ -62,6 +80,7 @@ static void do_audit(const Connection* c,
                      uint32_t id,
                      unique_cJSON_ptr& event,
                      const char* warn) {
+    ScopedAllocDomain domain(AllocationDomain::Audit);
     auto text = to_string(event, false);
     auto status = put_audit_event(get_audit_handle(), id, text.data(),
                                   text.length());
@@ -72,6 +91,9 @@ static void do_audit(const Connection* c,
 }
 
 void audit_auth_failure(const Connection *c, const char *reason) {
+    if (!audit_enabled(MEMCACHED_AUDIT_AUTHENTICATION_FAILED)) {
+        return;
+    }
     auto root = create_memcached_audit_object(c);
     cJSON_AddStringToObject(root.get(), "reason", reason);
 
@@ -80,6 +102,9 @@ void audit_auth_failure(const Connection *c, const char *reason) {
 }
 
 void audit_auth_success(const Connection *c) {
+    if (!audit_enabled(MEMCACHED_AUDIT_AUTHENTICATION_SUCCEEDED)) {
+        return;
+    }
     auto root = create_memcached_audit_object(c);
     do_audit(c, MEMCACHED_AUDIT_AUTHENTICATION_SUCCEEDED, root,
              "Failed to send AUTH SUCCESS audit event");
@@ -87,6 +112,9 @@ void audit_auth_success(const Connection *c) {
 
 
 void audit_bucket_flush(const Connection *c, const char *bucket) {
+    if (!audit_enabled(MEMCACHED_AUDIT_BUCKET_FLUSH)) {
+        return;
+    }
     auto root = create_memcached_audit_object(c);
     cJSON_AddStringToObject(root.get(), "bucket", bucket);
 
@@ -98,7 +126,7 @@ void audit_bucket_flush(const Connection *c, const char *bucket) {
 void audit_dcp_open(const Connection *c) {
     if (c->isAdmin()) {
         LOG_INFO(c, "Open DCP stream with admin credentials");
-    } else {
+    } else if (audit_enabled(MEMCACHED_AUDIT_OPENED_DCP_CONNECTION)) {
         auto root = create_memcached_audit_object(c);
         cJSON_AddStringToObject(root.get(), "bucket", getBucketName(c));
 
@@ -109,6 +137,9 @@ void audit_dcp_open(const Connection *c) {
 }
 
 void audit_command_access_failed(const McbpConnection *c) {
+    if (!audit_enabled(MEMCACHED_AUDIT_COMMAND_ACCESS_FAILURE)) {
+        return;
+    }
     auto root = create_memcached_audit_object(c);
     char buffer[256];
     memset(buffer, 0, sizeof(buffer));
@@ -123,6 +154,9 @@ void audit_command_access_failed(const McbpConnection *c) {
 }
 
 void audit_invalid_packet(const McbpConnection *c) {
+    if (!audit_enabled(MEMCACHED_AUDIT_INVALID_PACKET)) {
+        return;
+    }
     auto root = create_memcached_audit_object(c);
     char buffer[256];
     memset(buffer, 0, sizeof(buffer));
@@ -17,8 +17,11 @@
 #include "mcbp.h"
 
 #include "debug_helpers.h"
+#include "experiments.h"
 #include "memcached.h"
+#include "slow_log.h"
 #include "utilities/protocol2text.h"
+#include "utilities/vector_compare.h"
 
 #include <snappy-c.h>
 
@@ -36,7 +39,7 @@ static int get_clustermap_revno(const char *map, size_t mapsize) {
     mapsize -= prefix.length();
 
     for (size_t index = 1; index < mapsize; ++index) {
-        if (memcmp(map + index, prefix.data(), prefix.length()) == 0) {
+        if (cb_memeq(map + index, prefix.data(), prefix.length())) {
             index += prefix.length();
             /* Found :-) */
             while (isspace(map[index])) {
@@ -58,20 +61,17 @@ static int get_clustermap_revno(const char *map, size_t mapsize) {
 static ENGINE_ERROR_CODE get_vb_map_cb(const void* void_cookie,
                                        const void* map,
                                        size_t mapsize) {
-    char* buf;
-
     auto* cookie = reinterpret_cast<const Cookie*>(void_cookie);
     if (cookie->connection == nullptr) {
         throw std::runtime_error("get_vb_map_cb: cookie must represent connection");
     }
 
     McbpConnection* c = reinterpret_cast<McbpConnection*>(cookie->connection);
-    protocol_binary_response_header header;
-    size_t needed = sizeof(protocol_binary_response_header);
 
-    if (settings.isDedupeNmvbMaps()) {
-        int revno = get_clustermap_revno(reinterpret_cast<const char*>(map),
-                                         mapsize);
+    const int revno = get_clustermap_revno(reinterpret_cast<const char*>(map),
+                                           mapsize);
+
+    if (settings_snapshot().dedupe_nmvb_maps) {
         if (revno == c->getClustermapRevno()) {
             /* The client already have this map... */
             mapsize = 0;
@@ -80,28 +80,52 @@ static ENGINE_ERROR_CODE get_vb_map_cb(const void* void_cookie,
         }
     }
 
-    needed += mapsize;
-    if (!c->growDynamicBuffer(needed)) {
-        LOG_WARNING(c, "<%d ERROR: Failed to allocate memory for response",
-                    c->getId());
-        return ENGINE_ENOMEM;
+    /* During a rebalance every misdirected request carries the very
+     * same map, so the map is served from an immutable per-bucket blob
+     * keyed by the map revision; only the first response for a new
+     * revision copies it. The response iovecs reference the blob
+     * directly and the connection pins it until transmit. */
+    std::shared_ptr<const std::string> blob;
+    if (mapsize > 0) {
+        auto& snapshot = all_buckets[c->getBucketIndex()].nmvb_map_snapshot;
+        std::lock_guard<std::mutex> guard(snapshot.mutex);
+        if (revno != -1 && snapshot.revno == revno && snapshot.payload) {
+            blob = snapshot.payload;
+        } else {
+            try {
+                blob = std::make_shared<const std::string>(
+                    reinterpret_cast<const char*>(map), mapsize);
+            } catch (const std::bad_alloc&) {
+                LOG_WARNING(c,
+                            "<%d ERROR: Failed to allocate memory for response",
+                            c->getId());
+                return ENGINE_ENOMEM;
+            }
+            if (revno != -1) {
+                snapshot.payload = blob;
+                snapshot.revno = revno;
+            }
+        }
     }
 
-    auto& buffer = c->getDynamicBuffer();
-    buf = buffer.getCurrent();
-    memset(&header, 0, sizeof(header));
+    if (mcbp_add_header(c, PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET,
+                        0, 0, (uint32_t)mapsize,
+                        PROTOCOL_BINARY_RAW_BYTES) == -1) {
+        return ENGINE_ENOMEM;
+    }
 
-    header.response.magic = (uint8_t)PROTOCOL_BINARY_RES;
-    header.response.opcode = c->binary_header.request.opcode;
-    header.response.status = (uint16_t)htons(
-        PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET);
-    header.response.bodylen = htonl((uint32_t)mapsize);
-    header.response.opaque = c->getOpaque();
+    if (blob) {
+        if (!c->addIov(blob->data(), blob->size()) ||
+            !c->retainBlobReference(std::move(blob))) {
+            return ENGINE_ENOMEM;
+        }
+    }
 
-    memcpy(buf, header.bytes, sizeof(header.response));
-    buf += sizeof(header.response);
-    memcpy(buf, map, mapsize);
-    buffer.moveOffset(needed);
+    /* The blob is immutable and pinned until transmit time, so the
+     * response may be corked */
+    c->setCorkableResponse(true);
+    c->setState(conn_mwrite);
+    c->setWriteAndGo(conn_new_cmd);
 
     return ENGINE_SUCCESS;
 }
@@ -113,12 +137,25 @@ void mcbp_write_response(McbpConnection* c,
                          int dlen) {
     if (!c->isNoReply() || c->getCmd() == PROTOCOL_BINARY_CMD_GET ||
         c->getCmd() == PROTOCOL_BINARY_CMD_GETK) {
+        /* Is the payload staged in the write buffer (right behind the
+         * response header slot)? If so it needs to be accounted for in
+         * the staging offset, and the response is safe to cork. */
+        const bool staged = d != nullptr &&
+                            reinterpret_cast<const char*>(d) >= c->write.buf &&
+                            reinterpret_cast<const char*>(d) <
+                            c->write.buf + c->write.size;
+
         if (mcbp_add_header(c, 0, extlen, keylen, dlen,
                             PROTOCOL_BINARY_RAW_BYTES) == -1) {
             c->setState(conn_closing);
             return;
         }
         c->addIov(d, dlen);
+        if (staged) {
+            c->write.curr += dlen;
+            c->write.bytes += dlen;
+        }
+        c->setCorkableResponse(d == nullptr || staged);
         c->setState(conn_mwrite);
         c->setWriteAndGo(conn_new_cmd);
     } else {
@@ -134,16 +171,35 @@ void mcbp_write_and_free(McbpConnection* c, DynamicBuffer* buf) {
     if (buf->getRoot() == nullptr) {
         c->setState(conn_closing);
     } else {
-        if (!c->pushTempAlloc(buf->getRoot())) {
+        /* The buffer is a chain of segments; scatter-gather them out
+         * of msglist rather than requiring the response to be
+         * contiguous. When responses are corked in front of us this
+         * appends behind them and everything goes out in the same
+         * flush. */
+        for (const auto& segment : buf->getSegments()) {
+            if (segment.used == 0) {
+                continue;
+            }
+            if (!c->addIov(segment.data, segment.used)) {
+                c->setState(conn_closing);
+                return;
+            }
+        }
+
+        /* Hand the segments over to the connection; they are released
+         * (pooled ones back to their pool) once the command is done
+         * with them. Nothing has been transferred if this fails, so
+         * the buffer still owns - and will release - the chain. */
+        if (!c->takeBufferOwnership(*buf)) {
             c->setState(conn_closing);
             return;
         }
-        c->write.curr = buf->getRoot();
-        c->write.bytes = (uint32_t)buf->getOffset();
-        c->setState(conn_write);
-        c->setWriteAndGo(conn_new_cmd);
 
-        buf->takeOwnership();
+        /* The connection now owns the segments and only releases them
+         * once transmit has drained, so the response may be corked. */
+        c->setCorkableResponse(true);
+        c->setState(conn_mwrite);
+        c->setWriteAndGo(conn_new_cmd);
     }
 }
 
@@ -157,10 +213,10 @@ void mcbp_write_packet(McbpConnection* c, protocol_binary_response_status err) {
 
         ENGINE_ERROR_CODE ret;
 
+        /* The callback stages the response (header plus a reference
+         * to the cached map blob) itself */
         ret = bucket_get_engine_vb_map(c, get_vb_map_cb);
-        if (ret == ENGINE_SUCCESS) {
-            mcbp_write_and_free(c, &c->getDynamicBuffer());
-        } else {
+        if (ret != ENGINE_SUCCESS) {
             c->setState(conn_closing);
         }
     } else {
@@ -186,11 +242,32 @@ void mcbp_write_packet(McbpConnection* c, protocol_binary_response_status err) {
         if (errtext) {
             c->addIov(errtext, len);
         }
+        /* The error text is static, so the response may be corked */
+        c->setCorkableResponse(true);
         c->setState(conn_mwrite);
         c->setWriteAndGo(conn_new_cmd);
     }
 }
 
+/*
+ * Compose a host integer whose in-memory byte representation is the
+ * arguments in order, i.e. the order the bytes appear on the wire. With
+ * constant arguments (the magic byte, a raw datatype, a success status)
+ * the packing collapses to a compile time constant, and the header can
+ * be emitted with a handful of word-sized stores instead of one store
+ * and byte swap per field.
+ */
+static constexpr uint32_t mcbp_pack32(uint8_t b0, uint8_t b1,
+                                      uint8_t b2, uint8_t b3) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    return (uint32_t(b0) << 24) | (uint32_t(b1) << 16) |
+           (uint32_t(b2) << 8) | uint32_t(b3);
+#else
+    return (uint32_t(b3) << 24) | (uint32_t(b2) << 16) |
+           (uint32_t(b1) << 8) | uint32_t(b0);
+#endif
+}
+
 int mcbp_add_header(McbpConnection* c,
                     uint16_t err,
                     uint8_t ext_len,
@@ -204,23 +281,61 @@ int mcbp_add_header(McbpConnection* c,
             "mcbp_add_header: 'c' must be non-NULL");
     }
 
-    if (!c->addMsgHdr(true)) {
-        return -1;
+    if (c->getPendingResponses() == 0) {
+        if (!c->addMsgHdr(true)) {
+            return -1;
+        }
     }
 
-    header = (protocol_binary_response_header*)c->write.buf;
-
-    header->response.magic = (uint8_t)PROTOCOL_BINARY_RES;
-    header->response.opcode = c->binary_header.request.opcode;
-    header->response.keylen = (uint16_t)htons(key_len);
-
-    header->response.extlen = ext_len;
-    header->response.datatype = datatype;
-    header->response.status = (uint16_t)htons(err);
+    /* When the client negotiated server timings and this command is one
+     * of the phase-sampled ones, prepend the server's processing
+     * timestamps to the response extras: the time the command was
+     * picked up and the time the response was queued, in microseconds
+     * of the monotonic clock (truncated to 32 bits; the client only
+     * needs their difference). The blob lives in the scratch arena -
+     * which survives until transmit has drained, like any corked
+     * staging - so the staged-payload convention ("payload right
+     * behind the header slot") is untouched. Unsampled commands and
+     * clients which didn't ask only pay for a predicted-not-taken
+     * branch. */
+    uint8_t timing_len = 0;
+    uint32_t* stamps = nullptr;
+    if (c->isSupportsServerTimings() && c->getStart() != 0 &&
+        c->getPhaseSampler().isSampled()) {
+        stamps = reinterpret_cast<uint32_t*>(
+                c->getScratchArena().alloc(2 * sizeof(uint32_t)));
+        if (stamps != nullptr) {
+            stamps[0] = htonl(uint32_t(c->getStart() / 1000));
+            stamps[1] = htonl(uint32_t(gethrtime() / 1000));
+            timing_len = 2 * sizeof(uint32_t);
+        }
+    }
 
-    header->response.bodylen = htonl(body_len);
-    header->response.opaque = c->getOpaque();
-    header->response.cas = htonll(c->getCAS());
+    /* The header is bump-allocated from the write buffer so that
+     * several (corked) response headers can coexist until the batch is
+     * transmitted. */
+    header = (protocol_binary_response_header*)c->getResponseHeaderSlot();
+
+    /* The slot follows payloads of arbitrary length, so it need not be
+     * word aligned; memcpy of a word compiles down to a plain
+     * (unaligned-tolerant) store on the platforms we care about. */
+    const uint32_t w0 = mcbp_pack32(PROTOCOL_BINARY_RES,
+                                    c->binary_header.request.opcode,
+                                    uint8_t(key_len >> 8), uint8_t(key_len));
+    const uint32_t w1 = mcbp_pack32(uint8_t(ext_len + timing_len), datatype,
+                                    uint8_t(err >> 8), uint8_t(err));
+    const uint32_t wire_body_len = body_len + timing_len;
+    const uint32_t w2 = mcbp_pack32(uint8_t(wire_body_len >> 24),
+                                    uint8_t(wire_body_len >> 16),
+                                    uint8_t(wire_body_len >> 8),
+                                    uint8_t(wire_body_len));
+    const uint32_t w3 = c->getOpaque(); /* already in wire order */
+    const uint64_t w4 = htonll(c->getCAS());
+    memcpy(header->bytes, &w0, sizeof(w0));
+    memcpy(header->bytes + 4, &w1, sizeof(w1));
+    memcpy(header->bytes + 8, &w2, sizeof(w2));
+    memcpy(header->bytes + 12, &w3, sizeof(w3));
+    memcpy(header->bytes + 16, &w4, sizeof(w4));
 
     if (settings.getVerbose() > 1) {
         char buffer[1024];
@@ -232,7 +347,18 @@ int mcbp_add_header(McbpConnection* c,
         }
     }
 
-    return c->addIov(c->write.buf, sizeof(header->response)) ? 0 : -1;
+    c->write.bytes += sizeof(header->response);
+    c->write.curr = c->write.buf + c->write.bytes;
+
+    c->accountResponseBytes(sizeof(header->response) + wire_body_len);
+
+    if (!c->addIov(header, sizeof(header->response))) {
+        return -1;
+    }
+    if (timing_len != 0 && !c->addIov(stamps, timing_len)) {
+        return -1;
+    }
+    return 0;
 }
 
 protocol_binary_response_status engine_error_2_mcbp_protocol_error(
@@ -380,11 +506,25 @@ bool mcbp_response_handler(const void* key, uint16_t keylen,
     return true;
 }
 
+/**
+ * Latency histograms per traffic lane, indexed by the transport
+ * (0 = plaintext, 1 = SSL) and the EventPriority enum values.
+ */
+static Timings lane_timings[2][4];
+
+Timings& get_lane_timings(bool ssl, const EventPriority& priority) {
+    return lane_timings[ssl ? 1 : 0][size_t(priority)];
+}
+
 void mcbp_collect_timings(const McbpConnection* c) {
     hrtime_t now = gethrtime();
     const hrtime_t elapsed_ns = now - c->getStart();
+    // use the calling worker's histogram shard so the hot opcodes
+    // don't have all of the workers hammering the same cache lines
+    const size_t shard = c->getThread()->index;
+
     // aggregated timing for all buckets
-    all_buckets[0].timings.collect(c->getCmd(), elapsed_ns);
+    all_buckets[0].timings.collect(c->getCmd(), elapsed_ns, shard);
 
     // timing for current bucket
     bucket_id_t bucketid = get_bucket_id(c->getCookie());
@@ -393,7 +533,44 @@ void mcbp_collect_timings(const McbpConnection* c) {
      * to delete the bucket you're associated with and your're idle.
      */
     if (bucketid != 0) {
-        all_buckets[bucketid].timings.collect(c->getCmd(), elapsed_ns);
+        all_buckets[bucketid].timings.collect(c->getCmd(), elapsed_ns, shard);
+    }
+
+    // timing for the connection's traffic lane - transport crossed
+    // with priority class (across all buckets)
+    get_lane_timings(c->isSsl(), c->getEventPriority()).collect(c->getCmd(),
+                                                                elapsed_ns,
+                                                                shard);
+
+    // timing for the A/B experiment arms the connection belongs to
+    collect_experiment_timings(c->getExperimentEligible(),
+                               c->getExperimentTreatment(),
+                               c->getCmd(), elapsed_ns, shard);
+
+    // resource accounting for the (bucket, opcode) matrix
+    const uint64_t bytes_in = sizeof(c->binary_header) +
+                              c->binary_header.request.bodylen;
+    const uint64_t engine_ns = uint64_t(c->getEngineTime());
+    all_buckets[0].rusage.collect(c->getCmd(), shard, bytes_in,
+                                  c->getResponseBytes(), engine_ns,
+                                  uint64_t(elapsed_ns));
+    if (bucketid != 0) {
+        all_buckets[bucketid].rusage.collect(c->getCmd(), shard, bytes_in,
+                                             c->getResponseBytes(), engine_ns,
+                                             uint64_t(elapsed_ns));
+
+        // settle the command's cost against the bucket's throttle
+        // token buckets (see conn_new_cmd)
+        all_buckets[bucketid].ops_throttle.debit(1);
+        all_buckets[bucketid].bytes_throttle.debit(
+            int64_t(bytes_in + c->getResponseBytes()));
+    }
+
+    // Capture commands over the slow-op threshold into the audit
+    // ring (drained to the log by a background task)
+    const uint64_t slow_threshold = slow_op_log_threshold_ns();
+    if (slow_threshold != 0 && uint64_t(elapsed_ns) >= slow_threshold) {
+        slow_op_log_capture(c, bucketid, elapsed_ns, shard);
     }
 
     // Log operations taking longer than 0.5s
@@ -24,6 +24,7 @@
 
 #include <memcached/protocol_binary.h>
 #include "connection_mcbp.h"
+#include "timings.h"
 
 int mcbp_add_header(McbpConnection* c,
                     uint16_t err,
@@ -63,3 +64,13 @@ bool mcbp_response_handler(const void* key, uint16_t keylen,
 
 /* set up a connection to write a DynamicBuffer then free it once sent. */
 void mcbp_write_and_free(McbpConnection* c, DynamicBuffer* buf);
+
+/**
+ * Get the command latency histogram for a traffic lane: the transport
+ * (plaintext or SSL) crossed with the event priority class. The
+ * histograms span all buckets; they exist to tell the latency of the
+ * traffic on a high priority interface apart from the bulk traffic,
+ * and the cost of the SSL clients apart from the plaintext ones, so
+ * SLOs can be set per lane (see "stats class-timings").
+ */
+Timings& get_lane_timings(bool ssl, const EventPriority& priority);
@@ -23,6 +23,7 @@
 #include "buckets.h"
 #include "config_parse.h"
 #include "ioctl.h"
+#include "json_validator.h"
 #include "runtime.h"
 #include "debug_helpers.h"
 #include "mcaudit.h"
@@ -31,10 +32,14 @@
 #include "connections.h"
 #include "mcbp_validators.h"
 #include "mcbp_topkeys.h"
+#include "phase_timings.h"
+#include "experiments.h"
 #include "enginemap.h"
 #include "mcbpdestroybuckettask.h"
 #include "sasl_tasks.h"
+#include "session_resume.h"
 #include "mcbp_privileges.h"
+#include "numa_replicas.h"
 
 #include <memcached/audit_interface.h>
 #include <platform/cb_malloc.h>
@@ -74,6 +79,7 @@ static bool authenticated(McbpConnection* c) {
     case PROTOCOL_BINARY_CMD_SASL_AUTH:       /* FALLTHROUGH */
     case PROTOCOL_BINARY_CMD_SASL_STEP:       /* FALLTHROUGH */
     case PROTOCOL_BINARY_CMD_VERSION:         /* FALLTHROUGH */
+    case PROTOCOL_BINARY_CMD_RESUME_SESSION:  /* FALLTHROUGH */
     case PROTOCOL_BINARY_CMD_HELLO:
         rv = true;
         break;
@@ -168,13 +174,22 @@ static void handle_binary_protocol_error(McbpConnection* c) {
  * valid operation.
  */
 void update_topkeys(const char* key, size_t nkey, McbpConnection* c) {
+#ifndef DISABLE_TOPKEYS
+    if (buckets_with_topkeys.load(std::memory_order_relaxed) == 0) {
+        /* No bucket is tracking; keep the hot path down to this single
+         * (perfectly predicted) branch. */
+        return;
+    }
 
     if (topkey_commands[c->binary_header.request.opcode]) {
-        if (all_buckets[c->getBucketIndex()].topkeys != nullptr) {
-            all_buckets[c->getBucketIndex()].topkeys->updateKey(key, nkey,
-                                                                mc_time_get_current_time());
+        TopKeys* topkeys = all_buckets[c->getBucketIndex()].topkeys.load(
+                std::memory_order_acquire);
+        if (topkeys != nullptr) {
+            topkeys->updateKey(key, nkey, mc_time_get_current_time(),
+                               c->getThread()->index);
         }
     }
+#endif
 }
 
 // Generic add_stat<T>. Uses std::to_string which requires heap allocation.
@@ -265,6 +280,8 @@ static ENGINE_ERROR_CODE server_stats(ADD_STAT add_stat_callback,
     struct thread_stats thread_stats;
     thread_stats.aggregate(all_buckets[c->getBucketIndex()].stats,
                            settings.getNumWorkerThreads());
+    // report relative to the baseline captured by the last reset
+    thread_stats -= all_buckets[c->getBucketIndex()].stats_baseline;
 
     auto* cookie = c->getCookie();
 
@@ -339,11 +356,30 @@ static ENGINE_ERROR_CODE server_stats(ADD_STAT add_stat_callback,
         add_stat(cookie, add_stat_callback, "bytes_read", thread_stats.bytes_read);
         add_stat(cookie, add_stat_callback, "bytes_written",
                  thread_stats.bytes_written);
+        add_stat(cookie, add_stat_callback, "bytes_sent_zerocopy",
+                 thread_stats.bytes_sent_zerocopy);
+        add_stat(cookie, add_stat_callback, "bytes_sent_copied",
+                 thread_stats.bytes_sent_copied);
+        add_stat(cookie, add_stat_callback, "bytes_sent_ship",
+                 thread_stats.bytes_sent_ship);
+        add_stat(cookie, add_stat_callback, "sendmsg_calls",
+                 thread_stats.sendmsg_calls);
+        add_stat(cookie, add_stat_callback, "responses_corked",
+                 thread_stats.responses_corked);
         add_stat(cookie, add_stat_callback, "accepting_conns",
                  is_listen_disabled() ? 0 : 1);
         add_stat(cookie, add_stat_callback, "listen_disabled_num",
                  get_listen_disabled_num());
         add_stat(cookie, add_stat_callback, "rejected_conns", stats.rejected_conns);
+        add_stat(cookie, add_stat_callback, "op_budget_kills",
+                 stats.op_budget_kills);
+        add_stat(cookie, add_stat_callback, "deadline_drops",
+                 stats.deadline_drops);
+        add_stat(cookie, add_stat_callback, "shed_conns", stats.shed_conns);
+        add_stat(cookie, add_stat_callback, "cross_numa_dispatch",
+                 stats.cross_numa_dispatch);
+        add_stat(cookie, add_stat_callback, "conn_migrations",
+                 stats.conn_migrations);
         add_stat(cookie, add_stat_callback, "threads", settings.getNumWorkerThreads());
         add_stat(cookie, add_stat_callback, "conn_yields", thread_stats.conn_yields);
         add_stat(cookie, add_stat_callback, "rbufs_allocated",
@@ -360,6 +396,8 @@ static ENGINE_ERROR_CODE server_stats(ADD_STAT add_stat_callback,
                  thread_stats.iovused_high_watermark);
         add_stat(cookie, add_stat_callback, "msgused_high_watermark",
                  thread_stats.msgused_high_watermark);
+        add_stat(cookie, add_stat_callback, "scratch_arena_high_watermark",
+                 thread_stats.scratch_arena_high_watermark);
     } catch (std::bad_alloc&) {
         return ENGINE_ENOMEM;
     }
@@ -480,6 +518,11 @@ static void process_stat_settings(ADD_STAT add_stat_callback,
                              "-management");
             add_stat(cookie, add_stat_callback, interface, ifce.management);
 
+            checked_snprintf(interface + offset, sizeof(interface) - offset,
+                             "-priority");
+            add_stat(cookie, add_stat_callback, interface,
+                     to_string(ifce.priority));
+
             if (ifce.ssl.enabled) {
                 checked_snprintf(interface + offset, sizeof(interface) - offset,
                                  "-ssl-pkey");
@@ -498,6 +541,22 @@ static void process_stat_settings(ADD_STAT add_stat_callback,
                     error.what());
     }
 
+    try {
+        for (const auto& exp : settings.getExperiments()) {
+            char key[1024];
+            checked_snprintf(key, sizeof(key), "experiment-%s",
+                             exp.name.c_str());
+            std::string value = std::to_string(exp.percentage) + "%";
+            if (exp.port != 0) {
+                value += " on port " + std::to_string(exp.port);
+            }
+            add_stat(cookie, add_stat_callback, key, value);
+        }
+    } catch (std::exception& error) {
+        LOG_WARNING(nullptr, "process_stats_settings: Error building stats: %s",
+                    error.what());
+    }
+
     add_stat(cookie, add_stat_callback, "verbosity", settings.getVerbose());
     add_stat(cookie, add_stat_callback, "num_threads", settings.getNumWorkerThreads());
     add_stat(cookie, add_stat_callback, "reqs_per_event_high_priority",
@@ -508,6 +567,14 @@ static void process_stat_settings(ADD_STAT add_stat_callback,
              settings.getRequestsPerEventNotification(EventPriority::Low));
     add_stat(cookie, add_stat_callback, "reqs_per_event_def_priority",
              settings.getRequestsPerEventNotification(EventPriority::Default));
+    add_stat(cookie, add_stat_callback, "event_time_budget_high_priority",
+             settings.getEventTimeBudget(EventPriority::High));
+    add_stat(cookie, add_stat_callback, "event_time_budget_med_priority",
+             settings.getEventTimeBudget(EventPriority::Medium));
+    add_stat(cookie, add_stat_callback, "event_time_budget_low_priority",
+             settings.getEventTimeBudget(EventPriority::Low));
+    add_stat(cookie, add_stat_callback, "event_time_budget_def_priority",
+             settings.getEventTimeBudget(EventPriority::Default));
     add_stat(cookie, add_stat_callback, "auth_enabled_sasl", "yes");
     add_stat(cookie, add_stat_callback, "auth_sasl_engine", "cbsasl");
 
@@ -546,12 +613,199 @@ static void process_stat_settings(ADD_STAT add_stat_callback,
             settings.isDedupeNmvbMaps() ? "true" : "false");
     add_stat(cookie, add_stat_callback, "max_packet_size",
              std::to_string(settings.getMaxPacketSize()).c_str());
+    add_stat(cookie, add_stat_callback, "dcp_ship_batch_size",
+             std::to_string(settings.getDcpShipBatchSize()).c_str());
+    add_stat(cookie, add_stat_callback, "response_compression_threshold",
+             std::to_string(
+                 settings.getResponseCompressionThreshold()).c_str());
+    add_stat(cookie, add_stat_callback, "per_op_memory_budget",
+             std::to_string(settings.getPerOpMemoryBudget()).c_str());
+    add_stat(cookie, add_stat_callback, "scheduler_quantum_us",
+             std::to_string(settings.getSchedulerQuantumUs()).c_str());
+    add_stat(cookie, add_stat_callback, "stats_shm_path",
+             settings.getStatsShmPath().c_str());
+    add_stat(cookie, add_stat_callback, "engine_module_warming",
+             settings.getEngineModuleWarming().c_str());
+    add_stat(cookie, add_stat_callback, "bucket_warmup_ops",
+             std::to_string(settings.getBucketWarmupOps()).c_str());
+    add_stat(cookie, add_stat_callback, "sched_trace_mode",
+             settings.getSchedTraceMode().c_str());
+    add_stat(cookie, add_stat_callback, "sched_trace_file",
+             settings.getSchedTraceFile().c_str());
+}
+
+
+/* Cap on the number of pipelined get requests resolved by one engine
+ * multi-get call */
+#define MULTIGET_MAX_BATCH 32
+
+static bool is_get_opcode(uint8_t opcode) {
+    return opcode == PROTOCOL_BINARY_CMD_GET ||
+           opcode == PROTOCOL_BINARY_CMD_GETQ ||
+           opcode == PROTOCOL_BINARY_CMD_GETK ||
+           opcode == PROTOCOL_BINARY_CMD_GETKQ;
+}
+
+/**
+ * Pipelined-GET batching.
+ *
+ * When a client pipelines get requests the following frames already
+ * sit complete in the read buffer (the same observation the header
+ * prescan builds on). Collect the keys of the burst and resolve them
+ * with a single engine multi-get call, which lets the engine hash the
+ * whole batch up front, prefetch its hash buckets and amortize its
+ * internal locking; the results for the following requests are
+ * stashed on the connection and consumed as those requests are
+ * parsed.
+ *
+ * Returns true if the current key was resolved (filling out *it and
+ * *ret); false means the caller should take the per-key path, with no
+ * key resolved.
+ */
+static bool try_multiget(McbpConnection* c, const char* key, size_t nkey,
+                         item** it, ENGINE_ERROR_CODE* ret) {
+    if (c->getBucketEngine()->get_multi == nullptr) {
+        return false;
+    }
+
+    const uint16_t vbucket = c->binary_header.request.vbucket;
+    const uint16_t raw_vbucket = htons(vbucket);
+    item_get_entry entries[MULTIGET_MAX_BATCH];
+    size_t count = 0;
+
+    entries[count].key = key;
+    entries[count].nkey = nkey;
+    ++count;
+
+    const char* ptr = c->read.curr;
+    size_t remaining = c->read.bytes;
+    while (count < MULTIGET_MAX_BATCH &&
+           remaining >= sizeof(protocol_binary_request_header)) {
+        protocol_binary_request_header header;
+        memcpy(&header, ptr, sizeof(header));
+
+        const uint32_t bodylen = ntohl(header.request.bodylen);
+        const uint16_t keylen = ntohs(header.request.keylen);
+        const size_t frame = sizeof(header) + size_t(bodylen);
+
+        /* The same checks get_validator applies; a frame failing them
+         * is rejected when it is parsed, so just end the batch at it.
+         * Frames against another vbucket end the batch as well since
+         * the engine resolves the batch against a single vbucket. */
+        if (header.request.magic != PROTOCOL_BINARY_REQ ||
+            !is_get_opcode(header.request.opcode) ||
+            header.request.extlen != 0 ||
+            keylen == 0 || bodylen != uint32_t(keylen) ||
+            header.request.datatype != PROTOCOL_BINARY_RAW_BYTES ||
+            header.request.cas != 0 ||
+            header.request.vbucket != raw_vbucket ||
+            remaining < frame) {
+            break;
+        }
+
+        entries[count].key = ptr + sizeof(header);
+        entries[count].nkey = keylen;
+        ++count;
+        ptr += frame;
+        remaining -= frame;
+    }
+
+    if (count < 2) {
+        /* Nothing pipelined behind us; not worth an engine roundtrip */
+        return false;
+    }
+
+    if (bucket_get_multi(c, entries, count, vbucket) != ENGINE_SUCCESS) {
+        /* Engine declined (or would have blocked); no entry was
+         * resolved, serve everything per key */
+        return false;
+    }
+
+    for (size_t ii = 1; ii < count; ++ii) {
+        if (!c->stashPrefetchedGet(entries[ii].key,
+                                   uint16_t(entries[ii].nkey),
+                                   entries[ii].item,
+                                   entries[ii].status)) {
+            /* Out of memory growing the stash; release the remaining
+             * results and serve those requests per key instead */
+            for (size_t jj = ii; jj < count; ++jj) {
+                if (entries[jj].item != nullptr) {
+                    bucket_release_item(c, entries[jj].item);
+                }
+            }
+            break;
+        }
+    }
+
+    *it = static_cast<item*>(entries[0].item);
+    *ret = entries[0].status;
+    return true;
 }
 
+/* Values up to this size are eligible for the optimistic copy-out read
+ * path; anything larger keeps the zero-copy locked path */
+#define GET_COPY_BUFSZ 4096
+
+/**
+ * Optimistic single-GET fast path.
+ *
+ * Asks the engine to copy the value into a stack buffer without taking
+ * its cache lock or pinning the item (see get_copy in the engine
+ * interface). Small values go out through the response handler's
+ * staging buffer anyway, so nothing is lost by not holding an item
+ * reference, and the lock-free lookup keeps hot single-key gets off
+ * the engine's locks entirely.
+ *
+ * Returns true if the response was written (or the connection is being
+ * shut down); false means the caller should take the regular locked
+ * path - the engine's answer is not authoritative for misses, values
+ * that don't fit, or values the client needs inflated.
+ */
+static bool try_get_copy(McbpConnection* c, const char* key, size_t nkey) {
+    char buffer[GET_COPY_BUFSZ];
+    item_info_holder info;
+    info.info.clsid = 0;
+    info.info.nvalue = 1;
+
+    if (bucket_get_copy(c, key, nkey, buffer, sizeof(buffer), &info.info,
+                        c->binary_header.request.vbucket) != ENGINE_SUCCESS) {
+        return false;
+    }
+
+    auto datatype = info.info.datatype;
+    if (!c->isSupportsDatatype()) {
+        if (mcbp::datatype::is_compressed(datatype)) {
+            /* Needs inflating; the locked path has the machinery */
+            return false;
+        }
+        datatype = PROTOCOL_BINARY_RAW_BYTES;
+    }
+
+    uint16_t keylen = 0;
+    if ((c->getCmd() == PROTOCOL_BINARY_CMD_GETK) ||
+        (c->getCmd() == PROTOCOL_BINARY_CMD_GETKQ)) {
+        keylen = (uint16_t)nkey;
+    }
+
+    if (!mcbp_response_handler(key, keylen, &info.info.flags, 4,
+                               buffer, info.info.nbytes, datatype,
+                               PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                               info.info.cas, c->getCookie())) {
+        /* Couldn't stage the response; nothing sent, fall back */
+        return false;
+    }
+
+    STATS_HIT(c, get, key, nkey);
+    /* The value is staged through the dynamic buffer */
+    get_thread_stats(c)->bytes_sent_copied += info.info.nbytes;
+    update_topkeys(key, nkey, c);
+    mcbp_write_and_free(c, &c->getDynamicBuffer());
+    return true;
+}
 
 static void process_bin_get(McbpConnection* c) {
     item* it;
-    protocol_binary_response_get* rsp = (protocol_binary_response_get*)c->write.buf;
+    protocol_binary_response_get* rsp;
     char* key = binary_get_key(c);
     size_t nkey = c->binary_header.request.keylen;
     uint16_t keylen;
@@ -572,8 +826,17 @@ static void process_bin_get(McbpConnection* c) {
     ret = c->getAiostat();
     c->setAiostat(ENGINE_SUCCESS);
     if (ret == ENGINE_SUCCESS) {
-        ret = bucket_get(c, &it, key, (int)nkey,
-                         c->binary_header.request.vbucket);
+        void* stashed;
+        if (c->consumePrefetchedGet(key, uint16_t(nkey), &stashed, &ret)) {
+            /* Resolved ahead of time by a multi-get batch */
+            it = static_cast<item*>(stashed);
+        } else if (!try_multiget(c, key, nkey, &it, &ret)) {
+            if (try_get_copy(c, key, nkey)) {
+                return;
+            }
+            ret = bucket_get(c, &it, key, (int)nkey,
+                             c->binary_header.request.vbucket);
+        }
     }
 
     item_info_holder info;
@@ -619,12 +882,51 @@ static void process_bin_get(McbpConnection* c) {
                                              datatype,
                                              PROTOCOL_BINARY_RESPONSE_SUCCESS,
                                              info.info.cas, c->getCookie())) {
+                /* Inflating forces the value through an intermediate
+                   buffer; account for it so the zero-copy ratio can be
+                   tracked. */
+                get_thread_stats(c)->bytes_sent_copied += info.info.nbytes;
                 mcbp_write_and_free(c, &c->getDynamicBuffer());
                 bucket_release_item(c, it);
             } else {
                 mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
             }
         } else {
+            /* Optionally compress the value on the client's behalf.
+               The client negotiated datatype support, so it can
+               receive Snappy values; once a value is big enough the
+               CPU spent deflating costs less than shipping the extra
+               bytes. The compressed copy is staged through the
+               dynamic buffer so it stays valid until conn_mwrite has
+               drained. Any failure along the way just falls back to
+               sending the value uncompressed. */
+            const char* compressed = nullptr;
+            size_t compressed_len = 0;
+            const int threshold = settings.getResponseCompressionThreshold();
+            if (threshold > 0 && c->isSupportsDatatype() &&
+                info.info.nvalue == 1 &&
+                !mcbp::datatype::is_compressed(datatype) &&
+                info.info.nbytes >= uint32_t(threshold)) {
+                cb::compression::Buffer buffer;
+                if (cb::compression::deflate(
+                        cb::compression::Algorithm::Snappy,
+                        reinterpret_cast<const char*>(
+                            info.info.value[0].iov_base),
+                        info.info.value[0].iov_len, buffer) &&
+                    buffer.len < info.info.value[0].iov_len &&
+                    c->growDynamicBuffer(buffer.len)) {
+                    auto& dbuf = c->getDynamicBuffer();
+                    compressed = dbuf.getCurrent();
+                    memcpy(dbuf.getCurrent(), buffer.data.get(), buffer.len);
+                    dbuf.moveOffset(buffer.len);
+                    compressed_len = buffer.len;
+                    datatype |= PROTOCOL_BINARY_DATATYPE_COMPRESSED;
+                    bodylen -= info.info.nbytes;
+                    bodylen += uint32_t(compressed_len);
+                }
+            }
+
+            rsp = (protocol_binary_response_get*)c->getResponseHeaderSlot();
             if (mcbp_add_header(c, 0, sizeof(rsp->message.body),
                                 keylen, bodylen, datatype) == -1) {
                 c->setState(conn_closing);
@@ -632,19 +934,45 @@ static void process_bin_get(McbpConnection* c) {
             }
             rsp->message.header.response.cas = htonll(info.info.cas);
 
-            /* add the flags */
+            /* add the flags (staged right behind the header) */
             rsp->message.body.flags = info.info.flags;
             c->addIov(&rsp->message.body, sizeof(rsp->message.body));
+            c->write.curr += sizeof(rsp->message.body);
+            c->write.bytes += sizeof(rsp->message.body);
 
             if ((c->getCmd() == PROTOCOL_BINARY_CMD_GETK) ||
                 (c->getCmd() == PROTOCOL_BINARY_CMD_GETKQ)) {
                 c->addIov(info.info.key, nkey);
             }
 
-            for (ii = 0; ii < info.info.nvalue; ++ii) {
-                c->addIov(info.info.value[ii].iov_base,
-                          info.info.value[ii].iov_len);
+            if (compressed != nullptr) {
+                c->addIov(compressed, compressed_len);
+                /* Hand the dynamic buffer segments over to the
+                   connection so the compressed bytes survive until
+                   transmit time. */
+                if (!c->takeBufferOwnership(c->getDynamicBuffer())) {
+                    bucket_release_item(c, it);
+                    c->setState(conn_closing);
+                    return;
+                }
+                c->accountCompressedResponse(info.info.nbytes -
+                                             compressed_len);
+                get_thread_stats(c)->bytes_sent_copied += compressed_len;
+            } else {
+                /* The iovecs point straight into the engine's item
+                   memory; nothing is staged through the write buffer.
+                   The item reference below keeps the memory alive
+                   until conn_mwrite has drained. */
+                for (ii = 0; ii < info.info.nvalue; ++ii) {
+                    c->addIov(info.info.value[ii].iov_base,
+                              info.info.value[ii].iov_len);
+                }
+                get_thread_stats(c)->bytes_sent_zerocopy += info.info.nbytes;
             }
+            /* Everything referenced by the iovecs stays valid until
+               transmit time (the item is kept alive below), so the
+               response may be corked. */
+            c->setCorkableResponse(true);
             c->setState(conn_mwrite);
             /* Remember this item so we can garbage collect it later */
             c->setItem(it);
@@ -660,8 +988,8 @@ static void process_bin_get(McbpConnection* c) {
         } else {
             if ((c->getCmd() == PROTOCOL_BINARY_CMD_GETK) ||
                 (c->getCmd() == PROTOCOL_BINARY_CMD_GETKQ)) {
-                char* ofs =
-                    c->write.buf + sizeof(protocol_binary_response_header);
+                char* ofs = c->getResponseHeaderSlot() +
+                            sizeof(protocol_binary_response_header);
                 if (mcbp_add_header(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT,
                                     0, (uint16_t)nkey,
                                     (uint32_t)nkey,
@@ -671,6 +999,10 @@ static void process_bin_get(McbpConnection* c) {
                 }
                 memcpy(ofs, key, nkey);
                 c->addIov(ofs, nkey);
+                c->write.curr += nkey;
+                c->write.bytes += nkey;
+                /* Key echoed via the write buffer; safe to cork */
+                c->setCorkableResponse(true);
                 c->setState(conn_mwrite);
             } else {
                 mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
@@ -1041,6 +1373,9 @@ void ship_mcbp_tap_log(McbpConnection* c) {
 
     c->setEwouldblock(false);
     if (send_data) {
+        const size_t staged = c->getStagedSendBytes();
+        c->accountShipBytes(staged);
+        get_thread_stats(c)->bytes_sent_ship += staged;
         c->setState(conn_mwrite);
         if (disconnect) {
             c->setWriteAndGo(conn_closing);
@@ -1270,16 +1605,8 @@ static void process_bin_tap_packet(tap_event_t event, McbpConnection* c) {
         if (ret == ENGINE_SUCCESS) {
             uint8_t datatype = c->binary_header.request.datatype;
             if (event == TAP_MUTATION && !c->isSupportsDatatype()) {
-                auto* validator = c->getThread()->validator;
-                try {
-                    if (validator->validate(reinterpret_cast<uint8_t*>(data),
-                                            ndata)) {
-                        datatype = PROTOCOL_BINARY_DATATYPE_JSON;
-                    }
-                } catch (std::bad_alloc&) {
-                    // @todo send ENOMEM
-                    c->setState(conn_closing);
-                    return;
+                if (is_valid_json(reinterpret_cast<uint8_t*>(data), ndata)) {
+                    datatype = PROTOCOL_BINARY_DATATYPE_JSON;
                 }
             }
 
@@ -1843,6 +2170,14 @@ static ENGINE_ERROR_CODE dcp_message_buffer_acknowledgement(const void* void_coo
                                                             uint32_t buffer_bytes) {
     auto* c = cookie2mcbp(void_cookie, __func__);
     c->setCmd(PROTOCOL_BINARY_CMD_DCP_BUFFER_ACKNOWLEDGEMENT);
+
+    /* Consumers emit an acknowledgement per processed message; when
+     * the previous message in this batch acked the same stream just
+     * fold the bytes into it instead of queuing another packet. */
+    if (c->coalesceBufferAck(opaque, vbucket, buffer_bytes)) {
+        return ENGINE_SUCCESS;
+    }
+
     protocol_binary_request_dcp_buffer_acknowledgement packet;
     if (c->write.bytes + sizeof(packet.bytes) >= c->write.size) {
         /* We don't have room in the buffer */
@@ -1862,6 +2197,7 @@ static ENGINE_ERROR_CODE dcp_message_buffer_acknowledgement(const void* void_coo
     c->addIov(c->write.curr, sizeof(packet.bytes));
     c->write.curr += sizeof(packet.bytes);
     c->write.bytes += sizeof(packet.bytes);
+    c->noteBufferAck(opaque, vbucket);
 
     return ENGINE_SUCCESS;
 }
@@ -1927,6 +2263,7 @@ void ship_mcbp_dcp_log(McbpConnection* c) {
     // Begin timing DCP, each dcp callback needs to set the c->cmd for the timing
     // to be recorded.
     c->setStart(gethrtime());
+    c->resetCommandAccounting();
 
     if (!c->addMsgHdr(true)) {
         LOG_WARNING(c,
@@ -1939,15 +2276,46 @@ void ship_mcbp_dcp_log(McbpConnection* c) {
 
     c->write.bytes = 0;
     c->write.curr = c->write.buf;
+    c->resetBufferAckCoalescing();
     c->setEwouldblock(false);
-    ret = c->getBucketEngine()->dcp.step(c->getBucketEngineAsV0(), c->getCookie(),
-                                         &producers);
-    if (ret == ENGINE_SUCCESS) {
+
+    /*
+     * Drive the engine until it runs dry (or the write buffer is
+     * half full) instead of transmitting every message by itself:
+     * during a rebalance the stream delivers a long run of small
+     * mutations, and shipping them one sendmsg() at a time made the
+     * syscall overhead dominate. Everything batched here goes out in
+     * a single vectored write through the regular msglist machinery.
+     */
+    const int max_batch = settings.getDcpShipBatchSize();
+    int batched = 0;
+    do {
+        ret = c->getBucketEngine()->dcp.step(c->getBucketEngineAsV0(),
+                                             c->getCookie(), &producers);
+        if (ret == ENGINE_WANT_MORE) {
+            ++batched;
+        }
+    } while (ret == ENGINE_WANT_MORE &&
+             c->write.bytes < (c->write.size / 2) &&
+             batched < max_batch);
+
+    if (ret == ENGINE_E2BIG && batched > 0) {
+        /* The producer ran out of buffer room mid-batch; ship what we
+         * have and retry the rejected message with an empty buffer */
+        ret = ENGINE_WANT_MORE;
+    }
+
+    if (ret == ENGINE_SUCCESS && batched == 0) {
         /* the engine don't have more data to send at this moment */
         c->setEwouldblock(true);
-    } else if (ret == ENGINE_WANT_MORE) {
-        /* The engine got more data it wants to send */
+    } else if (ret == ENGINE_SUCCESS || ret == ENGINE_WANT_MORE) {
+        /* Ship the batch; conn_ship_log picks up where we left off
+         * (and discovers an idle engine on the next call) */
         ret = ENGINE_SUCCESS;
+        c->accountDcpBatch(batched);
+        const size_t staged = c->getStagedSendBytes();
+        c->accountShipBytes(staged);
+        get_thread_stats(c)->bytes_sent_ship += staged;
         c->setState(conn_mwrite);
         c->setWriteAndGo(conn_ship_log);
     }
@@ -2793,23 +3161,13 @@ static void add_set_replace_executor(McbpConnection* c, void* packet,
         memcpy(info.info.value[0].iov_base, key + nkey, vlen);
 
         if (!c->isSupportsDatatype()) {
-            auto* validator = c->getThread()->validator;
-
-            try {
-                auto* ptr = reinterpret_cast<uint8_t*>(info.info.value[0].iov_base);
-                if (validator->validate(ptr, info.info.value[0].iov_len)) {
-                    info.info.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
-                    if (!bucket_set_item_info(c, it, &info.info)) {
-                        LOG_WARNING(c, "%u: Failed to set item info",
-                                    c->getId());
-                    }
+            auto* ptr = reinterpret_cast<uint8_t*>(info.info.value[0].iov_base);
+            if (is_valid_json(ptr, info.info.value[0].iov_len)) {
+                info.info.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+                if (!bucket_set_item_info(c, it, &info.info)) {
+                    LOG_WARNING(c, "%u: Failed to set item info",
+                                c->getId());
                 }
-            } catch (std::bad_alloc&) {
-                // @todo return error message back to client
-                bucket_release_item(c, c->getItem());
-                c->setItem(nullptr);
-                c->setState(conn_closing);
-                return;
             }
         }
     }
@@ -2835,7 +3193,8 @@ static void add_set_replace_executor(McbpConnection* c, void* packet,
                 return;
             }
             mutation_descr_t* const extras = (mutation_descr_t*)
-                (c->write.buf + sizeof(protocol_binary_response_no_extras));
+                (c->getResponseHeaderSlot() +
+                 sizeof(protocol_binary_response_no_extras));
             extras->vbucket_uuid = htonll(info.info.vbucket_uuid);
             extras->seqno = htonll(info.info.seqno);
             mcbp_write_response(c, extras, sizeof(*extras), 0, sizeof(*extras));
@@ -2934,6 +3293,9 @@ public:
         // If the client sends compressed data we need to inflate the
         // input data before we can do anything
         InflateInputData,
+        // Ask the engine to extend the document in place (O(delta));
+        // engines which can't fall us through to the copy path below
+        TryInplace,
         // Look up the item to operate on
         GetItem,
         // Allocate the destination object
@@ -2966,7 +3328,7 @@ public:
           cas(ntohll(req->message.header.request.cas)),
           olditem(nullptr),
           newitem(nullptr),
-          state(State::GetItem) {
+          state(State::TryInplace) {
 
         auto datatype = req->message.header.request.datatype;
         if (mcbp::datatype::is_compressed(datatype)) {
@@ -2981,6 +3343,9 @@ public:
             case State::InflateInputData:
                 ret = inflateInputData();
                 break;
+            case State::TryInplace:
+                ret = tryInplace();
+                break;
             case State::GetItem:
                 ret = getItem();
                 break;
@@ -3018,7 +3383,7 @@ private:
             }
             value.buf = inputbuffer.data.get();
             value.len = inputbuffer.len;
-            state = State::GetItem;
+            state = State::TryInplace;
         } catch (const std::bad_alloc&) {
             return ENGINE_ENOMEM;
         }
@@ -3026,6 +3391,30 @@ private:
         return ENGINE_SUCCESS;
     }
 
+    ENGINE_ERROR_CODE tryInplace() {
+        if (connection.isSupportsMutationExtras()) {
+            // the extras want the vbucket uuid / seqno from the stored
+            // item's info; take the path which ends up holding the item
+            state = State::GetItem;
+            return ENGINE_SUCCESS;
+        }
+
+        uint64_t ncas = cas;
+        auto ret = bucket_append(&connection, key.buf, key.len,
+                                 value.buf, value.len, &ncas,
+                                 mode == Mode::Prepend, vbucket);
+        if (ret == ENGINE_SUCCESS) {
+            update_topkeys(key.buf, key.len, &connection);
+            connection.setCAS(ncas);
+            mcbp_write_packet(&connection, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            state = State::Done;
+        } else if (ret == ENGINE_ENOTSUP) {
+            state = State::GetItem;
+            ret = ENGINE_SUCCESS;
+        }
+        return ret;
+    }
+
     ENGINE_ERROR_CODE getItem() {
         auto ret = bucket_get(&connection, &olditem, key.buf, key.len, vbucket);
         if (ret == ENGINE_SUCCESS) {
@@ -3121,7 +3510,7 @@ private:
                     return ENGINE_FAILED;
                 }
                 mutation_descr_t* const extras = (mutation_descr_t*)
-                    (connection.write.buf +
+                    (connection.getResponseHeaderSlot() +
                      sizeof(protocol_binary_response_no_extras));
                 extras->vbucket_uuid = htonll(newItemInfo.info.vbucket_uuid);
                 extras->seqno = htonll(newItemInfo.info.seqno);
@@ -3236,112 +3625,425 @@ static void prependq_executor(McbpConnection* c, void* packet) {
                             AppendPrependCommandContext::Mode::Prepend);
 }
 
-
-static void get_executor(McbpConnection* c, void* packet) {
-    (void)packet;
-
-    switch (c->getCmd()) {
-    case PROTOCOL_BINARY_CMD_GETQ:
-        c->setNoReply(true);
-        break;
-    case PROTOCOL_BINARY_CMD_GET:
-        c->setNoReply(false);
-        break;
-    case PROTOCOL_BINARY_CMD_GETKQ:
-        c->setNoReply(true);
-        break;
-    case PROTOCOL_BINARY_CMD_GETK:
-        c->setNoReply(false);
-        break;
-    default:
-        LOG_WARNING(c,
-                    "%u: get_executor: cmd (which is %d) is not a valid GET "
-                        "variant - closing connection", c->getCmd());
-        c->setState(conn_closing);
-        return;
-    }
-
-    process_bin_get(c);
-}
-
 /**
- * This is a very slow thing that you shouldn't use in production ;-)
- *
- * @param c the connection to return the details for
+ * The SetRangeCommandContext implements the byte-range patch (SET_RANGE)
+ * command. Like append/prepend it first offers the operation to the
+ * engine, which can overwrite the range inside the stored value without
+ * touching the rest of the document; engines which can't (or won't for a
+ * given document) fall us through to the classic fetch + copy + CAS
+ * store sequence, with the same retry-on-EEXISTS loop as append when the
+ * client didn't pin a cas.
  */
-static void process_bucket_details(McbpConnection* c) {
-    cJSON* obj = cJSON_CreateObject();
+class SetRangeCommandContext : public CommandContext {
+public:
+    enum class State : uint8_t {
+        // Ask the engine to patch the document in place (O(delta))
+        TryInplace,
+        // Look up the item to operate on
+        GetItem,
+        // Allocate the destination object
+        AllocateNewItem,
+        // Store the new document
+        StoreItem,
+        // Release resources and retry after losing a CAS race
+        Reset,
+        // We're all done :)
+        Done
+    };
 
-    cJSON* array = cJSON_CreateArray();
-    for (int ii = 0; ii < settings.getMaxBuckets(); ++ii) {
-        cJSON* o = get_bucket_details(ii);
-        if (o != NULL) {
-            cJSON_AddItemToArray(array, o);
-        }
+    SetRangeCommandContext(McbpConnection& c,
+                           protocol_binary_request_set_range* req)
+        : connection(c),
+          key((char*)req->bytes + sizeof(req->bytes),
+              ntohs(req->message.header.request.keylen)),
+          value(key.buf + key.len,
+                ntohl(req->message.header.request.bodylen) - key.len -
+                sizeof(req->message.body)),
+          offset(ntohl(req->message.body.offset)),
+          vbucket(ntohs(req->message.header.request.vbucket)),
+          cas(ntohll(req->message.header.request.cas)),
+          olditem(nullptr),
+          newitem(nullptr),
+          state(State::TryInplace) {
     }
-    cJSON_AddItemToObject(obj, "buckets", array);
 
-    char* stats_str = cJSON_PrintUnformatted(obj);
-    append_stats("bucket details", 14, stats_str, uint32_t(strlen(stats_str)),
-                 c->getCookie());
-    cJSON_Free(stats_str);
-    cJSON_Delete(obj);
-}
+    ENGINE_ERROR_CODE step() {
+        ENGINE_ERROR_CODE ret;
+        do {
+            switch (state) {
+            case State::TryInplace:
+                ret = tryInplace();
+                break;
+            case State::GetItem:
+                ret = getItem();
+                break;
+            case State::AllocateNewItem:
+                ret = allocateNewItem();
+                break;
+            case State::StoreItem:
+                ret = storeItem();
+                break;
+            case State::Reset:
+                ret = reset();
+                break;
+            case State::Done:
+                return ENGINE_SUCCESS;
+            }
+        } while (ret == ENGINE_SUCCESS);
 
-/**
- * Handler for the <code>stats reset</code> command.
- *
- * Clear the global and the connected buckets stats.
- *
- * It is possible to clear a subset of the stats by using its submodule.
- * The following submodules exists:
- * <ul>
- *    <li>timings</li>
- * </ul>
- *
- * @todo I would have assumed that we wanted to clear the stats from
- *       <b>all</b> of the buckets?
- *
- * @param arg - should be empty
- * @param connection the connection that requested the operation
- */
-static ENGINE_ERROR_CODE stat_reset_executor(const std::string& arg,
-                                             McbpConnection& connection) {
-    if (arg.empty()) {
-        stats_reset(connection.getCookie());
-        bucket_reset_stats(&connection);
-        all_buckets[0].timings.reset();
-        all_buckets[connection.getBucketIndex()].timings.reset();
-        return ENGINE_SUCCESS;
-    } else if (arg == "timings") {
-        // Nuke the command timings section for the connected bucket
-        all_buckets[connection.getBucketIndex()].timings.reset();
-        return ENGINE_SUCCESS;
-    } else {
-        return ENGINE_EINVAL;
-    }
-}
+        if (ret != ENGINE_EWOULDBLOCK) {
+            SLAB_INCR(&connection, cmd_set, key, nkey);
+        }
 
-/**
- * Handler for the <code>stats settings</code> used to get the current
- * settings.
- *
- * @param arg - should be empty
- * @param connection the connection that requested the operation
- */
-static ENGINE_ERROR_CODE stat_settings_executor(const std::string& arg,
-                                                McbpConnection& connection) {
+        return ret;
+    }
 
-    if (arg.empty()) {
-        process_stat_settings(&append_stats, &connection);
-        return ENGINE_SUCCESS;
-    } else {
-        return ENGINE_EINVAL;
+    ~SetRangeCommandContext() override {
+        reset();
     }
-}
 
-/**
- * Handler for the <code>stats audit</code> used to get statistics from
+private:
+    ENGINE_ERROR_CODE tryInplace() {
+        if (connection.isSupportsMutationExtras()) {
+            // the extras want the vbucket uuid / seqno from the stored
+            // item's info; take the path which ends up holding the item
+            state = State::GetItem;
+            return ENGINE_SUCCESS;
+        }
+
+        uint64_t ncas = cas;
+        auto ret = bucket_patch(&connection, key.buf, key.len,
+                                value.buf, value.len, offset, &ncas,
+                                vbucket);
+        if (ret == ENGINE_SUCCESS) {
+            update_topkeys(key.buf, key.len, &connection);
+            connection.setCAS(ncas);
+            mcbp_write_packet(&connection, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            state = State::Done;
+        } else if (ret == ENGINE_ENOTSUP) {
+            state = State::GetItem;
+            ret = ENGINE_SUCCESS;
+        }
+        return ret;
+    }
+
+    ENGINE_ERROR_CODE getItem() {
+        auto ret = bucket_get(&connection, &olditem, key.buf, key.len, vbucket);
+        if (ret == ENGINE_SUCCESS) {
+            oldItemInfo.info.clsid = 0;
+            oldItemInfo.info.nvalue = 1;
+
+            if (!bucket_get_item_info(&connection, olditem,
+                                      &oldItemInfo.info)) {
+                return ENGINE_FAILED;
+            }
+
+            uint64_t oldcas = oldItemInfo.info.cas;
+            if (cas != 0 && cas != oldcas) {
+                return ENGINE_KEY_EEXISTS;
+            }
+
+            if (mcbp::datatype::is_compressed(oldItemInfo.info.datatype)) {
+                try {
+                    if (!cb::compression::inflate(cb::compression::Algorithm::Snappy,
+                                                  (const char*)oldItemInfo.info.value[0].iov_base,
+                                                  oldItemInfo.info.value[0].iov_len,
+                                                  buffer)) {
+                        return ENGINE_FAILED;
+                    }
+                } catch (const std::bad_alloc&) {
+                    return ENGINE_ENOMEM;
+                }
+            }
+
+            size_t oldsize = oldItemInfo.info.nbytes;
+            if (buffer.len != 0) {
+                oldsize = buffer.len;
+            }
+            if (size_t(offset) + value.len > oldsize) {
+                // a patch never changes the document's size
+                return ENGINE_ERANGE;
+            }
+
+            // Move on to the next state
+            state = State::AllocateNewItem;
+        }
+
+        return ret;
+    }
+
+    ENGINE_ERROR_CODE allocateNewItem() {
+        size_t oldsize = oldItemInfo.info.nbytes;
+        if (buffer.len != 0) {
+            oldsize = buffer.len;
+        }
+
+        // the patched document keeps the old datatype, except that an
+        // inflated value is stored back uncompressed
+        const auto datatype = protocol_binary_datatype_t(
+                oldItemInfo.info.datatype &
+                ~PROTOCOL_BINARY_DATATYPE_COMPRESSED);
+
+        ENGINE_ERROR_CODE ret;
+        ret = bucket_allocate(&connection, &newitem, key.buf, key.len,
+                              oldsize, oldItemInfo.info.flags, 0,
+                              datatype);
+        if (ret == ENGINE_SUCCESS) {
+            // copy the data over..
+            newItemInfo.info.clsid = 0;
+            newItemInfo.info.nvalue = 1;
+
+            if (!bucket_get_item_info(&connection, newitem,
+                                      &newItemInfo.info)) {
+                return ENGINE_FAILED;
+            }
+
+            const char* src = (const char*)oldItemInfo.info.value[0].iov_base;
+            if (buffer.len != 0) {
+                src = buffer.data.get();
+            }
+
+            char* newdata = (char*)newItemInfo.info.value[0].iov_base;
+
+            // do the op
+            memcpy(newdata, src, oldsize);
+            memcpy(newdata + offset, value.buf, value.len);
+            bucket_item_set_cas(&connection, newitem, oldItemInfo.info.cas);
+
+            state = State::StoreItem;
+        }
+        return ret;
+    }
+
+    ENGINE_ERROR_CODE storeItem() {
+        uint64_t ncas = cas;
+        auto ret = bucket_store(&connection, newitem, &ncas, OPERATION_CAS,
+                                vbucket);
+
+        if (ret == ENGINE_SUCCESS) {
+            update_topkeys(key.buf, key.len, &connection);
+            connection.setCAS(ncas);
+            if (connection.isSupportsMutationExtras()) {
+                newItemInfo.info.nvalue = 1;
+                if (!bucket_get_item_info(&connection, newitem,
+                                          &newItemInfo.info)) {
+                    return ENGINE_FAILED;
+                }
+                mutation_descr_t* const extras = (mutation_descr_t*)
+                    (connection.getResponseHeaderSlot() +
+                     sizeof(protocol_binary_response_no_extras));
+                extras->vbucket_uuid = htonll(newItemInfo.info.vbucket_uuid);
+                extras->seqno = htonll(newItemInfo.info.seqno);
+                mcbp_write_response(&connection, extras, sizeof(*extras), 0,
+                                    sizeof(*extras));
+            } else {
+                mcbp_write_packet(&connection,
+                                  PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            }
+            state = State::Done;
+        } else if (ret == ENGINE_KEY_EEXISTS && cas == 0) {
+            state = State::Reset;
+        }
+
+        return ret;
+    }
+
+    ENGINE_ERROR_CODE reset() {
+        if (olditem != nullptr) {
+            bucket_release_item(&connection, olditem);
+            olditem = nullptr;
+        }
+        if (newitem != nullptr) {
+            bucket_release_item(&connection, newitem);
+            newitem = nullptr;
+        }
+
+        if (buffer.len > 0) {
+            buffer.len = 0;
+            buffer.data.reset();
+        }
+        state = State::GetItem;
+        return ENGINE_SUCCESS;
+    }
+
+    McbpConnection& connection;
+    const const_sized_buffer key;
+    const const_sized_buffer value;
+    const uint32_t offset;
+    const uint16_t vbucket;
+    const uint64_t cas;
+
+    item* olditem;
+    item_info_holder oldItemInfo;
+
+    item* newitem;
+    item_info_holder newItemInfo;
+
+    cb::compression::Buffer buffer;
+    State state;
+};
+
+static void set_range_executor(McbpConnection* c, void* packet) {
+    c->setNoReply(false);
+    if (c->getCommandContext() == nullptr) {
+        auto* req = reinterpret_cast<protocol_binary_request_set_range*>(packet);
+        c->setCommandContext(new SetRangeCommandContext(*c, req));
+    }
+
+    ENGINE_ERROR_CODE ret = c->getAiostat();
+    c->setAiostat(ENGINE_SUCCESS);
+    c->setEwouldblock(false);
+
+    if (ret == ENGINE_SUCCESS) {
+        auto* context = reinterpret_cast<SetRangeCommandContext*>(c->getCommandContext());
+        ret = context->step();
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->setAiostat(ENGINE_EWOULDBLOCK);
+        c->setEwouldblock(true);
+        return;
+    case ENGINE_DISCONNECT:
+        c->setState(conn_closing);
+        return;
+    default:
+        mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+        return;
+    }
+}
+
+
+static void set_op_deadline_executor(McbpConnection* c, void* packet) {
+    auto* req = reinterpret_cast<protocol_binary_request_set_op_deadline*>(packet);
+    uint32_t deadline_ms = ntohl(req->message.body.deadline_ms);
+
+    /* stored in nanoseconds to match the gethrtime() timestamps used
+     * by process_bin_packet; 0 removes the deadline */
+    c->setOpDeadline(uint64_t(deadline_ms) * 1000000);
+    mcbp_write_response(c, NULL, 0, 0, 0);
+}
+
+static void get_executor(McbpConnection* c, void* packet) {
+    (void)packet;
+
+    switch (c->getCmd()) {
+    case PROTOCOL_BINARY_CMD_GETQ:
+        c->setNoReply(true);
+        break;
+    case PROTOCOL_BINARY_CMD_GET:
+        c->setNoReply(false);
+        break;
+    case PROTOCOL_BINARY_CMD_GETKQ:
+        c->setNoReply(true);
+        break;
+    case PROTOCOL_BINARY_CMD_GETK:
+        c->setNoReply(false);
+        break;
+    default:
+        LOG_WARNING(c,
+                    "%u: get_executor: cmd (which is %d) is not a valid GET "
+                        "variant - closing connection", c->getCmd());
+        c->setState(conn_closing);
+        return;
+    }
+
+    process_bin_get(c);
+}
+
+/**
+ * This is a very slow thing that you shouldn't use in production ;-)
+ *
+ * @param c the connection to return the details for
+ */
+static void process_bucket_details(McbpConnection* c) {
+    cJSON* obj = cJSON_CreateObject();
+
+    cJSON* array = cJSON_CreateArray();
+    for (int ii = 0; ii < settings.getMaxBuckets(); ++ii) {
+        cJSON* o = get_bucket_details(ii);
+        if (o != NULL) {
+            cJSON_AddItemToArray(array, o);
+        }
+    }
+    cJSON_AddItemToObject(obj, "buckets", array);
+
+    char* stats_str = cJSON_PrintUnformatted(obj);
+    append_stats("bucket details", 14, stats_str, uint32_t(strlen(stats_str)),
+                 c->getCookie());
+    cJSON_Free(stats_str);
+    cJSON_Delete(obj);
+}
+
+/**
+ * Handler for the <code>stats reset</code> command.
+ *
+ * Clear the global and the connected buckets stats.
+ *
+ * It is possible to clear a subset of the stats by using its submodule.
+ * The following submodules exists:
+ * <ul>
+ *    <li>timings</li>
+ * </ul>
+ *
+ * @todo I would have assumed that we wanted to clear the stats from
+ *       <b>all</b> of the buckets?
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_reset_executor(const std::string& arg,
+                                             McbpConnection& connection) {
+    if (arg.empty()) {
+        stats_reset(connection.getCookie());
+        bucket_reset_stats(&connection);
+        all_buckets[0].timings.reset();
+        all_buckets[connection.getBucketIndex()].timings.reset();
+        for (const auto& ssl : {false, true}) {
+            for (const auto& priority : {EventPriority::High,
+                                         EventPriority::Medium,
+                                         EventPriority::Low,
+                                         EventPriority::Default}) {
+                get_lane_timings(ssl, priority).reset();
+            }
+        }
+        all_buckets[connection.getBucketIndex()].rusage.reset();
+        all_buckets[connection.getBucketIndex()].stats_snapshot.invalidate();
+        phase_timings.reset();
+        sasl_auth_reset_timings();
+        reset_experiment_timings();
+        return ENGINE_SUCCESS;
+    } else if (arg == "timings") {
+        // Nuke the command timings section for the connected bucket
+        all_buckets[connection.getBucketIndex()].timings.reset();
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats settings</code> used to get the current
+ * settings.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_settings_executor(const std::string& arg,
+                                                McbpConnection& connection) {
+
+    if (arg.empty()) {
+        process_stat_settings(&append_stats, &connection);
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats audit</code> used to get statistics from
  * the audit subsystem.
  *
  * @param arg - should be empty
@@ -3357,186 +4059,815 @@ static ENGINE_ERROR_CODE stat_audit_executor(const std::string& arg,
     } else {
         return ENGINE_EINVAL;
     }
-}
+}
+
+
+/**
+ * Handler for the <code>stats bucket details</code> used to get information
+ * of the buckets (type, state, #clients etc)
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_bucket_details_executor(const std::string& arg,
+                                                      McbpConnection& connection) {
+    if (arg.empty()) {
+        process_bucket_details(&connection);
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats aggregate</code>.. probably not used anymore
+ * as it gives just a subset of what you'll get from an empty stat.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_aggregate_executor(const std::string& arg,
+                                                 McbpConnection& connection) {
+    if (arg.empty()) {
+        return server_stats(&append_stats, &connection);
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Render the complete (argument-less) stats output for the connection,
+ * and - when the snapshot cache is enabled - store the serialization
+ * in the bucket's snapshot so that requests within the configured age
+ * are served with a bulk copy instead of the full walk.
+ */
+static ENGINE_ERROR_CODE render_all_stats(McbpConnection* c) {
+    auto ret = c->getBucketEngine()->get_stats(c->getBucketEngineAsV0(),
+                                               c->getCookie(), nullptr, 0,
+                                               append_stats);
+    if (ret == ENGINE_SUCCESS) {
+        ret = server_stats(&append_stats, c);
+    }
+
+    if (ret == ENGINE_SUCCESS && settings.getStatsSnapshotAge() > 0) {
+        all_buckets[c->getBucketIndex()].stats_snapshot.update(
+            c->getDynamicBuffer(), mc_time_get_current_time());
+    }
+
+    return ret;
+}
+
+/**
+ * Handler for the <code>stats refresh</code> command: render the same
+ * output as the plain "stats" command, but always from scratch
+ * (bypassing and repopulating the cached serialization).
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_refresh_executor(const std::string& arg,
+                                               McbpConnection& connection) {
+    if (!arg.empty()) {
+        return ENGINE_EINVAL;
+    }
+    return render_all_stats(&connection);
+}
+
+/**
+ * Handler for the <code>stats connection[ fd]</code> command to retrieve
+ * information about connection specific details.
+ *
+ * @param arg an optional file descriptor representing the connection
+ *            object to retrieve information about. If empty dump all.
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_connections_executor(const std::string& arg,
+                                                   McbpConnection& connection) {
+    int64_t fd = -1;
+
+    if (!arg.empty()) {
+        try {
+            fd = std::stoll(arg);
+        } catch (...) {
+            return ENGINE_EINVAL;
+        }
+    }
+
+    connection_stats(&append_stats, connection.getCookie(), fd);
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Handler for the <code>stats topkeys</code> command used to retrieve
+ * the most popular keys in the attached bucket.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_topkeys_executor(const std::string& arg,
+                                               McbpConnection& connection) {
+    if (arg.empty()) {
+        auto& bucket = all_buckets[connection.getBucketIndex()];
+        TopKeys* topkeys = bucket.topkeys.load();
+        if (topkeys == nullptr) {
+            /* tracking is disabled for the bucket */
+            return ENGINE_KEY_ENOENT;
+        }
+        return topkeys->stats(connection.getCookie(),
+                              mc_time_get_current_time(),
+                              append_stats);
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats topkeys</code> command used to retrieve
+ * a JSON document containing the most popular keys in the attached bucket.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_topkeys_json_executor(const std::string& arg,
+                                                    McbpConnection& connection) {
+    if (arg.empty()) {
+        ENGINE_ERROR_CODE ret;
+
+        auto& bucket = all_buckets[connection.getBucketIndex()];
+        TopKeys* topkeys = bucket.topkeys.load();
+        if (topkeys == nullptr) {
+            /* tracking is disabled for the bucket */
+            return ENGINE_KEY_ENOENT;
+        }
+
+        char key[] = "topkeys_json";
+        const rel_time_t now = mc_time_get_current_time();
+        const auto max_age = rel_time_t(settings.getStatsSnapshotAge());
+
+        if (max_age > 0) {
+            /* Rendering visits every shard under its lock (or merges
+             * the per-worker sketches); serve the cached document to
+             * the pollers within the snapshot window instead. */
+            auto& snapshot = bucket.topkeys_json_snapshot;
+            std::lock_guard<std::mutex> guard(snapshot.mutex);
+            if (!snapshot.payload.empty() &&
+                snapshot.timestamp + max_age >= now) {
+                append_stats(key, (uint16_t)strlen(key),
+                             snapshot.payload.data(),
+                             (uint32_t)snapshot.payload.size(),
+                             connection.getCookie());
+                return ENGINE_SUCCESS;
+            }
+        }
+
+        cJSON* topkeys_doc = cJSON_CreateObject();
+        if (topkeys_doc == nullptr) {
+            ret = ENGINE_ENOMEM;
+        } else {
+            ret = topkeys->json_stats(topkeys_doc, now);
+
+            if (ret == ENGINE_SUCCESS) {
+                char* topkeys_str = cJSON_PrintUnformatted(topkeys_doc);
+                if (topkeys_str != nullptr) {
+                    append_stats(key, (uint16_t)strlen(key),
+                                 topkeys_str, (uint32_t)strlen(topkeys_str),
+                                 connection.getCookie());
+                    if (max_age > 0) {
+                        auto& snapshot = bucket.topkeys_json_snapshot;
+                        std::lock_guard<std::mutex> guard(snapshot.mutex);
+                        snapshot.payload.assign(topkeys_str);
+                        snapshot.timestamp = now;
+                    }
+                    cJSON_Free(topkeys_str);
+                } else {
+                    ret = ENGINE_ENOMEM;
+                }
+            }
+            cJSON_Delete(topkeys_doc);
+        }
+        return ret;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats subdoc_execute</code> command used to retrieve
+ * information from the subdoc subsystem.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_subdoc_execute_executor(const std::string& arg,
+                                                      McbpConnection& connection) {
+    if (arg.empty()) {
+        const auto index = connection.getBucketIndex();
+        std::string json_str;
+        if (index == 0) {
+            // Aggregrated timings for all buckets.
+            TimingHistogram aggregated;
+            for (const auto& bucket : all_buckets) {
+                aggregated += bucket.subjson_operation_times;
+            }
+            json_str = aggregated.to_string();
+        } else {
+            // Timings for a specific bucket.
+            auto& bucket = all_buckets[connection.getBucketIndex()];
+            json_str = bucket.subjson_operation_times.to_string();
+        }
+        append_stats(nullptr, 0, json_str.c_str(), json_str.size(),
+                     connection.getCookie());
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats phase-timings</code> command used to
+ * retrieve the per-phase command timings recorded by the 1-in-N
+ * command sampling (see PhaseSampler). One stat is emitted per
+ * (opcode, phase) pair which has recorded samples, keyed as
+ * "OPCODE:phase". The collection is process wide (it can't be
+ * attributed to a bucket as the sampler doesn't know the bucket while
+ * the request is being read), so the group requires admin privileges.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_phase_timings_executor(const std::string& arg,
+                                                     McbpConnection& connection) {
+    if (!arg.empty()) {
+        return ENGINE_EINVAL;
+    }
+
+    static const CommandPhase phases[] = {
+        CommandPhase::Read,
+        CommandPhase::Parse,
+        CommandPhase::Validate,
+        CommandPhase::Execute,
+        CommandPhase::Write
+    };
+
+    for (int ii = 0; ii < MAX_NUM_OPCODES; ++ii) {
+        const auto opcode = uint8_t(ii);
+        for (auto phase : phases) {
+            std::string json = phase_timings.generate(opcode, phase);
+            if (json.empty()) {
+                continue;
+            }
+
+            char name[48];
+            const char* text = memcached_opcode_2_text(opcode);
+            if (text != nullptr) {
+                checked_snprintf(name, sizeof(name), "%s:%s", text,
+                                 PhaseTimings::to_string(phase));
+            } else {
+                checked_snprintf(name, sizeof(name), "0x%02x:%s", opcode,
+                                 PhaseTimings::to_string(phase));
+            }
+            append_stats(name, uint16_t(strlen(name)),
+                         json.data(), uint32_t(json.size()),
+                         connection.getCookie());
+        }
+    }
+
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Handler for the <code>stats sasl-timings</code> command used to
+ * retrieve the latency histograms of the crypto part of the SASL
+ * authentications running on the executor pool. One stat is emitted
+ * per mechanism which has recorded samples, keyed by the mechanism
+ * name. The collection is process wide (authentication happens before
+ * the connection is associated with a bucket), so the group requires
+ * admin privileges.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_sasl_timings_executor(const std::string& arg,
+                                                    McbpConnection& connection) {
+    if (!arg.empty()) {
+        return ENGINE_EINVAL;
+    }
+
+    for (const auto& entry : sasl_auth_get_timings()) {
+        append_stats(entry.first.c_str(),
+                     uint16_t(entry.first.size()),
+                     entry.second.c_str(),
+                     uint32_t(entry.second.size()),
+                     connection.getCookie());
+    }
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Handler for the <code>stats cmd-timings</code> command used to
+ * retrieve the fine grained latency percentiles (p50/p90/p99/p99.9/max,
+ * in usec) recorded by the high dynamic range histograms. One stat is
+ * emitted per opcode which has recorded samples, keyed by the opcode
+ * name. The classic bucketed output remains available through
+ * CMD_GET_TIMINGS.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_cmd_timings_executor(const std::string& arg,
+                                                   McbpConnection& connection) {
+    if (!arg.empty()) {
+        return ENGINE_EINVAL;
+    }
+
+    const auto index = connection.getBucketIndex();
+    if (index == 0 && !cookie_is_admin(connection.getCookie())) {
+        // We're not connected to a bucket, and we didn't authenticate
+        // to a bucket.. don't leak the aggregated timings
+        return ENGINE_EACCESS;
+    }
+
+    auto& timings = all_buckets[index].timings;
+    for (int ii = 0; ii < MAX_NUM_OPCODES; ++ii) {
+        const auto opcode = uint8_t(ii);
+        std::string json = timings.generate_percentiles(opcode);
+        if (json.empty()) {
+            continue;
+        }
+
+        char name[32];
+        const char* text = memcached_opcode_2_text(opcode);
+        if (text != nullptr) {
+            checked_snprintf(name, sizeof(name), "%s", text);
+        } else {
+            checked_snprintf(name, sizeof(name), "0x%02x", opcode);
+        }
+        append_stats(name, uint16_t(strlen(name)),
+                     json.data(), uint32_t(json.size()),
+                     connection.getCookie());
+    }
 
+    return ENGINE_SUCCESS;
+}
 
 /**
- * Handler for the <code>stats bucket details</code> used to get information
- * of the buckets (type, state, #clients etc)
+ * Handler for the <code>stats class-timings</code> command used to
+ * retrieve the latency percentiles recorded per traffic lane: the
+ * transport ("plain" or "ssl") crossed with the event priority class
+ * (see the "priority" attribute of an interface). One stat is emitted
+ * per (lane, opcode) triple which has recorded samples, keyed as
+ * "transport:class:opcode". The histograms span all buckets - which
+ * is also why the group is privileged - so a loader saturating a low
+ * priority port can be told apart from the latency sensitive frontend
+ * traffic, and the SSL clients from the plaintext ones, without any
+ * per-bucket bookkeeping.
  *
  * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_bucket_details_executor(const std::string& arg,
-                                                      McbpConnection& connection) {
-    if (arg.empty()) {
-        process_bucket_details(&connection);
-        return ENGINE_SUCCESS;
-    } else {
+static ENGINE_ERROR_CODE stat_class_timings_executor(const std::string& arg,
+                                                     McbpConnection& connection) {
+    if (!arg.empty()) {
         return ENGINE_EINVAL;
     }
+
+    for (const auto& ssl : {false, true}) {
+        for (const auto& priority : {EventPriority::High,
+                                     EventPriority::Medium,
+                                     EventPriority::Low,
+                                     EventPriority::Default}) {
+            auto& timings = get_lane_timings(ssl, priority);
+            for (int ii = 0; ii < MAX_NUM_OPCODES; ++ii) {
+                const auto opcode = uint8_t(ii);
+                std::string json = timings.generate_percentiles(opcode);
+                if (json.empty()) {
+                    continue;
+                }
+
+                char name[48];
+                const char* text = memcached_opcode_2_text(opcode);
+                if (text != nullptr) {
+                    checked_snprintf(name, sizeof(name), "%s:%s:%s",
+                                     ssl ? "ssl" : "plain",
+                                     to_string(priority), text);
+                } else {
+                    checked_snprintf(name, sizeof(name), "%s:%s:0x%02x",
+                                     ssl ? "ssl" : "plain",
+                                     to_string(priority), opcode);
+                }
+                append_stats(name, uint16_t(strlen(name)),
+                             json.data(), uint32_t(json.size()),
+                             connection.getCookie());
+            }
+        }
+    }
+
+    return ENGINE_SUCCESS;
 }
 
 /**
- * Handler for the <code>stats aggregate</code>.. probably not used anymore
- * as it gives just a subset of what you'll get from an empty stat.
+ * Handler for the <code>stats experiments</code> group: the per-arm
+ * command timings of the configured A/B experiments (see
+ * experiments.h). For every experiment the sizes of the two
+ * populations are emitted ("name:treatment_conns" /
+ * "name:control_conns", connections assigned since startup) followed
+ * by the fine grained percentile JSON for every opcode either arm has
+ * samples for, keyed "name:arm:opcode" - so the p99 effect of a
+ * feature on its slice of real traffic can be read straight off one
+ * stats call. The histograms span all buckets, hence the group is
+ * privileged (like class-timings).
  *
  * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_aggregate_executor(const std::string& arg,
-                                                 McbpConnection& connection) {
-    if (arg.empty()) {
-        return server_stats(&append_stats, &connection);
-    } else {
+static ENGINE_ERROR_CODE stat_experiments_executor(const std::string& arg,
+                                                   McbpConnection& connection) {
+    if (!arg.empty()) {
         return ENGINE_EINVAL;
     }
+
+    for (size_t idx = 0; idx < experiments_count(); ++idx) {
+        const auto& name = experiment_name(idx);
+        char key[96];
+        char value[32];
+
+        for (const bool arm : {true, false}) {
+            checked_snprintf(key, sizeof(key), "%s:%s_conns", name.c_str(),
+                             arm ? "treatment" : "control");
+            checked_snprintf(value, sizeof(value), "%" PRIu64,
+                             experiment_arm_size(idx, arm));
+            append_stats(key, uint16_t(strlen(key)),
+                         value, uint32_t(strlen(value)),
+                         connection.getCookie());
+        }
+
+        for (const bool arm : {true, false}) {
+            auto& timings = experiment_timings(idx, arm);
+            for (int ii = 0; ii < MAX_NUM_OPCODES; ++ii) {
+                const auto opcode = uint8_t(ii);
+                std::string json = timings.generate_percentiles(opcode);
+                if (json.empty()) {
+                    continue;
+                }
+
+                const char* text = memcached_opcode_2_text(opcode);
+                if (text != nullptr) {
+                    checked_snprintf(key, sizeof(key), "%s:%s:%s",
+                                     name.c_str(),
+                                     arm ? "treatment" : "control", text);
+                } else {
+                    checked_snprintf(key, sizeof(key), "%s:%s:0x%02x",
+                                     name.c_str(),
+                                     arm ? "treatment" : "control", opcode);
+                }
+                append_stats(key, uint16_t(strlen(key)),
+                             json.data(), uint32_t(json.size()),
+                             connection.getCookie());
+            }
+        }
+    }
+
+    return ENGINE_SUCCESS;
 }
 
 /**
- * Handler for the <code>stats connection[ fd]</code> command to retrieve
- * information about connection specific details.
+ * Handler for the <code>stats rusage</code> command used to retrieve
+ * the per-opcode resource accounting for the connected bucket. For
+ * every opcode which has completed operations five stats are emitted
+ * (<code>opcode:count</code>, <code>opcode:bytes_in</code>,
+ * <code>opcode:bytes_out</code>, <code>opcode:engine_ns</code> and
+ * <code>opcode:daemon_ns</code>) allowing the resource usage to be
+ * attributed per (bucket, opcode) pair.
  *
- * @param arg an optional file descriptor representing the connection
- *            object to retrieve information about. If empty dump all.
+ * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_connections_executor(const std::string& arg,
-                                                   McbpConnection& connection) {
-    int64_t fd = -1;
-
+static ENGINE_ERROR_CODE stat_rusage_executor(const std::string& arg,
+                                              McbpConnection& connection) {
     if (!arg.empty()) {
-        try {
-            fd = std::stoll(arg);
-        } catch (...) {
-            return ENGINE_EINVAL;
+        return ENGINE_EINVAL;
+    }
+
+    const auto index = connection.getBucketIndex();
+    if (index == 0 && !cookie_is_admin(connection.getCookie())) {
+        // We're not connected to a bucket, and we didn't authenticate
+        // to a bucket.. don't leak the aggregated usage
+        return ENGINE_EACCESS;
+    }
+
+    auto& rusage = all_buckets[index].rusage;
+    for (int ii = 0; ii < MAX_NUM_OPCODES; ++ii) {
+        const auto opcode = uint8_t(ii);
+        const auto entry = rusage.rollup(opcode);
+        if (entry.count == 0) {
+            continue;
+        }
+
+        char opname[32];
+        const char* text = memcached_opcode_2_text(opcode);
+        if (text != nullptr) {
+            checked_snprintf(opname, sizeof(opname), "%s", text);
+        } else {
+            checked_snprintf(opname, sizeof(opname), "0x%02x", opcode);
+        }
+
+        const struct {
+            const char* suffix;
+            uint64_t value;
+        } fields[] = {
+            {"count", entry.count},
+            {"bytes_in", entry.bytes_in},
+            {"bytes_out", entry.bytes_out},
+            {"engine_ns", entry.engine_ns},
+            {"daemon_ns", entry.daemon_ns}
+        };
+
+        for (const auto& field : fields) {
+            char name[64];
+            char value[32];
+            checked_snprintf(name, sizeof(name), "%s:%s",
+                             opname, field.suffix);
+            checked_snprintf(value, sizeof(value), "%" PRIu64, field.value);
+            append_stats(name, uint16_t(strlen(name)),
+                         value, uint32_t(strlen(value)),
+                         connection.getCookie());
         }
     }
 
-    connection_stats(&append_stats, connection.getCookie(), fd);
     return ENGINE_SUCCESS;
 }
 
 /**
- * Handler for the <code>stats topkeys</code> command used to retrieve
- * the most popular keys in the attached bucket.
+ * Handler for the <code>stats worker</code> command used to retrieve
+ * the event-loop health counters for each worker thread (iteration
+ * latency, starvation and queue depths; see the loop_* members of
+ * LIBEVENT_THREAD). Keys are prefixed with the thread index.
  *
  * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_topkeys_executor(const std::string& arg,
-                                               McbpConnection& connection) {
-    if (arg.empty()) {
-        auto& bucket = all_buckets[connection.getBucketIndex()];
-        return bucket.topkeys->stats(connection.getCookie(),
-                                     mc_time_get_current_time(),
-                                     append_stats);
-    } else {
+static ENGINE_ERROR_CODE stat_worker_executor(const std::string& arg,
+                                              McbpConnection& connection) {
+    if (!arg.empty()) {
         return ENGINE_EINVAL;
     }
+
+    threads_worker_stats(append_stats, connection.getCookie());
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Append the four counters recorded for an allocation domain with the
+ * given key prefix ("<prefix>:allocated_bytes" etc).
+ */
+static void append_alloc_domain_stats(const char* prefix,
+                                      const AllocDomain::Counters& counters,
+                                      McbpConnection& connection) {
+    const struct {
+        const char* suffix;
+        uint64_t value;
+    } fields[] = {
+        {"allocated_bytes", counters.allocated},
+        {"freed_bytes", counters.freed},
+        {"malloc_count", counters.malloc_count},
+        {"free_count", counters.free_count}
+    };
+
+    for (const auto& field : fields) {
+        char name[160];
+        char value[32];
+        checked_snprintf(name, sizeof(name), "%s:%s", prefix, field.suffix);
+        checked_snprintf(value, sizeof(value), "%" PRIu64, field.value);
+        append_stats(name, uint16_t(strlen(name)),
+                     value, uint32_t(strlen(value)),
+                     connection.getCookie());
+    }
 }
 
 /**
- * Handler for the <code>stats topkeys</code> command used to retrieve
- * a JSON document containing the most popular keys in the attached bucket.
+ * Handler for the <code>stats memory</code> command used to retrieve
+ * the allocation-domain counters (see alloc_domain.h): how much memory
+ * has been allocated and released on behalf of the connection, engine,
+ * audit, SASL and logging subsystems, and for the Engine domain the
+ * per-bucket attribution. Administrators get the breakdown for every
+ * bucket; everyone else only for the bucket they're connected to.
  *
  * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_topkeys_json_executor(const std::string& arg,
-                                                    McbpConnection& connection) {
-    if (arg.empty()) {
-        ENGINE_ERROR_CODE ret;
+static ENGINE_ERROR_CODE stat_memory_executor(const std::string& arg,
+                                              McbpConnection& connection) {
+    if (!arg.empty()) {
+        return ENGINE_EINVAL;
+    }
 
-        cJSON* topkeys_doc = cJSON_CreateObject();
-        if (topkeys_doc == nullptr) {
-            ret = ENGINE_ENOMEM;
-        } else {
-            auto& bucket = all_buckets[connection.getBucketIndex()];
-            ret = bucket.topkeys->json_stats(topkeys_doc,
-                                             mc_time_get_current_time());
+    const AllocationDomain domains[] = {
+        AllocationDomain::Connection,
+        AllocationDomain::Engine,
+        AllocationDomain::Audit,
+        AllocationDomain::Sasl,
+        AllocationDomain::Logging
+    };
 
-            if (ret == ENGINE_SUCCESS) {
-                char key[] = "topkeys_json";
-                char* topkeys_str = cJSON_PrintUnformatted(topkeys_doc);
-                if (topkeys_str != nullptr) {
-                    append_stats(key, (uint16_t)strlen(key),
-                                 topkeys_str, (uint32_t)strlen(topkeys_str),
-                                 connection.getCookie());
-                    cJSON_Free(topkeys_str);
-                } else {
-                    ret = ENGINE_ENOMEM;
-                }
-            }
-            cJSON_Delete(topkeys_doc);
+    for (const auto domain : domains) {
+        append_alloc_domain_stats(to_string(domain),
+                                  AllocDomain::getCounters(domain),
+                                  connection);
+    }
+
+    const bool admin = cookie_is_admin(connection.getCookie());
+    const auto index = size_t(connection.getBucketIndex());
+
+    // Entry 0 is "no bucket"; engine calls made without a bucket
+    // association end up there but there is no name to report it under.
+    for (size_t ii = 1; ii < all_buckets.size(); ++ii) {
+        if (!admin && ii != index) {
+            continue;
+        }
+
+        Bucket& bucket = all_buckets[ii];
+        char prefix[MAX_BUCKET_NAME_LENGTH + 32];
+        cb_mutex_enter(&bucket.mutex);
+        const bool ready = (bucket.state == BucketState::Ready);
+        if (ready) {
+            checked_snprintf(prefix, sizeof(prefix), "bucket:%s:engine",
+                             bucket.name);
+        }
+        cb_mutex_exit(&bucket.mutex);
+
+        if (ready) {
+            append_alloc_domain_stats(prefix,
+                                      AllocDomain::getBucketCounters(ii),
+                                      connection);
         }
-        return ret;
-    } else {
-        return ENGINE_EINVAL;
     }
+
+    return ENGINE_SUCCESS;
 }
 
 /**
- * Handler for the <code>stats subdoc_execute</code> command used to retrieve
- * information from the subdoc subsystem.
+ * Handler for the <code>stats scheduler</code> command used to
+ * retrieve the worker-time shares achieved by each bucket under the
+ * fair scheduler (see scheduler_quantum_us): the nanoseconds of
+ * worker time spent driving the bucket's connections from the
+ * pending io queues, and the number of times the remainder of the
+ * bucket's queue was deferred because its quantum ran out.
+ * Administrators get every bucket; everyone else only the bucket
+ * they're connected to.
  *
  * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_subdoc_execute_executor(const std::string& arg,
-                                                      McbpConnection& connection) {
-    if (arg.empty()) {
-        const auto index = connection.getBucketIndex();
-        std::string json_str;
-        if (index == 0) {
-            // Aggregrated timings for all buckets.
-            TimingHistogram aggregated;
-            for (const auto& bucket : all_buckets) {
-                aggregated += bucket.subjson_operation_times;
+static ENGINE_ERROR_CODE stat_scheduler_executor(const std::string& arg,
+                                                 McbpConnection& connection) {
+    if (!arg.empty()) {
+        return ENGINE_EINVAL;
+    }
+
+    add_stat(connection.getCookie(), append_stats, "scheduler_quantum_us",
+             std::to_string(settings.getSchedulerQuantumUs()).c_str());
+
+    const bool admin = cookie_is_admin(connection.getCookie());
+    const auto index = size_t(connection.getBucketIndex());
+
+    for (size_t ii = 1; ii < all_buckets.size(); ++ii) {
+        if (!admin && ii != index) {
+            continue;
+        }
+
+        Bucket& bucket = all_buckets[ii];
+        char prefix[MAX_BUCKET_NAME_LENGTH + 32];
+        cb_mutex_enter(&bucket.mutex);
+        const bool ready = (bucket.state == BucketState::Ready);
+        if (ready) {
+            checked_snprintf(prefix, sizeof(prefix), "bucket:%s",
+                             bucket.name);
+        }
+        cb_mutex_exit(&bucket.mutex);
+
+        if (ready) {
+            const struct {
+                const char* suffix;
+                uint64_t value;
+            } fields[] = {
+                {"worker_ns", bucket.sched_ns.load()},
+                {"deferrals", bucket.sched_deferrals.load()}
+            };
+
+            for (const auto& field : fields) {
+                char name[160];
+                char value[32];
+                checked_snprintf(name, sizeof(name), "%s:%s",
+                                 prefix, field.suffix);
+                checked_snprintf(value, sizeof(value), "%" PRIu64,
+                                 field.value);
+                append_stats(name, uint16_t(strlen(name)),
+                             value, uint32_t(strlen(value)),
+                             connection.getCookie());
             }
-            json_str = aggregated.to_string();
-        } else {
-            // Timings for a specific bucket.
-            auto& bucket = all_buckets[connection.getBucketIndex()];
-            json_str = bucket.subjson_operation_times.to_string();
         }
-        append_stats(nullptr, 0, json_str.c_str(), json_str.size(),
-                     connection.getCookie());
-        return ENGINE_SUCCESS;
-    } else {
-        return ENGINE_EINVAL;
     }
-}
 
-static void stat_executor(McbpConnection* c, void*) {
-    struct stat_handler {
-        /**
-         * Is this a privileged stat or may it be requested by anyone
-         */
-        bool privileged;
-        /**
-         * The callback function to handle the stat request
-         */
-        ENGINE_ERROR_CODE (*handler)(const std::string &arg,
-                                     McbpConnection& connection);
-    };
+    return ENGINE_SUCCESS;
+}
 
+struct stat_handler {
     /**
-     * A mapping from all stat subgroups to the callback providing the
-     * statistics
+     * Is this a privileged stat or may it be requested by anyone
      */
-    static std::unordered_map<std::string, struct stat_handler> handlers = {
-        {"reset", {true, stat_reset_executor}},
-        {"settings", {false, stat_settings_executor}},
-        {"audit", {true, stat_audit_executor}},
-        {"bucket_details", {true, stat_bucket_details_executor}},
-        {"aggregate", {false, stat_aggregate_executor}},
-        {"connections", {false, stat_connections_executor}},
-        {"topkeys", {false, stat_topkeys_executor}},
-        {"topkeys_json", {false, stat_topkeys_json_executor}},
-        {"subdoc_execute", {false, stat_subdoc_execute_executor}}
-    };
+    bool privileged;
+    /**
+     * The callback function to handle the stat request
+     */
+    ENGINE_ERROR_CODE (*handler)(const std::string &arg,
+                                 McbpConnection& connection);
+};
+
+static ENGINE_ERROR_CODE stat_select_executor(const std::string& arg,
+                                              McbpConnection& connection);
+
+/**
+ * A mapping from all stat subgroups to the callback providing the
+ * statistics
+ */
+static const std::unordered_map<std::string, struct stat_handler> stat_handlers = {
+    {"reset", {true, stat_reset_executor}},
+    {"refresh", {false, stat_refresh_executor}},
+    {"settings", {false, stat_settings_executor}},
+    {"audit", {true, stat_audit_executor}},
+    {"bucket_details", {true, stat_bucket_details_executor}},
+    {"aggregate", {false, stat_aggregate_executor}},
+    {"connections", {false, stat_connections_executor}},
+    {"topkeys", {false, stat_topkeys_executor}},
+    {"topkeys_json", {false, stat_topkeys_json_executor}},
+    {"subdoc_execute", {false, stat_subdoc_execute_executor}},
+    {"cmd-timings", {false, stat_cmd_timings_executor}},
+    {"class-timings", {true, stat_class_timings_executor}},
+    {"phase-timings", {true, stat_phase_timings_executor}},
+    {"experiments", {true, stat_experiments_executor}},
+    {"sasl-timings", {true, stat_sasl_timings_executor}},
+    {"rusage", {false, stat_rusage_executor}},
+    {"worker", {false, stat_worker_executor}},
+    {"memory", {false, stat_memory_executor}},
+    {"scheduler", {false, stat_scheduler_executor}},
+    {"select", {false, stat_select_executor}}
+};
+
+/**
+ * Handler for the <code>stats select</code> group: render several stat
+ * groups in one request. The argument is a comma separated list of the
+ * groups to render, so a monitoring agent can fetch exactly the groups
+ * it needs in a single round trip instead of paying for the full
+ * default set or a request per group. Privileged groups require the
+ * Stats privilege just like a direct request; the action groups
+ * ("reset" and "refresh") cannot be selected.
+ */
+static ENGINE_ERROR_CODE stat_select_executor(const std::string& arg,
+                                              McbpConnection& connection) {
+    if (arg.empty()) {
+        return ENGINE_EINVAL;
+    }
+
+    std::string::size_type start = 0;
+    while (start <= arg.size()) {
+        auto end = arg.find(',', start);
+        if (end == std::string::npos) {
+            end = arg.size();
+        }
+        const std::string group = arg.substr(start, end - start);
+        start = end + 1;
+
+        if (group.empty() || group == "reset" || group == "refresh" ||
+            group == "select") {
+            return ENGINE_EINVAL;
+        }
+
+        auto iter = stat_handlers.find(group);
+        if (iter == stat_handlers.end()) {
+            return ENGINE_KEY_ENOENT;
+        }
+
+        if (iter->second.privileged) {
+            switch (connection.checkPrivilege(Privilege::Stats)) {
+            case PrivilegeAccess::Ok:
+                break;
+            case PrivilegeAccess::Fail:
+                return ENGINE_EACCESS;
+            case PrivilegeAccess::Stale:
+                return ENGINE_AUTH_STALE;
+            }
+        }
+
+        const auto ret = iter->second.handler(std::string(), connection);
+        if (ret != ENGINE_SUCCESS) {
+            return ret;
+        }
+    }
+
+    return ENGINE_SUCCESS;
+}
 
+static void stat_executor(McbpConnection* c, void*) {
     // The raw representing the key
     const std::string key(binary_get_key(c), c->binary_header.request.keylen);
 
@@ -3555,10 +4886,15 @@ static void stat_executor(McbpConnection* c, void*) {
     if (ret == ENGINE_SUCCESS) {
         if (key.empty()) {
             /* request all statistics */
-            ret = c->getBucketEngine()->get_stats(c->getBucketEngineAsV0(), c->getCookie(),
-                                                  nullptr, 0, append_stats);
-            if (ret == ENGINE_SUCCESS) {
-                ret = server_stats(&append_stats, c);
+            const auto max_age = rel_time_t(settings.getStatsSnapshotAge());
+            auto& snapshot = all_buckets[c->getBucketIndex()].stats_snapshot;
+
+            if (max_age > 0 &&
+                snapshot.copyTo(*c, mc_time_get_current_time(), max_age)) {
+                /* Served from the cached serialization */
+                ret = ENGINE_SUCCESS;
+            } else {
+                ret = render_all_stats(c);
             }
         } else {
             // Split the key into a command and argument.
@@ -3573,8 +4909,8 @@ static void stat_executor(McbpConnection* c, void*) {
                 argument = key.substr(++index);
             }
 
-            auto iter = handlers.find(command);
-            if (iter == handlers.end()) {
+            auto iter = stat_handlers.find(command);
+            if (iter == stat_handlers.end()) {
                 // This may be specific to the underlying engine
                 ret = c->getBucketEngine()->get_stats(c->getBucketEngineAsV0(),
                                                       c->getCookie(), key.c_str(),
@@ -3708,6 +5044,7 @@ static void process_hello_packet_executor(McbpConnection* c, void* packet) {
      */
     c->setSupportsDatatype(false);
     c->setSupportsMutationExtras(false);
+    c->setSupportsServerTimings(false);
 
     if (klen) {
         if (klen > 256) {
@@ -3755,6 +5092,29 @@ static void process_hello_packet_executor(McbpConnection* c, void* packet) {
                 added = true;
             }
             break;
+
+        case PROTOCOL_BINARY_FEATURE_PIPELINED_BOOTSTRAP:
+            /* Pure capability advertisement; the execution loop always
+             * drains pipelined bootstrap commands back to back (SASL
+             * authentications block the pipeline until complete, so
+             * ordering holds even though they run on the executor
+             * pool) and the responses are corked into a single
+             * flush. */
+            added = true;
+            break;
+
+        case PROTOCOL_BINARY_FEATURE_SERVER_TIMINGS:
+            if (!c->isSupportsServerTimings()) {
+                c->setSupportsServerTimings(true);
+                added = true;
+            }
+            break;
+
+        case PROTOCOL_BINARY_FEATURE_OP_DEADLINE:
+            /* Pure capability advertisement; the deadline itself is
+             * set (and cleared) with SET_OP_DEADLINE. */
+            added = true;
+            break;
         }
 
         if (added) {
@@ -3817,7 +5177,21 @@ static void sasl_list_mech_executor(McbpConnection* c, void*) {
                                nullptr);
 
     if (ret == CBSASL_OK) {
-        mcbp_write_response(c, (char*)result_string, 0, 0, string_length);
+        /* Stage the (small) mechanism list in the write buffer right
+         * behind the response header slot so the response can be
+         * corked; cbsasl owns result_string and a corked reference to
+         * it would outlive this command. The list is pipelined in
+         * front of SASL_AUTH by bootstrapping clients. */
+        char* ofs = c->getResponseHeaderSlot() +
+                    sizeof(protocol_binary_response_header);
+        if (string_length < c->write.size - c->write.bytes -
+                            sizeof(protocol_binary_response_header)) {
+            memcpy(ofs, result_string, string_length);
+            mcbp_write_response(c, ofs, 0, 0, string_length);
+        } else {
+            mcbp_write_response(c, (char*)result_string, 0, 0,
+                                string_length);
+        }
     } else  {
         /* Perhaps there's a better error for this... */
         LOG_WARNING(c, "%u: Failed to list SASL mechanisms: %s", c->getId(),
@@ -3840,6 +5214,16 @@ static void sasl_auth_executor(McbpConnection* c, void* packet) {
     LOG_DEBUG(c, "%u: SASL auth with mech: '%s' with %d bytes of data",
               c->getId(), mechanism.c_str(), vlen);
 
+    if (!sasl_auth_try_acquire_slot()) {
+        /* Too many authentications already running on the executor
+         * pool; ask the client to back off and retry rather than
+         * letting an auth storm starve the other tasks there. */
+        LOG_DEBUG(c, "%u: SASL auth rejected: too many authentications "
+                  "in flight", c->getId());
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ETMPFAIL);
+        return;
+    }
+
     std::shared_ptr<Task> task;
 
     if (c->getCmd() == PROTOCOL_BINARY_CMD_SASL_AUTH) {
@@ -3847,12 +5231,69 @@ static void sasl_auth_executor(McbpConnection* c, void* packet) {
     } else {
         task = std::make_shared<StepSaslAuthTask>(c->getCookieObject(), *c, mechanism, challenge);
     }
-    c->setCommandContext(new SaslCommandContext(task));
-
-    c->setEwouldblock(true);
-    c->setState(conn_sasl_auth);
-    std::lock_guard<std::mutex> guard(task->getMutex());
-    executorPool->schedule(task, true);
+    c->setCommandContext(new SaslCommandContext(task));
+
+    c->setEwouldblock(true);
+    c->setState(conn_sasl_auth);
+    std::lock_guard<std::mutex> guard(task->getMutex());
+    executorPool->schedule(task, true);
+}
+
+static void get_session_token_executor(McbpConnection* c, void*) {
+    const std::string token = session_resume_make_token(c);
+    if (token.empty()) {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_AUTH_ERROR);
+        return;
+    }
+
+    if (mcbp_response_handler(NULL, 0, NULL, 0, token.data(),
+                              uint32_t(token.size()),
+                              PROTOCOL_BINARY_RAW_BYTES,
+                              PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                              0, c->getCookie())) {
+        mcbp_write_and_free(c, &c->getDynamicBuffer());
+    } else {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+    }
+}
+
+static void resume_session_executor(McbpConnection* c, void* packet) {
+    auto* req = reinterpret_cast<protocol_binary_request_no_extras*>(packet);
+    const char* token = reinterpret_cast<const char*>(req->bytes) +
+                        sizeof(req->message.header);
+    const size_t len = ntohl(req->message.header.request.bodylen);
+
+    const auto status = session_resume_apply_token(c, token, len);
+    if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        LOG_INFO(c, "%u: Client %s resumed session as %s",
+                 c->getId(), c->getPeername().c_str(), c->getUsername());
+        mcbp_write_response(c, NULL, 0, 0, 0);
+    } else {
+        mcbp_write_packet(c, status);
+    }
+}
+
+static void seal_session_token_executor(McbpConnection* c, void* packet) {
+    auto* req = reinterpret_cast<protocol_binary_request_no_extras*>(packet);
+    const char* state = reinterpret_cast<const char*>(req->bytes) +
+                        sizeof(req->message.header);
+    const size_t len = ntohl(req->message.header.request.bodylen);
+
+    const std::string token = session_resume_seal_state(state, len);
+    if (token.empty()) {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
+        return;
+    }
+
+    if (mcbp_response_handler(NULL, 0, NULL, 0, token.data(),
+                              uint32_t(token.size()),
+                              PROTOCOL_BINARY_RAW_BYTES,
+                              PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                              0, c->getCookie())) {
+        mcbp_write_and_free(c, &c->getDynamicBuffer());
+    } else {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+    }
 }
 
 static void noop_executor(McbpConnection* c, void*) {
@@ -3924,7 +5365,8 @@ static void delete_executor(McbpConnection* c, void*) {
         if (c->isSupportsMutationExtras()) {
             /* Response includes vbucket UUID and sequence number */
             mutation_descr_t* const extras = (mutation_descr_t*)
-                (c->write.buf + sizeof(protocol_binary_response_delete));
+                (c->getResponseHeaderSlot() +
+                 sizeof(protocol_binary_response_delete));
 
             extras->vbucket_uuid = htonll(mut_info.vbucket_uuid);
             extras->seqno = htonll(mut_info.seqno);
@@ -3956,6 +5398,296 @@ static void delete_executor(McbpConnection* c, void*) {
     }
 }
 
+/* Refuse absurd batches before allocating anything for them */
+static const size_t DELETE_MULTI_MAX_KEYS = 4096;
+
+static void delete_multi_executor(McbpConnection* c, void* packet) {
+    auto* req = reinterpret_cast<protocol_binary_request_no_extras*>(packet);
+    const uint8_t* body = req->bytes + sizeof(req->message.header);
+    size_t remaining = ntohl(req->message.header.request.bodylen);
+
+    if (c->getBucketEngine()->remove_multi == nullptr) {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED);
+        return;
+    }
+
+    /* Unpack the [keylen][key] sequence; the entries reference the
+     * key bytes in the read buffer in place. */
+    std::vector<item_remove_entry> entries;
+    while (remaining > 0) {
+        uint16_t klen;
+        if (remaining < sizeof(klen)) {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
+            return;
+        }
+        memcpy(&klen, body, sizeof(klen));
+        klen = ntohs(klen);
+        body += sizeof(klen);
+        remaining -= sizeof(klen);
+        if (klen == 0 || klen > KEY_MAX_LENGTH || klen > remaining ||
+            entries.size() >= DELETE_MULTI_MAX_KEYS) {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
+            return;
+        }
+        item_remove_entry entry;
+        entry.key = body;
+        entry.nkey = klen;
+        entry.cas = 0;
+        entry.status = ENGINE_SUCCESS;
+        try {
+            entries.push_back(entry);
+        } catch (const std::bad_alloc&) {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+            return;
+        }
+        body += klen;
+        remaining -= klen;
+    }
+
+    const auto ret = c->getBucketEngine()->remove_multi(
+            c->getBucketEngineAsV0(), c->getCookie(), entries.data(),
+            entries.size(), c->binary_header.request.vbucket);
+    if (ret != ENGINE_SUCCESS) {
+        mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+        return;
+    }
+
+    uint32_t deleted = 0;
+    for (auto& entry : entries) {
+        if (entry.status == ENGINE_SUCCESS) {
+            ++deleted;
+            SLAB_INCR(c, delete_hits, entry.key, entry.nkey);
+        } else {
+            STATS_INCR(c, delete_misses, entry.key, entry.nkey);
+        }
+    }
+
+    deleted = htonl(deleted);
+    if (mcbp_response_handler(NULL, 0, NULL, 0, &deleted, sizeof(deleted),
+                              PROTOCOL_BINARY_RAW_BYTES,
+                              PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                              0, c->getCookie())) {
+        mcbp_write_and_free(c, &c->getDynamicBuffer());
+    } else {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+    }
+}
+
+static const size_t EXIST_MULTI_MAX_KEYS = 4096;
+
+static void exist_multi_executor(McbpConnection* c, void* packet) {
+    auto* req = reinterpret_cast<protocol_binary_request_no_extras*>(packet);
+    const uint8_t* body = req->bytes + sizeof(req->message.header);
+    size_t remaining = ntohl(req->message.header.request.bodylen);
+
+    /* Unpack the [keylen][key] sequence; the entries reference the
+     * key bytes in the read buffer in place. */
+    std::vector<item_exist_entry> entries;
+    while (remaining > 0) {
+        uint16_t klen;
+        if (remaining < sizeof(klen)) {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
+            return;
+        }
+        memcpy(&klen, body, sizeof(klen));
+        klen = ntohs(klen);
+        body += sizeof(klen);
+        remaining -= sizeof(klen);
+        if (klen == 0 || klen > KEY_MAX_LENGTH || klen > remaining ||
+            entries.size() >= EXIST_MULTI_MAX_KEYS) {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
+            return;
+        }
+        item_exist_entry entry;
+        entry.key = body;
+        entry.nkey = klen;
+        entry.cas = 0;
+        entry.status = ENGINE_KEY_ENOENT;
+        try {
+            entries.push_back(entry);
+        } catch (const std::bad_alloc&) {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+            return;
+        }
+        body += klen;
+        remaining -= klen;
+    }
+
+    if (c->getBucketEngine()->exists_multi != nullptr) {
+        const auto ret = c->getBucketEngine()->exists_multi(
+                c->getBucketEngineAsV0(), c->getCookie(), entries.data(),
+                entries.size(), c->binary_header.request.vbucket);
+        if (ret != ENGINE_SUCCESS) {
+            mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+            return;
+        }
+    } else {
+        /* The engine has no batched probe; fall back to a get/release
+         * per key. The values are materialized and thrown away, but
+         * the batch still collapses into a single response. */
+        for (auto& entry : entries) {
+            item* it = nullptr;
+            const auto ret = bucket_get(c, &it, entry.key, int(entry.nkey),
+                                        c->binary_header.request.vbucket);
+            if (ret == ENGINE_SUCCESS) {
+                item_info info;
+                info.nvalue = 1;
+                if (bucket_get_item_info(c, it, &info)) {
+                    entry.cas = info.cas;
+                    entry.status = ENGINE_SUCCESS;
+                }
+                bucket_release_item(c, it);
+            } else if (ret == ENGINE_EWOULDBLOCK) {
+                /* The command is re-driven from scratch once the
+                 * engine is ready; the probe is read only, so redoing
+                 * the earlier entries is harmless */
+                c->setEwouldblock(true);
+                return;
+            } else if (ret != ENGINE_KEY_ENOENT) {
+                mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+                return;
+            }
+        }
+    }
+
+    /* Nine bytes per key, in request order: hit flag + CAS */
+    std::vector<uint8_t> payload;
+    try {
+        payload.reserve(entries.size() * 9);
+        for (const auto& entry : entries) {
+            const uint64_t cas = htonll(entry.cas);
+            const auto* p = reinterpret_cast<const uint8_t*>(&cas);
+            payload.push_back(entry.status == ENGINE_SUCCESS ? 1 : 0);
+            payload.insert(payload.end(), p, p + sizeof(cas));
+        }
+    } catch (const std::bad_alloc&) {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+        return;
+    }
+
+    if (mcbp_response_handler(NULL, 0, NULL, 0, payload.data(),
+                              uint32_t(payload.size()),
+                              PROTOCOL_BINARY_RAW_BYTES,
+                              PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                              0, c->getCookie())) {
+        mcbp_write_and_free(c, &c->getDynamicBuffer());
+    } else {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+    }
+}
+
+static void get_range_executor(McbpConnection* c, void* packet) {
+    auto* req = reinterpret_cast<protocol_binary_request_get_range*>(packet);
+    const char* key = reinterpret_cast<const char*>(req->bytes) +
+                      sizeof(req->message.header) +
+                      sizeof(req->message.body);
+    const size_t nkey = ntohs(req->message.header.request.keylen);
+    const uint32_t offset = ntohl(req->message.body.offset);
+    uint32_t length = ntohl(req->message.body.length);
+
+    item* it = nullptr;
+    auto ret = c->getAiostat();
+    c->setAiostat(ENGINE_SUCCESS);
+    if (ret == ENGINE_SUCCESS) {
+        ret = bucket_get(c, &it, key, int(nkey),
+                         c->binary_header.request.vbucket);
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS: {
+        STATS_HIT(c, get, key, nkey);
+
+        item_info_holder info;
+        info.info.clsid = 0;
+        info.info.nvalue = IOV_MAX;
+        if (!bucket_get_item_info(c, it, &info.info)) {
+            bucket_release_item(c, it);
+            LOG_WARNING(c, "%u: Failed to get item info", c->getId());
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+            break;
+        }
+
+        if (mcbp::datatype::is_compressed(info.info.datatype)) {
+            /* A byte range of a Snappy stream is useless to the
+             * client, and inflating just to throw most of the value
+             * away defeats the point of the command. */
+            bucket_release_item(c, it);
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED);
+            break;
+        }
+
+        if (offset >= info.info.nbytes) {
+            bucket_release_item(c, it);
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ERANGE);
+            break;
+        }
+        if (length == 0 || length > info.info.nbytes - offset) {
+            length = info.info.nbytes - offset;
+        }
+
+        auto* rsp = reinterpret_cast<protocol_binary_response_get*>(
+                c->getResponseHeaderSlot());
+        if (mcbp_add_header(c, 0, sizeof(rsp->message.body), 0,
+                            sizeof(rsp->message.body) + length,
+                            PROTOCOL_BINARY_RAW_BYTES) == -1) {
+            bucket_release_item(c, it);
+            c->setState(conn_closing);
+            return;
+        }
+        rsp->message.header.response.cas = htonll(info.info.cas);
+
+        /* add the flags (staged right behind the header) */
+        rsp->message.body.flags = info.info.flags;
+        c->addIov(&rsp->message.body, sizeof(rsp->message.body));
+        c->write.curr += sizeof(rsp->message.body);
+        c->write.bytes += sizeof(rsp->message.body);
+
+        /* Point the iovecs straight into the item's value, skipping
+           ahead to the requested byte range. The item reference below
+           keeps the memory alive until conn_mwrite has drained. */
+        uint32_t skip = offset;
+        uint32_t todo = length;
+        for (int ii = 0; ii < info.info.nvalue && todo > 0; ++ii) {
+            auto* base = static_cast<char*>(info.info.value[ii].iov_base);
+            size_t len = info.info.value[ii].iov_len;
+            if (skip >= len) {
+                skip -= uint32_t(len);
+                continue;
+            }
+            base += skip;
+            len -= skip;
+            skip = 0;
+            if (len > todo) {
+                len = todo;
+            }
+            c->addIov(base, len);
+            todo -= uint32_t(len);
+        }
+        get_thread_stats(c)->bytes_sent_zerocopy += length;
+
+        /* Everything referenced by the iovecs stays valid until
+           transmit time, so the response may be corked. */
+        c->setCorkableResponse(true);
+        c->setState(conn_mwrite);
+        c->setItem(it);
+        update_topkeys(key, nkey, c);
+        break;
+    }
+    case ENGINE_KEY_ENOENT:
+        STATS_MISS(c, get, key, nkey);
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->setEwouldblock(true);
+        break;
+    case ENGINE_DISCONNECT:
+        c->setState(conn_closing);
+        break;
+    default:
+        mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+    }
+}
+
 static void arithmetic_executor(McbpConnection* c, void* packet) {
     auto* req = reinterpret_cast<protocol_binary_request_incr*>(binary_get_request(
         c));
@@ -4050,8 +5782,10 @@ static void arithmetic_executor(McbpConnection* c, void* packet) {
         }
         c->setCAS(info.cas);
 
-        char* body_buf =
-            (c->write.buf + sizeof(protocol_binary_response_incr));
+        /* The body is staged in the write buffer right behind the
+         * response header (mcbp_write_response accounts for it). */
+        char* body_buf = (c->getResponseHeaderSlot() +
+                          sizeof(protocol_binary_response_header));
         if (c->isSupportsMutationExtras()) {
             /* Response includes vbucket UUID and sequence number (in addition
              * to value) */
@@ -4131,16 +5865,34 @@ static void arithmetic_executor(McbpConnection* c, void* packet) {
 static void get_cmd_timer_executor(McbpConnection* c, void* packet) {
     std::string str;
     auto* req = reinterpret_cast<protocol_binary_request_get_cmd_timer*>(packet);
-    const char* key = (const char*)(req->bytes + sizeof(req->bytes));
+    const auto extlen = req->message.header.request.extlen;
+    const char* key = (const char*)(req->bytes +
+                                    sizeof(req->message.header.bytes) +
+                                    extlen);
     size_t keylen = ntohs(req->message.header.request.keylen);
     int index = c->getBucketIndex();
     std::string bucket(key, keylen);
 
+    /* The optional second extras byte selects delta mode: return only
+     * the samples recorded since this connection's previous delta
+     * request for the opcode (the first delta request returns the
+     * full histogram). Used by "mctimings --watch" to poll without
+     * re-transferring the whole histogram every time. */
+    const bool delta = (extlen == 2) &&
+            (req->bytes[sizeof(req->message.header.bytes) + 1] == 1);
+
     if (bucket == "/all/") {
         index = 0;
         keylen = 0;
     }
 
+    if (delta && keylen != 0) {
+        /* The cursor tracks a single histogram per opcode; it can't
+         * follow arbitrary by-name bucket lookups as well */
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
+        return;
+    }
+
     if (keylen == 0) {
         if (index == 0 && !cookie_is_admin(c->getCookie())) {
             // We're not connected to a bucket, and we didn't
@@ -4149,7 +5901,19 @@ static void get_cmd_timer_executor(McbpConnection* c, void* packet) {
             mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EACCESS);
             return;
         }
-        str = all_buckets[index].timings.generate(req->message.body.opcode);
+        if (delta) {
+            const auto opcode = req->message.body.opcode;
+            auto current = all_buckets[index].timings.get_timing_histogram(
+                opcode);
+            auto& cursor = c->getTimingsCursor(opcode);
+            TimingHistogram diff(current);
+            diff -= cursor;
+            cursor = current;
+            str = diff.to_string();
+        } else {
+            str = all_buckets[index].timings.generate(
+                req->message.body.opcode);
+        }
         mcbp_response_handler(NULL, 0, NULL, 0, str.data(),
                               uint32_t(str.length()),
                               PROTOCOL_BINARY_RAW_BYTES,
@@ -4679,6 +6443,14 @@ std::array<mcbp_package_execute, 0x100>& get_mcbp_executors(void) {
     executors[PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP] = subdoc_multi_lookup_executor;
     executors[PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION] = subdoc_multi_mutation_executor;
     executors[PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT] = subdoc_get_count_executor;
+    executors[PROTOCOL_BINARY_CMD_GET_SESSION_TOKEN] = get_session_token_executor;
+    executors[PROTOCOL_BINARY_CMD_RESUME_SESSION] = resume_session_executor;
+    executors[PROTOCOL_BINARY_CMD_DELETE_MULTI] = delete_multi_executor;
+    executors[PROTOCOL_BINARY_CMD_EXIST_MULTI] = exist_multi_executor;
+    executors[PROTOCOL_BINARY_CMD_GET_RANGE] = get_range_executor;
+    executors[PROTOCOL_BINARY_CMD_SET_RANGE] = set_range_executor;
+    executors[PROTOCOL_BINARY_CMD_SET_OP_DEADLINE] = set_op_deadline_executor;
+    executors[PROTOCOL_BINARY_CMD_SEAL_SESSION_TOKEN] = seal_session_token_executor;
 
     executors[PROTOCOL_BINARY_CMD_CREATE_BUCKET] = create_bucket_executor;
     executors[PROTOCOL_BINARY_CMD_LIST_BUCKETS] = list_bucket_executor;
@@ -4774,6 +6546,12 @@ static bool invalid_datatype(McbpConnection* c) {
 }
 
 static protocol_binary_response_status validate_bin_header(McbpConnection* c) {
+    if (c->isCurrentHeaderPrevalidated()) {
+        /* already checked by mcbp_prescan_headers when the header was
+         * parsed */
+        return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+    }
+
     if (c->binary_header.request.bodylen >=
         (c->binary_header.request.keylen + c->binary_header.request.extlen)) {
         return PROTOCOL_BINARY_RESPONSE_SUCCESS;
@@ -4782,17 +6560,265 @@ static protocol_binary_response_status validate_bin_header(McbpConnection* c) {
     }
 }
 
+/**
+ * Handle a request packet which failed validation: log it, submit an
+ * audit event and send the error back before disconnecting the
+ * client. Shared by the generic and the fused dispatch entries below.
+ */
+static void handle_invalid_packet(McbpConnection* c,
+                                  protocol_binary_command opcode,
+                                  protocol_binary_response_status result) {
+    LOG_WARNING(c,
+                "%u: Invalid format for specified for %s - %d - "
+                "closing connection",
+                c->getId(), memcached_opcode_2_text(opcode), result);
+    audit_invalid_packet(c);
+    mcbp_write_packet(c, result);
+    c->setWriteAndGo(conn_closing);
+}
+
+/**
+ * The generic entry in the fused dispatch table: check the header,
+ * run the bucket's validator chain and forward to the executor (or
+ * the unknown command handler) - the walk every packet used to take.
+ */
+static void mcbp_validate_and_execute(McbpConnection* c, void* packet) {
+    const auto opcode = static_cast<protocol_binary_command>(
+        c->binary_header.request.opcode);
+
+    auto result = validate_bin_header(c);
+    if (result == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        result = c->validateCommand(opcode);
+    }
+
+    if (result != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        handle_invalid_packet(c, opcode, result);
+        return;
+    }
+
+    {
+        auto& sampler = c->getPhaseSampler();
+        if (sampler.isSampled()) {
+            sampler.mark(opcode, CommandPhase::Validate);
+        }
+    }
+
+    auto executor = executors[opcode];
+    if (executor != NULL) {
+        executor(c, packet);
+    } else {
+        process_bin_unknown_packet(c);
+    }
+}
+
+/**
+ * A fused validate+execute handler, specialized at compile time on
+ * the fixed header shape of its opcode:
+ *
+ *   Extlen             the exact number of extras bytes
+ *   AllowValue         may the request carry a value after the key?
+ *   CasMustBeZero      does the validator reject a non-zero cas?
+ *   RequireRawDatatype must datatype be PROTOCOL_BINARY_RAW_BYTES?
+ *
+ * (All of the specialized opcodes require a key, and the magic has
+ * already been checked by try_read_mcbp_command.) As the shape is
+ * given by template constants the validation collapses into a few
+ * compares against the already byteswapped header and the executor
+ * call is direct - one call through the table instead of the header
+ * check, the validator chain walk and the executor table lookup.
+ *
+ * Buckets may register additional validators (e.g. for collections);
+ * the inlined checks aren't sufficient then, so the handler falls
+ * back to the generic entry above.
+ */
+template <uint8_t Extlen,
+          bool AllowValue,
+          bool CasMustBeZero,
+          bool RequireRawDatatype,
+          mcbp_package_execute Execute>
+static void mcbp_fused_validate_execute(McbpConnection* c, void* packet) {
+    const auto opcode = static_cast<protocol_binary_command>(
+        c->binary_header.request.opcode);
+
+    if (Bucket::mcbpCommandHasExtraValidators(c, opcode)) {
+        mcbp_validate_and_execute(c, packet);
+        return;
+    }
+
+    const auto& header = c->binary_header.request;
+    const uint32_t minBody = uint32_t(header.keylen) + Extlen;
+    bool valid = header.extlen == Extlen && header.keylen != 0 &&
+                 (AllowValue ? header.bodylen >= minBody
+                             : header.bodylen == minBody);
+    if (CasMustBeZero && header.cas != 0) {
+        valid = false;
+    }
+    if (RequireRawDatatype &&
+        header.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        valid = false;
+    }
+
+    if (!valid) {
+        handle_invalid_packet(c, opcode, PROTOCOL_BINARY_RESPONSE_EINVAL);
+        return;
+    }
+
+    {
+        auto& sampler = c->getPhaseSampler();
+        if (sampler.isSampled()) {
+            sampler.mark(opcode, CommandPhase::Validate);
+        }
+    }
+
+    Execute(c, packet);
+}
+
+/**
+ * Build the fused dispatch table. Every opcode gets the generic
+ * validate-then-execute entry except for the hottest data commands,
+ * which get handlers specialized on their header shape (matching
+ * get_validator, delete_validator, set_replace_validator and
+ * add_validator in mcbp_validators.cc).
+ */
+static std::array<mcbp_package_execute, 0x100>& get_mcbp_fused_executors(void) {
+    static std::array<mcbp_package_execute, 0x100> fused;
+    std::fill(fused.begin(), fused.end(), mcbp_validate_and_execute);
+
+    fused[PROTOCOL_BINARY_CMD_GET] =
+        mcbp_fused_validate_execute<0, false, true, true, get_executor>;
+    fused[PROTOCOL_BINARY_CMD_GETQ] =
+        mcbp_fused_validate_execute<0, false, true, true, get_executor>;
+    fused[PROTOCOL_BINARY_CMD_GETK] =
+        mcbp_fused_validate_execute<0, false, true, true, get_executor>;
+    fused[PROTOCOL_BINARY_CMD_GETKQ] =
+        mcbp_fused_validate_execute<0, false, true, true, get_executor>;
+    fused[PROTOCOL_BINARY_CMD_DELETE] =
+        mcbp_fused_validate_execute<0, false, false, true, delete_executor>;
+    fused[PROTOCOL_BINARY_CMD_DELETEQ] =
+        mcbp_fused_validate_execute<0, false, false, true, delete_executor>;
+    fused[PROTOCOL_BINARY_CMD_SET] =
+        mcbp_fused_validate_execute<8, true, false, false, set_executor>;
+    fused[PROTOCOL_BINARY_CMD_SETQ] =
+        mcbp_fused_validate_execute<8, true, false, false, setq_executor>;
+    fused[PROTOCOL_BINARY_CMD_REPLACE] =
+        mcbp_fused_validate_execute<8, true, false, false, replace_executor>;
+    fused[PROTOCOL_BINARY_CMD_REPLACEQ] =
+        mcbp_fused_validate_execute<8, true, false, false, replaceq_executor>;
+    fused[PROTOCOL_BINARY_CMD_ADD] =
+        mcbp_fused_validate_execute<8, true, true, false, add_executor>;
+    fused[PROTOCOL_BINARY_CMD_ADDQ] =
+        mcbp_fused_validate_execute<8, true, true, false, addq_executor>;
+
+    return fused;
+}
+
+static std::array<mcbp_package_execute, 0x100>& fused_executors =
+    get_mcbp_fused_executors();
+
+/**
+ * The per-packet dispatch state replicated per NUMA node (see
+ * numa_replicas.h): the fused validate+execute table and the
+ * privilege chains are consulted for every request packet, the
+ * response handler table for every response on a TAP/DCP ack stream.
+ * All three are write-once - the constructor copies (or rebuilds)
+ * them after initialize_mbcp_lookup_map() has run, and
+ * mcbp_publish_numa_replicas() builds the per-node copies before the
+ * listening sockets open. The request_handlers table stays shared;
+ * engines may register unknown-command handlers at runtime through
+ * setup_mcbp_lookup_cmd().
+ */
+struct McbpDispatchTables {
+    McbpDispatchTables()
+        : fused(fused_executors),
+          responses(response_handlers) {
+    }
+
+    std::array<mcbp_package_execute, 0x100> fused;
+    std::array<RESPONSE_HANDLER, 0x100> responses;
+    McbpPrivilegeChains privileges;
+};
+
+static NumaReplicated<McbpDispatchTables> dispatch_tables;
+
+void mcbp_publish_numa_replicas(void) {
+    dispatch_tables.publish();
+}
+
 static void process_bin_packet(McbpConnection* c) {
-    static McbpPrivilegeChains privilegeChains;
-    protocol_binary_response_status result;
+    McbpDispatchTables& tables = dispatch_tables.get();
 
     char* packet = (c->read.curr - (c->binary_header.request.bodylen +
                                     sizeof(c->binary_header)));
 
     auto opcode = static_cast<protocol_binary_command>(c->binary_header.request.opcode);
-    auto executor = executors[opcode];
+    auto& cookie = c->getCookieObject();
+
+    // Feed the load heuristic used to even out the connections over
+    // the worker threads (see maybe_migrate_connection)
+    c->getThread()->ops++;
+
+    if (cookie.hasContinuation()) {
+        /* The engine completed this command asynchronously and we're
+         * being re-driven from notify_io_complete. The packet was
+         * checked for access and validated before the command was
+         * handed to the engine (and the input buffer can't have moved
+         * while the connection was suspended), so jump straight back
+         * into the executor which picks up the result from the aiostat
+         * and builds the response. */
+        auto resume = cookie.getContinuation();
+        void* resumePacket = cookie.getContinuationPacket();
+        cookie.clearContinuation();
+        const uint64_t deadline = c->getOpDeadline();
+        if (deadline != 0 &&
+            uint64_t(gethrtime() - c->getStart()) > deadline) {
+            /* The command spent its deadline blocked in the engine;
+             * the client has given up on the result by now, so throw
+             * away the engine's status instead of building (and
+             * shipping) a response nobody reads. */
+            stats.deadline_drops++;
+            c->setAiostat(ENGINE_SUCCESS);
+            c->setEwouldblock(false);
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_DEADLINE_EXCEEDED);
+            return;
+        }
+        resume(c, resumePacket);
+        if (c->isEwouldblock() && c->getState() == conn_nread) {
+            cookie.setContinuation(resume, resumePacket);
+        }
+        return;
+    }
+
+    /* Opcode acceptance filters: a bucket (or a listening interface)
+     * with a restricted protocol surface rejects disallowed commands
+     * here, before any validator or privilege chain work is done. The
+     * common (unrestricted) case is a load and a perfectly predicted
+     * branch per filter. */
+    {
+        auto& bucket = all_buckets[c->getBucketIndex()];
+        const auto* iface = c->getInterfaceOpcodeFilter();
+        if (!bucket.opcode_filter.isAllowed(opcode) ||
+            (iface != nullptr && !iface->isAllowed(opcode))) {
+            bucket.rejected_ops++;
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED);
+            return;
+        }
+    }
+
+    /* Command deadline (see SET_OP_DEADLINE): a command which is
+     * already older than the deadline the client put on it (it sat in
+     * the input stream behind slow pipelined work) is dropped before
+     * we spend validator, privilege and engine cycles on it. */
+    {
+        const uint64_t deadline = c->getOpDeadline();
+        if (deadline != 0 &&
+            uint64_t(gethrtime() - c->getStart()) > deadline) {
+            stats.deadline_drops++;
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_DEADLINE_EXCEEDED);
+            return;
+        }
+    }
 
-    auto res = privilegeChains.invoke(opcode, c->getCookieObject());
+    auto res = tables.privileges.invoke(opcode, cookie);
     switch (res) {
     case PrivilegeAccess::Fail:
         LOG_WARNING(c,
@@ -4802,29 +6828,22 @@ static void process_bin_packet(McbpConnection* c) {
         audit_command_access_failed(c);
         mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EACCESS);
         return;
-    case PrivilegeAccess::Ok:
-        result = validate_bin_header(c);
-        if (result == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
-            result = c->validateCommand(opcode);
-        }
-
-        if (result != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
-            LOG_WARNING(c,
-                        "%u: Invalid format for specified for %s - %d - "
-                        "closing connection",
-                        c->getId(), memcached_opcode_2_text(opcode), result);
-            audit_invalid_packet(c);
-            mcbp_write_packet(c, result);
-            c->setWriteAndGo(conn_closing);
-            return;
-        }
-
-        if (executor != NULL) {
-            executor(c, packet);
-        } else {
-            process_bin_unknown_packet(c);
+    case PrivilegeAccess::Ok: {
+        auto handler = tables.fused[opcode];
+        handler(c, packet);
+        if (c->isEwouldblock() && c->getState() == conn_nread) {
+            /* The command was suspended from within the executor and
+             * will be re-driven through this function once the engine
+             * notifies us. Remember where to resume so that we don't
+             * have to redo the work above (re-running the cheap fused
+             * validation is harmless). Executors which block into
+             * a dedicated connection state (sasl auth, bucket
+             * management etc) are resumed by that state and shall not
+             * get a continuation. */
+            cookie.setContinuation(handler, packet);
         }
         return;
+    }
     case PrivilegeAccess::Stale:
         mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_AUTH_STALE);
         return;
@@ -4881,12 +6900,25 @@ static void dispatch_bin_command(McbpConnection* c) {
 
     if (c->getStart() == 0) {
         c->setStart(gethrtime());
+        c->resetCommandAccounting();
+    }
+
+    {
+        /* The header has been parsed and the opcode is known; flush
+         * the read time collected while it was still in flight and
+         * close out the parse phase */
+        auto& sampler = c->getPhaseSampler();
+        if (sampler.isSampled()) {
+            sampler.flushRead(c->binary_header.request.opcode);
+            sampler.mark(c->binary_header.request.opcode,
+                         CommandPhase::Parse);
+        }
     }
 
     MEMCACHED_PROCESS_COMMAND_START(c->getId(), c->read.curr, c->read.bytes);
 
     /* binprot supports 16bit keys, but internals are still 8bit */
-    if (keylen > KEY_MAX_LENGTH) {
+    if (!c->isCurrentHeaderPrevalidated() && keylen > KEY_MAX_LENGTH) {
         handle_binary_protocol_error(c);
         return;
     }
@@ -4895,9 +6927,11 @@ static void dispatch_bin_command(McbpConnection* c) {
 
     /*
      * Protect ourself from someone trying to kill us by sending insanely
-     * large packets.
+     * large packets (checked up front by the batch scan for
+     * pre-validated headers).
      */
-    if (c->binary_header.request.bodylen > settings.getMaxPacketSize()) {
+    if (!c->isCurrentHeaderPrevalidated() &&
+        c->binary_header.request.bodylen > settings_snapshot().max_packet_size) {
         mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
         c->setWriteAndGo(conn_closing);
     } else {
@@ -4908,7 +6942,7 @@ static void dispatch_bin_command(McbpConnection* c) {
 void mcbp_complete_nread(McbpConnection* c) {
     if (c->binary_header.request.magic == PROTOCOL_BINARY_RES) {
         RESPONSE_HANDLER handler;
-        handler = response_handlers[c->binary_header.request.opcode];
+        handler = dispatch_tables.get().responses[c->binary_header.request.opcode];
         if (handler) {
             handler(c);
         } else {
@@ -4922,6 +6956,84 @@ void mcbp_complete_nread(McbpConnection* c) {
     }
 }
 
+/**
+ * Batch pre-validation of pipelined request headers.
+ *
+ * When a client pipelines commands the headers of the following
+ * requests already sit in the read buffer at known offsets (each
+ * frame occupies the 24 byte header plus bodylen bytes). Walk the
+ * complete headers once, prefetching the next one while checking the
+ * current, and record on the connection how many passed the cheap
+ * sanity checks (magic, packet size limit, key length limit and
+ * bodylen covering key + extras) so the per-command parse path
+ * doesn't have to repeat them for every request in the burst.
+ *
+ * Each validated header is also byte swapped to native endian and
+ * stashed in a small ring on the connection. The scan runs straight
+ * after the recv() (see conn_read) while the bytes are still hot in
+ * cache, so by the time conn_parse_cmd gets around to a request its
+ * header fields are already decoded - the decode stage is software
+ * pipelined with draining the socket.
+ *
+ * The scan stops at the first frame which isn't a well formed
+ * request (e.g. a response on a TAP/DCP ack stream); such frames
+ * simply take the unbatched path.
+ */
+void mcbp_prescan_headers(McbpConnection* c) {
+    const char* ptr = c->read.curr;
+    size_t remaining = c->read.bytes;
+    const uint32_t maxPacketSize = settings_snapshot().max_packet_size;
+    uint32_t frames = 0;
+
+    c->clearDecodedHeaders();
+
+    while (remaining >= sizeof(protocol_binary_request_header)) {
+        /* Pull in the whole header with one bulk copy (the compiler
+         * turns this into a couple of wide loads); the buffer offers
+         * no alignment guarantees so we can't read the fields in
+         * place. */
+        protocol_binary_request_header header;
+        memcpy(&header, ptr, sizeof(header));
+
+        const uint32_t bodylen = ntohl(header.request.bodylen);
+        const size_t frame = sizeof(header) + size_t(bodylen);
+
+#if defined(__GNUC__) || defined(__clang__)
+        if (remaining >= frame + sizeof(header)) {
+            /* Pull the next header towards the cache while we check
+             * this one */
+            __builtin_prefetch(ptr + frame);
+        }
+#endif
+
+        const uint16_t keylen = ntohs(header.request.keylen);
+        if (header.request.magic != PROTOCOL_BINARY_REQ ||
+            bodylen > maxPacketSize ||
+            bodylen < uint32_t(keylen) + header.request.extlen ||
+            keylen > KEY_MAX_LENGTH) {
+            break;
+        }
+
+        ++frames;
+
+        header.request.keylen = keylen;
+        header.request.bodylen = bodylen;
+        header.request.vbucket = ntohs(header.request.vbucket);
+        header.request.cas = ntohll(header.request.cas);
+        c->pushDecodedHeader(header);
+
+        if (remaining < frame) {
+            /* The header checked out but the rest of the frame is
+             * still in flight; nothing follows it in the buffer yet */
+            break;
+        }
+        ptr += frame;
+        remaining -= frame;
+    }
+
+    c->setPrevalidatedHeaders(frames);
+}
+
 int try_read_mcbp_command(McbpConnection* c) {
     if (c == nullptr) {
         throw std::runtime_error("Internal eror, connection is not mcbp");
@@ -4936,7 +7048,9 @@ int try_read_mcbp_command(McbpConnection* c) {
     } else {
 #ifdef NEED_ALIGN
         if (((long)(c->read.curr)) % 8 != 0) {
-            /* must realign input buffer */
+            /* must realign input buffer; stashed lookup results hold
+             * key pointers into it */
+            c->releasePrefetchedGets();
             memmove(c->read.buf, c->read.curr, c->read.bytes);
             c->read.curr = c->read.buf;
             LOG_DEBUG(c, "%d: Realign input buffer", c->sfd);
@@ -4945,6 +7059,16 @@ int try_read_mcbp_command(McbpConnection* c) {
         protocol_binary_request_header* req;
         req = (protocol_binary_request_header*)c->read.curr;
 
+        if (c->getPrevalidatedHeaders() == 0) {
+            mcbp_prescan_headers(c);
+        }
+        const bool prevalidated = c->consumePrevalidatedHeader();
+        /* The decoded ring is filled for validated headers only and
+         * consumed in lockstep with the pre-validation counter, so it
+         * may only be popped when the scan covered this header */
+        const protocol_binary_request_header* decoded =
+            prevalidated ? c->popDecodedHeader() : nullptr;
+
         if (settings.getVerbose() > 1) {
             /* Dump the packet before we convert it to host order */
             char buffer[1024];
@@ -4958,15 +7082,22 @@ int try_read_mcbp_command(McbpConnection* c) {
             }
         }
 
-        c->binary_header = *req;
-        c->binary_header.request.keylen = ntohs(req->request.keylen);
-        c->binary_header.request.bodylen = ntohl(req->request.bodylen);
-        c->binary_header.request.vbucket = ntohs(req->request.vbucket);
-        c->binary_header.request.cas = ntohll(req->request.cas);
+        if (decoded != nullptr) {
+            /* The batch scan already byte swapped this header while
+             * the recv was still warming the cache */
+            c->binary_header = *decoded;
+        } else {
+            c->binary_header = *req;
+            c->binary_header.request.keylen = ntohs(req->request.keylen);
+            c->binary_header.request.bodylen = ntohl(req->request.bodylen);
+            c->binary_header.request.vbucket = ntohs(req->request.vbucket);
+            c->binary_header.request.cas = ntohll(req->request.cas);
+        }
 
-        if (c->binary_header.request.magic != PROTOCOL_BINARY_REQ &&
+        if (!prevalidated &&
+            c->binary_header.request.magic != PROTOCOL_BINARY_REQ &&
             !(c->binary_header.request.magic == PROTOCOL_BINARY_RES &&
-              response_handlers[c->binary_header.request.opcode])) {
+              dispatch_tables.get().responses[c->binary_header.request.opcode])) {
             if (c->binary_header.request.magic != PROTOCOL_BINARY_RES) {
                 LOG_WARNING(c, "%u: Invalid magic: %x, closing connection",
                             c->getId(), c->binary_header.request.magic);
@@ -4982,7 +7113,9 @@ int try_read_mcbp_command(McbpConnection* c) {
             return -1;
         }
 
-        if (!c->addMsgHdr(true)) {
+        /* While responses are corked we keep appending to the existing
+         * message; resetting here would wipe the queued data. */
+        if (c->getPendingResponses() == 0 && !c->addMsgHdr(true)) {
             c->setState(conn_closing);
             return -1;
         }
@@ -39,8 +39,24 @@ void mcbp_complete_nread(McbpConnection *c);
 
 int try_read_mcbp_command(McbpConnection *c);
 
+/**
+ * Batch pre-validation and speculative decode of the pipelined
+ * request headers sitting in the connection's read buffer. Run right
+ * after the recv() so the decode overlaps with draining the socket;
+ * try_read_mcbp_command() falls back to running it lazily.
+ */
+void mcbp_prescan_headers(McbpConnection *c);
+
 void initialize_mbcp_lookup_map(void);
 
+/**
+ * Build the per NUMA node replicas of the immutable per-packet
+ * dispatch tables (see McbpDispatchTables in mcbp_executors.cc).
+ * Must run after initialize_mbcp_lookup_map() and thread_init(), and
+ * before the listening sockets open.
+ */
+void mcbp_publish_numa_replicas(void);
+
 void ship_mcbp_tap_log(McbpConnection* c);
 void ship_mcbp_dcp_log(McbpConnection* c);
 void setup_mcbp_lookup_cmd(
@@ -45,6 +45,11 @@ McbpPrivilegeChains::McbpPrivilegeChains() {
     setup(PROTOCOL_BINARY_CMD_REPLACEQ, require<Privilege::Write>);
     setup(PROTOCOL_BINARY_CMD_DELETE, require<Privilege::Write>);
     setup(PROTOCOL_BINARY_CMD_DELETEQ, require<Privilege::Write>);
+    setup(PROTOCOL_BINARY_CMD_DELETE_MULTI, require<Privilege::Write>);
+    setup(PROTOCOL_BINARY_CMD_EXIST_MULTI, require<Privilege::Read>);
+    setup(PROTOCOL_BINARY_CMD_GET_RANGE, require<Privilege::Read>);
+    setup(PROTOCOL_BINARY_CMD_SET_RANGE, require<Privilege::Write>);
+    setup(PROTOCOL_BINARY_CMD_SET_OP_DEADLINE, empty);
     setup(PROTOCOL_BINARY_CMD_APPEND, require<Privilege::Write>);
     setup(PROTOCOL_BINARY_CMD_APPENDQ, require<Privilege::Write>);
     setup(PROTOCOL_BINARY_CMD_PREPEND, require<Privilege::Write>);
@@ -74,6 +79,9 @@ McbpPrivilegeChains::McbpPrivilegeChains() {
     setup(PROTOCOL_BINARY_CMD_SASL_LIST_MECHS, empty);
     setup(PROTOCOL_BINARY_CMD_SASL_AUTH, empty);
     setup(PROTOCOL_BINARY_CMD_SASL_STEP, empty);
+    setup(PROTOCOL_BINARY_CMD_GET_SESSION_TOKEN, empty);
+    setup(PROTOCOL_BINARY_CMD_RESUME_SESSION, empty);
+    setup(PROTOCOL_BINARY_CMD_SEAL_SESSION_TOKEN, require<Privilege::NodeManagement>);
     /* Control */
     setup(PROTOCOL_BINARY_CMD_IOCTL_GET, require<Privilege::NodeManagement>);
     setup(PROTOCOL_BINARY_CMD_IOCTL_SET, require<Privilege::NodeManagement>);
@@ -276,6 +284,8 @@ McbpPrivilegeChains::McbpPrivilegeChains() {
 
     /* Scrub the data */
     setup(PROTOCOL_BINARY_CMD_SCRUB, require<Privilege::NodeManagement>);
+    /* Bulk-load a record stream into the engine */
+    setup(PROTOCOL_BINARY_CMD_ITEM_IMPORT, require<Privilege::NodeManagement>);
     /* Refresh the ISASL data */
     setup(PROTOCOL_BINARY_CMD_ISASL_REFRESH, require<Privilege::NodeManagement>);
     /* Refresh the SSL certificates */
@@ -49,12 +49,29 @@ public:
      */
     PrivilegeAccess invoke(protocol_binary_command command,
                            const Cookie& cookie) {
+        // The outcome of the chain only changes when the authentication
+        // context or the selected bucket does, so the common case is
+        // answered from the memoized results on the connection instead
+        // of walking the chain
+        PrivilegeAccess access;
+        if (cookie.connection != nullptr &&
+            cookie.connection->getCachedPrivilegeCheck(uint8_t(command),
+                                                       access)) {
+            return access;
+        }
+
         auto& chain = commandChains[command];
         if (chain.empty()) {
-            return PrivilegeAccess::Fail;
+            access = PrivilegeAccess::Fail;
         } else {
-            return chain.invoke(cookie);
+            access = chain.invoke(cookie);
+        }
+
+        if (cookie.connection != nullptr) {
+            cookie.connection->setCachedPrivilegeCheck(uint8_t(command),
+                                                       access);
         }
+        return access;
     }
 
 protected:
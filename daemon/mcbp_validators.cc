@@ -366,6 +366,38 @@ static protocol_binary_response_status sasl_auth_validator(const Cookie& cookie)
     return PROTOCOL_BINARY_RESPONSE_SUCCESS;
 }
 
+static protocol_binary_response_status get_session_token_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_no_extras*>(McbpConnection::getPacket(cookie));
+
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 0 ||
+        req->message.header.request.keylen != 0 ||
+        req->message.header.request.bodylen != 0 ||
+        req->message.header.request.cas != 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+static protocol_binary_response_status resume_session_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_no_extras*>(McbpConnection::getPacket(cookie));
+
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 0 ||
+        req->message.header.request.keylen != 0 ||
+        req->message.header.request.bodylen == 0 ||
+        req->message.header.request.cas != 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
 static protocol_binary_response_status noop_validator(const Cookie& cookie)
 {
     auto req = static_cast<protocol_binary_request_no_extras*>(McbpConnection::getPacket(cookie));
@@ -487,6 +519,95 @@ static protocol_binary_response_status delete_validator(const Cookie& cookie)
     return PROTOCOL_BINARY_RESPONSE_SUCCESS;
 }
 
+static protocol_binary_response_status delete_multi_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_no_extras*>(McbpConnection::getPacket(cookie));
+    uint16_t klen = ntohs(req->message.header.request.keylen);
+    uint32_t blen = ntohl(req->message.header.request.bodylen);
+
+    /* The per-entry key lengths inside the body are checked by the
+     * executor; the header carries no key of its own. */
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 0 ||
+        klen != 0 || blen == 0 ||
+        req->message.header.request.cas != 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+static protocol_binary_response_status exist_multi_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_no_extras*>(McbpConnection::getPacket(cookie));
+    uint16_t klen = ntohs(req->message.header.request.keylen);
+    uint32_t blen = ntohl(req->message.header.request.bodylen);
+
+    /* Same layout as DELETE_MULTI: the keys live in the body and the
+     * per-entry key lengths are checked by the executor. */
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 0 ||
+        klen != 0 || blen == 0 ||
+        req->message.header.request.cas != 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+static protocol_binary_response_status get_range_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_get_range*>(McbpConnection::getPacket(cookie));
+    uint16_t klen = ntohs(req->message.header.request.keylen);
+    uint32_t blen = ntohl(req->message.header.request.bodylen);
+
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 8 ||
+        klen == 0 || (klen + 8u) != blen ||
+        req->message.header.request.cas != 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+static protocol_binary_response_status set_range_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_set_range*>(McbpConnection::getPacket(cookie));
+    uint16_t klen = ntohs(req->message.header.request.keylen);
+    uint32_t blen = ntohl(req->message.header.request.bodylen);
+
+    /* the cas field carries the expected cas, so it isn't validated;
+     * a zero-length patch would be a no-op and is rejected */
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 4 ||
+        klen == 0 || blen <= (klen + 4u) ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+static protocol_binary_response_status set_op_deadline_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_set_op_deadline*>(McbpConnection::getPacket(cookie));
+
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 4 ||
+        req->message.header.request.keylen != 0 ||
+        req->message.header.request.bodylen != htonl(4) ||
+        req->message.header.request.cas != 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
 static protocol_binary_response_status stat_validator(const Cookie& cookie)
 {
     auto req = static_cast<protocol_binary_request_no_extras*>(McbpConnection::getPacket(cookie));
@@ -526,8 +647,11 @@ static protocol_binary_response_status get_cmd_timer_validator(const Cookie& coo
     uint32_t blen = ntohl(req->message.header.request.bodylen);
     uint8_t extlen = req->message.header.request.extlen;
 
+    /* extlen == 1 is the classic request (opcode only); extlen == 2
+     * carries an additional mode byte (0 = full histogram, 1 = delta
+     * since this connection's last delta request) */
     if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
-        extlen != 1 || (klen + extlen) != blen ||
+        (extlen != 1 && extlen != 2) || (klen + extlen) != blen ||
         req->message.header.request.cas != 0 ||
         req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
         return PROTOCOL_BINARY_RESPONSE_EINVAL;
@@ -598,6 +722,16 @@ static protocol_binary_response_status ioctl_get_validator(const Cookie& cookie)
     return PROTOCOL_BINARY_RESPONSE_SUCCESS;
 }
 
+/**
+ * A few ioctl_set properties take a document (a settings delta, a
+ * property script) rather than a short scalar, and may carry a value
+ * larger than IOCTL_VAL_LENGTH.
+ */
+static bool is_document_ioctl(const char* key, uint16_t klen) {
+    const std::string name(key, klen);
+    return name == "batch.apply" || name == "config.push";
+}
+
 static protocol_binary_response_status ioctl_set_validator(const Cookie& cookie)
 {
     auto req = static_cast<protocol_binary_request_ioctl_set*>(McbpConnection::getPacket(cookie));
@@ -608,11 +742,19 @@ static protocol_binary_response_status ioctl_set_validator(const Cookie& cookie)
         req->message.header.request.extlen != 0 ||
         req->message.header.request.cas != 0 ||
         klen == 0 || klen > IOCTL_KEY_LENGTH ||
-        vallen > IOCTL_VAL_LENGTH ||
         req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
         return PROTOCOL_BINARY_RESPONSE_EINVAL;
     }
 
+    if (vallen > IOCTL_VAL_LENGTH) {
+        const char* key = reinterpret_cast<const char*>(
+            req->bytes + sizeof(req->bytes));
+        if (vallen > CONFIG_VALIDATE_MAX_LENGTH ||
+            !is_document_ioctl(key, klen)) {
+            return PROTOCOL_BINARY_RESPONSE_EINVAL;
+        }
+    }
+
     return PROTOCOL_BINARY_RESPONSE_SUCCESS;
 }
 
@@ -855,6 +997,9 @@ void McbpValidatorChains::initializeMcbpValidatorChains(McbpValidatorChains& cha
     chains.push_unique(PROTOCOL_BINARY_CMD_SASL_LIST_MECHS, sasl_list_mech_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_SASL_AUTH, sasl_auth_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_SASL_STEP, sasl_auth_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_GET_SESSION_TOKEN, get_session_token_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_RESUME_SESSION, resume_session_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_SEAL_SESSION_TOKEN, resume_session_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_NOOP, noop_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_FLUSH, flush_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_FLUSHQ, flush_validator);
@@ -864,6 +1009,11 @@ void McbpValidatorChains::initializeMcbpValidatorChains(McbpValidatorChains& cha
     chains.push_unique(PROTOCOL_BINARY_CMD_GETKQ, get_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_DELETE, delete_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_DELETEQ, delete_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_DELETE_MULTI, delete_multi_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_EXIST_MULTI, exist_multi_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_GET_RANGE, get_range_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_SET_RANGE, set_range_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_SET_OP_DEADLINE, set_op_deadline_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_STAT, stat_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_INCREMENT, arithmetic_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_INCREMENTQ, arithmetic_validator);
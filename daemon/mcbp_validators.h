@@ -43,6 +43,16 @@ public:
         return commandChains[command].invoke(cookie);
     }
 
+    /*
+     * Check if the command has more than one validator in its chain
+     * (e.g. the extra collections validators). The fused dispatch
+     * entries in mcbp_executors.cc may only validate inline when this
+     * is false.
+     */
+    bool haveMultiple(protocol_binary_command command) const {
+        return commandChains[command].size() > 1;
+    }
+
     /*
      * Silently ignores any attempt to push the same function onto the chain.
      */
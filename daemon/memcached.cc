@@ -20,6 +20,7 @@
 #include "memcached/extension_loggers.h"
 #include "memcached/audit_interface.h"
 #include "mcbp.h"
+#include "alloc_domain.h"
 #include "alloc_hooks.h"
 #include "utilities/engine_loader.h"
 #include "timings.h"
@@ -35,13 +36,17 @@
 #include "runtime.h"
 #include "mcaudit.h"
 #include "session_cas.h"
+#include "experiments.h"
+#include "sched_trace.h"
 #include "settings.h"
+#include "settings_snapshot.h"
 #include "subdocument.h"
 #include "enginemap.h"
 #include "buckets.h"
 #include "parent_monitor.h"
 #include "topkeys.h"
 #include "stats.h"
+#include "stats_shm.h"
 #include "mcbp_executors.h"
 #include "memcached_openssl.h"
 #include "greenstack.h"
@@ -50,6 +55,7 @@
 
 #include <phosphor/phosphor.h>
 #include <platform/cb_malloc.h>
+#include <platform/checked_snprintf.h>
 #include <platform/strerror.h>
 #include <platform/sysinfo.h>
 
@@ -68,10 +74,12 @@
 #include <stddef.h>
 #include <snappy-c.h>
 #include <cJSON.h>
-#include <JSON_checker.h>
 #include <engines/default_engine.h>
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <thread>
+#include <unordered_map>
 #include <cJSON_utils.h>
 
 // MB-14649: log crashing on windows..
@@ -91,6 +99,43 @@ static EXTENSION_LOG_LEVEL get_log_level(void);
 static cb_mutex_t buckets_lock;
 std::vector<Bucket> all_buckets;
 
+/**
+ * An immutable snapshot mapping the name of every bucket in state
+ * Ready to its index in all_buckets. It is published with an atomic
+ * pointer swap and read with std::atomic_load, so the lookup in
+ * associate_bucket() doesn't need any locks. Old snapshots stay alive
+ * until the last reader drops its reference (the shared_ptr refcount
+ * plays the role of the grace period in a classic RCU scheme).
+ *
+ * The snapshot is rebuilt (under buckets_lock) every time a bucket
+ * becomes Ready or leaves the Ready state; see
+ * publish_bucket_index_map().
+ */
+typedef std::unordered_map<std::string, int> BucketIndexMap;
+static std::shared_ptr<const BucketIndexMap> bucket_index_map;
+
+/**
+ * Rebuild the name -> index snapshot from all_buckets and publish it.
+ * Called whenever a bucket enters or leaves the Ready state. Grabs
+ * buckets_lock to serialize with other writers, so the caller must
+ * not hold it (nor any bucket mutex).
+ */
+static void publish_bucket_index_map(void) {
+    auto next = std::make_shared<BucketIndexMap>();
+    cb_mutex_enter(&buckets_lock);
+    for (int ii = 1; ii < settings.getMaxBuckets(); ++ii) {
+        Bucket &b = all_buckets.at(ii);
+        cb_mutex_enter(&b.mutex);
+        if (b.state == BucketState::Ready) {
+            next->emplace(b.name, ii);
+        }
+        cb_mutex_exit(&b.mutex);
+    }
+    std::atomic_store(&bucket_index_map,
+                      std::shared_ptr<const BucketIndexMap>(std::move(next)));
+    cb_mutex_exit(&buckets_lock);
+}
+
 static ENGINE_HANDLE* v1_handle_2_handle(ENGINE_HANDLE_V1* v1) {
     return reinterpret_cast<ENGINE_HANDLE*>(v1);
 }
@@ -106,6 +151,11 @@ protocol_binary_response_status Bucket::validateMcbpCommand(
     return all_buckets[c->getBucketIndex()].validatorChains.invoke(command, cookie);
 }
 
+bool Bucket::mcbpCommandHasExtraValidators(const Connection* c,
+                                           protocol_binary_command command) {
+    return all_buckets[c->getBucketIndex()].validatorChains.haveMultiple(command);
+}
+
 std::atomic<bool> memcached_shutdown;
 std::atomic<bool> service_online;
 // Should we enable to common ports (all of the ports which arn't tagged as
@@ -156,7 +206,7 @@ static engine_event_handler_array_t engine_event_handlers;
 char reset_stats_time[80];
 static void set_stats_reset_time(void)
 {
-    time_t now = time(NULL);
+    time_t now = mc_time_get_epoch_seconds();
 #ifdef WIN32
     ctime_s(reset_stats_time, sizeof(reset_stats_time), &now);
 #else
@@ -170,17 +220,18 @@ static void set_stats_reset_time(void)
 
 void disassociate_bucket(Connection *c) {
     Bucket &b = all_buckets.at(c->getBucketIndex());
-    cb_mutex_enter(&b.mutex);
-    b.clients--;
 
     c->setBucketIndex(0);
     c->setBucketEngine(nullptr);
 
-    if (b.clients == 0 && b.state == BucketState::Destroying) {
+    /* If we were the last client out of a bucket being deleted, wake
+     * the deletion thread. The signal is sent without holding the
+     * bucket mutex; that may (in theory) lose a race with the thread
+     * entering its wait, but it waits with a one second timeout so
+     * the only cost is a slightly delayed deletion. */
+    if (--b.clients == 0 && b.state == BucketState::Destroying) {
         cb_cond_signal(&b.cond);
     }
-
-    cb_mutex_exit(&b.mutex);
 }
 
 bool associate_bucket(Connection *c, const char *name) {
@@ -189,38 +240,58 @@ bool associate_bucket(Connection *c, const char *name) {
     /* leave the current bucket */
     disassociate_bucket(c);
 
-    /* Try to associate with the named bucket */
+    /* Look up the named bucket in the current snapshot of the name
+     * map. No locks are taken on this path; see bucket_index_map. */
     /* @todo add auth checks!!! */
-    for (int ii = 1; ii < settings.getMaxBuckets() && !found; ++ii) {
-        Bucket &b = all_buckets.at(ii);
-        cb_mutex_enter(&b.mutex);
-        if (b.state == BucketState::Ready && strcmp(b.name, name) == 0) {
+    auto map = std::atomic_load(&bucket_index_map);
+    if (map) {
+        const auto iter = map->find(name);
+        if (iter != map->end()) {
+            Bucket &b = all_buckets.at(iter->second);
+            /* The snapshot may be stale, so optimistically register
+             * as a client of the bucket and then verify that it is
+             * still the bucket we asked for. Once our increment is
+             * visible a deletion thread can't tear the bucket down
+             * (it waits for clients to drop to zero), so if we
+             * observe Ready after the increment the name is stable
+             * and safe to compare. This mirrors the validate /
+             * register / re-validate protocol used by session_cas. */
             b.clients++;
-            c->setBucketIndex(ii);
-            c->setBucketEngine(b.engine);
-            found = true;
+            if (b.state == BucketState::Ready &&
+                strcmp(b.name, name) == 0) {
+                c->setBucketIndex(iter->second);
+                c->setBucketEngine(b.engine);
+                found = true;
+            } else {
+                /* Lost a race with a bucket deletion (or the slot
+                 * has been recycled for another bucket); back out
+                 * again. */
+                if (--b.clients == 0 &&
+                    b.state == BucketState::Destroying) {
+                    cb_cond_signal(&b.cond);
+                }
+            }
         }
-        cb_mutex_exit(&b.mutex);
     }
 
     if (!found) {
         /* Bucket not found, connect to the "no-bucket" */
         Bucket &b = all_buckets.at(0);
-        cb_mutex_enter(&b.mutex);
         b.clients++;
-        cb_mutex_exit(&b.mutex);
         c->setBucketIndex(0);
         c->setBucketEngine(b.engine);
     }
 
+    /* The selected bucket changed; drop the memoized privilege check
+     * results */
+    bump_privilege_epoch();
+
     return found;
 }
 
 void associate_initial_bucket(Connection *c) {
     Bucket &b = all_buckets.at(0);
-    cb_mutex_enter(&b.mutex);
     b.clients++;
-    cb_mutex_exit(&b.mutex);
 
     c->setBucketIndex(0);
     c->setBucketEngine(b.engine);
@@ -229,8 +300,12 @@ void associate_initial_bucket(Connection *c) {
 }
 
 static void populate_log_level(void*) {
-    // Lock the entire buckets array so that buckets can't be modified while
-    // we notify them (blocking bucket creation/deletion)
+    // Lock the entire buckets array so that new buckets can't show up
+    // while we notify them. Bucket deletion no longer takes this lock,
+    // but that's safe: the Ready check below happens under the bucket
+    // mutex, and a deletion can't move the bucket out of Ready (its
+    // first step) while we hold it - so the engine stays alive for the
+    // duration of the callback.
     auto val = get_log_level();
 
     cb_mutex_enter(&buckets_lock);
@@ -387,6 +462,11 @@ static void stats_init(void) {
     stats.total_conns.reset();
     stats.daemon_conns.reset();
     stats.rejected_conns.reset();
+    stats.op_budget_kills.reset();
+    stats.deadline_drops.reset();
+    stats.cross_numa_dispatch.reset();
+    stats.conn_migrations.reset();
+    stats.shed_conns.reset();
     stats.curr_conns.store(0, std::memory_order_relaxed);
 }
 
@@ -411,9 +491,30 @@ void stats_reset(const void *void_cookie) {
         std::lock_guard<std::mutex> guard(stats_mutex);
         set_stats_reset_time();
     }
-    stats.total_conns.reset();
-    stats.rejected_conns.reset();
-    threadlocal_stats_reset(all_buckets[conn->getBucketIndex()].stats);
+
+    /* The server wide connection counters aren't owned by any bucket;
+     * only an admin reset touches them so one tenant resetting its
+     * own stats can't pull the rug out from under another's
+     * monitoring. */
+    if (conn->isAdmin()) {
+        stats.total_conns.reset();
+        stats.rejected_conns.reset();
+        stats.op_budget_kills.reset();
+        stats.deadline_drops.reset();
+        stats.cross_numa_dispatch.reset();
+        stats.conn_migrations.reset();
+        stats.shed_conns.reset();
+    }
+
+    /* Reset the bucket's thread local counters by snapshotting their
+     * aggregate as the new baseline (the reporting side differences
+     * against it; see server_stats). This only _reads_ the workers'
+     * counters - zeroing them would dirty every worker's cache line
+     * aligned slice and race their concurrent increments. */
+    auto& bucket = all_buckets[conn->getBucketIndex()];
+    bucket.stats_baseline.reset();
+    bucket.stats_baseline.aggregate(bucket.stats,
+                                    settings.getNumWorkerThreads());
     bucket_reset_stats(conn);
 }
 
@@ -451,10 +552,23 @@ static void ssl_cipher_list_changed_listener(const std::string&, Settings &s) {
     set_ssl_cipher_list(s.getSslCipherList());
 }
 
+static void ssl_session_cache_size_changed_listener(const std::string&,
+                                                    Settings &s) {
+    // Drop the cached server contexts; new connections create contexts
+    // with the new cache size.
+    invalidate_ssl_server_ctx_cache();
+}
+
 static void verbosity_changed_listener(const std::string&, Settings &s) {
     perform_callbacks(ON_LOG_LEVEL, NULL, NULL);
 }
 
+static void event_settings_changed_listener(const std::string&, Settings &s) {
+    // Each connection caches its reqs-per-event / time-budget values;
+    // bump the generation so they re-derive them on their next event.
+    McbpConnection::bumpEventSettingsGeneration();
+}
+
 static void interfaces_changed_listener(const std::string&, Settings &s) {
     for (const auto& ifc : s.getInterfaces()) {
         auto* port = get_listening_port_instance(ifc.port);
@@ -477,19 +591,37 @@ static void interfaces_changed_listener(const std::string&, Settings &s) {
 
 static void settings_init(void) {
     // Set up the listener functions
+    settings_snapshot_init();
     settings.addChangeListener("breakpad",
                                breakpad_changed_listener);
     settings.addChangeListener("ssl_minimum_protocol",
                                ssl_minimum_protocol_changed_listener);
     settings.addChangeListener("ssl_cipher_list",
                                ssl_cipher_list_changed_listener);
+    settings.addChangeListener("ssl_session_cache_size",
+                               ssl_session_cache_size_changed_listener);
     settings.addChangeListener("verbosity", verbosity_changed_listener);
     settings.addChangeListener("interfaces", interfaces_changed_listener);
+    for (const auto* key : {"reqs_per_event_high_priority",
+                            "reqs_per_event_med_priority",
+                            "reqs_per_event_low_priority",
+                            "default_reqs_per_event",
+                            "event_time_budget_high_priority",
+                            "event_time_budget_med_priority",
+                            "event_time_budget_low_priority",
+                            "default_event_time_budget"}) {
+        settings.addChangeListener(key, event_settings_changed_listener);
+    }
 
     struct interface default_interface;
     settings.addInterface(default_interface);
 
-    settings.setBioDrainBufferSize(8192);
+    /* The SSL staging buffers and the BIO pair are sized by this. 8k
+     * couldn't even hold one full 16k TLS record, so a pipeline burst
+     * was decrypted in dribbles; 64k lets one drain of the socket feed
+     * several records to a single SSL_read pass. */
+    settings.setBioDrainBufferSize(65536);
+    settings.setSslSessionCacheSize(1024);
 
     settings.setVerbose(0);
     settings.setConnectionIdleTime(0); // Connection idle time disabled
@@ -596,6 +728,51 @@ static void disable_listen(void) {
     }
 }
 
+/*
+ * Drain mode, initiated over the ioctl interface (drain.start) ahead
+ * of a planned restart: stop accepting new clients and disconnect the
+ * connected ones at their next command boundary, so every in-flight
+ * command completes and has its response flushed before the socket is
+ * torn down. DCP / TAP clients go through the normal disconnect path,
+ * so their peers observe a clean close and can re-establish the
+ * streams elsewhere. Connections which haven't reached a command
+ * boundary when the deadline passes are shut down regardless. Admin
+ * connections are exempt so the load balancer can keep polling the
+ * progress (ioctl_get drain.status) over one of them; the process
+ * stays up until it is restarted the normal way.
+ */
+static std::atomic<bool> service_draining;
+static std::atomic<rel_time_t> drain_deadline;
+
+bool is_draining(void) {
+    return service_draining.load(std::memory_order_relaxed);
+}
+
+rel_time_t get_drain_deadline(void) {
+    return drain_deadline.load(std::memory_order_relaxed);
+}
+
+void initiate_drain(rel_time_t grace) {
+    drain_deadline.store(mc_time_get_current_time() + grace);
+    if (!service_draining.exchange(true)) {
+        LOG_NOTICE(NULL,
+                   "Drain initiated; no longer accepting new clients. "
+                   "%d connected clients will be disconnected within %u "
+                   "seconds",
+                   count_drainable_connections(), unsigned(grace));
+    } else {
+        LOG_NOTICE(NULL, "Drain deadline moved to %u seconds from now",
+                   unsigned(grace));
+    }
+
+    /* The listen thread disables the listeners
+     * (dispatch_event_handler) and the workers disable their sharded
+     * listeners and start prodding their idle clients
+     * (thread_libevent_process). */
+    notify_dispatcher();
+    threads_notify_clock_tick();
+}
+
 void safe_close(SOCKET sfd) {
     if (sfd != INVALID_SOCKET) {
         int rval;
@@ -710,34 +887,51 @@ ENGINE_ERROR_CODE refresh_cbsasl(Connection *c)
     return ENGINE_EWOULDBLOCK;
 }
 
-#if 0
-static void ssl_certs_refresh_main(void *c)
-{
-    /* Update the internal certificates */
+/**
+ * Task run on the executor pool to rebuild the cached server SSL
+ * contexts after the certificate / private key files have been
+ * replaced on disk. The expensive part (reading and parsing the new
+ * certificates) happens on the executor thread; new connections start
+ * using the new contexts as soon as they're swapped into the cache,
+ * and established connections keep the context they were accepted
+ * with. The client is notified (and the response sent) when the
+ * rebuild is done.
+ */
+class SslCertsRefreshTask : public Task {
+public:
+    SslCertsRefreshTask(const void* cookie_)
+        : cookie(cookie_),
+          status(ENGINE_SUCCESS) {
+        // empty
+    }
 
-    notify_io_complete(c, ENGINE_SUCCESS);
-}
-#endif
+    virtual bool execute() override {
+        if (!refresh_ssl_server_ctx_cache()) {
+            status = ENGINE_EINVAL;
+        }
+        return true;
+    }
+
+    virtual void notifyExecutionComplete() override {
+        notify_io_complete(cookie, status);
+    }
+
+private:
+    const void* cookie;
+    ENGINE_ERROR_CODE status;
+};
 
 ENGINE_ERROR_CODE refresh_ssl_certs(Connection *c)
 {
-    (void)c;
-#if 0
-    cb_thread_t tid;
-    int err;
+    // @todo refactor and move this code over to MCBP
+    auto* conn = dynamic_cast<McbpConnection*>(c);
 
-    err = cb_create_thread(&tid, ssl_certs_refresh_main, c, 1);
-    if (err != 0) {
-        settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                                        "Failed to create ssl_certificate "
-                                        "update thread: %s",
-                                        strerror(err));
-        return ENGINE_DISCONNECT;
-    }
+    std::shared_ptr<Task> task =
+        std::make_shared<SslCertsRefreshTask>(conn->getCookie());
+    std::lock_guard<std::mutex> guard(task->getMutex());
+    executorPool->schedule(task, true);
 
     return ENGINE_EWOULDBLOCK;
-#endif
-    return ENGINE_SUCCESS;
 }
 
 static cJSON *get_bucket_details_UNLOCKED(const Bucket& bucket, int idx) {
@@ -770,6 +964,14 @@ static cJSON *get_bucket_details_UNLOCKED(const Bucket& bucket, int idx) {
 
     cJSON_AddNumberToObject(root, "clients", bucket.clients);
     cJSON_AddStringToObject(root, "name", bucket.name);
+    cJSON_AddNumberToObject(root, "throttle_ops_limit",
+                            double(bucket.ops_throttle.getLimit()));
+    cJSON_AddNumberToObject(root, "throttle_bytes_limit",
+                            double(bucket.bytes_throttle.getLimit()));
+    cJSON_AddNumberToObject(root, "throttle_events",
+                            double(bucket.throttle_events));
+    cJSON_AddNumberToObject(root, "rejected_ops",
+                            double(bucket.rejected_ops));
 
     switch (bucket.type) {
     case BucketType::Unknown:
@@ -787,6 +989,9 @@ static cJSON *get_bucket_details_UNLOCKED(const Bucket& bucket, int idx) {
     case BucketType::EWouldBlock:
         cJSON_AddStringToObject(root, "type", "ewouldblock");
         break;
+    case BucketType::Crash:
+        cJSON_AddStringToObject(root, "type", "crash");
+        break;
     }
 
     return root;
@@ -805,6 +1010,18 @@ cJSON *get_bucket_details(int idx)
 
 bool conn_listening(ListenConnection *c)
 {
+    if (is_draining()) {
+        /* The listener fired before it got disabled; don't let the
+         * client in, and disable the listener from its own thread (the
+         * only one which may touch the libevent registration). */
+        if (c->getWorker() != nullptr) {
+            c->disable();
+        } else {
+            disable_listen();
+        }
+        return false;
+    }
+
     struct sockaddr_storage addr;
     socklen_t addrlen = sizeof(addr);
     SOCKET sfd = accept(c->getSocketDescriptor(), (struct sockaddr*)&addr,
@@ -822,7 +1039,15 @@ bool conn_listening(ListenConnection *c)
             LOG_WARNING(c, "Too many open files. Current limit: %d",
                         limit.rlim_cur);
 #endif
-            disable_listen();
+            if (c->getWorker() != nullptr) {
+                /* Sharded listener running on its owning worker thread.
+                 * Only that thread may touch the libevent registration,
+                 * so disable just this listener; it is re-enabled the
+                 * next time the worker is notified. */
+                c->disable();
+            } else {
+                disable_listen();
+            }
         } else if (!is_blocking(error)) {
             log_socket_error(EXTENSION_LOG_WARNING, c,
                              "Failed to accept new client: %s");
@@ -841,6 +1066,14 @@ bool conn_listening(ListenConnection *c)
         port_conns = ++port_instance->curr_conns;
     }
 
+    const int headroom = int(settings.getConnectionShedHeadroom());
+    if (headroom > 0 && curr_conns >= settings.getMaxconns() - headroom) {
+        /* We're eating into the configured headroom; ask the workers
+         * to shed their longest-idle connections. The new client is
+         * still let in as long as we're below the hard limit. */
+        threads_request_connection_shed();
+    }
+
     if (curr_conns >= settings.getMaxconns() || port_conns >= port_instance->maxconns) {
         {
             std::lock_guard<std::mutex> guard(stats_mutex);
@@ -867,7 +1100,20 @@ bool conn_listening(ListenConnection *c)
         return false;
     }
 
-    dispatch_conn_new(sfd, c->getParentPort());
+    auto* worker = c->getWorker();
+    if (worker != nullptr) {
+        /* Sharded listener: we're already running on the worker thread
+         * which should own the client, so create the connection right
+         * here instead of taking the hop through the dispatcher. */
+        if (conn_new(sfd, c->getParentPort(), worker->base, worker) ==
+            nullptr) {
+            LOG_WARNING(nullptr, "Failed to create connection for socket %ld",
+                        long(sfd));
+            safe_close(sfd);
+        }
+    } else {
+        dispatch_conn_new(sfd, c->getParentPort());
+    }
 
     return false;
 }
@@ -880,16 +1126,23 @@ bool conn_listening(ListenConnection *c)
 bool is_bucket_dying(Connection *c)
 {
     bool disconnect = memcached_shutdown;
+    const char* reason = "The connected bucket is being deleted";
     Bucket &b = all_buckets.at(c->getBucketIndex());
 
     if (b.state != BucketState::Ready) {
         disconnect = true;
     }
 
+    if (!disconnect && is_draining() && !c->isAdmin()) {
+        /* The connection rests at a command boundary right now (this
+         * check runs from conn_new_cmd and friends), so it may be
+         * drained without cutting off an in-flight command. */
+        disconnect = true;
+        reason = "The server is draining for restart";
+    }
+
     if (disconnect) {
-        LOG_NOTICE(c,
-                   "%u The connected bucket is being deleted.. disconnecting",
-                   c->getId());
+        LOG_NOTICE(c, "%u %s.. disconnecting", c->getId(), reason);
         c->initateShutdown();
         return true;
     }
@@ -910,6 +1163,12 @@ void event_handler(evutil_socket_t fd, short which, void *arg) {
             "ignored");
         return;
     }
+    thr->event_dispatches++;
+
+    /* The replay gate has to run before the thread lock is taken;
+     * a dispatch waiting for its turn must not block a
+     * notify_io_complete the trace wants delivered first. */
+    sched_trace_event_dispatch(c->getId());
 
     LOCK_THREAD(thr);
     if (memcached_shutdown) {
@@ -932,30 +1191,11 @@ void event_handler(evutil_socket_t fd, short which, void *arg) {
     /* sanity */
     cb_assert(fd == c->getSocketDescriptor());
 
-    if ((which & EV_TIMEOUT) == EV_TIMEOUT) {
-        auto* mcbp = dynamic_cast<McbpConnection*>(c);
-
-        if (mcbp != nullptr && (c->isAdmin() || c->isDCP() || c->isTAP())) {
-            auto* mcbp = dynamic_cast<McbpConnection*>(c);
-            if (c->isAdmin()) {
-                LOG_NOTICE(c, "%u: Timeout for admin connection. (ignore)",
-                           c->getId());
-            } else if (c->isDCP()) {
-                LOG_NOTICE(c, "%u: Timeout for DCP connection. (ignore)",
-                           c->getId());
-            } else if (c->isTAP()) {
-                LOG_NOTICE(c, "%u: Timeout for TAP connection. (ignore)",
-                           c->getId());
-            }
-            if (!mcbp->reapplyEventmask()) {
-                c->initateShutdown();
-            }
-        } else {
-            LOG_NOTICE(c, "%u: Shutting down idle client %s", c->getId(),
-                       c->getDescription().c_str());
-            c->initateShutdown();
-        }
-    }
+    /* (EV_TIMEOUT only shows up in 'which' for connections in a
+     * throttle backoff (see McbpConnection::throttleBackoff); other
+     * connection events are registered without a timeout. Idle clients
+     * are disconnected by the worker's timer wheel instead - see
+     * ConnectionTimerWheel.) */
 
     run_event_loop(c, which);
 
@@ -990,6 +1230,13 @@ void listen_event_handler(evutil_socket_t, short which, void *arg) {
     }
 
     if (memcached_shutdown) {
+        if (c->getWorker() != nullptr) {
+            // A sharded listener runs on a worker thread; just stop
+            // accepting and let the worker's own shutdown logic drive
+            // the event base.
+            c->disable();
+            return;
+        }
         // Someone requested memcached to shut down. The listen thread should
         // be stopped immediately.
         LOG_NOTICE(NULL, "Stopping listen thread");
@@ -1004,6 +1251,16 @@ static void dispatch_event_handler(evutil_socket_t fd, short, void *) {
     char buffer[80];
     ssize_t nr = recv(fd, buffer, sizeof(buffer), 0);
 
+    if (is_draining()) {
+        /* No new clients during a drain; we're running on the thread
+         * owning the listen events, so it is safe to disable them
+         * right here. */
+        if (!is_listen_disabled()) {
+            disable_listen();
+        }
+        return;
+    }
+
     if (enable_common_ports.load()) {
         enable_common_ports.store(false);
         create_listen_sockets(false);
@@ -1080,7 +1337,8 @@ static void maximize_sndbuf(const SOCKET sfd) {
     }
 }
 
-static SOCKET new_server_socket(struct addrinfo *ai, bool tcp_nodelay) {
+static SOCKET new_server_socket(struct addrinfo *ai, bool tcp_nodelay,
+                                bool reuseport) {
     SOCKET sfd;
 
     sfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
@@ -1121,6 +1379,22 @@ static SOCKET new_server_socket(struct addrinfo *ai, bool tcp_nodelay) {
 #endif
 
     setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, flags_ptr, sizeof(flags));
+
+#ifdef SO_REUSEPORT
+    if (reuseport) {
+        error = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, flags_ptr,
+                           sizeof(flags));
+        if (error != 0) {
+            LOG_WARNING(NULL, "setsockopt(SO_REUSEPORT): %s",
+                        strerror(errno));
+            safe_close(sfd);
+            return INVALID_SOCKET;
+        }
+    }
+#else
+    (void)reuseport;
+#endif
+
     error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, flags_ptr,
                        sizeof(flags));
     if (error != 0) {
@@ -1188,6 +1462,7 @@ static void add_listening_port(const struct interface *interf, in_port_t port, s
         newport.tcp_nodelay = interf->tcp_nodelay;
         newport.management = interf->management;
         newport.protocol = interf->protocol;
+        newport.priority = interf->priority;
 
         stats.listening_ports.push_back(newport);
     } else {
@@ -1200,12 +1475,35 @@ static void add_listening_port(const struct interface *interf, in_port_t port, s
     }
 }
 
+/**
+ * Should the worker threads own their own SO_REUSEPORT listening
+ * sockets for the given interface?
+ *
+ * Sharding is only used for the user ports (the management ports see a
+ * trivial amount of traffic and are subject to the require_init dance),
+ * and only for interfaces with a fixed port number: with SO_REUSEPORT
+ * every bind to port 0 gets its own ephemeral port, so the shards would
+ * end up listening on different ports than the main listener.
+ */
+static bool is_sharded_interface(const struct interface& interf) {
+#ifdef SO_REUSEPORT
+    return settings.isReuseportListeners() && !settings.isRequireInit() &&
+           !interf.management && interf.port != 0;
+#else
+    return false;
+#endif
+}
+
 /**
  * Create a socket and bind it to a specific port number
- * @param interface the interface to bind to
- * @param port the port number to bind to
+ * @param interf the interface to bind to
+ * @param worker the worker thread which should own the listening socket
+ *               when listener sharding (SO_REUSEPORT) is in use, or
+ *               nullptr to create the traditional listener served by
+ *               the dispatcher thread
  */
-static int server_socket(const struct interface *interf) {
+static int server_socket(const struct interface *interf,
+                         LIBEVENT_THREAD *worker) {
     SOCKET sfd;
     struct addrinfo hints;
     int success = 0;
@@ -1246,8 +1544,14 @@ static int server_socket(const struct interface *interf) {
         return 1;
     }
 
+    /* When an interface is sharded, every socket bound to its port (the
+     * dispatcher's one included) must request SO_REUSEPORT or the binds
+     * conflict with each other. */
+    const bool reuseport = is_sharded_interface(*interf);
+
     for (struct addrinfo* next = ai; next; next = next->ai_next) {
-        if ((sfd = new_server_socket(next, interf->tcp_nodelay)) == INVALID_SOCKET) {
+        if ((sfd = new_server_socket(next, interf->tcp_nodelay,
+                                     reuseport)) == INVALID_SOCKET) {
             /* getaddrinfo can return "junk" addresses,
              * we make sure at least one works before erroring.
              */
@@ -1286,13 +1590,22 @@ static int server_socket(const struct interface *interf) {
         }
 
         auto* lconn = conn_new_server(sfd, listenport, next->ai_addr->sa_family,
-                                      *interf, main_base);
+                                      *interf,
+                                      worker ? worker->base : main_base,
+                                      worker);
         if (lconn == nullptr) {
             FATAL_ERROR(EXIT_FAILURE, "Failed to create listening connection");
         }
 
-        lconn->setNext(listen_conn);
-        listen_conn = lconn;
+        if (worker == nullptr) {
+            lconn->setNext(listen_conn);
+            listen_conn = lconn;
+        } else {
+            /* Sharded listeners are kept on a per-thread list; only the
+             * owning thread may touch their libevent registration. */
+            lconn->setNext(worker->listen_conn);
+            worker->listen_conn = lconn;
+        }
 
         stats.daemon_conns++;
         stats.curr_conns.fetch_add(1, std::memory_order_relaxed);
@@ -1316,9 +1629,9 @@ static int server_sockets(bool management) {
 
     for (auto& interface : settings.getInterfaces()) {
         if (management && interface.management) {
-            ret |= server_socket(&interface);
+            ret |= server_socket(&interface, nullptr);
         } else if (!management && !interface.management) {
-            ret |= server_socket(&interface);
+            ret |= server_socket(&interface, nullptr);
         }
     }
 
@@ -1329,6 +1642,27 @@ static int server_sockets(bool management) {
     return ret;
 }
 
+void create_worker_listen_sockets(LIBEVENT_THREAD* thread) {
+    bool any = false;
+
+    for (auto& interface : settings.getInterfaces()) {
+        if (is_sharded_interface(interface)) {
+            any = true;
+            if (server_socket(&interface, thread)) {
+                FATAL_ERROR(EX_OSERR,
+                            "Failed to create SO_REUSEPORT listening socket");
+            }
+        }
+    }
+
+    if (any && thread->index == 0) {
+        LOG_NOTICE(nullptr,
+                   "Sharding user port listeners across %d worker threads"
+                       " (SO_REUSEPORT)",
+                   settings.getNumWorkerThreads());
+    }
+}
+
 static void create_listen_sockets(bool management) {
     if (server_sockets(management)) {
         FATAL_ERROR(EX_OSERR, "Failed to create listening socket");
@@ -1860,6 +2194,7 @@ static SERVER_HANDLE_V1 *get_server_api(void)
         server_cookie_api.validate_session_cas = validate_session_cas;
         server_cookie_api.decrement_session_ctr = decrement_session_ctr;
         server_cookie_api.notify_io_complete = notify_io_complete;
+        server_cookie_api.notify_io_complete_batch = notify_io_complete_batch;
         server_cookie_api.reserve = reserve_cookie;
         server_cookie_api.release = release_cookie;
         server_cookie_api.set_priority = cookie_set_priority;
@@ -1912,6 +2247,80 @@ static SERVER_HANDLE_V1 *get_server_api(void)
 }
 
 /* BUCKET FUNCTIONS */
+
+/**
+ * Drive a burst of synthetic store/get/delete cycles through a freshly
+ * initialized engine, before the bucket is marked ready and becomes
+ * visible to clients (see the "bucket_warmup_ops" setting; 0 disables
+ * the phase). The first real commands after a restart otherwise pay
+ * for the lazy page-in of the engine code, the cold allocator paths
+ * and the untrained branch predictors; with the warmup an LB health
+ * check probing a just-created bucket only admits a node whose serving
+ * paths have actually been executed. The keys are removed again, so
+ * nothing of the warmup stays visible.
+ */
+static void warmup_bucket_engine(Connection& connection, Bucket& bucket) {
+    const int ops = settings.getBucketWarmupOps();
+    if (ops == 0) {
+        return;
+    }
+
+    /* The cookie is only handed back to the server API should the
+     * engine need it; the creating connection is the management
+     * connection. */
+    auto* mcbp = dynamic_cast<McbpConnection*>(&connection);
+    const void* cookie = mcbp != nullptr ? mcbp->getCookie() : nullptr;
+
+    auto* engine = bucket.engine;
+    auto* handle = v1_handle_2_handle(engine);
+    const hrtime_t start = gethrtime();
+    int completed = 0;
+
+    for (int ii = 0; ii < ops; ++ii) {
+        char key[32];
+        const int nkey = snprintf(key, sizeof(key), "warmup-%d", ii);
+        item* it = nullptr;
+
+        if (engine->allocate(handle, cookie, &it, key, size_t(nkey), 64,
+                             0, 0, PROTOCOL_BINARY_RAW_BYTES)
+                != ENGINE_SUCCESS) {
+            break;
+        }
+
+        item_info info;
+        memset(&info, 0, sizeof(info));
+        info.nvalue = 1;
+        if (engine->get_item_info(handle, cookie, it, &info) &&
+            info.nvalue > 0) {
+            memset(info.value[0].iov_base, 0xaa, info.value[0].iov_len);
+        }
+
+        uint64_t cas = 0;
+        const auto stored = engine->store(handle, cookie, it, &cas,
+                                          OPERATION_SET, 0);
+        engine->release(handle, cookie, it);
+        if (stored != ENGINE_SUCCESS) {
+            break;
+        }
+
+        it = nullptr;
+        if (engine->get(handle, cookie, &it, key, nkey, 0) ==
+            ENGINE_SUCCESS) {
+            engine->release(handle, cookie, it);
+        }
+
+        mutation_descr_t mut_info;
+        cas = 0;
+        engine->remove(handle, cookie, key, size_t(nkey), &cas, 0, &mut_info);
+        ++completed;
+    }
+
+    LOG_NOTICE(&connection,
+               "%u - Bucket [%s] warmup: %d/%d synthetic op cycles in %lu us",
+               connection.getId(), bucket.name, completed, ops,
+               (unsigned long)((gethrtime() - start) / 1000));
+}
+
 void CreateBucketThread::create() {
     LOG_NOTICE(&connection, "%u Create bucket [%s]",
                connection.getId(), name.c_str());
@@ -1961,20 +2370,17 @@ void CreateBucketThread::create() {
         result = ENGINE_SUCCESS;
         ii = first_free;
         /*
-         * split the creation of the bucket in two... so
-         * we can release the global lock..
+         * Reserve the slot (and the name) while holding the global
+         * lock. Once the state leaves None nobody else will touch
+         * the slot, so everything else - including the allocations
+         * below and the (potentially very slow) engine creation and
+         * warmup - runs without blocking creation or deletion of
+         * other buckets.
          */
         cb_mutex_enter(&all_buckets[ii].mutex);
         all_buckets[ii].state = BucketState::Creating;
         all_buckets[ii].type = type;
         strcpy(all_buckets[ii].name, name.c_str());
-        try {
-            all_buckets[ii].topkeys = new TopKeys(settings.getTopkeysSize());
-        } catch (const std::bad_alloc &) {
-            result = ENGINE_ENOMEM;
-            LOG_WARNING(&connection,
-                        "%u Create bucket [%s] failed - out of memory",
-                        connection.getId(), name.c_str());        }
         cb_mutex_exit(&all_buckets[ii].mutex);
     }
     cb_mutex_exit(&buckets_lock);
@@ -1985,6 +2391,37 @@ void CreateBucketThread::create() {
 
     auto &bucket = all_buckets[ii];
 
+    try {
+        /* Topkeys tracking is per bucket: the new bucket inherits the
+         * global default budget (0 = disabled) and can be enabled,
+         * resized or disabled at runtime over ioctl
+         * (bucket.topkeys.size). */
+        bucket_set_topkeys_budget(bucket, settings.getTopkeysSize());
+        /* A reused bucket slot should start with a cold stats cache */
+        bucket.stats_snapshot.invalidate();
+        bucket.topkeys_json_snapshot.invalidate();
+        bucket.nmvb_map_snapshot.invalidate();
+    } catch (const std::bad_alloc &) {
+        LOG_WARNING(&connection,
+                    "%u Create bucket [%s] failed - out of memory",
+                    connection.getId(), name.c_str());
+        /* Release the slot again */
+        cb_mutex_enter(&bucket.mutex);
+        bucket.state = BucketState::None;
+        bucket.name[0] = '\0';
+        cb_mutex_exit(&bucket.mutex);
+        result = ENGINE_ENOMEM;
+        return;
+    }
+
+    /* Give the bucket a dedicated allocator arena (0 when the
+     * allocator doesn't support arenas) and keep the creating thread
+     * bound to it for the rest of the function, so the engine
+     * creation and warmup allocate from the bucket's own arena.
+     */
+    bucket.arena = AllocHooks::arena_create();
+    ScopedBucketArena arenaGuard(ii);
+
     /* People aren't allowed to use the engine in this state,
      * so we can do stuff without locking..
      */
@@ -2010,9 +2447,17 @@ void CreateBucketThread::create() {
         }
 
         if (result == ENGINE_SUCCESS) {
+            /* Exercise the serving paths of the fresh engine while
+             * nobody can see the bucket yet */
+            warmup_bucket_engine(connection, bucket);
             cb_mutex_enter(&bucket.mutex);
             bucket.state = BucketState::Ready;
             cb_mutex_exit(&bucket.mutex);
+            /* Make the bucket visible to the lock free lookup in
+             * associate_bucket() */
+            publish_bucket_index_map();
+            /* ... and name its record in the statistics segment */
+            stats_shm_bind(size_t(ii), name.c_str());
             LOG_NOTICE(&connection,
                         "%u - Bucket [%s] created successfully",
                         connection.getId(), name.c_str());
@@ -2026,8 +2471,9 @@ void CreateBucketThread::create() {
             bucket.state = BucketState::None;
             bucket.name[0] = '\0';
             bucket.engine = nullptr;
-            delete bucket.topkeys;
-            bucket.topkeys = nullptr;
+            bucket_destroy_topkeys(bucket);
+            AllocHooks::arena_destroy(bucket.arena);
+            bucket.arena = 0;
             cb_mutex_exit(&bucket.mutex);
 
             result = ENGINE_NOT_STORED;
@@ -2037,8 +2483,9 @@ void CreateBucketThread::create() {
         bucket.state = BucketState::None;
         bucket.name[0] = '\0';
         bucket.engine = nullptr;
-        delete bucket.topkeys;
-        bucket.topkeys = nullptr;
+        bucket_destroy_topkeys(bucket);
+        AllocHooks::arena_destroy(bucket.arena);
+        bucket.arena = 0;
         cb_mutex_exit(&bucket.mutex);
 
         LOG_WARNING(&connection,
@@ -2076,7 +2523,6 @@ void notify_thread_bucket_deletion(LIBEVENT_THREAD *me) {
 
 void DestroyBucketThread::destroy() {
     ENGINE_ERROR_CODE ret = ENGINE_KEY_ENOENT;
-    cb_mutex_enter(&buckets_lock);
 
     /*
      * The destroy function will have access to a connection if the
@@ -2089,6 +2535,14 @@ void DestroyBucketThread::destroy() {
             ? "<none>"
             : std::to_string(connection->getId())};
 
+    /*
+     * Find the bucket and claim it by moving it from Ready to
+     * Destroying. The per-bucket mutex is all we need for that to be
+     * race free (a concurrent deletion of the same bucket will find
+     * the state already changed, and a concurrent creation can't
+     * reuse the slot before the state returns to None), so deleting
+     * a bucket never blocks creation or deletion of other buckets.
+     */
     int idx = 0;
     for (int ii = 0; ii < settings.getMaxBuckets(); ++ii) {
         cb_mutex_enter(&all_buckets[ii].mutex);
@@ -2106,7 +2560,6 @@ void DestroyBucketThread::destroy() {
             break;
         }
     }
-    cb_mutex_exit(&buckets_lock);
 
     if (ret != ENGINE_SUCCESS) {
         auto code = engine_error_2_mcbp_protocol_error(ret);
@@ -2117,6 +2570,11 @@ void DestroyBucketThread::destroy() {
         return;
     }
 
+    /* Drop the bucket from the lookup snapshot. Readers holding an
+     * older snapshot may still find it, but they will re-validate the
+     * state after registering and back out again. */
+    publish_bucket_index_map();
+
     LOG_NOTICE(connection, "%s Delete bucket [%s]. Notifying all registered "
             "ON_DELETE_BUCKET callbacks", connection_id.c_str(), name.c_str());
 
@@ -2138,7 +2596,8 @@ void DestroyBucketThread::destroy() {
     while (all_buckets[idx].clients > 0) {
         LOG_NOTICE(connection,
                    "%u Delete bucket [%s]. Still waiting: %u clients connected",
-                   connection_id.c_str(), name.c_str(), all_buckets[idx].clients);
+                   connection_id.c_str(), name.c_str(),
+                   all_buckets[idx].clients.load());
         /* drop the lock and notify the worker threads */
         cb_mutex_exit(&all_buckets[idx].mutex);
         threads_notify_bucket_deletion();
@@ -2177,9 +2636,16 @@ void DestroyBucketThread::destroy() {
                connection_id.c_str(), name.c_str());
 
     /* Clean up the stats... */
-    delete[]all_buckets[idx].stats;
-    int numthread = settings.getNumWorkerThreads() + 1;
-    all_buckets[idx].stats = new thread_stats[numthread];
+    if (stats_shm_enabled()) {
+        /* The counters live in the shared-memory segment; release the
+         * record (which zeroes its slices under the record seqlock)
+         * instead of reallocating */
+        stats_shm_unbind(idx);
+    } else {
+        delete[]all_buckets[idx].stats;
+        int numthread = settings.getNumWorkerThreads() + 1;
+        all_buckets[idx].stats = new thread_stats[numthread];
+    }
 
     // Clear any registered event handlers
     for (auto& handler : all_buckets[idx].engine_event_handlers) {
@@ -2190,11 +2656,24 @@ void DestroyBucketThread::destroy() {
     all_buckets[idx].state = BucketState::None;
     all_buckets[idx].engine = NULL;
     all_buckets[idx].name[0] = '\0';
-    delete all_buckets[idx].topkeys;
-    all_buckets[idx].topkeys = nullptr;
+    bucket_destroy_topkeys(all_buckets[idx]);
+    /* Purge the bucket's arena so its memory is handed back to the
+     * OS, and recycle the arena index */
+    AllocHooks::arena_destroy(all_buckets[idx].arena);
+    all_buckets[idx].arena = 0;
     cb_mutex_exit(&all_buckets[idx].mutex);
     // don't need lock because all timing data uses atomics
     all_buckets[idx].timings.reset();
+    /* A recycled slot shouldn't inherit the old tenant's throttle
+     * (nor its opcode filter) */
+    all_buckets[idx].ops_throttle.reset();
+    all_buckets[idx].bytes_throttle.reset();
+    all_buckets[idx].throttle_events.reset();
+    all_buckets[idx].opcode_filter.allowAll();
+    all_buckets[idx].rejected_ops.reset();
+    /* ... nor its stats baseline (the thread_stats array above is
+     * brand new, so the baseline must go back to zero with it) */
+    all_buckets[idx].stats_baseline.reset();
 
     LOG_NOTICE(connection, "%s Delete bucket [%s] complete",
                connection_id.c_str(), name.c_str());
@@ -2213,8 +2692,14 @@ static void initialize_buckets(void) {
     all_buckets.resize(settings.getMaxBuckets());
 
     int numthread = settings.getNumWorkerThreads() + 1;
-    for (auto &b : all_buckets) {
-        b.stats = new thread_stats[numthread];
+    for (int ii = 0; ii < settings.getMaxBuckets(); ++ii) {
+        /* With the shared-memory statistics segment enabled the
+         * counters live inside the mapping (so scrapers read them in
+         * place); otherwise they go on the heap as before */
+        all_buckets[ii].stats = stats_shm_thread_stats(size_t(ii));
+        if (all_buckets[ii].stats == nullptr) {
+            all_buckets[ii].stats = new thread_stats[numthread];
+        }
     }
 
     // To make the life easier for us in the code, index 0
@@ -2230,6 +2715,15 @@ static void initialize_buckets(void) {
     nobucket.type = BucketType::NoBucket;
     nobucket.state = BucketState::Ready;
     nobucket.engine = (ENGINE_HANDLE_V1*)handle;
+
+    /* Install the initial (empty) bucket lookup snapshot. The
+     * "no bucket" is deliberately not part of the map; it is reached
+     * through the fallback in associate_bucket(). */
+    publish_bucket_index_map();
+
+    /* Record 0 in the statistics segment is the "no bucket" and is
+     * always bound (with an empty name) */
+    stats_shm_bind(0, "");
 }
 
 static void cleanup_buckets(void) {
@@ -2258,10 +2752,12 @@ static void cleanup_buckets(void) {
 
         if (bucket.state == BucketState::Ready) {
             bucket.engine->destroy(v1_handle_2_handle(bucket.engine), false);
-            delete bucket.topkeys;
+            bucket_destroy_topkeys(bucket);
         }
 
-        delete []bucket.stats;
+        if (!stats_shm_enabled()) {
+            delete []bucket.stats;
+        }
     }
 }
 
@@ -2566,6 +3062,49 @@ static void initialize_sasl() {
     }
 }
 
+/**
+ * Wall-clock duration of each named startup phase, reported in one log
+ * line once the server is about to go online. Rolling restarts care
+ * about the time to first accept, so a regression in any phase should
+ * be visible in the log rather than needing a profiler.
+ */
+class StartupTimings {
+public:
+    /** Record a phase that was timed externally (e.g. on another thread) */
+    void record(const char* name, hrtime_t duration) {
+        timings.emplace_back(name, duration);
+    }
+
+    /** Run (and time) the given startup phase */
+    template <typename Func>
+    void time(const char* name, Func func) {
+        const hrtime_t start = gethrtime();
+        func();
+        record(name, gethrtime() - start);
+    }
+
+    /** Log the collected phases and their sum */
+    void log(void) {
+        std::string report;
+        hrtime_t total = 0;
+        char entry[80];
+        for (const auto& timing : timings) {
+            total += timing.second;
+            checked_snprintf(entry, sizeof(entry), "%s: %lu ms, ",
+                             timing.first,
+                             (unsigned long)(timing.second / 1000000));
+            report.append(entry);
+        }
+        settings.extensions.logger->log(EXTENSION_LOG_INFO, NULL,
+                                        "Startup phase timings: %stotal: "
+                                            "%lu ms", report.c_str(),
+                                        (unsigned long)(total / 1000000));
+    }
+
+private:
+    std::vector<std::pair<const char*, hrtime_t>> timings;
+};
+
 extern "C" int memcached_main(int argc, char **argv) {
     // MB-14649 log() crash on windows on some CPU's
 #ifdef _WIN64
@@ -2592,16 +3131,19 @@ extern "C" int memcached_main(int argc, char **argv) {
     }
 #endif
 
+    StartupTimings startup_timings;
+
     install_backtrace_terminate_handler(settings.extensions.logger);
 
     setup_libevent_locking();
 
-    initialize_openssl();
+    startup_timings.time("ssl", initialize_openssl);
 
     /* Initialize the socket subsystem */
     cb_initialize_sockets();
 
     AllocHooks::initialize();
+    AllocDomain::initialize();
 
     /* init settings */
     settings_init();
@@ -2628,8 +3170,26 @@ extern "C" int memcached_main(int argc, char **argv) {
     /* Initialize breakpad crash catcher with our just-parsed settings. */
     initialize_breakpad(settings.getBreakpadSettings());
 
+    /* Freeze the A/B experiment arm-assignment table before any
+     * connection can be accepted. */
+    try {
+        initialize_experiments();
+    } catch (std::exception& exception) {
+        FATAL_ERROR(EXIT_FAILURE, "Failed initialize server: %s",
+                    exception.what());
+    }
+
+    /* Open (record) or load (replay) the scheduling trace before any
+     * connection can be accepted. */
+    try {
+        initialize_sched_trace();
+    } catch (std::exception& exception) {
+        FATAL_ERROR(EXIT_FAILURE, "Failed initialize server: %s",
+                    exception.what());
+    }
+
     /* load extensions specified in the settings */
-    load_extensions();
+    startup_timings.time("extensions", load_extensions);
 
     /* Logging available now extensions have been loaded. */
     LOG_NOTICE(NULL, "Couchbase version %s starting.", get_server_version());
@@ -2656,7 +3216,33 @@ extern "C" int memcached_main(int argc, char **argv) {
     }
 #endif
 
-    initialize_audit();
+    /*
+     * The engine map (dlopen and symbol resolution of every engine
+     * module) and SASL (reading the password database) are the slow,
+     * mutually independent pieces of early startup; run them on their
+     * own threads so this stage is bounded by the slowest of them
+     * instead of their sum, while the main thread takes care of the
+     * cheap bits. An engine map failure is reported after the join;
+     * audit startup is deferred until the listening sockets exist
+     * (see below).
+     */
+    char* engine_map_errmsg = nullptr;
+    bool engine_map_ok = false;
+    hrtime_t engine_map_duration = 0;
+    std::thread engine_map_thread([&engine_map_errmsg, &engine_map_ok,
+                                   &engine_map_duration] {
+        const hrtime_t start = gethrtime();
+        engine_map_ok = initialize_engine_map(&engine_map_errmsg,
+                                              settings.extensions.logger);
+        engine_map_duration = gethrtime() - start;
+    });
+
+    hrtime_t sasl_duration = 0;
+    std::thread sasl_thread([&sasl_duration] {
+        const hrtime_t start = gethrtime();
+        initialize_sasl();
+        sasl_duration = gethrtime() - start;
+    });
 
     /* inform interested parties of initial verbosity level */
     perform_callbacks(ON_LOG_LEVEL, NULL, NULL);
@@ -2666,19 +3252,6 @@ extern "C" int memcached_main(int argc, char **argv) {
     /* Aggregate the maximum number of connections */
     settings.calculateMaxconns();
 
-    {
-        char *errmsg;
-        if (!initialize_engine_map(&errmsg, settings.extensions.logger)) {
-            FATAL_ERROR(EXIT_FAILURE, "Unable to initialize engine "
-                        "map: %s", errmsg);
-        }
-    }
-
-    /* Initialize bucket engine */
-    initialize_buckets();
-
-    initialize_sasl();
-
     /* initialize main thread libevent instance */
     main_base = event_base_new();
 
@@ -2700,8 +3273,49 @@ extern "C" int memcached_main(int argc, char **argv) {
     }
 #endif
 
+    engine_map_thread.join();
+    if (!engine_map_ok) {
+        FATAL_ERROR(EXIT_FAILURE, "Unable to initialize engine "
+                    "map: %s", engine_map_errmsg);
+    }
+    startup_timings.record("engine map", engine_map_duration);
+
+    /* Page the engine module text in up front (optionally locking it
+     * into memory) so the first commands after the restart don't
+     * stall on major faults */
+    if (settings.getEngineModuleWarming() != "off") {
+        startup_timings.time("module warming", [] {
+            warm_engine_modules(settings.getEngineModuleWarming() == "lock",
+                                settings.extensions.logger);
+        });
+    }
+
+    /* Map the shared-memory statistics segment (if configured) before
+     * the buckets are created, since their counter arrays are placed
+     * inside it. Failure just falls back to heap allocated stats. */
+    if (!settings.getStatsShmPath().empty()) {
+        stats_shm_init(settings.getStatsShmPath(),
+                       size_t(settings.getMaxBuckets()),
+                       size_t(settings.getNumWorkerThreads() + 1));
+    }
+
+    /* Initialize bucket engine (requires the engine map) */
+    startup_timings.time("buckets", initialize_buckets);
+
+    sasl_thread.join();
+    startup_timings.record("sasl", sasl_duration);
+
     /* start up worker threads if MT mode */
-    thread_init(settings.getNumWorkerThreads(), main_base, dispatch_event_handler);
+    startup_timings.time("worker threads", [] {
+        thread_init(settings.getNumWorkerThreads(), main_base,
+                    dispatch_event_handler);
+    });
+
+    /* Replicate the immutable dispatch tables per NUMA node now that
+     * thread_init() has counted the nodes; the workers are running
+     * but can't serve traffic until the listening sockets open
+     * below. */
+    mcbp_publish_numa_replicas();
 
     executorPool.reset(new ExecutorPool(size_t(settings.getNumWorkerThreads())));
 
@@ -2716,12 +3330,22 @@ extern "C" int memcached_main(int argc, char **argv) {
     mc_time_init(main_base);
 
     /* create the listening socket, bind it, and init */
-    create_listen_sockets(true);
+    startup_timings.time("interfaces", [] { create_listen_sockets(true); });
 
     /* Optional parent monitor */
     setup_parent_monitor();
 
+    /*
+     * The audit daemon isn't needed to serve traffic, so it is brought
+     * up after the listening sockets exist - the kernel accepts
+     * connections while audit reads its configuration, and nothing
+     * generates audit events until the event loop below starts
+     * dispatching commands.
+     */
+    startup_timings.time("audit", initialize_audit);
+
     if (!memcached_shutdown) {
+        startup_timings.log();
         /* enter the event loop */
         if (settings.isRequireInit()) {
             LOG_NOTICE(nullptr,
@@ -2752,6 +3376,7 @@ extern "C" int memcached_main(int argc, char **argv) {
 
     LOG_NOTICE(NULL, "Releasing bucket resources");
     cleanup_buckets();
+    stats_shm_shutdown();
 
     LOG_NOTICE(NULL, "Releasing thread resources");
     threads_cleanup();
@@ -2759,6 +3384,9 @@ extern "C" int memcached_main(int argc, char **argv) {
     LOG_NOTICE(nullptr, "Shutting down executor pool");
     delete executorPool.release();
 
+    LOG_NOTICE(NULL, "Closing scheduling trace");
+    shutdown_sched_trace();
+
     LOG_NOTICE(NULL, "Releasing signal handlers");
     release_signal_handlers();
 
@@ -2774,6 +3402,9 @@ extern "C" int memcached_main(int argc, char **argv) {
     LOG_NOTICE(NULL, "Shutting down engine map");
     shutdown_engine_map();
 
+    LOG_NOTICE(NULL, "Releasing cached engine modules");
+    shutdown_engine_loader();
+
     LOG_NOTICE(NULL, "Removing breakpad");
     destroy_breakpad();
 
@@ -2781,6 +3412,7 @@ extern "C" int memcached_main(int argc, char **argv) {
     free_callbacks();
 
     LOG_NOTICE(NULL, "Shutting down OpenSSL");
+    invalidate_ssl_server_ctx_cache();
     shutdown_openssl();
 
     LOG_NOTICE(NULL, "Shutting down libevent");
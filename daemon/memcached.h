@@ -19,8 +19,8 @@
 #include <memcached/protocol_binary.h>
 #include <memcached/engine.h>
 #include <memcached/extension.h>
-#include <JSON_checker.h>
 
+#include "alloc_domain.h"
 #include "dynamic_buffer.h"
 #include "executorpool.h"
 #include "log_macros.h"
@@ -31,7 +31,15 @@
 #define KEY_MAX_LENGTH 250
 
 #define DATA_BUFFER_SIZE 2048
-#define UDP_MAX_PAYLOAD_SIZE 1400
+
+/**
+ * While corking responses, stop accumulating and flush once less than
+ * this many bytes of the write buffer remain for staging. It must cover
+ * the largest amount of data a single response stages in the write
+ * buffer: a response header plus up to KEY_MAX_LENGTH bytes (a GETK
+ * miss echoes the key right behind the header).
+ */
+#define CORK_BUFFER_RESERVED 320
 #define MAX_SENDBUF_SIZE (256 * 1024 * 1024)
 
 /** Initial size of list of items being returned by "get". */
@@ -60,6 +68,25 @@
 
 #define MAX_VERBOSITY_LEVEL 2
 
+/* Maximum number of spare network buffers each worker thread keeps around
+ * to loan to connections as they go active; see conn_loan_buffers(). Only
+ * default sized buffers are pooled, so a thread holds at most
+ * BUFFER_POOL_DEPTH * DATA_BUFFER_SIZE bytes per direction in spares.
+ */
+#define BUFFER_POOL_DEPTH 8
+
+/**
+ * A small LIFO pool of spare network buffers owned by a worker thread.
+ * Buffers are pushed here when an idle connection returns its (clean)
+ * read/write buffer and popped when a connection goes active again,
+ * keeping buffer memory proportional to the number of active - rather
+ * than connected - clients.
+ */
+struct net_buf_pool {
+    struct net_buf bufs[BUFFER_POOL_DEPTH]; /* spare buffers, LIFO order */
+    int count; /* number of valid entries in bufs */
+};
+
 extern struct stats stats;
 
 enum class ThreadType {
@@ -70,23 +97,76 @@ enum class ThreadType {
 
 class Connection;
 class ConnectionQueue;
+class ConnectionTimerWheel;
+struct thread_conn_registry;
 
 struct LIBEVENT_THREAD {
     cb_thread_t thread_id;      /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
     struct event notify_event;  /* listen event for notify pipe */
-    SOCKET notify[2];           /* notification pipes */
+    SOCKET notify[2];           /* notification pipes (when the channel is
+                                   an eventfd both entries hold the same
+                                   descriptor) */
+    bool notify_is_eventfd;     /* is the notification channel an eventfd? */
     ConnectionQueue *new_conn_queue; /* queue of new connections to handle */
+    ConnectionTimerWheel *timer_wheel; /* hashed timer wheel driving the
+                                          idle-connection timeouts for the
+                                          connections owned by this thread */
+    thread_conn_registry *conn_registry; /* dense slot array of the
+                                            connections owned by this
+                                            thread, so per-thread
+                                            maintenance walks (bucket
+                                            deletion signalling) scan one
+                                            small array instead of the
+                                            global list. See
+                                            connections.cc. */
     cb_mutex_t mutex;      /* Mutex to lock protect access to the pending_io */
     bool is_locked;
     Connection *pending_io;    /* List of connection with pending async io ops */
+    Connection *listen_conn;   /* List of sharded (SO_REUSEPORT) listening
+                                  connections owned by this thread; empty
+                                  unless listener sharding is enabled. See
+                                  create_worker_listen_sockets(). */
     int index;                  /* index of this thread in the threads array */
+    int numa_node;              /* NUMA node the thread is pinned to, or -1
+                                   when thread affinity is disabled (or the
+                                   topology is unknown) */
+    uint64_t ops;               /* Number of operations executed by this
+                                   thread. Only the owning thread updates it;
+                                   the rebalancer on the other workers reads
+                                   it without locking (it is just a load
+                                   heuristic, so stale values are fine) */
+    uint64_t ops_last_check;    /* Value of 'ops' the last time this thread
+                                   looked for load skew */
+    int busy_poll_conns;        /* Number of connections bound to this thread
+                                   whose interface enables busy polling. Only
+                                   touched by the owning thread. */
+    uint64_t event_dispatches;  /* Number of callbacks dispatched on this
+                                   thread's event base; the busy poll loop in
+                                   worker_libevent() compares it before and
+                                   after a non-blocking poll to detect
+                                   activity */
+
+    /* Event-loop health counters, exposed through "stats worker".
+     * Like 'ops' they have a single writer (the owning thread) and are
+     * read without locking by the stats code; stale values are fine. */
+    uint64_t loop_iterations;   /* notification callbacks processed */
+    uint64_t loop_ns_total;     /* total time spent inside the callback */
+    uint64_t loop_ns_max;       /* slowest single callback */
+    uint64_t loop_slow;         /* callbacks which took longer than 10ms
+                                   (everything else on the loop starved
+                                   for that long) */
+    uint64_t new_conn_total;    /* new connections dispatched */
+    uint64_t pending_io_total;  /* connections drained from pending_io */
+    uint64_t pending_io_max;    /* largest pending_io batch */
     ThreadType type;      /* Type of IO this thread processes */
 
     rel_time_t last_checked;
 
-    struct net_buf read; /** Shared read buffer for all connections serviced by this thread. */
-    struct net_buf write; /** Shared write buffer for all connections serviced by this thread. */
+    struct net_buf_pool read; /** Pool of spare read buffers for the
+                                  connections serviced by this thread. */
+    struct net_buf_pool write; /** Pool of spare write buffers for the
+                                   connections serviced by this thread. */
 
     subdoc_OPERATION* subdoc_op; /** Shared sub-document operation for all
                                      connections serviced by this thread. */
@@ -102,7 +182,13 @@ struct LIBEVENT_THREAD {
      */
     int deleting_buckets;
 
-    JSON_checker::Validator *validator;
+    /**
+     * Set (under the thread lock) by the accept path when the server
+     * is running out of connection slots; the owning thread picks up
+     * the flag on its next notification and sheds its longest-idle
+     * sheddable connection to make room for new clients.
+     */
+    bool shed_request;
 };
 
 #define LOCK_THREAD(t) \
@@ -118,6 +204,7 @@ struct LIBEVENT_THREAD {
 extern void notify_thread(LIBEVENT_THREAD *thread);
 extern void notify_dispatcher(void);
 extern bool create_notification_pipe(LIBEVENT_THREAD *me);
+extern bool create_notification_channel(LIBEVENT_THREAD *me);
 
 #include "connection.h"
 #include "connection_greenstack.h"
@@ -160,14 +247,25 @@ void threads_cleanup(void);
 
 void dispatch_conn_new(SOCKET sfd, int parent_port);
 
+/**
+ * Check if the worker thread owning the connection is overloaded
+ * compared to the other workers, and if so hand the connection over to
+ * the least loaded one. Only quiescent connections are moved (see
+ * McbpConnection::isMigratable), and only when the connection_rebalance
+ * setting is enabled. The owning thread's lock must be held (the
+ * check runs as part of the event loop of the owning thread).
+ */
+void maybe_migrate_connection(Connection* c);
+
 /* Lock wrappers for cache functions that are called from main loop. */
 int is_listen_thread(void);
 
 void STATS_LOCK(void);
 void STATS_UNLOCK(void);
-void threadlocal_stats_reset(struct thread_stats *thread_stats);
 
 void notify_io_complete(const void *cookie, ENGINE_ERROR_CODE status);
+void notify_io_complete_batch(const void* const* cookies, size_t count,
+                              ENGINE_ERROR_CODE status);
 void safe_close(SOCKET sfd);
 
 
@@ -182,6 +280,16 @@ int add_conn_to_pending_io_list(Connection *c);
 /* connection state machine */
 bool conn_listening(ListenConnection *c);
 
+/**
+ * Create the sharded (SO_REUSEPORT) listening sockets owned by the given
+ * worker thread; one per user interface with a fixed port number. Called
+ * from thread_init() before the worker's event loop is started (it is
+ * not safe to register events on the base once the loop is running).
+ * No-op unless the "reuseport_listeners" setting is enabled and the
+ * platform supports SO_REUSEPORT.
+ */
+void create_worker_listen_sockets(LIBEVENT_THREAD* thread);
+
 void event_handler(evutil_socket_t fd, short which, void *arg);
 void listen_event_handler(evutil_socket_t, short, void *);
 
@@ -224,6 +332,38 @@ void threads_notify_bucket_deletion(void);
 void threads_complete_bucket_deletion(void);
 void threads_initiate_bucket_deletion(void);
 
+/**
+ * Wake up all worker threads so that they advance their timer wheels
+ * (disconnecting clients which have been idle for too long). Called
+ * once a second from the clock handler in mc_time.cc.
+ */
+void threads_notify_clock_tick(void);
+
+/**
+ * Ask every worker thread to disconnect its longest-idle sheddable
+ * connection. Called from the accept path when the number of
+ * connections eats into the configured headroom
+ * (settings.connection_shed_headroom) below the connection limit.
+ */
+void threads_request_connection_shed(void);
+
+/**
+ * Copy the thread ids of the worker threads into the provided array
+ * (used by the sampling profiler to know who to interrupt).
+ *
+ * @param ids where to store the thread ids
+ * @param max the capacity of the array
+ * @return the number of ids stored (0 until thread_init() has run)
+ */
+size_t threads_get_thread_ids(cb_thread_t* ids, size_t max);
+
+/**
+ * Emit the per-worker event-loop health counters (one set of stats
+ * per worker thread, keys prefixed with the thread index). Used by
+ * the "stats worker" group.
+ */
+void threads_worker_stats(ADD_STAT add_stat_callback, const void* cookie);
+
 // This should probably go in a network-helper file..
 #ifdef WIN32
 #define GetLastNetworkError() WSAGetLastError()
@@ -285,19 +425,53 @@ bool cookie_is_admin(const void *cookie);
 bool is_listen_disabled(void);
 uint64_t get_listen_disabled_num(void);
 
+/**
+ * Start draining the server ahead of a planned restart: stop accepting
+ * new clients and disconnect the connected ones at their next command
+ * boundary (admin connections are exempt so the drain can be
+ * monitored over one). Connections still around when the grace period
+ * expires are disconnected regardless of state. Initiating a drain
+ * again just moves the deadline.
+ *
+ * @param grace the number of seconds before remaining connections are
+ *              forcibly shut down
+ */
+void initiate_drain(rel_time_t grace);
+
+/** Is an ioctl-initiated drain in progress? */
+bool is_draining(void);
+
+/** The time the current drain forcibly disconnects what is left */
+rel_time_t get_drain_deadline(void);
+
 ENGINE_ERROR_CODE refresh_cbsasl(Connection *c);
 ENGINE_ERROR_CODE refresh_ssl_certs(Connection *c);
 
 
 
-/* Wrap the engine interface ! */
+/* Wrap the engine interface !
+ *
+ * The data-path wrappers (get/store/allocate/unknown_command) also
+ * account the time spent inside the engine on the connection so that
+ * mcbp_collect_timings can split the duration of a command into engine
+ * time and daemon time, tag the call with the Engine allocation
+ * domain so that the memory the engine allocates (or releases) is
+ * attributed to the bucket (see alloc_domain.h), and bind the calling
+ * thread to the bucket's allocator arena (see Bucket::arena).
+ */
 
 static inline ENGINE_ERROR_CODE bucket_unknown_command(McbpConnection* c,
                                                        protocol_binary_request_header* request,
                                                        ADD_RESPONSE response) {
-    return c->getBucketEngine()->unknown_command(c->getBucketEngineAsV0(),
-                                                 c->getCookie(),
-                                                 request, response);
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
+    const hrtime_t enter = gethrtime();
+    auto ret = c->getBucketEngine()->unknown_command(c->getBucketEngineAsV0(),
+                                                     c->getCookie(),
+                                                     request, response);
+    c->accountEngineTime(gethrtime() - enter);
+    return ret;
 }
 
 static inline void bucket_item_set_cas(McbpConnection* c, item* it, uint64_t cas) {
@@ -334,8 +508,98 @@ static inline ENGINE_ERROR_CODE bucket_store(McbpConnection* c,
                                              uint64_t* cas,
                                              ENGINE_STORE_OPERATION operation,
                                              uint16_t vbucket) {
-    return c->getBucketEngine()->store(c->getBucketEngineAsV0(), c->getCookie(),
-                                       item_, cas, operation, vbucket);
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
+    const hrtime_t enter = gethrtime();
+    auto ret = c->getBucketEngine()->store(c->getBucketEngineAsV0(),
+                                           c->getCookie(),
+                                           item_, cas, operation, vbucket);
+    c->accountEngineTime(gethrtime() - enter);
+    return ret;
+}
+
+static inline ENGINE_ERROR_CODE bucket_append(McbpConnection* c,
+                                              const void* key,
+                                              size_t nkey,
+                                              const void* data,
+                                              size_t ndata,
+                                              uint64_t* cas,
+                                              bool prepend,
+                                              uint16_t vbucket) {
+    auto* engine = c->getBucketEngine();
+    if (engine->append == nullptr) {
+        return ENGINE_ENOTSUP;
+    }
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
+    const hrtime_t enter = gethrtime();
+    auto ret = engine->append(c->getBucketEngineAsV0(), c->getCookie(),
+                              key, nkey, data, ndata, cas, prepend, vbucket);
+    c->accountEngineTime(gethrtime() - enter);
+    return ret;
+}
+
+static inline ENGINE_ERROR_CODE bucket_patch(McbpConnection* c,
+                                             const void* key,
+                                             size_t nkey,
+                                             const void* data,
+                                             size_t ndata,
+                                             uint32_t offset,
+                                             uint64_t* cas,
+                                             uint16_t vbucket) {
+    auto* engine = c->getBucketEngine();
+    if (engine->patch == nullptr) {
+        return ENGINE_ENOTSUP;
+    }
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
+    const hrtime_t enter = gethrtime();
+    auto ret = engine->patch(c->getBucketEngineAsV0(), c->getCookie(),
+                             key, nkey, data, ndata, offset, cas, vbucket);
+    c->accountEngineTime(gethrtime() - enter);
+    return ret;
+}
+
+static inline ENGINE_ERROR_CODE bucket_get_multi(McbpConnection* c,
+                                                 item_get_entry* entries,
+                                                 size_t count,
+                                                 uint16_t vbucket) {
+    auto* engine = c->getBucketEngine();
+    if (engine->get_multi == nullptr) {
+        return ENGINE_ENOTSUP;
+    }
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
+    const hrtime_t enter = gethrtime();
+    auto ret = engine->get_multi(c->getBucketEngineAsV0(), c->getCookie(),
+                                 entries, count, vbucket);
+    c->accountEngineTime(gethrtime() - enter);
+    return ret;
+}
+
+static inline ENGINE_ERROR_CODE bucket_get_copy(McbpConnection* c,
+                                                const void* key,
+                                                size_t nkey,
+                                                void* buffer,
+                                                size_t buffsize,
+                                                item_info* info,
+                                                uint16_t vbucket) {
+    auto* engine = c->getBucketEngine();
+    if (engine->get_copy == nullptr) {
+        return ENGINE_ENOTSUP;
+    }
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
+    const hrtime_t enter = gethrtime();
+    auto ret = engine->get_copy(c->getBucketEngineAsV0(), c->getCookie(),
+                                key, nkey, buffer, buffsize, info, vbucket);
+    c->accountEngineTime(gethrtime() - enter);
+    return ret;
 }
 
 static inline ENGINE_ERROR_CODE bucket_get(McbpConnection* c,
@@ -343,11 +607,21 @@ static inline ENGINE_ERROR_CODE bucket_get(McbpConnection* c,
                                            const void* key,
                                            const int nkey,
                                            uint16_t vbucket) {
-    return c->getBucketEngine()->get(c->getBucketEngineAsV0(), c->getCookie(),
-                                     item_, key, nkey, vbucket);
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
+    const hrtime_t enter = gethrtime();
+    auto ret = c->getBucketEngine()->get(c->getBucketEngineAsV0(),
+                                         c->getCookie(),
+                                         item_, key, nkey, vbucket);
+    c->accountEngineTime(gethrtime() - enter);
+    return ret;
 }
 
 static inline void bucket_release_item(McbpConnection* c, item* it) {
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
     c->getBucketEngine()->release(c->getBucketEngineAsV0(),
                                   c->getCookie(), it);
 }
@@ -360,9 +634,16 @@ static inline ENGINE_ERROR_CODE bucket_allocate(McbpConnection* c,
                                                 const int flags,
                                                 const rel_time_t exptime,
                                                 uint8_t datatype) {
-    return c->getBucketEngine()->allocate(c->getBucketEngineAsV0(),
-                                          c->getCookie(), it, key, nkey,
-                                          nbytes, flags, exptime, datatype);
+    ScopedAllocDomain domain(AllocationDomain::Engine,
+                             size_t(c->getBucketIndex()));
+    ScopedBucketArena arena(size_t(c->getBucketIndex()));
+    const hrtime_t enter = gethrtime();
+    auto ret = c->getBucketEngine()->allocate(c->getBucketEngineAsV0(),
+                                              c->getCookie(), it, key, nkey,
+                                              nbytes, flags, exptime,
+                                              datatype);
+    c->accountEngineTime(gethrtime() - enter);
+    return ret;
 }
 
 /**
@@ -0,0 +1,63 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "numa_replicas.h"
+
+#include <platform/cb_malloc.h>
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+static size_t node_count = 1;
+static thread_local int local_node = 0;
+
+void numa_replicas_set_node_count(size_t count) {
+    if (count < 1) {
+        count = 1;
+    } else if (count > MAX_NUMA_REPLICAS) {
+        count = MAX_NUMA_REPLICAS;
+    }
+    node_count = count;
+}
+
+size_t numa_replicas_node_count(void) {
+    return node_count;
+}
+
+void numa_replicas_set_local_node(int node) {
+    if (node < 0 || node >= MAX_NUMA_REPLICAS) {
+        node = 0;
+    }
+    local_node = node;
+}
+
+int numa_replicas_local_node(void) {
+    return local_node;
+}
+
+void* numa_replicas_alloc(size_t size, int node) {
+#ifdef HAVE_LIBNUMA
+    if (numa_available() == 0 && node >= 0 && node <= numa_max_node()) {
+        void* ptr = numa_alloc_onnode(size, node);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+    }
+#endif
+    return cb_malloc(size);
+}
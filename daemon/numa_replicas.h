@@ -0,0 +1,130 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include "config.h"
+
+#include <cstddef>
+#include <new>
+
+/**
+ * NUMA replication of immutable lookup tables.
+ *
+ * The tables consulted for every command (the fused dispatch table,
+ * the privilege chains etc; see McbpDispatchTables in
+ * mcbp_executors.cc) are written once at startup and then only read,
+ * but they live on whichever NUMA node happened to initialize them.
+ * On a multi-socket frontend every worker on the other socket then
+ * pays a cross-node memory access whenever a lookup misses its cache.
+ * The helpers below replicate such write-once state per node at
+ * startup so each worker reads the copy on its own node.
+ *
+ * Worker threads announce the node they are pinned to with
+ * numa_replicas_set_local_node() (see setup_thread_affinity() in
+ * thread.cc). Threads which never announce a node - and builds or
+ * machines without NUMA - read replica 0, which is the original
+ * single-copy behaviour.
+ */
+
+/** Cap on the number of nodes we bother replicating for */
+#define MAX_NUMA_REPLICAS 8
+
+/**
+ * Record the number of NUMA nodes in the machine (clamped to
+ * [1, MAX_NUMA_REPLICAS]). Called from thread_init() once the
+ * CPU -> node map has been built, before any replicas are published.
+ */
+void numa_replicas_set_node_count(size_t count);
+
+/** The number of nodes replicas are built for (1 when NUMA is not in
+ *  play) */
+size_t numa_replicas_node_count(void);
+
+/**
+ * Announce the NUMA node of the calling thread (values outside
+ * [0, MAX_NUMA_REPLICAS) select replica 0).
+ */
+void numa_replicas_set_local_node(int node);
+
+/** The node announced by the calling thread (0 if it never did) */
+int numa_replicas_local_node(void);
+
+/**
+ * Allocate size bytes of memory placed on the given node when libnuma
+ * is available; otherwise plain heap memory (still a private copy, so
+ * each node's workers at least keep their own cache-resident instance).
+ * The replicas live for the lifetime of the process and are never
+ * freed.
+ */
+void* numa_replicas_alloc(size_t size, int node);
+
+/**
+ * Holder of one default-constructed instance of T per NUMA node.
+ *
+ * The constructor of T is expected to produce identical, immutable
+ * contents on every node (typically by copying from master tables
+ * which have been fully populated by the time publish() runs).
+ */
+template <typename T>
+class NumaReplicated {
+public:
+    NumaReplicated() {
+        for (auto& replica : replicas) {
+            replica = nullptr;
+        }
+    }
+
+    /**
+     * Build one replica per node, into node-local memory. Call once
+     * at startup after the state the constructor copies from has been
+     * fully populated, and before the worker threads start serving
+     * traffic.
+     */
+    void publish() {
+        const size_t nodes = numa_replicas_node_count();
+        for (size_t ii = 0; ii < nodes; ++ii) {
+            if (replicas[ii] == nullptr) {
+                replicas[ii] =
+                    new (numa_replicas_alloc(sizeof(T), int(ii))) T();
+            }
+        }
+    }
+
+    /**
+     * The replica on the calling thread's node (replica 0 for threads
+     * which never announced a node or nodes beyond the replicated
+     * set). Safe to call before publish() while the process is still
+     * single threaded; the first call builds replica 0.
+     */
+    T& get() {
+        const int node = numa_replicas_local_node();
+        T* ret = nullptr;
+        if (node >= 0 && node < MAX_NUMA_REPLICAS) {
+            ret = replicas[node];
+        }
+        if (ret == nullptr) {
+            if (replicas[0] == nullptr) {
+                replicas[0] = new (numa_replicas_alloc(sizeof(T), 0)) T();
+            }
+            ret = replicas[0];
+        }
+        return *ret;
+    }
+
+private:
+    T* replicas[MAX_NUMA_REPLICAS];
+};
@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * A 256-bit opcode acceptance bitmap, one bit per MCBP opcode.
+ *
+ * Used to restrict the protocol surface of a bucket or of a listening
+ * interface (e.g. a bucket fronted by a "GET/SET only" port, or a
+ * management port which shouldn't speak data commands). The check is a
+ * single relaxed load and bit test, so it sits in front of the
+ * validator and privilege chains and rejects disallowed commands
+ * before any of that work is done. See process_bin_packet().
+ *
+ * The default state accepts every opcode. The words are atomics so the
+ * filter may be reconfigured over ioctl while traffic is flowing; a
+ * reader racing a multi-word update may see a mix of the old and the
+ * new filter for that one packet, which is harmless for this purpose.
+ */
+class OpcodeFilter {
+public:
+    OpcodeFilter() {
+        allowAll();
+    }
+
+    OpcodeFilter(const OpcodeFilter& other) {
+        *this = other;
+    }
+
+    OpcodeFilter& operator=(const OpcodeFilter& other) {
+        for (size_t ii = 0; ii < words.size(); ++ii) {
+            words[ii].store(other.words[ii].load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+        }
+        return *this;
+    }
+
+    /**
+     * May the given opcode be accepted? This is the hot-path check:
+     * one load and one bit test.
+     */
+    bool isAllowed(uint8_t opcode) const {
+        const uint64_t word = words[opcode >> 6].load(
+            std::memory_order_relaxed);
+        return ((word >> (opcode & 0x3f)) & 1) != 0;
+    }
+
+    /** Accept every opcode (the default state) */
+    void allowAll() {
+        for (auto& word : words) {
+            word.store(~uint64_t(0), std::memory_order_relaxed);
+        }
+    }
+
+    /** Reject every opcode (the starting point for an allow-list) */
+    void denyAll() {
+        for (auto& word : words) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /** Accept the given opcode */
+    void allow(uint8_t opcode) {
+        words[opcode >> 6].fetch_or(uint64_t(1) << (opcode & 0x3f),
+                                    std::memory_order_relaxed);
+    }
+
+    /** Reject the given opcode */
+    void deny(uint8_t opcode) {
+        words[opcode >> 6].fetch_and(~(uint64_t(1) << (opcode & 0x3f)),
+                                     std::memory_order_relaxed);
+    }
+
+    /** Does the filter accept every opcode? */
+    bool isUnrestricted() const {
+        for (const auto& word : words) {
+            if (word.load(std::memory_order_relaxed) != ~uint64_t(0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, 4> words;
+};
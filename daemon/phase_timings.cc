@@ -0,0 +1,92 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "phase_timings.h"
+#include "settings.h"
+#include "settings_snapshot.h"
+
+#include <stdexcept>
+
+PhaseTimings phase_timings;
+
+void PhaseTimings::reset(void) {
+    for (auto& opcode : timings) {
+        for (auto& hist : opcode) {
+            hist.reset();
+        }
+    }
+}
+
+void PhaseTimings::collect(const uint8_t opcode, const CommandPhase phase,
+                           const hrtime_t nsec) {
+    timings[opcode][size_t(phase)].add(nsec);
+}
+
+std::string PhaseTimings::generate(const uint8_t opcode,
+                                   const CommandPhase phase) {
+    auto& hist = timings[opcode][size_t(phase)];
+    if (hist.get_total() == 0) {
+        return "";
+    }
+    return hist.to_string();
+}
+
+const char* PhaseTimings::to_string(const CommandPhase phase) {
+    switch (phase) {
+    case CommandPhase::Read:
+        return "read";
+    case CommandPhase::Parse:
+        return "parse";
+    case CommandPhase::Validate:
+        return "validate";
+    case CommandPhase::Execute:
+        return "execute";
+    case CommandPhase::Write:
+        return "write";
+    }
+    throw std::invalid_argument("PhaseTimings::to_string: Unknown phase");
+}
+
+void PhaseSampler::beginCommand(void) {
+    // Drop any half-recorded command (e.g. a quiet command which
+    // completed without a response)
+    sampled = false;
+    readAccum = 0;
+
+    const int every = settings_snapshot().phase_timing_sample_every;
+    if (every <= 0) {
+        return;
+    }
+
+    if (--countdown == 0) {
+        countdown = uint32_t(every);
+        sampled = true;
+        stamp = gethrtime();
+    }
+}
+
+void PhaseSampler::flushRead(const uint8_t opcode) {
+    if (readAccum != 0) {
+        phase_timings.collect(opcode, CommandPhase::Read, readAccum);
+        readAccum = 0;
+    }
+}
+
+void PhaseSampler::mark(const uint8_t opcode, const CommandPhase phase) {
+    const hrtime_t now = gethrtime();
+    phase_timings.collect(opcode, phase, now - stamp);
+    stamp = now;
+}
@@ -0,0 +1,150 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+#include <array>
+#include <cstdint>
+#include <string>
+#include "timing_histogram.h"
+
+/**
+ * The phases a command passes through on its way through the daemon.
+ * The classic command timings (see Timings) record the total time from
+ * dispatch to response; the phase timings break that down so that one
+ * can tell whether time is spent reading the request off the network,
+ * parsing and validating it, executing it in the engine or writing the
+ * response back.
+ */
+enum class CommandPhase : uint8_t {
+    /** Reading the request off the socket (conn_read / conn_nread) */
+    Read = 0,
+    /** Parsing the header and setting up the dispatch */
+    Parse = 1,
+    /** Header and packet validation (including the privilege check) */
+    Validate = 2,
+    /** Running the executor / the engine */
+    Execute = 3,
+    /** Transmitting the response */
+    Write = 4
+};
+
+const size_t NUM_COMMAND_PHASES = 5;
+
+/**
+ * The per-phase, per-opcode histograms behind the "phase-timings" stat
+ * group. Only sampled commands (see PhaseSampler) record here, so a
+ * single process-wide instance with plain (atomic) histograms is cheap
+ * enough; there is no need for the per-worker sharding the full-rate
+ * command timings use.
+ */
+class PhaseTimings {
+public:
+    void reset(void);
+
+    /** Record a sample for the given opcode and phase */
+    void collect(const uint8_t opcode, const CommandPhase phase,
+                 const hrtime_t nsec);
+
+    /**
+     * Generate the histogram JSON (see TimingHistogram::to_string) for
+     * an opcode and phase, or an empty string if no samples have been
+     * recorded for it.
+     */
+    std::string generate(const uint8_t opcode, const CommandPhase phase);
+
+    /** Get the textual name of a phase (as used in the stat keys) */
+    static const char* to_string(const CommandPhase phase);
+
+private:
+    std::array<std::array<TimingHistogram, NUM_COMMAND_PHASES>, 0x100> timings;
+};
+
+extern PhaseTimings phase_timings;
+
+/**
+ * Per-connection state driving the phase timing collection. Every Nth
+ * command on a connection (N given by the phase_timing_sample_every
+ * setting) is sampled; for a sampled command the state machine and the
+ * dispatch path take timestamps at the phase boundaries and charge the
+ * elapsed time to the phase histograms above. Unsampled commands only
+ * pay for the countdown decrement.
+ *
+ * Time spent reading is accumulated on the side and flushed once the
+ * header has been parsed, as the opcode isn't known while the request
+ * is still being read.
+ */
+class PhaseSampler {
+public:
+    PhaseSampler()
+        : countdown(1),
+          sampled(false),
+          stamp(0),
+          readAccum(0) {
+    }
+
+    /**
+     * Called at every command boundary: run the 1-in-N countdown and
+     * (for a sampled command) start the clock. Any partially recorded
+     * command (e.g. a quiet command which never produced a response)
+     * is dropped.
+     */
+    void beginCommand(void);
+
+    bool isSampled(void) const {
+        return sampled;
+    }
+
+    /** Restart the clock without charging the elapsed time anywhere */
+    void restamp(void) {
+        stamp = gethrtime();
+    }
+
+    /**
+     * Charge the time since the last stamp to the read accumulator
+     * (the opcode isn't known yet) and restart the clock.
+     */
+    void accumulateRead(void) {
+        const hrtime_t now = gethrtime();
+        readAccum += now - stamp;
+        stamp = now;
+    }
+
+    /** Charge the accumulated read time to the read phase of an opcode */
+    void flushRead(const uint8_t opcode);
+
+    /**
+     * Charge the time since the last stamp to the given phase of an
+     * opcode and restart the clock.
+     */
+    void mark(const uint8_t opcode, const CommandPhase phase);
+
+    /** The command completed; stop charging until the next sample */
+    void finishCommand(void) {
+        sampled = false;
+    }
+
+private:
+    /** Commands left until the next sample */
+    uint32_t countdown;
+    /** Is the current command being sampled? */
+    bool sampled;
+    /** When the current phase started */
+    hrtime_t stamp;
+    /** Read time collected before the opcode was known */
+    hrtime_t readAccum;
+};
@@ -0,0 +1,350 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "profiler.h"
+
+#ifdef HAVE_BACKTRACE
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The maximum number of frames captured for a single sample. We only
+ * aggregate the flat (leaf) profile, but the whole stack has to be
+ * walked to find the leaf.
+ */
+static const int MAX_FRAMES = 64;
+
+/**
+ * The number of frames at the top of a captured stack belonging to the
+ * capture itself (the signal handler and the kernel signal trampoline)
+ * rather than the interrupted code.
+ */
+static const int SKIP_FRAMES = 3;
+
+/**
+ * The communication area between the profiler thread and the signal
+ * handler. The profiler samples one worker at a time: it arms the slot,
+ * signals the worker, and waits for the handler to publish the captured
+ * stack (or gives up and counts the sample as dropped).
+ */
+static struct {
+    /** Is a sample expected? (armed by the profiler thread) */
+    std::atomic<bool> pending;
+    /**
+     * The number of captured frames; negative while the capture is in
+     * flight. The store in the handler releases the frames below.
+     */
+    std::atomic<int> depth;
+    void* frames[MAX_FRAMES];
+} sample_slot;
+
+static void profiler_signal_handler(int) {
+    if (!sample_slot.pending.load(std::memory_order_acquire)) {
+        // Stale signal (the profiler timed out waiting for us and
+        // moved on); don't scribble over the slot.
+        return;
+    }
+    int depth = backtrace(sample_slot.frames, MAX_FRAMES);
+    sample_slot.depth.store(depth, std::memory_order_release);
+}
+
+/**
+ * The profiler singleton. All of the mutable state (the profile, the
+ * sampling thread handle and the running flag) is protected by the
+ * mutex; the sampling thread only holds it while aggregating a sample
+ * so the ioctls stay responsive while profiling.
+ */
+class Profiler {
+public:
+    Profiler()
+        : thread(0),
+          running(false),
+          interval_ms(10),
+          samples(0),
+          dropped(0) {
+    }
+
+    ENGINE_ERROR_CODE start(int interval);
+    ENGINE_ERROR_CODE stop();
+    std::string getStatus();
+    void dump(std::string& value);
+
+private:
+    static void thread_main(void* arg);
+
+    /** Interrupt one worker and fold its stack into the profile */
+    void sampleThread(cb_thread_t tid);
+
+    std::mutex mutex;
+    std::condition_variable shutdown_cv;
+    cb_thread_t thread;
+    bool running;
+    int interval_ms;
+
+    /** Number of successfully captured samples */
+    uint64_t samples;
+    /** Number of samples where the handler didn't respond in time */
+    uint64_t dropped;
+
+    /** Leaf program counter -> number of samples it was on-CPU */
+    std::unordered_map<void*, uint64_t> profile;
+
+    /** The worker threads being sampled (captured at start) */
+    std::vector<cb_thread_t> workers;
+};
+
+static Profiler profiler;
+
+ENGINE_ERROR_CODE Profiler::start(int interval) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (running) {
+        return ENGINE_KEY_EEXISTS;
+    }
+
+    workers.resize(settings.getNumWorkerThreads());
+    workers.resize(threads_get_thread_ids(workers.data(), workers.size()));
+    if (workers.empty()) {
+        // Worker threads not started yet
+        return ENGINE_TMPFAIL;
+    }
+
+    // backtrace(3) is not async-signal-safe the first time it is
+    // called (it may pull in the unwinder library); prime it from a
+    // sane context before any handler runs.
+    void* primer[2];
+    backtrace(primer, 2);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = profiler_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+        return ENGINE_FAILED;
+    }
+
+    profile.clear();
+    samples = 0;
+    dropped = 0;
+    interval_ms = interval;
+    running = true;
+
+    if (cb_create_named_thread(&thread, Profiler::thread_main, this, 0,
+                               "mc:profiler") != 0) {
+        running = false;
+        return ENGINE_FAILED;
+    }
+
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE Profiler::stop() {
+    cb_thread_t tojoin;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!running) {
+            return ENGINE_KEY_ENOENT;
+        }
+        running = false;
+        tojoin = thread;
+    }
+    shutdown_cv.notify_all();
+    cb_join_thread(tojoin);
+    return ENGINE_SUCCESS;
+}
+
+std::string Profiler::getStatus() {
+    std::lock_guard<std::mutex> guard(mutex);
+    std::stringstream ss;
+    ss << (running ? "running" : "stopped")
+       << " interval=" << interval_ms << "ms"
+       << " samples=" << samples
+       << " dropped=" << dropped;
+    return ss.str();
+}
+
+void Profiler::dump(std::string& value) {
+    std::vector<std::pair<void*, uint64_t>> sorted;
+    uint64_t total;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        sorted.assign(profile.begin(), profile.end());
+        total = samples;
+    }
+
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<void*, uint64_t>& a,
+                 const std::pair<void*, uint64_t>& b) {
+                  return a.second > b.second;
+              });
+
+    std::stringstream ss;
+    ss << "samples " << total << std::endl;
+    for (const auto& entry : sorted) {
+        ss << entry.second << " " << entry.first;
+        char** symbol = backtrace_symbols(&entry.first, 1);
+        if (symbol != nullptr) {
+            ss << " " << symbol[0];
+            free(symbol);
+        }
+        ss << std::endl;
+    }
+    value = ss.str();
+}
+
+void Profiler::sampleThread(cb_thread_t tid) {
+    sample_slot.depth.store(-1, std::memory_order_relaxed);
+    sample_slot.pending.store(true, std::memory_order_release);
+
+    if (pthread_kill(tid, SIGPROF) != 0) {
+        sample_slot.pending.store(false, std::memory_order_relaxed);
+        return;
+    }
+
+    // Wait (briefly) for the handler to publish the stack. The handler
+    // runs on the worker we just signalled so this is normally a few
+    // microseconds; give up after ~1ms so a worker stuck in an
+    // uninterruptible state can't stall the whole sweep.
+    int depth = -1;
+    for (int ii = 0; ii < 1000; ++ii) {
+        depth = sample_slot.depth.load(std::memory_order_acquire);
+        if (depth >= 0) {
+            break;
+        }
+        usleep(1);
+    }
+    sample_slot.pending.store(false, std::memory_order_release);
+
+    std::lock_guard<std::mutex> guard(mutex);
+    if (depth > SKIP_FRAMES) {
+        profile[sample_slot.frames[SKIP_FRAMES]]++;
+        samples++;
+    } else {
+        dropped++;
+    }
+}
+
+void Profiler::thread_main(void* arg) {
+    auto* instance = reinterpret_cast<Profiler*>(arg);
+
+    while (true) {
+        std::vector<cb_thread_t> targets;
+        int interval;
+        {
+            // Wait for either the shutdown condvar to be notified, or
+            // for the sampling interval to pass.
+            std::unique_lock<std::mutex> lock(instance->mutex);
+            if (instance->shutdown_cv.wait_for(
+                    lock,
+                    std::chrono::milliseconds(instance->interval_ms),
+                    [instance]{ return !instance->running; })) {
+                // No longer profiling - exit thread.
+                return;
+            }
+            targets = instance->workers;
+            interval = instance->interval_ms;
+        }
+
+        // Spread the workers out over the interval instead of
+        // stampeding all of them at the same instant.
+        const useconds_t spacing =
+            useconds_t((interval * 1000) / (targets.size() + 1));
+        for (auto tid : targets) {
+            instance->sampleThread(tid);
+            if (spacing > 0) {
+                usleep(spacing);
+            }
+        }
+    }
+}
+
+ENGINE_ERROR_CODE ioctlGetProfilerStatus(Connection*,
+                                         const StrToStrMap&,
+                                         std::string& value) {
+    value = profiler.getStatus();
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE ioctlGetProfilerDump(Connection*,
+                                       const StrToStrMap&,
+                                       std::string& value) {
+    profiler.dump(value);
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE ioctlSetProfilerStart(Connection*,
+                                        const StrToStrMap&,
+                                        const std::string& value) {
+    int interval = 10;
+    if (!value.empty()) {
+        try {
+            interval = std::stoi(value);
+        } catch (const std::exception&) {
+            return ENGINE_EINVAL;
+        }
+        if (interval < 1) {
+            return ENGINE_EINVAL;
+        }
+    }
+    return profiler.start(interval);
+}
+
+ENGINE_ERROR_CODE ioctlSetProfilerStop(Connection*,
+                                       const StrToStrMap&,
+                                       const std::string& value) {
+    return profiler.stop();
+}
+
+#else // HAVE_BACKTRACE
+
+ENGINE_ERROR_CODE ioctlGetProfilerStatus(Connection*,
+                                         const StrToStrMap&,
+                                         std::string&) {
+    return ENGINE_ENOTSUP;
+}
+
+ENGINE_ERROR_CODE ioctlGetProfilerDump(Connection*,
+                                       const StrToStrMap&,
+                                       std::string&) {
+    return ENGINE_ENOTSUP;
+}
+
+ENGINE_ERROR_CODE ioctlSetProfilerStart(Connection*,
+                                        const StrToStrMap&,
+                                        const std::string&) {
+    return ENGINE_ENOTSUP;
+}
+
+ENGINE_ERROR_CODE ioctlSetProfilerStop(Connection*,
+                                       const StrToStrMap&,
+                                       const std::string&) {
+    return ENGINE_ENOTSUP;
+}
+
+#endif // HAVE_BACKTRACE
@@ -0,0 +1,74 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <memcached/types.h>
+
+#include "memcached.h"
+#include "utilities/string_utilities.h"
+
+/*
+ * In-process sampling profiler for the worker threads.
+ *
+ * While the profiler is running a background thread periodically
+ * interrupts each worker with a signal; the signal handler captures
+ * the stack of the interrupted thread and the sampled program counters
+ * are aggregated into a flat profile. The profile can be retrieved
+ * over the admin connection with ioctl_get, removing the need to
+ * attach an external profiler to a production node.
+ *
+ * Only available on platforms with backtrace(3); the ioctls return
+ * ENGINE_ENOTSUP elsewhere.
+ */
+
+/**
+ * IOCTL Get callback to get the profiler status
+ * @param[out] value "running" or "stopped", with the sampling interval
+ *                   and the number of collected samples
+ */
+ENGINE_ERROR_CODE ioctlGetProfilerStatus(Connection* c,
+                                         const StrToStrMap& arguments,
+                                         std::string& value);
+
+/**
+ * IOCTL Get callback to dump the collected profile
+ * @param[out] value The flat profile, one "count address symbol" line
+ *                   per sampled program counter (hottest first)
+ */
+ENGINE_ERROR_CODE ioctlGetProfilerDump(Connection* c,
+                                       const StrToStrMap& arguments,
+                                       std::string& value);
+
+/**
+ * IOCTL Set callback to start profiling. Discards any previously
+ * collected profile.
+ * @param value The sampling interval in milliseconds, or empty for
+ *              the default (10ms)
+ */
+ENGINE_ERROR_CODE ioctlSetProfilerStart(Connection* c,
+                                        const StrToStrMap& arguments,
+                                        const std::string& value);
+
+/**
+ * IOCTL Set callback to stop profiling
+ */
+ENGINE_ERROR_CODE ioctlSetProfilerStop(Connection* c,
+                                       const StrToStrMap& arguments,
+                                       const std::string& value);
@@ -0,0 +1,111 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "resource_accounting.h"
+
+ResourceAccounting::Shard::Shard() {
+    for (auto& entry : entries) {
+        entry.count = 0;
+        entry.bytes_in = 0;
+        entry.bytes_out = 0;
+        entry.engine_ns = 0;
+        entry.total_ns = 0;
+    }
+}
+
+ResourceAccounting::ResourceAccounting() {
+    for (auto& shard : shards) {
+        shard.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+ResourceAccounting::~ResourceAccounting() {
+    for (auto& shard : shards) {
+        delete shard.load(std::memory_order_relaxed);
+    }
+}
+
+void ResourceAccounting::reset() {
+    for (auto& slot : shards) {
+        auto* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            for (auto& entry : shard->entries) {
+                entry.count = 0;
+                entry.bytes_in = 0;
+                entry.bytes_out = 0;
+                entry.engine_ns = 0;
+                entry.total_ns = 0;
+            }
+        }
+    }
+}
+
+ResourceAccounting::Shard* ResourceAccounting::getShard(const size_t index) {
+    auto& slot = shards[index % MAX_SHARDS];
+    Shard* shard = slot.load(std::memory_order_acquire);
+    if (shard == nullptr) {
+        auto* created = new Shard;
+        if (slot.compare_exchange_strong(shard, created,
+                                         std::memory_order_acq_rel)) {
+            shard = created;
+        } else {
+            // Another worker sharing the slot won the race
+            delete created;
+        }
+    }
+    return shard;
+}
+
+void ResourceAccounting::collect(const uint8_t opcode,
+                                 const size_t shard,
+                                 const uint64_t bytes_in,
+                                 const uint64_t bytes_out,
+                                 const uint64_t engine_ns,
+                                 const uint64_t total_ns) {
+    auto& entry = getShard(shard)->entries[opcode];
+    entry.count += 1;
+    entry.bytes_in += bytes_in;
+    entry.bytes_out += bytes_out;
+    entry.engine_ns += engine_ns;
+    entry.total_ns += total_ns;
+}
+
+ResourceAccounting::Rollup ResourceAccounting::rollup(
+                                                const uint8_t opcode) const {
+    Rollup ret = {0, 0, 0, 0, 0};
+    uint64_t total_ns = 0;
+
+    for (auto& slot : shards) {
+        auto* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            auto& entry = shard->entries[opcode];
+            ret.count += entry.count.load();
+            ret.bytes_in += entry.bytes_in.load();
+            ret.bytes_out += entry.bytes_out.load();
+            ret.engine_ns += entry.engine_ns.load();
+            total_ns += entry.total_ns.load();
+        }
+    }
+
+    // The engine and total time for an operation are read at slightly
+    // different points; don't let the daemon share underflow if they
+    // race with a concurrent update.
+    if (total_ns > ret.engine_ns) {
+        ret.daemon_ns = total_ns - ret.engine_ns;
+    }
+
+    return ret;
+}
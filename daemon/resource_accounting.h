@@ -0,0 +1,126 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+#include <relaxed_atomic.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "timings.h"
+
+/**
+ * Per-opcode resource accounting for a bucket.
+ *
+ * While Timings records the latency distribution per opcode, this class
+ * records the resources each opcode consumed: the number of operations,
+ * the bytes received and sent, and the time split between the engine
+ * and the daemon. Together with the per-bucket instances this gives a
+ * (bucket, opcode) matrix which can be used to attribute CPU and
+ * network usage in a multi-tenant deployment.
+ *
+ * Like Timings the counters are recorded into lazily allocated
+ * per-worker shards (each shard is a separate heap allocation with a
+ * single writer, so the record path never writes to cache lines shared
+ * with another worker), and the shards are rolled up on demand when
+ * the stats are requested.
+ */
+class ResourceAccounting {
+public:
+    /**
+     * The maximum number of per-worker shards (same capacity and
+     * indexing scheme as Timings::MAX_SHARDS).
+     */
+    static const size_t MAX_SHARDS = 64;
+
+    /**
+     * The rolled up counters for a single opcode (the sum over all
+     * worker shards).
+     */
+    struct Rollup {
+        /** Number of completed operations */
+        uint64_t count;
+        /** Bytes received from the network (request packets) */
+        uint64_t bytes_in;
+        /** Bytes queued for transmission (response packets) */
+        uint64_t bytes_out;
+        /** Time spent inside the engine interface */
+        uint64_t engine_ns;
+        /** Time spent in the daemon (total minus engine time) */
+        uint64_t daemon_ns;
+    };
+
+    ResourceAccounting();
+    ~ResourceAccounting();
+    void reset();
+
+    /**
+     * Account a completed operation
+     *
+     * @param opcode the opcode of the operation
+     * @param shard the calling worker's thread index
+     * @param bytes_in the size of the request packet
+     * @param bytes_out the size of the response packet(s)
+     * @param engine_ns time spent inside the engine
+     * @param total_ns the total duration of the operation
+     */
+    void collect(const uint8_t opcode,
+                 const size_t shard,
+                 const uint64_t bytes_in,
+                 const uint64_t bytes_out,
+                 const uint64_t engine_ns,
+                 const uint64_t total_ns);
+
+    /**
+     * Roll up the per-worker shards for an opcode into a single set
+     * of counters.
+     */
+    Rollup rollup(const uint8_t opcode) const;
+
+private:
+    /**
+     * The counters for a single opcode within a shard. The shard has
+     * a single writer so plain (relaxed) increments suffice.
+     */
+    struct Entry {
+        Couchbase::RelaxedAtomic<uint64_t> count;
+        Couchbase::RelaxedAtomic<uint64_t> bytes_in;
+        Couchbase::RelaxedAtomic<uint64_t> bytes_out;
+        Couchbase::RelaxedAtomic<uint64_t> engine_ns;
+        Couchbase::RelaxedAtomic<uint64_t> total_ns;
+    };
+
+    /**
+     * The accounting matrix row for a single worker thread. Each
+     * shard is a separate heap allocation so shards never share a
+     * cache line with one another (or with the shard pointer array).
+     */
+    struct Shard {
+        Shard();
+        std::array<Entry, MAX_NUM_OPCODES> entries;
+    };
+
+    /**
+     * Get the shard for the given worker, allocating it on the
+     * first sample.
+     */
+    Shard* getShard(const size_t index);
+
+    /** The lazily allocated per-worker shards */
+    std::array<std::atomic<Shard*>, MAX_SHARDS> shards;
+};
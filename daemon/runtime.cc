@@ -22,8 +22,11 @@
 #include "ssl_utils.h"
 
 #include <atomic>
+#include <map>
 #include <string>
 #include <mutex>
+#include <utility>
+#include <vector>
 
 #include <memcached/openssl.h>
 
@@ -42,12 +45,16 @@ static std::string ssl_cipher_list;
 static std::mutex ssl_cipher_list_mutex;
 
 void set_ssl_cipher_list(const std::string& list) {
-    std::lock_guard<std::mutex> lock(ssl_cipher_list_mutex);
-    if (list.empty()) {
-        ssl_cipher_list.resize(0);
-    } else {
-        ssl_cipher_list.assign(list);
+    {
+        std::lock_guard<std::mutex> lock(ssl_cipher_list_mutex);
+        if (list.empty()) {
+            ssl_cipher_list.resize(0);
+        } else {
+            ssl_cipher_list.assign(list);
+        }
     }
+    /* New connections should pick up the new cipher list */
+    invalidate_ssl_server_ctx_cache();
 }
 
 void set_ssl_ctx_cipher_list(SSL_CTX *ctx) {
@@ -80,12 +87,147 @@ void set_ssl_protocol_mask(const std::string& mask) {
                     "An error occured while decoding the SSL protocol: %s",
                     mask.c_str());
     }
+    /* New connections should pick up the new protocol mask */
+    invalidate_ssl_server_ctx_cache();
 }
 
 void set_ssl_ctx_protocol_mask(SSL_CTX* ctx) {
     SSL_CTX_set_options(ctx, ssl_protocol_mask.load(std::memory_order_acquire));
 }
 
+/*
+ * Server SSL contexts are shared between all of the connections using
+ * the same certificate / private key pair (keyed on the two file names)
+ * so that OpenSSL's session cache and session ticket keys span
+ * connections, allowing clients to resume sessions with an abbreviated
+ * handshake. The cache holds one reference to each context; every
+ * caller of acquire_ssl_server_ctx() gets their own reference.
+ */
+static std::mutex ssl_ctx_cache_mutex;
+static std::map<std::pair<std::string, std::string>, SSL_CTX*> ssl_ctx_cache;
+
+/**
+ * Build a new server context for the given certificate / private key
+ * pair, applying the currently configured protocol mask, cipher list
+ * and session cache settings. The caller gets the initial reference
+ * to the returned context.
+ */
+static SSL_CTX* create_ssl_server_ctx(const std::string& cert,
+                                      const std::string& pkey) {
+    SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
+    if (ctx == nullptr) {
+        return nullptr;
+    }
+    set_ssl_ctx_protocol_mask(ctx);
+
+    /* @todo don't read files, but use in-memory-copies */
+    if (!SSL_CTX_use_certificate_chain_file(ctx, cert.c_str()) ||
+        !SSL_CTX_use_PrivateKey_file(ctx, pkey.c_str(), SSL_FILETYPE_PEM)) {
+        LOG_WARNING(nullptr, "Failed to use SSL cert %s and pkey %s",
+                    cert.c_str(), pkey.c_str());
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+
+    set_ssl_ctx_cipher_list(ctx);
+
+    const auto cachesz = settings.getSslSessionCacheSize();
+    if (cachesz > 0) {
+        static const unsigned char session_id_ctx[] = "memcached";
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, long(cachesz));
+        SSL_CTX_set_session_id_context(ctx, session_id_ctx,
+                                       sizeof(session_id_ctx) - 1);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+
+    return ctx;
+}
+
+SSL_CTX* acquire_ssl_server_ctx(const std::string& cert,
+                                const std::string& pkey) {
+    const auto key = std::make_pair(cert, pkey);
+    std::lock_guard<std::mutex> lock(ssl_ctx_cache_mutex);
+
+    auto iter = ssl_ctx_cache.find(key);
+    if (iter != ssl_ctx_cache.end()) {
+        CRYPTO_add(&iter->second->references, 1, CRYPTO_LOCK_SSL_CTX);
+        return iter->second;
+    }
+
+    SSL_CTX* ctx = create_ssl_server_ctx(cert, pkey);
+    if (ctx == nullptr) {
+        return nullptr;
+    }
+
+    /* one reference for the cache, one for the caller */
+    CRYPTO_add(&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+    ssl_ctx_cache[key] = ctx;
+    return ctx;
+}
+
+bool refresh_ssl_server_ctx_cache(void) {
+    /* Snapshot the file names so that the certificate loading (which
+     * reads from disk) happens without holding the cache lock; the
+     * frontend threads keep accepting connections with the old
+     * contexts in the meantime. */
+    std::vector<std::pair<std::string, std::string>> files;
+    {
+        std::lock_guard<std::mutex> lock(ssl_ctx_cache_mutex);
+        for (const auto& entry : ssl_ctx_cache) {
+            files.push_back(entry.first);
+        }
+    }
+
+    bool success = true;
+    for (const auto& pair : files) {
+        SSL_CTX* ctx = create_ssl_server_ctx(pair.first, pair.second);
+        if (ctx == nullptr) {
+            /* Keep serving the old certificate rather than none at all */
+            success = false;
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(ssl_ctx_cache_mutex);
+        auto iter = ssl_ctx_cache.find(pair);
+        if (iter == ssl_ctx_cache.end()) {
+            /* The entry was invalidated while we were rebuilding it;
+             * don't resurrect it */
+            SSL_CTX_free(ctx);
+        } else {
+            /* Swap in the new context. Established connections hold
+             * their own reference to the old one, so they keep the
+             * certificate they were accepted with. */
+            SSL_CTX_free(iter->second);
+            iter->second = ctx;
+        }
+    }
+
+    return success;
+}
+
+void invalidate_ssl_server_ctx_cache(void) {
+    std::lock_guard<std::mutex> lock(ssl_ctx_cache_mutex);
+    for (auto& entry : ssl_ctx_cache) {
+        SSL_CTX_free(entry.second);
+    }
+    ssl_ctx_cache.clear();
+}
+
+/* Start at 1 so that a connection initializing its recorded epoch to 0
+ * always misses (and resets) its cache on the first lookup */
+static std::atomic<uint64_t> privilege_epoch { 1 };
+
+uint64_t get_privilege_epoch(void) {
+    return privilege_epoch.load(std::memory_order_acquire);
+}
+
+void bump_privilege_epoch(void) {
+    privilege_epoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
 static std::atomic<Audit*> auditHandle { nullptr };
 
 void set_audit_handle(Audit* handle) {
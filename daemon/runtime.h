@@ -23,6 +23,7 @@
 #pragma once
 
 #include <memcached/openssl.h>
+#include <cstdint>
 #include <string>
 
 bool is_server_initialized(void);
@@ -37,7 +38,68 @@ void set_ssl_protocol_mask(const std::string& mask);
 
 void set_ssl_ctx_protocol_mask(SSL_CTX* ctx);
 
+/**
+ * Get a server SSL_CTX for the given certificate / private key pair.
+ *
+ * The context is shared between all of the connections using the same
+ * pair, which is what makes the OpenSSL session cache (and the session
+ * ticket keys) span connections so that reconnecting clients may resume
+ * an earlier session with an abbreviated handshake. The size of the
+ * session cache is read from the "ssl_session_cache_size" setting when
+ * the context is created (0 disables resumption entirely).
+ *
+ * The caller owns a reference to the returned context and must release
+ * it with SSL_CTX_free().
+ *
+ * @param cert the certificate file to use
+ * @param pkey the private key file to use
+ * @return the context, or nullptr if it could not be created
+ */
+SSL_CTX* acquire_ssl_server_ctx(const std::string& cert,
+                                const std::string& pkey);
+
+/**
+ * Drop all of the cached server SSL contexts so that new connections
+ * pick up updated settings (cipher list, protocol mask, session cache
+ * size). Contexts still referenced by connected clients stay alive
+ * until those connections close.
+ */
+void invalidate_ssl_server_ctx_cache(void);
+
+/**
+ * Rebuild every cached server SSL context from the (possibly updated)
+ * certificate / private key files on disk and swap the new contexts
+ * into the cache, so that new connections pick up the new
+ * certificates. Established connections keep the reference to the
+ * context they were accepted with and are not disturbed.
+ *
+ * The certificate files are read without holding the cache lock, so
+ * this is safe to run from a background thread while the frontend
+ * threads keep accepting connections.
+ *
+ * @return true if all of the contexts could be rebuilt, false if one
+ *              or more could not (the old context is kept in that case)
+ */
+bool refresh_ssl_server_ctx_cache(void);
+
 class Audit;
 
 void set_audit_handle(Audit*);
 Audit* get_audit_handle(void);
+
+/**
+ * Get the current privilege epoch.
+ *
+ * The privilege epoch moves every time something happens which may
+ * change the outcome of a privilege check (a connection authenticates,
+ * selects another bucket etc). The connections use it to invalidate
+ * their memoized per-opcode privilege check results; see
+ * Connection::getCachedPrivilegeCheck().
+ */
+uint64_t get_privilege_epoch(void);
+
+/**
+ * Bump the privilege epoch, invalidating every memoized privilege
+ * check result in the system.
+ */
+void bump_privilege_epoch(void);
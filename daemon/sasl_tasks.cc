@@ -18,6 +18,70 @@
 #include "sasl_tasks.h"
 #include "memcached.h"
 #include "mcaudit.h"
+#include "timing_histogram.h"
+
+#include <array>
+#include <atomic>
+
+/**
+ * The latency of the crypto part of the authentication, per mechanism.
+ * Unknown mechanism names are lumped into the final entry so that a
+ * client can't grow the table by spraying bogus mechanism names.
+ */
+static const char* const auth_mechanisms[] = {
+    "PLAIN", "CRAM-MD5", "SCRAM-SHA1", "SCRAM-SHA256", "SCRAM-SHA512",
+    "(unknown)"
+};
+static std::array<TimingHistogram, 6> auth_timings;
+
+static void record_auth_timing(const std::string& mechanism, hrtime_t ns) {
+    size_t idx = 0;
+    while (idx < auth_timings.size() - 1 &&
+           mechanism != auth_mechanisms[idx]) {
+        ++idx;
+    }
+    auth_timings[idx].add(ns);
+}
+
+std::vector<std::pair<std::string, std::string>> sasl_auth_get_timings() {
+    std::vector<std::pair<std::string, std::string>> ret;
+    for (size_t ii = 0; ii < auth_timings.size(); ++ii) {
+        if (auth_timings[ii].get_total() > 0) {
+            ret.emplace_back(auth_mechanisms[ii],
+                             auth_timings[ii].to_string());
+        }
+    }
+    return ret;
+}
+
+void sasl_auth_reset_timings() {
+    for (auto& histogram : auth_timings) {
+        histogram.reset();
+    }
+}
+
+/**
+ * The number of authentications currently scheduled on (or running on)
+ * the executor pool. The cap leaves at least one executor free for the
+ * other tasks running there (bucket creation/deletion etc).
+ */
+static std::atomic<int> in_flight_auths(0);
+
+bool sasl_auth_try_acquire_slot() {
+    int limit = settings.getNumWorkerThreads() - 1;
+    if (limit < 1) {
+        limit = 1;
+    }
+    if (in_flight_auths.fetch_add(1) >= limit) {
+        in_flight_auths.fetch_sub(1);
+        return false;
+    }
+    return true;
+}
+
+static void sasl_auth_release_slot() {
+    in_flight_auths.fetch_sub(1);
+}
 
 
 StartSaslAuthTask::StartSaslAuthTask(Cookie& cookie_,
@@ -30,11 +94,14 @@ StartSaslAuthTask::StartSaslAuthTask(Cookie& cookie_,
 
 bool StartSaslAuthTask::execute() {
     connection.restartAuthentication();
+    ScopedAllocDomain domain(AllocationDomain::Sasl);
+    const hrtime_t start = gethrtime();
     error = cbsasl_server_start(connection.getSaslConn(),
                                 mechanism.c_str(),
                                 challenge.data(),
                                 static_cast<unsigned int>(challenge.length()),
                                 &response, &response_length);
+    record_auth_timing(mechanism, gethrtime() - start);
     return true;
 }
 
@@ -47,9 +114,12 @@ StepSaslAuthTask::StepSaslAuthTask(Cookie& cookie_,
 }
 
 bool StepSaslAuthTask::execute() {
+    ScopedAllocDomain domain(AllocationDomain::Sasl);
+    const hrtime_t start = gethrtime();
     error = cbsasl_server_step(connection.getSaslConn(), challenge.data(),
                                static_cast<unsigned int>(challenge.length()),
                                &response, &response_length);
+    record_auth_timing(mechanism, gethrtime() - start);
     return true;
 }
 
@@ -58,7 +128,8 @@ SaslAuthTask::SaslAuthTask(Cookie& cookie_,
                            Connection& connection_,
                            const std::string& mechanism_,
                            const std::string& challenge_)
-    : cookie(cookie_),
+    : Task(TaskPriority::High),
+      cookie(cookie_),
       connection(connection_),
       mechanism(mechanism_),
       challenge(challenge_),
@@ -69,6 +140,8 @@ SaslAuthTask::SaslAuthTask(Cookie& cookie_,
 }
 
 void SaslAuthTask::notifyExecutionComplete() {
+    sasl_auth_release_slot();
+
     if (error == CBSASL_OK) {
         connection.setAuthenticated(true);
 
@@ -19,11 +19,39 @@
 #include "task.h"
 #include <cbsasl/cbsasl.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 
 class Connection;
 class Cookie;
 
+/**
+ * Try to reserve a slot for running a SASL authentication on the
+ * executor pool. The number of in-flight authentications is capped
+ * below the size of the pool so that an authentication storm can't
+ * occupy every executor thread (the password hashing performed there
+ * is deliberately expensive). The slot is released when the task
+ * completes.
+ *
+ * @return true if the authentication may be scheduled, false if the
+ *              client should be asked to back off and retry
+ */
+bool sasl_auth_try_acquire_slot();
+
+/**
+ * Get the authentication latency histograms recorded by the SASL
+ * tasks, one entry per mechanism which has samples. The first member
+ * of each pair is the mechanism name, the second the histogram
+ * rendered as JSON (the same format as the command timings).
+ */
+std::vector<std::pair<std::string, std::string>> sasl_auth_get_timings();
+
+/**
+ * Reset the authentication latency histograms (used by stat reset)
+ */
+void sasl_auth_reset_timings();
+
 /**
  * The SaslAuthTask is the abstract base class used during SASL
  * authentication (which is being run by the executor service)
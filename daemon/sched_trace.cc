@@ -0,0 +1,235 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "sched_trace.h"
+#include "log_macros.h"
+#include "settings.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+enum class SchedTraceMode : uint8_t {
+    Off,
+    Record,
+    Replay
+};
+
+/** The point in the scheduling a trace record describes */
+enum class SchedTracePoint : uint8_t {
+    /** a worker dispatched an event loop callback (id = connection) */
+    Dispatch = 0,
+    /** the executor ran a task (id = running count, diagnostic only) */
+    Task = 1,
+    /** an engine delivered a notify_io_complete (id = connection) */
+    NotifyIo = 2
+};
+
+/**
+ * One record in the trace. Written to disk as the type byte followed
+ * by the four id bytes in host order (the trace is consumed on the
+ * machine that produced it, so there's no point in byteswapping five
+ * bytes per scheduling decision on the hot path).
+ */
+struct SchedTraceRecord {
+    SchedTracePoint type;
+    uint32_t id;
+};
+
+/**
+ * How long a replayed point may wait for its turn before we declare
+ * the run diverged from the trace. Generous enough for a task stuck
+ * behind real disk I/O, short enough that a diverged test run fails
+ * quickly instead of hanging.
+ */
+const std::chrono::seconds DivergenceTimeout(5);
+
+static SchedTraceMode trace_mode = SchedTraceMode::Off;
+
+/** Serializes trace_file appends (record) and guards the cursor (replay) */
+static std::mutex trace_mutex;
+
+/** Signalled every time the replay cursor advances */
+static std::condition_variable trace_cond;
+
+/** The open trace file in record mode */
+static FILE* trace_file = nullptr;
+
+/** The loaded trace in replay mode */
+static std::vector<SchedTraceRecord> trace;
+
+/** The next record to be consumed in replay mode */
+static size_t trace_cursor = 0;
+
+/** Running count of executed tasks (the id of Task records) */
+static uint32_t task_serial = 0;
+
+static const char* to_string(SchedTracePoint type) {
+    switch (type) {
+    case SchedTracePoint::Dispatch: return "dispatch";
+    case SchedTracePoint::Task: return "task";
+    case SchedTracePoint::NotifyIo: return "notify_io";
+    }
+    return "unknown";
+}
+
+/**
+ * Append one record to the trace file. fwrite buffers internally so
+ * this is a memcpy in the common case; the flush to disk happens when
+ * the buffer fills and at shutdown.
+ */
+static void record_point(SchedTracePoint type, uint32_t id) {
+    std::lock_guard<std::mutex> guard(trace_mutex);
+    const uint8_t byte = static_cast<uint8_t>(type);
+    if (fwrite(&byte, sizeof(byte), 1, trace_file) != 1 ||
+        fwrite(&id, sizeof(id), 1, trace_file) != 1) {
+        LOG_WARNING(NULL, "sched_trace: failed to append to trace file; "
+                    "disabling recording");
+        trace_mode = SchedTraceMode::Off;
+    }
+}
+
+/**
+ * Block until the head of the trace is a record of the given type
+ * (and, for points with a stable identity, the given id), then
+ * consume it and wake the other blocked points. On timeout the
+ * divergence is logged and enforcement is switched off - a wedged
+ * daemon would be worse than an unenforced tail of the trace.
+ */
+static void replay_point(SchedTracePoint type, uint32_t id, bool match_id) {
+    std::unique_lock<std::mutex> lock(trace_mutex);
+
+    while (trace_mode == SchedTraceMode::Replay) {
+        if (trace_cursor == trace.size()) {
+            LOG_NOTICE(NULL, "sched_trace: trace fully replayed (%u records);"
+                       " scheduling is free-running from here",
+                       (unsigned int)trace.size());
+            trace_mode = SchedTraceMode::Off;
+            trace_cond.notify_all();
+            return;
+        }
+
+        const auto& head = trace[trace_cursor];
+        if (head.type == type && (!match_id || head.id == id)) {
+            ++trace_cursor;
+            trace_cond.notify_all();
+            return;
+        }
+
+        if (trace_cond.wait_for(lock, DivergenceTimeout) ==
+            std::cv_status::timeout) {
+            LOG_WARNING(NULL, "sched_trace: replay diverged at record %u: "
+                        "trace expects %s(%u) but %s(%u) is ready to run; "
+                        "enforcement disabled",
+                        (unsigned int)trace_cursor, to_string(head.type),
+                        head.id, to_string(type), id);
+            trace_mode = SchedTraceMode::Off;
+            trace_cond.notify_all();
+            return;
+        }
+    }
+}
+
+void initialize_sched_trace() {
+    const std::string& mode = settings.getSchedTraceMode();
+    if (mode == "off") {
+        return;
+    }
+
+    if (settings.getNumWorkerThreads() != 1) {
+        throw std::invalid_argument(
+            "sched_trace requires a single worker thread (threads=1); "
+            "with multiple workers the recorded order isn't replayable");
+    }
+
+    const std::string& file = settings.getSchedTraceFile();
+    if (file.empty()) {
+        throw std::invalid_argument(
+            "sched_trace_mode requires sched_trace_file to be set");
+    }
+
+    if (mode == "record") {
+        trace_file = fopen(file.c_str(), "wb");
+        if (trace_file == nullptr) {
+            throw std::invalid_argument(
+                "sched_trace: failed to create trace file \"" + file + "\"");
+        }
+        trace_mode = SchedTraceMode::Record;
+        LOG_NOTICE(NULL, "sched_trace: recording scheduling decisions to %s",
+                   file.c_str());
+        return;
+    }
+
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (fp == nullptr) {
+        throw std::invalid_argument(
+            "sched_trace: failed to open trace file \"" + file + "\"");
+    }
+
+    SchedTraceRecord rec;
+    uint8_t byte;
+    while (fread(&byte, sizeof(byte), 1, fp) == 1 &&
+           fread(&rec.id, sizeof(rec.id), 1, fp) == 1) {
+        rec.type = static_cast<SchedTracePoint>(byte);
+        trace.push_back(rec);
+    }
+    fclose(fp);
+
+    if (trace.empty()) {
+        throw std::invalid_argument(
+            "sched_trace: trace file \"" + file + "\" contains no records");
+    }
+
+    trace_mode = SchedTraceMode::Replay;
+    LOG_NOTICE(NULL, "sched_trace: replaying %u scheduling decisions from %s",
+               (unsigned int)trace.size(), file.c_str());
+}
+
+void shutdown_sched_trace() {
+    std::lock_guard<std::mutex> guard(trace_mutex);
+    if (trace_file != nullptr) {
+        fclose(trace_file);
+        trace_file = nullptr;
+    }
+    trace_mode = SchedTraceMode::Off;
+}
+
+void sched_trace_event_dispatch(uint32_t conn_id) {
+    if (trace_mode == SchedTraceMode::Record) {
+        record_point(SchedTracePoint::Dispatch, conn_id);
+    } else if (trace_mode == SchedTraceMode::Replay) {
+        replay_point(SchedTracePoint::Dispatch, conn_id, true);
+    }
+}
+
+void sched_trace_task_execute() {
+    if (trace_mode == SchedTraceMode::Record) {
+        record_point(SchedTracePoint::Task, task_serial++);
+    } else if (trace_mode == SchedTraceMode::Replay) {
+        replay_point(SchedTracePoint::Task, task_serial++, false);
+    }
+}
+
+void sched_trace_notify_io(uint32_t conn_id) {
+    if (trace_mode == SchedTraceMode::Record) {
+        record_point(SchedTracePoint::NotifyIo, conn_id);
+    } else if (trace_mode == SchedTraceMode::Replay) {
+        replay_point(SchedTracePoint::NotifyIo, conn_id, true);
+    }
+}
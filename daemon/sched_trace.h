@@ -0,0 +1,81 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include "config.h"
+
+#include <cstdint>
+
+/**
+ * Scheduling record/replay harness ("sched_trace_mode" /
+ * "sched_trace_file" in the settings).
+ *
+ * Scheduling bugs rarely survive being looked at: by the time a
+ * misordered notification or a task/dispatch race shows up in
+ * production it can't be reproduced on a developer machine. In record
+ * mode the daemon appends a compact record to the trace file every
+ * time a worker dispatches an event loop callback, the executor runs
+ * a task, or an engine delivers a notify_io_complete. In replay mode
+ * the daemon loads that file at startup and each of those points
+ * blocks until it is the next record in the trace, re-imposing the
+ * recorded interleaving on a fresh run so the failure can be debugged
+ * offline.
+ *
+ * The harness is only tractable for single-worker configurations
+ * (threads=1); with multiple workers the recorded order spans
+ * schedules the replaying kernel is free to make differently, and
+ * initialize_sched_trace() refuses the combination. Replay matches
+ * dispatches and notifications on the connection id, which assumes
+ * connections are accepted in the same order as in the recorded run
+ * (the natural situation for a scripted test workload). If the replayed
+ * run diverges from the trace the blocked point times out, the
+ * divergence is logged with its position in the trace, and enforcement
+ * is switched off rather than deadlocking the daemon.
+ */
+
+/**
+ * Read the trace mode from the settings and open (record) or load
+ * (replay) the trace file. Called once at startup before any
+ * connection is accepted. Throws std::invalid_argument if the
+ * configuration can't be used (more than one worker thread, no trace
+ * file given, or an unreadable replay file).
+ */
+void initialize_sched_trace();
+
+/** Flush and close the trace file (record mode) */
+void shutdown_sched_trace();
+
+/**
+ * A worker thread is about to dispatch the event loop callback for
+ * the given connection. Called before the thread lock is taken so
+ * that a blocked replay can't stall notify_io_complete.
+ */
+void sched_trace_event_dispatch(uint32_t conn_id);
+
+/**
+ * The executor is about to run a task. Tasks carry no stable identity
+ * across runs, so replay only enforces *when* a task runs relative to
+ * dispatches and notifications, not which one (with a single executor
+ * the queue order takes care of that).
+ */
+void sched_trace_task_execute();
+
+/**
+ * An engine is delivering a notify_io_complete for the given
+ * connection. Called before the thread lock is taken.
+ */
+void sched_trace_notify_io(uint32_t conn_id);
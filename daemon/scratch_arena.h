@@ -0,0 +1,162 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/cb_malloc.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/**
+ * A per-connection bump allocator for the scratch memory a command needs
+ * while it is being executed (response staging, temporary keys and
+ * vectors). Allocation is a pointer increment into a single block and
+ * there is no per-allocation free; the whole arena is reset in one go
+ * when the command's memory is known to be dead (see reset_cmd_handler),
+ * so the common command makes no heap calls outside the engine.
+ *
+ * Requests that don't fit in the block are refused (alloc returns
+ * nullptr) and the caller falls back to the regular heap; owns() lets
+ * the shared free paths tell the two kinds of pointer apart.
+ */
+class ScratchArena {
+public:
+    ScratchArena()
+        : block(nullptr),
+          cursor(0),
+          high_watermark(0) {
+        // the block itself is allocated on first use; most connections
+        // never get past the state machine handshake states
+    }
+
+    ScratchArena(const ScratchArena&) = delete;
+
+    ~ScratchArena() {
+        cb_free(block);
+    }
+
+    /**
+     * Carve <em>nbytes</em> (suitably aligned for any object) out of the
+     * arena, or return nullptr if it doesn't fit - the caller should
+     * fall back to the regular heap.
+     */
+    char* alloc(size_t nbytes) {
+        size_t aligned = (nbytes + (Alignment - 1)) & ~size_t(Alignment - 1);
+        if (aligned < nbytes || aligned > Capacity - cursor) {
+            return nullptr;
+        }
+        if (block == nullptr) {
+            block = reinterpret_cast<char*>(cb_malloc(Capacity));
+            if (block == nullptr) {
+                return nullptr;
+            }
+        }
+        char* ret = block + cursor;
+        cursor += aligned;
+        if (cursor > high_watermark) {
+            high_watermark = cursor;
+        }
+        return ret;
+    }
+
+    /**
+     * Throw away everything allocated from the arena. Only legal when
+     * nothing handed out by alloc() can still be referenced.
+     */
+    void reset() {
+        cursor = 0;
+    }
+
+    /**
+     * Does this pointer point into the arena's block? (Used by free
+     * paths which see a mix of arena and heap pointers.)
+     */
+    bool owns(const void* ptr) const {
+        return block != nullptr &&
+               ptr >= block && ptr < block + Capacity;
+    }
+
+    /**
+     * The largest number of bytes ever live in the arena at once; used
+     * to judge whether the capacity is sized right for the workload.
+     */
+    size_t getHighWatermark() const {
+        return high_watermark;
+    }
+
+private:
+    static const size_t Capacity = 16 * 1024;
+    static const size_t Alignment = 8;
+
+    /** The arena's single block; allocated lazily */
+    char* block;
+    /** Offset of the first free byte in the block */
+    size_t cursor;
+    /** Highest value cursor has reached */
+    size_t high_watermark;
+};
+
+/**
+ * Minimal C++11 allocator fronting a ScratchArena so standard containers
+ * (the per-command vectors and strings) can draw from it. Memory the
+ * arena can't serve comes from the regular heap; deallocate frees only
+ * those, arena memory is reclaimed by the arena reset.
+ */
+template <typename T>
+class ScratchAllocator {
+public:
+    typedef T value_type;
+
+    explicit ScratchAllocator(ScratchArena& arena_)
+        : arena(&arena_) {
+    }
+
+    template <typename U>
+    ScratchAllocator(const ScratchAllocator<U>& other)
+        : arena(other.arena) {
+    }
+
+    T* allocate(size_t n) {
+        char* ptr = arena->alloc(n * sizeof(T));
+        if (ptr == nullptr) {
+            ptr = reinterpret_cast<char*>(cb_malloc(n * sizeof(T)));
+            if (ptr == nullptr) {
+                throw std::bad_alloc();
+            }
+        }
+        return reinterpret_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t) {
+        if (!arena->owns(ptr)) {
+            cb_free(ptr);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const ScratchAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ScratchAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+
+    ScratchArena* arena;
+};
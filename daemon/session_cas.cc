@@ -19,51 +19,83 @@
 
 SessionCas session_cas;
 
+/*
+ * The counter operations are the fast path (they run for every command
+ * carrying a cas value) and are plain atomic operations. The token may
+ * only change while no sessions are registered, which is guaranteed
+ * without holding a mutex over both members by having both sides
+ * recheck the other member after their own update:
+ *
+ *   - increment_session_counter validates the token, registers itself
+ *     in the counter and then revalidates the token (backing off if
+ *     it changed in between).
+ *   - cas checks the counter, stores the new token and then rechecks
+ *     the counter (restoring the old token if a session slipped in).
+ *
+ * With the (default) sequentially consistent ordering at least one of
+ * the two is guaranteed to observe the other, so we can never end up
+ * with a registered session holding a stale token.
+ */
+
 ENGINE_ERROR_CODE SessionCas::cas(uint64_t newValue, uint64_t casval,
                                   uint64_t& currentValue) {
-    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
-    {
-        std::lock_guard<std::mutex> lock(mutex);
+    // The mutex just serializes the writers; it is never taken by the
+    // readers
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (counter.load() != 0) {
+        currentValue = value.load();
+        return ENGINE_EBUSY;
+    }
+
+    const uint64_t current = value.load();
+    if (casval != 0 && casval != current) {
+        currentValue = current;
+        return ENGINE_KEY_EEXISTS;
+    }
+
+    value.store(newValue);
 
-        if (session_cas.counter > 0) {
-            ret = ENGINE_EBUSY;
-        } else {
-            if (casval == 0 || casval == value) {
-                value = newValue;
-            } else {
-                ret = ENGINE_KEY_EEXISTS;
-            }
-        }
-        currentValue = value;
+    if (counter.load() != 0) {
+        // A session registered itself between the counter check and
+        // the store. It validated against the old token, so restore
+        // it and report busy (if the session happened to see the new
+        // token it has already backed off and released the counter).
+        value.store(current);
+        currentValue = current;
+        return ENGINE_EBUSY;
     }
 
-    return ret;
+    currentValue = newValue;
+    return ENGINE_SUCCESS;
 }
 
 uint64_t SessionCas::getCasValue() {
-    std::lock_guard<std::mutex> lock(mutex);
-    return value;
+    return value.load();
 }
 
 void SessionCas::decrement_session_counter()  {
-    std::lock_guard<std::mutex> lock(mutex);
-    if (counter == 0) {
+    const auto prev = counter.fetch_sub(1);
+    if (prev == 0) {
+        // An unmatched decrement; undo the wrap before complaining
+        counter.fetch_add(1);
         throw std::logic_error("session counter can't be 0");
     }
-    --counter;
 }
 
 bool SessionCas::increment_session_counter(const uint64_t cas)  {
-    std::lock_guard<std::mutex> lock(mutex);
-    bool ret = true;
-    if (cas != 0) {
-        if (value != cas) {
-            ret = false;
-        } else {
-            counter++;
-        }
-    } else {
-        counter++;
+    if (cas != 0 && value.load() != cas) {
+        return false;
     }
-    return ret;
+
+    counter.fetch_add(1);
+
+    if (cas != 0 && value.load() != cas) {
+        // The token was swapped between the validation above and our
+        // registration becoming visible. Back off; the swapper won
+        counter.fetch_sub(1);
+        return false;
+    }
+
+    return true;
 }
@@ -16,6 +16,7 @@
  */
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <mutex>
 #include <memcached/types.h>
@@ -73,18 +74,25 @@ private:
      * use <code>cas</code> to update (it may not be modified unless
      * counter == 0)
      */
-    uint64_t value;
+    std::atomic<uint64_t> value;
 
     /**
      * Whenever we need to perform a potentially long-lived operation
      * protected by the session cas, we bump this counter and no one may
      * change the CAS value until we're done (used to protect ourself from
-     * race conditions)
+     * race conditions).
+     *
+     * The counter operations are plain atomics (every command with a
+     * cas value hits this path, so we don't want them all to serialize
+     * on a mutex); see the comments in session_cas.cc for how they
+     * synchronize with cas().
      */
-    uint64_t counter;
+    std::atomic<uint64_t> counter;
 
     /**
-     * All members in the class is protected with this mutex
+     * Serializes the (rare) attempts to change the CAS value. The
+     * fast path (increment/decrement of the counter) never takes
+     * this mutex.
      */
     std::mutex mutex;
 };
@@ -0,0 +1,275 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "session_resume.h"
+#include "memcached.h"
+#include "buckets.h"
+#include "mc_time.h"
+
+#include <cbcrypto/cbcrypto.h>
+#include <cJSON_utils.h>
+
+#include <atomic>
+#include <ctime>
+#include <random>
+#include <vector>
+
+/* A token is the JSON payload followed by a HMAC-SHA256 of the payload
+ * under a key which never leaves this process. */
+static const size_t TOKEN_MAC_SIZE = cb::crypto::SHA256_DIGEST_SIZE;
+
+/* Only the current token format is accepted. */
+static const int TOKEN_VERSION = 1;
+
+/**
+ * Tokens exist to bridge a reconnect (storm); don't let them live long
+ * enough to turn into a long-term credential. Ten minutes comfortably
+ * covers a failover without keeping identities around for ever.
+ */
+static const time_t TOKEN_MAX_AGE = 600;
+
+/**
+ * Generation number baked into every token. Bumping it (when the
+ * password database is refreshed) invalidates everything issued
+ * earlier without having to track the individual tokens.
+ */
+static std::atomic<uint64_t> token_generation(1);
+
+void session_resume_invalidate_tokens() {
+    token_generation++;
+}
+
+/**
+ * The key tokens are sealed under. Generated on first use and never
+ * exposed; a restart therefore invalidates all outstanding tokens,
+ * which is exactly the behavior we want (clients just fall back to the
+ * normal authentication handshake).
+ */
+static const std::vector<uint8_t>& get_token_key() {
+    static const std::vector<uint8_t> key = [] {
+        std::random_device rd;
+        std::vector<uint8_t> ret(TOKEN_MAC_SIZE);
+        for (auto& byte : ret) {
+            byte = uint8_t(rd());
+        }
+        return ret;
+    }();
+    return key;
+}
+
+/**
+ * Stamp the generation/issue time onto the given state description and
+ * seal it: serialize and append the MAC. Returns the token ("" on
+ * failure).
+ */
+static std::string seal_payload(cJSON* root) {
+    cJSON_AddNumberToObject(root, "generation",
+                            double(token_generation.load()));
+    cJSON_AddNumberToObject(root, "issued",
+                            double(mc_time_get_epoch_seconds()));
+
+    char* ptr = cJSON_PrintUnformatted(root);
+    if (ptr == nullptr) {
+        return "";
+    }
+    std::string token(ptr);
+    cJSON_Free(ptr);
+
+    try {
+        const std::vector<uint8_t> payload(token.begin(), token.end());
+        const auto mac = cb::crypto::HMAC(cb::crypto::Algorithm::SHA256,
+                                          get_token_key(), payload);
+        token.append(reinterpret_cast<const char*>(mac.data()), mac.size());
+    } catch (const std::exception&) {
+        return "";
+    }
+
+    return token;
+}
+
+std::string session_resume_make_token(McbpConnection* c) {
+    if (!c->isAuthenticated()) {
+        return "";
+    }
+
+    unique_cJSON_ptr root(cJSON_CreateObject());
+    if (!root) {
+        return "";
+    }
+    cJSON_AddNumberToObject(root.get(), "version", TOKEN_VERSION);
+    cJSON_AddStringToObject(root.get(), "user", c->getUsername());
+    cJSON_AddStringToObject(root.get(), "bucket", getBucketName(c));
+
+    cJSON* features = cJSON_CreateArray();
+    if (c->isSupportsDatatype()) {
+        cJSON_AddItemToArray(features,
+                             cJSON_CreateNumber(PROTOCOL_BINARY_FEATURE_DATATYPE));
+    }
+    if (c->isSupportsMutationExtras()) {
+        cJSON_AddItemToArray(features,
+                             cJSON_CreateNumber(PROTOCOL_BINARY_FEATURE_MUTATION_SEQNO));
+    }
+    cJSON_AddItemToObject(root.get(), "features", features);
+
+    return seal_payload(root.get());
+}
+
+std::string session_resume_seal_state(const char* json, size_t len) {
+    const std::string input(json, len);
+    unique_cJSON_ptr supplied(cJSON_Parse(input.c_str()));
+    if (!supplied) {
+        return "";
+    }
+
+    auto* user = cJSON_GetObjectItem(supplied.get(), "user");
+    auto* bucket = cJSON_GetObjectItem(supplied.get(), "bucket");
+    auto* features = cJSON_GetObjectItem(supplied.get(), "features");
+
+    if (user == nullptr || user->type != cJSON_String ||
+        bucket == nullptr || bucket->type != cJSON_String ||
+        (features != nullptr && features->type != cJSON_Array)) {
+        return "";
+    }
+
+    /* Rebuild a canonical payload from the validated fields rather
+     * than sealing the supplied document verbatim; anything else the
+     * caller may have put in there (including a generation or issue
+     * time) is dropped on the floor. */
+    unique_cJSON_ptr root(cJSON_CreateObject());
+    if (!root) {
+        return "";
+    }
+    cJSON_AddNumberToObject(root.get(), "version", TOKEN_VERSION);
+    cJSON_AddStringToObject(root.get(), "user", user->valuestring);
+    cJSON_AddStringToObject(root.get(), "bucket", bucket->valuestring);
+
+    cJSON* out = cJSON_CreateArray();
+    if (features != nullptr) {
+        for (auto* feature = features->child; feature != nullptr;
+             feature = feature->next) {
+            if (feature->type == cJSON_Number) {
+                cJSON_AddItemToArray(out,
+                                     cJSON_CreateNumber(feature->valueint));
+            }
+        }
+    }
+    cJSON_AddItemToObject(root.get(), "features", out);
+
+    return seal_payload(root.get());
+}
+
+protocol_binary_response_status session_resume_apply_token(
+        McbpConnection* c, const char* token, size_t len) {
+    if (len <= TOKEN_MAC_SIZE) {
+        return PROTOCOL_BINARY_RESPONSE_AUTH_ERROR;
+    }
+    const size_t payload_len = len - TOKEN_MAC_SIZE;
+
+    std::vector<uint8_t> mac;
+    try {
+        const std::vector<uint8_t> payload(token, token + payload_len);
+        mac = cb::crypto::HMAC(cb::crypto::Algorithm::SHA256,
+                               get_token_key(), payload);
+    } catch (const std::exception&) {
+        return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+    }
+
+    /* Constant time comparison so the MAC can't be guessed a byte at
+     * a time. */
+    const auto* provided = reinterpret_cast<const uint8_t*>(token +
+                                                            payload_len);
+    uint8_t diff = 0;
+    for (size_t ii = 0; ii < TOKEN_MAC_SIZE; ++ii) {
+        diff |= uint8_t(mac[ii] ^ provided[ii]);
+    }
+    if (diff != 0) {
+        return PROTOCOL_BINARY_RESPONSE_AUTH_ERROR;
+    }
+
+    /* The payload is now known to be one we sealed ourselves. */
+    const std::string json(token, payload_len);
+    unique_cJSON_ptr root(cJSON_Parse(json.c_str()));
+    if (!root) {
+        return PROTOCOL_BINARY_RESPONSE_AUTH_ERROR;
+    }
+
+    auto* version = cJSON_GetObjectItem(root.get(), "version");
+    auto* user = cJSON_GetObjectItem(root.get(), "user");
+    auto* bucket = cJSON_GetObjectItem(root.get(), "bucket");
+    auto* features = cJSON_GetObjectItem(root.get(), "features");
+    auto* generation = cJSON_GetObjectItem(root.get(), "generation");
+    auto* issued = cJSON_GetObjectItem(root.get(), "issued");
+
+    if (version == nullptr || version->type != cJSON_Number ||
+        user == nullptr || user->type != cJSON_String ||
+        bucket == nullptr || bucket->type != cJSON_String ||
+        features == nullptr || features->type != cJSON_Array ||
+        generation == nullptr || generation->type != cJSON_Number ||
+        issued == nullptr || issued->type != cJSON_Number) {
+        return PROTOCOL_BINARY_RESPONSE_AUTH_ERROR;
+    }
+
+    if (version->valueint != TOKEN_VERSION) {
+        return PROTOCOL_BINARY_RESPONSE_AUTH_ERROR;
+    }
+
+    if (uint64_t(generation->valuedouble) != token_generation.load()) {
+        /* Issued before the password database was refreshed. */
+        return PROTOCOL_BINARY_RESPONSE_AUTH_ERROR;
+    }
+
+    const time_t now = mc_time_get_epoch_seconds();
+    const time_t then = time_t(issued->valuedouble);
+    if (then > now || (now - then) > TOKEN_MAX_AGE) {
+        return PROTOCOL_BINARY_RESPONSE_AUTH_ERROR;
+    }
+
+    /* Restore the identity. The admin status is recomputed from the
+     * current configuration, never trusted from the token. */
+    c->restoreAuthentication(user->valuestring);
+    if (settings.isAdmin(user->valuestring)) {
+        c->setAdmin(true);
+    }
+
+    /* Replay the recorded features subject to the same conditions the
+     * HELLO executor applies. */
+    for (auto* feature = features->child; feature != nullptr;
+         feature = feature->next) {
+        if (feature->type != cJSON_Number) {
+            continue;
+        }
+        switch (feature->valueint) {
+        case PROTOCOL_BINARY_FEATURE_DATATYPE:
+            if (settings.isDatatypeSupport()) {
+                c->setSupportsDatatype(true);
+            }
+            break;
+        case PROTOCOL_BINARY_FEATURE_MUTATION_SEQNO:
+            c->setSupportsMutationExtras(true);
+            break;
+        }
+    }
+
+    if (!associate_bucket(c, bucket->valuestring)) {
+        /* The bucket went away while the client was gone; don't leave
+         * the connection half-restored. */
+        c->restartAuthentication();
+        return PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
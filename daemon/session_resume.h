@@ -0,0 +1,92 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <memcached/protocol_binary.h>
+
+#include <string>
+
+class McbpConnection;
+
+/**
+ * Session resumption.
+ *
+ * A reconnecting client normally spends three round trips (HELLO, SASL
+ * and SELECT_BUCKET) before its first real operation, and the server
+ * recomputes the full authentication for each of them. After
+ * authenticating, a client may instead ask for an opaque resumption
+ * token (GET_SESSION_TOKEN) which seals the negotiated state (user,
+ * bucket, features) under a process-local HMAC key. Presenting the
+ * token on a new connection (RESUME_SESSION) restores that state with
+ * a single MAC verification, which collapses the reconnect storms
+ * following a failover.
+ *
+ * Tokens are deliberately short-lived and go stale whenever the
+ * password database is refreshed; the admin status of the user is
+ * always recomputed on resumption, never taken from the token.
+ */
+
+/**
+ * Create a resumption token describing the connection's currently
+ * negotiated state.
+ *
+ * @param c the connection to describe
+ * @return the opaque token, or an empty string if the connection is
+ *         not authenticated (or sealing the token failed).
+ */
+std::string session_resume_make_token(McbpConnection* c);
+
+/**
+ * Seal an explicitly supplied state description into a resumption
+ * token valid on this node. Used for planned failover handoff: an
+ * orchestrator captures the negotiated state of the clients on the
+ * node going into maintenance and pre-seals matching tokens on the
+ * peer, which the clients then present via RESUME_SESSION without any
+ * renegotiation round trips. Callers are trusted (the command requires
+ * node management privileges); the description is a JSON object with
+ * "user" and "bucket" strings and an optional "features" array of
+ * HELLO feature codes.
+ *
+ * @param json the state description
+ * @param len length of the description in bytes
+ * @return the sealed token, or an empty string if the description is
+ *         malformed.
+ */
+std::string session_resume_seal_state(const char* json, size_t len);
+
+/**
+ * Verify the given token and restore the connection state recorded in
+ * it.
+ *
+ * @param c the connection to restore the state onto
+ * @param token the token as presented by the client
+ * @param len length of the token in bytes
+ * @return PROTOCOL_BINARY_RESPONSE_SUCCESS if the state was restored,
+ *         PROTOCOL_BINARY_RESPONSE_AUTH_ERROR if the token doesn't
+ *         verify (bad MAC, stale, malformed),
+ *         PROTOCOL_BINARY_RESPONSE_KEY_ENOENT if the bucket recorded
+ *         in the token no longer exists.
+ */
+protocol_binary_response_status session_resume_apply_token(
+        McbpConnection* c, const char* token, size_t len);
+
+/**
+ * Invalidate every previously issued resumption token. Called when the
+ * password database is refreshed, as the recorded identities may no
+ * longer be valid.
+ */
+void session_resume_invalidate_tokens();
@@ -16,6 +16,7 @@
  */
 #include "config.h"
 
+#include <cinttypes>
 #include <cstring>
 #include <platform/dirutils.h>
 #include "settings.h"
@@ -32,23 +33,47 @@ Settings settings;
 Settings::Settings()
     : num_threads(0),
       require_sasl(false),
+      reuseport_listeners(false),
+      thread_affinity(false),
+      event_backend("default"),
+      engine_module_warming("off"),
+      sched_trace_mode("off"),
       bio_drain_buffer_sz(0),
+      greedy_read_budget(0),
+      scheduler_quantum_us(0),
+      timings_precision(2),
+      phase_timing_sample_every(100),
+      stats_snapshot_age(0),
+      bucket_warmup_ops(0),
+      dcp_ship_batch_size(128),
+      ship_log_byte_limit(0),
       datatype(false),
+      response_compression_threshold(0),
+      per_op_memory_budget(0),
       reqs_per_event_high_priority(0),
       reqs_per_event_med_priority(0),
       reqs_per_event_low_priority(0),
       default_reqs_per_event(00),
+      event_time_budget_high_priority(0),
+      event_time_budget_med_priority(0),
+      event_time_budget_low_priority(0),
+      default_event_time_budget(0),
       max_packet_size(0),
       require_init(false),
+      ssl_session_cache_size(0),
       topkeys_size(0),
+      topkeys_sketch(false),
       stdin_listen(false),
       exit_on_connection_close(false),
       maxconns(0),
       max_buckets(0) {
 
+    notifications_deferred = false;
     verbose.store(0);
     connection_idle_time.reset();
     dedupe_nmvb_maps.store(false);
+    connection_rebalance.store(false);
+    connection_shed_headroom.reset();
 
     memset(&has, 0, sizeof(has));
     memset(&extensions, 0, sizeof(extensions));
@@ -109,6 +134,24 @@ static void handle_audit_file(Settings& s, cJSON* obj) {
     s.setAuditFile(obj->valuestring);
 }
 
+/**
+ * Handle the "stats_shm_path" tag in the settings
+ *
+ *  The value must be a string naming the file to back the
+ *  shared-memory statistics segment with (the file is created by the
+ *  daemon, so no existence check here)
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_stats_shm_path(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_String) {
+        throw std::invalid_argument("\"stats_shm_path\" must be a string");
+    }
+
+    s.setStatsShmPath(obj->valuestring);
+}
+
 /**
  * Handle the "threads" tag in the settings
  *
@@ -196,6 +239,40 @@ static void handle_reqs_event(Settings& s, cJSON* obj) {
     s.setRequestsPerEventNotification(obj->valueint, priority);
 }
 
+/**
+ * Handle "default_event_time_budget", "event_time_budget_high_priority",
+ * "event_time_budget_med_priority" and "event_time_budget_low_priority"
+ * tag in the settings
+ *
+ *  The value must be an integer value (microseconds; 0 disables the
+ *  time budget)
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_event_time_budget(Settings& s, cJSON* obj) {
+    std::string name(obj->string);
+
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument("\"" + name + "\" must be an integer");
+    }
+
+    EventPriority priority;
+
+    if (name == "default_event_time_budget") {
+        priority = EventPriority::Default;
+    } else if (name == "event_time_budget_high_priority") {
+        priority = EventPriority::High;
+    } else if (name == "event_time_budget_med_priority") {
+        priority = EventPriority::Medium;
+    } else if (name == "event_time_budget_low_priority") {
+        priority = EventPriority::Low;
+    } else {
+        throw std::invalid_argument("Invalid key specified: " + name);
+    }
+    s.setEventTimeBudget(obj->valueint, priority);
+}
+
 /**
  * Handle the "verbosity" tag in the settings
  *
@@ -227,6 +304,128 @@ static void handle_connection_idle_time(Settings& s, cJSON* obj) {
     s.setConnectionIdleTime(obj->valueint);
 }
 
+/**
+ * Handle the "reuseport_listeners" tag in the settings
+ *
+ *  The value must be a boolean value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_reuseport_listeners(Settings& s, cJSON* obj) {
+    if (obj->type == cJSON_True) {
+        s.setReuseportListeners(true);
+    } else if (obj->type == cJSON_False) {
+        s.setReuseportListeners(false);
+    } else {
+        throw std::invalid_argument(
+            "\"reuseport_listeners\" must be a boolean value");
+    }
+}
+
+/**
+ * Handle the "thread_affinity" tag in the settings
+ *
+ *  The value must be a boolean value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_thread_affinity(Settings& s, cJSON* obj) {
+    if (obj->type == cJSON_True) {
+        s.setThreadAffinity(true);
+    } else if (obj->type == cJSON_False) {
+        s.setThreadAffinity(false);
+    } else {
+        throw std::invalid_argument(
+            "\"thread_affinity\" must be a boolean value");
+    }
+}
+
+/**
+ * Handle the "event_backend" tag in the settings
+ *
+ *  The value must be one of the strings "default" or "epoll"
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_event_backend(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_String) {
+        throw std::invalid_argument(
+            "\"event_backend\" must be a string");
+    }
+
+    std::string backend(obj->valuestring);
+    if (backend != "default" && backend != "epoll") {
+        throw std::invalid_argument(
+            "\"event_backend\" must be \"default\" or \"epoll\"");
+    }
+    s.setEventBackend(backend);
+}
+
+/**
+ * Handle the "engine_module_warming" tag in the settings
+ *
+ *  The value must be one of the strings "off", "readahead" or "lock"
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_engine_module_warming(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_String) {
+        throw std::invalid_argument(
+            "\"engine_module_warming\" must be a string");
+    }
+
+    std::string mode(obj->valuestring);
+    if (mode != "off" && mode != "readahead" && mode != "lock") {
+        throw std::invalid_argument(
+            "\"engine_module_warming\" must be \"off\", \"readahead\" or "
+            "\"lock\"");
+    }
+    s.setEngineModuleWarming(mode);
+}
+
+/**
+ * Handle the "sched_trace_mode" tag in the settings
+ *
+ *  The value must be one of the strings "off", "record" or "replay"
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_sched_trace_mode(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_String) {
+        throw std::invalid_argument(
+            "\"sched_trace_mode\" must be a string");
+    }
+
+    std::string mode(obj->valuestring);
+    if (mode != "off" && mode != "record" && mode != "replay") {
+        throw std::invalid_argument(
+            "\"sched_trace_mode\" must be \"off\", \"record\" or "
+            "\"replay\"");
+    }
+    s.setSchedTraceMode(mode);
+}
+
+/**
+ * Handle the "sched_trace_file" tag in the settings
+ *
+ *  The value must be a string pointing at the trace file
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_sched_trace_file(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_String) {
+        throw std::invalid_argument(
+            "\"sched_trace_file\" must be a string");
+    }
+    s.setSchedTraceFile(obj->valuestring);
+}
+
 /**
  * Handle the "bio_drain_buffer_sz" tag in the settings
  *
@@ -243,6 +442,243 @@ static void handle_bio_drain_buffer_sz(Settings& s, cJSON* obj) {
     s.setBioDrainBufferSize(obj->valueint);
 }
 
+/**
+ * Handle the "greedy_read_budget" tag in the settings
+ *
+ *  The value must be a non-negative numeric value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_greedy_read_budget(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"greedy_read_budget\" must be an integer");
+    }
+    if (obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"greedy_read_budget\" must be a positive number");
+    }
+    s.setGreedyReadBudget(obj->valueint);
+}
+
+/**
+ * Handle the "scheduler_quantum_us" tag in the settings
+ *
+ *  The value must be a non-negative numeric value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_scheduler_quantum_us(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"scheduler_quantum_us\" must be an integer");
+    }
+    if (obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"scheduler_quantum_us\" must be a positive number");
+    }
+    s.setSchedulerQuantumUs(obj->valueint);
+}
+
+/**
+ * Handle the "timings_precision" tag in the settings
+ *
+ *  The value must be an integer between 1 and 3 (the number of
+ *  significant decimal digits preserved by the high dynamic range
+ *  command timing histograms)
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_timings_precision(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"timings_precision\" must be an integer");
+    }
+    if (obj->valueint < 1 || obj->valueint > 3) {
+        throw std::invalid_argument(
+            "\"timings_precision\" must be between 1 and 3");
+    }
+    s.setTimingsPrecision(obj->valueint);
+}
+
+/**
+ * Handle the "stats_snapshot_age" tag in the settings
+ *
+ *  The value must be a non-negative integer; the number of seconds a
+ *  cached "stats" serialization may be served before it is re-rendered
+ *  (0 disables the cache)
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_stats_snapshot_age(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"stats_snapshot_age\" must be an integer");
+    }
+    if (obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"stats_snapshot_age\" must be a non-negative integer");
+    }
+    s.setStatsSnapshotAge(obj->valueint);
+}
+
+/**
+ * Handle the "bucket_warmup_ops" tag in the settings
+ *
+ *  The value must be a non-negative integer; the number of synthetic
+ *  store/get/delete cycles driven through a freshly created bucket's
+ *  engine before the bucket is marked ready (0 disables the warmup)
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_bucket_warmup_ops(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"bucket_warmup_ops\" must be an integer");
+    }
+    if (obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"bucket_warmup_ops\" must be a non-negative integer");
+    }
+    s.setBucketWarmupOps(obj->valueint);
+}
+
+/**
+ * Handle the "dcp_ship_batch_size" tag in the settings
+ *
+ *  The value must be a positive integer; the maximum number of
+ *  messages a DCP producer may batch into a single vectored write
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_dcp_ship_batch_size(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"dcp_ship_batch_size\" must be an integer");
+    }
+    if (obj->valueint < 1) {
+        throw std::invalid_argument(
+            "\"dcp_ship_batch_size\" must be a positive integer");
+    }
+    s.setDcpShipBatchSize(obj->valueint);
+}
+
+/**
+ * Handle the "ship_log_byte_limit" tag in the settings
+ *
+ *  The value must be a non-negative integer; the maximum number of
+ *  bytes a TAP/DCP connection may stage onto the wire per worker
+ *  thread timeslice. 0 means unlimited.
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_ship_log_byte_limit(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"ship_log_byte_limit\" must be an integer");
+    }
+    if (obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"ship_log_byte_limit\" must be a non-negative integer");
+    }
+    s.setShipLogByteLimit(uint32_t(obj->valueint));
+}
+
+/**
+ * Handle the "response_compression_threshold" tag in the settings
+ *
+ *  The value must be a non-negative integer; the minimum value size
+ *  (in bytes) for which the server compresses responses on behalf of
+ *  datatype-aware clients. 0 disables server-side compression.
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_response_compression_threshold(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"response_compression_threshold\" must be an integer");
+    }
+    if (obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"response_compression_threshold\" must be a non-negative "
+                "integer");
+    }
+    s.setResponseCompressionThreshold(obj->valueint);
+}
+
+/**
+ * Handle the "per_op_memory_budget" tag in the settings
+ *
+ *  The value must be a non-negative integer; the maximum number of
+ *  bytes of scratch memory (response staging, subdoc intermediate
+ *  documents) a single command may allocate before it is failed with
+ *  a temporary failure. 0 disables the cap.
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_per_op_memory_budget(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"per_op_memory_budget\" must be an integer");
+    }
+    if (obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"per_op_memory_budget\" must be a non-negative integer");
+    }
+    s.setPerOpMemoryBudget(size_t(obj->valueint));
+}
+
+/**
+ * Handle the "topkeys_sketch" tag in the settings
+ *
+ *  The value must be a boolean value; when set topkeys uses the
+ *  probabilistic per-worker sketches instead of the exact
+ *  mutex-protected shards
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_topkeys_sketch(Settings& s, cJSON* obj) {
+    if (obj->type == cJSON_True) {
+        s.setTopkeysSketchEnabled(true);
+    } else if (obj->type == cJSON_False) {
+        s.setTopkeysSketchEnabled(false);
+    } else {
+        throw std::invalid_argument(
+            "\"topkeys_sketch\" must be a boolean value");
+    }
+}
+
+/**
+ * Handle the "phase_timing_sample_every" tag in the settings
+ *
+ *  The value must be a non-negative integer; every Nth command on a
+ *  connection records per-phase timings (0 disables the collection)
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_phase_timing_sample_every(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument(
+            "\"phase_timing_sample_every\" must be an integer");
+    }
+    if (obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"phase_timing_sample_every\" must be a non-negative integer");
+    }
+    s.setPhaseTimingSampleEvery(obj->valueint);
+}
+
 /**
  * Handle the "datatype_support" tag in the settings
  *
@@ -321,6 +757,22 @@ static void handle_ssl_minimum_protocol(Settings& s, cJSON* obj) {
     s.setSslMinimumProtocol(obj->valuestring);
 }
 
+/**
+ * Handle the "ssl_session_cache_size" tag in the settings
+ *
+ *  The value must be a numeric value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_ssl_session_cache_size(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"ssl_session_cache_size\" must be a positive integer");
+    }
+    s.setSslSessionCacheSize(obj->valueint);
+}
+
 /**
  * Handle the "get_max_packet_size" tag in the settings
  *
@@ -409,6 +861,41 @@ static void handle_dedupe_nmvb_maps(Settings& s, cJSON* obj) {
     }
 }
 
+/**
+ * Handle the "connection_rebalance" tag in the settings
+ *
+ *  The value must be a boolean value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_connection_rebalance(Settings& s, cJSON* obj) {
+    if (obj->type == cJSON_True) {
+        s.setConnectionRebalance(true);
+    } else if (obj->type == cJSON_False) {
+        s.setConnectionRebalance(false);
+    } else {
+        throw std::invalid_argument(
+            "\"connection_rebalance\" must be a boolean value");
+    }
+}
+
+/**
+ * Handle the "connection_shed_headroom" tag in the settings
+ *
+ *  The value must be a non-negative numeric value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_connection_shed_headroom(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"connection_shed_headroom\" must be a non-negative integer");
+    }
+    s.setConnectionShedHeadroom(size_t(obj->valueint));
+}
+
 /**
  * Handle the "extensions" tag in the settings
  *
@@ -455,6 +942,37 @@ static void handle_interfaces(Settings& s, cJSON* obj) {
     }
 }
 
+/**
+ * Handle the "experiments" tag in the settings
+ *
+ *  The value must be an array of objects, each with a mandatory
+ *  "name" (string) and an optional "percentage" (0-100, default 0)
+ *  and "port" (restrict the experiment to one interface; default all)
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_experiments(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Array) {
+        throw std::invalid_argument("\"experiments\" must be an array");
+    }
+
+    for (auto* child = obj->child; child != nullptr; child = child->next) {
+        if (child->type != cJSON_Object) {
+            throw std::invalid_argument(
+                "Elements in the \"experiments\" array must be objects");
+        }
+        experiment_settings exp(child);
+        for (const auto& other : s.getExperiments()) {
+            if (other.name == exp.name) {
+                throw std::invalid_argument(
+                    "Experiment names must be unique");
+            }
+        }
+        s.addExperiment(exp);
+    }
+}
+
 static void handle_breakpad(Settings& s, cJSON* obj) {
     if (obj->type != cJSON_Object) {
         throw std::invalid_argument("\"breakpad\" must be an object");
@@ -490,8 +1008,10 @@ void Settings::reconfigure(const unique_cJSON_ptr& json) {
     std::vector<settings_config_tokens> handlers = {
         {"admin",                        handle_admin},
         {"audit_file",                   handle_audit_file},
+        {"stats_shm_path",               handle_stats_shm_path},
         {"threads",                      handle_threads},
         {"interfaces",                   handle_interfaces},
+        {"experiments",                  handle_experiments},
         {"extensions",                   handle_extensions},
         {"require_init",                 handle_require_init},
         {"require_sasl",                 handle_require_sasl},
@@ -499,19 +1019,44 @@ void Settings::reconfigure(const unique_cJSON_ptr& json) {
         {"reqs_per_event_high_priority", handle_reqs_event},
         {"reqs_per_event_med_priority",  handle_reqs_event},
         {"reqs_per_event_low_priority",  handle_reqs_event},
+        {"default_event_time_budget",    handle_event_time_budget},
+        {"event_time_budget_high_priority", handle_event_time_budget},
+        {"event_time_budget_med_priority", handle_event_time_budget},
+        {"event_time_budget_low_priority", handle_event_time_budget},
         {"verbosity",                    handle_verbosity},
         {"connection_idle_time",         handle_connection_idle_time},
+        {"reuseport_listeners",          handle_reuseport_listeners},
+        {"thread_affinity",              handle_thread_affinity},
+        {"event_backend",                handle_event_backend},
+        {"engine_module_warming",        handle_engine_module_warming},
+        {"sched_trace_mode",             handle_sched_trace_mode},
+        {"sched_trace_file",             handle_sched_trace_file},
         {"bio_drain_buffer_sz",          handle_bio_drain_buffer_sz},
+        {"greedy_read_budget",           handle_greedy_read_budget},
+        {"scheduler_quantum_us",         handle_scheduler_quantum_us},
+        {"timings_precision",            handle_timings_precision},
+        {"phase_timing_sample_every",    handle_phase_timing_sample_every},
+        {"topkeys_sketch",               handle_topkeys_sketch},
+        {"stats_snapshot_age",           handle_stats_snapshot_age},
+        {"bucket_warmup_ops",            handle_bucket_warmup_ops},
+        {"dcp_ship_batch_size",          handle_dcp_ship_batch_size},
+        {"ship_log_byte_limit",          handle_ship_log_byte_limit},
+        {"response_compression_threshold",
+                                         handle_response_compression_threshold},
+        {"per_op_memory_budget", handle_per_op_memory_budget},
         {"datatype_support",             handle_datatype_support},
         {"root",                         handle_root},
         {"ssl_cipher_list",              handle_ssl_cipher_list},
         {"ssl_minimum_protocol",         handle_ssl_minimum_protocol},
+        {"ssl_session_cache_size",       handle_ssl_session_cache_size},
         {"breakpad",                     handle_breakpad},
         {"max_packet_size",              handle_max_packet_size},
         {"stdin_listen",                 handle_stdin_listen},
         {"exit_on_connection_close",     handle_exit_on_connection_close},
         {"sasl_mechanisms",              handle_sasl_mechanisms},
-        {"dedupe_nmvb_maps",             handle_dedupe_nmvb_maps}
+        {"dedupe_nmvb_maps",             handle_dedupe_nmvb_maps},
+        {"connection_rebalance",         handle_connection_rebalance},
+        {"connection_shed_headroom",     handle_connection_shed_headroom}
     };
 
     cJSON* obj = json->child;
@@ -544,6 +1089,14 @@ static void handle_interface_maxconn(struct interface& ifc, cJSON* obj) {
     ifc.maxconn = obj->valueint;
 }
 
+static void handle_interface_busy_poll_usec(struct interface& ifc, cJSON* obj) {
+    if (obj->type != cJSON_Number) {
+        throw std::invalid_argument("\"busy_poll_usec\" must be a number");
+    }
+
+    ifc.busy_poll_usec = obj->valueint;
+}
+
 static void handle_interface_port(struct interface& ifc, cJSON* obj) {
     if (obj->type != cJSON_Number) {
         throw std::invalid_argument("\"port\" must be a number");
@@ -656,6 +1209,28 @@ static void handle_interface_protocol(struct interface& ifc, cJSON* obj) {
     }
 }
 
+static void handle_interface_priority(struct interface& ifc, cJSON* obj) {
+    if (obj->type != cJSON_String) {
+        throw std::invalid_argument("\"priority\" must be a string");
+    }
+
+    std::string priority(obj->valuestring);
+
+    if (priority == "high") {
+        ifc.priority = EventPriority::High;
+    } else if (priority == "medium") {
+        ifc.priority = EventPriority::Medium;
+    } else if (priority == "low") {
+        ifc.priority = EventPriority::Low;
+    } else if (priority == "default") {
+        ifc.priority = EventPriority::Default;
+    } else {
+        throw std::invalid_argument(
+            "\"priority\" must be \"high\", \"medium\", \"low\" or "
+            "\"default\"");
+    }
+}
+
 interface::interface(const cJSON* json)
     : interface() {
 
@@ -680,6 +1255,7 @@ interface::interface(const cJSON* json)
 
     std::vector<interface_config_tokens> handlers = {
         {"maxconn",     handle_interface_maxconn},
+        {"busy_poll_usec", handle_interface_busy_poll_usec},
         {"port",        handle_interface_port},
         {"host",        handle_interface_host},
         {"backlog",     handle_interface_backlog},
@@ -689,6 +1265,7 @@ interface::interface(const cJSON* json)
         {"ssl",         handle_interface_ssl},
         {"management",  handle_interface_management},
         {"protocol",    handle_interface_protocol},
+        {"priority",    handle_interface_priority},
     };
 
     cJSON* obj = json->child;
@@ -732,12 +1309,54 @@ void Settings::updateSettings(const Settings& other, bool apply) {
             throw std::invalid_argument("audit can't be changed dynamically");
         }
     }
+    if (other.has.stats_shm_path) {
+        if (other.stats_shm_path != stats_shm_path) {
+            throw std::invalid_argument(
+                "stats_shm_path can't be changed dynamically");
+        }
+    }
     if (other.has.require_sasl) {
         if (other.require_sasl != require_sasl) {
             throw std::invalid_argument(
                 "require_sasl can't be changed dynamically");
         }
     }
+    if (other.has.reuseport_listeners) {
+        if (other.reuseport_listeners != reuseport_listeners) {
+            throw std::invalid_argument(
+                "reuseport_listeners can't be changed dynamically");
+        }
+    }
+    if (other.has.thread_affinity) {
+        if (other.thread_affinity != thread_affinity) {
+            throw std::invalid_argument(
+                "thread_affinity can't be changed dynamically");
+        }
+    }
+    if (other.has.event_backend) {
+        if (other.event_backend != event_backend) {
+            throw std::invalid_argument(
+                "event_backend can't be changed dynamically");
+        }
+    }
+    if (other.has.engine_module_warming) {
+        if (other.engine_module_warming != engine_module_warming) {
+            throw std::invalid_argument(
+                "engine_module_warming can't be changed dynamically");
+        }
+    }
+    if (other.has.sched_trace_mode) {
+        if (other.sched_trace_mode != sched_trace_mode) {
+            throw std::invalid_argument(
+                "sched_trace_mode can't be changed dynamically");
+        }
+    }
+    if (other.has.sched_trace_file) {
+        if (other.sched_trace_file != sched_trace_file) {
+            throw std::invalid_argument(
+                "sched_trace_file can't be changed dynamically");
+        }
+    }
     if (other.has.bio_drain_buffer_sz) {
         if (other.bio_drain_buffer_sz != bio_drain_buffer_sz) {
             throw std::invalid_argument(
@@ -767,6 +1386,12 @@ void Settings::updateSettings(const Settings& other, bool apply) {
                 "topkeys_size can't be changed dynamically");
         }
     }
+    if (other.has.topkeys_sketch) {
+        if (other.topkeys_sketch != topkeys_sketch) {
+            throw std::invalid_argument(
+                "topkeys_sketch can't be changed dynamically");
+        }
+    }
     if (other.has.stdin_listen) {
         if (other.stdin_listen != stdin_listen) {
             throw std::invalid_argument(
@@ -807,6 +1432,8 @@ void Settings::updateSettings(const Settings& other, bool apply) {
             if ((i1.host != i2.host) || (i1.port != i2.port) ||
                 (i1.ipv4 != i2.ipv4) || (i1.ipv6 != i2.ipv6) ||
                 (i1.protocol != i2.protocol) ||
+                (i1.busy_poll_usec != i2.busy_poll_usec) ||
+                (i1.priority != i2.priority) ||
                 (i1.management != i2.management)) {
                 throw std::invalid_argument(
                     "interfaces can't be changed dynamically");
@@ -814,6 +1441,25 @@ void Settings::updateSettings(const Settings& other, bool apply) {
         }
     }
 
+    if (other.has.experiments) {
+        if (other.experiments.size() != experiments.size()) {
+            throw std::invalid_argument(
+                "experiments can't be changed dynamically");
+        }
+        for (std::vector<experiment_settings>::size_type ii = 0;
+             ii < experiments.size(); ++ii) {
+            const auto& e1 = experiments[ii];
+            const auto& e2 = other.experiments[ii];
+            if (e1.name != e2.name || e1.percentage != e2.percentage ||
+                e1.port != e2.port) {
+                // reshuffling the arm populations mid-run would
+                // poison the measurements being collected
+                throw std::invalid_argument(
+                    "experiments can't be changed dynamically");
+            }
+        }
+    }
+
     if (other.has.extensions) {
         if (other.pending_extensions.size() != pending_extensions.size()) {
             throw std::invalid_argument(
@@ -892,6 +1538,49 @@ void Settings::updateSettings(const Settings& other, bool apply) {
                                             EventPriority::Default);
         }
     }
+    if (other.has.event_time_budget_high_priority) {
+        if (other.event_time_budget_high_priority !=
+            event_time_budget_high_priority) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change high priority time budget per event from %u to %u us",
+                  event_time_budget_high_priority,
+                  other.event_time_budget_high_priority);
+            setEventTimeBudget(other.event_time_budget_high_priority,
+                               EventPriority::High);
+        }
+    }
+    if (other.has.event_time_budget_med_priority) {
+        if (other.event_time_budget_med_priority !=
+            event_time_budget_med_priority) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change medium priority time budget per event from %u to %u us",
+                  event_time_budget_med_priority,
+                  other.event_time_budget_med_priority);
+            setEventTimeBudget(other.event_time_budget_med_priority,
+                               EventPriority::Medium);
+        }
+    }
+    if (other.has.event_time_budget_low_priority) {
+        if (other.event_time_budget_low_priority !=
+            event_time_budget_low_priority) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change low priority time budget per event from %u to %u us",
+                  event_time_budget_low_priority,
+                  other.event_time_budget_low_priority);
+            setEventTimeBudget(other.event_time_budget_low_priority,
+                               EventPriority::Low);
+        }
+    }
+    if (other.has.default_event_time_budget) {
+        if (other.default_event_time_budget != default_event_time_budget) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change default time budget per event from %u to %u us",
+                  default_event_time_budget,
+                  other.default_event_time_budget);
+            setEventTimeBudget(other.default_event_time_budget,
+                               EventPriority::Default);
+        }
+    }
     if (other.has.connection_idle_time) {
         if (other.connection_idle_time != connection_idle_time) {
             logit(EXTENSION_LOG_NOTICE,
@@ -910,6 +1599,45 @@ void Settings::updateSettings(const Settings& other, bool apply) {
             setMaxPacketSize(other.max_packet_size);
         }
     }
+    if (other.has.dcp_ship_batch_size) {
+        if (other.dcp_ship_batch_size != dcp_ship_batch_size) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change DCP ship batch size from %d to %d",
+                  dcp_ship_batch_size,
+                  other.dcp_ship_batch_size);
+            setDcpShipBatchSize(other.dcp_ship_batch_size);
+        }
+    }
+    if (other.has.ship_log_byte_limit) {
+        if (other.ship_log_byte_limit != ship_log_byte_limit) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change ship log byte limit from %u to %u",
+                  ship_log_byte_limit,
+                  other.ship_log_byte_limit);
+            setShipLogByteLimit(other.ship_log_byte_limit);
+        }
+    }
+    if (other.has.response_compression_threshold) {
+        if (other.response_compression_threshold !=
+            response_compression_threshold) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change response compression threshold from %d to %d",
+                  response_compression_threshold,
+                  other.response_compression_threshold);
+            setResponseCompressionThreshold(
+                other.response_compression_threshold);
+        }
+    }
+    if (other.has.per_op_memory_budget) {
+        if (other.per_op_memory_budget != per_op_memory_budget) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change per-operation memory budget from %" PRIu64
+                  " to %" PRIu64,
+                  uint64_t(per_op_memory_budget),
+                  uint64_t(other.per_op_memory_budget));
+            setPerOpMemoryBudget(other.per_op_memory_budget);
+        }
+    }
     if (other.has.ssl_cipher_list) {
         if (other.ssl_cipher_list != ssl_cipher_list) {
             // this isn't safe!! an other thread could call stats settings
@@ -931,6 +1659,41 @@ void Settings::updateSettings(const Settings& other, bool apply) {
             setSslMinimumProtocol(other.ssl_minimum_protocol);
         }
     }
+    if (other.has.ssl_session_cache_size) {
+        if (other.ssl_session_cache_size != ssl_session_cache_size) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change SSL session cache size from %u to %u",
+                  ssl_session_cache_size,
+                  other.ssl_session_cache_size);
+            setSslSessionCacheSize(other.ssl_session_cache_size);
+        }
+    }
+    if (other.has.greedy_read_budget) {
+        if (other.greedy_read_budget != greedy_read_budget) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change greedy read budget from %u to %u",
+                  unsigned(greedy_read_budget),
+                  unsigned(other.greedy_read_budget));
+            setGreedyReadBudget(other.greedy_read_budget);
+        }
+    }
+    if (other.has.scheduler_quantum_us) {
+        if (other.scheduler_quantum_us != scheduler_quantum_us) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change scheduler quantum from %u to %u us",
+                  unsigned(scheduler_quantum_us),
+                  unsigned(other.scheduler_quantum_us));
+            setSchedulerQuantumUs(other.scheduler_quantum_us);
+        }
+    }
+    if (other.has.bucket_warmup_ops) {
+        if (other.bucket_warmup_ops != bucket_warmup_ops) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change bucket warmup ops from %d to %d",
+                  bucket_warmup_ops, other.bucket_warmup_ops);
+            setBucketWarmupOps(other.bucket_warmup_ops);
+        }
+    }
     if (other.has.dedupe_nmvb_maps) {
         if (other.dedupe_nmvb_maps != dedupe_nmvb_maps) {
             logit(EXTENSION_LOG_NOTICE,
@@ -939,6 +1702,23 @@ void Settings::updateSettings(const Settings& other, bool apply) {
             setDedupeNmvbMaps(other.dedupe_nmvb_maps.load());
         }
     }
+    if (other.has.connection_rebalance) {
+        if (other.connection_rebalance != connection_rebalance) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "%s connection rebalancing",
+                  other.connection_rebalance.load() ? "Enable" : "Disable");
+            setConnectionRebalance(other.connection_rebalance.load());
+        }
+    }
+    if (other.has.connection_shed_headroom) {
+        if (other.connection_shed_headroom != connection_shed_headroom) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change connection shed headroom from %u to %u",
+                  unsigned(connection_shed_headroom),
+                  unsigned(other.connection_shed_headroom));
+            setConnectionShedHeadroom(other.connection_shed_headroom);
+        }
+    }
 
     if (other.has.interfaces) {
         // validate that we haven't changed stuff in the entries
@@ -1058,6 +1838,16 @@ void Settings::logit(EXTENSION_LOG_LEVEL level, const char* fmt, ...) {
 }
 
 void Settings::notify_changed(const std::string& key) {
+    if (notifications_deferred) {
+        for (const auto& pending : deferred_notifications) {
+            if (pending == key) {
+                return;
+            }
+        }
+        deferred_notifications.push_back(key);
+        return;
+    }
+
     auto iter = change_listeners.find(key);
     if (iter != change_listeners.end()) {
         for (auto& listener : iter->second) {
@@ -1066,6 +1856,20 @@ void Settings::notify_changed(const std::string& key) {
     }
 }
 
+void Settings::beginNotificationBatch() {
+    notifications_deferred = true;
+}
+
+void Settings::endNotificationBatch() {
+    notifications_deferred = false;
+
+    std::vector<std::string> keys;
+    keys.swap(deferred_notifications);
+    for (const auto& key : keys) {
+        notify_changed(key);
+    }
+}
+
 BreakpadSettings::BreakpadSettings(const cJSON* json) {
     auto* obj = cJSON_GetObjectItem(const_cast<cJSON*>(json), "enabled");
     if (obj == nullptr) {
@@ -43,11 +43,21 @@ enum class Protocol : uint8_t {
 
 const char* to_string(const Protocol& protocol);
 
+enum class EventPriority {
+    High,
+    Medium,
+    Low,
+    Default
+};
+
+const char* to_string(const EventPriority& priority);
 
 struct interface {
     interface()
         : maxconn(1000),
           backlog(1024),
+          busy_poll_usec(0),
+          priority(EventPriority::Default),
           port(11211),
           ipv6(true),
           ipv4(true),
@@ -65,6 +75,22 @@ struct interface {
     } ssl;
     int maxconn;
     int backlog;
+    /**
+     * The number of microseconds a worker thread should keep busy
+     * polling its event base for new work from connections bound to
+     * this interface before falling back to a blocking wait. 0 means
+     * always use blocking waits (the default).
+     */
+    int busy_poll_usec;
+    /**
+     * The event priority class the connections accepted on this
+     * interface start out in. A high priority interface gets the
+     * bigger reqs-per-event / time-budget tiers and is serviced ahead
+     * of the other lanes in the worker's event loop, so a loader
+     * saturating a bulk port can't starve the latency sensitive
+     * frontend traffic.
+     */
+    EventPriority priority;
     in_port_t port;
     bool ipv6;
     bool ipv4;
@@ -99,6 +125,68 @@ struct extension_settings {
     std::string config;
 };
 
+/**
+ * A named arm of an A/B experiment. Fleet rollouts of performance
+ * features want a way to expose a change to a slice of real traffic
+ * and compare latency between the populations without external
+ * orchestration; an experiment places a connection in its treatment
+ * arm at accept time, either because it was accepted on the
+ * experiment's dedicated port or because the hash of its connection
+ * id falls below the configured percentage. Assignment is evaluated
+ * once and sticks for the connection's lifetime, and the command
+ * timings of both arms are recorded separately (see experiments.h and
+ * "stats experiments").
+ */
+struct experiment_settings {
+    experiment_settings() : percentage(0), port(0) {}
+
+    experiment_settings(const cJSON* json) : percentage(0), port(0) {
+        cJSON* obj = cJSON_GetObjectItem(const_cast<cJSON*>(json), "name");
+        if (obj == nullptr) {
+            throw std::invalid_argument(
+                "experiment_settings: mandatory element name not found");
+        }
+        if (obj->type != cJSON_String || obj->valuestring[0] == '\0') {
+            throw std::invalid_argument(
+                "experiment_settings: \"name\" must be a non-empty string");
+        }
+        name.assign(obj->valuestring);
+
+        obj = cJSON_GetObjectItem(const_cast<cJSON*>(json), "percentage");
+        if (obj != nullptr) {
+            if (obj->type != cJSON_Number || obj->valueint < 0 ||
+                obj->valueint > 100) {
+                throw std::invalid_argument(
+                    "experiment_settings: \"percentage\" must be an integer "
+                    "in the range [0,100]");
+            }
+            percentage = obj->valueint;
+        }
+
+        obj = cJSON_GetObjectItem(const_cast<cJSON*>(json), "port");
+        if (obj != nullptr) {
+            if (obj->type != cJSON_Number || obj->valueint < 0 ||
+                obj->valueint > UINT16_MAX) {
+                throw std::invalid_argument(
+                    "experiment_settings: \"port\" must be a valid port "
+                    "number");
+            }
+            port = in_port_t(obj->valueint);
+        }
+    }
+
+    /** The name the arm is reported under in "stats experiments" */
+    std::string name;
+    /** The share of connections (0-100) placed in the treatment arm */
+    int percentage;
+    /**
+     * Restrict the experiment to connections accepted on this port
+     * (0 = all interfaces). A canary listener can be paired with
+     * percentage 100 to get the treatment deterministically.
+     */
+    in_port_t port;
+};
+
 /**
  * What information should breakpad minidumps contain?
  */
@@ -167,14 +255,6 @@ protected:
     BreakpadContent content;
 };
 
-enum class EventPriority {
-    High,
-    Medium,
-    Low,
-    Default
-};
-
-
 /* When adding a setting, be sure to update process_stat_settings */
 /**
  * Globally accessible settings as derived from the commandline / JSON config
@@ -285,6 +365,50 @@ public:
         return interfaces;
     }
 
+    /**
+     * Add an A/B experiment definition. Experiments are snapshotted
+     * into the runtime arm-assignment table at startup (see
+     * initialize_experiments) and can't be changed dynamically -
+     * reshuffling the populations mid-run would poison the
+     * measurements being collected.
+     *
+     * @param exp the experiment to add
+     */
+    void addExperiment(const struct experiment_settings& exp) {
+        experiments.push_back(exp);
+        has.experiments = true;
+        notify_changed("experiments");
+    }
+
+    /**
+     * Get the vector of all configured A/B experiments
+     *
+     * @return the vector of experiments
+     */
+    const std::vector<struct experiment_settings>& getExperiments() const {
+        return experiments;
+    }
+
+    /**
+     * Get the busy poll window (in microseconds) configured for the
+     * interface listening on the given port.
+     *
+     * @param port the port the client connected to
+     * @return the configured window, or 0 if busy polling isn't enabled
+     *         for that interface (interfaces using ephemeral ports
+     *         can't be matched and always report 0)
+     */
+    int getBusyPollUsec(in_port_t port) const {
+        if (port != 0) {
+            for (const auto& ifc : interfaces) {
+                if (ifc.port == port) {
+                    return ifc.busy_poll_usec;
+                }
+            }
+        }
+        return 0;
+    }
+
     /**
      * Add a new extension to be loaded to the internal list of extensions
      *
@@ -325,6 +449,29 @@ public:
         notify_changed("audit_file");
     }
 
+    /**
+     * Get the path of the file backing the shared-memory statistics
+     * segment (empty when the segment is disabled)
+     *
+     * @return the path of the statistics segment file
+     */
+    const std::string& getStatsShmPath() const {
+        return stats_shm_path;
+    }
+
+    /**
+     * Set the path of the file backing the shared-memory statistics
+     * segment. Can't be changed dynamically; the per-worker counters
+     * are placed inside the mapping when the buckets are created.
+     *
+     * @param stats_shm_path the path of the statistics segment file
+     */
+    void setStatsShmPath(const std::string& stats_shm_path) {
+        has.stats_shm_path = true;
+        Settings::stats_shm_path = stats_shm_path;
+        notify_changed("stats_shm_path");
+    }
+
     /**
      * Is SASL required or not
      *
@@ -508,6 +655,64 @@ public:
             "setRequestsPerEventNotification: Unknown priority");
     }
 
+    /**
+     * Set the time budget (in microseconds) a connection may consume
+     * per notification from the event library before it is forced to
+     * yield the worker thread. 0 means no time budget; only the
+     * request count above limits the timeslice.
+     *
+     * @param us the budget in microseconds
+     * @param priority The priority to update
+     */
+    void setEventTimeBudget(int us, const EventPriority& priority) {
+        switch (priority) {
+        case EventPriority::High:
+            event_time_budget_high_priority = us;
+            has.event_time_budget_high_priority = true;
+            notify_changed("event_time_budget_high_priority");
+            return;
+        case EventPriority::Medium:
+            event_time_budget_med_priority = us;
+            has.event_time_budget_med_priority = true;
+            notify_changed("event_time_budget_med_priority");
+            return;
+        case EventPriority::Low:
+            event_time_budget_low_priority = us;
+            has.event_time_budget_low_priority = true;
+            notify_changed("event_time_budget_low_priority");
+            return;
+        case EventPriority::Default:
+            default_event_time_budget = us;
+            has.default_event_time_budget = true;
+            notify_changed("default_event_time_budget");
+            return;
+        }
+        throw std::invalid_argument(
+            "setEventTimeBudget: Unknown priority");
+    }
+
+    /**
+     * Get the time budget (in microseconds) a connection may consume
+     * per callback from the event library (0 == no time budget)
+     *
+     * @param priority the priority of interest
+     * @return the budget in microseconds
+     */
+    int getEventTimeBudget(const EventPriority& priority) const {
+        switch (priority) {
+        case EventPriority::High:
+            return event_time_budget_high_priority;
+        case EventPriority::Medium:
+            return event_time_budget_med_priority;
+        case EventPriority::Low:
+            return event_time_budget_low_priority;
+        case EventPriority::Default:
+            return default_event_time_budget;
+        }
+        throw std::invalid_argument(
+            "getEventTimeBudget: Unknown priority");
+    }
+
     /**
      * Is datatype supported or not
      *
@@ -528,6 +733,199 @@ public:
         notify_changed("datatype_support");
     }
 
+    /**
+     * Get the minimum value size (in bytes) for which the server
+     * compresses responses on behalf of datatype-aware clients
+     *
+     * @return the threshold in bytes (0 means the server never
+     *         compresses on behalf of clients)
+     */
+    int getResponseCompressionThreshold() const {
+        return response_compression_threshold;
+    }
+
+    /**
+     * Set the minimum value size for which responses are compressed
+     * on behalf of datatype-aware clients. Compressing trades worker
+     * CPU for network bandwidth, so it only pays off for values big
+     * enough that the transmit cost dominates.
+     *
+     * @param threshold the threshold in bytes (0 disables it)
+     */
+    void setResponseCompressionThreshold(int threshold) {
+        response_compression_threshold = threshold;
+        has.response_compression_threshold = true;
+        notify_changed("response_compression_threshold");
+    }
+
+    /**
+     * Get the cap on the scratch memory (response staging, subdoc
+     * intermediate documents) a single command may allocate
+     *
+     * @return the budget in bytes (0 means no per-operation cap)
+     */
+    size_t getPerOpMemoryBudget() const {
+        return per_op_memory_budget;
+    }
+
+    /**
+     * Set the cap on the scratch memory a single command may
+     * allocate. Commands which exceed it fail with a temporary
+     * failure instead of growing without bound and degrading the
+     * rest of the node.
+     *
+     * @param budget the budget in bytes (0 disables the cap)
+     */
+    void setPerOpMemoryBudget(size_t budget) {
+        per_op_memory_budget = budget;
+        has.per_op_memory_budget = true;
+        notify_changed("per_op_memory_budget");
+    }
+
+    /**
+     * Should each worker thread own its own SO_REUSEPORT listening
+     * socket for the user ports (in addition to the traditional
+     * dispatcher-owned listener)?
+     *
+     * @return true if listener sharding should be used
+     */
+    bool isReuseportListeners() const {
+        return reuseport_listeners;
+    }
+
+    /**
+     * Set if the worker threads should own their own SO_REUSEPORT
+     * listening sockets or not
+     *
+     * @param reuseport_listeners true if listener sharding should be used
+     */
+    void setReuseportListeners(bool reuseport_listeners) {
+        Settings::reuseport_listeners = reuseport_listeners;
+        has.reuseport_listeners = true;
+        notify_changed("reuseport_listeners");
+    }
+
+    /**
+     * Should the worker threads be pinned to a CPU? When enabled each
+     * worker is bound to a single core (round robin over the available
+     * cores), and new connections are dispatched to a worker on the
+     * same NUMA node as the CPU which received the connection (when
+     * the operating system lets us figure that out).
+     *
+     * @return true if the worker threads should be pinned
+     */
+    bool isThreadAffinity() const {
+        return thread_affinity;
+    }
+
+    /**
+     * Set if the worker threads should be pinned to a CPU or not
+     *
+     * @param thread_affinity true if the workers should be pinned
+     */
+    void setThreadAffinity(bool thread_affinity) {
+        Settings::thread_affinity = thread_affinity;
+        has.thread_affinity = true;
+        notify_changed("thread_affinity");
+    }
+
+    /**
+     * Get the event backend the worker event bases should be built
+     * with. "default" leaves the method selection entirely to the
+     * event library; "epoll" additionally enables batched event
+     * modification (the epoll changelist), so the unregister/register
+     * pair performed when a connection changes its interest mask is
+     * applied as a single syscall at the next dispatch instead of two
+     * immediate epoll_ctl calls. On platforms where the epoll method
+     * isn't available the setting is accepted but falls back to the
+     * default method (with a warning at startup).
+     *
+     * @return "default" or "epoll"
+     */
+    const std::string& getEventBackend() const {
+        return event_backend;
+    }
+
+    /**
+     * Set the event backend to use for the worker event bases
+     *
+     * @param event_backend "default" or "epoll"
+     */
+    void setEventBackend(const std::string& event_backend) {
+        Settings::event_backend = event_backend;
+        has.event_backend = true;
+        notify_changed("event_backend");
+    }
+
+    /**
+     * Get the engine module warming mode applied at startup, after
+     * the engine map has been initialized. "readahead" pages the text
+     * of every cached engine module into memory up front; "lock"
+     * additionally mlocks it so it can't be evicted again; "off"
+     * leaves the pages to fault in lazily on the first commands.
+     *
+     * @return "off", "readahead" or "lock"
+     */
+    const std::string& getEngineModuleWarming() const {
+        return engine_module_warming;
+    }
+
+    /**
+     * Set the engine module warming mode
+     *
+     * @param mode "off", "readahead" or "lock"
+     */
+    void setEngineModuleWarming(const std::string& mode) {
+        engine_module_warming = mode;
+        has.engine_module_warming = true;
+        notify_changed("engine_module_warming");
+    }
+
+    /**
+     * Get the scheduling record/replay mode. "record" appends the
+     * order of event dispatches, task executions and
+     * notify_io_complete deliveries to the trace file; "replay"
+     * re-imposes a previously recorded order (see sched_trace.h).
+     * Only usable with a single worker thread.
+     *
+     * @return "off", "record" or "replay"
+     */
+    const std::string& getSchedTraceMode() const {
+        return sched_trace_mode;
+    }
+
+    /**
+     * Set the scheduling record/replay mode
+     *
+     * @param mode "off", "record" or "replay"
+     */
+    void setSchedTraceMode(const std::string& mode) {
+        sched_trace_mode = mode;
+        has.sched_trace_mode = true;
+        notify_changed("sched_trace_mode");
+    }
+
+    /**
+     * Get the file the scheduling trace is recorded to / replayed
+     * from
+     *
+     * @return the path of the trace file
+     */
+    const std::string& getSchedTraceFile() const {
+        return sched_trace_file;
+    }
+
+    /**
+     * Set the scheduling trace file
+     *
+     * @param file the path of the trace file
+     */
+    void setSchedTraceFile(const std::string& file) {
+        sched_trace_file = file;
+        has.sched_trace_file = true;
+        notify_changed("sched_trace_file");
+    }
+
     /**
      * Get the size of the OpenSSL BIO buffers
      *
@@ -548,6 +946,192 @@ public:
         notify_changed("bio_drain_buffer_sz");
     }
 
+    /**
+     * Get the number of bytes a connection may greedily read from the
+     * network in a single event before backing off (0 means greedy
+     * reads are disabled)
+     *
+     * @return the read budget in bytes
+     */
+    size_t getGreedyReadBudget() const {
+        return greedy_read_budget;
+    }
+
+    /**
+     * Set the number of bytes a connection may greedily read from the
+     * network in a single event before backing off
+     *
+     * @param greedy_read_budget the new budget in bytes (0 disables
+     *                           greedy reads)
+     */
+    void setGreedyReadBudget(size_t greedy_read_budget) {
+        Settings::greedy_read_budget = greedy_read_budget;
+        has.greedy_read_budget = true;
+        notify_changed("greedy_read_budget");
+    }
+
+    /**
+     * Get the number of microseconds of worker time a bucket's
+     * connections may consume per pending io drain before the
+     * remainder of the bucket's queue is deferred to the next
+     * notification (0 means fair scheduling is disabled and the
+     * queue is served in FIFO order)
+     *
+     * @return the quantum in microseconds
+     */
+    size_t getSchedulerQuantumUs() const {
+        return scheduler_quantum_us;
+    }
+
+    /**
+     * Set the per-bucket worker time quantum for the pending io
+     * scheduler
+     *
+     * @param scheduler_quantum_us the new quantum in microseconds
+     *                             (0 disables fair scheduling)
+     */
+    void setSchedulerQuantumUs(size_t scheduler_quantum_us) {
+        Settings::scheduler_quantum_us = scheduler_quantum_us;
+        has.scheduler_quantum_us = true;
+        notify_changed("scheduler_quantum_us");
+    }
+
+    /**
+     * Get the number of significant decimal digits preserved by the
+     * high dynamic range command timing histograms (see HdrHistogram)
+     *
+     * @return the number of significant digits (1-3)
+     */
+    int getTimingsPrecision() const {
+        return timings_precision;
+    }
+
+    /**
+     * Set the number of significant decimal digits preserved by the
+     * high dynamic range command timing histograms
+     *
+     * @param precision the number of significant digits (1-3)
+     */
+    void setTimingsPrecision(int precision) {
+        timings_precision = precision;
+        has.timings_precision = true;
+        notify_changed("timings_precision");
+    }
+
+    /**
+     * Get the sampling interval for the per-phase command timings:
+     * every Nth command on a connection records how long it spent in
+     * each phase (read, parse, validate, execute, write)
+     *
+     * @return the interval (0 = phase timings disabled)
+     */
+    int getPhaseTimingSampleEvery() const {
+        return phase_timing_sample_every;
+    }
+
+    /**
+     * Set the sampling interval for the per-phase command timings
+     *
+     * @param every sample every Nth command (0 = disabled)
+     */
+    void setPhaseTimingSampleEvery(int every) {
+        phase_timing_sample_every = every;
+        has.phase_timing_sample_every = true;
+        notify_changed("phase_timing_sample_every");
+    }
+
+    /**
+     * Get the maximum age (in seconds) of the cached "stats"
+     * serialization (see StatsSnapshot)
+     *
+     * @return the maximum age (0 = caching disabled)
+     */
+    int getStatsSnapshotAge() const {
+        return stats_snapshot_age;
+    }
+
+    /**
+     * Set the maximum age of the cached "stats" serialization
+     *
+     * @param age the maximum age in seconds (0 = disabled)
+     */
+    void setStatsSnapshotAge(int age) {
+        stats_snapshot_age = age;
+        has.stats_snapshot_age = true;
+        notify_changed("stats_snapshot_age");
+    }
+
+    /**
+     * Get the number of synthetic store/get/delete cycles driven
+     * through a freshly created bucket's engine before the bucket is
+     * marked ready, warming the engine code and allocator paths so
+     * the first real commands don't pay for them
+     *
+     * @return the number of warmup cycles (0 = warmup disabled)
+     */
+    int getBucketWarmupOps() const {
+        return bucket_warmup_ops;
+    }
+
+    /**
+     * Set the number of synthetic operation cycles driven through a
+     * new bucket's engine before it is marked ready
+     *
+     * @param ops the number of cycles (0 disables the warmup)
+     */
+    void setBucketWarmupOps(int ops) {
+        bucket_warmup_ops = ops;
+        has.bucket_warmup_ops = true;
+        notify_changed("bucket_warmup_ops");
+    }
+
+    /**
+     * Get the maximum number of messages a DCP producer may batch into
+     * a single vectored write on the ship-log path
+     *
+     * @return the batch size in messages
+     */
+    int getDcpShipBatchSize() const {
+        return dcp_ship_batch_size;
+    }
+
+    /**
+     * Set the maximum number of messages a DCP producer may batch into
+     * a single vectored write. Bigger batches amortize the sendmsg
+     * cost, but keep a slow consumer's data pinned for longer.
+     *
+     * @param size the batch size in messages
+     */
+    void setDcpShipBatchSize(int size) {
+        dcp_ship_batch_size = size;
+        has.dcp_ship_batch_size = true;
+        notify_changed("dcp_ship_batch_size");
+    }
+
+    /**
+     * Get the maximum number of bytes a TAP/DCP connection may stage
+     * onto the wire per worker-thread timeslice (0 = unlimited)
+     *
+     * @return the byte budget per timeslice
+     */
+    uint32_t getShipLogByteLimit() const {
+        return ship_log_byte_limit;
+    }
+
+    /**
+     * Set the per-timeslice byte budget for the ship-log path. A
+     * backfill-driven stream can otherwise monopolize its worker
+     * thread; once a connection has staged this many bytes it yields
+     * until its next event.
+     *
+     * @param limit the byte budget per timeslice (0 = unlimited)
+     */
+    void setShipLogByteLimit(uint32_t limit) {
+        ship_log_byte_limit = limit;
+        has.ship_log_byte_limit = true;
+        notify_changed("ship_log_byte_limit");
+    }
+
     /**
      * Get the maximum size of a packet the system should try to inspect.
      * Packets exceeding this limit will cause the client to be disconnected
@@ -634,6 +1218,30 @@ public:
         notify_changed("ssl_minimum_protocol");
     }
 
+    /**
+     * Get the number of TLS sessions to keep in the server-side session
+     * cache (allowing clients to resume sessions with an abbreviated
+     * handshake)
+     *
+     * @return the number of sessions to cache (0 disables resumption)
+     */
+    unsigned int getSslSessionCacheSize() const {
+        return ssl_session_cache_size;
+    }
+
+    /**
+     * Set the number of TLS sessions to keep in the server-side session
+     * cache
+     *
+     * @param ssl_session_cache_size the new cache size (0 disables
+     *                               session resumption)
+     */
+    void setSslSessionCacheSize(unsigned int ssl_session_cache_size) {
+        Settings::ssl_session_cache_size = ssl_session_cache_size;
+        has.ssl_session_cache_size = true;
+        notify_changed("ssl_session_cache_size");
+    }
+
     /**
      * Get the number of topkeys to track
      *
@@ -653,6 +1261,27 @@ public:
         has.topkeys_size = true;
     }
 
+    /**
+     * Should topkeys use the probabilistic per-worker sketches
+     * instead of the exact mutex-protected shards? (see TopKeys)
+     *
+     * @return true if sketch mode is enabled
+     */
+    bool isTopkeysSketchEnabled() const {
+        return topkeys_sketch;
+    }
+
+    /**
+     * Enable or disable the probabilistic topkeys mode
+     *
+     * @param enabled true to use the per-worker sketches
+     */
+    void setTopkeysSketchEnabled(bool enabled) {
+        topkeys_sketch = enabled;
+        has.topkeys_sketch = true;
+        notify_changed("topkeys_sketch");
+    }
+
     /**
      * Should the server listen on stdin for commands or not
      * (This is used for unit testing)
@@ -739,6 +1368,53 @@ public:
         notify_changed("dedupe_nmvb_maps");
     }
 
+    /**
+     * Should the worker threads try to even out their load by migrating
+     * quiescent connections from an overloaded worker to an idle one?
+     *
+     * @return true if connection rebalancing is enabled
+     */
+    bool isConnectionRebalance() const {
+        return connection_rebalance.load();
+    }
+
+    /**
+     * Set if the worker threads should migrate connections to even out
+     * their load or not
+     *
+     * @param connection_rebalance true if rebalancing should be enabled
+     */
+    void setConnectionRebalance(const bool& connection_rebalance) {
+        Settings::connection_rebalance.store(connection_rebalance);
+        has.connection_rebalance = true;
+        notify_changed("connection_rebalance");
+    }
+
+    /**
+     * Get the number of connection slots the accept path should keep
+     * free by shedding the longest-idle connections when new clients
+     * start eating into the headroom
+     *
+     * @return the headroom in number of connections (0 = shedding
+     *         disabled)
+     */
+    size_t getConnectionShedHeadroom() const {
+        return connection_shed_headroom;
+    }
+
+    /**
+     * Set the number of connection slots to defend by shedding idle
+     * connections
+     *
+     * @param headroom the headroom in number of connections (0 disables
+     *                 shedding)
+     */
+    void setConnectionShedHeadroom(size_t headroom) {
+        connection_shed_headroom = headroom;
+        has.connection_shed_headroom = true;
+        notify_changed("connection_shed_headroom");
+    }
+
     /**
      * Get the breakpad settings
      *
@@ -783,6 +1459,22 @@ public:
         change_listeners[key].push_back(listener);
     }
 
+    /**
+     * Begin deferring change notifications. While a batch is open
+     * notify_changed records each changed key (once) instead of
+     * running its listeners. Used when applying a batch of related
+     * property updates so the listeners observe the final state once,
+     * rather than every intermediate combination.
+     */
+    void beginNotificationBatch();
+
+    /**
+     * Stop deferring change notifications and run the listeners of
+     * every key changed since beginNotificationBatch, in the order
+     * the keys first changed.
+     */
+    void endNotificationBatch();
+
     static void logit(EXTENSION_LOG_LEVEL level, const char *fmt, ...);
 
 protected:
@@ -803,6 +1495,12 @@ protected:
      */
     std::vector<struct interface> interfaces;
 
+    /**
+     * The configured A/B experiments (snapshotted at startup by
+     * initialize_experiments)
+     */
+    std::vector<struct experiment_settings> experiments;
+
     /**
      * Array of extensions and their settings to be loaded
      */
@@ -813,6 +1511,12 @@ protected:
      */
     std::string audit_file;
 
+    /**
+     * The file backing the shared-memory statistics segment (see
+     * daemon/stats_shm.h). Empty means the segment is disabled.
+     */
+    std::string stats_shm_path;
+
     /**
      * require SASL auth
      */
@@ -833,16 +1537,111 @@ protected:
      */
     std::string root;
 
+    /**
+     * Should the worker threads own their own SO_REUSEPORT listening
+     * sockets for the user ports?
+     */
+    bool reuseport_listeners;
+
+    /**
+     * Should the worker threads be pinned to a CPU (and connections be
+     * dispatched to a worker on the NUMA node which received them)?
+     */
+    bool thread_affinity;
+
+    /**
+     * The event backend the worker event bases should be built with
+     * ("default" or "epoll", see getEventBackend())
+     */
+    std::string event_backend;
+
+    /**
+     * The engine module warming mode applied at startup ("off",
+     * "readahead" or "lock", see getEngineModuleWarming())
+     */
+    std::string engine_module_warming;
+
+    /**
+     * The scheduling record/replay mode ("off", "record" or "replay",
+     * see getSchedTraceMode())
+     */
+    std::string sched_trace_mode;
+
+    /**
+     * The file the scheduling trace is recorded to / replayed from
+     */
+    std::string sched_trace_file;
+
     /**
      * size of the SSL bio buffers
      */
     unsigned int bio_drain_buffer_sz;
 
+    /**
+     * The number of bytes a connection may greedily read from the
+     * network per event (0 = disabled)
+     */
+    size_t greedy_read_budget;
+
+    /**
+     * The number of microseconds of worker time a bucket may consume
+     * per pending io drain (0 = fair scheduling disabled)
+     */
+    size_t scheduler_quantum_us;
+
+    /**
+     * The number of significant decimal digits preserved by the high
+     * dynamic range command timing histograms
+     */
+    int timings_precision;
+
+    /**
+     * Sample every Nth command into the per-phase command timings
+     * (0 = disabled)
+     */
+    int phase_timing_sample_every;
+
+    /**
+     * The maximum age (in seconds) of the cached "stats"
+     * serialization (0 = disabled)
+     */
+    int stats_snapshot_age;
+
+    /**
+     * The number of synthetic operation cycles driven through a new
+     * bucket's engine before it is marked ready (0 = disabled)
+     */
+    int bucket_warmup_ops;
+
+    /**
+     * The maximum number of messages a DCP producer batches into a
+     * single vectored write on the ship-log path
+     */
+    int dcp_ship_batch_size;
+
+    /**
+     * The maximum number of bytes a TAP/DCP connection may stage per
+     * worker-thread timeslice (0 = unlimited)
+     */
+    uint32_t ship_log_byte_limit;
+
     /**
      * is datatype support enabled?
      */
     bool datatype;
 
+    /**
+     * The minimum value size for which responses are compressed on
+     * behalf of datatype-aware clients (0 = never)
+     */
+    int response_compression_threshold;
+
+    /**
+     * The maximum number of bytes of scratch memory a single command
+     * may allocate (0 == unlimited)
+     */
+    size_t per_op_memory_budget;
+
     /**
      * Maximum number of io events to process based on the priority of the
      * connection
@@ -852,6 +1651,16 @@ protected:
     int reqs_per_event_low_priority;
     int default_reqs_per_event;
 
+    /**
+     * Maximum number of microseconds of worker thread time a
+     * connection may consume per io event based on its priority
+     * (0 == only the request count above applies)
+     */
+    int event_time_budget_high_priority;
+    int event_time_budget_med_priority;
+    int event_time_budget_low_priority;
+    int default_event_time_budget;
+
     /**
      * Breakpad crash catcher settings
      */
@@ -880,11 +1689,22 @@ protected:
      */
     std::string ssl_minimum_protocol;
 
+    /**
+     * Number of TLS sessions to keep in the server-side session cache
+     * (0 disables session resumption)
+     */
+    unsigned int ssl_session_cache_size;
+
     /**
      * The number of topkeys to track
      */
     int topkeys_size;
 
+    /**
+     * Should topkeys use the probabilistic per-worker sketches?
+     */
+    bool topkeys_sketch;
+
     /**
      * Listen on stdin (reply to stdout)
      */
@@ -906,6 +1726,18 @@ protected:
      */
     std::atomic_bool dedupe_nmvb_maps;
 
+    /**
+     * Should the worker threads migrate quiescent connections to even
+     * out their load
+     */
+    std::atomic_bool connection_rebalance;
+
+    /**
+     * The number of connection slots the accept path should defend by
+     * shedding idle connections (0 disables shedding)
+     */
+    Couchbase::RelaxedAtomic<size_t> connection_shed_headroom;
+
 public:
     /**
      * Flags for each of the above config options, indicating if they were
@@ -917,28 +1749,54 @@ public:
         bool admin;
         bool threads;
         bool interfaces;
+        bool experiments;
         bool extensions;
         bool audit;
+        bool stats_shm_path;
         bool require_sasl;
         bool reqs_per_event_high_priority;
         bool reqs_per_event_med_priority;
         bool reqs_per_event_low_priority;
         bool default_reqs_per_event;
+        bool event_time_budget_high_priority;
+        bool event_time_budget_med_priority;
+        bool event_time_budget_low_priority;
+        bool default_event_time_budget;
         bool verbose;
         bool connection_idle_time;
+        bool reuseport_listeners;
+        bool thread_affinity;
+        bool event_backend;
+        bool engine_module_warming;
+        bool sched_trace_mode;
+        bool sched_trace_file;
         bool bio_drain_buffer_sz;
+        bool greedy_read_budget;
+        bool scheduler_quantum_us;
+        bool timings_precision;
+        bool phase_timing_sample_every;
+        bool stats_snapshot_age;
+        bool bucket_warmup_ops;
+        bool dcp_ship_batch_size;
+        bool ship_log_byte_limit;
         bool datatype;
+        bool response_compression_threshold;
+        bool per_op_memory_budget;
         bool root;
         bool breakpad;
         bool max_packet_size;
         bool require_init;
         bool ssl_cipher_list;
         bool ssl_minimum_protocol;
+        bool ssl_session_cache_size;
         bool topkeys_size;
+        bool topkeys_sketch;
         bool stdin_listen;
         bool exit_on_connection_close;
         bool sasl_mechanisms;
         bool dedupe_nmvb_maps;
+        bool connection_rebalance;
+        bool connection_shed_headroom;
     } has;
 
 protected:
@@ -951,6 +1809,19 @@ protected:
      */
     std::map<std::string, std::deque<void (*)(const std::string& key, Settings& obj)> > change_listeners;
 
+    /**
+     * When true, notify_changed queues the changed keys on
+     * deferred_notifications instead of running their listeners
+     * (see beginNotificationBatch)
+     */
+    bool notifications_deferred;
+
+    /**
+     * The keys changed while notifications were deferred, in the
+     * order they first changed (each key recorded once)
+     */
+    std::vector<std::string> deferred_notifications;
+
     void notify_changed(const std::string& key);
 
     /*************************************************************************
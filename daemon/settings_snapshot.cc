@@ -0,0 +1,68 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "settings_snapshot.h"
+
+#include "settings.h"
+
+/* Start at 1 so the zero-initialized thread-local snapshots are stale
+   and the first access on every thread rebuilds them. */
+std::atomic<uint64_t> settings_snapshot_generation(1);
+thread_local SettingsSnapshot settings_snapshot_tls;
+
+void settings_snapshot_rebuild() {
+    /* Read the generation before the values: if a setting changes
+       while we're copying, the stored generation no longer matches
+       and the next accessor call rebuilds again. */
+    const uint64_t gen =
+            settings_snapshot_generation.load(std::memory_order_acquire);
+
+    settings_snapshot_tls.verbose = settings.getVerbose();
+    settings_snapshot_tls.datatype = settings.isDatatypeSupport();
+    settings_snapshot_tls.dedupe_nmvb_maps = settings.isDedupeNmvbMaps();
+    settings_snapshot_tls.require_sasl = settings.isRequireSasl();
+    settings_snapshot_tls.max_packet_size = settings.getMaxPacketSize();
+    settings_snapshot_tls.per_op_memory_budget =
+            settings.getPerOpMemoryBudget();
+    settings_snapshot_tls.greedy_read_budget = settings.getGreedyReadBudget();
+    settings_snapshot_tls.phase_timing_sample_every =
+            settings.getPhaseTimingSampleEvery();
+    settings_snapshot_tls.response_compression_threshold =
+            settings.getResponseCompressionThreshold();
+    settings_snapshot_tls.dcp_ship_batch_size = settings.getDcpShipBatchSize();
+
+    settings_snapshot_tls.generation = gen;
+}
+
+static void snapshot_changed_listener(const std::string&, Settings&) {
+    settings_snapshot_generation.fetch_add(1, std::memory_order_release);
+}
+
+void settings_snapshot_init() {
+    for (const auto* key : {"verbosity",
+                            "datatype_support",
+                            "dedupe_nmvb_maps",
+                            "require_sasl",
+                            "max_packet_size",
+                            "per_op_memory_budget",
+                            "greedy_read_budget",
+                            "phase_timing_sample_every",
+                            "response_compression_threshold",
+                            "dcp_ship_batch_size"}) {
+        settings.addChangeListener(key, snapshot_changed_listener);
+    }
+}
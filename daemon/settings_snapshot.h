@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A read-mostly snapshot of the handful of settings the per-command
+ * hot paths consult. The accessors in settings.h are safe but not
+ * free: some are atomic loads and all of them touch the one shared
+ * Settings instance. Each worker thread keeps its own copy of the hot
+ * fields instead, so per-op checks (the verbosity test in front of
+ * every LOG_DEBUG, the packet size limit, the per-op memory budget,
+ * ...) are plain member loads from a thread-local cache line.
+ *
+ * The snapshot is rebuilt lazily: every relevant setting has a change
+ * listener which bumps a global generation counter, and the accessor
+ * re-reads the authoritative values the first time a thread observes
+ * the new generation - the same scheme the connections use for their
+ * cached event-loop settings.
+ */
+struct SettingsSnapshot {
+    int verbose;
+    bool datatype;
+    bool dedupe_nmvb_maps;
+    bool require_sasl;
+    uint32_t max_packet_size;
+    size_t per_op_memory_budget;
+    size_t greedy_read_budget;
+    int phase_timing_sample_every;
+    int response_compression_threshold;
+    int dcp_ship_batch_size;
+    /** The generation the fields above were copied from */
+    uint64_t generation;
+};
+
+/**
+ * Register the change listeners which invalidate every thread's
+ * snapshot. Must be called from settings_init() (i.e. before the
+ * worker threads are spun up; see addChangeListener).
+ */
+void settings_snapshot_init();
+
+/* Implementation details of the inline accessor below */
+extern std::atomic<uint64_t> settings_snapshot_generation;
+extern thread_local SettingsSnapshot settings_snapshot_tls;
+void settings_snapshot_rebuild();
+
+/**
+ * Get the calling thread's snapshot of the hot settings. The returned
+ * reference stays valid for the lifetime of the thread, but the values
+ * may be refreshed by a later call, so don't cache fields across
+ * blocking points.
+ */
+inline const SettingsSnapshot& settings_snapshot() {
+    if (settings_snapshot_tls.generation !=
+        settings_snapshot_generation.load(std::memory_order_acquire)) {
+        settings_snapshot_rebuild();
+    }
+    return settings_snapshot_tls;
+}
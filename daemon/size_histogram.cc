@@ -0,0 +1,81 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "size_histogram.h"
+
+#include <new>
+#include <string>
+
+SizeHistogram::SizeHistogram() {
+    reset();
+}
+
+void SizeHistogram::reset(void) {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+}
+
+void SizeHistogram::add(const size_t bytes) {
+    size_t ii = 0;
+    size_t limit = 64;
+
+    while (ii < buckets.size() - 1 && bytes >= limit) {
+        ++ii;
+        limit <<= 1;
+    }
+
+    buckets[ii].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+cJSON* SizeHistogram::toJSON(void) const {
+    cJSON* obj = cJSON_CreateObject();
+    if (obj == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    size_t low = 0;
+    size_t high = 63;
+    for (size_t ii = 0; ii < buckets.size() - 1; ++ii) {
+        std::string label(std::to_string(low) + " - " + std::to_string(high));
+        cJSON_AddNumberToObject(obj, label.c_str(),
+                                buckets[ii].load(std::memory_order_relaxed));
+        low = high + 1;
+        high = (low * 2) - 1;
+    }
+
+    std::string label(std::to_string(low) + " - inf");
+    cJSON_AddNumberToObject(obj, label.c_str(),
+                            buckets.back().load(std::memory_order_relaxed));
+
+    cJSON_AddNumberToObject(obj, "total", getTotal());
+    cJSON_AddNumberToObject(obj, "bytes", getSum());
+
+    return obj;
+}
+
+uint64_t SizeHistogram::getTotal(void) const {
+    return total.load(std::memory_order_relaxed);
+}
+
+uint64_t SizeHistogram::getSum(void) const {
+    return sum.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,58 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include <cJSON.h>
+
+/** Records the size (in bytes) of some event, accumulating the samples in
+ * a histogram. The byte sibling of TimingHistogram.
+ *
+ * The histogram has buckets with power of two boundaries:
+ *
+ *     [0-63], [64-127], [128-255], ..., [32768-65535], [65536-inf]
+ */
+class SizeHistogram {
+public:
+    SizeHistogram(void);
+
+    void reset(void);
+    void add(const size_t bytes);
+
+    /**
+     * Get the JSON representation of the histogram. The returned object
+     * is owned by the caller (and must be released with cJSON_Delete).
+     */
+    cJSON* toJSON(void) const;
+
+    /** The number of samples recorded */
+    uint64_t getTotal(void) const;
+
+    /** The sum of all of the recorded samples */
+    uint64_t getSum(void) const;
+
+private:
+    /* Bucket ii counts samples in [32 * 2^ii, 64 * 2^ii) (with the
+     * first and the last bucket being open ended) */
+    std::array<std::atomic<uint32_t>, 12> buckets;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+};
@@ -0,0 +1,314 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "slow_log.h"
+
+#include "task.h"
+#include "utilities/protocol2text.h"
+
+#include <platform/checked_snprintf.h>
+
+#include <inttypes.h>
+#include <array>
+#include <atomic>
+#include <mutex>
+
+/**
+ * A single slow operation record. Fixed size so the ring buffer can
+ * be preallocated; the key itself is reduced to a hash as the full
+ * key would make the record variable length (and could leak document
+ * names into the log).
+ */
+struct SlowOpRecord {
+    /** When the command completed */
+    hrtime_t completed;
+    /** The total duration of the command in nanoseconds */
+    uint64_t total_ns;
+    /** The time spent inside the engine in nanoseconds */
+    uint64_t engine_ns;
+    /** FNV-1a hash of the document key (0 for keyless commands) */
+    uint32_t key_hash;
+    /** The id of the connection the command ran on */
+    uint32_t conn_id;
+    /** The bucket the command executed in */
+    bucket_id_t bucket;
+    /** The opcode of the command */
+    uint8_t opcode;
+};
+
+/**
+ * The slow operation log. One ring buffer per worker thread; the
+ * worker owning the ring is the only writer and the drain task is
+ * the only reader, so head and tail each have a single writer and
+ * the ring needs no locks.
+ */
+class SlowOpLog {
+public:
+    /**
+     * The maximum number of per-worker rings (same capacity and
+     * indexing scheme as Timings::MAX_SHARDS)
+     */
+    static const size_t MAX_SHARDS = 64;
+
+    /** The capacity of each ring. Must be a power of two */
+    static const size_t RING_SIZE = 1024;
+
+    SlowOpLog() : threshold_ns(5000000), // default 5ms
+                  drain_scheduled(false) {
+        for (auto& ring : rings) {
+            ring.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~SlowOpLog() {
+        for (auto& ring : rings) {
+            delete ring.load(std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t getThreshold() const {
+        return threshold_ns.load(std::memory_order_relaxed);
+    }
+
+    void setThreshold(uint64_t ns) {
+        threshold_ns.store(ns, std::memory_order_relaxed);
+    }
+
+    /**
+     * Append a record to the caller's ring. Called from the worker
+     * thread at command completion; never blocks and never allocates
+     * (apart from the one-time ring allocation on the worker's first
+     * slow operation). Schedules the drain task if one isn't already
+     * pending.
+     */
+    void record(size_t worker, const SlowOpRecord& rec) {
+        auto* ring = getRing(worker);
+        const uint32_t head = ring->head.load(std::memory_order_relaxed);
+        const uint32_t tail = ring->tail.load(std::memory_order_acquire);
+
+        if (head - tail == RING_SIZE) {
+            // The drain has fallen behind; drop the record rather
+            // than stalling the worker
+            ring->dropped++;
+        } else {
+            ring->slots[head & (RING_SIZE - 1)] = rec;
+            ring->head.store(head + 1, std::memory_order_release);
+        }
+
+        maybeScheduleDrain();
+    }
+
+    /**
+     * Drain all rings through the installed logger. Runs on an
+     * executor thread; serialized so two overlapping drain tasks
+     * never race on the ring tails.
+     */
+    void drain();
+
+private:
+    /** A per-worker ring of slow operation records */
+    struct Ring {
+        Ring() : head(0), tail(0), dropped(0) {}
+
+        /** Next slot to write; only the owning worker updates it */
+        std::atomic<uint32_t> head;
+        /** Next slot to read; only the drain updates it */
+        std::atomic<uint32_t> tail;
+        /** Records dropped because the ring was full */
+        Couchbase::RelaxedAtomic<uint64_t> dropped;
+        /** Dropped records already reported by the drain */
+        uint64_t dropped_reported = 0;
+        /** The preallocated record slots */
+        std::array<SlowOpRecord, RING_SIZE> slots;
+    };
+
+    /**
+     * Get the ring for the given worker, allocating it on the
+     * worker's first slow operation.
+     */
+    Ring* getRing(size_t index) {
+        auto& slot = rings[index % MAX_SHARDS];
+        Ring* ring = slot.load(std::memory_order_acquire);
+        if (ring == nullptr) {
+            auto* created = new Ring;
+            if (slot.compare_exchange_strong(ring, created,
+                                             std::memory_order_acq_rel)) {
+                ring = created;
+            } else {
+                // Another worker sharing the slot won the race
+                delete created;
+            }
+        }
+        return ring;
+    }
+
+    void maybeScheduleDrain();
+
+    /** The slow operation threshold in nanoseconds (0 = disabled) */
+    std::atomic<uint64_t> threshold_ns;
+
+    /** Is a drain task already scheduled (or running)? */
+    std::atomic<bool> drain_scheduled;
+
+    /** Serializes concurrent drains */
+    std::mutex drain_mutex;
+
+    /** The lazily allocated per-worker rings */
+    std::array<std::atomic<Ring*>, MAX_SHARDS> rings;
+};
+
+static SlowOpLog slow_op_log;
+
+/**
+ * The one-shot task draining the slow operation rings. A new instance
+ * is scheduled by the first worker to add a record after the previous
+ * drain completed, so an idle system runs no periodic work at all.
+ */
+class SlowOpDrainTask : public Task {
+public:
+    SlowOpDrainTask() : Task(TaskPriority::Low) {}
+
+    bool execute() override {
+        slow_op_log.drain();
+        return true;
+    }
+};
+
+void SlowOpLog::maybeScheduleDrain() {
+    if (drain_scheduled.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    if (!executorPool) {
+        // Too early (or too late) in the process lifetime; leave the
+        // records in the ring for a later drain
+        drain_scheduled.store(false, std::memory_order_release);
+        return;
+    }
+
+    std::shared_ptr<Task> task = std::make_shared<SlowOpDrainTask>();
+    std::lock_guard<std::mutex> guard(task->getMutex());
+    executorPool->schedule(task, true);
+}
+
+void SlowOpLog::drain() {
+    std::lock_guard<std::mutex> guard(drain_mutex);
+
+    // Clear the flag before reading the rings so a record added
+    // while we're draining schedules a new task (it may land in a
+    // slot we've already passed)
+    drain_scheduled.store(false, std::memory_order_release);
+
+    const hrtime_t now = gethrtime();
+
+    for (auto& slot : rings) {
+        auto* ring = slot.load(std::memory_order_acquire);
+        if (ring == nullptr) {
+            continue;
+        }
+
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        const uint32_t head = ring->head.load(std::memory_order_acquire);
+
+        while (tail != head) {
+            const auto& rec = ring->slots[tail & (RING_SIZE - 1)];
+
+            const char* opcode = memcached_opcode_2_text(rec.opcode);
+            char opcode_s[16];
+            if (opcode == nullptr) {
+                checked_snprintf(opcode_s, sizeof(opcode_s), "0x%02x",
+                                 rec.opcode);
+                opcode = opcode_s;
+            }
+
+            const uint64_t daemon_ns = rec.total_ns > rec.engine_ns ?
+                                       rec.total_ns - rec.engine_ns : 0;
+            const hrtime_t age_ms = (now - rec.completed) / 1000000;
+
+            LOG_NOTICE(NULL,
+                       "Slow op: %u: %s bucket %u key#%08" PRIx32
+                       " total %" PRIu64 "us (engine %" PRIu64
+                       "us, daemon %" PRIu64 "us) logged %" PRIu64
+                       "ms after completion",
+                       rec.conn_id, opcode, rec.bucket, rec.key_hash,
+                       rec.total_ns / 1000, rec.engine_ns / 1000,
+                       daemon_ns / 1000, uint64_t(age_ms));
+
+            ring->tail.store(++tail, std::memory_order_release);
+        }
+
+        const uint64_t dropped = ring->dropped.load();
+        if (dropped != ring->dropped_reported) {
+            LOG_WARNING(NULL,
+                        "Slow op log dropped %" PRIu64 " record(s); the "
+                        "drain could not keep up",
+                        dropped - ring->dropped_reported);
+            ring->dropped_reported = dropped;
+        }
+    }
+}
+
+uint64_t slow_op_log_threshold_ns() {
+    return slow_op_log.getThreshold();
+}
+
+void slow_op_log_capture(const McbpConnection* c,
+                         bucket_id_t bucket,
+                         hrtime_t elapsed_ns,
+                         size_t worker) {
+    SlowOpRecord rec;
+    rec.completed = gethrtime();
+    rec.total_ns = uint64_t(elapsed_ns);
+    rec.engine_ns = uint64_t(c->getEngineTime());
+    rec.conn_id = c->getId();
+    rec.bucket = bucket;
+    rec.opcode = c->getCmd();
+
+    // We're already off the fast path (the command blew the
+    // threshold), so hashing the key here is cheap by comparison
+    const auto key = c->getKey();
+    uint32_t hash = 2166136261u;
+    for (size_t ii = 0; ii < key.len; ++ii) {
+        hash ^= uint8_t(key.buf[ii]);
+        hash *= 16777619u;
+    }
+    rec.key_hash = key.len == 0 ? 0 : hash;
+
+    slow_op_log.record(worker, rec);
+}
+
+ENGINE_ERROR_CODE ioctlGetSlowOpLogThreshold(Connection* c,
+                                             const StrToStrMap& arguments,
+                                             std::string& value) {
+    value = std::to_string(slow_op_log.getThreshold() / 1000);
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE ioctlSetSlowOpLogThreshold(Connection* c,
+                                             const StrToStrMap& arguments,
+                                             const std::string& value) {
+    uint64_t usec;
+    try {
+        usec = std::stoull(value);
+    } catch (const std::exception&) {
+        return ENGINE_EINVAL;
+    }
+
+    slow_op_log.setThreshold(usec * 1000);
+    LOG_NOTICE(c, "%u: IOCTL_SET: slow_op_log.threshold set to %" PRIu64 "us",
+               c->getId(), usec);
+    return ENGINE_SUCCESS;
+}
@@ -0,0 +1,74 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "memcached.h"
+#include "utilities/string_utilities.h"
+
+/*
+ * Audit log of slow operations.
+ *
+ * Every command which completes slower than a (live settable)
+ * threshold is recorded with its opcode, a hash of the key, the
+ * bucket, the connection id and the engine/daemon time split. The
+ * record is written at command completion into a fixed size per-worker
+ * ring buffer (single writer, no allocation and no locks on that
+ * path), and the rings are drained by a background task which formats
+ * the records through the installed logger extension. If the drain
+ * falls behind, new records are dropped (and counted) rather than
+ * stalling the worker.
+ */
+
+/**
+ * The current slow operation threshold in nanoseconds (0 means the
+ * log is disabled). Polled by the workers at command completion.
+ */
+uint64_t slow_op_log_threshold_ns();
+
+/**
+ * Record a completed slow operation. Must be called from the worker
+ * thread owning the connection (the per-worker ring has a single
+ * writer).
+ *
+ * @param c the connection the command completed on
+ * @param bucket the bucket the command executed in
+ * @param elapsed_ns the total duration of the command
+ * @param worker the calling worker's thread index
+ */
+void slow_op_log_capture(const McbpConnection* c,
+                         bucket_id_t bucket,
+                         hrtime_t elapsed_ns,
+                         size_t worker);
+
+/**
+ * IOCTL Get callback to read the slow operation threshold
+ * @param[out] value the threshold in microseconds ("0" when disabled)
+ */
+ENGINE_ERROR_CODE ioctlGetSlowOpLogThreshold(Connection* c,
+                                             const StrToStrMap& arguments,
+                                             std::string& value);
+
+/**
+ * IOCTL Set callback to change the slow operation threshold
+ * @param value the new threshold in microseconds; "0" disables the log
+ */
+ENGINE_ERROR_CODE ioctlSetSlowOpLogThreshold(Connection* c,
+                                             const StrToStrMap& arguments,
+                                             const std::string& value);
@@ -22,8 +22,11 @@
 #include "mcbp_executors.h"
 #include "connections.h"
 #include "sasl_tasks.h"
+#include "session_resume.h"
+#include "phase_timings.h"
 #include "runtime.h"
 #include "mcaudit.h"
+#include "mc_time.h"
 
 void McbpStateMachine::setCurrentTask(McbpConnection& connection, TaskFunction task) {
     // Moving to the same state is legal
@@ -51,6 +54,44 @@ void McbpStateMachine::setCurrentTask(McbpConnection& connection, TaskFunction t
         }
     }
 
+    {
+        /* Charge the time spent in the state we're leaving to the
+         * matching command phase (for sampled commands only; see
+         * PhaseSampler). Parse, validate and execute are attributed
+         * with explicit marks from the dispatch path as they all run
+         * within conn_parse_cmd / conn_nread. */
+        auto& sampler = connection.getPhaseSampler();
+        if (sampler.isSampled()) {
+            if (task == conn_write || task == conn_mwrite) {
+                /* Entering the write states: everything since the last
+                 * mark was spent executing the command */
+                sampler.mark(connection.binary_header.request.opcode,
+                             CommandPhase::Execute);
+            } else if (currentTask == conn_write ||
+                       currentTask == conn_mwrite) {
+                /* Leaving the write states: the response has been
+                 * transmitted (or corked) */
+                sampler.mark(connection.binary_header.request.opcode,
+                             CommandPhase::Write);
+                sampler.finishCommand();
+            } else if (currentTask == conn_read || currentTask == conn_nread) {
+                /* The opcode isn't known while the request is being
+                 * read; park the time until the header is parsed */
+                sampler.accumulateRead();
+            } else if (currentTask == conn_parse_cmd &&
+                       task == conn_new_cmd) {
+                /* A quiet command completed without a response */
+                sampler.mark(connection.binary_header.request.opcode,
+                             CommandPhase::Execute);
+                sampler.finishCommand();
+            } else {
+                /* Idle states (conn_waiting etc) aren't charged to
+                 * any phase */
+                sampler.restamp();
+            }
+        }
+    }
+
     if (settings.getVerbose() > 2 || task == conn_closing
         || task == conn_setup_tap_stream) {
         settings.extensions.logger->log(EXTENSION_LOG_DETAIL, this,
@@ -124,12 +165,34 @@ static void reset_cmd_handler(McbpConnection *c) {
     }
 
     c->resetCommandContext();
+    c->maybeResetScratchArena();
+    c->resetCommandMemory();
+    c->getCookieObject().clearContinuation();
+    c->getPhaseSampler().beginCommand();
 
     if (c->read.bytes == 0) {
         /* Make the whole read buffer available. */
         c->read.curr = c->read.buf;
     }
 
+    if (c->havePendingCompleteRequest()) {
+        /* We're draining a pipeline of fully received requests. Don't
+         * shrink (and most likely immediately regrow) the buffers for
+         * every command in the burst; that happens once the pipeline
+         * runs dry. */
+        c->setState(conn_parse_cmd);
+        return;
+    }
+
+    if (c->getPendingResponses() > 0) {
+        /* The pipeline ran dry with responses still corked (the burst
+         * may have ended with a quiet command which produced no
+         * response to piggy-back the flush on). Send them now. */
+        c->setWriteAndGo(conn_new_cmd);
+        c->setState(conn_mwrite);
+        return;
+    }
+
     c->shrinkBuffers();
     if (c->read.bytes > 0) {
         c->setState(conn_parse_cmd);
@@ -183,7 +246,12 @@ bool conn_ship_log(McbpConnection *c) {
         /* and it will slowly grow.. */
         c->setNumEvents(c->getMaxReqsPerEvent());
     } else if (c->isWriteEvent()) {
-        if (c->decrementNumEvents() >= 0) {
+        /* The byte budget (ship_log_byte_limit) shapes backfill: a
+         * stream with a deep ship log gets at most that many bytes
+         * staged per timeslice, then yields so frontend connections
+         * on the worker get a turn. */
+        if (c->decrementNumEvents() >= 0 && !c->isTimesliceExhausted() &&
+            !c->isShipBudgetExhausted()) {
             c->setEwouldblock(false);
             if (c->isDCP()) {
                 ship_mcbp_dcp_log(c);
@@ -233,6 +301,15 @@ bool conn_read(McbpConnection *c) {
         }
         break;
     case McbpConnection::TryReadResult::DataReceived:
+        /* Scan and byte swap the freshly received headers while they
+         * are still hot in cache, so conn_parse_cmd finds them
+         * pre-decoded. Skipped while headers from an earlier scan are
+         * still pending - their ring entries must stay in stream
+         * order. */
+        if (c->getPrevalidatedHeaders() == 0 &&
+            c->read.bytes >= sizeof(protocol_binary_request_header)) {
+            mcbp_prescan_headers(c);
+        }
         c->setState(conn_parse_cmd);
         break;
     case McbpConnection::TryReadResult::SocketError:
@@ -260,14 +337,50 @@ bool conn_new_cmd(McbpConnection *c) {
         return true;
     }
 
+    const rel_time_t now = mc_time_get_current_time();
+
+    /* "touch" the connection's slot in the worker's timer wheel so it
+       isn't disconnected as idle (just a timestamp update; the wheel
+       re-hashes the connection lazily) */
+    c->setLastActivity(now);
+
     c->setStart(0);
 
+    /*
+     * Per-tenant rate limiting: when the bucket's token buckets (ops
+     * or bandwidth per second) have run dry, don't pick up the next
+     * command. The connection re-registers its event with a short
+     * timeout and retries the gate when it fires, so a throttled
+     * tenant waits in libevent instead of burning the worker thread.
+     * Admin connections are exempt so the node can still be managed.
+     */
+    if (!c->isAdmin()) {
+        auto& bucket = all_buckets[c->getBucketIndex()];
+        if (!bucket.throttleGate(now)) {
+            if (!c->isEventTimeoutArmed()) {
+                bucket.throttle_events++;
+            }
+            if (!c->throttleBackoff()) {
+                c->setState(conn_closing);
+                return true;
+            }
+            return false;
+        }
+    }
+    if (c->isEventTimeoutArmed()) {
+        /* Admitted again; go back to a plain (timeout free) event */
+        c->clearEventTimeout();
+    }
+
     /*
      * In order to ensure that all clients will be served each
      * connection will only process a certain number of operations
-     * before they will back off.
+     * before they will back off. Counting requests alone treats a
+     * multi-megabyte mutation the same as a tiny get, so connections
+     * also yield when they exhaust the (optional) time budget of
+     * their timeslice.
      */
-    if (c->decrementNumEvents() >= 0) {
+    if (c->decrementNumEvents() >= 0 && !c->isTimesliceExhausted()) {
         reset_cmd_handler(c);
     } else {
         get_thread_stats(c)->conn_yields++;
@@ -283,8 +396,13 @@ bool conn_new_cmd(McbpConnection *c) {
          * DCP and TAP connections is different from normal
          * connections in the way that they may not even get data from
          * the other end so that they'll _have_ to wait for a write event.
+         *
+         * The same goes for corked responses; they are flushed from
+         * reset_cmd_handler so we need to get back there even if the
+         * client doesn't send us another byte.
          */
-        if (c->havePendingInputData() || c->isDCP() || c->isTAP()) {
+        if (c->havePendingInputData() || c->getPendingResponses() > 0 ||
+            c->isDCP() || c->isTAP()) {
             short flags = EV_WRITE | EV_PERSIST;
             // pipe requires EV_READ forcing to ensure we can read until EOF
             if (c->isPipeConnection()) {
@@ -392,13 +510,21 @@ bool conn_write(McbpConnection *c) {
 bool conn_mwrite(McbpConnection *c) {
     bool ret = true;
 
+    if (c->maybeCorkResponse()) {
+        /* The response was queued up in msglist; go pick up the next
+         * pipelined request and send everything in one go later. */
+        c->setState(conn_new_cmd);
+        return true;
+    }
+
     switch (c->transmit()) {
     case McbpConnection::TransmitResult::Complete:
 
         c->releaseTempAlloc();
-        if (c->getState() == conn_mwrite) {
+        if (c->getState() == conn_mwrite || c->getState() == conn_write) {
             c->releaseReservedItems();
-        } else if (c->getState() != conn_write) {
+            c->resetResponseStaging();
+        } else {
             LOG_WARNING(c, "%u: Unexpected state %d, closing",
                         c->getId(), c->getState());
             c->setState(conn_closing);
@@ -512,6 +638,9 @@ bool conn_refresh_cbsasl(McbpConnection *c) {
 
     switch (ret) {
     case ENGINE_SUCCESS:
+        /* The identities recorded in outstanding resumption tokens may
+         * no longer be valid with the new password database. */
+        session_resume_invalidate_tokens();
         mcbp_write_response(c, NULL, 0, 0, 0);
         break;
     case ENGINE_DISCONNECT:
@@ -652,11 +781,27 @@ bool conn_sasl_auth(McbpConnection* c) {
     auto task = reinterpret_cast<SaslAuthTask*>(ctx->task.get());
 
     switch (task->getError()) {
-    case CBSASL_OK:
-        mcbp_write_response(c, task->getResponse(), 0, 0,
-                            task->getResponse_length());
+    case CBSASL_OK: {
+        /* Most mechanisms have no payload on success; those which do
+         * (the SCRAM server signature) produce a handful of bytes.
+         * Stage it in the write buffer so the response can be corked
+         * when the client pipelined SELECT_BUCKET (and more) behind
+         * the authentication. */
+        const char* data = task->getResponse();
+        uint32_t len = uint32_t(task->getResponse_length());
+        if (data != nullptr && len > 0) {
+            char* ofs = c->getResponseHeaderSlot() +
+                        sizeof(protocol_binary_response_header);
+            if (len < c->write.size - c->write.bytes -
+                      sizeof(protocol_binary_response_header)) {
+                memcpy(ofs, data, len);
+                data = ofs;
+            }
+        }
+        mcbp_write_response(c, data, 0, 0, len);
         get_thread_stats(c)->auth_cmds++;
         break;
+    }
     case CBSASL_CONTINUE:
         LOG_INFO(c, "%u: SASL continue", c->getId());
 
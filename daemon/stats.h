@@ -20,12 +20,17 @@
 #include <relaxed_atomic.h>
 #include <mutex>
 
+#include "opcode_filter.h"
 #include "timing_histogram.h"
 
 /**
- * Stats stored per-thread.
+ * Stats stored per-thread. All of the counters are relaxed atomics (a
+ * single worker thread is the writer; the aggregator just reads), and
+ * the struct is aligned (and thereby padded) to the cache line size so
+ * that one worker's hot counters never share a cache line with its
+ * neighbour's in the per-bucket arrays.
  */
-struct thread_stats {
+struct alignas(64) thread_stats {
     thread_stats() {
         reset();
     }
@@ -46,6 +51,11 @@ struct thread_stats {
         cas_misses = 0;
         bytes_written = 0;
         bytes_read = 0;
+        bytes_sent_zerocopy = 0;
+        bytes_sent_copied = 0;
+        bytes_sent_ship = 0;
+        sendmsg_calls = 0;
+        responses_corked = 0;
         cmd_flush = 0;
         conn_yields = 0;
         auth_cmds = 0;
@@ -66,6 +76,7 @@ struct thread_stats {
 
         iovused_high_watermark = 0;
         msgused_high_watermark = 0;
+        scratch_arena_high_watermark = 0;
     }
 
     thread_stats & operator += (const thread_stats &other) {
@@ -84,6 +95,11 @@ struct thread_stats {
         cas_misses += other.cas_misses;
         bytes_read += other.bytes_read;
         bytes_written += other.bytes_written;
+        bytes_sent_zerocopy += other.bytes_sent_zerocopy;
+        bytes_sent_copied += other.bytes_sent_copied;
+        bytes_sent_ship += other.bytes_sent_ship;
+        sendmsg_calls += other.sendmsg_calls;
+        responses_corked += other.responses_corked;
         cmd_flush += other.cmd_flush;
         conn_yields += other.conn_yields;
         auth_cmds += other.auth_cmds;
@@ -104,6 +120,71 @@ struct thread_stats {
 
         iovused_high_watermark.setIfGreater(other.iovused_high_watermark);
         msgused_high_watermark.setIfGreater(other.msgused_high_watermark);
+        scratch_arena_high_watermark.setIfGreater(
+            other.scratch_arena_high_watermark);
+
+        return *this;
+    }
+
+    /**
+     * Interpret this (aggregated) set of counters relative to the
+     * given baseline snapshot (see stats_reset). The monotonic
+     * counters are simply differenced. A difference is meaningless
+     * for the high watermarks: a new high is only observable once it
+     * exceeds the watermark captured in the baseline, so a watermark
+     * which hasn't been beaten since the snapshot reads as 0.
+     */
+    thread_stats& operator-=(const thread_stats& other) {
+        cmd_get -= other.cmd_get;
+        get_misses -= other.get_misses;
+        cmd_set -= other.cmd_set;
+        get_hits -= other.get_hits;
+        delete_hits -= other.delete_hits;
+        cas_hits -= other.cas_hits;
+        cas_badval -= other.cas_badval;
+        delete_misses -= other.delete_misses;
+        decr_misses -= other.decr_misses;
+        incr_misses -= other.incr_misses;
+        decr_hits -= other.decr_hits;
+        incr_hits -= other.incr_hits;
+        cas_misses -= other.cas_misses;
+        bytes_read -= other.bytes_read;
+        bytes_written -= other.bytes_written;
+        bytes_sent_zerocopy -= other.bytes_sent_zerocopy;
+        bytes_sent_copied -= other.bytes_sent_copied;
+        bytes_sent_ship -= other.bytes_sent_ship;
+        sendmsg_calls -= other.sendmsg_calls;
+        responses_corked -= other.responses_corked;
+        cmd_flush -= other.cmd_flush;
+        conn_yields -= other.conn_yields;
+        auth_cmds -= other.auth_cmds;
+        auth_errors -= other.auth_errors;
+        cmd_subdoc_lookup -= other.cmd_subdoc_lookup;
+        cmd_subdoc_mutation -= other.cmd_subdoc_mutation;
+
+        bytes_subdoc_lookup_total -= other.bytes_subdoc_lookup_total;
+        bytes_subdoc_lookup_extracted -= other.bytes_subdoc_lookup_extracted;
+        bytes_subdoc_mutation_total -= other.bytes_subdoc_mutation_total;
+        bytes_subdoc_mutation_inserted -= other.bytes_subdoc_mutation_inserted;
+
+        rbufs_allocated -= other.rbufs_allocated;
+        rbufs_loaned -= other.rbufs_loaned;
+        rbufs_existing -= other.rbufs_existing;
+        wbufs_allocated -= other.wbufs_allocated;
+        wbufs_loaned -= other.wbufs_loaned;
+
+        if (iovused_high_watermark.load() <=
+            other.iovused_high_watermark.load()) {
+            iovused_high_watermark = 0;
+        }
+        if (msgused_high_watermark.load() <=
+            other.msgused_high_watermark.load()) {
+            msgused_high_watermark = 0;
+        }
+        if (scratch_arena_high_watermark.load() <=
+            other.scratch_arena_high_watermark.load()) {
+            scratch_arena_high_watermark = 0;
+        }
 
         return *this;
     }
@@ -129,6 +210,23 @@ struct thread_stats {
     Couchbase::RelaxedAtomic<uint64_t> cas_misses;
     Couchbase::RelaxedAtomic<uint64_t> bytes_read;
     Couchbase::RelaxedAtomic<uint64_t> bytes_written;
+    /* # of response value bytes sent via iovecs referencing engine memory
+       directly (the item is pinned until the write drains). */
+    Couchbase::RelaxedAtomic<uint64_t> bytes_sent_zerocopy;
+    /* # of response value bytes which had to be staged through an
+       intermediate buffer first (e.g. inflate for clients without
+       datatype support). */
+    Couchbase::RelaxedAtomic<uint64_t> bytes_sent_copied;
+    /* # of bytes staged by the TAP/DCP ship-log path (backfill and
+       replication traffic). Compared against bytes_written this gives
+       the backfill vs frontend byte share of the worker. */
+    Couchbase::RelaxedAtomic<uint64_t> bytes_sent_ship;
+    /* # of sendmsg() calls issued; bytes_written / sendmsg_calls gives the
+       average number of bytes shipped per system call. */
+    Couchbase::RelaxedAtomic<uint64_t> sendmsg_calls;
+    /* # of responses which were corked (queued up behind an earlier
+       response and transmitted in the same sendmsg call). */
+    Couchbase::RelaxedAtomic<uint64_t> responses_corked;
     Couchbase::RelaxedAtomic<uint64_t> cmd_flush;
     Couchbase::RelaxedAtomic<uint64_t> conn_yields; /* # of yields for connections (-R option)*/
     Couchbase::RelaxedAtomic<uint64_t> auth_cmds;
@@ -164,14 +262,14 @@ struct thread_stats {
     /* # of write buffers which could be loaned (and hence didn't need to be allocated). */
     Couchbase::RelaxedAtomic<uint64_t> wbufs_loaned;
 
-    // Right now we're protecting both the "high watermark" variables
-    // between the same mutex
-    std::mutex mutex;
-
     /* Highest value iovsize has got to */
     Couchbase::RelaxedAtomic<int> iovused_high_watermark;
     /* High value Connection->msgused has got to */
     Couchbase::RelaxedAtomic<int> msgused_high_watermark;
+    /* Most bytes the per-command scratch arena has ever had live at once
+       (across all connections served by the thread); used to judge the
+       arena capacity against the workload */
+    Couchbase::RelaxedAtomic<int> scratch_arena_high_watermark;
 };
 
 /**
@@ -195,6 +293,17 @@ struct listening_port {
     bool tcp_nodelay;
     bool management;
     Protocol protocol;
+    /** The event priority class for connections accepted on the port */
+    EventPriority priority;
+    /**
+     * The opcodes accepted from connections on the port. Defaults to
+     * all of them; restricted over ioctl (interface.opcode_filter) to
+     * shrink the protocol surface of an exposed interface. Connections
+     * cache a pointer to this filter, so the instance must stay put
+     * for the lifetime of the process (listening_ports is only built
+     * during startup).
+     */
+    OpcodeFilter opcode_filter;
 };
 
 /**
@@ -216,6 +325,29 @@ struct stats {
     /** The number of times I reject a client */
     Couchbase::RelaxedAtomic<uint64_t> rejected_conns;
 
+    /** The number of commands failed with a temporary failure because
+     * they exceeded the per-operation memory budget (see the
+     * per_op_memory_budget setting) */
+    Couchbase::RelaxedAtomic<uint64_t> op_budget_kills;
+
+    /** The number of commands dropped with DEADLINE_EXCEEDED because
+     * they aged past the deadline the client put on the connection
+     * (see SET_OP_DEADLINE) */
+    Couchbase::RelaxedAtomic<uint64_t> deadline_drops;
+
+    /** The number of new connections which couldn't be handed to a worker
+     * on the NUMA node which received them (only counted when
+     * thread_affinity is enabled and the node could be determined) */
+    Couchbase::RelaxedAtomic<uint64_t> cross_numa_dispatch;
+
+    /** The number of connections migrated to a less loaded worker thread
+     * (only counted when connection_rebalance is enabled) */
+    Couchbase::RelaxedAtomic<uint64_t> conn_migrations;
+
+    /** The number of idle connections disconnected to make room for new
+     * clients (only counted when connection_shed_headroom is set) */
+    Couchbase::RelaxedAtomic<uint64_t> shed_conns;
+
     std::vector<listening_port> listening_ports;
 };
 
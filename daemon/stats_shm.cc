@@ -0,0 +1,260 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "stats_shm.h"
+
+#include "memcached.h"
+#include "stats.h"
+
+#include <utilities/stats_shm.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+ * The reader interprets the counter slices through the plain
+ * stats_shm_counters mirror of thread_stats; make sure the two can't
+ * drift apart silently. The atomics in thread_stats have the same
+ * object representation as the underlying integers, so matching sizes
+ * and offsets is all it takes.
+ */
+static_assert(sizeof(stats_shm_counters) <= sizeof(thread_stats),
+              "stats_shm_counters is bigger than thread_stats");
+static_assert(offsetof(stats_shm_counters, cmd_get) ==
+              offsetof(thread_stats, cmd_get),
+              "cmd_get offset mismatch");
+static_assert(offsetof(stats_shm_counters, bytes_read) ==
+              offsetof(thread_stats, bytes_read),
+              "bytes_read offset mismatch");
+static_assert(offsetof(stats_shm_counters, wbufs_loaned) ==
+              offsetof(thread_stats, wbufs_loaned),
+              "wbufs_loaned offset mismatch");
+static_assert(offsetof(stats_shm_counters, scratch_arena_high_watermark) ==
+              offsetof(thread_stats, scratch_arena_high_watermark),
+              "scratch_arena_high_watermark offset mismatch");
+static_assert(STATS_SHM_MAX_NAME == MAX_BUCKET_NAME_LENGTH,
+              "STATS_SHM_MAX_NAME out of sync with MAX_BUCKET_NAME_LENGTH");
+
+struct stats_shm_segment {
+    char* base = nullptr;
+    size_t size = 0;
+    stats_shm_header* header = nullptr;
+#ifdef WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+static stats_shm_segment segment;
+
+/* Keep the header, the records and the counter slices on their own
+ * cache lines (thread_stats is itself alignas(64), so the slices must
+ * start at a 64 byte boundary within the mapping anyway). */
+static size_t roundup64(size_t val) {
+    return (val + 63) & ~size_t(63);
+}
+
+static stats_shm_record* get_record(size_t idx) {
+    return reinterpret_cast<stats_shm_record*>(
+        segment.base + segment.header->header_size +
+        idx * segment.header->record_stride);
+}
+
+bool stats_shm_init(const std::string& path, size_t records, size_t slices) {
+    const size_t header_size = roundup64(sizeof(stats_shm_header));
+    const size_t slice_offset = roundup64(sizeof(stats_shm_record));
+    const size_t record_stride = roundup64(slice_offset +
+                                           slices * sizeof(thread_stats));
+    const size_t total = header_size + records * record_stride;
+
+#ifdef WIN32
+    segment.file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                               FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL, NULL);
+    if (segment.file == INVALID_HANDLE_VALUE) {
+        LOG_WARNING(NULL, "Failed to create stats shm segment \"%s\": %u",
+                    path.c_str(), (unsigned)GetLastError());
+        return false;
+    }
+    segment.mapping = CreateFileMappingA(segment.file, NULL, PAGE_READWRITE,
+                                         (DWORD)(uint64_t(total) >> 32),
+                                         (DWORD)total, NULL);
+    if (segment.mapping == NULL) {
+        LOG_WARNING(NULL, "Failed to size stats shm segment \"%s\": %u",
+                    path.c_str(), (unsigned)GetLastError());
+        CloseHandle(segment.file);
+        segment.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    segment.base = reinterpret_cast<char*>(
+        MapViewOfFile(segment.mapping, FILE_MAP_ALL_ACCESS, 0, 0, total));
+    if (segment.base == nullptr) {
+        LOG_WARNING(NULL, "Failed to map stats shm segment \"%s\": %u",
+                    path.c_str(), (unsigned)GetLastError());
+        CloseHandle(segment.mapping);
+        CloseHandle(segment.file);
+        segment.mapping = NULL;
+        segment.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+#else
+    segment.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (segment.fd == -1) {
+        LOG_WARNING(NULL, "Failed to create stats shm segment \"%s\": %s",
+                    path.c_str(), strerror(errno));
+        return false;
+    }
+    if (ftruncate(segment.fd, (off_t)total) == -1) {
+        LOG_WARNING(NULL, "Failed to size stats shm segment \"%s\": %s",
+                    path.c_str(), strerror(errno));
+        close(segment.fd);
+        segment.fd = -1;
+        return false;
+    }
+    void* base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      segment.fd, 0);
+    if (base == MAP_FAILED) {
+        LOG_WARNING(NULL, "Failed to map stats shm segment \"%s\": %s",
+                    path.c_str(), strerror(errno));
+        close(segment.fd);
+        segment.fd = -1;
+        return false;
+    }
+    segment.base = reinterpret_cast<char*>(base);
+#endif
+
+    segment.size = total;
+    memset(segment.base, 0, total);
+
+    segment.header = reinterpret_cast<stats_shm_header*>(segment.base);
+    segment.header->version = STATS_SHM_VERSION;
+    segment.header->header_size = (uint32_t)header_size;
+    segment.header->record_stride = (uint32_t)record_stride;
+    segment.header->record_count = (uint32_t)records;
+    segment.header->slice_offset = (uint32_t)slice_offset;
+    segment.header->slice_count = (uint32_t)slices;
+    segment.header->slice_stride = (uint32_t)sizeof(thread_stats);
+    segment.header->boot_time = (uint64_t)time(NULL);
+
+    /* Construct the thread_stats arrays in place. The elements are
+     * trivially destructible so nothing needs tearing down at
+     * shutdown beyond unmapping. */
+    for (size_t ii = 0; ii < records; ++ii) {
+        char* slice = reinterpret_cast<char*>(get_record(ii)) + slice_offset;
+        for (size_t jj = 0; jj < slices; ++jj) {
+            new (slice + jj * sizeof(thread_stats)) thread_stats();
+        }
+    }
+
+    /* Publish the magic last: a scraper which raced the setup above
+     * sees a zero magic and backs off */
+    std::atomic_thread_fence(std::memory_order_release);
+    segment.header->magic = STATS_SHM_MAGIC;
+
+    LOG_NOTICE(NULL, "Exporting statistics to shm segment \"%s\" "
+               "(%" PRIu64 " bytes, %" PRIu64 " records)",
+               path.c_str(), uint64_t(total), uint64_t(records));
+    return true;
+}
+
+bool stats_shm_enabled(void) {
+    return segment.base != nullptr;
+}
+
+struct thread_stats* stats_shm_thread_stats(size_t idx) {
+    if (segment.base == nullptr) {
+        return nullptr;
+    }
+    return reinterpret_cast<thread_stats*>(
+        reinterpret_cast<char*>(get_record(idx)) +
+        segment.header->slice_offset);
+}
+
+/* Seqlock write protocol: bump to odd, fence, mutate, fence, bump back
+ * to even. Binds and unbinds are serialized by the bucket machinery
+ * (the slot's state leaves/enters BucketState::None under
+ * buckets_lock), so there is a single writer per record. */
+static void seq_begin(stats_shm_record* record) {
+    record->seq++;
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void seq_end(stats_shm_record* record) {
+    std::atomic_thread_fence(std::memory_order_release);
+    record->seq++;
+}
+
+void stats_shm_bind(size_t idx, const char* name) {
+    if (segment.base == nullptr) {
+        return;
+    }
+    auto* record = get_record(idx);
+    seq_begin(record);
+    strncpy(record->name, name, STATS_SHM_MAX_NAME);
+    record->name[STATS_SHM_MAX_NAME] = '\0';
+    record->in_use = 1;
+    seq_end(record);
+}
+
+void stats_shm_unbind(size_t idx) {
+    if (segment.base == nullptr) {
+        return;
+    }
+    auto* record = get_record(idx);
+    seq_begin(record);
+    record->in_use = 0;
+    record->name[0] = '\0';
+    auto* slices = stats_shm_thread_stats(idx);
+    for (size_t ii = 0; ii < segment.header->slice_count; ++ii) {
+        slices[ii].reset();
+    }
+    seq_end(record);
+}
+
+void stats_shm_shutdown(void) {
+    if (segment.base == nullptr) {
+        return;
+    }
+#ifdef WIN32
+    UnmapViewOfFile(segment.base);
+    CloseHandle(segment.mapping);
+    CloseHandle(segment.file);
+    segment.mapping = NULL;
+    segment.file = INVALID_HANDLE_VALUE;
+#else
+    munmap(segment.base, segment.size);
+    close(segment.fd);
+    segment.fd = -1;
+#endif
+    segment.base = nullptr;
+    segment.header = nullptr;
+    segment.size = 0;
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+/*
+ * Writer side of the shared-memory statistics segment (the format and
+ * the reader live in utilities/stats_shm.h; the layout is documented
+ * in docs/StatsShm.md).
+ *
+ * When enabled, the per-bucket thread_stats arrays are placement
+ * constructed inside a file-backed MAP_SHARED mapping instead of on
+ * the heap, so the workers' counter updates land directly in the
+ * segment and node-local scrapers can read them at any frequency
+ * without consuming a connection or any daemon CPU.
+ */
+
+#include <cstddef>
+#include <string>
+
+struct thread_stats;
+
+/**
+ * Create (truncating any stale segment from a previous run) and map
+ * the statistics segment.
+ *
+ * @param path the file to back the segment with
+ * @param records the number of bucket records (max_buckets)
+ * @param slices counter slices per record (worker threads + 1)
+ * @return true on success; false leaves the facility disabled (the
+ *         caller falls back to heap allocated stats)
+ */
+bool stats_shm_init(const std::string& path, size_t records, size_t slices);
+
+/**
+ * Is the shared-memory segment mapped?
+ */
+bool stats_shm_enabled(void);
+
+/**
+ * Get the (placement constructed) thread_stats array for the given
+ * bucket record, or nullptr when the facility is disabled.
+ */
+struct thread_stats* stats_shm_thread_stats(size_t idx);
+
+/**
+ * Bind a record to a bucket: publish the name and mark the record in
+ * use under the record's seqlock. Called when a created bucket
+ * becomes ready.
+ */
+void stats_shm_bind(size_t idx, const char* name);
+
+/**
+ * Release a record when its bucket is deleted: mark it free and zero
+ * the counter slices under the record's seqlock, so a recycled slot
+ * starts from scratch.
+ */
+void stats_shm_unbind(size_t idx);
+
+/**
+ * Unmap the segment (the file is left behind; its boot_time tells a
+ * scraper it is stale once the daemon restarts).
+ */
+void stats_shm_shutdown(void);
@@ -0,0 +1,80 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "stats_snapshot.h"
+
+#include "connection_mcbp.h"
+
+#include <cstring>
+
+bool StatsSnapshot::copyTo(McbpConnection& c, rel_time_t now,
+                           rel_time_t max_age) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    if (payload.empty() || (now - timestamp) > max_age) {
+        return false;
+    }
+
+    if (!c.growDynamicBuffer(payload.size())) {
+        return false;
+    }
+
+    auto& dbuf = c.getDynamicBuffer();
+    char* buf = dbuf.getCurrent();
+    memcpy(buf, payload.data(), payload.size());
+
+    // Each packet in the payload carries the opaque of the request it
+    // was originally rendered for; rewrite them for this request.
+    // The opaque is stored as-is (no byteorder conversion), the same
+    // way append_bin_stats writes it.
+    const uint32_t opaque = c.getOpaque();
+    size_t offset = 0;
+    while (offset + sizeof(protocol_binary_response_header) <=
+           payload.size()) {
+        auto* header = reinterpret_cast<protocol_binary_response_header*>(
+            buf + offset);
+        header->response.opaque = opaque;
+        offset += sizeof(protocol_binary_response_header) +
+                  ntohl(header->response.bodylen);
+    }
+
+    dbuf.moveOffset(payload.size());
+    return true;
+}
+
+void StatsSnapshot::update(const DynamicBuffer& buf, rel_time_t now) {
+    std::lock_guard<std::mutex> guard(mutex);
+    payload.clear();
+    try {
+        payload.reserve(buf.getOffset());
+        for (const auto& segment : buf.getSegments()) {
+            payload.append(segment.data, segment.used);
+        }
+    } catch (const std::bad_alloc&) {
+        // Not caching the payload is always an option
+        payload.clear();
+        payload.shrink_to_fit();
+        return;
+    }
+    timestamp = now;
+}
+
+void StatsSnapshot::invalidate(void) {
+    std::lock_guard<std::mutex> guard(mutex);
+    payload.clear();
+    payload.shrink_to_fit();
+}
@@ -0,0 +1,86 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <memcached/engine.h>
+
+#include <mutex>
+#include <string>
+
+class DynamicBuffer;
+class McbpConnection;
+
+/**
+ * A cache of the fully serialized response payload for the plain
+ * (argument-less) "stats" command of a bucket.
+ *
+ * Rendering all statistics walks the engine and the server stat
+ * providers with a callback per key/value pair, growing the response
+ * buffer pair by pair. Monitoring systems tend to poll the exact same
+ * command at a fixed cadence on every node, so the first request past
+ * the configured age renders (and caches) the payload as usual and
+ * everybody else within the window gets a single bulk copy of the
+ * cached serialization instead.
+ *
+ * The payload is a sequence of complete STAT response packets, so the
+ * only per-request fix-up needed when serving from the cache is
+ * patching the opaque field of each packet to match the request.
+ */
+class StatsSnapshot {
+public:
+    StatsSnapshot()
+        : timestamp(0) {
+    }
+
+    /**
+     * Try to serve a cached payload by copying it into the
+     * connection's dynamic buffer (with the opaques rewritten for the
+     * request).
+     *
+     * @param c the connection to build the response for
+     * @param now the current time
+     * @param max_age maximum age (in seconds) the cached payload may
+     *        have
+     * @return true if the response was built from the cache, false if
+     *         there is no payload fresh enough (or growing the buffer
+     *         failed) and the caller should render the stats as usual
+     */
+    bool copyTo(McbpConnection& c, rel_time_t now, rel_time_t max_age);
+
+    /**
+     * Store a freshly rendered payload (the content of the dynamic
+     * buffer before the terminating empty stat is appended). The
+     * buffer is a chain of segments, so the payload is gathered
+     * segment by segment.
+     *
+     * @param buf the buffer holding the serialized stat packets
+     * @param now the current time
+     */
+    void update(const DynamicBuffer& buf, rel_time_t now);
+
+    /** Throw away the cached payload (bucket deleted, stats reset etc) */
+    void invalidate(void);
+
+private:
+    std::mutex mutex;
+
+    /** The serialized stat packets ("" = nothing cached) */
+    std::string payload;
+
+    /** When the payload was rendered */
+    rel_time_t timestamp;
+};
@@ -88,9 +88,11 @@ static void subdoc_print_command(Connection* c, protocol_binary_command cmd,
  * Definitions
  */
 
+template <protocol_binary_command CMD>
 static SubdocCmdContext*
-subdoc_create_context(McbpConnection* c, const SubdocCmdTraits traits,
-                      const void* packet, const_sized_buffer value) {
+subdoc_create_context(McbpConnection* c, const void* packet,
+                      const_sized_buffer value) {
+    constexpr SubdocCmdTraits traits = get_traits<CMD>();
 
     try {
         auto* context = new SubdocCmdContext(c, traits);
@@ -243,15 +245,20 @@ uint32_t subdoc_decode_expiration(const protocol_binary_request_header* header,
 /* Main function which handles execution of all sub-document
  * commands: fetches, operates on, updates and finally responds to the client.
  *
+ * Templated on the binary protocol command so the command traits are
+ * compile-time constants - branches taken on them (expiry decoding,
+ * single/multi context creation, mutation vs lookup stats) constant-fold
+ * away in each instantiation instead of being tested per call.
+ *
  * Invoked via extern "C" trampoline functions (see later) which populate the
  * subdocument elements of executors[].
  *
  * @param c      connection object.
  * @param packet request packet.
- * @param traits Traits associated with the specific command.
  */
-static void subdoc_executor(McbpConnection *c, const void *packet,
-                            const SubdocCmdTraits traits) {
+template <protocol_binary_command CMD>
+static void subdoc_executor(McbpConnection *c, const void *packet) {
+    constexpr SubdocCmdTraits traits = get_traits<CMD>();
 
     // 0. Parse the request and log it if debug enabled.
     const protocol_binary_request_subdocument *req =
@@ -299,7 +306,7 @@ static void subdoc_executor(McbpConnection *c, const void *packet,
         auto* context = dynamic_cast<SubdocCmdContext*>(c->getCommandContext());
         if (context == nullptr) {
             const_sized_buffer value_buf{value, vallen};
-            context = subdoc_create_context(c, traits, packet, value_buf);
+            context = subdoc_create_context<CMD>(c, packet, value_buf);
             c->setCommandContext(context);
         }
 
@@ -346,7 +353,7 @@ static void subdoc_executor(McbpConnection *c, const void *packet,
         // in addition to specific subdoc counters. (This is mainly so we
         // see subdoc commands in the GUI, which used cmd_set / cmd_get).
         auto* thread_stats = get_thread_stats(c);
-        if (context->traits.is_mutator) {
+        if (traits.is_mutator) {
             thread_stats->cmd_subdoc_mutation++;
             thread_stats->bytes_subdoc_mutation_total += context->out_doc_len;
             thread_stats->bytes_subdoc_mutation_inserted +=
@@ -378,6 +385,28 @@ static void subdoc_executor(McbpConnection *c, const void *packet,
     mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ENGINE_TMPFAIL));
 }
 
+/* If the document value carries a leading extended attribute blob
+ * (DATATYPE_XATTR), advance {document} past it so subjson only ever sees
+ * the document body. The blob is self-describing - its total size is
+ * recoverable in constant time from the leading 32bit length field - so
+ * the body can be located without scanning (or copying) either segment.
+ * Returns false if the blob claims to be larger than the value.
+ */
+static bool skip_xattr_segment(const_sized_buffer& document) {
+    if (document.len < sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t xattr_len;
+    std::memcpy(&xattr_len, document.buf, sizeof(xattr_len));
+    const size_t body_offset = ntohl(xattr_len) + sizeof(uint32_t);
+    if (body_offset > document.len) {
+        return false;
+    }
+    document.buf += body_offset;
+    document.len -= body_offset;
+    return true;
+}
+
 /* Gets a flat, uncompressed JSON document ready for performing a subjson
  * operation on it.
  * @param      c        Connection
@@ -432,58 +461,84 @@ get_document_for_searching(McbpConnection * c, const item* item,
         const size_t compressed_len = info.info.value[0].iov_len;
         size_t uncompressed_len;
 
-        if (snappy_uncompressed_length(compressed_buf, compressed_len,
-                                       &uncompressed_len) != SNAPPY_OK) {
-            char clean_key[KEY_MAX_LENGTH + 32];
-            if (buf_to_printable_buffer(clean_key, sizeof(clean_key),
-                                        static_cast<const char*>(info.info.key),
-                                        info.info.nkey) != -1) {
-                LOG_WARNING(c,
-                            "<%u ERROR: Failed to determine inflated body"
-                                " size. Key: '%s' may have an "
-                                "incorrect datatype of COMPRESSED_JSON.",
-                            c->getId(), clean_key);
+        // A previous subdoc command on this connection may already have
+        // inflated this exact revision of the document - reuse it if so.
+        auto& cache = c->getInflatedDocCache();
+        if (cache.matches(c->getBucketIndex(),
+                          static_cast<const char*>(info.info.key),
+                          info.info.nkey, info.info.cas)) {
+            document.buf = cache.getData();
+            document.len = cache.getLength();
+        } else {
+            if (snappy_uncompressed_length(compressed_buf, compressed_len,
+                                           &uncompressed_len) != SNAPPY_OK) {
+                char clean_key[KEY_MAX_LENGTH + 32];
+                if (buf_to_printable_buffer(clean_key, sizeof(clean_key),
+                                            static_cast<const char*>(info.info.key),
+                                            info.info.nkey) != -1) {
+                    LOG_WARNING(c,
+                                "<%u ERROR: Failed to determine inflated body"
+                                    " size. Key: '%s' may have an "
+                                    "incorrect datatype of COMPRESSED_JSON.",
+                                c->getId(), clean_key);
+                }
+                return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
             }
-            return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
-        }
 
-        // We use the connections' dynamic buffer to uncompress into; this
-        // will later be used as the the send buffer for the subset of the
-        // document we send.
-        if (!c->growDynamicBuffer(uncompressed_len)) {
-            LOG_WARNING(c,
-                        "<%u ERROR: Failed to grow dynamic buffer to %"
-                            PRIu64 "for uncompressing document.",
-                        c->getId(), uncompressed_len);
-            return PROTOCOL_BINARY_RESPONSE_E2BIG;
-        }
-
-        auto &dbuf = c->getDynamicBuffer();
-        char* buffer = dbuf.getCurrent();
-        if (snappy_uncompress(compressed_buf, compressed_len, buffer,
-                              &uncompressed_len) != SNAPPY_OK) {
-            char clean_key[KEY_MAX_LENGTH + 32];
-            if (buf_to_printable_buffer(clean_key, sizeof(clean_key),
-                                        static_cast<const char*>(info.info.key),
-                                        info.info.nkey) != -1) {
+            // We uncompress into the connections' inflated document cache;
+            // unlike the dynamic buffer (which the response code may grow,
+            // and with that relocate, while the document is still referenced)
+            // the cache buffer stays put for the rest of the command, and a
+            // subsequent subdoc command against the same revision of the
+            // document can reuse it and skip the inflate entirely.
+            char* buffer = cache.allocate(uncompressed_len);
+            if (buffer == nullptr) {
                 LOG_WARNING(c,
-                            "<%u ERROR: Failed to inflate body. Key: '%s'"
-                                " may have an incorrect datatype of "
-                                "COMPRESSED_JSON.", c->getId(), clean_key);
+                            "<%u ERROR: Failed to allocate buffer of size %"
+                                PRIu64 " for uncompressing document.",
+                            c->getId(), uncompressed_len);
+                return PROTOCOL_BINARY_RESPONSE_E2BIG;
             }
-            return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+
+            if (snappy_uncompress(compressed_buf, compressed_len, buffer,
+                                  &uncompressed_len) != SNAPPY_OK) {
+                char clean_key[KEY_MAX_LENGTH + 32];
+                if (buf_to_printable_buffer(clean_key, sizeof(clean_key),
+                                            static_cast<const char*>(info.info.key),
+                                            info.info.nkey) != -1) {
+                    LOG_WARNING(c,
+                                "<%u ERROR: Failed to inflate body. Key: '%s'"
+                                    " may have an incorrect datatype of "
+                                    "COMPRESSED_JSON.", c->getId(), clean_key);
+                }
+                return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+            }
+            cache.set(c->getBucketIndex(),
+                      static_cast<const char*>(info.info.key),
+                      info.info.nkey, info.info.cas, uncompressed_len);
+            // Update document to point to the uncompressed version in the
+            // buffer.
+            document.buf = buffer;
+            document.len = uncompressed_len;
         }
-        dbuf.moveOffset(uncompressed_len);
-        // Update document to point to the uncompressed version in the buffer.
-        document.buf = buffer;
-        document.len = uncompressed_len;
-        return PROTOCOL_BINARY_RESPONSE_SUCCESS;
     } else {
         // Good to go using original buffer.
         document.buf = static_cast<char*>(info.info.value[0].iov_base);
         document.len = info.info.value[0].iov_len;
-        return PROTOCOL_BINARY_RESPONSE_SUCCESS;
     }
+
+    // If the value carries a leading xattr blob, position the document
+    // over just the body - a constant time operation irrespective of the
+    // size of either segment.
+    if (mcbp::datatype::is_xattr(info.info.datatype)) {
+        if (!skip_xattr_segment(document)) {
+            LOG_WARNING(c, "%u: Malformed xattr segment in document",
+                        c->getId());
+            return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+        }
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
 }
 
 // Fetch the item to operate on from the engine.
@@ -681,31 +736,53 @@ static bool subdoc_operate(SubdocCmdContext* context) {
                         // storage for iovecs from the result. Ideally we'd
                         // either permit subjson to take an iovec as input, or
                         // permit subjson to take all the multipaths at once.
-                        // For now we make a contiguous region in a temporary
-                        // std::vector, and point in_doc at that.
-                        std::unique_ptr<char[]> intermediate_doc;
-                        try {
-                            intermediate_doc.reset(new char[new_doc_len]);
-                        } catch (const std::bad_alloc&) {
-                            // Insufficient memory - unable to continue.
-                            mcbp_write_packet(context->c,
-                                              PROTOCOL_BINARY_RESPONSE_ENOMEM);
-                            return false;
+                        // For now gather into one of the context's two
+                        // scratch buffers. As the result iovecs may point
+                        // into the buffer used by the previous operation we
+                        // alternate between the two, growing (at least
+                        // geometrically) when the intermediate document
+                        // doesn't fit - a typical 16-path mutation then
+                        // performs just two allocations instead of one (plus
+                        // a free) per path.
+                        const int next = context->temp_doc_next;
+                        if (context->temp_doc_capacity[next] < new_doc_len) {
+                            size_t capacity =
+                                    context->temp_doc_capacity[next] * 2;
+                            if (capacity < new_doc_len) {
+                                capacity = new_doc_len;
+                            }
+                            if (!context->c->accountCommandMemory(capacity)) {
+                                // Over the per-operation memory budget;
+                                // fail fast instead of letting one
+                                // request grow without bound.
+                                stats.op_budget_kills++;
+                                mcbp_write_packet(context->c,
+                                                  PROTOCOL_BINARY_RESPONSE_ETMPFAIL);
+                                return false;
+                            }
+                            try {
+                                context->temp_doc[next].reset(
+                                        new char[capacity]);
+                            } catch (const std::bad_alloc&) {
+                                // Insufficient memory - unable to continue.
+                                mcbp_write_packet(context->c,
+                                                  PROTOCOL_BINARY_RESPONSE_ENOMEM);
+                                return false;
+                            }
+                            context->temp_doc_capacity[next] = capacity;
                         }
 
+                        char* dest = context->temp_doc[next].get();
                         size_t offset = 0;
                         for (auto& loc : op->result.newdoc()) {
-                            std::memcpy(intermediate_doc.get() + offset,
-                                        loc.at, loc.length);
+                            std::memcpy(dest + offset, loc.at, loc.length);
                             offset += loc.length;
                         }
 
-                        // Copying complete - safe to delete the old temp_doc
-                        // (even if it was the source of some of the newdoc
-                        // iovecs).
-                        context->temp_doc.swap(intermediate_doc);
-                        context->in_doc = {context->temp_doc.get(),
-                                           new_doc_len};
+                        // Gather complete - the other buffer becomes the
+                        // destination for the next operation's result.
+                        context->temp_doc_next = next ^ 1;
+                        context->in_doc = {dest, new_doc_len};
 
                     } else { // lookup
                         // nothing to do.
@@ -908,9 +985,6 @@ static size_t encode_multi_mutation_result_spec(uint8_t index,
 static void subdoc_single_response(SubdocCmdContext* context) {
     auto* const c = context->c;
 
-    protocol_binary_response_subdocument* rsp =
-            reinterpret_cast<protocol_binary_response_subdocument*>(c->write.buf);
-
     // Calculate extras size
     const bool include_mutation_dscr = (c->isSupportsMutationExtras() &&
                                         context->traits.is_mutator);
@@ -931,7 +1005,6 @@ static void subdoc_single_response(SubdocCmdContext* context) {
         c->setState(conn_closing);
         return;
     }
-    rsp->message.header.response.cas = htonll(c->getCAS());
 
     // Add mutation descr to response buffer if requested.
     if (include_mutation_dscr) {
@@ -959,8 +1032,6 @@ static void subdoc_single_response(SubdocCmdContext* context) {
  */
 static void subdoc_multi_mutation_response(SubdocCmdContext* context) {
     auto* const c = context->c;
-    protocol_binary_response_subdocument* rsp =
-            reinterpret_cast<protocol_binary_response_subdocument*>(c->write.buf);
 
     // MULTI_MUTATION: On success, zero to N multi_mutation_result_spec objects
     // (one for each spec which wants to return a value), with optional 16byte
@@ -1025,7 +1096,6 @@ static void subdoc_multi_mutation_response(SubdocCmdContext* context) {
         c->setState(conn_closing);
         return;
     }
-    rsp->message.header.response.cas = htonll(c->getCAS());
 
     // Append extras if requested.
     if (extlen > 0) {
@@ -1070,8 +1140,6 @@ static void subdoc_multi_mutation_response(SubdocCmdContext* context) {
  */
 static void subdoc_multi_lookup_response(SubdocCmdContext* context) {
     auto* const c = context->c;
-    protocol_binary_response_subdocument* rsp =
-            reinterpret_cast<protocol_binary_response_subdocument*>(c->write.buf);
 
     // Calculate the value length - sum of all the operation results.
     context->response_val_len = 0;
@@ -1085,14 +1153,33 @@ static void subdoc_multi_lookup_response(SubdocCmdContext* context) {
     }
 
     // We need two iovecs per operation result:
-    // 1. status (uin16_t) & vallen (uint32_t). Use the dynamicBuffer for this
+    // 1. status (uint16_t) & vallen (uint32_t) - a fixed six bytes per path.
+    //    Stage these in the write buffer, right behind the response header
+    //    slot (the same spot mcbp_write_response uses for small payloads),
+    //    so the common case performs no dynamic allocation at all. The
+    //    dynamicBuffer is kept as a fallback for the (pathological) case
+    //    where the write buffer lacks the space.
     // 2. actual value - this already resides either in the original document
-    //                   (for lookups) or stored in the Subdoc::Result.
-    DynamicBuffer& response_buf = c->getDynamicBuffer();
-    size_t needed = (sizeof(uint16_t) + sizeof(uint32_t)) * context->ops.size();
-    if (!response_buf.grow(needed)) {
+    //                   (for lookups) or stored in the Subdoc::Result, and
+    //                   is referenced in place - it is never copied.
+    const size_t header_sz = sizeof(uint16_t) + sizeof(uint32_t);
+    const size_t needed = header_sz * context->ops.size();
+
+    // mcbp_add_header() will bump-allocate the response header from the
+    // write buffer first (resetting the staging offset if no responses are
+    // corked) - account for both when checking for space.
+    const size_t staged = (c->getPendingResponses() == 0) ? 0 : c->write.bytes;
+    const bool stage_in_write_buf =
+            (c->write.size - staged) >=
+            (needed + sizeof(protocol_binary_response_header));
+    if (!stage_in_write_buf && !c->growDynamicBuffer(needed)) {
         // Unable to form complete response.
-        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+        if (c->isCommandBudgetExceeded()) {
+            stats.op_budget_kills++;
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ETMPFAIL);
+        } else {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+        }
         return;
     }
 
@@ -1103,7 +1190,6 @@ static void subdoc_multi_lookup_response(SubdocCmdContext* context) {
         c->setState(conn_closing);
         return;
     }
-    rsp->message.header.response.cas = htonll(c->getCAS());
 
     // Append the iovecs for each operation result.
     for (auto& op : context->ops) {
@@ -1111,8 +1197,8 @@ static void subdoc_multi_lookup_response(SubdocCmdContext* context) {
 
         // Header is always included. Result value included if the response for
         // this command has a value (e.g. not for EXISTS).
-        char* header = response_buf.getCurrent();
-        const size_t header_sz = sizeof(uint16_t) + sizeof(uint32_t);
+        char* header = stage_in_write_buf ? c->write.curr
+                                          : c->getDynamicBuffer().getCurrent();
         *reinterpret_cast<uint16_t*>(header) = htons(op.status);
         uint32_t result_len = 0;
         if (op.traits.response_has_value) {
@@ -1125,7 +1211,12 @@ static void subdoc_multi_lookup_response(SubdocCmdContext* context) {
         if (result_len != 0) {
             c->addIov(mloc.at, mloc.length);
         }
-        response_buf.moveOffset(header_sz);
+        if (stage_in_write_buf) {
+            c->write.curr += header_sz;
+            c->write.bytes += header_sz;
+        } else {
+            c->getDynamicBuffer().moveOffset(header_sz);
+        }
     }
 
     c->setState(conn_mwrite);
@@ -1154,71 +1245,57 @@ void subdoc_response(SubdocCmdContext* context) {
 }
 
 void subdoc_get_executor(McbpConnection* c, void* packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_GET>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_GET>(c, packet);
 }
 
 void subdoc_exists_executor(McbpConnection* c, void* packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_EXISTS>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_EXISTS>(c, packet);
 }
 
 void subdoc_dict_add_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DICT_ADD>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_DICT_ADD>(c, packet);
 }
 
 void subdoc_dict_upsert_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DICT_UPSERT>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_DICT_UPSERT>(c, packet);
 }
 
 void subdoc_delete_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DELETE>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_DELETE>(c, packet);
 }
 
 void subdoc_replace_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_REPLACE>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_REPLACE>(c, packet);
 }
 
 void subdoc_array_push_last_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_LAST>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_LAST>(c, packet);
 }
 
 void subdoc_array_push_first_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_FIRST>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_FIRST>(c, packet);
 }
 
 void subdoc_array_insert_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_INSERT>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_INSERT>(c, packet);
 }
 
 void subdoc_array_add_unique_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_ADD_UNIQUE>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_ADD_UNIQUE>(c, packet);
 }
 
 void subdoc_counter_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_COUNTER>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_COUNTER>(c, packet);
 }
 
 void subdoc_get_count_executor(McbpConnection *c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT>(c, packet);
 }
 
 void subdoc_multi_lookup_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP>(c, packet);
 }
 
 void subdoc_multi_mutation_executor(McbpConnection* c, void *packet) {
-    return subdoc_executor(c, packet,
-                           get_traits<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION>());
+    return subdoc_executor<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION>(c, packet);
 }
@@ -20,6 +20,7 @@
 #include "memcached.h"
 
 #include "buffer.h"
+#include "scratch_arena.h"
 #include "subdocument_traits.h"
 
 #include <cstddef>
@@ -34,14 +35,21 @@
 struct SubdocCmdContext : public CommandContext {
 
     class OperationSpec;
-    typedef std::vector<OperationSpec> Operations;
+    /* The specs live in the connection's scratch arena; they are dead
+     * well before the arena is reset (the command context is destroyed
+     * first, see reset_cmd_handler). */
+    typedef std::vector<OperationSpec,
+                        ScratchAllocator<OperationSpec>> Operations;
 
     SubdocCmdContext(McbpConnection * connection, const SubdocCmdTraits traits_)
       : c(connection),
         traits(traits_),
+        ops(ScratchAllocator<OperationSpec>(connection->getScratchArena())),
         in_doc({NULL, 0}),
         in_cas(0),
         in_flags(0),
+        temp_doc_capacity(),
+        temp_doc_next(0),
         executed(false),
         jroot_type(JSONSL_T_ROOT),
         needs_new_doc(false),
@@ -71,17 +79,27 @@ struct SubdocCmdContext : public CommandContext {
 
     // The expanded input JSON document. This may either refer to:
     // a). The raw engine item iovec
-    // b). The connections' DynamicBuffer if the JSON document had to be
-    //     decompressed.
-    // c). {intermediate_result} member of this object.
+    // b). The connections' InflatedDocCache if the JSON document had to
+    //     be decompressed.
+    // c). {temp_doc} member of this object.
     // Either way, it should /not/ be cb_free()d.
-    // TODO: Remove (b), and just use intermediate result.
     const_sized_buffer in_doc;
 
-    // Temporary buffer used to hold the intermediate result document for
-    // multi-path mutations. {in_doc} is then updated to point to this to use
-    // as input for the next multi-path mutation.
-    std::unique_ptr<char[]> temp_doc;
+    // Scratch buffers used to hold the intermediate result document for
+    // multi-path mutations. {in_doc} is then updated to point into one of
+    // these to use as input for the next multi-path mutation. Two buffers
+    // are used alternately so gathering one operation's result can never
+    // overwrite the buffer its result iovecs point into, and the buffers
+    // (sized to the largest intermediate document seen so far) are reused
+    // across all paths of the command instead of being allocated per path.
+    std::unique_ptr<char[]> temp_doc[2];
+
+    // Allocated size of each of the {temp_doc} buffers.
+    size_t temp_doc_capacity[2];
+
+    // Index (0 or 1) of the {temp_doc} buffer to gather the next
+    // intermediate result into.
+    int temp_doc_next;
 
     // CAS value of the input document. Required to ensure we only store a
     // new document which was derived from the same original input document.
@@ -66,11 +66,16 @@ struct SubdocMultiCmdTraits {
  */
 SubdocCmdTraits get_subdoc_cmd_traits(protocol_binary_command cmd);
 
+/*
+ * Compile-time lookup of a Sub-document commands' traits. All
+ * specializations are constexpr so the traits (and any branches taken
+ * on them) can be folded into the templated executors in subdocument.cc.
+ */
 template <protocol_binary_command CMD>
-SubdocCmdTraits get_traits();
+constexpr SubdocCmdTraits get_traits();
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_GET>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_GET>() {
     return {Subdoc::Command::GET,
             SUBDOC_FLAG_NONE,
             /*request_has_value*/false,
@@ -81,7 +86,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_GET>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_EXISTS>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_EXISTS>() {
     return {Subdoc::Command::EXISTS,
             SUBDOC_FLAG_NONE,
             /*request_has_value*/false,
@@ -92,7 +97,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_EXISTS>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DICT_ADD>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DICT_ADD>() {
     return {Subdoc::Command::DICT_ADD,
             SUBDOC_FLAG_MKDIR_P|SUBDOC_FLAG_MKDOC,
             /*request_has_value*/true,
@@ -103,7 +108,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DICT_ADD>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DICT_UPSERT>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DICT_UPSERT>() {
     return {Subdoc::Command::DICT_UPSERT,
             SUBDOC_FLAG_MKDIR_P|SUBDOC_FLAG_MKDOC,
             /*request_has_value*/true,
@@ -114,7 +119,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DICT_UPSERT>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DELETE>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DELETE>() {
     return {Subdoc::Command::REMOVE,
             SUBDOC_FLAG_NONE,
             /*request_has_value*/false,
@@ -125,7 +130,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_DELETE>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_REPLACE>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_REPLACE>() {
     return {Subdoc::Command::REPLACE,
             SUBDOC_FLAG_NONE,
             /*request_has_value*/true,
@@ -136,7 +141,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_REPLACE>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_LAST>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_LAST>() {
     return {Subdoc::Command::ARRAY_APPEND,
             SUBDOC_FLAG_MKDIR_P|SUBDOC_FLAG_MKDOC,
             /*request_has_value*/true,
@@ -147,7 +152,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_LAST>()
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_FIRST>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_FIRST>() {
     return {Subdoc::Command::ARRAY_PREPEND,
             SUBDOC_FLAG_MKDIR_P|SUBDOC_FLAG_MKDOC,
             /*request_has_value*/true,
@@ -158,7 +163,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_PUSH_FIRST>()
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_INSERT>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_INSERT>() {
     return {Subdoc::Command::ARRAY_INSERT,
             SUBDOC_FLAG_NONE,
             /*request_has_value*/true,
@@ -169,7 +174,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_INSERT>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_ADD_UNIQUE>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_ADD_UNIQUE>() {
     return {Subdoc::Command::ARRAY_ADD_UNIQUE,
             SUBDOC_FLAG_MKDIR_P|SUBDOC_FLAG_MKDOC,
             /*request_has_value*/true,
@@ -180,7 +185,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_ARRAY_ADD_UNIQUE>()
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_COUNTER>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_COUNTER>() {
     return {Subdoc::Command::COUNTER,
             SUBDOC_FLAG_MKDIR_P|SUBDOC_FLAG_MKDOC,
             /*request_has_value*/true,
@@ -191,7 +196,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_COUNTER>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT>() {
     return {Subdoc::Command::GET_COUNT,
             SUBDOC_FLAG_NONE,
             /*request_has_value*/false,
@@ -202,7 +207,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP>() {
     return {Subdoc::Command::INVALID,
             SUBDOC_FLAG_NONE,
             /*request_has_value*/true,
@@ -213,7 +218,7 @@ inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP>() {
 }
 
 template <>
-inline SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION>() {
+constexpr SubdocCmdTraits get_traits<PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION>() {
     return {Subdoc::Command::INVALID,
             SUBDOC_FLAG_NONE,
             /*request_has_value*/true,
@@ -22,6 +22,20 @@ class Executor;
 #include <memcached/types.h>
 #include <mutex>
 #include <stdexcept>
+
+/**
+ * The priority class for a Task. The executors drain all queued high
+ * priority tasks before looking at the normal ones, so that a latency
+ * sensitive task (like SASL authentication) never have to wait behind
+ * bulk work (like bucket deletion).
+ */
+enum class TaskPriority {
+    /** Latency sensitive tasks */
+    High,
+    /** Bulk background work (the default) */
+    Low
+};
+
 /**
  * The Task class represents a Task that needs to be performed by the
  * ExecutorPool. See task must be non-blocking and utilize other theads
@@ -29,7 +43,9 @@ class Executor;
  */
 class Task {
 public:
-    Task() : executor(nullptr) {
+    Task(TaskPriority priority_ = TaskPriority::Low)
+        : priority(priority_),
+          executor(nullptr) {
         // empty
     }
 
@@ -75,6 +91,13 @@ public:
      */
     void makeRunnable();
 
+    /**
+     * Get the priority class for this task
+     */
+    TaskPriority getPriority() const {
+        return priority;
+    }
+
 private:
     /**
      * The task is pinned to an executor thread while being executed. In
@@ -87,18 +110,25 @@ private:
     friend class Executor;
 
     /**
-     * Set the executor that is supposed to handle this task. Once the
-     * task is pinned to an executor it cannot be moved.
+     * Set the executor that is supposed to handle this task. The task
+     * normally stays on the executor it was scheduled on, but an idle
+     * executor may re-pin a task which is still sitting in a run queue
+     * when it steals the task (the executors guarantee that a task
+     * never moves while it is being executed or sitting in a wait
+     * queue).
      *
      * @param executor_ the executor used to run the task
      */
     void setExecutor(Executor *executor_) {
-        if (executor != nullptr && executor != executor_) {
-            throw std::logic_error("The task can't switch executor");
-        }
         executor = executor_;
     }
 
+    /**
+     * The priority class for this task. It is set when the task is
+     * created and never change during the lifetime of the task.
+     */
+    const TaskPriority priority;
+
     /**
      * The executor thread responsible for running this task
      */
@@ -5,6 +5,10 @@
 #include "config.h"
 #include "memcached.h"
 #include "connections.h"
+#include "mc_time.h"
+#include "numa_replicas.h"
+#include "sched_trace.h"
+#include "timer_wheel.h"
 
 #include <atomic>
 #include <stdio.h>
@@ -18,8 +22,19 @@
 #include <platform/cb_malloc.h>
 #include <platform/platform.h>
 #include <platform/strerror.h>
-#include <queue>
 #include <memory>
+#include <vector>
+
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <vector>
+#endif
 
 #define ITEMS_PER_ALLOC 64
 
@@ -30,41 +45,85 @@ extern std::atomic<bool> memcached_shutdown;
 struct ConnectionQueueItem {
     ConnectionQueueItem(SOCKET sock, in_port_t port)
         : sfd(sock),
-          parent_port(port) {
+          parent_port(port),
+          migrating(nullptr),
+          next(nullptr) {
+        // empty
+    }
+
+    /* An existing connection being migrated to the receiving thread
+     * (as opposed to a freshly accepted socket) */
+    ConnectionQueueItem(Connection* c)
+        : sfd(INVALID_SOCKET),
+          parent_port(0),
+          migrating(c),
+          next(nullptr) {
         // empty
     }
 
     SOCKET sfd;
     in_port_t parent_port;
+    Connection* migrating;
+    ConnectionQueueItem* next;
 };
 
+/**
+ * An intrusive, lock free multi-producer single-consumer queue of new
+ * connections.
+ *
+ * Producers push onto an atomic stack, so during a reconnect storm the
+ * listener never blocks behind the worker holding a mutex. The consumer
+ * grabs the entire stack with a single exchange and reverses it, which
+ * keeps FIFO dispatch order and amortizes the synchronization over the
+ * whole batch.
+ */
 class ConnectionQueue {
 public:
     ~ConnectionQueue() {
-        while (!connections.empty()) {
-            safe_close(connections.front()->sfd);
-            connections.pop();
+        ConnectionQueueItem* item = takeAll();
+        while (item != nullptr) {
+            ConnectionQueueItem* next = item->next;
+            if (item->migrating == nullptr) {
+                /* (migrating connections are owned by the global
+                 * connection list and torn down with it) */
+                safe_close(item->sfd);
+            }
+            delete item;
+            item = next;
         }
     }
 
-    std::unique_ptr<ConnectionQueueItem> pop() {
-        std::lock_guard<std::mutex> guard(mutex);
-        if (connections.empty()) {
-            return nullptr;
+    /**
+     * Detach all queued items in arrival order, leaving the queue empty.
+     * The caller takes ownership of the returned list.
+     */
+    ConnectionQueueItem* takeAll() {
+        ConnectionQueueItem* list = head.exchange(nullptr,
+                                                  std::memory_order_acquire);
+        /* The stack is in LIFO order; reverse it so connections are
+           dispatched in the order they were accepted. */
+        ConnectionQueueItem* reversed = nullptr;
+        while (list != nullptr) {
+            ConnectionQueueItem* next = list->next;
+            list->next = reversed;
+            reversed = list;
+            list = next;
         }
-        std::unique_ptr<ConnectionQueueItem> ret(std::move(connections.front()));
-        connections.pop();
-        return ret;
+        return reversed;
     }
 
     void push(std::unique_ptr<ConnectionQueueItem> &item) {
-        std::lock_guard<std::mutex> guard(mutex);
-        connections.push(std::move(item));
+        ConnectionQueueItem* node = item.release();
+        node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(node->next, node,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+            /* node->next now holds the current head; try again */
+        }
     }
 
 private:
-    std::mutex mutex;
-    std::queue< std::unique_ptr<ConnectionQueueItem> > connections;
+    std::atomic<ConnectionQueueItem*> head{nullptr};
 };
 
 
@@ -144,6 +203,31 @@ bool create_notification_pipe(LIBEVENT_THREAD *me)
     return true;
 }
 
+/*
+ * Set up the channel used to wake up a worker thread. Prefer an eventfd:
+ * the kernel keeps a 64-bit counter, so any number of notifications
+ * posted between two wakeups collapse into a single event which is
+ * drained with one 8 byte read, where the pipe costs a byte per
+ * notification and a recv() loop through devnull to drain them. Falls
+ * back to the notification pipe where eventfd isn't available. The
+ * dispatcher keeps using the pipe as it relies on counting the bytes
+ * it receives.
+ */
+bool create_notification_channel(LIBEVENT_THREAD *me)
+{
+#ifdef HAVE_EVENTFD
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd != -1) {
+        me->notify[0] = me->notify[1] = efd;
+        me->notify_is_eventfd = true;
+        return true;
+    }
+    log_socket_error(EXTENSION_LOG_WARNING, NULL,
+                     "Can't create eventfd, falling back to pipe: %s");
+#endif
+    return create_notification_pipe(me);
+}
+
 static void setup_dispatcher(struct event_base *main_base,
                              void (*dispatcher_callback)(evutil_socket_t, short, void *))
 {
@@ -167,26 +251,62 @@ static void setup_dispatcher(struct event_base *main_base,
     }
 }
 
-/*
- * Set up a thread's information.
+/**
+ * Create the event base for a worker thread, honoring the configured
+ * event backend. With "epoll" the base is built with the changelist
+ * enabled: event modifications are queued and applied in a batch at
+ * the next dispatch, so the unregister/register pair performed by
+ * McbpConnection::updateEvent when a connection flips between read
+ * and write interest collapses into a single epoll_ctl (or none when
+ * the two cancel out). "default" leaves everything to libevent.
  */
-static void setup_thread(LIBEVENT_THREAD *me) {
-    me->type = ThreadType::GENERAL;
+static struct event_base *create_worker_event_base(void) {
+    struct event_config *cfg = event_config_new();
+
+    if (cfg == NULL) {
+        return event_base_new();
+    }
 
     if (settings.isStdinListen()) {
         // can't use epoll for stdin listening
-        struct event_config *cfg = event_config_new();
         event_config_avoid_method(cfg, "epoll");
-        me->base = event_base_new_with_config(cfg);
-        event_config_free(cfg);
-    } else {
-        me->base = event_base_new();
+    } else if (settings.getEventBackend() == "epoll") {
+        event_config_set_flag(cfg, EVENT_BASE_FLAG_EPOLL_USE_CHANGELIST);
     }
 
+    struct event_base *base = event_base_new_with_config(cfg);
+    event_config_free(cfg);
+    return base;
+}
+
+/*
+ * Set up a thread's information.
+ */
+static void setup_thread(LIBEVENT_THREAD *me) {
+    me->type = ThreadType::GENERAL;
+
+    me->base = create_worker_event_base();
     if (! me->base) {
         FATAL_ERROR(EXIT_FAILURE, "Can't allocate event base");
     }
 
+    if (me->index == 0 && settings.getEventBackend() == "epoll" &&
+        strcmp(event_base_get_method(me->base), "epoll") != 0) {
+        LOG_WARNING(NULL,
+                    "event_backend is set to \"epoll\" but the event "
+                    "library selected the \"%s\" method; running without "
+                    "batched event modification",
+                    event_base_get_method(me->base));
+    }
+
+    /* Set up the priority lanes (high / normal / low) used to service
+     * connections from high priority interfaces ahead of the bulk
+     * traffic. See libevent_priority() in connection_mcbp.cc for the
+     * mapping. */
+    if (event_base_priority_init(me->base, 3) == -1) {
+        FATAL_ERROR(EXIT_FAILURE, "Can't initialize event base priorities");
+    }
+
     /* Listen for notifications from other threads */
     if ((event_assign(&me->notify_event, me->base, me->notify[0],
                       EV_READ | EV_PERSIST,
@@ -202,15 +322,131 @@ static void setup_thread(LIBEVENT_THREAD *me) {
         FATAL_ERROR(EXIT_FAILURE, "Failed to allocate memory for connection queue");
     }
 
+    try {
+        me->timer_wheel = new ConnectionTimerWheel;
+    } catch (std::bad_alloc&) {
+        FATAL_ERROR(EXIT_FAILURE,
+                    "Failed to allocate memory for connection timer wheel");
+    }
+
+    try {
+        me->conn_registry = conn_registry_create();
+    } catch (std::bad_alloc&) {
+        FATAL_ERROR(EXIT_FAILURE,
+                    "Failed to allocate memory for connection registry");
+    }
+
     cb_mutex_initialize(&me->mutex);
 
     // Initialize threads' sub-document parser / handler
     me->subdoc_op = subdoc_op_alloc();
+}
 
-    try {
-        me->validator = new JSON_checker::Validator();
-    } catch (const std::bad_alloc&) {
-        FATAL_ERROR(EXIT_FAILURE, "Failed to allocate memory for JSON validator");
+/****************************** THREAD AFFINITY *****************************/
+
+#ifdef __linux__
+/* The NUMA node of each CPU (indexed by CPU number). Filled in by
+ * thread_init() when thread affinity is enabled so that
+ * dispatch_conn_new() doesn't have to touch sysfs for every new
+ * connection. */
+static std::vector<int> cpu_to_node;
+#endif
+
+#ifdef __linux__
+/*
+ * Look up the NUMA node a CPU belongs to. We use the physical package
+ * id as the node (one memory controller per socket on the boxes we
+ * care about). Returns -1 if the topology can't be determined.
+ */
+static int get_numa_node_of_cpu(int cpu) {
+    char fname[128];
+    int node = -1;
+    FILE* fp;
+
+    snprintf(fname, sizeof(fname),
+             "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+             cpu);
+    fp = fopen(fname, "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "%d", &node) != 1) {
+            node = -1;
+        }
+        fclose(fp);
+    }
+    return node;
+}
+#endif
+
+/*
+ * Pin the calling worker thread to a single CPU (round robin over the
+ * online CPUs) and remember which NUMA node that CPU belongs to so
+ * that dispatch_conn_new() may prefer node-local workers.
+ */
+static void setup_thread_affinity(LIBEVENT_THREAD *me) {
+#ifdef __linux__
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) {
+        return;
+    }
+
+    int cpu = me->index % static_cast<int>(ncpu);
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+        LOG_WARNING(NULL, "Failed to pin worker %d to CPU %d: %s",
+                    me->index, cpu, strerror(errno));
+        return;
+    }
+
+    me->numa_node = get_numa_node_of_cpu(cpu);
+    /* Read the NUMA-replicated lookup tables from this node's copy */
+    numa_replicas_set_local_node(me->numa_node);
+#else
+    if (me->index == 0) {
+        LOG_NOTICE(NULL,
+                   "thread_affinity is not supported on this platform");
+    }
+#endif
+}
+
+/**
+ * Run the worker's event loop in hybrid busy poll mode. After a
+ * blocking wait has dispatched something we keep polling the event
+ * base without blocking for up to 'window' nanoseconds, restarting
+ * the window every time a poll dispatches work. Only when a full
+ * window passes without any activity do we fall back to a blocking
+ * (epoll) wait, so an idle thread doesn't burn CPU forever but a
+ * busy one never pays the wakeup latency between back-to-back
+ * requests.
+ *
+ * The spinning is skipped entirely while the thread doesn't own any
+ * connection from an interface with busy polling enabled.
+ */
+static void worker_busy_poll_loop(LIBEVENT_THREAD *me, hrtime_t window) {
+    while (true) {
+        if (event_base_loop(me->base, EVLOOP_ONCE) != 0 ||
+            event_base_got_break(me->base)) {
+            return;
+        }
+
+        if (me->busy_poll_conns == 0) {
+            /* Nobody on this thread asked for low latency */
+            continue;
+        }
+
+        hrtime_t deadline = gethrtime() + window;
+        do {
+            const uint64_t before = me->event_dispatches;
+            if (event_base_loop(me->base, EVLOOP_NONBLOCK) != 0 ||
+                event_base_got_break(me->base)) {
+                return;
+            }
+            if (me->event_dispatches != before) {
+                /* We did some work; keep spinning */
+                deadline = gethrtime() + window;
+            }
+        } while (gethrtime() < deadline);
     }
 }
 
@@ -223,13 +459,33 @@ static void worker_libevent(void *arg) {
     /* Any per-thread setup can happen here; thread_init() will block until
      * all threads have finished initializing.
      */
+    if (settings.isThreadAffinity()) {
+        /* (thread_init() waits for all of the threads before returning,
+         * so the numa_node member is stable before anyone dispatches a
+         * connection) */
+        setup_thread_affinity(me);
+    }
 
     cb_mutex_enter(&init_lock);
     init_count++;
     cb_cond_signal(&init_cond);
     cb_mutex_exit(&init_lock);
 
-    event_base_loop(me->base, 0);
+    /* If any interface enables busy polling, drive the event base
+     * through the hybrid poll loop (the largest configured window
+     * wins if they differ); otherwise use plain blocking waits. */
+    int busy_poll_usec = 0;
+    for (const auto& ifc : settings.getInterfaces()) {
+        if (ifc.busy_poll_usec > busy_poll_usec) {
+            busy_poll_usec = ifc.busy_poll_usec;
+        }
+    }
+
+    if (busy_poll_usec > 0) {
+        worker_busy_poll_loop(me, hrtime_t(busy_poll_usec) * 1000);
+    } else {
+        event_base_loop(me->base, 0);
+    }
 
     // Event loop exited; cleanup before thread exits.
     ERR_remove_state(0);
@@ -245,9 +501,25 @@ static int number_of_pending(Connection *c, Connection *list) {
     return rv;
 }
 
-static void drain_notification_channel(evutil_socket_t fd)
+static void drain_notification_channel(LIBEVENT_THREAD *me, evutil_socket_t fd)
 {
     int nread;
+
+#ifdef HAVE_EVENTFD
+    if (me->notify_is_eventfd) {
+        /* The eventfd collapses all pending notifications into its
+           counter; one read consumes them all. EAGAIN just means the
+           counter was already drained. */
+        uint64_t count;
+        if (read(fd, &count, sizeof(count)) == -1 &&
+            !is_blocking(GetLastNetworkError())) {
+            log_socket_error(EXTENSION_LOG_WARNING, NULL,
+                             "Can't read from eventfd: %s");
+        }
+        return;
+    }
+#endif
+
     while ((nread = recv(fd, devnull, sizeof(devnull), 0)) == (int)sizeof(devnull)) {
         /* empty */
     }
@@ -258,23 +530,269 @@ static void drain_notification_channel(evutil_socket_t fd)
     }
 }
 
+/**
+ * Stop accepting clients on the sharded (SO_REUSEPORT) listeners owned
+ * by this thread, if any. May only be called from the owning thread as
+ * it touches the libevent registration.
+ */
+static void disable_thread_listeners(LIBEVENT_THREAD* me) {
+    for (Connection* c = me->listen_conn; c != nullptr; c = c->getNext()) {
+        static_cast<ListenConnection*>(c)->disable();
+    }
+}
+
+/**
+ * (Re-)enable accepting clients on the sharded listeners owned by this
+ * thread; a no-op for listeners which are already registered.
+ */
+static void enable_thread_listeners(LIBEVENT_THREAD* me) {
+    for (Connection* c = me->listen_conn; c != nullptr; c = c->getNext()) {
+        static_cast<ListenConnection*>(c)->enable();
+    }
+}
+
+/*
+ * Final half of a connection migration; runs on the receiving thread.
+ * The previous owner has unregistered the connection from its event
+ * base and stopped touching it before posting it on our queue.
+ */
+static void complete_connection_migration(Connection* c, LIBEVENT_THREAD* me) {
+    auto* mcbp = dynamic_cast<McbpConnection*>(c);
+    cb_assert(mcbp != nullptr);
+
+    c->setThread(me);
+    me->timer_wheel->add(mcbp);
+    if (settings.getBusyPollUsec(c->getParentPort()) > 0) {
+        me->busy_poll_conns++;
+    }
+    if (!mcbp->migrateEventBase(me->base)) {
+        LOG_WARNING(c, "%u Failed to register migrated connection in "
+                    "libevent - closing", c->getId());
+        LOCK_THREAD(me);
+        c->initateShutdown();
+        run_event_loop(c, EV_WRITE);
+        UNLOCK_THREAD(me);
+    }
+}
+
 void dispatch_new_connections(LIBEVENT_THREAD* me) {
-    std::unique_ptr<ConnectionQueueItem> item;
-    while ((item = me->new_conn_queue->pop()) != nullptr) {
-        Connection* c = nullptr;
-        if (item->sfd == fileno(stdin)) {
-            c = conn_pipe_new(item->sfd, me->base, me);
+    ConnectionQueueItem* item = me->new_conn_queue->takeAll();
+    while (item != nullptr) {
+        ConnectionQueueItem* next = item->next;
+        me->new_conn_total++;
+        if (item->migrating != nullptr) {
+            complete_connection_migration(item->migrating, me);
         } else {
-            c = conn_new(item->sfd, item->parent_port, me->base, me);
+            Connection* c = nullptr;
+            if (item->sfd == fileno(stdin)) {
+                c = conn_pipe_new(item->sfd, me->base, me);
+            } else {
+                c = conn_new(item->sfd, item->parent_port, me->base, me);
+            }
+            if (c == nullptr) {
+                LOG_WARNING(nullptr, "Failed to dispatch event for socket %ld",
+                            long(item->sfd));
+                safe_close(item->sfd);
+            }
         }
-        if (c == nullptr) {
-            LOG_WARNING(nullptr, "Failed to dispatch event for socket %ld",
-                        long(item->sfd));
-            safe_close(item->sfd);
+        delete item;
+        item = next;
+    }
+}
+
+/*
+ * Advance the thread's timer wheel and disconnect the clients which
+ * have been idle for longer than "connection_idle_time". Cheap when
+ * nothing is due (the wheel only looks at one slot per elapsed
+ * second), so it is run from every notification; the clock handler in
+ * mc_time.cc guarantees (at least) one notification a second. The
+ * caller must hold the thread lock.
+ */
+static void sweep_timer_wheel(LIBEVENT_THREAD *me) {
+    std::vector<McbpConnection*> expired;
+    me->timer_wheel->tick(mc_time_get_current_time(), expired);
+
+    for (auto* c : expired) {
+        LOG_NOTICE(c, "%u: Shutting down idle client %s", c->getId(),
+                   c->getDescription().c_str());
+        c->initateShutdown();
+        run_event_loop(c, EV_WRITE);
+    }
+}
+
+/*
+ * Disconnect the thread's best shed victim (unauthenticated before
+ * authenticated, longest idle first) to free up a connection slot for
+ * a new client. Runs when the accept path has flagged the thread
+ * because the connection count ate into the configured headroom. One
+ * victim per notification is enough: the accept path re-flags the
+ * workers for as long as the server stays short on slots. The caller
+ * must hold the thread lock.
+ */
+static void shed_idle_connection(LIBEVENT_THREAD *me) {
+    McbpConnection* victim = me->timer_wheel->findShedVictim();
+    if (victim == nullptr) {
+        return;
+    }
+
+    LOG_NOTICE(victim, "%u: Shedding idle client %s to make room for new "
+               "connections", victim->getId(),
+               victim->getDescription().c_str());
+    stats.shed_conns++;
+    victim->initateShutdown();
+    run_event_loop(victim, EV_WRITE);
+}
+
+/*
+ * Drive an ioctl-initiated drain for the thread's connections. Idle
+ * clients are prodded (made writable) so they run their state machine
+ * and pick the drain up at their command boundary - completing any
+ * in-flight command and flushing its response first. Once the drain
+ * deadline has passed, whatever is left is shut down regardless of
+ * state. Runs from every notification while draining; the clock
+ * handler guarantees one a second. The caller must hold the thread
+ * lock.
+ */
+static void drain_thread_connections(LIBEVENT_THREAD *me) {
+    if (mc_time_get_current_time() > get_drain_deadline()) {
+        std::vector<McbpConnection*> conns;
+        me->timer_wheel->snapshot(conns);
+        for (auto* c : conns) {
+            if (c->isAdmin()) {
+                continue;
+            }
+            LOG_NOTICE(c, "%u: Drain deadline passed; disconnecting %s",
+                       c->getId(), c->getDescription().c_str());
+            c->initateShutdown();
+            run_event_loop(c, EV_WRITE);
         }
+    } else {
+        signal_idle_clients(me, -1, false);
     }
 }
 
+/**
+ * Drive one connection from the pending io queue: (re)register it in
+ * libevent if needed and let the state machine run a single event so
+ * the correct mask ends up registered (we don't want the thread to
+ * keep on serving all of the connection's data from the context of
+ * the notification pipe).
+ */
+static void run_pending_connection(Connection* c) {
+    auto *mcbp = dynamic_cast<McbpConnection*>(c);
+    if (mcbp != nullptr) {
+        if (c->getSocketDescriptor() != INVALID_SOCKET &&
+            !mcbp->isRegisteredInLibevent()) {
+            /* The socket may have been shut down while we're looping */
+            /* in delayed shutdown */
+            mcbp->registerEvent();
+        }
+        mcbp->setNumEvents(1);
+    }
+    run_event_loop(c, EV_READ|EV_WRITE);
+}
+
+/**
+ * Drain the pending io queue. With scheduler_quantum_us set the queue
+ * is served bucket by bucket in a deficit round-robin: the drained
+ * connections are grouped by the bucket they're associated with
+ * (keeping the arrival order within each group) and every bucket may
+ * consume one quantum of worker time per drain. A bucket whose group
+ * outlives its quantum has the remainder pushed back onto the queue
+ * and the thread renotified, so a tenant flooding its pipelines
+ * delays its own commands rather than every connection on the
+ * worker. The time consumed and the deferrals are charged to the
+ * bucket for "stats scheduler". With the quantum set to 0 the queue
+ * is served in plain FIFO order.
+ *
+ * The caller must hold the thread lock. Returns the number of
+ * connections served.
+ */
+static uint64_t drain_pending_io(LIBEVENT_THREAD *me) {
+    Connection* pending = me->pending_io;
+    me->pending_io = NULL;
+    uint64_t drained = 0;
+
+    const uint64_t quantum_ns =
+        uint64_t(settings.getSchedulerQuantumUs()) * 1000;
+    if (quantum_ns == 0) {
+        while (pending != NULL) {
+            Connection *c = pending;
+            drained++;
+            cb_assert(me == c->getThread());
+            pending = pending->getNext();
+            c->setNext(nullptr);
+            run_pending_connection(c);
+        }
+        return drained;
+    }
+
+    /* Group the queue by bucket, preserving the FIFO order within
+     * each group. The number of distinct buckets in one drain is
+     * small, so a linear scan beats a map here. */
+    struct SchedGroup {
+        size_t bucket;
+        Connection* head;
+        Connection* tail;
+    };
+    std::vector<SchedGroup> groups;
+
+    while (pending != NULL) {
+        Connection *c = pending;
+        cb_assert(me == c->getThread());
+        pending = pending->getNext();
+        c->setNext(nullptr);
+
+        const size_t bucket = size_t(c->getBucketIndex());
+        SchedGroup* group = nullptr;
+        for (auto& gr : groups) {
+            if (gr.bucket == bucket) {
+                group = &gr;
+                break;
+            }
+        }
+        if (group == nullptr) {
+            groups.push_back({bucket, c, c});
+        } else {
+            group->tail->setNext(c);
+            group->tail = c;
+        }
+    }
+
+    for (auto& group : groups) {
+        uint64_t deficit = quantum_ns;
+        Connection* c = group.head;
+
+        while (c != nullptr && deficit > 0) {
+            Connection* next = c->getNext();
+            c->setNext(nullptr);
+
+            const hrtime_t start = gethrtime();
+            run_pending_connection(c);
+            const uint64_t spent = uint64_t(gethrtime() - start);
+
+            all_buckets[group.bucket].sched_ns += spent;
+            deficit -= (spent < deficit) ? spent : deficit;
+            drained++;
+            c = next;
+        }
+
+        if (c != nullptr) {
+            /* Quantum exhausted. Push the remainder (which is still
+             * linked through to group.tail) back onto the queue - it
+             * was empty when we took it, but the connections we just
+             * served may have repopulated it - and make sure another
+             * notification arrives to serve it. */
+            all_buckets[group.bucket].sched_deferrals++;
+            group.tail->setNext(me->pending_io);
+            me->pending_io = c;
+            notify_thread(me);
+        }
+    }
+
+    return drained;
+}
+
 /*
  * Processes an incoming "handle a new connection" item. This is called when
  * input arrives on the libevent wakeup pipe.
@@ -283,12 +801,15 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
     LIBEVENT_THREAD* me = reinterpret_cast<LIBEVENT_THREAD*>(arg);
 
     cb_assert(me->type == ThreadType::GENERAL);
+    me->event_dispatches++;
+    me->loop_iterations++;
+    const hrtime_t loop_start = gethrtime();
     // Start by draining the notification channel before doing any work.
     // By doing so we know that we'll be notified again if someone
     // tries to notify us while we're doing the work below (so we don't have
     // to care about race conditions for stuff people try to notify us
     // about.
-    drain_notification_channel(fd);
+    drain_notification_channel(me, fd);
 
     if (memcached_shutdown) {
         // Someone requested memcached to shut down. The listen thread should
@@ -299,41 +820,46 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
             return;
         }
 
+        // Stop accepting new clients on this thread's sharded listeners
+        // (if any) while we wait for the connected clients to go away.
+        disable_thread_listeners(me);
+
         if (signal_idle_clients(me, -1, false) == 0) {
             LOG_NOTICE(NULL, "Stopping worker thread %u", me->index);
             event_base_loopbreak(me->base);
             return;
         }
+    } else if (is_draining()) {
+        // Don't accept new clients while the server is draining for a
+        // restart.
+        disable_thread_listeners(me);
+    } else {
+        // Re-enable any sharded listener which got disabled (e.g. by
+        // running out of file descriptors); deferring the enable until
+        // the next notification avoids busy-looping on accept() while
+        // the system is still out of sockets.
+        enable_thread_listeners(me);
     }
 
     dispatch_new_connections(me);
 
     LOCK_THREAD(me);
-    Connection* pending = me->pending_io;
-    me->pending_io = NULL;
-    while (pending != NULL) {
-        Connection *c = pending;
-        cb_assert(me == c->getThread());
-        pending = pending->getNext();
-        c->setNext(nullptr);
+    const uint64_t drained = drain_pending_io(me);
 
-        auto *mcbp = dynamic_cast<McbpConnection*>(c);
-        if (mcbp != nullptr) {
-            if (c->getSocketDescriptor() != INVALID_SOCKET &&
-                !mcbp->isRegisteredInLibevent()) {
-                /* The socket may have been shut down while we're looping */
-                /* in delayed shutdown */
-                mcbp->registerEvent();
-            }
+    me->pending_io_total += drained;
+    if (drained > me->pending_io_max) {
+        me->pending_io_max = drained;
+    }
 
-            /*
-             * We don't want the thread to keep on serving all of the data
-             * from the context of the notification pipe, so just let it
-             * run one time to set up the correct mask in libevent
-             */
-            mcbp->setNumEvents(1);
-        }
-        run_event_loop(c, EV_READ|EV_WRITE);
+    sweep_timer_wheel(me);
+
+    if (me->shed_request) {
+        me->shed_request = false;
+        shed_idle_connection(me);
+    }
+
+    if (is_draining() && !memcached_shutdown) {
+        drain_thread_connections(me);
     }
 
     /*
@@ -359,6 +885,17 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
     }
 
     UNLOCK_THREAD(me);
+
+    /* While this callback runs nothing else on the loop is served;
+     * a slow iteration is exactly the starvation we want to spot */
+    const uint64_t elapsed = uint64_t(gethrtime() - loop_start);
+    me->loop_ns_total += elapsed;
+    if (elapsed > me->loop_ns_max) {
+        me->loop_ns_max = elapsed;
+    }
+    if (elapsed > 10000000) { /* 10ms */
+        me->loop_slow++;
+    }
 }
 
 extern volatile rel_time_t current_time;
@@ -445,6 +982,11 @@ void notify_io_complete(const void *void_cookie, ENGINE_ERROR_CODE status)
         LOG_DEBUG(NULL, "Got notify from %u, status 0x%x",
                   connection->getId(), status);
 
+        /* The replay gate has to run before the thread lock is taken;
+         * a notification waiting for its turn must not block the
+         * dispatch the trace wants to run first. */
+        sched_trace_notify_io(connection->getId());
+
         LOCK_THREAD(thr);
         reinterpret_cast<McbpConnection*>(connection)->setAiostat(status);
         notify = add_conn_to_pending_io_list(connection);
@@ -459,6 +1001,88 @@ void notify_io_complete(const void *void_cookie, ENGINE_ERROR_CODE status)
     }
 }
 
+void notify_io_complete_batch(const void* const* void_cookies, size_t count,
+                              ENGINE_ERROR_CODE status)
+{
+    if (void_cookies == nullptr) {
+        throw std::logic_error(
+            "notify_io_complete_batch: can't be called without cookies");
+    }
+
+    /*
+     * Resolve every cookie to its owning worker up front so that each
+     * thread mutex is taken exactly once for the whole batch. A disk
+     * fetch or flush burst used to fire thousands of individual
+     * notifications, each paying for a mutex acquisition and a wakeup
+     * write; grouping them reduces that to one of each per worker.
+     */
+    std::vector<Connection*> connections(count);
+    std::vector<bool> has_work(nthreads, false);
+
+    for (size_t ii = 0; ii < count; ++ii) {
+        auto* cookie = reinterpret_cast<const Cookie*>(void_cookies[ii]);
+        if (cookie == nullptr) {
+            throw std::logic_error(
+                "notify_io_complete_batch: can't be called without cookie");
+        }
+        cookie->validate();
+
+        if (cookie->command != nullptr) {
+            throw std::runtime_error(
+                "notify_io_complete_batch: not implemented for Commands");
+        }
+
+        Connection* connection = cookie->connection;
+        if (connection == nullptr) {
+            throw std::logic_error(
+                "notify_io_complete_batch: can't be called with command and "
+                    "connection set to null");
+        }
+
+        LIBEVENT_THREAD* thr = connection->getThread();
+        if (thr == nullptr) {
+            throw std::runtime_error(
+                "notify_io_complete_batch: connection should be bound to a "
+                    "thread");
+        }
+
+        /* Trace each notification of the batch individually; the
+         * batching is a delivery optimization, not a scheduling
+         * decision the replay should preserve. */
+        sched_trace_notify_io(connection->getId());
+
+        connections[ii] = connection;
+        has_work[thr->index] = true;
+    }
+
+    for (int tid = 0; tid < nthreads; ++tid) {
+        if (!has_work[tid]) {
+            continue;
+        }
+
+        LIBEVENT_THREAD* thr = &threads[tid];
+        int notify = 0;
+
+        LOCK_THREAD(thr);
+        for (size_t ii = 0; ii < count; ++ii) {
+            Connection* connection = connections[ii];
+            if (connection->getThread() != thr) {
+                continue;
+            }
+            LOG_DEBUG(NULL, "Got notify from %u, status 0x%x",
+                      connection->getId(), status);
+            reinterpret_cast<McbpConnection*>(connection)->setAiostat(status);
+            notify |= add_conn_to_pending_io_list(connection);
+        }
+        UNLOCK_THREAD(thr);
+
+        /* kick the thread in the butt */
+        if (notify) {
+            notify_thread(thr);
+        }
+    }
+}
+
 /* Which thread we assigned a connection to most recently. */
 static int last_thread = -1;
 
@@ -468,6 +1092,36 @@ static int last_thread = -1;
  */
 void dispatch_conn_new(SOCKET sfd, int parent_port) {
     int tid = (last_thread + 1) % settings.getNumWorkerThreads();
+
+#if defined(__linux__) && defined(SO_INCOMING_CPU)
+    if (settings.isThreadAffinity()) {
+        /* Try to hand the connection to a worker on the same NUMA node
+         * as the CPU which received it, so that the connection's
+         * buffers stay local to the NIC queue feeding it. The round
+         * robin counter is kept as the starting point of the search so
+         * the load still spreads over the node-local workers. */
+        int cpu = 0;
+        socklen_t len = sizeof(cpu);
+        if (getsockopt(sfd, SOL_SOCKET, SO_INCOMING_CPU,
+                       &cpu, &len) == 0 &&
+            cpu >= 0 && size_t(cpu) < cpu_to_node.size() &&
+            cpu_to_node[cpu] != -1) {
+            const int node = cpu_to_node[cpu];
+            for (int ii = 0; ii < settings.getNumWorkerThreads(); ++ii) {
+                const int candidate =
+                    (tid + ii) % settings.getNumWorkerThreads();
+                if (threads[candidate].numa_node == node) {
+                    tid = candidate;
+                    break;
+                }
+            }
+            if (threads[tid].numa_node != node) {
+                stats.cross_numa_dispatch++;
+            }
+        }
+    }
+#endif
+
     LIBEVENT_THREAD* thread = threads + tid;
     last_thread = tid;
 
@@ -487,6 +1141,83 @@ void dispatch_conn_new(SOCKET sfd, int parent_port) {
     notify_thread(thread);
 }
 
+/************************* CONNECTION REBALANCING ***************************/
+
+/* Only look for load skew after the owning thread has executed this
+ * many operations since the previous check; scanning the other workers
+ * doesn't belong on the per-event fast path. */
+static const uint64_t REBALANCE_CHECK_OPS = 1024;
+
+/* Don't migrate until the skew amounts to a meaningful number of
+ * operations (avoids churn right after startup). */
+static const uint64_t REBALANCE_MIN_SKEW = 8192;
+
+void maybe_migrate_connection(Connection* c) {
+    LIBEVENT_THREAD* thr = c->getThread();
+    if (thr == nullptr || thr->type != ThreadType::GENERAL ||
+        settings.getNumWorkerThreads() < 2 || memcached_shutdown) {
+        return;
+    }
+
+    if (thr->ops - thr->ops_last_check < REBALANCE_CHECK_OPS) {
+        return;
+    }
+    thr->ops_last_check = thr->ops;
+
+    /* Find the least loaded worker. The counters belong to the other
+     * threads and are read without locking; this is just a heuristic
+     * and a stale value only means we migrate a bit too early or too
+     * late. */
+    LIBEVENT_THREAD* target = thr;
+    for (int ii = 0; ii < settings.getNumWorkerThreads(); ++ii) {
+        if (threads[ii].ops < target->ops) {
+            target = &threads[ii];
+        }
+    }
+
+    if (target == thr || thr->ops < 2 * target->ops ||
+        (thr->ops - target->ops) < REBALANCE_MIN_SKEW) {
+        return;
+    }
+
+    /* The connection driving this check is the one hammering the
+     * thread, so it is the one we want to move (but only if it is
+     * completely quiescent right now). */
+    auto* mcbp = dynamic_cast<McbpConnection*>(c);
+    if (mcbp == nullptr || !mcbp->isMigratable()) {
+        return;
+    }
+
+    if (!mcbp->unregisterEvent()) {
+        return;
+    }
+
+    thr->timer_wheel->remove(mcbp);
+    if (settings.getBusyPollUsec(c->getParentPort()) > 0) {
+        thr->busy_poll_conns--;
+    }
+
+    LOG_INFO(c, "%u Migrating connection from worker %d to worker %d",
+             c->getId(), thr->index, target->index);
+
+    try {
+        std::unique_ptr<ConnectionQueueItem> item(new ConnectionQueueItem(c));
+        target->new_conn_queue->push(item);
+    } catch (std::bad_alloc&) {
+        /* Stay where we are; re-register and carry on */
+        mcbp->registerEvent();
+        thr->timer_wheel->add(mcbp);
+        if (settings.getBusyPollUsec(c->getParentPort()) > 0) {
+            thr->busy_poll_conns++;
+        }
+        return;
+    }
+
+    /* From this point on the connection belongs to the target thread */
+    stats.conn_migrations++;
+    notify_thread(target);
+}
+
 /*
  * Returns true if this is the thread that listens for new TCP connections.
  */
@@ -498,14 +1229,6 @@ void notify_dispatcher(void) {
     notify_thread(&dispatcher_thread);
 }
 
-/******************************* GLOBAL STATS ******************************/
-
-void threadlocal_stats_reset(struct thread_stats *thread_stats) {
-    for (int ii = 0; ii < settings.getNumWorkerThreads(); ++ii) {
-        thread_stats[ii].reset();
-    }
-}
-
 /*
  * Initializes the thread subsystem, creating various worker threads.
  *
@@ -534,14 +1257,44 @@ void thread_init(int nthr, struct event_base *main_base,
     setup_dispatcher(main_base, dispatcher_callback);
 
     for (i = 0; i < nthreads; i++) {
-        if (!create_notification_pipe(&threads[i])) {
-            FATAL_ERROR(EXIT_FAILURE, "Cannot create notification pipe");
+        if (!create_notification_channel(&threads[i])) {
+            FATAL_ERROR(EXIT_FAILURE, "Cannot create notification channel");
         }
         threads[i].index = i;
+        threads[i].numa_node = -1;
 
         setup_thread(&threads[i]);
     }
 
+#ifdef __linux__
+    if (settings.isThreadAffinity()) {
+        /* Build the CPU -> NUMA node map used when dispatching new
+         * connections (doing it up front keeps sysfs out of the
+         * dispatch path) */
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < ncpu; ++cpu) {
+            cpu_to_node.push_back(get_numa_node_of_cpu(int(cpu)));
+        }
+
+        /* Tell the table replication how many nodes to build copies
+         * for (see numa_replicas.h) */
+        int max_node = 0;
+        for (const auto node : cpu_to_node) {
+            if (node > max_node) {
+                max_node = node;
+            }
+        }
+        numa_replicas_set_node_count(size_t(max_node) + 1);
+    }
+#endif
+
+    /* Create the sharded (SO_REUSEPORT) listening sockets while it is
+     * still safe to register events on the worker bases; once the
+     * threads are running only the owning thread may do so. */
+    for (i = 0; i < nthreads; i++) {
+        create_worker_listen_sockets(&threads[i]);
+    }
+
     /* Create threads after we've done all the libevent setup. */
     for (i = 0; i < nthreads; i++) {
         std::string name = "mc:worker_" + std::to_string(i);
@@ -572,20 +1325,108 @@ void threads_cleanup(void)
     int ii;
     for (ii = 0; ii < nthreads; ++ii) {
         safe_close(threads[ii].notify[0]);
-        safe_close(threads[ii].notify[1]);
+        if (!threads[ii].notify_is_eventfd) {
+            safe_close(threads[ii].notify[1]);
+        }
+        /* The worker has stopped; unregister and free the events of its
+         * sharded listeners (if any) before their event base goes away.
+         * The connection objects themselves are torn down with the rest
+         * of the connections. */
+        for (Connection* lc = threads[ii].listen_conn; lc != nullptr;
+             lc = lc->getNext()) {
+            static_cast<ListenConnection*>(lc)->releaseEvent();
+        }
+
         event_base_free(threads[ii].base);
 
-        cb_free(threads[ii].read.buf);
-        cb_free(threads[ii].write.buf);
+        for (int jj = 0; jj < threads[ii].read.count; ++jj) {
+            cb_free(threads[ii].read.bufs[jj].buf);
+        }
+        for (int jj = 0; jj < threads[ii].write.count; ++jj) {
+            cb_free(threads[ii].write.bufs[jj].buf);
+        }
         subdoc_op_free(threads[ii].subdoc_op);
-        delete threads[ii].validator;
         delete threads[ii].new_conn_queue;
+        delete threads[ii].timer_wheel;
+        conn_registry_destroy(threads[ii].conn_registry);
     }
 
     cb_free(thread_ids);
     cb_free(threads);
 }
 
+void threads_notify_clock_tick(void)
+{
+    /* The clock event runs on the main thread; the wheels belong to
+     * the workers, so just wake each of them up and let them sweep
+     * their own wheel (sweep_timer_wheel). A no-op until thread_init()
+     * has run. */
+    for (int ii = 0; ii < nthreads; ++ii) {
+        notify_thread(&threads[ii]);
+    }
+}
+
+void threads_request_connection_shed(void)
+{
+    for (int ii = 0; ii < nthreads; ++ii) {
+        LIBEVENT_THREAD* thr = &threads[ii];
+        LOCK_THREAD(thr);
+        thr->shed_request = true;
+        UNLOCK_THREAD(thr);
+        notify_thread(thr);
+    }
+}
+
+void threads_worker_stats(ADD_STAT add_stat_callback, const void *cookie)
+{
+    for (int ii = 0; ii < nthreads; ++ii) {
+        LIBEVENT_THREAD *thr = threads + ii;
+
+        /* Snapshot of the connections currently waiting for the
+         * thread to pick up their async io completion */
+        uint64_t pending_now = 0;
+        LOCK_THREAD(thr);
+        for (Connection *c = thr->pending_io; c != NULL; c = c->getNext()) {
+            pending_now++;
+        }
+        UNLOCK_THREAD(thr);
+
+        const struct {
+            const char *name;
+            uint64_t value;
+        } entries[] = {
+            { "ops", thr->ops },
+            { "loop_iterations", thr->loop_iterations },
+            { "loop_ns_avg", thr->loop_iterations == 0 ? 0 :
+                             thr->loop_ns_total / thr->loop_iterations },
+            { "loop_ns_max", thr->loop_ns_max },
+            { "loop_slow", thr->loop_slow },
+            { "new_conns", thr->new_conn_total },
+            { "pending_io", thr->pending_io_total },
+            { "pending_io_max", thr->pending_io_max },
+            { "pending_io_now", pending_now }
+        };
+
+        for (const auto &entry : entries) {
+            char key[64];
+            char val[32];
+            int klen = snprintf(key, sizeof(key), "%d:%s", ii, entry.name);
+            int vlen = snprintf(val, sizeof(val), "%" PRIu64, entry.value);
+            add_stat_callback(key, uint16_t(klen), val, uint32_t(vlen),
+                              cookie);
+        }
+    }
+}
+
+size_t threads_get_thread_ids(cb_thread_t *ids, size_t max)
+{
+    size_t num = size_t(nthreads) < max ? size_t(nthreads) : max;
+    for (size_t ii = 0; ii < num; ++ii) {
+        ids[ii] = threads[ii].thread_id;
+    }
+    return num;
+}
+
 void threads_notify_bucket_deletion(void)
 {
     for (int ii = 0; ii < nthreads; ++ii) {
@@ -615,6 +1456,19 @@ void threads_initiate_bucket_deletion(void)
 }
 
 void notify_thread(LIBEVENT_THREAD *thread) {
+#ifdef HAVE_EVENTFD
+    if (thread->notify_is_eventfd) {
+        uint64_t one = 1;
+        /* EAGAIN means the counter is saturated; a wakeup is already
+           guaranteed so there is nothing more to do. */
+        if (write(thread->notify[1], &one, sizeof(one)) != sizeof(one) &&
+                !is_blocking(GetLastNetworkError())) {
+            log_socket_error(EXTENSION_LOG_WARNING, NULL,
+                             "Failed to notify thread: %s");
+        }
+        return;
+    }
+#endif
     if (send(thread->notify[1], "", 1, 0) != 1 &&
             !is_blocking(GetLastNetworkError())) {
         log_socket_error(EXTENSION_LOG_WARNING, NULL,
@@ -0,0 +1,139 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "timer_wheel.h"
+#include "connection_mcbp.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+ConnectionTimerWheel::ConnectionTimerWheel()
+    : slots(NumSlots),
+      last_tick(0) {
+    // empty
+}
+
+void ConnectionTimerWheel::add(McbpConnection* c) {
+    if (c->getTimerWheelSlot() != -1) {
+        throw std::logic_error("ConnectionTimerWheel::add: connection is "
+                                   "already enlisted in the wheel");
+    }
+
+    /* Exempt connections (deadline 0) are parked in the current slot;
+       they'll be revisited (and kept) once per revolution. */
+    const rel_time_t deadline = c->getIdleDeadline();
+    const size_t slot = (deadline != 0 ? deadline : last_tick) % NumSlots;
+    slots[slot].push_back(c);
+    c->setTimerWheelSlot(int(slot));
+}
+
+void ConnectionTimerWheel::remove(McbpConnection* c) {
+    const int slot = c->getTimerWheelSlot();
+    if (slot == -1) {
+        return;
+    }
+
+    auto& bucket = slots[slot];
+    auto iter = std::find(bucket.begin(), bucket.end(), c);
+    cb_assert(iter != bucket.end());
+    /* order within a slot doesn't matter; swap with the last element
+       to get constant time removal */
+    *iter = bucket.back();
+    bucket.pop_back();
+    c->setTimerWheelSlot(-1);
+}
+
+McbpConnection* ConnectionTimerWheel::findShedVictim() const {
+    McbpConnection* victim = nullptr;
+
+    for (const auto& bucket : slots) {
+        for (auto* c : bucket) {
+            if (!c->isSheddable()) {
+                continue;
+            }
+            if (victim == nullptr) {
+                victim = c;
+                continue;
+            }
+
+            const bool c_auth = c->isAuthenticated();
+            if (c_auth != victim->isAuthenticated()) {
+                /* A client which never authenticated is holding a slot
+                   without being entitled to do anything with it; those
+                   go first. */
+                if (!c_auth) {
+                    victim = c;
+                }
+            } else if (c->getLastActivity() < victim->getLastActivity()) {
+                victim = c;
+            }
+        }
+    }
+
+    return victim;
+}
+
+void ConnectionTimerWheel::snapshot(std::vector<McbpConnection*>& conns) const {
+    for (const auto& bucket : slots) {
+        conns.insert(conns.end(), bucket.begin(), bucket.end());
+    }
+}
+
+void ConnectionTimerWheel::tick(rel_time_t now,
+                                std::vector<McbpConnection*>& expired) {
+    if (now > last_tick + rel_time_t(NumSlots)) {
+        /* More than a full revolution behind (startup, or the process
+           was stopped in a debugger); every slot is due, so start a
+           fresh lap rather than spinning through the gap. */
+        last_tick = now - rel_time_t(NumSlots);
+    }
+
+    while (last_tick < now) {
+        ++last_tick;
+        auto& bucket = slots[last_tick % NumSlots];
+
+        size_t ii = 0;
+        while (ii < bucket.size()) {
+            McbpConnection* c = bucket[ii];
+            const rel_time_t deadline = c->getIdleDeadline();
+
+            if (deadline == 0) {
+                /* Exempt (admin/DCP/TAP, timeouts disabled, or blocked
+                   on an engine operation); look again next lap. */
+                ++ii;
+            } else if (deadline > last_tick) {
+                /* Still alive; re-hash into the slot of its current
+                   deadline (unless that happens to be this one). */
+                const size_t slot = deadline % NumSlots;
+                if (slot == last_tick % NumSlots) {
+                    ++ii;
+                } else {
+                    bucket[ii] = bucket.back();
+                    bucket.pop_back();
+                    slots[slot].push_back(c);
+                    c->setTimerWheelSlot(int(slot));
+                }
+            } else {
+                /* Timed out; hand it to the caller. */
+                bucket[ii] = bucket.back();
+                bucket.pop_back();
+                c->setTimerWheelSlot(-1);
+                expired.push_back(c);
+            }
+        }
+    }
+}
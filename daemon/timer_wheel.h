@@ -0,0 +1,110 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <memcached/types.h>
+
+#include <vector>
+
+class McbpConnection;
+
+/**
+ * A hashed timer wheel driving the idle-connection timeouts for the
+ * connections owned by a single worker thread.
+ *
+ * Libevent keeps its timeouts in a binary heap, so arming (and
+ * re-arming) a timeout per connection gets expensive once we're
+ * serving a hundred thousand connections. With idle times measured in
+ * minutes we don't need that precision: the wheel hashes each
+ * connection into one of a fixed number of one-second slots by its
+ * deadline, and advancing the wheel one second only has to look at a
+ * single slot.
+ *
+ * Connections "touch" the wheel for free: they just record the time
+ * of their last command (see McbpConnection::setLastActivity) and
+ * stay in their slot. When the wheel reaches the slot it recomputes
+ * the deadline; a connection which has been active in the meantime is
+ * simply re-hashed into the slot its new deadline belongs to.
+ *
+ * The wheel is owned by (and must only be accessed from) the worker
+ * thread, just like the rest of the members of LIBEVENT_THREAD.
+ */
+class ConnectionTimerWheel {
+public:
+    ConnectionTimerWheel();
+
+    /**
+     * Enlist a connection in the wheel. Throws std::logic_error if the
+     * connection is already enlisted.
+     */
+    void add(McbpConnection* c);
+
+    /**
+     * Remove a connection from the wheel (a no-op if the connection
+     * isn't enlisted, so it is safe to call from the generic teardown
+     * path).
+     */
+    void remove(McbpConnection* c);
+
+    /**
+     * Advance the wheel up to the given time, sweeping every slot
+     * passed on the way. Connections whose idle deadline has passed
+     * are removed from the wheel and appended to 'expired'; the caller
+     * is responsible for shutting them down.
+     *
+     * @param now the current time (mc_time_get_current_time())
+     * @param expired where to return the timed out connections
+     */
+    void tick(rel_time_t now, std::vector<McbpConnection*>& expired);
+
+    /**
+     * Find the connection which should be disconnected to make room
+     * for new clients: the wheel holds every connection owned by the
+     * worker, so this is a plain scan over all slots picking the best
+     * victim (unauthenticated connections before authenticated ones,
+     * the longest-idle one within each group). Only run when the
+     * server is defending its connection headroom, so the O(n) walk is
+     * off the normal path.
+     *
+     * @return the victim, or nullptr if no connection may be shed
+     */
+    McbpConnection* findShedVictim() const;
+
+    /**
+     * Copy every enlisted connection into 'conns'. Used by the drain
+     * logic to shut the remaining connections down once the drain
+     * deadline has passed.
+     */
+    void snapshot(std::vector<McbpConnection*>& conns) const;
+
+private:
+    /**
+     * The number of slots in the wheel. The span of the wheel doesn't
+     * limit the idle time (a connection whose deadline is further out
+     * than a full revolution is just looked at - and kept - once per
+     * lap); it only has to be big enough to spread the connections
+     * thin over the slots.
+     */
+    static const size_t NumSlots = 512;
+
+    /** The slots; slot n holds the connections with deadline % NumSlots
+        == n (and the exempt connections parked wherever they were) */
+    std::vector<std::vector<McbpConnection*> > slots;
+
+    /** The last second the wheel was advanced to */
+    rel_time_t last_tick;
+};
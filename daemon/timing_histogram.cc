@@ -44,6 +44,12 @@ static void fetch_add(T& dst, const T& src) {
                   std::memory_order_relaxed);
 }
 
+template <typename T>
+static void fetch_sub(T& dst, const T& src) {
+    dst.fetch_sub(src.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+}
+
 /**
  * This isn't completely accurate, but it's only called whenever we're
  * grabbing the stats. We don't want to create a lock in order to make
@@ -107,6 +113,34 @@ TimingHistogram& TimingHistogram::operator+=(const TimingHistogram& other) {
     return *this;
 }
 
+/**
+ * As per operator+= this isn't completely accurate/consistent; it is
+ * only used on snapshot copies when generating the delta output.
+ */
+TimingHistogram& TimingHistogram::operator-=(const TimingHistogram& other) {
+    fetch_sub(ns, other.ns);
+
+    for (size_t idx = 0; idx < usec.size(); ++idx) {
+        fetch_sub(usec[idx], other.usec[idx]);
+    }
+
+    for (size_t idx = 0; idx < msec.size(); ++idx) {
+        fetch_sub(msec[idx], other.msec[idx]);
+    }
+
+    for (size_t idx = 0; idx < halfsec.size(); ++idx) {
+        fetch_sub(halfsec[idx], other.halfsec[idx]);
+    }
+
+    for (size_t idx = 0; idx < wayout.size(); ++idx) {
+        fetch_sub(wayout[idx], other.wayout[idx]);
+    }
+
+    fetch_sub(total, other.total);
+
+    return *this;
+}
+
 void TimingHistogram::reset(void) {
     ns.store(0, std::memory_order_relaxed);
     for(auto& us: usec) {
@@ -39,6 +39,14 @@ public:
     TimingHistogram& operator=(const TimingHistogram &other);
     TimingHistogram& operator+=(const TimingHistogram& other);
 
+    /**
+     * Subtract another histogram from this one. The counters are
+     * monotonically increasing, so subtracting an earlier snapshot
+     * of the same histogram yields the samples recorded in between
+     * (used by the delta mode of CMD_GET_CMD_TIMER).
+     */
+    TimingHistogram& operator-=(const TimingHistogram& other);
+
     void reset(void);
     void add(const hrtime_t nsec);
     std::string to_string(void);
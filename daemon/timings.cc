@@ -17,24 +17,172 @@
 #include "timings.h"
 #include <memcached/protocol_binary.h>
 #include <platform/platform.h>
+#include "settings.h"
 #include "timing_histogram.h"
 
+Timings::Shard::Shard() {
+    for (auto& hist : hdr) {
+        hist.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+Timings::Shard::~Shard() {
+    for (auto& hist : hdr) {
+        delete hist.load(std::memory_order_relaxed);
+    }
+}
+
 Timings::Timings() {
+    for (auto& shard : shards) {
+        shard.store(nullptr, std::memory_order_relaxed);
+    }
     reset();
 }
 
+Timings::~Timings() {
+    for (auto& shard : shards) {
+        delete shard.load(std::memory_order_relaxed);
+    }
+}
+
+Timings& Timings::operator=(const Timings& other) {
+    // Collapse the other side's base histograms and shards into our
+    // base histograms. As for TimingHistogram::operator= this is only
+    // used for snapshot purposes and doesn't have to be 100% accurate.
+    for (size_t ii = 0; ii < MAX_NUM_OPCODES; ++ii) {
+        timings[ii] = other.timings[ii];
+    }
+
+    for (auto& slot : other.shards) {
+        auto* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            for (size_t ii = 0; ii < MAX_NUM_OPCODES; ++ii) {
+                timings[ii] += shard->timings[ii];
+            }
+        }
+    }
+
+    for (auto& slot : shards) {
+        auto* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            for (auto& hist : shard->timings) {
+                hist.reset();
+            }
+        }
+    }
+
+    return *this;
+}
+
 void Timings::reset(void) {
     for (int ii = 0; ii < MAX_NUM_OPCODES; ++ii) {
         timings[ii].reset();
     }
+
+    for (auto& slot : shards) {
+        auto* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            for (auto& hist : shard->timings) {
+                hist.reset();
+            }
+            for (auto& hist : shard->hdr) {
+                auto* hdr = hist.load(std::memory_order_acquire);
+                if (hdr != nullptr) {
+                    hdr->reset();
+                }
+            }
+        }
+    }
 }
 
-void Timings::collect(const uint8_t opcode, const hrtime_t nsec) {
-    timings[opcode].add(nsec);
+Timings::Shard* Timings::getShard(const size_t index) {
+    auto& slot = shards[index % MAX_SHARDS];
+    Shard* shard = slot.load(std::memory_order_acquire);
+    if (shard == nullptr) {
+        auto* created = new Shard;
+        if (slot.compare_exchange_strong(shard, created,
+                                         std::memory_order_acq_rel)) {
+            shard = created;
+        } else {
+            // Another worker sharing the slot won the race
+            delete created;
+        }
+    }
+    return shard;
+}
+
+HdrHistogram* Timings::getHdr(Shard& shard, const uint8_t opcode) {
+    auto& slot = shard.hdr[opcode];
+    HdrHistogram* hist = slot.load(std::memory_order_acquire);
+    if (hist == nullptr) {
+        auto* created = new HdrHistogram(settings.getTimingsPrecision());
+        if (slot.compare_exchange_strong(hist, created,
+                                         std::memory_order_acq_rel)) {
+            hist = created;
+        } else {
+            // Another worker sharing the shard won the race
+            delete created;
+        }
+    }
+    return hist;
+}
+
+void Timings::collect(const uint8_t opcode, const hrtime_t nsec,
+                      const size_t shard) {
+    auto* s = getShard(shard);
+    s->timings[opcode].add(nsec);
+    getHdr(*s, opcode)->add(nsec);
+}
+
+TimingHistogram Timings::aggregate(const uint8_t opcode) {
+    TimingHistogram ret(timings[opcode]);
+    for (auto& slot : shards) {
+        auto* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            ret += shard->timings[opcode];
+        }
+    }
+    return ret;
+}
+
+uint64_t Timings::get_total(const uint8_t opcode) {
+    uint64_t ret = timings[opcode].get_total();
+    for (auto& slot : shards) {
+        auto* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            ret += shard->timings[opcode].get_total();
+        }
+    }
+    return ret;
 }
 
 std::string Timings::generate(const uint8_t opcode) {
-    return timings[opcode].to_string();
+    TimingHistogram merged = aggregate(opcode);
+    return merged.to_string();
+}
+
+TimingHistogram Timings::get_timing_histogram(const uint8_t opcode) {
+    return aggregate(opcode);
+}
+
+std::string Timings::generate_percentiles(const uint8_t opcode) {
+    HdrHistogram merged(settings.getTimingsPrecision());
+
+    for (auto& slot : shards) {
+        auto* shard = slot.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+            auto* hdr = shard->hdr[opcode].load(std::memory_order_acquire);
+            if (hdr != nullptr) {
+                merged += *hdr;
+            }
+        }
+    }
+
+    if (merged.get_total() == 0) {
+        return "";
+    }
+
+    return merged.to_string();
 }
 
 uint64_t Timings::get_aggregated_mutation_stats() {
@@ -62,7 +210,7 @@ uint64_t Timings::get_aggregated_mutation_stats() {
 
     uint64_t ret = 0;
     for (auto cmd : mutations) {
-        ret += timings[cmd].get_total();
+        ret += get_total(cmd);
     }
     return ret;
 }
@@ -82,7 +230,7 @@ uint64_t Timings::get_aggregated_retrival_stats() {
 
     uint64_t ret = 0;
     for (auto cmd : retrival) {
-        ret += timings[cmd].get_total();
+        ret += get_total(cmd);
     }
     return ret;
 }
@@ -18,24 +18,115 @@
 
 #include <platform/platform.h>
 #include <array>
+#include <atomic>
 #include <string>
 #include <cstdint>
+#include "hdr_histogram.h"
 #include "timing_histogram.h"
 
 #define MAX_NUM_OPCODES 0x100
 
 /** Records timings for each memcached opcode. Each opcode has a histogram of
  * times.
+ *
+ * Samples are recorded into per-worker shards (so the hot record path
+ * only touches cache lines owned by the calling thread) and the shards
+ * are merged when the timings are generated for the stats commands.
+ * Shards are allocated lazily on the first sample from a worker; with
+ * a histogram array per opcode they are too big to allocate up front
+ * for every bucket in all_buckets.
  */
 class Timings {
 public:
+    /**
+     * The maximum number of per-worker shards. Workers use their
+     * thread index (modulo this capacity, for the unlikely case of
+     * more workers than shards) to select a shard.
+     */
+    static const size_t MAX_SHARDS = 64;
+
     Timings(void);
+    ~Timings();
+    Timings& operator=(const Timings& other);
     void reset(void);
-    void collect(const uint8_t opcode, const hrtime_t nsec);
+
+    /**
+     * Record a timing sample
+     *
+     * @param opcode the opcode the sample belongs to
+     * @param nsec the duration of the operation
+     * @param shard the calling worker's thread index
+     */
+    void collect(const uint8_t opcode, const hrtime_t nsec,
+                 const size_t shard);
     std::string generate(const uint8_t opcode);
+
+    /**
+     * Generate the fine grained percentile JSON (see
+     * HdrHistogram::to_string) for an opcode, or an empty string if
+     * no samples have been recorded for it.
+     */
+    std::string generate_percentiles(const uint8_t opcode);
+
+    /**
+     * Get a snapshot of the merged (base plus all shards) histogram
+     * for an opcode (used by the delta mode of CMD_GET_CMD_TIMER to
+     * diff against the per-connection cursor).
+     */
+    TimingHistogram get_timing_histogram(const uint8_t opcode);
+
     uint64_t get_aggregated_mutation_stats();
     uint64_t get_aggregated_retrival_stats();
 
 private:
+    /**
+     * The histograms for a single worker thread. Each shard is a
+     * separate heap allocation so shards never share a cache line
+     * with one another (or with the base histograms below).
+     */
+    struct Shard {
+        Shard();
+        ~Shard();
+
+        std::array<TimingHistogram, MAX_NUM_OPCODES> timings;
+
+        /**
+         * The high dynamic range histograms backing the percentile
+         * stats. Allocated on the first sample for an opcode; most
+         * workloads only exercise a handful of opcodes and a full
+         * array per shard would waste a lot of memory.
+         */
+        std::array<std::atomic<HdrHistogram*>, MAX_NUM_OPCODES> hdr;
+    };
+
+    /**
+     * Get the high dynamic range histogram for an opcode within a
+     * shard, allocating it on the first sample.
+     */
+    HdrHistogram* getHdr(Shard& shard, const uint8_t opcode);
+
+    /**
+     * Get the shard for the given worker, allocating it on the
+     * first sample.
+     */
+    Shard* getShard(const size_t index);
+
+    /**
+     * Merge the base histogram and all shards for an opcode into a
+     * single histogram (used when generating stats).
+     */
+    TimingHistogram aggregate(const uint8_t opcode);
+
+    /** Get the total number of recorded samples for an opcode */
+    uint64_t get_total(const uint8_t opcode);
+
+    /**
+     * The base histograms. Samples are never recorded directly here
+     * anymore; it holds data merged from other Timings instances
+     * (see operator=).
+     */
     std::array<TimingHistogram, MAX_NUM_OPCODES> timings;
+
+    /** The lazily allocated per-worker shards */
+    std::array<std::atomic<Shard*>, MAX_SHARDS> shards;
 };
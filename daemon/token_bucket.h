@@ -0,0 +1,131 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <memcached/types.h>
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * A lock free token bucket guarding one resource of a bucket
+ * (operations or bandwidth). The limit is the number of tokens added
+ * per second, and also caps the balance (the burst). A limit of 0
+ * means unlimited.
+ *
+ * Consumption is debt based: the cost of a command (e.g. its byte
+ * count) isn't known up front, so completed commands debit what they
+ * actually used - possibly driving the balance negative - and the
+ * gate refuses new work until the per-second refills have paid the
+ * debt off. That keeps both the gate and the debit a single atomic
+ * operation on the hot path.
+ */
+class TokenBucket {
+public:
+    TokenBucket() : limit(0), tokens(0), last_refill(0) {
+    }
+
+    TokenBucket(const TokenBucket& other)
+        : limit(other.limit.load()),
+          tokens(other.tokens.load()),
+          last_refill(other.last_refill.load()) {
+    }
+
+    TokenBucket& operator=(const TokenBucket& other) {
+        limit.store(other.limit.load());
+        tokens.store(other.tokens.load());
+        last_refill.store(other.last_refill.load());
+        return *this;
+    }
+
+    /**
+     * Set the number of tokens added (and the max balance) per
+     * second. 0 disables the limit.
+     */
+    void setLimit(uint64_t lim) {
+        limit.store(lim);
+    }
+
+    uint64_t getLimit() const {
+        return limit.load();
+    }
+
+    /**
+     * May more work be admitted at the given time?
+     */
+    bool gate(rel_time_t now) {
+        if (limit.load(std::memory_order_relaxed) == 0) {
+            return true;
+        }
+        maybeRefill(now);
+        return tokens.load(std::memory_order_relaxed) > 0;
+    }
+
+    /**
+     * Debit tokens for completed work.
+     */
+    void debit(int64_t used) {
+        if (limit.load(std::memory_order_relaxed) != 0) {
+            tokens.fetch_sub(used, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Drop the limit and forgive any accumulated debt (used when a
+     * bucket slot is recycled).
+     */
+    void reset() {
+        limit.store(0);
+        tokens.store(0);
+        last_refill.store(0);
+    }
+
+private:
+    /**
+     * Top the balance up if the clock has ticked since the last
+     * refill. The loser of the CAS leaves the refill to the winner.
+     * The arithmetic isn't perfectly exact when racing the debits,
+     * but a token more or less doesn't matter for rate limiting.
+     */
+    void maybeRefill(rel_time_t now) {
+        rel_time_t prev = last_refill.load(std::memory_order_relaxed);
+        if (prev == now) {
+            return;
+        }
+        if (!last_refill.compare_exchange_strong(prev, now)) {
+            return;
+        }
+
+        const int64_t lim = int64_t(limit.load(std::memory_order_relaxed));
+        const int64_t elapsed = (now > prev) ? int64_t(now - prev) : 1;
+        int64_t balance = tokens.load(std::memory_order_relaxed);
+        balance += lim * elapsed;
+        if (balance > lim) {
+            balance = lim;
+        }
+        tokens.store(balance, std::memory_order_relaxed);
+    }
+
+    /** Tokens added per second (and the max balance). 0 = unlimited */
+    std::atomic<uint64_t> limit;
+
+    /** The current balance; negative while in debt */
+    std::atomic<int64_t> tokens;
+
+    /** The second the balance was last topped up */
+    std::atomic<rel_time_t> last_refill;
+};
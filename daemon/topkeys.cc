@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <unordered_map>
 #include <platform/platform.h>
 
 #include "topkeys.h"
@@ -85,16 +86,43 @@
  * least-recently-used element is selected as a 'victim' and it's
  * contents is replaced by the incoming key.  Finally the linked-list
  * is updated to move the updated element to the head of the list.
+ *
+ * === TopKeys::Sketch (sketch mode) ===
+ *
+ * In sketch mode the exact shards stay idle and every worker thread
+ * owns a private Sketch instead: a small count-min sketch (ROWS rows
+ * of WIDTH counters; an access increments one counter per row and the
+ * estimate for a key is the smallest of its counters) plus a table of
+ * up to max_keys candidate keys. The candidate table stores the key
+ * identity only - at stats time the candidates of all sketches are
+ * re-estimated against their sketch, merged by key and ranked. A key
+ * enters the table when its estimate exceeds the estimate of the
+ * cheapest current candidate (which it then evicts), i.e. the
+ * space-saving scheme with the counts outsourced to the sketch.
+ *
+ * As a sketch is only ever updated by its owning worker the counters
+ * don't need to be atomic and the common update is the ROWS
+ * increments plus a scan of the candidate hashes; the mutex only
+ * guards mutation of the candidate table (rare once the hot set has
+ * settled) and the stats collection.
  */
 
 
-TopKeys::TopKeys(int mkeys) {
+TopKeys::TopKeys(int mkeys, bool sketch)
+    : sketch_mode(sketch),
+      max_keys(mkeys) {
     for (auto& shard : shards) {
         shard.setMaxKeys(mkeys);
     }
+    for (auto& slot : sketches) {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
 }
 
 TopKeys::~TopKeys() {
+    for (auto& slot : sketches) {
+        delete slot.load(std::memory_order_relaxed);
+    }
 }
 
 TopKeys::Shard& TopKeys::getShard(size_t key_hash) {
@@ -172,7 +200,8 @@ bool TopKeys::Shard::updateKey(const const_sized_buffer& key,
 }
 
 void TopKeys::updateKey(const void *key, size_t nkey,
-                        rel_time_t operation_time) {
+                        rel_time_t operation_time,
+                        size_t worker) {
     cb_assert(key);
     cb_assert(nkey > 0);
 
@@ -181,12 +210,181 @@ void TopKeys::updateKey(const void *key, size_t nkey,
         std::hash<const_sized_buffer> hash_fn;
         const size_t key_hash = hash_fn(key_buf);
 
-        getShard(key_hash).updateKey(key_buf, key_hash, operation_time);
+        if (sketch_mode) {
+            getSketch(worker)->updateKey(key_buf, key_hash, operation_time);
+        } else {
+            getShard(key_hash).updateKey(key_buf, key_hash, operation_time);
+        }
     } catch (std::bad_alloc) {
         // Failed to increment topkeys, continue...
     }
 }
 
+TopKeys::Sketch* TopKeys::getSketch(size_t worker) {
+    auto& slot = sketches[worker % NUM_SKETCHES];
+    Sketch* sketch = slot.load(std::memory_order_acquire);
+    if (sketch == nullptr) {
+        auto* created = new Sketch(max_keys);
+        if (slot.compare_exchange_strong(sketch, created,
+                                         std::memory_order_acq_rel)) {
+            sketch = created;
+        } else {
+            // Another worker sharing the slot won the race
+            delete created;
+        }
+    }
+    return sketch;
+}
+
+TopKeys::Sketch::Sketch(unsigned int mkeys)
+    : max_keys(mkeys),
+      min_estimate(0) {
+    for (auto& row : counters) {
+        row.fill(0);
+    }
+    candidates.reserve(max_keys);
+}
+
+size_t TopKeys::Sketch::rowIndex(size_t key_hash, size_t row) const {
+    // Derive an independent index per row by remixing the key's hash
+    // with a row-specific odd multiplier (multiply-shift hashing)
+    static const uint64_t seeds[ROWS] = {
+        0x9e3779b97f4a7c15ULL,
+        0xc2b2ae3d27d4eb4fULL,
+        0x165667b19e3779f9ULL,
+        0x27d4eb2f165667c5ULL
+    };
+    static_assert((WIDTH & (WIDTH - 1)) == 0, "WIDTH must be a power of two");
+    return size_t((uint64_t(key_hash) * seeds[row]) >> 32) & (WIDTH - 1);
+}
+
+uint32_t TopKeys::Sketch::increment(size_t key_hash) {
+    uint32_t ret = 0xffffffff;
+    for (size_t row = 0; row < ROWS; ++row) {
+        uint32_t& counter = counters[row][rowIndex(key_hash, row)];
+        if (counter != 0xffffffff) {
+            ++counter;
+        }
+        ret = std::min(ret, counter);
+    }
+    return ret;
+}
+
+uint32_t TopKeys::Sketch::estimate(size_t key_hash) const {
+    uint32_t ret = 0xffffffff;
+    for (size_t row = 0; row < ROWS; ++row) {
+        ret = std::min(ret, counters[row][rowIndex(key_hash, row)]);
+    }
+    return ret;
+}
+
+void TopKeys::Sketch::updateKey(const const_sized_buffer& key,
+                                size_t key_hash,
+                                rel_time_t operation_time) {
+    const uint32_t est = increment(key_hash);
+
+    // Already a candidate? The displayed count is re-estimated from
+    // the sketch at stats time so there is nothing to update. Scanning
+    // without the mutex is safe here as only the owning worker mutates
+    // the table.
+    for (const auto& candidate : candidates) {
+        if (candidate.hash == key_hash &&
+            candidate.key.compare(0, candidate.key.size(),
+                                  key.buf, key.len) == 0) {
+            return;
+        }
+    }
+
+    if (candidates.size() == max_keys && est <= min_estimate) {
+        // Can't displace anything; the common case for cold keys
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (candidates.size() < max_keys) {
+        candidates.push_back(Candidate{key_hash,
+                                       std::string(key.buf, key.len),
+                                       operation_time});
+        return;
+    }
+
+    // Find the cheapest candidate (by the current estimates; the
+    // cached min_estimate may be stale)
+    size_t victim = 0;
+    uint32_t cheapest = 0xffffffff;
+    uint32_t second = 0xffffffff;
+    for (size_t ii = 0; ii < candidates.size(); ++ii) {
+        const uint32_t e = estimate(candidates[ii].hash);
+        if (e < cheapest) {
+            second = cheapest;
+            cheapest = e;
+            victim = ii;
+        } else if (e < second) {
+            second = e;
+        }
+    }
+
+    if (est > cheapest) {
+        candidates[victim].hash = key_hash;
+        candidates[victim].key.assign(key.buf, key.len);
+        candidates[victim].ctime = operation_time;
+        min_estimate = std::min(est, second);
+    } else {
+        min_estimate = cheapest;
+    }
+}
+
+void TopKeys::Sketch::rank(
+    std::vector<std::pair<std::string, topkey_item_t>>& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& candidate : candidates) {
+        topkey_item_t item(candidate.ctime);
+        item.ti_access_count = int(estimate(candidate.hash));
+        out.emplace_back(candidate.key, item);
+    }
+}
+
+std::vector<std::pair<std::string, topkey_item_t>> TopKeys::rankSketched(void) {
+    std::vector<std::pair<std::string, topkey_item_t>> collected;
+
+    for (auto& slot : sketches) {
+        auto* sketch = slot.load(std::memory_order_acquire);
+        if (sketch != nullptr) {
+            sketch->rank(collected);
+        }
+    }
+
+    // Merge the per-worker entries by key: the sketches are private
+    // so the counts add up, and we keep the earliest creation time.
+    std::unordered_map<std::string, topkey_item_t> merged;
+    for (auto& entry : collected) {
+        auto iter = merged.find(entry.first);
+        if (iter == merged.end()) {
+            merged.insert(entry);
+        } else {
+            iter->second.ti_access_count += entry.second.ti_access_count;
+            iter->second.ti_ctime = std::min(iter->second.ti_ctime,
+                                             entry.second.ti_ctime);
+        }
+    }
+
+    std::vector<std::pair<std::string, topkey_item_t>> ret(merged.begin(),
+                                                           merged.end());
+    std::sort(ret.begin(), ret.end(),
+              [](const std::pair<std::string, topkey_item_t>& a,
+                 const std::pair<std::string, topkey_item_t>& b) {
+                  return a.second.ti_access_count > b.second.ti_access_count;
+              });
+
+    const size_t limit = size_t(max_keys) * NUM_SHARDS;
+    if (ret.size() > limit) {
+        // (can't resize() - topkey_item_t has no default constructor)
+        ret.erase(ret.begin() + limit, ret.end());
+    }
+    return ret;
+}
+
 struct tk_context {
     tk_context(const void *c, ADD_STAT a, rel_time_t t, cJSON *arr)
         : cookie(c), add_stat(a), current_time(t), array(arr)
@@ -250,6 +448,13 @@ ENGINE_ERROR_CODE TopKeys::stats(const void *cookie,
                                  ADD_STAT add_stat) {
     struct tk_context context(cookie, add_stat, current_time, nullptr);
 
+    if (sketch_mode) {
+        for (const auto& entry : rankSketched()) {
+            tk_iterfunc(entry.first, entry.second, &context);
+        }
+        return ENGINE_SUCCESS;
+    }
+
     for (auto& shard : shards) {
         shard.accept_visitor(tk_iterfunc, &context);
     }
@@ -274,8 +479,14 @@ ENGINE_ERROR_CODE TopKeys::json_stats(cJSON *object,
     struct tk_context context(nullptr, nullptr, current_time, topkeys);
 
     /* Collate the topkeys JSON object */
-    for (auto& shard : shards) {
-        shard.accept_visitor(tk_jsonfunc, &context);
+    if (sketch_mode) {
+        for (const auto& entry : rankSketched()) {
+            tk_jsonfunc(entry.first, entry.second, &context);
+        }
+    } else {
+        for (auto& shard : shards) {
+            shard.accept_visitor(tk_jsonfunc, &context);
+        }
     }
 
     cJSON_AddItemToObject(object, "topkeys", topkeys);
@@ -23,9 +23,11 @@
 #include <memcached/engine.h>
 #include <cJSON.h>
 
+#include <atomic>
 #include <mutex>
 #include <list>
 #include <string>
+#include <utility>
 #include <vector>
 
 /*
@@ -46,19 +48,42 @@ struct topkey_item_t {
 };
 
 /* Class to track the "top" keys in a bucket.
+ *
+ * Two modes are supported:
+ *
+ * - The exact mode (the default) shards the keyspace over a set of
+ *   mutex-protected lists; see topkeys.cc for the details.
+ *
+ * - The sketch mode trades exactness for update cost: each worker
+ *   thread owns a private count-min sketch with a small table of
+ *   candidate top keys on the side, so the common update is a handful
+ *   of unsynchronized array operations. The sketches are merged (and
+ *   the candidate counts re-estimated) when the stats are requested.
  */
 class TopKeys {
 public:
     /* Constructor.
      * @param mkeys Number of keys stored in each shard (i.e. up to
      * mkeys * SHARDS will be tracked).
+     * @param sketch use the probabilistic per-worker sketches instead
+     * of the exact mutex-protected shards.
      */
-    TopKeys(int mkeys);
+    TopKeys(int mkeys, bool sketch = false);
     ~TopKeys();
 
+    /**
+     * Update the ranking for a key.
+     *
+     * @param key the key that was accessed
+     * @param nkey the number of bytes in the key
+     * @param operation_time when the access happened
+     * @param worker the calling worker's thread index (used to select
+     *        the thread-private sketch; ignored in exact mode)
+     */
     void updateKey(const void *key,
                    size_t nkey,
-                   rel_time_t operation_time);
+                   rel_time_t operation_time,
+                   size_t worker = 0);
 
     ENGINE_ERROR_CODE stats(const void *cookie,
                             const rel_time_t current_time,
@@ -87,10 +112,25 @@ private:
     // concurrent update (there is one mutex per shard).
     static const int NUM_SHARDS = 8;
 
+    // The maximum number of per-worker sketches in sketch mode.
+    // Workers use their thread index (modulo this capacity) to select
+    // a sketch.
+    static const size_t NUM_SKETCHES = 64;
+
     class Shard;
+    class Sketch;
 
     Shard& getShard(size_t key_hash);
 
+    // Get the sketch for the given worker, allocating it on the
+    // first access.
+    Sketch* getSketch(size_t worker);
+
+    // Merge the per-worker sketches into a single ranked list of
+    // (key, stats) pairs, at most mkeys * NUM_SHARDS entries (the
+    // capacity of the exact mode).
+    std::vector<std::pair<std::string, topkey_item_t>> rankSketched(void);
+
     // One of N Shards which the keyspace has been broken
     // into.
     // Responsible for tracking the top {mkeys} within it's keyspace.
@@ -156,6 +196,83 @@ private:
         key_storage_t storage;
     };
 
+    // A worker-private count-min sketch plus a small table of
+    // candidate top keys.
+    //
+    // The sketch counters are plain (non-atomic) integers: each
+    // sketch is only updated by its owning worker thread, and the
+    // stats thread reading them while they tick is fine for an
+    // approximate ranking (the same approach the per-thread
+    // thread_stats counters use). The candidate table holds key
+    // identities only - the access counts are re-estimated from the
+    // sketch when the stats are generated - so the common update is
+    // the ROWS counter increments plus a scan of the (tiny) candidate
+    // table; the mutex is only taken when the table itself changes
+    // and when the stats are collected.
+    class Sketch {
+    public:
+        Sketch(unsigned int mkeys);
+
+        // Count an access of the given key, making it a candidate top
+        // key if its estimate grew past the current minimum.
+        void updateKey(const const_sized_buffer& key,
+                       size_t key_hash,
+                       rel_time_t operation_time);
+
+        // Append the candidates (with counts estimated from the
+        // sketch) to the given list.
+        void rank(std::vector<std::pair<std::string, topkey_item_t>>& out);
+
+    private:
+        // The sketch geometry: ROWS independent rows of WIDTH
+        // counters (WIDTH must stay a power of two).
+        static const size_t ROWS = 4;
+        static const size_t WIDTH = 2048;
+
+        // Get the counter index for a key in the given row
+        size_t rowIndex(size_t key_hash, size_t row) const;
+
+        // Increment the key's counter in every row and return the new
+        // estimate (the smallest of them)
+        uint32_t increment(size_t key_hash);
+
+        // Get the current estimate for a key
+        uint32_t estimate(size_t key_hash) const;
+
+        struct Candidate {
+            size_t hash;
+            std::string key;
+            rel_time_t ctime;
+        };
+
+        // Maximum number of candidates tracked by this sketch
+        unsigned int max_keys;
+
+        // Estimate of the "cheapest" candidate; keys estimating at or
+        // below this can't enter a full table so their update skips
+        // the mutex entirely. Only a cache - refreshed whenever the
+        // table is inspected under the mutex.
+        uint32_t min_estimate;
+
+        std::array<std::array<uint32_t, WIDTH>, ROWS> counters;
+
+        // The current candidate top keys. Scanned without the mutex
+        // by the owning worker; mutated (and read by the stats
+        // thread) under it.
+        std::vector<Candidate> candidates;
+
+        std::mutex mutex;
+    };
+
+    // Is this instance running in sketch mode?
+    const bool sketch_mode;
+
+    // Number of keys tracked per shard / sketch.
+    const unsigned int max_keys;
+
     // array of topkey shards.
     std::array<Shard, NUM_SHARDS> shards;
+
+    // The lazily allocated per-worker sketches (sketch mode only).
+    std::array<std::atomic<Sketch*>, NUM_SKETCHES> sketches;
 };
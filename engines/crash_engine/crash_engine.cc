@@ -15,13 +15,36 @@
  *   limitations under the License.
  */
 
-/* The "crash" bucket is a bucket which simply crashes when it is initialized.
- * It is intended to be used to test crash catching using Google Breakpad.
+/* The "crash" bucket serves two test purposes:
+ *
+ *  - With the MEMCACHED_CRASH_TEST environment variable set, it simply
+ *    crashes when it is initialized. This is used to test crash
+ *    catching using Google Breakpad.
+ *
+ *  - Without it, the engine runs as a fault/perf harness: every get is
+ *    answered from a single preallocated template item (no allocation,
+ *    no locking - the engine cost is as close to zero as it gets), and
+ *    each API can be given a failure rate through the config string.
+ *    Driving a workload against such a bucket measures the daemon-only
+ *    command ceiling, the number any frontend batching change should
+ *    be judged against, and exercises the frontend's error paths at a
+ *    controlled rate.
+ *
+ * Benchmark-mode config string keys (all optional):
+ *    value_size      size of the synthetic value in bytes (default 256)
+ *    fail_get_ppm    gets per million answered with ENGINE_TMPFAIL
+ *    fail_store_ppm  stores per million answered with ENGINE_TMPFAIL
+ *    fail_remove_ppm removes per million answered with ENGINE_TMPFAIL
+ *
+ * All synthetic items carry the same key and payload; the harness is
+ * about message rates, not data fidelity (GETK against it will echo
+ * the template's key, not the requested one).
  */
 
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdexcept>
 #include <string>
 
@@ -41,6 +64,19 @@ MEMCACHED_PUBLIC_API
 void destroy_engine(void);
 } // extern "C"
 
+/**
+ * The item format used by both the template item and items handed out
+ * by allocate: a fixed header followed by the key bytes and then the
+ * value bytes in a single block.
+ */
+struct synthetic_item {
+    uint64_t cas;
+    uint32_t nbytes;
+    uint16_t nkey;
+    uint8_t datatype;
+    char data[1]; /* key bytes followed by value bytes */
+};
+
 struct CrashEngine {
     ENGINE_HANDLE_V1 engine;
     union {
@@ -48,6 +84,29 @@ struct CrashEngine {
         char buffer[sizeof(engine_info) +
                     (sizeof(feature_info) * LAST_REGISTERED_ENGINE_FEATURE)];
     } info;
+
+    /* Benchmark-mode configuration (parsed from the config string) */
+    struct {
+        size_t value_size;
+        size_t fail_get_ppm;
+        size_t fail_store_ppm;
+        size_t fail_remove_ppm;
+    } config;
+
+    /* The preallocated item every get hands out */
+    synthetic_item* template_item;
+
+    /* xorshift state for the failure injection. Advanced without any
+       synchronization; a lost update just perturbs the sequence, which
+       is fine for a probabilistic fault injector. */
+    uint32_t rnd;
+
+    /* cas source for stores (racy increments are fine here too) */
+    uint64_t cas_source;
+
+    /* Approximate counters exposed through get_stats */
+    uint64_t synthetic_gets;
+    uint64_t injected_failures;
 };
 
 static CrashEngine* get_handle(ENGINE_HANDLE* handle)
@@ -89,33 +148,117 @@ char recursive_crash_function(char depth, CrashMode mode) {
     return dummy++;
 }
 
-/* 'initializes' this engine - given this is the crash_engine that
- * means crashing it.
+/**
+ * Roll the failure dice: returns true for roughly ppm calls per
+ * million. ppm == 0 short-circuits to false so the configured-off case
+ * costs a single compare on the hot path.
+ */
+static bool should_fail(CrashEngine* engine, size_t ppm)
+{
+    if (ppm == 0) {
+        return false;
+    }
+    uint32_t x = engine->rnd;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    engine->rnd = x;
+    if ((x % 1000000) < ppm) {
+        engine->injected_failures++;
+        return true;
+    }
+    return false;
+}
+
+static ENGINE_ERROR_CODE build_template_item(CrashEngine* engine)
+{
+    const char key[] = "synthetic";
+    const uint16_t nkey = (uint16_t)(sizeof(key) - 1);
+    const size_t nbytes = engine->config.value_size;
+    synthetic_item* it;
+
+    it = reinterpret_cast<synthetic_item*>(
+            cb_malloc(offsetof(synthetic_item, data) + nkey + nbytes));
+    if (it == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    it->cas = 1;
+    it->nbytes = (uint32_t)nbytes;
+    it->nkey = nkey;
+    it->datatype = PROTOCOL_BINARY_RAW_BYTES;
+    memcpy(it->data, key, nkey);
+    memset(it->data + nkey, 'x', nbytes);
+    engine->template_item = it;
+    return ENGINE_SUCCESS;
+}
+
+/* 'initializes' this engine. Under MEMCACHED_CRASH_TEST that means
+ * crashing it; otherwise the benchmark mode is configured.
  */
 static ENGINE_ERROR_CODE initialize(ENGINE_HANDLE* handle,
                                     const char* config_str)
 {
-    (void)handle;
-    (void)config_str;
-    std::string mode_string(getenv("MEMCACHED_CRASH_TEST"));
-    CrashMode mode;
-    if (mode_string == "segfault") {
-        mode = CrashMode::SegFault;
-    } else if (mode_string == "exception") {
-        mode = CrashMode::UncaughtException;
-    } else {
-        fprintf(stderr, "crash_engine::initialize: could not find a valid "
-                "CrashMode from MEMCACHED_CRASH_TEST env var ('%s')\n",
-                mode_string.c_str());
-        exit(1);
+    CrashEngine* engine = get_handle(handle);
+    const char* crash_env = getenv("MEMCACHED_CRASH_TEST");
+
+    if (crash_env != NULL) {
+        std::string mode_string(crash_env);
+        CrashMode mode;
+        if (mode_string == "segfault") {
+            mode = CrashMode::SegFault;
+        } else if (mode_string == "exception") {
+            mode = CrashMode::UncaughtException;
+        } else {
+            fprintf(stderr, "crash_engine::initialize: could not find a valid "
+                    "CrashMode from MEMCACHED_CRASH_TEST env var ('%s')\n",
+                    mode_string.c_str());
+            exit(1);
+        }
+        return ENGINE_ERROR_CODE(recursive_crash_function(25, mode));
     }
-    return ENGINE_ERROR_CODE(recursive_crash_function(25, mode));
+
+    if (config_str != NULL) {
+        struct config_item items[5];
+        int ii = 0;
+
+        memset(&items, 0, sizeof(items));
+
+        items[ii].key = "value_size";
+        items[ii].datatype = DT_SIZE;
+        items[ii].value.dt_size = &engine->config.value_size;
+        ++ii;
+
+        items[ii].key = "fail_get_ppm";
+        items[ii].datatype = DT_SIZE;
+        items[ii].value.dt_size = &engine->config.fail_get_ppm;
+        ++ii;
+
+        items[ii].key = "fail_store_ppm";
+        items[ii].datatype = DT_SIZE;
+        items[ii].value.dt_size = &engine->config.fail_store_ppm;
+        ++ii;
+
+        items[ii].key = "fail_remove_ppm";
+        items[ii].datatype = DT_SIZE;
+        items[ii].value.dt_size = &engine->config.fail_remove_ppm;
+        ++ii;
+
+        items[ii].key = NULL;
+
+        if (parse_config(config_str, items, stderr) != 0) {
+            return ENGINE_EINVAL;
+        }
+    }
+
+    return build_template_item(engine);
 }
 
 static void destroy(ENGINE_HANDLE* handle, const bool force)
 {
     (void)force;
-    cb_free(handle);
+    CrashEngine* engine = get_handle(handle);
+    cb_free(engine->template_item);
+    cb_free(engine);
 }
 
 static ENGINE_ERROR_CODE item_allocate(ENGINE_HANDLE* handle,
@@ -128,7 +271,20 @@ static ENGINE_ERROR_CODE item_allocate(ENGINE_HANDLE* handle,
                                        const rel_time_t exptime,
                                        uint8_t datatype)
 {
-    return ENGINE_FAILED;
+    synthetic_item* it;
+
+    it = reinterpret_cast<synthetic_item*>(
+            cb_malloc(offsetof(synthetic_item, data) + nkey + nbytes));
+    if (it == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    it->cas = 0;
+    it->nbytes = (uint32_t)nbytes;
+    it->nkey = (uint16_t)nkey;
+    it->datatype = datatype;
+    memcpy(it->data, key, nkey);
+    *item = it;
+    return ENGINE_SUCCESS;
 }
 
 static ENGINE_ERROR_CODE item_delete(ENGINE_HANDLE* handle,
@@ -139,13 +295,27 @@ static ENGINE_ERROR_CODE item_delete(ENGINE_HANDLE* handle,
                                      uint16_t vbucket,
                                      mutation_descr_t* mut_info)
 {
-    return ENGINE_FAILED;
+    CrashEngine* engine = get_handle(handle);
+
+    if (should_fail(engine, engine->config.fail_remove_ppm)) {
+        return ENGINE_TMPFAIL;
+    }
+    *cas = 0;
+    mut_info->vbucket_uuid = 0;
+    mut_info->seqno = 0;
+    return ENGINE_SUCCESS;
 }
 
 static void item_release(ENGINE_HANDLE* handle, const void *cookie,
                          item* item)
 {
+    CrashEngine* engine = get_handle(handle);
 
+    /* The template item is shared by every get and lives until the
+       bucket is destroyed */
+    if (item != engine->template_item) {
+        cb_free(item);
+    }
 }
 
 static ENGINE_ERROR_CODE get(ENGINE_HANDLE* handle,
@@ -155,7 +325,14 @@ static ENGINE_ERROR_CODE get(ENGINE_HANDLE* handle,
                              const int nkey,
                              uint16_t vbucket)
 {
-    return ENGINE_FAILED;
+    CrashEngine* engine = get_handle(handle);
+
+    if (should_fail(engine, engine->config.fail_get_ppm)) {
+        return ENGINE_TMPFAIL;
+    }
+    engine->synthetic_gets++;
+    *item = engine->template_item;
+    return ENGINE_SUCCESS;
 }
 
 static ENGINE_ERROR_CODE get_stats(ENGINE_HANDLE* handle,
@@ -164,7 +341,19 @@ static ENGINE_ERROR_CODE get_stats(ENGINE_HANDLE* handle,
                                    int nkey,
                                    ADD_STAT add_stat)
 {
-    return ENGINE_FAILED;
+    CrashEngine* engine = get_handle(handle);
+
+    if (stat_key == NULL) {
+        char val[32];
+        int len;
+
+        len = snprintf(val, sizeof(val), "%" PRIu64, engine->synthetic_gets);
+        add_stat("synthetic_gets", 14, val, len, cookie);
+        len = snprintf(val, sizeof(val), "%" PRIu64,
+                       engine->injected_failures);
+        add_stat("injected_failures", 17, val, len, cookie);
+    }
+    return ENGINE_SUCCESS;
 }
 
 static ENGINE_ERROR_CODE store(ENGINE_HANDLE* handle,
@@ -174,36 +363,83 @@ static ENGINE_ERROR_CODE store(ENGINE_HANDLE* handle,
                                ENGINE_STORE_OPERATION operation,
                                uint16_t vbucket)
 {
-    return ENGINE_FAILED;
+    CrashEngine* engine = get_handle(handle);
+
+    if (should_fail(engine, engine->config.fail_store_ppm)) {
+        return ENGINE_TMPFAIL;
+    }
+    *cas = ++engine->cas_source;
+    return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE arithmetic(ENGINE_HANDLE* handle,
+                                    const void* cookie,
+                                    const void* key,
+                                    const int nkey,
+                                    const bool increment,
+                                    const bool create,
+                                    const uint64_t delta,
+                                    const uint64_t initial,
+                                    const rel_time_t exptime,
+                                    item **item,
+                                    uint8_t datatype,
+                                    uint64_t *result,
+                                    uint16_t vbucket)
+{
+    return ENGINE_ENOTSUP;
 }
 
 static ENGINE_ERROR_CODE flush(ENGINE_HANDLE* handle,
                                const void* cookie,
                                time_t when)
 {
-    return ENGINE_FAILED;
+    return ENGINE_SUCCESS;
 }
 
 static void reset_stats(ENGINE_HANDLE* handle,
                          const void *cookie)
 {
+    CrashEngine* engine = get_handle(handle);
+    engine->synthetic_gets = 0;
+    engine->injected_failures = 0;
 }
 
 static void item_set_cas(ENGINE_HANDLE *handle, const void *cookie,
                          item* item, uint64_t val)
 {
+    reinterpret_cast<synthetic_item*>(item)->cas = val;
 }
 
 static bool get_item_info(ENGINE_HANDLE *handle, const void *cookie,
                           const item* item, item_info *item_info)
 {
-    return false;
+    const synthetic_item* it =
+            reinterpret_cast<const synthetic_item*>(item);
+
+    if (item_info->nvalue < 1) {
+        return false;
+    }
+    item_info->cas = it->cas;
+    item_info->vbucket_uuid = 0;
+    item_info->seqno = 0;
+    item_info->exptime = 0;
+    item_info->nbytes = it->nbytes;
+    item_info->flags = 0;
+    item_info->datatype = it->datatype;
+    item_info->clsid = 0;
+    item_info->nkey = it->nkey;
+    item_info->nvalue = 1;
+    item_info->key = it->data;
+    item_info->value[0].iov_base = const_cast<char*>(it->data) + it->nkey;
+    item_info->value[0].iov_len = it->nbytes;
+    return true;
 }
 
 static bool set_item_info(ENGINE_HANDLE *handle, const void *cookie,
                           item* item, const item_info *itm_info)
 {
-    return false;
+    reinterpret_cast<synthetic_item*>(item)->datatype = itm_info->datatype;
+    return true;
 }
 
 ENGINE_ERROR_CODE create_instance(uint64_t interface,
@@ -232,10 +468,13 @@ ENGINE_ERROR_CODE create_instance(uint64_t interface,
     engine->engine.get_stats = get_stats;
     engine->engine.reset_stats = reset_stats;
     engine->engine.store = store;
+    engine->engine.arithmetic = arithmetic;
     engine->engine.flush = flush;
     engine->engine.item_set_cas = item_set_cas;
     engine->engine.get_item_info = get_item_info;
     engine->engine.set_item_info = set_item_info;
+    engine->config.value_size = 256;
+    engine->rnd = 0xdeadcbdb;
     engine->info.eng_info.description = "Crash Engine";
     engine->info.eng_info.num_features = 0;
     *handle = reinterpret_cast<ENGINE_HANDLE*>(&engine->engine);
@@ -6,6 +6,7 @@
 #include "config.h"
 #include <fcntl.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,18 +19,115 @@
 #define hashsize(n) ((size_t)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
 
+#define stripemask (ASSOC_NUM_STRIPES - 1)
+
+/*
+ * Bounds on the table size. The minimum keeps a bucket and its images in
+ * the expanded table on the same stripe (see ASSOC_NUM_STRIPES); the
+ * maximum caps the bucket array at 2GB of pointers.
+ */
+#define ASSOC_MIN_HASHPOWER 9
+#define ASSOC_MAX_HASHPOWER 28
+
+/*
+ * When an expansion triggers, size the new table so that the observed
+ * insert rate takes this many seconds to fill it to the next expansion
+ * threshold, rather than always doubling. Bounded by ASSOC_EXPAND_MAX_STEP
+ * powers of two per expansion so a burst can't commit us to a huge table.
+ */
+#define ASSOC_EXPAND_HORIZON 60
+#define ASSOC_EXPAND_MAX_STEP 4
+
 /* One hashtable for all */
 static struct assoc* global_assoc = NULL;
 
+/*
+ * A bucket index is always the low bits of the hash, so the low bits of
+ * the hash select the stripe for both the primary and the old table.
+ */
+static cb_mutex_t *get_stripe_lock(struct assoc *assoc, uint32_t hash) {
+    return &assoc->stripe_locks[hash & stripemask];
+}
+
+/*
+ * Take (or drop) every stripe lock, in index order to avoid deadlocking
+ * against other all-lock callers. Normal operations hold exactly one
+ * stripe lock and never take a second, so they can't participate in a
+ * deadlock cycle.
+ */
+static void assoc_lock_all(struct assoc *assoc) {
+    int ii;
+    for (ii = 0; ii < ASSOC_NUM_STRIPES; ++ii) {
+        cb_mutex_enter(&assoc->stripe_locks[ii]);
+    }
+}
+
+static void assoc_unlock_all(struct assoc *assoc) {
+    int ii;
+    for (ii = ASSOC_NUM_STRIPES - 1; ii >= 0; --ii) {
+        cb_mutex_exit(&assoc->stripe_locks[ii]);
+    }
+}
+
+/*
+ * Sum of the per-stripe item counts. Only exact when the caller holds all
+ * of the stripe locks; without them it is a (good) estimate.
+ */
+static unsigned int assoc_item_count(struct assoc *assoc) {
+    unsigned int total = 0;
+    int ii;
+    for (ii = 0; ii < ASSOC_NUM_STRIPES; ++ii) {
+        total += assoc->stripe_items[ii];
+    }
+    return total;
+}
+
+/*
+ * Allocate a (zeroed) bucket array for the given hashpower, trying the
+ * configured huge page size first so chain walks don't thrash the TLB
+ * on very large tables. *mapped receives the mapping length when huge
+ * pages were obtained, 0 when the table came from the normal heap.
+ */
+static hash_item** alloc_table(enum hugepage_size request, int hashpower,
+                               size_t *mapped) {
+    if (request != HUGEPAGE_NONE) {
+        enum hugepage_size obtained;
+        hash_item** table = hugepage_alloc(hashsize(hashpower) *
+                                           sizeof(hash_item*),
+                                           request, &obtained, mapped);
+        if (table != NULL) {
+            /* the mapping is already zeroed */
+            return table;
+        }
+    }
+    *mapped = 0;
+    return cb_calloc(hashsize(hashpower), sizeof(hash_item*));
+}
+
+static void free_table(hash_item** table, size_t mapped) {
+    if (mapped != 0) {
+        hugepage_free(table, mapped);
+    } else {
+        cb_free(table);
+    }
+}
+
 /* assoc factory. returns one new assoc or NULL if out-of-memory */
-static struct assoc* assoc_consruct(int hashpower) {
+static struct assoc* assoc_consruct(int hashpower,
+                                    enum hugepage_size huge_pages) {
     struct assoc* new_assoc = NULL;
     new_assoc = cb_calloc(1, sizeof(struct assoc));
     if (new_assoc) {
+        int ii;
         new_assoc->hashpower = hashpower;
-        cb_mutex_initialize(&new_assoc->lock);
-        new_assoc->primary_hashtable = cb_calloc(hashsize(hashpower),
-                                              sizeof(hash_item*));
+        new_assoc->huge_pages = huge_pages;
+        new_assoc->grow_items = 0;
+        new_assoc->grow_time = gethrtime();
+        for (ii = 0; ii < ASSOC_NUM_STRIPES; ++ii) {
+            cb_mutex_initialize(&new_assoc->stripe_locks[ii]);
+        }
+        new_assoc->primary_hashtable = alloc_table(huge_pages, hashpower,
+                                                   &new_assoc->primary_mapped);
 
         if (new_assoc->primary_hashtable == NULL) {
             /* rollback and return NULL */
@@ -47,7 +145,40 @@ ENGINE_ERROR_CODE assoc_init(struct default_engine *engine) {
         For flexibility, the assoc code accesses the assoc via the engine handle.
     */
     if (global_assoc == NULL) {
-        global_assoc = assoc_consruct(16);
+        enum hugepage_size request = hugepage_parse(engine->config.huge_pages);
+        EXTENSION_LOGGER_DESCRIPTOR *logger;
+        int hashpower = (int)engine->config.initial_hashpower;
+
+        logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+
+        /* The stripes must divide the initial table (see assoc.h) */
+        cb_assert(hashsize(ASSOC_MIN_HASHPOWER - 1) >= ASSOC_NUM_STRIPES);
+        if (hashpower < ASSOC_MIN_HASHPOWER) {
+            hashpower = ASSOC_MIN_HASHPOWER;
+        } else if (hashpower > ASSOC_MAX_HASHPOWER) {
+            hashpower = ASSOC_MAX_HASHPOWER;
+        }
+        if (hashpower != (int)engine->config.initial_hashpower) {
+            logger->log(EXTENSION_LOG_WARNING, NULL,
+                        "initial_hashpower %" PRIu64 " out of range;"
+                        " using %d\n",
+                        (uint64_t)engine->config.initial_hashpower,
+                        hashpower);
+        }
+        global_assoc = assoc_consruct(hashpower, request);
+
+        if (global_assoc != NULL && request != HUGEPAGE_NONE) {
+            if (global_assoc->primary_mapped != 0) {
+                logger->log(EXTENSION_LOG_NOTICE, NULL,
+                            "Hash table backed by %s\n",
+                            hugepage_size_text(request));
+            } else {
+                logger->log(EXTENSION_LOG_WARNING, NULL,
+                            "Unable to back the hash table with %s;"
+                            " falling back to normal pages\n",
+                            hugepage_size_text(request));
+            }
+        }
     }
     engine->assoc = global_assoc;
     return (engine->assoc != NULL) ? ENGINE_SUCCESS : ENGINE_ENOMEM;
@@ -58,47 +189,175 @@ void assoc_destroy() {
         while (global_assoc->expanding) {
             usleep(250);
         }
-        cb_free(global_assoc->primary_hashtable);
+        free_table(global_assoc->primary_hashtable,
+                   global_assoc->primary_mapped);
         cb_free(global_assoc);
         global_assoc = NULL;
     }
 }
 
+/* The bucket walk of assoc_find; the caller holds the stripe lock
+ * covering the hash. */
+static hash_item *assoc_find_inlock(struct assoc *assoc, uint32_t hash,
+                                    const hash_key *key) {
+    hash_item *it;
+    unsigned int oldbucket;
+    hash_item *ret = NULL;
+    int depth = 0;
+    if (assoc->expanding &&
+        (oldbucket = (hash & hashmask(assoc->old_hashpower))) >= assoc->expand_bucket)
+    {
+        it = assoc->old_hashtable[oldbucket];
+    } else {
+        it = assoc->primary_hashtable[hash & hashmask(assoc->hashpower)];
+    }
+
+    while (it) {
+        /* the stored hash rejects a mismatch on the same cache line as
+         * h_next, without pulling in the entry's key bytes */
+        if (it->khash == hash) {
+            const hash_key* it_key = item_get_key(it);
+            if ((hash_key_get_key_len(key) == hash_key_get_key_len(it_key)) &&
+                cb_memeq(hash_key_get_key(key),
+                         hash_key_get_key(it_key),
+                         hash_key_get_key_len(key))) {
+                ret = it;
+                break;
+            }
+        }
+        it = it->h_next;
+        ++depth;
+    }
+    MEMCACHED_ASSOC_FIND(hash_key_get_key(key), hash_key_get_key_len(key), depth);
+    return ret;
+}
+
 hash_item *assoc_find(struct default_engine *engine, uint32_t hash, const hash_key *key) {
+    hash_item *ret;
+    cb_mutex_t *lock = get_stripe_lock(engine->assoc, hash);
+    cb_mutex_enter(lock);
+    ret = assoc_find_inlock(engine->assoc, hash, key);
+    cb_mutex_exit(lock);
+    return ret;
+}
+
+/* The bucket walk of assoc_find_view; the caller holds the stripe lock
+ * covering the hash. */
+static hash_item *assoc_find_inlock_view(struct assoc *assoc, uint32_t hash,
+                                         const hash_key_view *view) {
     hash_item *it;
     unsigned int oldbucket;
     hash_item *ret = NULL;
     int depth = 0;
-    cb_mutex_enter(&engine->assoc->lock);
-    if (engine->assoc->expanding &&
-        (oldbucket = (hash & hashmask(engine->assoc->hashpower - 1))) >= engine->assoc->expand_bucket)
+    if (assoc->expanding &&
+        (oldbucket = (hash & hashmask(assoc->old_hashpower))) >= assoc->expand_bucket)
     {
-        it = engine->assoc->old_hashtable[oldbucket];
+        it = assoc->old_hashtable[oldbucket];
     } else {
-        it = engine->assoc->primary_hashtable[hash & hashmask(engine->assoc->hashpower)];
+        it = assoc->primary_hashtable[hash & hashmask(assoc->hashpower)];
     }
 
     while (it) {
-        const hash_key* it_key = item_get_key(it);
-        if ((hash_key_get_key_len(key) == hash_key_get_key_len(it_key)) &&
-            (memcmp(hash_key_get_key(key),
-                    hash_key_get_key(it_key),
-                    hash_key_get_key_len(key)) == 0)) {
+        /* the stored hash rejects a mismatch on the same cache line as
+         * h_next, without pulling in the entry's key bytes */
+        if (it->khash == hash && hash_key_view_equals(view, item_get_key(it))) {
             ret = it;
             break;
         }
         it = it->h_next;
         ++depth;
     }
-    MEMCACHED_ASSOC_FIND(hash_key_get_key(key), hash_key_get_key_len(key), depth);
-    cb_mutex_exit(&engine->assoc->lock);
+    MEMCACHED_ASSOC_FIND(view->client_key, view->client_len, depth);
+    return ret;
+}
+
+hash_item *assoc_find_view(struct default_engine *engine, uint32_t hash,
+                           const hash_key_view *view) {
+    hash_item *ret;
+    cb_mutex_t *lock = get_stripe_lock(engine->assoc, hash);
+    cb_mutex_enter(lock);
+    ret = assoc_find_inlock_view(engine->assoc, hash, view);
+    cb_mutex_exit(lock);
     return ret;
 }
 
+hash_item *assoc_peek(struct default_engine *engine, uint32_t hash) {
+    struct assoc *assoc = engine->assoc;
+    hash_item **table = assoc->primary_hashtable;
+    unsigned int power = assoc->hashpower;
+
+    if (assoc->expanding) {
+        return NULL;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    __sync_synchronize();
+#endif
+    /* Re-check that no expansion swapped the table between the loads
+     * above; once this check passes 'table' stays dereferenceable, as
+     * a table being retired by an expansion which starts after this
+     * point is only freed when the (bucket-by-bucket) migration has
+     * completed. */
+    if (assoc->expanding || table != assoc->primary_hashtable ||
+        power != assoc->hashpower) {
+        return NULL;
+    }
+    return table[hash & hashmask(power)];
+}
+
+void assoc_prefetch(struct default_engine *engine, uint32_t hash) {
+#if defined(__GNUC__) || defined(__clang__)
+    struct assoc *assoc = engine->assoc;
+    /* Unlocked peek at the bucket slot. hashpower and the table pointer
+     * only change during an expansion, and a prefetch of a slightly
+     * stale address is harmless; this is purely a hint to pull the
+     * bucket (and its first entry) towards the cache before the stripe
+     * lock is taken. */
+    hash_item **slot = &assoc->primary_hashtable[hash & hashmask(assoc->hashpower)];
+    __builtin_prefetch(slot);
+#else
+    (void)engine;
+    (void)hash;
+#endif
+}
+
+void assoc_find_multi(struct default_engine *engine,
+                      const uint32_t *hashes,
+                      const hash_key_view *keys,
+                      hash_item **items,
+                      size_t count) {
+    struct assoc *assoc = engine->assoc;
+    uint64_t done = 0;
+    size_t ii, jj;
+
+    cb_assert(count <= 64);
+    for (ii = 0; ii < count; ++ii) {
+        uint32_t stripe;
+        cb_mutex_t *lock;
+        if (done & (UINT64_C(1) << ii)) {
+            continue;
+        }
+        /* Resolve every not-yet-done entry mapping to this stripe while
+         * we hold its lock, so each stripe lock is taken at most once
+         * for the whole batch. */
+        stripe = hashes[ii] & stripemask;
+        lock = &assoc->stripe_locks[stripe];
+        cb_mutex_enter(lock);
+        for (jj = ii; jj < count; ++jj) {
+            if ((done & (UINT64_C(1) << jj)) == 0 &&
+                (hashes[jj] & stripemask) == stripe) {
+                items[jj] = assoc_find_inlock_view(assoc, hashes[jj],
+                                                   &keys[jj]);
+                done |= UINT64_C(1) << jj;
+            }
+        }
+        cb_mutex_exit(lock);
+    }
+}
+
 /*
     returns the address of the item pointer before the key.  if *item == 0,
     the item wasn't found
-    assoc->lock is assumed to be held by the caller.
+    the stripe lock for the hash is assumed to be held by the caller.
 */
 static hash_item** _hashitem_before(struct default_engine *engine,
                                     uint32_t hash,
@@ -107,7 +366,7 @@ static hash_item** _hashitem_before(struct default_engine *engine,
     unsigned int oldbucket;
 
     if (engine->assoc->expanding &&
-        (oldbucket = (hash & hashmask(engine->assoc->hashpower - 1))) >= engine->assoc->expand_bucket)
+        (oldbucket = (hash & hashmask(engine->assoc->old_hashpower))) >= engine->assoc->expand_bucket)
     {
         pos = &engine->assoc->old_hashtable[oldbucket];
     } else {
@@ -115,104 +374,203 @@ static hash_item** _hashitem_before(struct default_engine *engine,
     }
 
     while (*pos) {
-        const hash_key* pos_key = item_get_key(*pos);
-        if ((hash_key_get_key_len(key) != hash_key_get_key_len(pos_key)) ||
-            (memcmp(hash_key_get_key(key),
-                    hash_key_get_key(pos_key),
-                    hash_key_get_key_len(key)))) {
-             pos = &(*pos)->h_next;
-        } else {
-            break;
+        if ((*pos)->khash == hash) {
+            const hash_key* pos_key = item_get_key(*pos);
+            if ((hash_key_get_key_len(key) == hash_key_get_key_len(pos_key)) &&
+                cb_memeq(hash_key_get_key(key),
+                         hash_key_get_key(pos_key),
+                         hash_key_get_key_len(key))) {
+                break;
+            }
         }
+        pos = &(*pos)->h_next;
     }
 
     return pos;
 }
 
 static void assoc_maintenance_thread(void *arg);
+static bool assoc_migrate_bucket(struct default_engine *engine);
 
 /*
-    grows the hashtable to the next power of 2.
-    assoc->lock is assumed to be held by the caller.
+ * How many buckets a mutating operation migrates on its way out while an
+ * expansion is in flight. Keeping the batch small bounds the latency added
+ * to any single operation; the maintenance thread mops up the rest.
+ */
+#define ASSOC_EXPAND_BATCH 2
+
+static void assoc_help_expand(struct default_engine *engine) {
+    int ii;
+    for (ii = 0; ii < ASSOC_EXPAND_BATCH; ++ii) {
+        if (!assoc_migrate_bucket(engine)) {
+            break;
+        }
+    }
+}
+
+/*
+ * Pick the hashpower for the next expansion. Always at least one power
+ * bigger; beyond that, project the table population ASSOC_EXPAND_HORIZON
+ * seconds ahead from the insert rate observed since the previous
+ * expansion (or startup) and size the table so the projection stays
+ * under the expansion threshold - one big expansion instead of a
+ * cascade of doublings under a steady load.
+ */
+static unsigned int assoc_next_hashpower(struct assoc *assoc,
+                                         unsigned int count,
+                                         hrtime_t now) {
+    unsigned int power = assoc->hashpower + 1;
+    const unsigned int limit = assoc->hashpower + ASSOC_EXPAND_MAX_STEP;
+
+    if (now > assoc->grow_time && count > assoc->grow_items) {
+        const hrtime_t elapsed = now - assoc->grow_time;
+        const uint64_t rate = /* inserts per second */
+            ((uint64_t)(count - assoc->grow_items) * 1000000000ULL) / elapsed;
+        const uint64_t projected = count + rate * ASSOC_EXPAND_HORIZON;
+
+        while (power < limit && power < ASSOC_MAX_HASHPOWER &&
+               (uint64_t)(hashsize(power) * 3) / 2 < projected) {
+            ++power;
+        }
+    }
+    return power;
+}
+
+/*
+    grows the hashtable (by at least one power of 2; see
+    assoc_next_hashpower).
+    called with no stripe locks held; takes all of them while the table
+    pointers and hashpower are swapped.
 */
-static void assoc_expand(struct default_engine *engine) {
-    engine->assoc->old_hashtable = engine->assoc->primary_hashtable;
+static void assoc_start_expand(struct default_engine *engine) {
+    struct assoc *assoc = engine->assoc;
+    EXTENSION_LOGGER_DESCRIPTOR *logger;
+    unsigned int count;
+    unsigned int new_power;
+    hrtime_t now;
+
+    logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+
+    assoc_lock_all(assoc);
+    count = assoc_item_count(assoc);
+    if (assoc->expanding ||
+        count <= (hashsize(assoc->hashpower) * 3) / 2) {
+        /* another stripe raced us here, or items have since gone away */
+        assoc_unlock_all(assoc);
+        return;
+    }
 
-    engine->assoc->primary_hashtable = cb_calloc(hashsize(engine->assoc->hashpower + 1),
-                                             sizeof(hash_item *));
-    if (engine->assoc->primary_hashtable) {
+    now = gethrtime();
+    new_power = assoc_next_hashpower(assoc, count, now);
+
+    assoc->old_hashtable = assoc->primary_hashtable;
+    assoc->old_mapped = assoc->primary_mapped;
+
+    assoc->primary_hashtable = alloc_table(assoc->huge_pages,
+                                           new_power,
+                                           &assoc->primary_mapped);
+    if (assoc->primary_hashtable) {
         int ret = 0;
         cb_thread_t tid;
 
-        engine->assoc->hashpower++;
-        engine->assoc->expanding = true;
-        engine->assoc->expand_bucket = 0;
+        assoc->old_hashpower = assoc->hashpower;
+        assoc->hashpower = new_power;
+        assoc->expanding = true;
+        assoc->expand_bucket = 0;
+        assoc->expand_start = now;
+        assoc->grow_items = count;
+        assoc->grow_time = now;
 
         /* start a thread to do the expansion */
         if ((ret = cb_create_named_thread(&tid, assoc_maintenance_thread,
                                           engine, 1, "mc:assoc_maint")) != 0)
         {
-            EXTENSION_LOGGER_DESCRIPTOR *logger;
-            logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
             logger->log(EXTENSION_LOG_WARNING, NULL,
                         "Can't create thread: %s\n", strerror(ret));
-            engine->assoc->hashpower--;
-            engine->assoc->expanding = false;
-            cb_free(engine->assoc->primary_hashtable);
-            engine->assoc->primary_hashtable = engine->assoc->old_hashtable;
+            assoc->hashpower = assoc->old_hashpower;
+            assoc->expanding = false;
+            free_table(assoc->primary_hashtable, assoc->primary_mapped);
+            assoc->primary_hashtable = assoc->old_hashtable;
+            assoc->primary_mapped = assoc->old_mapped;
+        } else {
+            logger->log(EXTENSION_LOG_NOTICE, NULL,
+                        "Expanding hash table from 2^%u to 2^%u buckets"
+                        " (%u items)\n",
+                        assoc->old_hashpower, assoc->hashpower, count);
         }
     } else {
-        engine->assoc->primary_hashtable = engine->assoc->old_hashtable;
+        assoc->primary_hashtable = assoc->old_hashtable;
+        assoc->primary_mapped = assoc->old_mapped;
         /* Bad news, but we can keep running. */
     }
+    assoc_unlock_all(assoc);
 }
 
 /* Note: this isn't an assoc_update.  The key must not already exist to call this */
 int assoc_insert(struct default_engine *engine, uint32_t hash, hash_item *it) {
     unsigned int oldbucket;
+    struct assoc *assoc = engine->assoc;
+    cb_mutex_t *lock = get_stripe_lock(assoc, hash);
+    bool expand_needed;
 
     cb_assert(assoc_find(engine, hash, item_get_key(it)) == 0);  /* shouldn't have duplicately named things defined */
 
-    cb_mutex_enter(&engine->assoc->lock);
-    if (engine->assoc->expanding &&
-        (oldbucket = (hash & hashmask(engine->assoc->hashpower - 1))) >= engine->assoc->expand_bucket)
+    cb_mutex_enter(lock);
+    if (assoc->expanding &&
+        (oldbucket = (hash & hashmask(assoc->old_hashpower))) >= assoc->expand_bucket)
     {
-        it->h_next = engine->assoc->old_hashtable[oldbucket];
-        engine->assoc->old_hashtable[oldbucket] = it;
+        it->h_next = assoc->old_hashtable[oldbucket];
+        assoc->old_hashtable[oldbucket] = it;
     } else {
-        it->h_next = engine->assoc->primary_hashtable[hash & hashmask(engine->assoc->hashpower)];
-        engine->assoc->primary_hashtable[hash & hashmask(engine->assoc->hashpower)] = it;
+        it->h_next = assoc->primary_hashtable[hash & hashmask(assoc->hashpower)];
+        assoc->primary_hashtable[hash & hashmask(assoc->hashpower)] = it;
     }
 
-    engine->assoc->hash_items++;
-    if (! engine->assoc->expanding && engine->assoc->hash_items > (hashsize(engine->assoc->hashpower) * 3) / 2) {
-        assoc_expand(engine);
+    assoc->stripe_items[hash & stripemask]++;
+    /*
+     * The hash spreads keys evenly over the stripes, so extrapolate the
+     * table population from our own stripe rather than taking every lock
+     * on the hot path. assoc_start_expand() re-checks the exact count.
+     */
+    expand_needed = !assoc->expanding &&
+        ((uint64_t)assoc->stripe_items[hash & stripemask] * ASSOC_NUM_STRIPES >
+         (hashsize(assoc->hashpower) * 3) / 2);
+    cb_mutex_exit(lock);
+
+    if (expand_needed) {
+        assoc_start_expand(engine);
+    } else if (assoc->expanding) {
+        assoc_help_expand(engine);
     }
-    cb_mutex_exit(&engine->assoc->lock);
-    MEMCACHED_ASSOC_INSERT(hash_key_get_key(item_get_key(it)), hash_key_get_key_len(item_get_key(it)), engine->assoc->hash_items);
+    MEMCACHED_ASSOC_INSERT(hash_key_get_key(item_get_key(it)), hash_key_get_key_len(item_get_key(it)), assoc_item_count(assoc));
     return 1;
 }
 
 void assoc_delete(struct default_engine *engine, uint32_t hash, const hash_key *key) {
-    cb_mutex_enter(&engine->assoc->lock);
+    struct assoc *assoc = engine->assoc;
+    cb_mutex_t *lock = get_stripe_lock(assoc, hash);
+    cb_mutex_enter(lock);
     hash_item **before = _hashitem_before(engine, hash, key);
 
     if (*before) {
         hash_item *nxt;
-        engine->assoc->hash_items--;
+        assoc->stripe_items[hash & stripemask]--;
         /* The DTrace probe cannot be triggered as the last instruction
          * due to possible tail-optimization by the compiler
          */
         MEMCACHED_ASSOC_DELETE(hash_key_get_key(key),
                                hash_key_get_key_len(key),
-                               engine->assoc->hash_items);
+                               assoc_item_count(assoc));
         nxt = (*before)->h_next;
         (*before)->h_next = 0;   /* probably pointless, but whatever. */
         *before = nxt;
-        cb_mutex_exit(&engine->assoc->lock);
+        cb_mutex_exit(lock);
+        if (assoc->expanding) {
+            assoc_help_expand(engine);
+        }
         return;
     }
-    cb_mutex_exit(&engine->assoc->lock);
+    cb_mutex_exit(lock);
     /* Note:  we never actually get here.  the callers don't delete things
        they can't find. */
     cb_assert(*before != 0);
@@ -223,44 +581,99 @@ void assoc_delete(struct default_engine *engine, uint32_t hash, const hash_key *
 #define DEFAULT_HASH_BULK_MOVE 1
 int hash_bulk_move = DEFAULT_HASH_BULK_MOVE;
 
+/*
+ * Migrate the bucket at the expansion frontier into the primary table.
+ *
+ * Only the stripe owning that bucket needs to be held: a bucket keeps its
+ * low hash bits when it moves to the expanded table, so any operation which
+ * could observe this bucket (in either table) serialises on the same stripe.
+ * expand_bucket is advanced under that stripe lock; operations on other
+ * stripes only compare against it to pick a table, and migration proceeds
+ * strictly in bucket order.
+ *
+ * Both the maintenance thread and mutating operations may call this
+ * concurrently; the frontier is re-read after the stripe lock is taken so
+ * the bucket is only migrated by whoever wins the stripe.
+ *
+ * Returns true if more buckets (may) remain to be migrated.
+ */
+static bool assoc_migrate_bucket(struct default_engine *engine) {
+    struct assoc *assoc = engine->assoc;
+    hash_item *it, *next;
+    unsigned int frontier;
+    int bucket;
+    bool finished;
+    cb_mutex_t *lock;
+
+    if (!assoc->expanding) {
+        return false;
+    }
+
+    lock = get_stripe_lock(assoc, assoc->expand_bucket);
+    cb_mutex_enter(lock);
+    if (!assoc->expanding ||
+        assoc->expand_bucket >= hashsize(assoc->old_hashpower)) {
+        /* expansion completed (or is being torn down) behind our back */
+        cb_mutex_exit(lock);
+        return false;
+    }
+    if (get_stripe_lock(assoc, assoc->expand_bucket) != lock) {
+        /* another migrator advanced the frontier to a different stripe
+         * while we waited for the lock; let the caller retry */
+        cb_mutex_exit(lock);
+        return true;
+    }
+
+    frontier = assoc->expand_bucket;
+    for (it = assoc->old_hashtable[frontier]; NULL != it; it = next) {
+        next = it->h_next;
+        /* no need to rehash the key; the hash rides along in the item */
+        bucket = it->khash & hashmask(assoc->hashpower);
+        it->h_next = assoc->primary_hashtable[bucket];
+        assoc->primary_hashtable[bucket] = it;
+    }
+
+    assoc->old_hashtable[frontier] = NULL;
+    assoc->expand_bucket++;
+    finished = (assoc->expand_bucket == hashsize(assoc->old_hashpower));
+    cb_mutex_exit(lock);
+
+    if (finished) {
+        /*
+         * Every bucket has been migrated, so no operation can reach the
+         * old table any more; take all of the stripe locks to flush out
+         * any in-flight probes before tearing it down.
+         */
+        assoc_lock_all(assoc);
+        assoc->expanding = false;
+        free_table(assoc->old_hashtable, assoc->old_mapped);
+        assoc->old_mapped = 0;
+        assoc_unlock_all(assoc);
+        {
+            EXTENSION_LOGGER_DESCRIPTOR *logger;
+            hrtime_t took = gethrtime() - assoc->expand_start;
+            logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+            logger->log(EXTENSION_LOG_NOTICE, NULL,
+                        "Hash table expansion to 2^%u buckets done in"
+                        " %" PRIu64 " ms\n",
+                        assoc->hashpower,
+                        (uint64_t)(took / 1000000));
+        }
+    }
+    return !finished;
+}
+
 static void assoc_maintenance_thread(void *arg) {
     struct default_engine *engine = arg;
-    bool done = false;
-    do {
+    bool more = true;
+    while (more) {
         int ii;
-        cb_mutex_enter(&engine->assoc->lock);
-
-        for (ii = 0; ii < hash_bulk_move && engine->assoc->expanding; ++ii) {
-            hash_item *it, *next;
-            int bucket;
-
-            for (it = engine->assoc->old_hashtable[engine->assoc->expand_bucket];
-                 NULL != it; it = next) {
-                next = it->h_next;
-                const hash_key* key = item_get_key(it);
-                bucket = crc32c(hash_key_get_key(key),
-                                hash_key_get_key_len(key),
-                                0) & hashmask(engine->assoc->hashpower);
-                it->h_next = engine->assoc->primary_hashtable[bucket];
-                engine->assoc->primary_hashtable[bucket] = it;
-            }
-
-            engine->assoc->old_hashtable[engine->assoc->expand_bucket] = NULL;
-            engine->assoc->expand_bucket++;
-            if (engine->assoc->expand_bucket == hashsize(engine->assoc->hashpower - 1)) {
-                engine->assoc->expanding = false;
-                cb_free(engine->assoc->old_hashtable);
-                if (engine->config.verbose > 1) {
-                    EXTENSION_LOGGER_DESCRIPTOR *logger;
-                    logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
-                    logger->log(EXTENSION_LOG_INFO, NULL,
-                                "Hash table expansion done\n");
-                }
-            }
+        for (ii = 0; ii < hash_bulk_move && more; ++ii) {
+            more = assoc_migrate_bucket(engine);
         }
-        if (!engine->assoc->expanding) {
-            done = true;
+        if (more) {
+            /* leave a window for foreground operations between batches */
+            usleep(50);
         }
-        cb_mutex_exit(&engine->assoc->lock);
-    } while (!done);
+    }
 }
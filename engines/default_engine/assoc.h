@@ -1,6 +1,16 @@
 #ifndef ASSOC_H
 #define ASSOC_H
 
+#include "hugepages.h"
+
+/*
+ * Number of bucket-region locks protecting the hash table. Must be a power
+ * of two, and must not exceed the number of buckets in the smallest table
+ * we'll ever probe (hashsize of the initial hashpower) so that a bucket and
+ * its image in the expanded table always share a stripe.
+ */
+#define ASSOC_NUM_STRIPES 256
+
 struct assoc {
    /* how many powers of 2's worth of buckets we use */
    unsigned int hashpower;
@@ -15,23 +25,62 @@ struct assoc {
     */
    hash_item** old_hashtable;
 
-   /* Number of items in the hash table. */
-   unsigned int hash_items;
+   /*
+    * The huge page size to request for table allocations, parsed from the
+    * engine config at init time (HUGEPAGE_NONE = use the normal heap).
+    */
+   enum hugepage_size huge_pages;
+
+   /*
+    * Mapping lengths when the tables are huge-page backed; 0 when the
+    * table came from the normal heap (see hugepages.h).
+    */
+   size_t primary_mapped;
+   size_t old_mapped;
+
+   /*
+    * Number of items hashed into each stripe. Each counter is only updated
+    * under its stripe lock; summing them gives the total table population.
+    */
+   unsigned int stripe_items[ASSOC_NUM_STRIPES];
 
    /* Flag: Are we in the middle of expanding now? */
    bool expanding;
 
+   /*
+    * hashpower of old_hashtable while an expansion is in flight. An
+    * expansion may grow the table by several powers of two in one go
+    * (see assoc_next_hashpower), so this is not simply hashpower - 1.
+    */
+   unsigned int old_hashpower;
+
    /*
     * During expansion we migrate values with bucket granularity; this is how
-    * far we've gotten so far. Ranges from 0 .. hashsize(hashpower - 1) - 1.
+    * far we've gotten so far. Ranges from 0 .. hashsize(old_hashpower) - 1.
     */
    unsigned int expand_bucket;
 
+   /*
+    * Table population and timestamp when the previous expansion was
+    * started (or the table created). The delta against the current
+    * values gives the observed insert rate, which sizes the next
+    * expansion so a steady load triggers one big expansion instead of
+    * a cascade of doublings.
+    */
+   unsigned int grow_items;
+   hrtime_t grow_time;
+
+   /* When the in-flight expansion started; for duration logging. */
+   hrtime_t expand_start;
+
 
    /*
-    * serialise access to the hashtable
+    * Each lock serialises access to the buckets whose index shares its low
+    * bits, so operations on independent bucket regions proceed in parallel.
+    * Structural changes (starting and finishing an expansion) are made while
+    * holding every stripe lock.
     */
-   cb_mutex_t lock;
+   cb_mutex_t stripe_locks[ASSOC_NUM_STRIPES];
 };
 
 /* associative array */
@@ -39,6 +88,26 @@ ENGINE_ERROR_CODE assoc_init(struct default_engine *engine);
 void assoc_destroy(void);
 hash_item *assoc_find(struct default_engine *engine, uint32_t hash,
                       const hash_key* key);
+/* As assoc_find, but looks up a non-owning key view so the caller
+   doesn't have to materialize a contiguous hash_key first. */
+hash_item *assoc_find_view(struct default_engine *engine, uint32_t hash,
+                           const hash_key_view* view);
+/* Lock-free peek at the head of the hash chain covering the given
+   hash, for optimistic readers. May spuriously return NULL (e.g. while
+   the table is expanding); the chain it returns may be mutated
+   concurrently, so the caller must validate whatever it reads (see
+   item_get_copy). */
+hash_item *assoc_peek(struct default_engine *engine, uint32_t hash);
+/* Hint that a lookup of the given hash is imminent; pulls the bucket
+   towards the cache without taking any locks. */
+void assoc_prefetch(struct default_engine *engine, uint32_t hash);
+/* Look up a whole batch (at most 64 entries), taking each stripe lock
+   at most once. items[ii] receives the result for keys[ii]/hashes[ii]. */
+void assoc_find_multi(struct default_engine *engine,
+                      const uint32_t *hashes,
+                      const hash_key_view *keys,
+                      hash_item **items,
+                      size_t count);
 int assoc_insert(struct default_engine *engine, uint32_t hash,
                  hash_item *item);
 void assoc_delete(struct default_engine *engine, uint32_t hash,
@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "default_engine_internal.h"
 #include "memcached/util.h"
@@ -16,6 +17,8 @@
 #include <platform/cb_malloc.h>
 #include "engines/default_engine.h"
 #include "engine_manager.h"
+#include "snapshot.h"
+#include "tier.h"
 
 static const engine_info* default_get_info(ENGINE_HANDLE* handle);
 static ENGINE_ERROR_CODE default_initialize(ENGINE_HANDLE* handle,
@@ -31,6 +34,52 @@ static ENGINE_ERROR_CODE default_item_allocate(ENGINE_HANDLE* handle,
                                                const int flags,
                                                const rel_time_t exptime,
                                                uint8_t datatype);
+static ENGINE_ERROR_CODE default_item_allocate_bulk(ENGINE_HANDLE* handle,
+                                                    const void* cookie,
+                                                    item_batch_entry* entries,
+                                                    size_t count);
+static ENGINE_ERROR_CODE default_store_bulk(ENGINE_HANDLE* handle,
+                                            const void* cookie,
+                                            item_batch_entry* entries,
+                                            size_t count,
+                                            ENGINE_STORE_OPERATION operation,
+                                            uint16_t vbucket);
+static ENGINE_ERROR_CODE default_append(ENGINE_HANDLE* handle,
+                                        const void* cookie,
+                                        const void* key,
+                                        const size_t nkey,
+                                        const void* data,
+                                        const size_t ndata,
+                                        uint64_t* cas,
+                                        bool prepend,
+                                        uint16_t vbucket);
+static ENGINE_ERROR_CODE default_patch(ENGINE_HANDLE* handle,
+                                       const void* cookie,
+                                       const void* key,
+                                       const size_t nkey,
+                                       const void* data,
+                                       const size_t ndata,
+                                       uint32_t offset,
+                                       uint64_t* cas,
+                                       uint16_t vbucket);
+static ENGINE_ERROR_CODE default_get_multi(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           item_get_entry* entries,
+                                           size_t count,
+                                           uint16_t vbucket);
+static ENGINE_ERROR_CODE default_remove_multi(ENGINE_HANDLE* handle,
+                                              const void* cookie,
+                                              item_remove_entry* entries,
+                                              size_t count,
+                                              uint16_t vbucket);
+static ENGINE_ERROR_CODE default_get_copy(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          const void* key,
+                                          size_t nkey,
+                                          void* buffer,
+                                          size_t buffsize,
+                                          item_info* info,
+                                          uint16_t vbucket);
 static ENGINE_ERROR_CODE default_item_delete(ENGINE_HANDLE* handle,
                                              const void* cookie,
                                              const void* key,
@@ -74,6 +123,26 @@ static ENGINE_ERROR_CODE default_arithmetic(ENGINE_HANDLE* handle,
                                             uint16_t vbucket);
 static ENGINE_ERROR_CODE default_flush(ENGINE_HANDLE* handle,
                                        const void* cookie, time_t when);
+static ENGINE_ERROR_CODE default_set_memory_target(ENGINE_HANDLE* handle,
+                                                   size_t target);
+static ENGINE_ERROR_CODE default_set_tier_config(ENGINE_HANDLE* handle,
+                                                 const engine_tier_config* config);
+static TAP_ITERATOR default_get_tap_iterator(ENGINE_HANDLE* handle,
+                                             const void* cookie,
+                                             const void* client,
+                                             size_t nclient,
+                                             uint32_t flags,
+                                             const void* userdata,
+                                             size_t nuserdata);
+static void handle_disconnect(const void* cookie,
+                              ENGINE_EVENT_TYPE type,
+                              const void* event_data,
+                              const void* cb_data);
+static ENGINE_ERROR_CODE default_exists_multi(ENGINE_HANDLE* handle,
+                                              const void* cookie,
+                                              item_exist_entry* entries,
+                                              size_t count,
+                                              uint16_t vbucket);
 static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
                                                  const char *cfg_str);
 static ENGINE_ERROR_CODE default_unknown_command(ENGINE_HANDLE* handle,
@@ -110,6 +179,44 @@ static bool handled_vbucket(struct default_engine *e, uint16_t vbid) {
 /* mechanism for handling bad vbucket requests */
 #define VBUCKET_GUARD(e, v) if (!handled_vbucket(e, v)) { return ENGINE_NOT_MY_VBUCKET; }
 
+/*
+ * Key-hash shard routing (the "shards" config item, default 1).
+ *
+ * With shards=N the engine created by the bucket is just a router;
+ * every key belongs to exactly one of N complete inner engines, so
+ * the cache lock, hash table and LRU scale with N instead of being
+ * shared by every worker thread hitting the bucket. The shard index
+ * comes from the high half of the same crc32c the assoc layer hashes
+ * with, keeping it decorrelated from the stripe/bucket selection
+ * inside the shard (which uses the low bits).
+ */
+size_t default_engine_shard_index(struct default_engine* engine,
+                                  const void* key, size_t nkey) {
+    if (engine->nshards == 0) {
+        return 0;
+    }
+    return (crc32c((const uint8_t*)key, nkey, 0) >> 16) % engine->nshards;
+}
+
+static struct default_engine* shard_for(struct default_engine* e,
+                                        const void* key, size_t nkey) {
+    if (e->nshards == 0) {
+        return e;
+    }
+    return e->shard[default_engine_shard_index(e, key, nkey)];
+}
+
+static struct default_engine* shard_for_item(struct default_engine* e,
+                                             const hash_item* it) {
+    const hash_key* key;
+    if (e->nshards == 0) {
+        return e;
+    }
+    key = item_get_key(it);
+    return shard_for(e, hash_key_get_client_key(key),
+                     hash_key_get_client_key_len(key));
+}
+
 static bool get_item_info(ENGINE_HANDLE *handle, const void *cookie,
                           const item* item, item_info *item_info);
 
@@ -135,6 +242,10 @@ void default_engine_constructor(struct default_engine* engine, bucket_id_t id)
     cb_mutex_initialize(&engine->items.lock);
     cb_mutex_initialize(&engine->stats.lock);
     cb_mutex_initialize(&engine->scrubber.lock);
+    cb_mutex_initialize(&engine->reaper.lock);
+    cb_mutex_initialize(&engine->snapshot.lock);
+    cb_mutex_initialize(&engine->tier.lock);
+    cb_cond_initialize(&engine->tier.cond);
 
     engine->bucket_id = id;
     engine->engine.interface.interface = 1;
@@ -154,15 +265,33 @@ void default_engine_constructor(struct default_engine* engine, bucket_id_t id)
     engine->engine.item_set_cas = item_set_cas;
     engine->engine.get_item_info = get_item_info;
     engine->engine.set_item_info = set_item_info;
+    engine->engine.allocate_bulk = default_item_allocate_bulk;
+    engine->engine.store_bulk = default_store_bulk;
+    engine->engine.append = default_append;
+    engine->engine.get_multi = default_get_multi;
+    engine->engine.remove_multi = default_remove_multi;
+    engine->engine.get_copy = default_get_copy;
+    engine->engine.set_memory_target = default_set_memory_target;
+    engine->engine.exists_multi = default_exists_multi;
+    engine->engine.patch = default_patch;
+    engine->engine.set_tier_config = default_set_tier_config;
+    engine->engine.get_tap_iterator = default_get_tap_iterator;
     engine->config.use_cas = true;
     engine->config.verbose = 0;
-    engine->config.oldest_live = 0;
     engine->config.evict_to_free = true;
     engine->config.maxbytes = 64 * 1024 * 1024;
     engine->config.preallocate = false;
     engine->config.factor = 1.25;
     engine->config.chunk_size = 48;
     engine->config.item_size_max= 1024 * 1024;
+    engine->config.snapshot_interval = 600;
+    engine->config.compress_threshold = 2048;
+    engine->config.chunk_threshold = 512 * 1024;
+    engine->config.shards = 1;
+    engine->config.scrub_step = 200;
+    engine->config.scrub_sleep = 0;
+    engine->config.initial_hashpower = 16;
+    engine->config.dedup_min_size = 64;
     engine->info.engine.description = "Default engine v0.1";
     engine->info.engine.num_features = 1;
     engine->info.engine.features[0].feature = ENGINE_FEATURE_LRU;
@@ -208,6 +337,89 @@ static const engine_info* default_get_info(ENGINE_HANDLE* handle) {
     return &get_handle(handle)->info.engine;
 }
 
+/*
+ * Create and initialize the internal key-hash shards. Each shard is a
+ * complete engine instance registered with the engine manager (so the
+ * expiry reaper ticks it like any other engine) and owns a 1/N slice
+ * of the memory budget. Snapshots stay disabled inside the shards;
+ * they would all race over the single configured segment file.
+ */
+static ENGINE_ERROR_CODE initialize_shards(struct default_engine *se) {
+   const size_t nshards = se->config.shards;
+   size_t ii;
+
+   se->shard = cb_calloc(nshards, sizeof(struct default_engine *));
+   if (se->shard == NULL) {
+      return ENGINE_ENOMEM;
+   }
+
+   for (ii = 0; ii < nshards; ++ii) {
+      struct default_engine *shard = engine_manager_create_engine();
+      ENGINE_ERROR_CODE ret;
+
+      if (shard == NULL) {
+         return ENGINE_ENOMEM;
+      }
+      shard->server = se->server;
+      shard->get_server_api = se->get_server_api;
+
+      /* Inherit the router's parsed configuration with a slice of the
+         memory budget. The string members stay owned by the router
+         (huge_pages is only ever read, never freed, so sharing the
+         pointer is fine; eviction_policy is freed on teardown and
+         must be duplicated). */
+      shard->config = se->config;
+      shard->config.shards = 1;
+      shard->config.maxbytes = se->config.maxbytes / nshards;
+      shard->config.uuid = NULL;
+      shard->config.snapshot_file = NULL;
+      shard->config.snapshot_interval = 0;
+      if (se->config.eviction_policy != NULL) {
+         shard->config.eviction_policy = cb_strdup(se->config.eviction_policy);
+         if (shard->config.eviction_policy == NULL) {
+            engine_manager_delete_engine(shard);
+            return ENGINE_ENOMEM;
+         }
+      }
+
+      /* Publish the shard before initializing it so a failure below
+         still gets it torn down with the router */
+      se->shard[ii] = shard;
+      se->nshards = ii + 1;
+
+      ret = assoc_init(shard);
+      if (ret != ENGINE_SUCCESS) {
+         return ret;
+      }
+
+      ret = slabs_init(shard, shard->config.maxbytes, shard->config.factor,
+                       shard->config.preallocate);
+      if (ret != ENGINE_SUCCESS) {
+         return ret;
+      }
+
+      ret = item_eviction_policy_init(shard);
+      if (ret != ENGINE_SUCCESS) {
+         return ret;
+      }
+
+      ret = item_exists_filter_init(shard);
+      if (ret != ENGINE_SUCCESS) {
+         return ret;
+      }
+
+      ret = item_dedup_init(shard);
+      if (ret != ENGINE_SUCCESS) {
+         return ret;
+      }
+
+      shard->items.expiry_current = shard->server.core->get_current_time();
+      shard->initialized = true;
+   }
+
+   return ENGINE_SUCCESS;
+}
+
 static ENGINE_ERROR_CODE default_initialize(ENGINE_HANDLE* handle,
                                             const char* config_str) {
    struct default_engine* se = get_handle(handle);
@@ -221,6 +433,28 @@ static ENGINE_ERROR_CODE default_initialize(ENGINE_HANDLE* handle,
        se->info.engine.features[se->info.engine.num_features++].feature = ENGINE_FEATURE_CAS;
    }
 
+   /* A client may disconnect half way through a TAP dump; its walk
+      cursor has to come back out of whichever LRU it is spliced
+      into. */
+   se->server.callback->register_callback((ENGINE_HANDLE*)se, ON_DISCONNECT,
+                                          handle_disconnect, se);
+
+   if (se->config.shards > 1) {
+      ret = initialize_shards(se);
+      if (ret != ENGINE_SUCCESS) {
+         return ret;
+      }
+
+      /* The batched entry points assume a single cache-lock domain;
+         leaving them NULL makes the core fall back to the (routed)
+         per-key calls */
+      se->engine.allocate_bulk = NULL;
+      se->engine.store_bulk = NULL;
+      se->engine.get_multi = NULL;
+      se->engine.remove_multi = NULL;
+      return ENGINE_SUCCESS;
+   }
+
    ret = assoc_init(se);
    if (ret != ENGINE_SUCCESS) {
       return ret;
@@ -232,6 +466,32 @@ static ENGINE_ERROR_CODE default_initialize(ENGINE_HANDLE* handle,
       return ret;
    }
 
+   ret = item_eviction_policy_init(se);
+   if (ret != ENGINE_SUCCESS) {
+      return ret;
+   }
+
+   ret = item_exists_filter_init(se);
+   if (ret != ENGINE_SUCCESS) {
+      return ret;
+   }
+
+   ret = item_dedup_init(se);
+   if (ret != ENGINE_SUCCESS) {
+      return ret;
+   }
+
+   /* Start the expiry wheel at the current second so a bucket created
+      late in the process's life doesn't have to replay the whole time
+      since startup on its first reaper tick. Must happen before any
+      item can be linked. */
+   se->items.expiry_current = se->server.core->get_current_time();
+
+   /* Warm the cache from the previous run's snapshot segment (if one
+      is configured and present). A bad segment is logged and ignored;
+      starting cold is always safe. */
+   item_snapshot_restore(se);
+
    return ENGINE_SUCCESS;
 }
 
@@ -241,17 +501,45 @@ static void default_destroy(ENGINE_HANDLE* handle, const bool force) {
 }
 
 void destroy_engine_instance(struct default_engine* engine) {
+    if (engine->nshards > 0) {
+        /* Hand every shard back to the engine manager. We're either on
+           the scrubber thread (which holds no locks while destroying
+           an engine) or in shutdown, so queueing more work is safe;
+           the router itself never initialized its own cache and falls
+           through to the trivial teardown below. */
+        size_t ii;
+        for (ii = 0; ii < engine->nshards; ++ii) {
+            engine_manager_delete_engine(engine->shard[ii]);
+        }
+        cb_free(engine->shard);
+        engine->shard = NULL;
+        engine->nshards = 0;
+    }
+
     if (engine->initialized) {
+        /* Stop the tier thread first; it may still be storing fetched
+           documents into the cache we're about to tear down */
+        item_tier_destroy(engine);
+
         /* Destory the slabs cache */
         slabs_destroy(engine);
 
         cb_free(engine->config.uuid);
+        cb_free(engine->config.snapshot_file);
+        cb_free(engine->config.eviction_policy);
+        item_eviction_policy_destroy(engine);
+        item_exists_filter_destroy(engine);
+        item_dedup_destroy(engine);
 
         /* Clean up the mutexes */
         cb_mutex_destroy(&engine->items.lock);
         cb_mutex_destroy(&engine->stats.lock);
         cb_mutex_destroy(&engine->slabs.lock);
         cb_mutex_destroy(&engine->scrubber.lock);
+        cb_mutex_destroy(&engine->reaper.lock);
+        cb_mutex_destroy(&engine->snapshot.lock);
+        cb_mutex_destroy(&engine->tier.lock);
+        cb_cond_destroy(&engine->tier.cond);
 
         engine->initialized = false;
     }
@@ -283,6 +571,7 @@ static ENGINE_ERROR_CODE default_item_allocate(ENGINE_HANDLE* handle,
       return ENGINE_E2BIG;
    }
 
+   engine = shard_for(engine, key, nkey);
    it = item_alloc(engine, key, nkey, flags, engine->server.core->realtime(exptime),
                    (uint32_t)nbytes, cookie, datatype);
 
@@ -294,6 +583,52 @@ static ENGINE_ERROR_CODE default_item_allocate(ENGINE_HANDLE* handle,
    }
 }
 
+static ENGINE_ERROR_CODE default_item_allocate_bulk(ENGINE_HANDLE* handle,
+                                                    const void* cookie,
+                                                    item_batch_entry* entries,
+                                                    size_t count) {
+   struct default_engine* engine = get_handle(handle);
+   size_t ii;
+
+   /* validate every entry up front; item_alloc_bulk skips the failures */
+   for (ii = 0; ii < count; ++ii) {
+      item_batch_entry* entry = &entries[ii];
+      size_t ntotal = sizeof(hash_item) + entry->nkey + entry->nbytes;
+      if (engine->config.use_cas) {
+         ntotal += sizeof(uint64_t);
+      }
+
+      entry->item = NULL;
+      if (slabs_clsid(engine, ntotal) == 0 ||
+          entry->nbytes > engine->config.item_size_max) {
+         entry->status = ENGINE_E2BIG;
+      } else {
+         entry->status = ENGINE_SUCCESS;
+         entry->exptime = engine->server.core->realtime(entry->exptime);
+      }
+   }
+
+   item_alloc_bulk(engine, entries, count, cookie);
+   return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE default_store_bulk(ENGINE_HANDLE* handle,
+                                            const void* cookie,
+                                            item_batch_entry* entries,
+                                            size_t count,
+                                            ENGINE_STORE_OPERATION operation,
+                                            uint16_t vbucket) {
+   struct default_engine* engine = get_handle(handle);
+   size_t ii;
+   VBUCKET_GUARD(engine, vbucket);
+
+   for (ii = 0; ii < count; ++ii) {
+      entries[ii].status = ENGINE_SUCCESS;
+   }
+   store_item_bulk(engine, entries, count, operation, cookie);
+   return ENGINE_SUCCESS;
+}
+
 static ENGINE_ERROR_CODE default_item_delete(ENGINE_HANDLE* handle,
                                              const void* cookie,
                                              const void* key,
@@ -307,6 +642,7 @@ static ENGINE_ERROR_CODE default_item_delete(ENGINE_HANDLE* handle,
 
    VBUCKET_GUARD(engine, vbucket);
 
+   engine = shard_for(engine, key, nkey);
    it = item_get(engine, cookie, key, nkey);
    if (it == NULL) {
       return ENGINE_KEY_ENOENT;
@@ -331,7 +667,8 @@ static ENGINE_ERROR_CODE default_item_delete(ENGINE_HANDLE* handle,
 static void default_item_release(ENGINE_HANDLE* handle,
                                  const void *cookie,
                                  item* item) {
-   item_release(get_handle(handle), get_real_item(item));
+   hash_item* it = get_real_item(item);
+   item_release(shard_for_item(get_handle(handle), it), it);
 }
 
 static ENGINE_ERROR_CODE default_get(ENGINE_HANDLE* handle,
@@ -343,12 +680,265 @@ static ENGINE_ERROR_CODE default_get(ENGINE_HANDLE* handle,
    struct default_engine *engine = get_handle(handle);
    VBUCKET_GUARD(engine, vbucket);
 
+   engine = shard_for(engine, key, nkey);
    *item = item_get(engine, cookie, key, nkey);
    if (*item != NULL) {
       return ENGINE_SUCCESS;
+   }
+   if (item_tier_fetch(engine, cookie, key, nkey)) {
+      /* the tier thread resolves the miss against the external store
+         and wakes the connection back up via notify_io_complete */
+      return ENGINE_EWOULDBLOCK;
+   }
+   return ENGINE_KEY_ENOENT;
+}
+
+static ENGINE_ERROR_CODE default_get_multi(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           item_get_entry* entries,
+                                           size_t count,
+                                           uint16_t vbucket) {
+   struct default_engine *engine = get_handle(handle);
+   VBUCKET_GUARD(engine, vbucket);
+
+   item_get_multi(engine, cookie, entries, count);
+   return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE default_remove_multi(ENGINE_HANDLE* handle,
+                                              const void* cookie,
+                                              item_remove_entry* entries,
+                                              size_t count,
+                                              uint16_t vbucket) {
+   struct default_engine *engine = get_handle(handle);
+   VBUCKET_GUARD(engine, vbucket);
+
+   item_remove_multi(engine, entries, count);
+   return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE default_exists_multi(ENGINE_HANDLE* handle,
+                                              const void* cookie,
+                                              item_exist_entry* entries,
+                                              size_t count,
+                                              uint16_t vbucket) {
+   struct default_engine *engine = get_handle(handle);
+   VBUCKET_GUARD(engine, vbucket);
+
+   if (engine->nshards > 0) {
+      /* Unlike the other batched entry points an existence probe
+         carries no item state across calls, so the batch can simply
+         be routed entry by entry; the per-shard filters still answer
+         the misses without any lock */
+      size_t ii;
+      for (ii = 0; ii < count; ++ii) {
+         struct default_engine *shard =
+             shard_for(engine, entries[ii].key, entries[ii].nkey);
+         entries[ii].status = item_exists(shard, entries[ii].key,
+                                          entries[ii].nkey,
+                                          &entries[ii].cas);
+      }
+      return ENGINE_SUCCESS;
+   }
+
+   item_exists_multi(engine, entries, count);
+   return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE default_get_copy(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          const void* key,
+                                          size_t nkey,
+                                          void* buffer,
+                                          size_t buffsize,
+                                          item_info* info,
+                                          uint16_t vbucket) {
+   struct default_engine *engine = get_handle(handle);
+   VBUCKET_GUARD(engine, vbucket);
+
+   engine = shard_for(engine, key, nkey);
+   if (item_get_copy(engine, key, nkey, buffer, buffsize, info)) {
+      return ENGINE_SUCCESS;
+   }
+   /* not an authoritative miss; the caller falls back to get() */
+   return ENGINE_ENOTSUP;
+}
+
+/*
+ * Stats for a sharded engine. The top level counters (and the scrub
+ * and reaper groups) are summed over the shards; the detailed groups
+ * (slabs/items/sizes/expiry) are emitted once per shard - the keys
+ * repeat, which keeps each shard's slab geometry visible instead of
+ * mashing different class layouts together.
+ */
+static ENGINE_ERROR_CODE sharded_get_stats(struct default_engine* engine,
+                                           const void* cookie,
+                                           const char* stat_key,
+                                           ADD_STAT add_stat)
+{
+   ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+   char val[128];
+   int len;
+   size_t ii;
+
+   if (stat_key == NULL) {
+      uint64_t evictions = 0;
+      uint64_t curr_items = 0;
+      uint64_t total_items = 0;
+      uint64_t curr_bytes = 0;
+      uint64_t reclaimed = 0;
+
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         struct default_engine* shard = engine->shard[ii];
+         cb_mutex_enter(&shard->stats.lock);
+         evictions += shard->stats.evictions;
+         curr_items += shard->stats.curr_items;
+         total_items += shard->stats.total_items;
+         curr_bytes += shard->stats.curr_bytes;
+         reclaimed += shard->stats.reclaimed;
+         cb_mutex_exit(&shard->stats.lock);
+      }
+
+      len = sprintf(val, "%"PRIu64, evictions);
+      add_stat("evictions", 9, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, curr_items);
+      add_stat("curr_items", 10, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, total_items);
+      add_stat("total_items", 11, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, curr_bytes);
+      add_stat("bytes", 5, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, reclaimed);
+      add_stat("reclaimed", 9, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, (uint64_t)engine->config.maxbytes);
+      add_stat("engine_maxbytes", 15, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, (uint64_t)engine->nshards);
+      add_stat("shards", 6, val, len, cookie);
+   } else if (strncmp(stat_key, "slabs", 5) == 0) {
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         slabs_stats(engine->shard[ii], add_stat, cookie);
+      }
+   } else if (strncmp(stat_key, "items", 5) == 0) {
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         item_stats(engine->shard[ii], add_stat, cookie);
+      }
+   } else if (strncmp(stat_key, "sizes", 5) == 0) {
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         item_stats_sizes(engine->shard[ii], add_stat, cookie);
+      }
+   } else if (strncmp(stat_key, "uuid", 4) == 0) {
+      if (engine->config.uuid) {
+         add_stat("uuid", 4, engine->config.uuid,
+                  (uint32_t)strlen(engine->config.uuid), cookie);
+      } else {
+         add_stat("uuid", 4, "", 0, cookie);
+      }
+   } else if (strncmp(stat_key, "scrub", 5) == 0) {
+      uint64_t visited = 0;
+      uint64_t cleaned = 0;
+      uint64_t total = 0;
+      time_t started = 0;
+      bool running = false;
+
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         struct default_engine* shard = engine->shard[ii];
+         cb_mutex_enter(&shard->scrubber.lock);
+         visited += shard->scrubber.visited;
+         cleaned += shard->scrubber.cleaned;
+         if (shard->scrubber.running) {
+            running = true;
+            total += shard->scrubber.total;
+            if (started == 0 || shard->scrubber.started < started) {
+               started = shard->scrubber.started;
+            }
+         }
+         cb_mutex_exit(&shard->scrubber.lock);
+      }
+
+      if (running) {
+         add_stat("scrubber:status", 15, "running", 7, cookie);
+      } else {
+         add_stat("scrubber:status", 15, "stopped", 7, cookie);
+      }
+      len = sprintf(val, "%"PRIu64, visited);
+      add_stat("scrubber:visited", 16, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, cleaned);
+      add_stat("scrubber:cleaned", 16, val, len, cookie);
+      if (running && total > 0) {
+         uint64_t pct = visited * 100 / total;
+         uint64_t elapsed = (uint64_t)(time(NULL) - started);
+         len = sprintf(val, "%"PRIu64, pct > 100 ? 100 : pct);
+         add_stat("scrubber:progress", 17, val, len, cookie);
+         if (visited > 0 && visited < total) {
+            len = sprintf(val, "%"PRIu64,
+                          elapsed * (total - visited) / visited);
+            add_stat("scrubber:eta", 12, val, len, cookie);
+         }
+      }
+   } else if (strncmp(stat_key, "reaper", 6) == 0) {
+      uint64_t visited = 0;
+      uint64_t reaped = 0;
+      uint64_t reaped_bytes = 0;
+
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         struct default_engine* shard = engine->shard[ii];
+         cb_mutex_enter(&shard->reaper.lock);
+         visited += shard->reaper.visited;
+         reaped += shard->reaper.reaped;
+         reaped_bytes += shard->reaper.reaped_bytes;
+         cb_mutex_exit(&shard->reaper.lock);
+      }
+
+      len = sprintf(val, "%"PRIu64, visited);
+      add_stat("reaper:visited", 14, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, reaped);
+      add_stat("reaper:reaped", 13, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, reaped_bytes);
+      add_stat("reaper:reaped_bytes", 19, val, len, cookie);
+   } else if (strncmp(stat_key, "tier", 4) == 0) {
+      uint64_t fetches = 0;
+      uint64_t fetch_hits = 0;
+      uint64_t fetch_misses = 0;
+      uint64_t fetch_errors = 0;
+      uint64_t writebacks = 0;
+
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         struct default_engine* shard = engine->shard[ii];
+         cb_mutex_enter(&shard->tier.lock);
+         fetches += shard->tier.fetches;
+         fetch_hits += shard->tier.fetch_hits;
+         fetch_misses += shard->tier.fetch_misses;
+         fetch_errors += shard->tier.fetch_errors;
+         writebacks += shard->tier.writebacks;
+         cb_mutex_exit(&shard->tier.lock);
+      }
+
+      len = sprintf(val, "%"PRIu64, fetches);
+      add_stat("tier:fetches", 12, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, fetch_hits);
+      add_stat("tier:fetch_hits", 15, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, fetch_misses);
+      add_stat("tier:fetch_misses", 17, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, fetch_errors);
+      add_stat("tier:fetch_errors", 17, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, writebacks);
+      add_stat("tier:writebacks", 15, val, len, cookie);
+   } else if (strncmp(stat_key, "expiry", 6) == 0) {
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         item_stats_expiry(engine->shard[ii], add_stat, cookie);
+      }
+   } else if (strncmp(stat_key, "snapshot", 8) == 0) {
+      /* snapshots are unsupported when sharding; bulk imports still
+         work (they route per shard) and are counted on the router */
+      add_stat("snapshot:status", 15, "disabled", 8, cookie);
+      cb_mutex_enter(&engine->snapshot.lock);
+      len = sprintf(val, "%"PRIu64, engine->snapshot.imported);
+      add_stat("snapshot:imported", 17, val, len, cookie);
+      cb_mutex_exit(&engine->snapshot.lock);
    } else {
-      return ENGINE_KEY_ENOENT;
+      ret = ENGINE_KEY_ENOENT;
    }
+
+   return ret;
 }
 
 static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
@@ -360,6 +950,10 @@ static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
    struct default_engine* engine = get_handle(handle);
    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
 
+   if (engine->nshards > 0) {
+      return sharded_get_stats(engine, cookie, stat_key, add_stat);
+   }
+
    if (stat_key == NULL) {
       char val[128];
       int len;
@@ -413,8 +1007,75 @@ static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
          add_stat("scrubber:visited", 16, val, len, cookie);
          len = sprintf(val, "%"PRIu64, engine->scrubber.cleaned);
          add_stat("scrubber:cleaned", 16, val, len, cookie);
+
+         if (engine->scrubber.running && engine->scrubber.total > 0) {
+            uint64_t visited = engine->scrubber.visited;
+            uint64_t total = engine->scrubber.total;
+            uint64_t pct = visited * 100 / total;
+            uint64_t elapsed = (uint64_t)(time(NULL) -
+                                          engine->scrubber.started);
+            len = sprintf(val, "%"PRIu64, pct > 100 ? 100 : pct);
+            add_stat("scrubber:progress", 17, val, len, cookie);
+            if (visited > 0 && visited < total) {
+               len = sprintf(val, "%"PRIu64,
+                             elapsed * (total - visited) / visited);
+               add_stat("scrubber:eta", 12, val, len, cookie);
+            }
+         }
       }
       cb_mutex_exit(&engine->scrubber.lock);
+   } else if (strncmp(stat_key, "reaper", 6) == 0) {
+      char val[128];
+      int len;
+
+      cb_mutex_enter(&engine->reaper.lock);
+      len = sprintf(val, "%"PRIu64, engine->reaper.visited);
+      add_stat("reaper:visited", 14, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->reaper.reaped);
+      add_stat("reaper:reaped", 13, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->reaper.reaped_bytes);
+      add_stat("reaper:reaped_bytes", 19, val, len, cookie);
+      cb_mutex_exit(&engine->reaper.lock);
+   } else if (strncmp(stat_key, "tier", 4) == 0) {
+      char val[128];
+      int len;
+
+      cb_mutex_enter(&engine->tier.lock);
+      len = sprintf(val, "%"PRIu64, engine->tier.fetches);
+      add_stat("tier:fetches", 12, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->tier.fetch_hits);
+      add_stat("tier:fetch_hits", 15, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->tier.fetch_misses);
+      add_stat("tier:fetch_misses", 17, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->tier.fetch_errors);
+      add_stat("tier:fetch_errors", 17, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->tier.writebacks);
+      add_stat("tier:writebacks", 15, val, len, cookie);
+      cb_mutex_exit(&engine->tier.lock);
+   } else if (strncmp(stat_key, "expiry", 6) == 0) {
+      item_stats_expiry(engine, add_stat, cookie);
+   } else if (strncmp(stat_key, "snapshot", 8) == 0) {
+      char val[128];
+      int len;
+
+      cb_mutex_enter(&engine->snapshot.lock);
+      if (engine->snapshot.running) {
+         add_stat("snapshot:status", 15, "running", 7, cookie);
+      } else {
+         add_stat("snapshot:status", 15, "stopped", 7, cookie);
+      }
+
+      if (engine->snapshot.last_stop != 0) {
+         len = sprintf(val, "%"PRIu64, (uint64_t)engine->snapshot.last_stop);
+         add_stat("snapshot:last_run", 17, val, len, cookie);
+         len = sprintf(val, "%"PRIu64, engine->snapshot.saved);
+         add_stat("snapshot:saved", 14, val, len, cookie);
+      }
+      len = sprintf(val, "%"PRIu64, engine->snapshot.restored);
+      add_stat("snapshot:restored", 17, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->snapshot.imported);
+      add_stat("snapshot:imported", 17, val, len, cookie);
+      cb_mutex_exit(&engine->snapshot.lock);
    } else {
       ret = ENGINE_KEY_ENOENT;
    }
@@ -430,8 +1091,38 @@ static ENGINE_ERROR_CODE default_store(ENGINE_HANDLE* handle,
                                        uint16_t vbucket) {
     struct default_engine *engine = get_handle(handle);
     VBUCKET_GUARD(engine, vbucket);
-    return store_item(engine, get_real_item(item), cas, operation,
-                      cookie);
+    return store_item(shard_for_item(engine, get_real_item(item)),
+                      get_real_item(item), cas, operation, cookie);
+}
+
+static ENGINE_ERROR_CODE default_append(ENGINE_HANDLE* handle,
+                                        const void* cookie,
+                                        const void* key,
+                                        const size_t nkey,
+                                        const void* data,
+                                        const size_t ndata,
+                                        uint64_t* cas,
+                                        bool prepend,
+                                        uint16_t vbucket) {
+    struct default_engine *engine = get_handle(handle);
+    VBUCKET_GUARD(engine, vbucket);
+    engine = shard_for(engine, key, nkey);
+    return item_append(engine, cookie, key, nkey, data, ndata, cas, prepend);
+}
+
+static ENGINE_ERROR_CODE default_patch(ENGINE_HANDLE* handle,
+                                       const void* cookie,
+                                       const void* key,
+                                       const size_t nkey,
+                                       const void* data,
+                                       const size_t ndata,
+                                       uint32_t offset,
+                                       uint64_t* cas,
+                                       uint16_t vbucket) {
+    struct default_engine *engine = get_handle(handle);
+    VBUCKET_GUARD(engine, vbucket);
+    engine = shard_for(engine, key, nkey);
+    return item_patch(engine, cookie, key, nkey, data, ndata, offset, cas);
 }
 
 static ENGINE_ERROR_CODE default_arithmetic(ENGINE_HANDLE* handle,
@@ -450,6 +1141,7 @@ static ENGINE_ERROR_CODE default_arithmetic(ENGINE_HANDLE* handle,
    struct default_engine *engine = get_handle(handle);
    VBUCKET_GUARD(engine, vbucket);
 
+   engine = shard_for(engine, key, nkey);
    return arithmetic(engine, cookie, key, nkey, increment,
                      create, delta, initial, engine->server.core->realtime(exptime),
                      item, datatype, result);
@@ -457,14 +1149,22 @@ static ENGINE_ERROR_CODE default_arithmetic(ENGINE_HANDLE* handle,
 
 static ENGINE_ERROR_CODE default_flush(ENGINE_HANDLE* handle,
                                        const void* cookie, time_t when) {
+   struct default_engine *engine = get_handle(handle);
+   size_t ii;
    (void)when;
-   item_flush_expired(get_handle(handle));
+
+   if (engine->nshards > 0) {
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         item_flush_expired(engine->shard[ii]);
+      }
+   } else {
+      item_flush_expired(engine);
+   }
 
    return ENGINE_SUCCESS;
 }
 
-static void default_reset_stats(ENGINE_HANDLE* handle, const void *cookie) {
-   struct default_engine *engine = get_handle(handle);
+static void reset_engine_stats(struct default_engine *engine) {
    item_stats_reset(engine);
 
    cb_mutex_enter(&engine->stats.lock);
@@ -474,6 +1174,101 @@ static void default_reset_stats(ENGINE_HANDLE* handle, const void *cookie) {
    cb_mutex_exit(&engine->stats.lock);
 }
 
+static void default_reset_stats(ENGINE_HANDLE* handle, const void *cookie) {
+   struct default_engine *engine = get_handle(handle);
+
+   if (engine->nshards > 0) {
+      size_t ii;
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         reset_engine_stats(engine->shard[ii]);
+      }
+   } else {
+      reset_engine_stats(engine);
+   }
+}
+
+static ENGINE_ERROR_CODE default_set_memory_target(ENGINE_HANDLE* handle,
+                                                   size_t target) {
+   struct default_engine *engine = get_handle(handle);
+
+   if (engine->nshards > 0) {
+      /* hand every shard its slice, mirroring the maxbytes split */
+      size_t ii;
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         slabs_set_rss_target(engine->shard[ii], target / engine->nshards);
+      }
+   } else {
+      slabs_set_rss_target(engine, target);
+   }
+
+   return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE default_set_tier_config(ENGINE_HANDLE* handle,
+                                                 const engine_tier_config* config) {
+   struct default_engine *engine = get_handle(handle);
+
+   if (config == NULL) {
+      return ENGINE_EINVAL;
+   }
+
+   if (engine->nshards > 0) {
+      /* Each shard runs its own tier thread: fetches and write-backs
+         address exactly one shard, so they are independent, and a slow
+         fetch against one shard doesn't delay the others. */
+      size_t ii;
+      for (ii = 0; ii < engine->nshards; ++ii) {
+         ENGINE_ERROR_CODE ret = item_tier_set_config(engine->shard[ii],
+                                                      config);
+         if (ret != ENGINE_SUCCESS) {
+            return ret;
+         }
+      }
+      return ENGINE_SUCCESS;
+   }
+
+   return item_tier_set_config(engine, config);
+}
+
+/*
+ * Snapshot-consistent full-bucket export (TAP dump). The walker
+ * captures a point-in-time boundary from the item sequence epoch and
+ * streams every item which existed at the capture through the core's
+ * ship-log state (which applies the ship_log_byte_limit backfill
+ * shaping); items created or replaced afterwards are left out. Only
+ * the plain dump is supported - registered streams, backfill-by-date
+ * and vbucket takeover belong to a full replication engine.
+ */
+static TAP_ITERATOR default_get_tap_iterator(ENGINE_HANDLE* handle,
+                                             const void* cookie,
+                                             const void* client,
+                                             size_t nclient,
+                                             uint32_t flags,
+                                             const void* userdata,
+                                             size_t nuserdata) {
+   struct default_engine* engine = get_handle(handle);
+   (void)client; (void)nclient; (void)userdata; (void)nuserdata;
+
+   if ((flags & ~(uint32_t)TAP_CONNECT_FLAG_DUMP) != 0) {
+      return NULL;
+   }
+
+   if (!initialize_item_tap_walker(engine, cookie)) {
+      return NULL;
+   }
+
+   return item_tap_walker;
+}
+
+static void handle_disconnect(const void* cookie,
+                              ENGINE_EVENT_TYPE type,
+                              const void* event_data,
+                              const void* cb_data) {
+   struct default_engine* engine = (struct default_engine*)cb_data;
+   (void)type; (void)event_data;
+   cleanup_item_tap_walker(engine, cookie);
+}
+
 static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
                                                  const char *cfg_str) {
    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
@@ -481,7 +1276,7 @@ static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
    se->config.vb0 = true;
 
    if (cfg_str != NULL) {
-       struct config_item items[13];
+       struct config_item items[28];
        int ii = 0;
 
        memset(&items, 0, sizeof(items));
@@ -544,9 +1339,84 @@ static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
        items[ii].value.dt_string = &se->config.uuid;
        ++ii;
 
+       items[ii].key = "snapshot_file";
+       items[ii].datatype = DT_STRING;
+       items[ii].value.dt_string = &se->config.snapshot_file;
+       ++ii;
+
+       items[ii].key = "snapshot_interval";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.snapshot_interval;
+       ++ii;
+
+       items[ii].key = "compression";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.compression;
+       ++ii;
+
+       items[ii].key = "compress_threshold";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.compress_threshold;
+       ++ii;
+
+       items[ii].key = "chunk_threshold";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.chunk_threshold;
+       ++ii;
+
+       items[ii].key = "eviction_policy";
+       items[ii].datatype = DT_STRING;
+       items[ii].value.dt_string = &se->config.eviction_policy;
+       ++ii;
+
+       items[ii].key = "huge_pages";
+       items[ii].datatype = DT_STRING;
+       items[ii].value.dt_string = &se->config.huge_pages;
+       ++ii;
+
+       items[ii].key = "shards";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.shards;
+       ++ii;
+
+       items[ii].key = "scrub_step";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.scrub_step;
+       ++ii;
+
+       items[ii].key = "scrub_sleep";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.scrub_sleep;
+       ++ii;
+
+       items[ii].key = "initial_hashpower";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.initial_hashpower;
+       ++ii;
+
+       items[ii].key = "integrity_check";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.integrity_check;
+       ++ii;
+
+       items[ii].key = "exists_filter";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.exists_filter;
+       ++ii;
+
+       items[ii].key = "dedup";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.dedup;
+       ++ii;
+
+       items[ii].key = "dedup_min_size";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.dedup_min_size;
+       ++ii;
+
        items[ii].key = NULL;
        ++ii;
-       cb_assert(ii == 13);
+       cb_assert(ii == 28);
        ret = se->server.core->parse_config(cfg_str, items, stderr);
    }
 
@@ -614,7 +1484,14 @@ static bool scrub_cmd(struct default_engine *e,
                       ADD_RESPONSE response) {
 
     protocol_binary_response_status res = PROTOCOL_BINARY_RESPONSE_SUCCESS;
-    if (!item_start_scrub(e)) {
+    if (e->nshards > 0) {
+        size_t ii;
+        for (ii = 0; ii < e->nshards; ++ii) {
+            if (!item_start_scrub(e->shard[ii])) {
+                res = PROTOCOL_BINARY_RESPONSE_EBUSY;
+            }
+        }
+    } else if (!item_start_scrub(e)) {
         res = PROTOCOL_BINARY_RESPONSE_EBUSY;
     }
 
@@ -622,6 +1499,39 @@ static bool scrub_cmd(struct default_engine *e,
                     res, 0, cookie);
 }
 
+static bool import_cmd(struct default_engine *e,
+                       const void *cookie,
+                       protocol_binary_request_header *request,
+                       ADD_RESPONSE response) {
+
+    uint32_t bodylen = ntohl(request->request.bodylen);
+    uint64_t loaded = 0;
+    uint64_t skipped = 0;
+    uint32_t counts[2];
+    ENGINE_ERROR_CODE ret;
+
+    if (request->request.extlen != 0 || request->request.keylen != 0 ||
+        bodylen == 0) {
+        return response(NULL, 0, NULL, 0, NULL, 0, PROTOCOL_BINARY_RAW_BYTES,
+                        PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+    }
+
+    ret = item_snapshot_import(e, request + 1, bodylen, cookie,
+                               &loaded, &skipped);
+    if (ret != ENGINE_SUCCESS) {
+        return response(NULL, 0, NULL, 0, NULL, 0, PROTOCOL_BINARY_RAW_BYTES,
+                        ret == ENGINE_ENOMEM ?
+                        PROTOCOL_BINARY_RESPONSE_ENOMEM :
+                        PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+    }
+
+    counts[0] = htonl((uint32_t)loaded);
+    counts[1] = htonl((uint32_t)skipped);
+    return response(NULL, 0, NULL, 0, counts, sizeof(counts),
+                    PROTOCOL_BINARY_RAW_BYTES,
+                    PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
+}
+
 static bool touch(struct default_engine *e, const void *cookie,
                   protocol_binary_request_header *request,
                   ADD_RESPONSE response) {
@@ -642,6 +1552,7 @@ static bool touch(struct default_engine *e, const void *cookie,
     key = t->bytes + sizeof(t->bytes);
     exptime = ntohl(t->message.body.expiration);
     nkey = ntohs(request->request.keylen);
+    e = shard_for(e, key, nkey);
     item = touch_item(e, cookie, key, nkey, e->server.core->realtime(exptime));
 
     if (item == NULL) {
@@ -656,6 +1567,28 @@ static bool touch(struct default_engine *e, const void *cookie,
         if (request->request.opcode == PROTOCOL_BINARY_CMD_TOUCH) {
             ret = response(NULL, 0, NULL, 0, NULL, 0, PROTOCOL_BINARY_RAW_BYTES,
                            PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
+        } else if ((item->iflag & ITEM_CHUNKED) != 0) {
+            /* the response callback wants the value contiguous */
+            char *buf = cb_malloc(item->nbytes);
+            if (buf == NULL) {
+                ret = response(NULL, 0, NULL, 0, NULL, 0,
+                               PROTOCOL_BINARY_RAW_BYTES,
+                               PROTOCOL_BINARY_RESPONSE_ENOMEM, 0, cookie);
+            } else {
+                item_copy_data(item, buf);
+                ret = response(NULL, 0, &item->flags, sizeof(item->flags),
+                               buf, item->nbytes,
+                               PROTOCOL_BINARY_RAW_BYTES,
+                               PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                               item_get_cas(item), cookie);
+                cb_free(buf);
+            }
+        } else if ((item->iflag & ITEM_SHARED) != 0) {
+            ret = response(NULL, 0, &item->flags, sizeof(item->flags),
+                           item_get_shared(item)->data, item->nbytes,
+                           PROTOCOL_BINARY_RAW_BYTES,
+                           PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                           item_get_cas(item), cookie);
         } else {
             ret = response(NULL, 0, &item->flags, sizeof(item->flags),
                            item_get_data(item), item->nbytes,
@@ -680,6 +1613,9 @@ static ENGINE_ERROR_CODE default_unknown_command(ENGINE_HANDLE* handle,
     case PROTOCOL_BINARY_CMD_SCRUB:
         sent = scrub_cmd(e, cookie, request, response);
         break;
+    case PROTOCOL_BINARY_CMD_ITEM_IMPORT:
+        sent = import_cmd(e, cookie, request, response);
+        break;
     case PROTOCOL_BINARY_CMD_DEL_VBUCKET:
         sent = rm_vbucket(e, cookie, request, response);
         break;
@@ -738,7 +1674,23 @@ hash_key* item_get_key(const hash_item* item)
 char* item_get_data(const hash_item* item)
 {
     const hash_key* key = item_get_key(item);
-    return ((char*)key->header.full_key) + hash_key_get_key_len(key);
+    /* A stored item's key bytes always live inline in key_storage
+     * (see hash_key_view_copy_to_item), so the value can be located
+     * without first loading the full_key pointer - one dependent
+     * cache access less on every value access. */
+    return ((char*)&key->key_storage) + hash_key_get_key_len(key);
+}
+
+item_chunk* item_get_chunk(const hash_item* item)
+{
+    /* the body of a chunked item holds the head-of-chain pointer */
+    return *(item_chunk**)item_get_data(item);
+}
+
+dedup_block* item_get_shared(const hash_item* item)
+{
+    /* the body of a shared item holds the value block pointer */
+    return *(dedup_block**)item_get_data(item);
 }
 
 uint8_t item_get_clsid(const hash_item* item)
@@ -751,9 +1703,18 @@ static bool get_item_info(ENGINE_HANDLE *handle, const void *cookie,
 {
     hash_item* it = (hash_item*)item;
     const hash_key* key = item_get_key(item);
+    struct default_engine* engine = get_handle(handle);
+
     if (item_info->nvalue < 1) {
         return false;
     }
+
+    /* route to the shard owning the item so a quarantine takes the
+       right cache lock (a no-op when integrity_check is off) */
+    if (!item_check_integrity(shard_for_item(engine, it), it)) {
+        return false;
+    }
+
     item_info->cas = item_get_cas(it);
     item_info->vbucket_uuid = 0;
     item_info->seqno = 0;
@@ -762,10 +1723,30 @@ static bool get_item_info(ENGINE_HANDLE *handle, const void *cookie,
     item_info->flags = it->flags;
     item_info->clsid = it->slabs_clsid;
     item_info->nkey = hash_key_get_client_key_len(key);
-    item_info->nvalue = 1;
     item_info->key = hash_key_get_client_key(key);
-    item_info->value[0].iov_base = item_get_data(it);
-    item_info->value[0].iov_len = it->nbytes;
+    if ((it->iflag & ITEM_CHUNKED) != 0) {
+        const item_chunk *chunk = item_get_chunk(it);
+        uint16_t ii = 0;
+        while (chunk != NULL) {
+            if (ii == item_info->nvalue) {
+                /* the caller can't scatter-gather this many pieces */
+                return false;
+            }
+            item_info->value[ii].iov_base = (void*)chunk->data;
+            item_info->value[ii].iov_len = chunk->used;
+            ++ii;
+            chunk = chunk->next;
+        }
+        item_info->nvalue = ii;
+    } else if ((it->iflag & ITEM_SHARED) != 0) {
+        item_info->value[0].iov_base = (void*)item_get_shared(it)->data;
+        item_info->value[0].iov_len = it->nbytes;
+        item_info->nvalue = 1;
+    } else {
+        item_info->value[0].iov_base = item_get_data(it);
+        item_info->value[0].iov_len = it->nbytes;
+        item_info->nvalue = 1;
+    }
     item_info->datatype = it->datatype;
     return true;
 }
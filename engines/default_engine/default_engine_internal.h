@@ -45,10 +45,33 @@ struct default_engine;
 /* temp */
 #define ITEM_SLABBED (2<<8)
 
+/* Accessed since it was last (re)linked into the LRU; the actual bump to
+   the head of the queue is deferred until the item shows up in an
+   eviction scan. */
+#define ITEM_ACTIVE (4<<8)
+
+/* The item's body holds a pointer to a chain of value chunks instead of
+   the value itself (see item_chunk in items.h). */
+#define ITEM_CHUNKED (8<<8)
+
+/* The item's body holds a pointer to a shared (refcounted) value block
+   instead of the value itself (see dedup_block in items.h). */
+#define ITEM_SHARED (64<<8)
+
+/* Transient: the TinyLFU admission filter judged the item colder than
+   the item evicted to make room for it, so item_link_q() inserts it at
+   the eviction end of the queue instead of the head (and clears the
+   flag). */
+#define ITEM_COLD (16<<8)
+
+/* The item sits in the protected segment of its class's segmented LRU
+   (items promoted there survive the probationary churn of scan-heavy
+   workloads); only meaningful under the tinylfu eviction policy. */
+#define ITEM_PROTECTED (32<<8)
+
 struct config {
    bool use_cas;
    size_t verbose;
-   rel_time_t oldest_live;
    bool evict_to_free;
    size_t maxbytes;
    bool preallocate;
@@ -58,6 +81,53 @@ struct config {
    bool ignore_vbucket;
    bool vb0;
    char *uuid;
+   /** Path of the warm-cache snapshot segment (NULL = no snapshots) */
+   char *snapshot_file;
+   /** Seconds between background snapshots (0 = never write one) */
+   size_t snapshot_interval;
+   /** Transparently compress large values on store */
+   bool compression;
+   /** Values below this size (in bytes) are never compressed */
+   size_t compress_threshold;
+   /** Values of at least this size (in bytes) are stored as a chain of
+       fixed-size chunks instead of one huge allocation (0 = never) */
+   size_t chunk_threshold;
+   /** Name of the eviction policy to use ("lru" or "tinylfu";
+       NULL = "lru") */
+   char *eviction_policy;
+   /** Huge-page backing for the slab preallocation and the hash
+       tables: "2M", "1G" or NULL/"off" (see hugepages.h) */
+   char *huge_pages;
+   /** Number of internal key-hash shards (1 = the classic single
+       cache-lock domain). See the comment above shard_for() in
+       default_engine.c */
+   size_t shards;
+   /** Items the scrubber visits per acquisition of the cache lock;
+       smaller steps bound the pause a scrub can inflict on clients */
+   size_t scrub_step;
+   /** Microseconds the scrubber sleeps between critical sections
+       (0 = no pacing) */
+   size_t scrub_sleep;
+   /** log2 of the number of buckets the hash table starts out with.
+       Size this for the expected population (buckets ~ items / 1.5)
+       to avoid a cascade of expansions while a known-large data set
+       is loaded */
+   size_t initial_hashpower;
+   /** Stamp a CRC32C over each item's key and value at store and
+       verify it when the item is served, so bit flips in resident
+       memory are detected (and the item quarantined) instead of
+       serving corrupt data */
+   bool integrity_check;
+   /** Maintain a counting existence filter over the linked keys so
+       batched existence probes (EXIST_MULTI) can answer misses
+       without taking the cache lock */
+   bool exists_filter;
+   /** Store identical values held under different keys in one shared
+       refcounted value block (see dedup_block in items.h) */
+   bool dedup;
+   /** Values below this size (in bytes) are never deduplicated; tiny
+       values save less than the stub + block bookkeeping costs */
+   size_t dedup_min_size;
 };
 
 MEMCACHED_PUBLIC_API
@@ -79,12 +149,67 @@ struct engine_scrubber {
    cb_mutex_t lock;
    uint64_t visited;
    uint64_t cleaned;
+   /** Items held when the scrub started; visited/total gives the
+       progress (and an ETA) reported by "stats scrub" */
+   uint64_t total;
    time_t started;
    time_t stopped;
    bool running;
    bool force_delete;
 };
 
+/**
+ * State for the background expiry reaper. The reaper advances the
+ * expiry wheel (see struct items) at a fixed cadence and unlinks the
+ * items whose buckets have come due, so their memory is returned
+ * without waiting for a client to touch the key. The counters are
+ * updated under items.lock and read under this lock for stats.
+ */
+struct engine_reaper {
+   cb_mutex_t lock;
+   uint64_t visited;
+   uint64_t reaped;
+   uint64_t reaped_bytes;
+};
+
+/**
+ * State for the warm-cache snapshot subsystem (see snapshot.c). The
+ * snapshot thread and the warmup path record their progress here; it
+ * is also what the "snapshot" stat group reports.
+ */
+struct engine_snapshot {
+   cb_mutex_t lock;
+   bool running;
+   time_t last_start;
+   time_t last_stop;
+   uint64_t saved;     /* items written by the last completed snapshot */
+   uint64_t restored;  /* items restored at warmup */
+   uint64_t imported;  /* items loaded through the bulk-import command */
+};
+
+/**
+ * State for the external-store tier (see tier.c). The registered
+ * callbacks, the queue of pending fetches and write-backs and the
+ * counters all live under the lock; the background thread which runs
+ * the callbacks is started when the first fetch callback is
+ * registered (set_tier_config).
+ */
+struct engine_tier {
+   cb_mutex_t lock;
+   cb_cond_t cond;
+   engine_tier_config config;
+   struct tier_request *head;
+   struct tier_request *tail;
+   cb_thread_t thread;
+   bool running;
+   bool shutdown;
+   uint64_t fetches;
+   uint64_t fetch_hits;
+   uint64_t fetch_misses;
+   uint64_t fetch_errors;
+   uint64_t writebacks;
+};
+
 struct vbucket_info {
     int state : 2;
 };
@@ -113,6 +238,9 @@ struct default_engine {
    struct config config;
    struct engine_stats stats;
    struct engine_scrubber scrubber;
+   struct engine_reaper reaper;
+   struct engine_snapshot snapshot;
+   struct engine_tier tier;
 
    union {
        engine_info engine;
@@ -124,14 +252,36 @@ struct default_engine {
 
    /* a unique bucket index, note this is not cluster wide and dies with the process */
    bucket_id_t bucket_id;
+
+   /**
+    * Internal key-hash shards (the "shards" config item). When the
+    * engine was created with shards=N (N > 1) this instance acts
+    * purely as a router: its own assoc/slabs/items are never
+    * initialized, and every key is served by exactly one of the N
+    * complete engine instances below - each with its own hash table,
+    * slab budget slice, LRU and cache lock. NULL/0 on a normal
+    * engine and inside every shard.
+    */
+   struct default_engine **shard;
+   size_t nshards;
 };
 
 char* item_get_data(const hash_item* item);
+item_chunk* item_get_chunk(const hash_item* item);
+dedup_block* item_get_shared(const hash_item* item);
 hash_key* item_get_key(const hash_item* item);
 void item_set_cas(ENGINE_HANDLE *handle, const void *cookie,
                   item* item, uint64_t val);
 uint64_t item_get_cas(const hash_item* item);
 uint8_t item_get_clsid(const hash_item* item);
+
+/**
+ * Key-hash shard routing for modules outside default_engine.c: the
+ * index into engine->shard[] which owns the key. Always 0 on an
+ * unsharded engine.
+ */
+size_t default_engine_shard_index(struct default_engine* engine,
+                                  const void* key, size_t nkey);
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,16 +19,28 @@
     Engine manager provides methods for creating and deleting of engine handles/structs
     and the creation and safe teardown of the scrubber thread.
 
-    Note: A single scrubber exists for the purposes of running a user requested scrub
-    and for background deletion of bucket items when a bucket is destroyed.
+    Note: A small pool of scrubber workers exists for the purposes of running
+    user requested scrubs and for background deletion of bucket items when a
+    bucket is destroyed. Each queued engine is handled by exactly one worker;
+    the pool lets a scrub of one bucket (or shard) proceed while another is
+    still in flight.
+
+    A single expiry reaper thread also lives here; it periodically walks a
+    bounded slice of every engine's LRU queues and unlinks expired items so
+    their memory is reclaimed without waiting for a client to touch the key.
+
+    A single snapshot thread writes the periodic warm-cache segments for
+    every engine which has a snapshot file configured (see snapshot.c).
 */
 
 #include "engine_manager.h"
 #include "default_engine_internal.h"
 #include "items.h"
+#include "snapshot.h"
 
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <mutex>
@@ -59,22 +71,28 @@ public:
     void shutdown();
 
     /**
-        Join the thread running the scrubber (to be called after shutdown).
+        Join the threads running the scrubber (to be called after shutdown).
     **/
     void joinThread();
 
     /**
-        Place the engine on the threads work queue for item scrubbing.
+        Place the engine on the work queue for item scrubbing.
         bool destroy indicates if the engine should be deleted once scrubbed.
     **/
     void placeOnWorkQueue(struct default_engine* engine, bool destroy);
 
     /**
-        Task's run loop method.
+        Run loop method executed by each worker thread.
     **/
     void run();
 
 private:
+    /* Number of worker threads servicing the work queue. Scrubs of
+       distinct engines (or shards) are independent, so a handful of
+       workers is enough to keep one slow bucket from delaying the
+       deletion of another. */
+    static const size_t numWorkers = 2;
+
     /*
        A queue of engine's to work on.
        The second bool indicates if the engine is to be deleted when done.
@@ -84,12 +102,82 @@ private:
     EngineManager* engineManager;
     std::mutex lock;
     std::condition_variable cvar;
-    cb_thread_t scrubberThread;
+    cb_thread_t scrubberThreads[numWorkers];
+};
+
+/**
+    The reaper task wakes once a second and gives every registered engine
+    a bounded budget of LRU items to check for expiry. The budget keeps
+    each tick short; the walk cursor inside the engine remembers where the
+    previous tick stopped, so over successive ticks the whole cache is
+    covered.
+**/
+class ReaperTask {
+public:
+    ReaperTask(EngineManager* manager);
+
+    /**
+        Shutdown the task
+    **/
+    void shutdown();
+
+    /**
+        Join the thread running the reaper (to be called after shutdown).
+    **/
+    void joinThread();
+
+    /**
+        Task's run loop method.
+    **/
+    void run();
+
+private:
+    /* Number of items each engine may visit per tick. */
+    static const int itemsPerTick = 1000;
+
+    std::atomic<bool> shuttingdown;
+    EngineManager* engineManager;
+    std::mutex lock;
+    std::condition_variable cvar;
+    cb_thread_t reaperThread;
+};
+
+/**
+    The snapshot task wakes once a second and asks every registered
+    engine with a snapshot file configured whose interval has elapsed
+    to serialize its items to disk (see item_snapshot_save).
+**/
+class SnapshotTask {
+public:
+    SnapshotTask(EngineManager* manager);
+
+    /**
+        Shutdown the task
+    **/
+    void shutdown();
+
+    /**
+        Join the thread running the snapshotter (to be called after shutdown).
+    **/
+    void joinThread();
+
+    /**
+        Task's run loop method.
+    **/
+    void run();
+
+private:
+    std::atomic<bool> shuttingdown;
+    EngineManager* engineManager;
+    std::mutex lock;
+    std::condition_variable cvar;
+    cb_thread_t snapshotThread;
 };
 
 /**
     Create/Delete of engines from one location.
-    Manages the scrubber task and handles global shutdown
+    Manages the scrubber, reaper and snapshot tasks and handles global
+    shutdown
 **/
 class EngineManager {
 public:
@@ -115,6 +203,18 @@ public:
     **/
     void scrubEngine(struct default_engine* engine);
 
+    /**
+        Give every registered engine one expiry-reaping pass of at most
+        itemBudget items. Called by the reaper task.
+    **/
+    void reapEngines(int itemBudget);
+
+    /**
+        Write a warm-cache segment for every registered engine whose
+        snapshot interval has elapsed. Called by the snapshot task.
+    **/
+    void snapshotEngines();
+
     /**
         Set the shutdown flag so that we can clean up
         1) no new engine's can be created.
@@ -128,6 +228,10 @@ private:
     std::mutex lock;
     std::unordered_set<struct default_engine*> engines;
 
+    /* Constructed last so the threads they spawn never observe a
+       partially initialized manager. */
+    ReaperTask reaperTask;
+    SnapshotTask snapshotTask;
 };
 
 static std::unique_ptr<EngineManager> engineManager;
@@ -140,9 +244,11 @@ static void scrubber_task_main(void* arg) {
 ScrubberTask::ScrubberTask(EngineManager* manager)
   : shuttingdown(false),
     engineManager(manager) {
-    if (cb_create_named_thread(&scrubberThread, &scrubber_task_main, this, 0,
-                               "mc:item_scrub") != 0) {
-        throw std::runtime_error("Error creating 'mc:item_scrub' thread");
+    for (size_t ii = 0; ii < numWorkers; ++ii) {
+        if (cb_create_named_thread(&scrubberThreads[ii], &scrubber_task_main,
+                                   this, 0, "mc:item_scrub") != 0) {
+            throw std::runtime_error("Error creating 'mc:item_scrub' thread");
+        }
     }
 }
 
@@ -150,11 +256,13 @@ void ScrubberTask::shutdown() {
     shuttingdown = true;
     // Serialize with ::run
     std::lock_guard<std::mutex> lck(lock);
-    cvar.notify_one();
+    cvar.notify_all();
 }
 
 void ScrubberTask::joinThread() {
-    cb_join_thread(scrubberThread);
+    for (size_t ii = 0; ii < numWorkers; ++ii) {
+        cb_join_thread(scrubberThreads[ii]);
+    }
 }
 
 void ScrubberTask::placeOnWorkQueue(struct default_engine* engine, bool destroy) {
@@ -177,7 +285,6 @@ void ScrubberTask::run() {
             item_scrubber_main(engine.first);
 
             if (engine.second) {
-                destroy_engine_instance(engine.first);
                 engineManager->deleteEngine(engine.first);
             }
 
@@ -190,9 +297,85 @@ void ScrubberTask::run() {
     }
 }
 
+static void reaper_task_main(void* arg) {
+    ReaperTask* task = reinterpret_cast<ReaperTask*>(arg);
+    task->run();
+}
+
+ReaperTask::ReaperTask(EngineManager* manager)
+  : shuttingdown(false),
+    engineManager(manager) {
+    if (cb_create_named_thread(&reaperThread, &reaper_task_main, this, 0,
+                               "mc:item_reap") != 0) {
+        throw std::runtime_error("Error creating 'mc:item_reap' thread");
+    }
+}
+
+void ReaperTask::shutdown() {
+    shuttingdown = true;
+    // Serialize with ::run
+    std::lock_guard<std::mutex> lck(lock);
+    cvar.notify_one();
+}
+
+void ReaperTask::joinThread() {
+    cb_join_thread(reaperThread);
+}
+
+void ReaperTask::run() {
+    std::unique_lock<std::mutex> lck(lock);
+    while (!shuttingdown) {
+        lck.unlock();
+        engineManager->reapEngines(itemsPerTick);
+        lck.lock();
+        if (!shuttingdown) {
+            cvar.wait_for(lck, std::chrono::seconds(1));
+        }
+    }
+}
+
+static void snapshot_task_main(void* arg) {
+    SnapshotTask* task = reinterpret_cast<SnapshotTask*>(arg);
+    task->run();
+}
+
+SnapshotTask::SnapshotTask(EngineManager* manager)
+  : shuttingdown(false),
+    engineManager(manager) {
+    if (cb_create_named_thread(&snapshotThread, &snapshot_task_main, this, 0,
+                               "mc:item_snap") != 0) {
+        throw std::runtime_error("Error creating 'mc:item_snap' thread");
+    }
+}
+
+void SnapshotTask::shutdown() {
+    shuttingdown = true;
+    // Serialize with ::run
+    std::lock_guard<std::mutex> lck(lock);
+    cvar.notify_one();
+}
+
+void SnapshotTask::joinThread() {
+    cb_join_thread(snapshotThread);
+}
+
+void SnapshotTask::run() {
+    std::unique_lock<std::mutex> lck(lock);
+    while (!shuttingdown) {
+        lck.unlock();
+        engineManager->snapshotEngines();
+        lck.lock();
+        if (!shuttingdown) {
+            cvar.wait_for(lck, std::chrono::seconds(1));
+        }
+    }
+}
+
 EngineManager::EngineManager()
   : scrubberTask(this),
-    shuttingdown(false) {}
+    shuttingdown(false),
+    reaperTask(this),
+    snapshotTask(this) {}
 
 EngineManager::~EngineManager() {
     shutdown();
@@ -221,11 +404,43 @@ struct default_engine* EngineManager::createEngine() {
 }
 
 void EngineManager::deleteEngine(struct default_engine* engine) {
-    std::lock_guard<std::mutex> lck(lock);
-    engines.erase(engine);
+    {
+        // Unregister first; once the engine is out of the set the reaper
+        // can no longer tick it, so it is safe to tear down.
+        std::lock_guard<std::mutex> lck(lock);
+        engines.erase(engine);
+    }
+    destroy_engine_instance(engine);
     delete engine;
 }
 
+void EngineManager::reapEngines(int itemBudget) {
+    std::lock_guard<std::mutex> lck(lock);
+    for (auto engine : engines) {
+        if (engine->initialized) {
+            item_reaper_tick(engine, itemBudget);
+        }
+    }
+}
+
+void EngineManager::snapshotEngines() {
+    /* The manager lock is held for the duration of the writes so an
+       engine can't be torn down under the snapshotter's feet. Engine
+       create/delete therefore waits for an in-flight snapshot; both
+       are rare administrative operations. */
+    std::lock_guard<std::mutex> lck(lock);
+    const time_t now = time(NULL);
+    for (auto engine : engines) {
+        if (engine->initialized &&
+            engine->config.snapshot_file != nullptr &&
+            engine->config.snapshot_interval > 0 &&
+            now - engine->snapshot.last_start >=
+            time_t(engine->config.snapshot_interval)) {
+            item_snapshot_save(engine);
+        }
+    }
+}
+
 void EngineManager::requestDestroyEngine(struct default_engine* engine) {
     if (!shuttingdown) {
         scrubberTask.placeOnWorkQueue(engine, true);
@@ -239,10 +454,15 @@ void EngineManager::scrubEngine(struct default_engine* engine) {
 }
 
 /*
- * Join the scrubber and delete any data which wasn't cleaned by clients
+ * Join the scrubber and reaper and delete any data which wasn't cleaned
+ * by clients
  */
 void EngineManager::shutdown() {
     shuttingdown = true;
+    snapshotTask.shutdown();
+    snapshotTask.joinThread();
+    reaperTask.shutdown();
+    reaperTask.joinThread();
     scrubberTask.shutdown();
     scrubberTask.joinThread();
     std::lock_guard<std::mutex> lck(lock);
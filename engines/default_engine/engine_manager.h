@@ -18,7 +18,8 @@
 /**
     Engine manager provides a C API for the managment of default_engine 'handles'.
 
-    Creation/Deletion and the item scrubber thread are all managed by this module.
+    Creation/Deletion, the item scrubber thread and the background expiry
+    reaper thread are all managed by this module.
 **/
 
 #ifdef __cplusplus
@@ -0,0 +1,116 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <strings.h>
+
+#include "hugepages.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+
+/* The MAP_HUGE_* encodings appeared in linux 3.8; define them here so
+ * we can build against older headers (the mmap call simply fails on a
+ * kernel that doesn't understand them and we fall back). */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+static void* try_mmap(size_t size, size_t pagesize, int hugeflag,
+                      size_t *mapped) {
+    size_t len = (size + pagesize - 1) & ~(pagesize - 1);
+    void *ptr;
+
+#ifdef MAP_HUGETLB
+    ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | hugeflag,
+               -1, 0);
+    if (ptr != MAP_FAILED) {
+        *mapped = len;
+        return ptr;
+    }
+#endif
+    return NULL;
+}
+
+void* hugepage_alloc(size_t size,
+                     enum hugepage_size request,
+                     enum hugepage_size *obtained,
+                     size_t *mapped) {
+    void *ptr;
+
+    if (request == HUGEPAGE_1G) {
+        ptr = try_mmap(size, (size_t)1 << 30, MAP_HUGE_1GB, mapped);
+        if (ptr != NULL) {
+            *obtained = HUGEPAGE_1G;
+            return ptr;
+        }
+    }
+
+    if (request != HUGEPAGE_NONE) {
+        ptr = try_mmap(size, (size_t)2 << 20, MAP_HUGE_2MB, mapped);
+        if (ptr != NULL) {
+            *obtained = HUGEPAGE_2M;
+            return ptr;
+        }
+    }
+
+    *obtained = HUGEPAGE_NONE;
+    *mapped = 0;
+    return NULL;
+}
+
+void hugepage_free(void *ptr, size_t mapped) {
+    if (ptr != NULL && mapped != 0) {
+        munmap(ptr, mapped);
+    }
+}
+
+#else /* !__linux__ */
+
+void* hugepage_alloc(size_t size,
+                     enum hugepage_size request,
+                     enum hugepage_size *obtained,
+                     size_t *mapped) {
+    (void)size;
+    (void)request;
+    *obtained = HUGEPAGE_NONE;
+    *mapped = 0;
+    return NULL;
+}
+
+void hugepage_free(void *ptr, size_t mapped) {
+    (void)ptr;
+    (void)mapped;
+}
+
+#endif /* __linux__ */
+
+enum hugepage_size hugepage_parse(const char *text) {
+    if (text != NULL) {
+        if (strcasecmp(text, "2M") == 0 || strcasecmp(text, "2MB") == 0) {
+            return HUGEPAGE_2M;
+        }
+        if (strcasecmp(text, "1G") == 0 || strcasecmp(text, "1GB") == 0) {
+            return HUGEPAGE_1G;
+        }
+    }
+    return HUGEPAGE_NONE;
+}
+
+const char* hugepage_size_text(enum hugepage_size size) {
+    switch (size) {
+    case HUGEPAGE_2M:
+        return "2MB huge pages";
+    case HUGEPAGE_1G:
+        return "1GB huge pages";
+    case HUGEPAGE_NONE:
+        break;
+    }
+    return "normal pages";
+}
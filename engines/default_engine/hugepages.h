@@ -0,0 +1,70 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Explicit huge-page backing for the large, long-lived allocations of
+ * the default engine (the preallocated slab backing store and the hash
+ * tables). Backing these with 2MB or 1GB pages instead of 4KB pages
+ * cuts the TLB pressure of chasing hash chains and items spread over
+ * hundreds of gigabytes.
+ *
+ * Only implemented on Linux (MAP_HUGETLB); on other platforms - and
+ * when the kernel has no huge pages available - the allocation
+ * functions fail and the caller falls back to the normal heap.
+ */
+#ifndef HUGEPAGES_H
+#define HUGEPAGES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum hugepage_size {
+    HUGEPAGE_NONE = 0,
+    HUGEPAGE_2M,
+    HUGEPAGE_1G
+};
+
+/**
+ * Allocate zeroed memory backed by huge pages.
+ *
+ * The requested page size is tried first; when it can't be satisfied
+ * smaller huge pages are tried before giving up (1G -> 2M -> fail).
+ *
+ * @param size number of bytes needed
+ * @param request the largest page size to try
+ * @param obtained set to the page size actually backing the mapping
+ * @param mapped set to the length of the mapping (size rounded up to
+ *               the obtained page size); needed by hugepage_free
+ * @return the mapping, or NULL if no huge pages could be obtained
+ */
+void* hugepage_alloc(size_t size,
+                     enum hugepage_size request,
+                     enum hugepage_size *obtained,
+                     size_t *mapped);
+
+/**
+ * Release a mapping obtained from hugepage_alloc.
+ *
+ * @param ptr the mapping
+ * @param mapped the mapping length reported by hugepage_alloc
+ */
+void hugepage_free(void *ptr, size_t mapped);
+
+/**
+ * Parse a huge page configuration value ("off", "2M" or "1G", case
+ * insensitive; NULL and unrecognized values mean off).
+ */
+enum hugepage_size hugepage_parse(const char *text);
+
+/**
+ * Get a textual name for the page size (for log messages)
+ */
+const char* hugepage_size_text(enum hugepage_size size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
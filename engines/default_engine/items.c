@@ -10,20 +10,22 @@
 
 #include <platform/cb_malloc.h>
 #include <platform/crc32c.h>
+#include <snappy-c.h>
 #include "default_engine_internal.h"
 #include "engine_manager.h"
+#include "tier.h"
 
 /* Forward Declarations */
 static void item_link_q(struct default_engine *engine, hash_item *it);
 static void item_unlink_q(struct default_engine *engine, hash_item *it);
 static hash_item *do_item_alloc(struct default_engine *engine,
-                                const hash_key *key,
+                                const hash_key_view *key,
                                 const int flags, const rel_time_t exptime,
                                 const int nbytes,
                                 const void *cookie,
                                 uint8_t datatype);
 static hash_item *do_item_get(struct default_engine *engine,
-                              const hash_key* key);
+                              const hash_key_view* key);
 static int do_item_link(struct default_engine *engine, hash_item *it);
 static void do_item_unlink(struct default_engine *engine, hash_item *it);
 static void do_item_release(struct default_engine *engine, hash_item *it);
@@ -32,30 +34,314 @@ static int do_item_replace(struct default_engine *engine,
                             hash_item *it, hash_item *new_it);
 static void item_free(struct default_engine *engine, hash_item *it);
 
-static bool hash_key_create(hash_key* hkey,
-                            const void* key,
-                            const size_t nkey,
-                            struct default_engine* engine,
-                            const void* cookie);
+static void hash_key_view_copy_to_item(hash_item* dst,
+                                       const hash_key_view* src);
 
-static void hash_key_destroy(hash_key* hkey);
-static void hash_key_copy_to_item(hash_item* dst, const hash_key* src);
-
-/*
- * We only reposition items in the LRU queue if they haven't been repositioned
- * in this many seconds. That saves us from churning on frequently-accessed
- * items.
- */
-#define ITEM_UPDATE_INTERVAL 60
 /*
  * To avoid scanning through the complete cache in some circumstances we'll
  * just give up and return an error after inspecting a fixed number of objects.
  */
 static const int search_items = 50;
 
+/*
+ * Per-item sequence stamps for optimistic readers (see item_get_copy).
+ * All writes happen under items.lock; the barriers order them against
+ * the lock-free readers. An odd stamp means "in flux".
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define SEQ_BARRIER() __sync_synchronize()
+#else
+#define SEQ_BARRIER()
+#endif
+
+/*
+ * Hint that an item's header is about to be inspected. The scan loops
+ * (walk cursor, expiry reaper, wheel redistribution) chase pointers
+ * across slab pages; prefetching the next header while the current one
+ * is processed keeps them streaming at memory bandwidth instead of
+ * stalling on every hop. All the fields a scan reads live in the
+ * header's leading cache line (see items.h), so one line is enough.
+ */
+static void item_prefetch(const hash_item *it) {
+#if defined(__GNUC__) || defined(__clang__)
+    if (it != NULL) {
+        __builtin_prefetch(it, 0, 0);
+    }
+#else
+    (void)it;
+#endif
+}
+
+static void item_seq_begin(hash_item *it) {
+    it->seqno++;
+    SEQ_BARRIER();
+}
+
+static void item_seq_end(hash_item *it) {
+    SEQ_BARRIER();
+    it->seqno++;
+}
+
+/*
+ * TinyLFU frequency sketch: an array of packed 4 bit counters indexed
+ * by two independent slots derived from the key hash; the estimate of
+ * a key's access frequency is the minimum of its two counters. Every
+ * lookup bumps the counters (saturating at 15), and once the number of
+ * observations reaches a multiple of the table size all counters are
+ * halved, so the sketch tracks recent popularity rather than all-time
+ * popularity. All access happens under items.lock.
+ */
+#define SKETCH_MIN_BYTES (1u << 14)
+#define SKETCH_MAX_BYTES (1u << 22)
+
+static uint32_t sketch_slot2(uint32_t hash) {
+    uint32_t h = hash * UINT32_C(0x9e3779b1);
+    return h ^ (h >> 16);
+}
+
+static unsigned int sketch_read(const struct items *items, uint32_t idx) {
+    uint8_t b = items->sketch[idx >> 1];
+    return (idx & 1) ? (b >> 4) : (b & 0x0f);
+}
+
+static void sketch_bump(struct items *items, uint32_t idx) {
+    uint8_t b = items->sketch[idx >> 1];
+    unsigned int v = (idx & 1) ? (b >> 4) : (b & 0x0f);
+    if (v < 15) {
+        ++v;
+        items->sketch[idx >> 1] = (uint8_t)((idx & 1) ?
+                                            ((b & 0x0f) | (v << 4)) :
+                                            ((b & 0xf0) | v));
+    }
+}
+
+static unsigned int sketch_estimate(const struct items *items,
+                                    uint32_t hash) {
+    unsigned int a = sketch_read(items, hash & items->sketch_mask);
+    unsigned int b = sketch_read(items, sketch_slot2(hash) & items->sketch_mask);
+    return (a < b) ? a : b;
+}
+
+static void sketch_touch(struct items *items, uint32_t hash) {
+    sketch_bump(items, hash & items->sketch_mask);
+    sketch_bump(items, sketch_slot2(hash) & items->sketch_mask);
+    if (++items->sketch_window >= (uint64_t)(items->sketch_mask + 1) * 4) {
+        /* Age the sketch. A full sweep, but only once every few
+         * million lookups, so the amortized cost per lookup is tiny */
+        size_t nbytes = ((size_t)items->sketch_mask + 1) / 2;
+        size_t ii;
+        for (ii = 0; ii < nbytes; ++ii) {
+            items->sketch[ii] = (uint8_t)((items->sketch[ii] >> 1) & 0x77);
+        }
+        items->sketch_window /= 2;
+    }
+}
+
+static const char *eviction_policy_name(enum eviction_policy policy) {
+    return (policy == EVICTION_POLICY_TINYLFU) ? "tinylfu" : "lru";
+}
+
+ENGINE_ERROR_CODE item_eviction_policy_init(struct default_engine *engine) {
+    const char *name = engine->config.eviction_policy;
+
+    if (name == NULL || strcmp(name, "lru") == 0) {
+        engine->items.policy = EVICTION_POLICY_LRU;
+        return ENGINE_SUCCESS;
+    }
+
+    if (strcmp(name, "tinylfu") == 0) {
+        /* roughly one counter pair per kilobyte of cache */
+        size_t nbytes = SKETCH_MIN_BYTES;
+        while (nbytes < engine->config.maxbytes / 1024 &&
+               nbytes < SKETCH_MAX_BYTES) {
+            nbytes <<= 1;
+        }
+        engine->items.sketch = cb_calloc(nbytes, 1);
+        if (engine->items.sketch == NULL) {
+            return ENGINE_ENOMEM;
+        }
+        engine->items.sketch_mask = (uint32_t)(nbytes * 2 - 1);
+        engine->items.policy = EVICTION_POLICY_TINYLFU;
+        return ENGINE_SUCCESS;
+    }
+
+    return ENGINE_EINVAL;
+}
+
+void item_eviction_policy_destroy(struct default_engine *engine) {
+    cb_free(engine->items.sketch);
+    engine->items.sketch = NULL;
+}
+
+/*
+ * Counting existence filter: an array of 8 bit counters indexed by two
+ * slots derived from the key hash (the same remix the TinyLFU sketch
+ * uses for its second slot). Every link increments both counters and
+ * every unlink decrements them, so a key whose counters are both zero
+ * is definitely not in the cache - an existence probe can answer the
+ * miss without ever taking the cache lock. Counters saturate at 255
+ * and a saturated counter is pinned (never decremented again), so the
+ * filter can only err towards false positives; a false negative would
+ * turn a present key invisible. Updates happen under items.lock,
+ * probes happen without it.
+ */
+#define EXIST_FILTER_MIN_SLOTS (1u << 16)
+#define EXIST_FILTER_MAX_SLOTS (1u << 24)
+
+ENGINE_ERROR_CODE item_exists_filter_init(struct default_engine *engine) {
+    size_t nslots = EXIST_FILTER_MIN_SLOTS;
+
+    if (!engine->config.exists_filter) {
+        return ENGINE_SUCCESS;
+    }
+
+    /* roughly four counters per expected item, assuming the same ~1KB
+       average document the TinyLFU sketch sizing assumes */
+    while (nslots < engine->config.maxbytes / 256 &&
+           nslots < EXIST_FILTER_MAX_SLOTS) {
+        nslots <<= 1;
+    }
+    engine->items.exist_filter = cb_calloc(nslots, 1);
+    if (engine->items.exist_filter == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    engine->items.exist_filter_mask = (uint32_t)(nslots - 1);
+    return ENGINE_SUCCESS;
+}
+
+void item_exists_filter_destroy(struct default_engine *engine) {
+    cb_free(engine->items.exist_filter);
+    engine->items.exist_filter = NULL;
+}
+
+/*
+ * Value deduplication. When enabled, every stored value of at least
+ * dedup_min_size bytes is looked up in a hash table of shared value
+ * blocks keyed by a CRC32C over the bytes; a hit replaces the item
+ * with a small stub referencing the existing block, a miss creates a
+ * new block. The table and the block refcounts live under items.lock;
+ * mutation paths (append, arithmetic, patch) never touch a shared
+ * block in place - they fall back to a full copy-on-write store.
+ */
+#define DEDUP_MIN_BUCKETS (1u << 12)
+#define DEDUP_MAX_BUCKETS (1u << 20)
+
+ENGINE_ERROR_CODE item_dedup_init(struct default_engine *engine) {
+    size_t nbuckets = DEDUP_MIN_BUCKETS;
+
+    if (!engine->config.dedup) {
+        return ENGINE_SUCCESS;
+    }
+
+    /* aim for short chains with the same ~1KB average document the
+       other sizing heuristics in this file assume */
+    while (nbuckets < engine->config.maxbytes / 2048 &&
+           nbuckets < DEDUP_MAX_BUCKETS) {
+        nbuckets <<= 1;
+    }
+    engine->items.dedup_table = cb_calloc(nbuckets, sizeof(dedup_block*));
+    if (engine->items.dedup_table == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    engine->items.dedup_mask = (uint32_t)(nbuckets - 1);
+    return ENGINE_SUCCESS;
+}
+
+void item_dedup_destroy(struct default_engine *engine) {
+    if (engine->items.dedup_table != NULL) {
+        uint32_t ii;
+        for (ii = 0; ii <= engine->items.dedup_mask; ++ii) {
+            dedup_block *blk = engine->items.dedup_table[ii];
+            while (blk != NULL) {
+                dedup_block *next = blk->h_next;
+                cb_free(blk);
+                blk = next;
+            }
+        }
+        cb_free(engine->items.dedup_table);
+        engine->items.dedup_table = NULL;
+    }
+    engine->items.dedup_blocks = 0;
+    engine->items.dedup_bytes = 0;
+}
+
+static void exist_filter_link(struct items *items, uint32_t hash) {
+    if (items->exist_filter != NULL) {
+        uint8_t *c1 = &items->exist_filter[hash & items->exist_filter_mask];
+        uint8_t *c2 = &items->exist_filter[sketch_slot2(hash) &
+                                           items->exist_filter_mask];
+        if (*c1 < 255) ++*c1;
+        if (*c2 < 255) ++*c2;
+    }
+}
+
+static void exist_filter_unlink(struct items *items, uint32_t hash) {
+    if (items->exist_filter != NULL) {
+        uint8_t *c1 = &items->exist_filter[hash & items->exist_filter_mask];
+        uint8_t *c2 = &items->exist_filter[sketch_slot2(hash) &
+                                           items->exist_filter_mask];
+        if (*c1 != 0 && *c1 < 255) --*c1;
+        if (*c2 != 0 && *c2 < 255) --*c2;
+    }
+}
+
+/*
+ * Lock-free probe. A key being linked concurrently may be missed,
+ * which is indistinguishable from the probe having run a moment
+ * earlier; a counter transiently above the table contents only costs
+ * a trip to the hash table.
+ */
+static bool exist_filter_maybe(const struct items *items, uint32_t hash) {
+    if (items->exist_filter == NULL) {
+        return true;
+    }
+    return items->exist_filter[hash & items->exist_filter_mask] != 0 &&
+           items->exist_filter[sketch_slot2(hash) &
+                               items->exist_filter_mask] != 0;
+}
+
+/*
+ * The closest item on the head side of 'it' which belongs to the
+ * protected segment, skipping any walk cursors spliced into the queue.
+ */
+static hash_item *prev_protected(hash_item *it) {
+    hash_item *p = it->prev;
+    while (p != NULL && (p->iflag & ITEM_PROTECTED) == 0) {
+        p = p->prev;
+    }
+    return p;
+}
+
+/*
+ * Shrink the protected segment by one: the boundary item falls back
+ * into the probationary segment without moving in the queue (it simply
+ * becomes the probationary head).
+ */
+static void slru_demote(struct default_engine *engine, unsigned int id) {
+    hash_item *boundary = engine->items.warm_tails[id];
+    if (boundary != NULL) {
+        boundary->iflag &= ~ITEM_PROTECTED;
+        engine->items.warm_tails[id] = prev_protected(boundary);
+        engine->items.warm_sizes[id]--;
+        engine->items.demotions++;
+    }
+}
+
 void item_stats_reset(struct default_engine *engine) {
     cb_mutex_enter(&engine->items.lock);
     memset(engine->items.itemstats, 0, sizeof(engine->items.itemstats));
+    engine->items.lookup_hits = 0;
+    engine->items.lookup_misses = 0;
+    engine->items.promotions = 0;
+    engine->items.demotions = 0;
+    engine->items.cold_admissions = 0;
+    engine->items.touch_inplace = 0;
+    engine->items.touch_relink = 0;
+    engine->items.deferred_frees = 0;
+    engine->items.crc_failures = 0;
+    engine->items.exist_filter_fastpath = 0;
+    engine->items.dedup_hits = 0;
+    engine->items.dedup_saved = 0;
     cb_mutex_exit(&engine->items.lock);
 }
 
@@ -63,7 +349,16 @@ void item_stats_reset(struct default_engine *engine) {
 /* warning: don't use these macros with a function, as it evals its arg twice */
 static size_t ITEM_ntotal(struct default_engine *engine,
                           const hash_item *item) {
-    size_t ret = sizeof(*item) + hash_key_get_alloc_size(item_get_key(item)) + item->nbytes;
+    /* the size of the item's own allocation; a chunked (or shared)
+       item carries just a pointer to its chain (or block), not the
+       value bytes */
+    size_t nbody = item->nbytes;
+    if ((item->iflag & ITEM_CHUNKED) != 0) {
+        nbody = sizeof(item_chunk*);
+    } else if ((item->iflag & ITEM_SHARED) != 0) {
+        nbody = sizeof(dedup_block*);
+    }
+    size_t ret = sizeof(*item) + hash_key_get_alloc_size(item_get_key(item)) + nbody;
     if (engine->config.use_cas) {
         ret += sizeof(uint64_t);
     }
@@ -71,11 +366,107 @@ static size_t ITEM_ntotal(struct default_engine *engine,
     return ret;
 }
 
+/* memory held by the item including any value chunk chain; this is what
+   the curr_bytes statistic accounts. A shared value block is accounted
+   once when it is created (several items may reference it), so it
+   deliberately isn't included here. */
+static size_t ITEM_memory(struct default_engine *engine,
+                          const hash_item *item) {
+    size_t ret = ITEM_ntotal(engine, item);
+    if ((item->iflag & ITEM_CHUNKED) != 0) {
+        const item_chunk *chunk = item_get_chunk(item);
+        while (chunk != NULL) {
+            ret += offsetof(item_chunk, data) + chunk->size;
+            chunk = chunk->next;
+        }
+    }
+    return ret;
+}
+
+/* release an item's value chunk chain back to the slabber */
+static void item_free_chunks(struct default_engine *engine, hash_item *it) {
+    item_chunk *chunk = item_get_chunk(it);
+    while (chunk != NULL) {
+        item_chunk *next = chunk->next;
+        slabs_free(engine, chunk, offsetof(item_chunk, data) + chunk->size,
+                   chunk->clsid);
+        chunk = next;
+    }
+    *(item_chunk**)item_get_data(it) = NULL;
+}
+
+/* drop an item's reference to its shared value block, removing the
+   block from the dedup table and freeing it when this was the last
+   one. Caller holds items.lock. */
+static void item_release_shared(struct default_engine *engine,
+                                hash_item *it) {
+    dedup_block *blk = item_get_shared(it);
+    if (blk != NULL && --blk->refcount == 0) {
+        dedup_block **bucket =
+            &engine->items.dedup_table[blk->vhash & engine->items.dedup_mask];
+        while (*bucket != blk) {
+            bucket = &(*bucket)->h_next;
+        }
+        *bucket = blk->h_next;
+        engine->items.dedup_blocks--;
+        engine->items.dedup_bytes -= offsetof(dedup_block, data) + blk->nbytes;
+        cb_mutex_enter(&engine->stats.lock);
+        engine->stats.curr_bytes -= offsetof(dedup_block, data) + blk->nbytes;
+        cb_mutex_exit(&engine->stats.lock);
+        cb_free(blk);
+    }
+    *(dedup_block**)item_get_data(it) = NULL;
+}
+
+void item_copy_data(const hash_item *it, void *buf) {
+    if ((it->iflag & ITEM_CHUNKED) != 0) {
+        const item_chunk *chunk = item_get_chunk(it);
+        char *dst = buf;
+        while (chunk != NULL) {
+            memcpy(dst, chunk->data, chunk->used);
+            dst += chunk->used;
+            chunk = chunk->next;
+        }
+    } else if ((it->iflag & ITEM_SHARED) != 0) {
+        memcpy(buf, item_get_shared(it)->data, it->nbytes);
+    } else {
+        memcpy(buf, item_get_data(it), it->nbytes);
+    }
+}
+
+/*
+ * CAS id generation. Every mutation stamps a fresh id, so a single
+ * process-wide counter would be a contended cache line shared by all
+ * workers (and all buckets). Instead each thread leases a block of
+ * 2^20 ids from the global source and hands them out locally; the
+ * shared counter is only touched once per million mutations. Ids stay
+ * unique process-wide (blocks never overlap) and a key's CAS always
+ * changes on every mutation, which is all the store paths rely on -
+ * they only ever compare CAS values for equality, never for order.
+ * The source starts at 1 so the reserved "no CAS" value 0 is never
+ * handed out; wrapping the 64-bit space is not a practical concern.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define CAS_LEASE_SIZE (UINT64_C(1) << 20)
+
+static uint64_t cas_source = 1;
+static __thread uint64_t cas_next;
+static __thread uint64_t cas_end;
+
+static uint64_t get_cas_id(void) {
+    if (cas_next == cas_end) {
+        cas_next = __sync_fetch_and_add(&cas_source, CAS_LEASE_SIZE);
+        cas_end = cas_next + CAS_LEASE_SIZE;
+    }
+    return cas_next++;
+}
+#else
 /* Get the next CAS id for a new item. */
 static uint64_t get_cas_id(void) {
     static uint64_t cas_id = 0;
     return ++cas_id;
 }
+#endif
 
 /* Enable this for reference-count debugging. */
 #if 0
@@ -88,10 +479,148 @@ static uint64_t get_cas_id(void) {
 # define DEBUG_REFCNT(it,op) while(0)
 #endif
 
+/*
+ * Epoch-based reclamation backing the optimistic readers.
+ *
+ * A freed item block used to go straight back to the slabber, and the
+ * lock-free walk in item_get_copy survived only because slab memory is
+ * never unmapped and a torn read is discarded by the sequence
+ * validation. That argument doesn't cover the chain hop itself: a
+ * pointer loaded out of a recycled block is arbitrary bytes, which is
+ * also why the chunk chains of large values could never be followed
+ * without the lock.
+ *
+ * Now every reader announces the global epoch in its own slot before
+ * walking and clears it afterwards, and a freed block is parked on the
+ * owning engine's limbo list, stamped with the epoch at free time; it
+ * only returns to the slabber once no announced epoch is at or below
+ * its stamp. Every pointer a reader can load during its announced
+ * epoch therefore refers to a block which is still intact, making the
+ * walk sound instead of merely probable. Readers write nothing shared
+ * (the slot is the thread's own cache line), so a hot key is served
+ * without bouncing its refcount between cores; the refcount remains
+ * for the long-lived references (pinned responses, walk cursors)
+ * taken under the lock. With no reader in flight the limbo list
+ * drains on the very next free, so the idle cost is nil.
+ */
+#define EPOCH_MAX_READERS 64
+
+struct epoch_slot {
+    volatile uint64_t epoch;   /* 0 = not inside a read */
+    char pad[64 - sizeof(uint64_t)];
+};
+
+static struct epoch_slot epoch_readers[EPOCH_MAX_READERS];
+static volatile uint64_t epoch_global = 1;
+
+#if defined(__GNUC__) || defined(__clang__)
+static __thread int epoch_reader_slot = -1;
+
+static bool epoch_reader_enter(void) {
+    static volatile unsigned next_reader_slot;
+
+    if (epoch_reader_slot < 0) {
+        unsigned idx = __sync_fetch_and_add(&next_reader_slot, 1);
+        if (idx >= EPOCH_MAX_READERS) {
+            /* more threads than slots; this one reads under the lock */
+            return false;
+        }
+        epoch_reader_slot = (int)idx;
+    }
+    epoch_readers[epoch_reader_slot].epoch = epoch_global;
+    /* the announcement must be visible before any chain pointer is
+       loaded (pairs with the fence on the free side) */
+    __sync_synchronize();
+    return true;
+}
+
+static void epoch_reader_exit(void) {
+    epoch_readers[epoch_reader_slot].epoch = 0;
+}
+
+static void epoch_advance(void) {
+    __sync_fetch_and_add(&epoch_global, 1);
+}
+#else
+/* without the builtins there are never any announced readers, so the
+   limbo list drains immediately and behaviour matches the old
+   free-at-once scheme */
+static bool epoch_reader_enter(void) { return false; }
+static void epoch_reader_exit(void) { }
+static void epoch_advance(void) { ++epoch_global; }
+#endif
+
+/* the oldest epoch any in-flight reader announced (UINT64_MAX when no
+   reader is active at all) */
+static uint64_t epoch_min_active(void) {
+    uint64_t min = UINT64_MAX;
+    int ii;
+    for (ii = 0; ii < EPOCH_MAX_READERS; ++ii) {
+        uint64_t e = epoch_readers[ii].epoch;
+        if (e != 0 && e < min) {
+            min = e;
+        }
+    }
+    return min;
+}
+
+/* the reclaim stamp of a parked block lives in its dead time fields
+   (the pointer-sized fields chain the limbo list) */
+static void limbo_stamp_set(hash_item *it, uint64_t stamp) {
+    it->time = (rel_time_t)(stamp & 0xffffffff);
+    it->exptime = (rel_time_t)(stamp >> 32);
+}
+
+static uint64_t limbo_stamp_get(const hash_item *it) {
+    return ((uint64_t)it->exptime << 32) | it->time;
+}
+
+/*
+ * Return every parked block whose stamp no in-flight reader can still
+ * be at to the slabber. The list is stamp-ordered by construction, so
+ * draining from the head is enough. Caller holds items.lock.
+ */
+static void item_limbo_drain(struct default_engine *engine) {
+    const uint64_t min_active = epoch_min_active();
+    hash_item *it = engine->items.limbo_head;
+
+    while (it != NULL && limbo_stamp_get(it) < min_active) {
+        hash_item *next = it->next;
+        unsigned int clsid = it->slabs_clsid;
+
+        engine->items.limbo_bytes -= ITEM_memory(engine, it);
+        engine->items.limbo_count--;
+        if ((it->iflag & ITEM_CHUNKED) != 0) {
+            item_free_chunks(engine, it);
+        } else if ((it->iflag & ITEM_SHARED) != 0) {
+            item_release_shared(engine, it);
+        }
+        it->slabs_clsid = 0;
+        slabs_free(engine, it, ITEM_ntotal(engine, it), clsid);
+        it = next;
+    }
+    engine->items.limbo_head = it;
+    if (it == NULL) {
+        engine->items.limbo_tail = NULL;
+    }
+}
+
+
+/*
+ * Dead by flush? item_flush_expired() bumps the engine's flush epoch
+ * in O(1) instead of walking the LRU queues, so a flushed item is
+ * simply one stamped under an older epoch. Treated exactly like an
+ * expired item wherever it is met; the memory comes back through the
+ * scrubber and the allocation-time steal below.
+ */
+static bool item_is_flushed(const struct default_engine *engine,
+                            const hash_item *it) {
+    return it->fepoch != engine->items.flush_epoch;
+}
 
 /*@null@*/
 hash_item *do_item_alloc(struct default_engine *engine,
-                         const hash_key *key,
+                         const hash_key_view *key,
                          const int flags,
                          const rel_time_t exptime,
                          const int nbytes,
@@ -100,11 +629,11 @@ hash_item *do_item_alloc(struct default_engine *engine,
     hash_item *it = NULL;
     int tries = search_items;
     hash_item *search;
-    rel_time_t oldest_live;
     rel_time_t current_time;
     unsigned int id;
+    bool cold_admission = false;
 
-    size_t ntotal = sizeof(hash_item) + hash_key_get_alloc_size(key) + nbytes;
+    size_t ntotal = sizeof(hash_item) + hash_key_view_alloc_size(key) + nbytes;
     if (engine->config.use_cas) {
         ntotal += sizeof(uint64_t);
     }
@@ -115,14 +644,13 @@ hash_item *do_item_alloc(struct default_engine *engine,
 
     /* do a quick check if we have any expired items in the tail.. */
     tries = search_items;
-    oldest_live = engine->config.oldest_live;
     current_time = engine->server.core->get_current_time();
 
     for (search = engine->items.tails[id];
          tries > 0 && search != NULL;
          tries--, search=search->prev) {
         if (search->refcount == 0 &&
-            ((search->time < oldest_live) || /* dead by flush */
+            (item_is_flushed(engine, search) ||
              (search->exptime != 0 && search->exptime < current_time))) {
             it = search;
             /* I don't want to actually free the object, just steal
@@ -133,8 +661,26 @@ hash_item *do_item_alloc(struct default_engine *engine,
             cb_mutex_exit(&engine->stats.lock);
             engine->items.itemstats[id].reclaimed++;
             it->refcount = 1;
-            slabs_adjust_mem_requested(engine, it->slabs_clsid, ITEM_ntotal(engine, it), ntotal);
             do_item_unlink(engine, it);
+            /* Reusing the block in place is only safe when no
+             * optimistic reader is in flight (the fence orders the
+             * unlink against the slot scan; a reader announced after
+             * it can no longer reach the block). Otherwise park it
+             * like any other free and take the allocator path. */
+            SEQ_BARRIER();
+            if (epoch_min_active() != UINT64_MAX) {
+                it->refcount = 0;
+                item_free(engine, it);
+                it = NULL;
+                break;
+            }
+            slabs_adjust_mem_requested(engine, it->slabs_clsid, ITEM_ntotal(engine, it), ntotal);
+            if ((it->iflag & ITEM_CHUNKED) != 0) {
+                /* the block is reused below; the chain would leak */
+                item_free_chunks(engine, it);
+            } else if ((it->iflag & ITEM_SHARED) != 0) {
+                item_release_shared(engine, it);
+            }
             /* Initialize the item block: */
             it->slabs_clsid = 0;
             it->refcount = 0;
@@ -142,6 +688,12 @@ hash_item *do_item_alloc(struct default_engine *engine,
         }
     }
 
+    if (it == NULL) {
+        /* pick up anything whose readers have left before bothering
+           the allocator (and certainly before evicting live items) */
+        item_limbo_drain(engine);
+    }
+
     if (it == NULL && (it = slabs_alloc(engine, ntotal, id)) == NULL) {
         /*
         ** Could not find an expired item at the tail, and memory allocation
@@ -170,9 +722,47 @@ hash_item *do_item_alloc(struct default_engine *engine,
             return NULL;
         }
 
-        for (search = engine->items.tails[id]; tries > 0 && search != NULL; tries--, search=search->prev) {
+        search = engine->items.tails[id];
+        while (tries > 0 && search != NULL) {
+            hash_item *prev = search->prev;
+            if (search->refcount == 0 &&
+                (search->iflag & ITEM_ACTIVE) &&
+                (search->exptime == 0 || search->exptime > current_time)) {
+                /* Referenced since it last sank to the tail; pay the
+                 * deferred LRU bump now instead of evicting a hot item.
+                 */
+                search->iflag &= ~ITEM_ACTIVE;
+                item_unlink_q(engine, search);
+                search->time = current_time;
+                if (engine->items.policy == EVICTION_POLICY_TINYLFU) {
+                    /* Re-referenced while probationary: promote across
+                     * the boundary into the protected segment */
+                    search->iflag |= ITEM_PROTECTED;
+                    item_link_q(engine, search);
+                    engine->items.warm_sizes[id]++;
+                    engine->items.promotions++;
+                    /* cap the protected segment at 3/4 of the class */
+                    while (engine->items.warm_tails[id] != NULL &&
+                           engine->items.warm_sizes[id] * 4 >
+                           engine->items.sizes[id] * 3) {
+                        slru_demote(engine, id);
+                    }
+                } else {
+                    item_link_q(engine, search);
+                }
+                --tries;
+                search = prev;
+                continue;
+            }
             if (search->refcount == 0) {
                 if (search->exptime == 0 || search->exptime > current_time) {
+                    if (engine->items.policy == EVICTION_POLICY_TINYLFU &&
+                        sketch_estimate(&engine->items, hash_key_view_hash(key)) <
+                        sketch_estimate(&engine->items, search->khash)) {
+                        /* The victim is more popular than the candidate
+                         * displacing it; admit the candidate cold */
+                        cold_admission = true;
+                    }
                     engine->items.itemstats[id].evicted++;
                     engine->items.itemstats[id].evicted_time = current_time - search->time;
                     if (search->exptime != 0) {
@@ -185,6 +775,10 @@ hash_item *do_item_alloc(struct default_engine *engine,
                     engine->server.stat->evicting(cookie,
                                                   hash_key_get_client_key(search_key),
                                                   hash_key_get_client_key_len(search_key));
+                    /* hand the victim to the write-behind tier (takes
+                       a reference, so the memory isn't reused until
+                       the external store has a copy) */
+                    item_tier_evict_notify(engine, search);
                 } else {
                     engine->items.itemstats[id].reclaimed++;
                     cb_mutex_enter(&engine->stats.lock);
@@ -194,6 +788,8 @@ hash_item *do_item_alloc(struct default_engine *engine,
                 do_item_unlink(engine, search);
                 break;
             }
+            --tries;
+            search = prev;
         }
         it = slabs_alloc(engine, ntotal, id);
         if (it == 0) {
@@ -207,6 +803,13 @@ hash_item *do_item_alloc(struct default_engine *engine,
              */
             tries = search_items;
             for (search = engine->items.tails[id]; tries > 0 && search != NULL; tries--, search=search->prev) {
+                /* Skip walk cursors (scrubber/reaper/tap/dcp); they hold a
+                   reference for as long as they're linked and must never be
+                   "repaired". */
+                if (item_get_key(search)->header.len == 0 &&
+                    search->nbytes == 0) {
+                    continue;
+                }
                 if (search->refcount != 0 && search->time + TAIL_REPAIR_TIME < current_time) {
                     engine->items.itemstats[id].tailrepairs++;
                     search->refcount = 0;
@@ -228,31 +831,50 @@ hash_item *do_item_alloc(struct default_engine *engine,
     cb_assert(it != engine->items.heads[it->slabs_clsid]);
 
     it->next = it->prev = it->h_next = 0;
+    it->exp_next = it->exp_prev = 0;
     it->refcount = 1;     /* the caller will have a reference */
     DEBUG_REFCNT(it, '*');
     it->iflag = engine->config.use_cas ? ITEM_WITH_CAS : 0;
+    if (cold_admission) {
+        it->iflag |= ITEM_COLD;
+    }
     it->nbytes = nbytes;
     it->flags = flags;
     it->datatype = datatype;
     it->exptime = exptime;
-    hash_key_copy_to_item(it, key);
+    hash_key_view_copy_to_item(it, key);
     return it;
 }
 
 static void item_free(struct default_engine *engine, hash_item *it) {
-    size_t ntotal = ITEM_ntotal(engine, it);
-    unsigned int clsid;
     cb_assert((it->iflag & ITEM_LINKED) == 0);
     cb_assert(it != engine->items.heads[it->slabs_clsid]);
     cb_assert(it != engine->items.tails[it->slabs_clsid]);
     cb_assert(it->refcount == 0 || engine->scrubber.force_delete);
 
-    /* so slab size changer can tell later if item is already free or not */
-    clsid = it->slabs_clsid;
-    it->slabs_clsid = 0;
+    /* Park the block (and its chunk chain) on the limbo list instead
+       of freeing it: an optimistic reader may still hold a pointer at
+       it. The stamp keeps the list ordered, and advancing the global
+       epoch afterwards guarantees later readers announce a value
+       above it. The drain below reclaims everything whose readers
+       have since left - including, in the common no-reader case, the
+       block we just parked. */
     it->iflag |= ITEM_SLABBED;
     DEBUG_REFCNT(it, 'F');
-    slabs_free(engine, it, ntotal, clsid);
+    it->next = NULL;
+    limbo_stamp_set(it, epoch_global);
+    if (engine->items.limbo_tail != NULL) {
+        engine->items.limbo_tail->next = it;
+    } else {
+        engine->items.limbo_head = it;
+    }
+    engine->items.limbo_tail = it;
+    engine->items.limbo_count++;
+    engine->items.limbo_bytes += ITEM_memory(engine, it);
+    engine->items.deferred_frees++;
+    epoch_advance();
+
+    item_limbo_drain(engine);
 }
 
 static void item_link_q(struct default_engine *engine, hash_item *it) { /* item is the new head */
@@ -264,12 +886,50 @@ static void item_link_q(struct default_engine *engine, hash_item *it) { /* item
     tail = &engine->items.tails[it->slabs_clsid];
     cb_assert(it != *head);
     cb_assert((*head && *tail) || (*head == 0 && *tail == 0));
+
+    if (engine->items.policy == EVICTION_POLICY_TINYLFU &&
+        (it->iflag & ITEM_PROTECTED) == 0) {
+        if ((it->iflag & ITEM_COLD) != 0) {
+            /* The admission filter judged the item colder than its
+             * eviction victim: enter at the eviction end of the queue
+             * so it only stays if it proves itself */
+            it->iflag &= ~ITEM_COLD;
+            engine->items.cold_admissions++;
+            it->next = 0;
+            it->prev = *tail;
+            if (it->prev) it->prev->next = it;
+            *tail = it;
+            if (*head == 0) *head = it;
+            engine->items.sizes[it->slabs_clsid]++;
+            return;
+        }
+        if (engine->items.warm_tails[it->slabs_clsid] != NULL) {
+            /* New items enter at the head of the probationary segment,
+             * right behind the protected boundary */
+            hash_item *boundary = engine->items.warm_tails[it->slabs_clsid];
+            it->prev = boundary;
+            it->next = boundary->next;
+            if (it->next) {
+                it->next->prev = it;
+            } else {
+                *tail = it;
+            }
+            boundary->next = it;
+            engine->items.sizes[it->slabs_clsid]++;
+            return;
+        }
+    }
+
     it->prev = 0;
     it->next = *head;
     if (it->next) it->next->prev = it;
     *head = it;
     if (*tail == 0) *tail = it;
     engine->items.sizes[it->slabs_clsid]++;
+    if ((it->iflag & ITEM_PROTECTED) != 0 &&
+        engine->items.warm_tails[it->slabs_clsid] == NULL) {
+        engine->items.warm_tails[it->slabs_clsid] = it;
+    }
     return;
 }
 
@@ -293,22 +953,169 @@ static void item_unlink_q(struct default_engine *engine, hash_item *it) {
     if (it->next) it->next->prev = it->prev;
     if (it->prev) it->prev->next = it->next;
     engine->items.sizes[it->slabs_clsid]--;
+
+    if ((it->iflag & ITEM_PROTECTED) != 0) {
+        if (engine->items.warm_tails[it->slabs_clsid] == it) {
+            engine->items.warm_tails[it->slabs_clsid] = prev_protected(it);
+        }
+        engine->items.warm_sizes[it->slabs_clsid]--;
+        it->iflag &= ~ITEM_PROTECTED;
+    }
     return;
 }
 
+/********************************* EXPIRY WHEEL ******************************/
+
+/*
+ * Pick the wheel bucket an item with the given exptime belongs in,
+ * given how far the wheel has advanced. Items whose second has already
+ * been processed keep the level-0 slot their exptime maps to; they are
+ * picked up when the wheel wraps around to it again (or earlier by the
+ * lazy expiry on access). All of this runs under items.lock.
+ */
+static struct expiry_bucket *expiry_bucket_for(struct default_engine *engine,
+                                               rel_time_t exptime) {
+    rel_time_t eslot = exptime / EXPIRY_WHEEL_SECONDS;
+    rel_time_t cslot = engine->items.expiry_current / EXPIRY_WHEEL_SECONDS;
+
+    if (eslot <= cslot) {
+        return &engine->items.expiry_seconds[exptime % EXPIRY_WHEEL_SECONDS];
+    }
+    if (eslot - cslot < EXPIRY_WHEEL_COARSE) {
+        return &engine->items.expiry_coarse[eslot % EXPIRY_WHEEL_COARSE];
+    }
+    return &engine->items.expiry_overflow;
+}
+
+static void expiry_link(struct default_engine *engine, hash_item *it) {
+    struct expiry_bucket *bucket = expiry_bucket_for(engine, it->exptime);
+    it->exp_prev = NULL;
+    it->exp_next = bucket->head;
+    if (bucket->head != NULL) {
+        bucket->head->exp_prev = it;
+    }
+    bucket->head = it;
+    bucket->count++;
+}
+
+static void expiry_unlink(struct default_engine *engine, hash_item *it) {
+    struct expiry_bucket *bucket = expiry_bucket_for(engine, it->exptime);
+    if (it->exp_prev != NULL) {
+        it->exp_prev->exp_next = it->exp_next;
+    } else {
+        cb_assert(bucket->head == it);
+        bucket->head = it->exp_next;
+    }
+    if (it->exp_next != NULL) {
+        it->exp_next->exp_prev = it->exp_prev;
+    }
+    it->exp_next = it->exp_prev = NULL;
+    bucket->count--;
+}
+
+/*
+ * Detach a bucket's chain and re-place every item for the wheel's new
+ * position. Used when a coarse bucket comes into level-0 range and when
+ * the overflow is rescanned at the same cadence.
+ */
+static void expiry_redistribute(struct default_engine *engine,
+                                struct expiry_bucket *bucket) {
+    hash_item *it = bucket->head;
+    bucket->head = NULL;
+    bucket->count = 0;
+    while (it != NULL) {
+        hash_item *next = it->exp_next;
+        item_prefetch(next);
+        expiry_link(engine, it);
+        it = next;
+    }
+}
+
+/*
+ * CRC32C over an item's key and value bytes; the crc32c kernel picks
+ * the SSE4.2 / ARMv8 CRC instruction when the CPU has it (see
+ * hash_key_hash), so stamping and verifying costs a fraction of the
+ * memcpy that accompanies every store and read anyway.
+ */
+static uint32_t item_compute_crc(const hash_item *it) {
+    const hash_key *key = item_get_key(it);
+    uint32_t crc = crc32c(hash_key_get_client_key(key),
+                          hash_key_get_client_key_len(key), 0);
+    if ((it->iflag & ITEM_CHUNKED) != 0) {
+        const item_chunk *chunk = item_get_chunk(it);
+        while (chunk != NULL) {
+            crc = crc32c((const uint8_t*)chunk->data, chunk->used, crc);
+            chunk = chunk->next;
+        }
+    } else if ((it->iflag & ITEM_SHARED) != 0) {
+        crc = crc32c((const uint8_t*)item_get_shared(it)->data,
+                     it->nbytes, crc);
+    } else {
+        crc = crc32c((const uint8_t*)item_get_data(it), it->nbytes, crc);
+    }
+    return crc;
+}
+
+bool item_check_integrity(struct default_engine *engine, hash_item *it) {
+    if (!engine->config.integrity_check) {
+        return true;
+    }
+    /* fast path: compare without any locks (the caller's reference
+       keeps the block from being reused under us) */
+    if (item_compute_crc(it) == it->vcrc) {
+        return true;
+    }
+
+    cb_mutex_enter(&engine->items.lock);
+    /* rule out a racing in-place mutation (incr/decr re-stamps under
+       the lock) before declaring the item corrupt */
+    if (item_compute_crc(it) == it->vcrc) {
+        cb_mutex_exit(&engine->items.lock);
+        return true;
+    }
+    engine->items.crc_failures++;
+    /* quarantine: drop the item from the table so the corrupt bytes
+       can never be served again; the caller's reference keeps the
+       block alive until it is released */
+    if ((it->iflag & ITEM_LINKED) != 0) {
+        do_item_unlink(engine, it);
+    }
+    cb_mutex_exit(&engine->items.lock);
+
+    {
+        EXTENSION_LOGGER_DESCRIPTOR *logger;
+        logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Integrity check failed for a %u byte item in class "
+                    "%u; the item has been quarantined\n",
+                    it->nbytes, it->slabs_clsid);
+    }
+    return false;
+}
+
 int do_item_link(struct default_engine *engine, hash_item *it) {
     const hash_key* key = item_get_key(it);
     MEMCACHED_ITEM_LINK(hash_key_get_client_key(key), hash_key_get_client_key_len(key), it->nbytes);
     cb_assert((it->iflag & (ITEM_LINKED|ITEM_SLABBED)) == 0);
     it->iflag |= ITEM_LINKED;
     it->time = engine->server.core->get_current_time();
+    it->fepoch = engine->items.flush_epoch;
+    it->khash = hash_key_hash(key);
+    if (engine->config.integrity_check) {
+        it->vcrc = item_compute_crc(it);
+    }
+
+    /* Keep the stamp odd until the item is fully published (the CAS
+     * isn't assigned until below) so an optimistic reader who finds it
+     * through the hash chain in the meantime backs off */
+    it->seqno = (engine->items.seq_epoch += 2) - 1;
+    SEQ_BARRIER();
 
-    assoc_insert(engine, crc32c(hash_key_get_key(key),
-                                hash_key_get_key_len(key), 0),
-                 it);
+    assoc_insert(engine, it->khash, it);
+    exist_filter_link(&engine->items, it->khash);
 
     cb_mutex_enter(&engine->stats.lock);
-    engine->stats.curr_bytes += ITEM_ntotal(engine, it);
+    engine->stats.curr_bytes += ITEM_memory(engine, it);
     engine->stats.curr_items += 1;
     engine->stats.total_items += 1;
     cb_mutex_exit(&engine->stats.lock);
@@ -317,6 +1124,11 @@ int do_item_link(struct default_engine *engine, hash_item *it) {
     item_set_cas(NULL, NULL, it, get_cas_id());
 
     item_link_q(engine, it);
+    if (it->exptime != 0) {
+        expiry_link(engine, it);
+    }
+
+    item_seq_end(it);             /* now even: visible to readers */
 
     return 1;
 }
@@ -327,15 +1139,20 @@ void do_item_unlink(struct default_engine *engine, hash_item *it) {
                           hash_key_get_client_key_len(key),
                           it->nbytes);
     if ((it->iflag & ITEM_LINKED) != 0) {
+        /* leave the stamp odd: the block may be freed and reused, so
+         * any optimistic copy racing with this must fail validation */
+        item_seq_begin(it);
         it->iflag &= ~ITEM_LINKED;
         cb_mutex_enter(&engine->stats.lock);
-        engine->stats.curr_bytes -= ITEM_ntotal(engine, it);
+        engine->stats.curr_bytes -= ITEM_memory(engine, it);
         engine->stats.curr_items -= 1;
         cb_mutex_exit(&engine->stats.lock);
-        assoc_delete(engine, crc32c(hash_key_get_key(key),
-                                    hash_key_get_key_len(key), 0),
-                     key);
+        assoc_delete(engine, it->khash, key);
+        exist_filter_unlink(&engine->items, it->khash);
         item_unlink_q(engine, it);
+        if (it->exptime != 0) {
+            expiry_unlink(engine, it);
+        }
         if (it->refcount == 0 || engine->scrubber.force_delete) {
             item_free(engine, it);
         }
@@ -356,18 +1173,20 @@ void do_item_release(struct default_engine *engine, hash_item *it) {
 }
 
 void do_item_update(struct default_engine *engine, hash_item *it) {
-    rel_time_t current_time = engine->server.core->get_current_time();
     MEMCACHED_ITEM_UPDATE(hash_key_get_client_key(item_get_key(it)),
                           hash_key_get_client_key_len(item_get_key(it)),
                           it->nbytes);
-    if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
-        cb_assert((it->iflag & ITEM_SLABBED) == 0);
+    cb_assert((it->iflag & ITEM_SLABBED) == 0);
 
-        if ((it->iflag & ITEM_LINKED) != 0) {
-            item_unlink_q(engine, it);
-            it->time = current_time;
-            item_link_q(engine, it);
-        }
+    /*
+     * Don't reposition the item in the LRU on every access; just note
+     * that it has been referenced. If the item later sinks to the tail
+     * of its queue the eviction scan in do_item_alloc() sees the flag
+     * and bumps it back to the head instead of evicting it, so reads
+     * stop paying for list surgery entirely.
+     */
+    if ((it->iflag & ITEM_LINKED) != 0) {
+        it->iflag |= ITEM_ACTIVE;
     }
 }
 
@@ -395,9 +1214,7 @@ static void do_item_stats(struct default_engine *engine,
             int search = search_items;
             while (search > 0 &&
                    engine->items.tails[i] != NULL &&
-                   ((engine->config.oldest_live != 0 && /* Item flushd */
-                     engine->config.oldest_live <= current_time &&
-                     engine->items.tails[i]->time <= engine->config.oldest_live) ||
+                   (item_is_flushed(engine, engine->items.tails[i]) ||
                     (engine->items.tails[i]->exptime != 0 && /* and not expired */
                      engine->items.tails[i]->exptime < current_time))) {
                 --search;
@@ -428,8 +1245,55 @@ static void do_item_stats(struct default_engine *engine,
                            "%u", engine->items.itemstats[i].tailrepairs);;
             add_statistics(c, add_stats, prefix, i, "reclaimed",
                            "%u", engine->items.itemstats[i].reclaimed);;
+            if (engine->items.policy == EVICTION_POLICY_TINYLFU) {
+                add_statistics(c, add_stats, prefix, i, "warm", "%u",
+                               engine->items.warm_sizes[i]);
+            }
         }
     }
+
+    /* Hit-rate counters tagged with the active policy so runs with
+       different eviction policies can be compared directly */
+    add_statistics(c, add_stats, "items", -1, "eviction_policy", "%s",
+                   eviction_policy_name(engine->items.policy));
+    add_statistics(c, add_stats, "items", -1, "policy_hits", "%"PRIu64,
+                   engine->items.lookup_hits);
+    add_statistics(c, add_stats, "items", -1, "policy_misses", "%"PRIu64,
+                   engine->items.lookup_misses);
+    add_statistics(c, add_stats, "items", -1, "touch_inplace", "%"PRIu64,
+                   engine->items.touch_inplace);
+    add_statistics(c, add_stats, "items", -1, "touch_relink", "%"PRIu64,
+                   engine->items.touch_relink);
+    add_statistics(c, add_stats, "items", -1, "deferred_frees", "%"PRIu64,
+                   engine->items.deferred_frees);
+    add_statistics(c, add_stats, "items", -1, "crc_failures", "%"PRIu64,
+                   engine->items.crc_failures);
+    if (engine->items.exist_filter != NULL) {
+        add_statistics(c, add_stats, "items", -1, "exist_filter_fastpath",
+                       "%"PRIu64, engine->items.exist_filter_fastpath);
+    }
+    add_statistics(c, add_stats, "items", -1, "limbo_count", "%"PRIu64,
+                   engine->items.limbo_count);
+    add_statistics(c, add_stats, "items", -1, "limbo_bytes", "%"PRIu64,
+                   engine->items.limbo_bytes);
+    if (engine->items.dedup_table != NULL) {
+        add_statistics(c, add_stats, "items", -1, "dedup_blocks", "%"PRIu64,
+                       engine->items.dedup_blocks);
+        add_statistics(c, add_stats, "items", -1, "dedup_bytes", "%"PRIu64,
+                       engine->items.dedup_bytes);
+        add_statistics(c, add_stats, "items", -1, "dedup_hits", "%"PRIu64,
+                       engine->items.dedup_hits);
+        add_statistics(c, add_stats, "items", -1, "dedup_saved_bytes",
+                       "%"PRIu64, engine->items.dedup_saved);
+    }
+    if (engine->items.policy == EVICTION_POLICY_TINYLFU) {
+        add_statistics(c, add_stats, "items", -1, "promotions", "%"PRIu64,
+                       engine->items.promotions);
+        add_statistics(c, add_stats, "items", -1, "demotions", "%"PRIu64,
+                       engine->items.demotions);
+        add_statistics(c, add_stats, "items", -1, "cold_admissions",
+                       "%"PRIu64, engine->items.cold_admissions);
+    }
 }
 
 /** dumps out a list of objects of each size, with granularity of 32 bytes */
@@ -479,22 +1343,24 @@ static void do_item_stats_sizes(struct default_engine *engine,
 
 /** wrapper around assoc_find which does the lazy expiration logic */
 hash_item *do_item_get(struct default_engine *engine,
-                       const hash_key *key) {
+                       const hash_key_view *key) {
     rel_time_t current_time = engine->server.core->get_current_time();
-    hash_item *it = assoc_find(engine,
-                               crc32c(hash_key_get_key(key),
-                                      hash_key_get_key_len(key), 0),
-                               key);
+    uint32_t hash = hash_key_view_hash(key);
+    hash_item *it = assoc_find_view(engine, hash, key);
     int was_found = 0;
 
+    if (engine->items.policy == EVICTION_POLICY_TINYLFU) {
+        sketch_touch(&engine->items, hash);
+    }
+
     if (engine->config.verbose > 2) {
         EXTENSION_LOGGER_DESCRIPTOR *logger;
         logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
         if (it == NULL) {
             logger->log(EXTENSION_LOG_DEBUG, NULL,
                         "> NOT FOUND in bucket %d, %s",
-                        hash_key_get_bucket_index(key),
-                        hash_key_get_client_key(key));
+                        key->bucket_index,
+                        key->client_key);
         } else {
             logger->log(EXTENSION_LOG_DEBUG, NULL,
                         "> FOUND KEY in bucket %d, %s",
@@ -504,9 +1370,7 @@ hash_item *do_item_get(struct default_engine *engine,
         }
     }
 
-    if (it != NULL && engine->config.oldest_live != 0 &&
-        engine->config.oldest_live <= current_time &&
-        it->time <= engine->config.oldest_live) {
+    if (it != NULL && item_is_flushed(engine, it)) {
         do_item_unlink(engine, it);           /* MTSAFE - items.lock held */
         it = NULL;
     }
@@ -534,6 +1398,9 @@ hash_item *do_item_get(struct default_engine *engine,
         it->refcount++;
         DEBUG_REFCNT(it, '+');
         do_item_update(engine, it);
+        engine->items.lookup_hits++;
+    } else {
+        engine->items.lookup_misses++;
     }
 
     return it;
@@ -550,8 +1417,11 @@ static ENGINE_ERROR_CODE do_store_item(struct default_engine *engine,
                                        ENGINE_STORE_OPERATION operation,
                                        const void *cookie,
                                        hash_item** stored_item) {
-    const hash_key* key = item_get_key(it);
-    hash_item *old_it = do_item_get(engine, key);
+    hash_key_view key;
+    hash_item *old_it;
+
+    hash_key_view_from_key(&key, item_get_key(it));
+    old_it = do_item_get(engine, &key);
     ENGINE_ERROR_CODE stored = ENGINE_NOT_STORED;
 
     hash_item *new_it = NULL;
@@ -626,6 +1496,16 @@ static ENGINE_ERROR_CODE do_store_item(struct default_engine *engine,
  *
  * returns a response code to send back to the client.
  */
+/*
+ * A uint64 needs at most 20 ASCII digits. Counters are allocated at
+ * this fixed width with the unused tail space padded - which the parse
+ * above (safe_strtoull) already tolerates, and which the inline
+ * replacement below has always produced for shrinking values - so once
+ * an item has been through arithmetic every subsequent incr/decr is
+ * resolved in place: no allocation, no key copy, no LRU relink.
+ */
+#define ARITH_VALUE_WIDTH 20
+
 static ENGINE_ERROR_CODE do_add_delta(struct default_engine *engine,
                                       hash_item *it, const bool incr,
                                       const int64_t delta, item** ritem,
@@ -639,7 +1519,8 @@ static ENGINE_ERROR_CODE do_add_delta(struct default_engine *engine,
         return ENGINE_EINVAL;
     }
 
-    ptr = item_get_data(it);
+    ptr = (it->iflag & ITEM_SHARED) != 0 ? item_get_shared(it)->data
+                                         : item_get_data(it);
     memcpy(buf, ptr, it->nbytes);
     buf[it->nbytes] = '\0';
 
@@ -664,22 +1545,37 @@ static ENGINE_ERROR_CODE do_add_delta(struct default_engine *engine,
         return ENGINE_EINVAL;
     }
 
-    if (it->refcount == 1 && res <= (int)it->nbytes) {
-        /* we can do inline replacement */
+    if (it->refcount == 1 && (it->iflag & ITEM_SHARED) == 0 &&
+        res <= (int)it->nbytes) {
+        /* we can do inline replacement (a shared value block may be
+           referenced by other keys, so it is copy-on-write: take the
+           replacement path below) */
+        item_seq_begin(it);
         memcpy(item_get_data(it), buf, res);
         memset(item_get_data(it) + res, ' ', it->nbytes - res);
         item_set_cas(NULL, NULL, it, get_cas_id());
+        if (engine->config.integrity_check) {
+            it->vcrc = item_compute_crc(it);
+        }
+        item_seq_end(it);
         *ritem = it;
     } else {
-        hash_item *new_it = do_item_alloc(engine, item_get_key(it),
-                                          it->flags,
-                                          it->exptime, res,
-                                          cookie, it->datatype);
+        /* Replacement is unavoidable (the value outgrew the item, or a
+         * concurrent reader has it pinned), but allocate the successor
+         * at the fixed counter width so this is the last time: every
+         * later incr/decr takes the inline path above. */
+        const int width = (res < ARITH_VALUE_WIDTH) ? ARITH_VALUE_WIDTH : res;
+        hash_key_view vkey;
+        hash_item *new_it;
+        hash_key_view_from_key(&vkey, item_get_key(it));
+        new_it = do_item_alloc(engine, &vkey, it->flags,
+                               it->exptime, width, cookie, it->datatype);
         if (new_it == NULL) {
             do_item_unlink(engine, it);
             return ENGINE_ENOMEM;
         }
         memcpy(item_get_data(new_it), buf, res);
+        memset(item_get_data(new_it) + res, ' ', width - res);
         do_item_replace(engine, it, new_it);
         *ritem = new_it;
     }
@@ -697,17 +1593,39 @@ hash_item *item_alloc(struct default_engine *engine,
                       rel_time_t exptime, int nbytes, const void *cookie,
                       uint8_t datatype) {
     hash_item *it;
-    hash_key hkey;
-    if (!hash_key_create(&hkey, key, nkey, engine, cookie)) {
-        return NULL;
-    }
+    hash_key_view hkey;
+    hash_key_view_init(&hkey, key, nkey, engine->bucket_id);
     cb_mutex_enter(&engine->items.lock);
     it = do_item_alloc(engine, &hkey, flags, exptime, nbytes, cookie, datatype);
     cb_mutex_exit(&engine->items.lock);
-    hash_key_destroy(&hkey);
     return it;
 }
 
+/*
+ * Allocates a whole batch of items with a single acquisition of the
+ * cache lock.
+ */
+void item_alloc_bulk(struct default_engine *engine,
+                     item_batch_entry *entries,
+                     size_t count,
+                     const void *cookie) {
+    size_t ii;
+    cb_mutex_enter(&engine->items.lock);
+    for (ii = 0; ii < count; ++ii) {
+        item_batch_entry *entry = &entries[ii];
+        hash_key_view hkey;
+        if (entry->status != ENGINE_SUCCESS) {
+            continue;
+        }
+        hash_key_view_init(&hkey, entry->key, entry->nkey, engine->bucket_id);
+        entry->item = do_item_alloc(engine, &hkey, entry->flags,
+                                    entry->exptime, (int)entry->nbytes,
+                                    cookie, entry->datatype);
+        entry->status = (entry->item != NULL) ? ENGINE_SUCCESS : ENGINE_ENOMEM;
+    }
+    cb_mutex_exit(&engine->items.lock);
+}
+
 /*
  * Returns an item if it hasn't been marked as expired,
  * lazy-expiring as needed.
@@ -717,17 +1635,425 @@ hash_item *item_get(struct default_engine *engine,
                     const void *key,
                     const size_t nkey) {
     hash_item *it;
-    hash_key hkey;
-    if (!hash_key_create(&hkey, key, nkey, engine, cookie)) {
-        return NULL;
-    }
+    hash_key_view hkey;
+    hash_key_view_init(&hkey, key, nkey, engine->bucket_id);
     cb_mutex_enter(&engine->items.lock);
     it = do_item_get(engine, &hkey);
     cb_mutex_exit(&engine->items.lock);
-    hash_key_destroy(&hkey);
     return it;
 }
 
+/*
+ * Batched item_get. Hashes every key up front, prefetches the hash
+ * buckets and resolves the whole batch with a single acquisition of the
+ * cache lock (and at most one acquisition of each hash stripe lock), so
+ * the per-lookup locking and cache-miss cost is amortized over the
+ * batch. Applies the same lazy expiration as do_item_get.
+ */
+#define GET_MULTI_STRIDE 32
+
+void item_get_multi(struct default_engine *engine,
+                    const void *cookie,
+                    item_get_entry *entries,
+                    size_t count) {
+    while (count > 0) {
+        hash_key_view hkeys[GET_MULTI_STRIDE];
+        uint32_t hashes[GET_MULTI_STRIDE];
+        hash_item *found[GET_MULTI_STRIDE];
+        size_t batch = (count < GET_MULTI_STRIDE) ? count : GET_MULTI_STRIDE;
+        rel_time_t current_time;
+        size_t ii;
+
+        for (ii = 0; ii < batch; ++ii) {
+            hash_key_view_init(&hkeys[ii], entries[ii].key,
+                               entries[ii].nkey, engine->bucket_id);
+            hashes[ii] = hash_key_view_hash(&hkeys[ii]);
+            found[ii] = NULL;
+            assoc_prefetch(engine, hashes[ii]);
+        }
+
+        cb_mutex_enter(&engine->items.lock);
+        current_time = engine->server.core->get_current_time();
+        assoc_find_multi(engine, hashes, hkeys, found, batch);
+        for (ii = 0; ii < batch; ++ii) {
+            hash_item *it = found[ii];
+            if (engine->items.policy == EVICTION_POLICY_TINYLFU) {
+                sketch_touch(&engine->items, hashes[ii]);
+            }
+            if (it != NULL && item_is_flushed(engine, it)) {
+                do_item_unlink(engine, it);   /* MTSAFE - items.lock held */
+                it = NULL;
+            }
+            if (it != NULL && it->exptime != 0 &&
+                it->exptime <= current_time) {
+                do_item_unlink(engine, it);   /* MTSAFE - items.lock held */
+                it = NULL;
+            }
+            if (it != NULL) {
+                it->refcount++;
+                DEBUG_REFCNT(it, '+');
+                do_item_update(engine, it);
+                engine->items.lookup_hits++;
+                entries[ii].item = it;
+                entries[ii].status = ENGINE_SUCCESS;
+            } else {
+                engine->items.lookup_misses++;
+                entries[ii].item = NULL;
+                entries[ii].status = ENGINE_KEY_ENOENT;
+            }
+        }
+        cb_mutex_exit(&engine->items.lock);
+
+        entries += batch;
+        count -= batch;
+    }
+}
+
+/*
+ * Batched delete; the same stride/prefetch scheme as item_get_multi,
+ * but the matched items are unlinked instead of referenced. Expired
+ * items are lazily reaped and reported as ENGINE_KEY_ENOENT, matching
+ * what a single DELETE through do_item_get would have said.
+ */
+void item_remove_multi(struct default_engine *engine,
+                       item_remove_entry *entries,
+                       size_t count) {
+    while (count > 0) {
+        hash_key_view hkeys[GET_MULTI_STRIDE];
+        uint32_t hashes[GET_MULTI_STRIDE];
+        hash_item *found[GET_MULTI_STRIDE];
+        size_t batch = (count < GET_MULTI_STRIDE) ? count : GET_MULTI_STRIDE;
+        rel_time_t current_time;
+        size_t ii;
+
+        for (ii = 0; ii < batch; ++ii) {
+            hash_key_view_init(&hkeys[ii], entries[ii].key,
+                               entries[ii].nkey, engine->bucket_id);
+            hashes[ii] = hash_key_view_hash(&hkeys[ii]);
+            found[ii] = NULL;
+            assoc_prefetch(engine, hashes[ii]);
+        }
+
+        cb_mutex_enter(&engine->items.lock);
+        current_time = engine->server.core->get_current_time();
+        assoc_find_multi(engine, hashes, hkeys, found, batch);
+        for (ii = 0; ii < batch; ++ii) {
+            hash_item *it = found[ii];
+            if (it != NULL && item_is_flushed(engine, it)) {
+                do_item_unlink(engine, it);   /* MTSAFE - items.lock held */
+                it = NULL;
+            }
+            if (it != NULL && it->exptime != 0 &&
+                it->exptime <= current_time) {
+                do_item_unlink(engine, it);   /* MTSAFE - items.lock held */
+                it = NULL;
+            }
+            if (it == NULL) {
+                entries[ii].status = ENGINE_KEY_ENOENT;
+            } else if (entries[ii].cas == 0 ||
+                       entries[ii].cas == item_get_cas(it)) {
+                do_item_unlink(engine, it);   /* MTSAFE - items.lock held */
+                entries[ii].status = ENGINE_SUCCESS;
+            } else {
+                entries[ii].status = ENGINE_KEY_EEXISTS;
+            }
+        }
+        cb_mutex_exit(&engine->items.lock);
+
+        entries += batch;
+        count -= batch;
+    }
+}
+
+/*
+ * Existence probe for a single key. Nothing is referenced, promoted
+ * or materialized; when the existence filter rules the key out the
+ * cache lock isn't taken at all. Expired items are lazily reaped like
+ * everywhere else.
+ */
+ENGINE_ERROR_CODE item_exists(struct default_engine *engine,
+                              const void *key,
+                              const size_t nkey,
+                              uint64_t *cas) {
+    hash_key_view hkey;
+    uint32_t hash;
+    hash_item *it;
+    rel_time_t current_time;
+    ENGINE_ERROR_CODE ret = ENGINE_KEY_ENOENT;
+
+    hash_key_view_init(&hkey, key, nkey, engine->bucket_id);
+    hash = hash_key_view_hash(&hkey);
+    *cas = 0;
+
+    if (!exist_filter_maybe(&engine->items, hash)) {
+        /* statistic only; torn updates are acceptable */
+        engine->items.exist_filter_fastpath++;
+        return ENGINE_KEY_ENOENT;
+    }
+
+    cb_mutex_enter(&engine->items.lock);
+    current_time = engine->server.core->get_current_time();
+    it = assoc_find_view(engine, hash, &hkey);
+    if (it != NULL && item_is_flushed(engine, it)) {
+        do_item_unlink(engine, it);   /* MTSAFE - items.lock held */
+        it = NULL;
+    }
+    if (it != NULL && it->exptime != 0 && it->exptime <= current_time) {
+        do_item_unlink(engine, it);   /* MTSAFE - items.lock held */
+        it = NULL;
+    }
+    if (it != NULL) {
+        *cas = item_get_cas(it);
+        ret = ENGINE_SUCCESS;
+    }
+    cb_mutex_exit(&engine->items.lock);
+    return ret;
+}
+
+/*
+ * Batched existence probe; the same stride/prefetch scheme as
+ * item_get_multi. The filter screens each stride first and only the
+ * survivors are looked up, so a negative-heavy stride may resolve
+ * without the cache lock entirely.
+ */
+void item_exists_multi(struct default_engine *engine,
+                       item_exist_entry *entries,
+                       size_t count) {
+    while (count > 0) {
+        hash_key_view hkeys[GET_MULTI_STRIDE];
+        uint32_t hashes[GET_MULTI_STRIDE];
+        hash_item *found[GET_MULTI_STRIDE];
+        size_t idx[GET_MULTI_STRIDE];
+        size_t take = (count < GET_MULTI_STRIDE) ? count : GET_MULTI_STRIDE;
+        size_t nbatch = 0;
+        rel_time_t current_time;
+        size_t ii;
+
+        for (ii = 0; ii < take; ++ii) {
+            hash_key_view hkey;
+            uint32_t hash;
+            hash_key_view_init(&hkey, entries[ii].key, entries[ii].nkey,
+                               engine->bucket_id);
+            hash = hash_key_view_hash(&hkey);
+            entries[ii].cas = 0;
+            entries[ii].status = ENGINE_KEY_ENOENT;
+            if (!exist_filter_maybe(&engine->items, hash)) {
+                /* statistic only; torn updates are acceptable */
+                engine->items.exist_filter_fastpath++;
+                continue;
+            }
+            hkeys[nbatch] = hkey;
+            hashes[nbatch] = hash;
+            found[nbatch] = NULL;
+            idx[nbatch] = ii;
+            assoc_prefetch(engine, hash);
+            ++nbatch;
+        }
+
+        if (nbatch > 0) {
+            cb_mutex_enter(&engine->items.lock);
+            current_time = engine->server.core->get_current_time();
+            assoc_find_multi(engine, hashes, hkeys, found, nbatch);
+            for (ii = 0; ii < nbatch; ++ii) {
+                hash_item *it = found[ii];
+                if (it != NULL && item_is_flushed(engine, it)) {
+                    do_item_unlink(engine, it); /* MTSAFE - items.lock held */
+                    it = NULL;
+                }
+                if (it != NULL && it->exptime != 0 &&
+                    it->exptime <= current_time) {
+                    do_item_unlink(engine, it); /* MTSAFE - items.lock held */
+                    it = NULL;
+                }
+                if (it != NULL) {
+                    entries[idx[ii]].cas = item_get_cas(it);
+                    entries[idx[ii]].status = ENGINE_SUCCESS;
+                }
+            }
+            cb_mutex_exit(&engine->items.lock);
+        }
+
+        entries += take;
+        count -= take;
+    }
+}
+
+/*
+ * Optimistic (lock-free) read. Walks the hash chain without taking any
+ * locks, copies the value into the caller's buffer and validates the
+ * item's sequence stamp afterwards; if the stamp changed (or was odd to
+ * begin with) the item was concurrently mutated and the copy is thrown
+ * away. Never touches the refcount or the LRU.
+ *
+ * The caller (item_get_copy) has announced a reader epoch, so every
+ * block this walk can reach - including the chunk chain of a large
+ * value - stays intact until we're done (see epoch_reader_enter).
+ * Torn contents are still possible when an item is mutated in place
+ * under our feet; those copies are discarded by the sequence
+ * validation, and every length is clamped against the caller's buffer
+ * first. Anything this function can't serve (oversized keys or
+ * values, expired items, sequence conflicts) falls back to the locked
+ * path: a false return is NOT an authoritative miss.
+ */
+#define GET_COPY_RETRIES 3
+#define GET_COPY_MAX_DEPTH 32
+#define GET_COPY_MAX_CHUNKS 128
+
+static bool do_item_get_copy(struct default_engine *engine,
+                             const void *key,
+                             const size_t nkey,
+                             void *buffer,
+                             const size_t buffsize,
+                             item_info *info) {
+    hash_key_view hkey;
+    uint32_t hash;
+    rel_time_t current_time;
+    int retry;
+
+    hash_key_view_init(&hkey, key, nkey, engine->bucket_id);
+    hash = hash_key_view_hash(&hkey);
+    current_time = engine->server.core->get_current_time();
+
+    for (retry = 0; retry < GET_COPY_RETRIES; ++retry) {
+        hash_item *it = assoc_peek(engine, hash);
+        int depth = 0;
+        bool conflict = false;
+
+        while (it != NULL && depth++ < GET_COPY_MAX_DEPTH) {
+            uint32_t seq1;
+            const hash_key *ikey;
+            const uint8_t *ikey_bytes;
+            uint32_t nb;
+
+            if (it->khash != hash) {
+                it = it->h_next;
+                continue;
+            }
+            seq1 = it->seqno;
+            SEQ_BARRIER();
+            if (seq1 & 1) {
+                /* being mutated (or already unlinked) right now */
+                conflict = true;
+                break;
+            }
+            /* The item's key always lives inline in key_storage (see
+             * hash_key_view_copy_to_item); compare against that
+             * directly instead of chasing the full_key pointer, which
+             * may be garbage if the block was recycled under our
+             * feet. */
+            ikey = item_get_key(it);
+            ikey_bytes = (const uint8_t*)&ikey->key_storage;
+            if (hash_key_get_key_len(ikey) != hash_key_view_total_len(&hkey) ||
+                !cb_memeq(ikey_bytes, &hkey.bucket_index,
+                          sizeof(hkey.bucket_index)) ||
+                !cb_memeq(ikey_bytes + sizeof(hkey.bucket_index),
+                          hkey.client_key, hkey.client_len)) {
+                it = it->h_next;
+                continue;
+            }
+            if ((it->iflag & ITEM_LINKED) == 0) {
+                return false;
+            }
+            nb = it->nbytes;
+            if (nb > buffsize) {
+                return false;
+            }
+            if (item_is_flushed(engine, it)) {
+                /* flushed; let the locked path lazy-expire it */
+                return false;
+            }
+            if (it->exptime != 0 && it->exptime <= current_time) {
+                return false;
+            }
+
+            info->cas = item_get_cas(it);
+            info->vbucket_uuid = 0;
+            info->seqno = 0;
+            info->exptime = it->exptime;
+            info->nbytes = nb;
+            info->flags = it->flags;
+            info->datatype = it->datatype;
+            info->clsid = it->slabs_clsid;
+            info->nkey = (uint16_t)nkey;
+            info->nvalue = 1;
+            info->key = NULL;
+            info->value[0].iov_base = buffer;
+            info->value[0].iov_len = nb;
+            if ((it->iflag & ITEM_CHUNKED) != 0) {
+                /* Follow the chunk chain; the blocks can't be
+                 * reclaimed during our epoch, but a racing mutation
+                 * can still leave garbage lengths, so clamp every hop
+                 * and let the sequence check throw the copy away. */
+                const item_chunk *chunk = item_get_chunk(it);
+                char *dst = buffer;
+                uint32_t remaining = nb;
+                int hops = 0;
+
+                while (chunk != NULL && remaining > 0 &&
+                       hops++ < GET_COPY_MAX_CHUNKS) {
+                    uint32_t used = chunk->used;
+                    if (used > remaining) {
+                        used = remaining;
+                    }
+                    memcpy(dst, chunk->data, used);
+                    dst += used;
+                    remaining -= used;
+                    chunk = chunk->next;
+                }
+                if (remaining != 0) {
+                    SEQ_BARRIER();
+                    if (it->seqno == seq1) {
+                        /* consistent but unservable (absurdly long
+                         * chain); let the locked path deal with it */
+                        return false;
+                    }
+                    conflict = true;
+                    break;
+                }
+            } else if ((it->iflag & ITEM_SHARED) != 0) {
+                /* The shared value block can't be reclaimed during our
+                 * epoch (item_release_shared only runs once no reader
+                 * can still reach the item), so a single copy is safe;
+                 * the sequence check below catches a racing
+                 * replacement. */
+                memcpy(buffer, item_get_shared(it)->data, nb);
+            } else {
+                memcpy(buffer, (const char*)ikey_bytes +
+                               hash_key_get_key_len(ikey), nb);
+            }
+
+            SEQ_BARRIER();
+            if (it->seqno == seq1) {
+                return true;
+            }
+            conflict = true;
+            break;
+        }
+        if (!conflict) {
+            /* clean walk without finding the key; a concurrent link may
+             * still have raced us, so report "don't know", not "miss" */
+            return false;
+        }
+    }
+    return false;
+}
+
+bool item_get_copy(struct default_engine *engine,
+                   const void *key,
+                   const size_t nkey,
+                   void *buffer,
+                   const size_t buffsize,
+                   item_info *info) {
+    bool ret;
+
+    if (!epoch_reader_enter()) {
+        return false;
+    }
+    ret = do_item_get_copy(engine, key, nkey, buffer, buffsize, info);
+    epoch_reader_exit();
+    return ret;
+}
+
 /*
  * Decrements the reference count on an item and adds it to the freelist if
  * needed.
@@ -749,7 +2075,7 @@ void item_unlink(struct default_engine *engine, hash_item *item) {
 
 static ENGINE_ERROR_CODE do_arithmetic(struct default_engine *engine,
                                        const void* cookie,
-                                       const hash_key* key,
+                                       const hash_key_view* key,
                                        const bool increment,
                                        const bool create,
                                        const uint64_t delta,
@@ -772,13 +2098,17 @@ static ENGINE_ERROR_CODE do_arithmetic(struct default_engine *engine,
          if (len < 0 || len >= sizeof(buffer)) {
              return ENGINE_ENOMEM;
          }
+         /* Born as a counter: allocate the fixed width up front so
+          * every incr/decr on it is resolved in place (see
+          * do_add_delta) */
+         memset(buffer + len, ' ', ARITH_VALUE_WIDTH - len);
 
-         item = do_item_alloc(engine, key, 0, exptime, len, cookie,
-                              datatype);
+         item = do_item_alloc(engine, key, 0, exptime, ARITH_VALUE_WIDTH,
+                              cookie, datatype);
          if (item == NULL) {
             return ENGINE_ENOMEM;
          }
-         memcpy((void*)item_get_data(item), buffer, len);
+         memcpy((void*)item_get_data(item), buffer, ARITH_VALUE_WIDTH);
          if ((ret = do_store_item(engine, item, OPERATION_ADD, cookie,
                                   (hash_item**)result_item)) == ENGINE_SUCCESS) {
              *result = initial;
@@ -808,19 +2138,260 @@ ENGINE_ERROR_CODE arithmetic(struct default_engine *engine,
                              uint64_t *result)
 {
     ENGINE_ERROR_CODE ret;
-    hash_key hkey;
-    if (!hash_key_create(&hkey, key, nkey, engine, cookie)) {
-        return ENGINE_ENOMEM;
-    }
+    hash_key_view hkey;
+    hash_key_view_init(&hkey, key, nkey, engine->bucket_id);
     cb_mutex_enter(&engine->items.lock);
     ret = do_arithmetic(engine, cookie, &hkey, increment,
                         create, delta, initial, exptime, item,
                         datatype, result);
     cb_mutex_exit(&engine->items.lock);
-    hash_key_destroy(&hkey);
     return ret;
 }
 
+/*
+ * If transparent compression is enabled and the value is worth it,
+ * build a compressed shadow of the item to link in place of the raw
+ * one. The shadow carries the COMPRESSED datatype bit so the frontend
+ * (which already inflates for clients without datatype support) and
+ * datatype-aware clients both do the right thing with the value.
+ *
+ * Runs without the cache lock held; the compression work therefore
+ * never extends the lock hold time of the store itself. Returns NULL
+ * when the item should be stored as-is: compression disabled, value
+ * under the threshold, value already compressed by the client, or the
+ * value didn't shrink.
+ */
+static hash_item *item_compress_maybe(struct default_engine *engine,
+                                      hash_item *it,
+                                      const void *cookie) {
+    const hash_key* key;
+    size_t clen;
+    char *buf;
+    hash_item *nit;
+
+    if (!engine->config.compression ||
+        it->nbytes < engine->config.compress_threshold ||
+        (it->datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) != 0) {
+        return NULL;
+    }
+
+    clen = snappy_max_compressed_length(it->nbytes);
+    buf = cb_malloc(clen);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    if (snappy_compress(item_get_data(it), it->nbytes, buf, &clen)
+        != SNAPPY_OK || clen >= it->nbytes) {
+        /* incompressible; keep the raw value */
+        cb_free(buf);
+        return NULL;
+    }
+
+    key = item_get_key(it);
+    nit = item_alloc(engine, hash_key_get_client_key(key),
+                     hash_key_get_client_key_len(key), it->flags,
+                     it->exptime, (int)clen, cookie,
+                     it->datatype | PROTOCOL_BINARY_DATATYPE_COMPRESSED);
+    if (nit == NULL) {
+        cb_free(buf);
+        return NULL;
+    }
+    memcpy(item_get_data(nit), buf, clen);
+    cb_free(buf);
+
+    /* a CAS store must validate against the caller's item */
+    item_set_cas(NULL, NULL, nit, item_get_cas(it));
+
+    slabs_record_compression(engine, nit->slabs_clsid, it->nbytes - clen);
+    return nit;
+}
+
+/* fixed allocation size targeted for value chunks; the usable capacity
+   is whatever the slab class this maps to actually hands out */
+#define ITEM_CHUNK_ALLOC (16 * 1024)
+
+/*
+ * If the value is at least config.chunk_threshold bytes, rebuild the
+ * item as a chunk chain (see item_chunk in items.h) so it stops paying
+ * the power-of-N rounding of the huge slab classes. Runs without the
+ * cache lock held. Returns the chunked replacement, or NULL when the
+ * item should be stored as it is: chunking disabled, value under the
+ * threshold, or out of memory building the chain.
+ */
+static hash_item *item_chunk_maybe(struct default_engine *engine,
+                                   hash_item *it,
+                                   const void *cookie) {
+    const hash_key* key;
+    hash_item *nit;
+    item_chunk *head = NULL;
+    item_chunk **tailp = &head;
+    unsigned int clsid;
+    size_t alloc_size;
+    size_t capacity;
+    uint32_t remaining;
+    const char *src;
+
+    if (engine->config.chunk_threshold == 0 ||
+        it->nbytes < engine->config.chunk_threshold ||
+        (it->iflag & ITEM_CHUNKED) != 0) {
+        return NULL;
+    }
+
+    /* The frontend inflates compressed values for clients without
+       datatype support and needs them in one piece for that; leave
+       compressed values contiguous. */
+    if ((it->datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) != 0) {
+        return NULL;
+    }
+
+    if ((clsid = slabs_clsid(engine, ITEM_CHUNK_ALLOC)) == 0) {
+        return NULL;
+    }
+    alloc_size = slabs_class_size(engine, clsid);
+    capacity = alloc_size - offsetof(item_chunk, data);
+
+    key = item_get_key(it);
+    nit = item_alloc(engine, hash_key_get_client_key(key),
+                     hash_key_get_client_key_len(key), it->flags,
+                     it->exptime, (int)sizeof(item_chunk*), cookie,
+                     it->datatype);
+    if (nit == NULL) {
+        return NULL;
+    }
+
+    remaining = it->nbytes;
+    src = item_get_data(it);
+    while (remaining > 0) {
+        uint32_t copy = remaining < capacity ? remaining : (uint32_t)capacity;
+        item_chunk *chunk = slabs_alloc(engine, alloc_size, clsid);
+        if (chunk == NULL) {
+            while (head != NULL) {
+                item_chunk *next = head->next;
+                slabs_free(engine, head, alloc_size, clsid);
+                head = next;
+            }
+            /* still a perfectly ordinary (tiny) item at this point */
+            item_release(engine, nit);
+            return NULL;
+        }
+        chunk->next = NULL;
+        chunk->used = copy;
+        chunk->size = (uint32_t)capacity;
+        chunk->clsid = (uint8_t)clsid;
+        memcpy(chunk->data, src, copy);
+        src += copy;
+        remaining -= copy;
+        *tailp = chunk;
+        tailp = &chunk->next;
+    }
+
+    *(item_chunk**)item_get_data(nit) = head;
+    nit->iflag |= ITEM_CHUNKED;
+    nit->nbytes = it->nbytes;
+
+    /* a CAS store must validate against the caller's item */
+    item_set_cas(NULL, NULL, nit, item_get_cas(it));
+    return nit;
+}
+
+/*
+ * The optional rewrite pass stores go through before the cache lock is
+ * taken: compression first (it wants the raw contiguous bytes), then
+ * chunking of whatever is still above the chunk threshold. Returns the
+ * item to link in place of the caller's, or NULL to store it as-is.
+ */
+static hash_item *item_rewrite_maybe(struct default_engine *engine,
+                                     hash_item *it,
+                                     const void *cookie) {
+    hash_item *compressed = item_compress_maybe(engine, it, cookie);
+    hash_item *base = compressed != NULL ? compressed : it;
+    hash_item *chunked = item_chunk_maybe(engine, base, cookie);
+    if (chunked != NULL) {
+        if (compressed != NULL) {
+            item_release(engine, compressed);
+        }
+        return chunked;
+    }
+    return compressed;
+}
+
+/*
+ * The dedup pass: replace an eligible item with a small stub
+ * referencing a shared value block. Unlike the rewrite pass this runs
+ * INSIDE items.lock - the dedup table and the block refcounts are
+ * protected by it. Returns the stub to store in place of the caller's
+ * item (the caller releases it after the store), or NULL to store the
+ * item as-is. A miss creates a new block, so every eligible store pays
+ * the stub + block cost up front; the saving arrives when a second key
+ * stores the same bytes.
+ */
+static hash_item *do_item_share_maybe(struct default_engine *engine,
+                                      hash_item *it,
+                                      const void *cookie) {
+    uint32_t vhash;
+    dedup_block *blk;
+    hash_item *nit;
+    hash_key_view vkey;
+
+    if (engine->items.dedup_table == NULL ||
+        it->nbytes < engine->config.dedup_min_size ||
+        it->nbytes <= sizeof(dedup_block*) ||
+        (it->iflag & (ITEM_CHUNKED | ITEM_SHARED)) != 0) {
+        return NULL;
+    }
+
+    /* allocate the stub first so a failure needs no block cleanup */
+    hash_key_view_from_key(&vkey, item_get_key(it));
+    nit = do_item_alloc(engine, &vkey, it->flags, it->exptime,
+                        (int)sizeof(dedup_block*), cookie, it->datatype);
+    if (nit == NULL) {
+        return NULL;
+    }
+
+    vhash = crc32c((const uint8_t*)item_get_data(it), it->nbytes, 0);
+    for (blk = engine->items.dedup_table[vhash & engine->items.dedup_mask];
+         blk != NULL; blk = blk->h_next) {
+        if (blk->vhash == vhash && blk->nbytes == it->nbytes &&
+            memcmp(blk->data, item_get_data(it), it->nbytes) == 0) {
+            break;
+        }
+    }
+
+    if (blk != NULL) {
+        engine->items.dedup_hits++;
+        engine->items.dedup_saved += it->nbytes;
+    } else {
+        dedup_block **bucket;
+        blk = cb_malloc(offsetof(dedup_block, data) + it->nbytes);
+        if (blk == NULL) {
+            do_item_release(engine, nit);
+            return NULL;
+        }
+        blk->vhash = vhash;
+        blk->nbytes = it->nbytes;
+        blk->refcount = 0;
+        memcpy(blk->data, item_get_data(it), it->nbytes);
+        bucket = &engine->items.dedup_table[vhash & engine->items.dedup_mask];
+        blk->h_next = *bucket;
+        *bucket = blk;
+        engine->items.dedup_blocks++;
+        engine->items.dedup_bytes += offsetof(dedup_block, data) + it->nbytes;
+        cb_mutex_enter(&engine->stats.lock);
+        engine->stats.curr_bytes += offsetof(dedup_block, data) + it->nbytes;
+        cb_mutex_exit(&engine->stats.lock);
+    }
+
+    *(dedup_block**)item_get_data(nit) = blk;
+    blk->refcount++;
+    nit->iflag |= ITEM_SHARED;
+    nit->nbytes = it->nbytes;
+
+    /* a CAS store must validate against the caller's item */
+    item_set_cas(NULL, NULL, nit, item_get_cas(it));
+    return nit;
+}
+
 /*
  * Stores an item in the cache (high level, obeys set/add/replace semantics)
  */
@@ -830,23 +2401,354 @@ ENGINE_ERROR_CODE store_item(struct default_engine *engine,
                              const void *cookie) {
     ENGINE_ERROR_CODE ret;
     hash_item* stored_item = NULL;
+    hash_item* shadow = item_rewrite_maybe(engine, item, cookie);
+    hash_item* candidate;
+    hash_item* shared;
 
     cb_mutex_enter(&engine->items.lock);
-    ret = do_store_item(engine, item, operation, cookie, &stored_item);
+    candidate = shadow != NULL ? shadow : item;
+    shared = do_item_share_maybe(engine, candidate, cookie);
+    if (shared != NULL) {
+        candidate = shared;
+    }
+    ret = do_store_item(engine, candidate, operation, cookie, &stored_item);
     if (ret == ENGINE_SUCCESS) {
         *cas = item_get_cas(stored_item);
     }
+    if (shared != NULL) {
+        /* the LRU link (or the failed store) owns it now; a failed
+           store sends the stub through the limbo list, which drops
+           the block reference */
+        do_item_release(engine, shared);
+    }
+    if (shadow != NULL) {
+        /* the LRU link (or the failed store) owns it now */
+        do_item_release(engine, shadow);
+    }
+    cb_mutex_exit(&engine->items.lock);
+    return ret;
+}
+
+/*
+ * Stores a whole batch of items with a single acquisition of the cache
+ * lock.
+ */
+void store_item_bulk(struct default_engine *engine,
+                     item_batch_entry *entries,
+                     size_t count,
+                     ENGINE_STORE_OPERATION operation,
+                     const void *cookie) {
+    size_t ii;
+    hash_item **shadows = NULL;
+
+    /* Run the rewrite pass (outside the lock) before the batch takes it */
+    if (engine->config.compression || engine->config.chunk_threshold != 0) {
+        shadows = cb_calloc(count, sizeof(hash_item*));
+        if (shadows != NULL) {
+            for (ii = 0; ii < count; ++ii) {
+                if (entries[ii].status == ENGINE_SUCCESS &&
+                    entries[ii].item != NULL) {
+                    shadows[ii] = item_rewrite_maybe(engine,
+                                                     entries[ii].item,
+                                                     cookie);
+                }
+            }
+        }
+    }
+
+    cb_mutex_enter(&engine->items.lock);
+    for (ii = 0; ii < count; ++ii) {
+        item_batch_entry *entry = &entries[ii];
+        hash_item *stored_item = NULL;
+        hash_item *candidate = entry->item;
+        if (entry->status != ENGINE_SUCCESS) {
+            continue;
+        }
+        if (shadows != NULL && shadows[ii] != NULL) {
+            candidate = shadows[ii];
+        }
+        {
+            hash_item *shared = do_item_share_maybe(engine, candidate,
+                                                    cookie);
+            if (shared != NULL) {
+                candidate = shared;
+            }
+            entry->status = do_store_item(engine, candidate, operation,
+                                          cookie, &stored_item);
+            if (entry->status == ENGINE_SUCCESS) {
+                entry->cas = item_get_cas(stored_item);
+            }
+            if (shared != NULL) {
+                do_item_release(engine, shared);
+            }
+        }
+        if (shadows != NULL && shadows[ii] != NULL) {
+            do_item_release(engine, shadows[ii]);
+        }
+    }
+    cb_mutex_exit(&engine->items.lock);
+    cb_free(shadows);
+}
+
+/*
+ * Extend a linked item's value in place. Requires items.lock and that
+ * the caller holds the only reference (so no other connection can be
+ * scattering the value out while it grows; the same rule do_add_delta
+ * uses for its inline replacement). Chunked items fill the slack at
+ * the tail of the chain and grow it; plain items use whatever slack
+ * their slab chunk has beyond ITEM_ntotal.
+ */
+static ENGINE_ERROR_CODE do_item_append_inplace(struct default_engine *engine,
+                                                hash_item *it,
+                                                const void *data,
+                                                size_t ndata) {
+    if ((it->iflag & ITEM_CHUNKED) != 0) {
+        item_chunk *tail = item_get_chunk(it);
+        item_chunk *extra = NULL;
+        item_chunk **tailp = &extra;
+        item_chunk *chunk;
+        const char *src = data;
+        size_t remaining = ndata;
+        size_t slack;
+        size_t copy;
+
+        while (tail->next != NULL) {
+            tail = tail->next;
+        }
+        slack = tail->size - tail->used;
+
+        /* allocate what the slack can't hold up front so a failure
+           leaves the item untouched */
+        if (remaining > slack) {
+            unsigned int clsid = slabs_clsid(engine, ITEM_CHUNK_ALLOC);
+            size_t alloc_size;
+            size_t capacity;
+            size_t need;
+            size_t added = 0;
+
+            if (clsid == 0) {
+                return ENGINE_ENOTSUP;
+            }
+            alloc_size = slabs_class_size(engine, clsid);
+            capacity = alloc_size - offsetof(item_chunk, data);
+            need = remaining - slack;
+            while (need > 0) {
+                chunk = slabs_alloc(engine, alloc_size, clsid);
+                if (chunk == NULL) {
+                    while (extra != NULL) {
+                        item_chunk *next = extra->next;
+                        slabs_free(engine, extra, alloc_size, clsid);
+                        extra = next;
+                    }
+                    /* let the ordinary store path (which can evict)
+                       have a go at it */
+                    return ENGINE_ENOTSUP;
+                }
+                chunk->next = NULL;
+                chunk->used = need < capacity ? (uint32_t)need
+                                              : (uint32_t)capacity;
+                chunk->size = (uint32_t)capacity;
+                chunk->clsid = (uint8_t)clsid;
+                need -= chunk->used;
+                added += alloc_size;
+                *tailp = chunk;
+                tailp = &chunk->next;
+            }
+            cb_mutex_enter(&engine->stats.lock);
+            engine->stats.curr_bytes += added;
+            cb_mutex_exit(&engine->stats.lock);
+        }
+
+        item_seq_begin(it);
+        copy = remaining < slack ? remaining : slack;
+        memcpy(tail->data + tail->used, src, copy);
+        tail->used += (uint32_t)copy;
+        src += copy;
+        for (chunk = extra; chunk != NULL; chunk = chunk->next) {
+            memcpy(chunk->data, src, chunk->used);
+            src += chunk->used;
+        }
+        tail->next = extra;
+    } else {
+        size_t ntotal = ITEM_ntotal(engine, it);
+        if (ntotal + ndata > slabs_class_size(engine, it->slabs_clsid)) {
+            return ENGINE_ENOTSUP;
+        }
+        item_seq_begin(it);
+        memcpy(item_get_data(it) + it->nbytes, data, ndata);
+        slabs_adjust_mem_requested(engine, it->slabs_clsid, ntotal,
+                                   ntotal + ndata);
+        cb_mutex_enter(&engine->stats.lock);
+        engine->stats.curr_bytes += ndata;
+        cb_mutex_exit(&engine->stats.lock);
+    }
+
+    it->nbytes += (uint32_t)ndata;
+    /* the frontend's copy path stores the combined document as raw
+       bytes; match it */
+    it->datatype = PROTOCOL_BINARY_RAW_BYTES;
+    item_set_cas(NULL, NULL, it, get_cas_id());
+    item_seq_end(it);
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE item_append(struct default_engine *engine,
+                              const void *cookie,
+                              const void *key, size_t nkey,
+                              const void *data, size_t ndata,
+                              uint64_t *cas, bool prepend) {
+    ENGINE_ERROR_CODE ret;
+    hash_item *it;
+    hash_key_view hkey;
+
+    hash_key_view_init(&hkey, key, nkey, engine->bucket_id);
+
+    cb_mutex_enter(&engine->items.lock);
+    it = do_item_get(engine, &hkey);
+    if (it == NULL) {
+        ret = ENGINE_KEY_ENOENT;
+    } else if (*cas != 0 && *cas != item_get_cas(it)) {
+        ret = ENGINE_KEY_EEXISTS;
+    } else if (it->nbytes + ndata > engine->config.item_size_max) {
+        ret = ENGINE_E2BIG;
+    } else if (prepend ||
+               (it->datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) != 0 ||
+               (it->iflag & ITEM_SHARED) != 0 ||
+               it->refcount != 1) {
+        /* prepending would shift bytes a concurrent reader may hold
+           iovecs into, compressed values need the inflate path, a
+           shared value block may back other keys (copy-on-write), and
+           a referenced item is (or may be) in flight to someone */
+        ret = ENGINE_ENOTSUP;
+    } else {
+        ret = do_item_append_inplace(engine, it, data, ndata);
+        if (ret == ENGINE_SUCCESS) {
+            *cas = item_get_cas(it);
+        }
+    }
+    if (it != NULL) {
+        do_item_release(engine, it);
+    }
+    cb_mutex_exit(&engine->items.lock);
+    return ret;
+}
+
+/*
+ * Overwrite a byte range of a linked item's value. Requires items.lock
+ * and that the caller holds the only reference (the same rule
+ * do_item_append_inplace uses; a referenced item is, or may be, in
+ * flight to someone who holds iovecs into the value). The item keeps
+ * its size, slab chunk, datatype and expiry - only the bytes in the
+ * range and the cas change, under the item's seqlock so optimistic
+ * readers can't observe a torn value.
+ */
+static void do_item_patch_inplace(struct default_engine *engine,
+                                  hash_item *it,
+                                  const void *data,
+                                  size_t ndata,
+                                  uint32_t offset) {
+    item_seq_begin(it);
+    if ((it->iflag & ITEM_CHUNKED) != 0) {
+        item_chunk *chunk = item_get_chunk(it);
+        const char *src = data;
+        size_t skip = offset;
+        size_t remaining = ndata;
+
+        while (skip >= chunk->used) {
+            skip -= chunk->used;
+            chunk = chunk->next;
+        }
+        while (remaining > 0) {
+            size_t copy = chunk->used - skip;
+            if (copy > remaining) {
+                copy = remaining;
+            }
+            memcpy(chunk->data + skip, src, copy);
+            src += copy;
+            remaining -= copy;
+            skip = 0;
+            chunk = chunk->next;
+        }
+    } else {
+        memcpy(item_get_data(it) + offset, data, ndata);
+    }
+    item_set_cas(NULL, NULL, it, get_cas_id());
+    item_seq_end(it);
+}
+
+ENGINE_ERROR_CODE item_patch(struct default_engine *engine,
+                             const void *cookie,
+                             const void *key, size_t nkey,
+                             const void *data, size_t ndata,
+                             uint32_t offset, uint64_t *cas) {
+    ENGINE_ERROR_CODE ret;
+    hash_item *it;
+    hash_key_view hkey;
+
+    hash_key_view_init(&hkey, key, nkey, engine->bucket_id);
+
+    cb_mutex_enter(&engine->items.lock);
+    it = do_item_get(engine, &hkey);
+    if (it == NULL) {
+        ret = ENGINE_KEY_ENOENT;
+    } else if (*cas != 0 && *cas != item_get_cas(it)) {
+        ret = ENGINE_KEY_EEXISTS;
+    } else if ((uint64_t)offset + ndata > it->nbytes) {
+        ret = ENGINE_ERANGE;
+    } else if ((it->datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) != 0 ||
+               (it->iflag & ITEM_SHARED) != 0 ||
+               it->refcount != 1) {
+        /* compressed values need the frontend's inflate path, a shared
+           value block may back other keys (copy-on-write), and a
+           referenced item is (or may be) in flight to someone */
+        ret = ENGINE_ENOTSUP;
+    } else {
+        do_item_patch_inplace(engine, it, data, ndata, offset);
+        *cas = item_get_cas(it);
+        ret = ENGINE_SUCCESS;
+    }
+    if (it != NULL) {
+        do_item_release(engine, it);
+    }
     cb_mutex_exit(&engine->items.lock);
     return ret;
 }
 
 static hash_item *do_touch_item(struct default_engine *engine,
-                                const hash_key *hkey,
+                                const hash_key_view *hkey,
                                 uint32_t exptime)
 {
    hash_item *item = do_item_get(engine, hkey);
-   if (item != NULL) {
-       item->exptime = exptime;
+   if (item != NULL && item->exptime != exptime) {
+       /* Touch-heavy workloads (a GAT on every session read) land here
+          on every access with a TTL a fixed distance in the future.
+          While the new expiry maps to the same wheel bucket as the old
+          one - which with the 256 second level-0 granularity it does
+          for all but one touch in 256 - the item can stay where it is
+          and the new exptime is simply stored: a single aligned word
+          write no optimistic reader can see torn, so no sequence bump
+          either. Only a touch which actually moves the item between
+          buckets pays the relink (under the item's seqlock, since
+          readers must not observe the expiry links mid-surgery). */
+       if (item->exptime != 0 && exptime != 0 &&
+           expiry_bucket_for(engine, item->exptime) ==
+           expiry_bucket_for(engine, exptime)) {
+           item->exptime = exptime;
+           engine->items.touch_inplace++;
+       } else {
+           /* move the item to the wheel bucket of its new expiry; the
+              old bucket has to be found from the old exptime */
+           item_seq_begin(item);
+           if (item->exptime != 0) {
+               expiry_unlink(engine, item);
+           }
+           item->exptime = exptime;
+           if (item->exptime != 0) {
+               expiry_link(engine, item);
+           }
+           item_seq_end(item);
+           engine->items.touch_relink++;
+       }
    }
    return item;
 }
@@ -858,50 +2760,30 @@ hash_item *touch_item(struct default_engine *engine,
                       uint32_t exptime)
 {
     hash_item *ret;
-    hash_key hkey;
-    if (!hash_key_create(&hkey, key, nkey, engine, cookie)) {
-        return NULL;
-    }
+    hash_key_view hkey;
+    hash_key_view_init(&hkey, key, nkey, engine->bucket_id);
     cb_mutex_enter(&engine->items.lock);
     ret = do_touch_item(engine, &hkey, exptime);
     cb_mutex_exit(&engine->items.lock);
-    hash_key_destroy(&hkey);
     return ret;
 }
 
 /*
- * Flushes expired items after a flush_all call
+ * Flush the cache after a flush_all call. Constant time regardless of
+ * how many items are held: advancing the flush epoch makes every
+ * linked item's stamp stale, so lookups treat them as misses from
+ * here on (see item_is_flushed). The memory is handed back lazily -
+ * by the scrub kicked off below, by the expiry reaper for items which
+ * sat in the expiry wheel, and by the allocation-time steal path
+ * under memory pressure - instead of stalling the bucket on an LRU
+ * walk proportional to the item count.
  */
 void item_flush_expired(struct default_engine *engine) {
     cb_mutex_enter(&engine->items.lock);
-
-    rel_time_t now = engine->server.core->get_current_time();
-    if (now > engine->config.oldest_live) {
-        engine->config.oldest_live = now - 1;
-    }
-
-    for (int ii = 0; ii < POWER_LARGEST; ii++) {
-        hash_item *iter, *next;
-        /*
-         * The LRU is sorted in decreasing time order, and an item's
-         * timestamp is never newer than its last access time, so we
-         * only need to walk back until we hit an item older than the
-         * oldest_live time.
-         * The oldest_live checking will auto-expire the remaining items.
-         */
-        for (iter = engine->items.heads[ii]; iter != NULL; iter = next) {
-            if (iter->time >= engine->config.oldest_live) {
-                next = iter->next;
-                if ((iter->iflag & ITEM_SLABBED) == 0) {
-                    do_item_unlink(engine, iter);
-                }
-            } else {
-                /* We've hit the first old item. Continue to the next queue. */
-                break;
-            }
-        }
-    }
+    engine->items.flush_epoch++;
     cb_mutex_exit(&engine->items.lock);
+
+    item_start_scrub(engine);
 }
 
 void item_stats(struct default_engine *engine,
@@ -921,8 +2803,8 @@ void item_stats_sizes(struct default_engine *engine,
     cb_mutex_exit(&engine->items.lock);
 }
 
-static void do_item_link_cursor(struct default_engine *engine,
-                                hash_item *cursor, int ii)
+void do_item_link_cursor(struct default_engine *engine,
+                         hash_item *cursor, int ii)
 {
     cursor->slabs_clsid = (uint8_t)ii;
     cursor->next = NULL;
@@ -932,15 +2814,12 @@ static void do_item_link_cursor(struct default_engine *engine,
     engine->items.sizes[ii]++;
 }
 
-typedef ENGINE_ERROR_CODE (*ITERFUNC)(struct default_engine *engine,
-                                      hash_item *item, void *cookie);
-
-static bool do_item_walk_cursor(struct default_engine *engine,
-                                hash_item *cursor,
-                                int steplength,
-                                ITERFUNC itemfunc,
-                                void* itemdata,
-                                ENGINE_ERROR_CODE *error)
+bool do_item_walk_cursor(struct default_engine *engine,
+                         hash_item *cursor,
+                         int steplength,
+                         ITERFUNC itemfunc,
+                         void* itemdata,
+                         ENGINE_ERROR_CODE *error)
 {
     int ii = 0;
     *error = ENGINE_SUCCESS;
@@ -950,6 +2829,9 @@ static bool do_item_walk_cursor(struct default_engine *engine,
         hash_item *ptr = cursor->prev;
         bool done = false;
 
+        /* Pull the next header in while we process this one */
+        item_prefetch(ptr->prev);
+
         ++ii;
         item_unlink_q(engine, cursor);
 
@@ -1002,7 +2884,8 @@ static ENGINE_ERROR_CODE item_scrub(struct default_engine *engine,
     }
 
     if (engine->scrubber.force_delete || (item->refcount == 0 &&
-       (item->exptime != 0 && item->exptime < current_time))) {
+       (item_is_flushed(engine, item) ||
+        (item->exptime != 0 && item->exptime < current_time)))) {
         do_item_unlink(engine, item);
         engine->scrubber.cleaned++;
     }
@@ -1014,13 +2897,23 @@ static void item_scrub_class(struct default_engine *engine,
 
     ENGINE_ERROR_CODE ret;
     bool more;
+    /* The step bounds the pause a scrub inflicts on clients waiting
+       for the cache lock; the sleep spreads the remaining work out
+       over time (both are config items). */
+    int step = (int)engine->config.scrub_step;
+    if (step < 1) {
+        step = 1;
+    }
     do {
         cb_mutex_enter(&engine->items.lock);
-        more = do_item_walk_cursor(engine, cursor, 200, item_scrub, NULL, &ret);
+        more = do_item_walk_cursor(engine, cursor, step, item_scrub, NULL, &ret);
         cb_mutex_exit(&engine->items.lock);
         if (ret != ENGINE_SUCCESS) {
             break;
         }
+        if (more && engine->config.scrub_sleep > 0) {
+            usleep(engine->config.scrub_sleep);
+        }
     } while (more);
 }
 
@@ -1068,6 +2961,9 @@ bool item_start_scrub(struct default_engine *engine)
         engine->scrubber.stopped = 0;
         engine->scrubber.visited = 0;
         engine->scrubber.cleaned = 0;
+        cb_mutex_enter(&engine->stats.lock);
+        engine->scrubber.total = engine->stats.curr_items;
+        cb_mutex_exit(&engine->stats.lock);
         engine->scrubber.running = true;
         engine_manager_scrub_engine(engine);
         ret = true;
@@ -1077,31 +2973,340 @@ bool item_start_scrub(struct default_engine *engine)
     return ret;
 }
 
+/********************************* PAGE REPACK *******************************/
+
+/*
+ * Cold-page consolidation. When a resident-memory target is set (see
+ * slabs_repack_begin) the slab layer picks a mostly-idle page and
+ * parks its free chunks; this pass migrates the live items out of the
+ * page so its memory can be handed back to the OS. It runs on the
+ * reaper cadence and re-scans the page each tick until it has fully
+ * drained - chunks freed to it in the meantime are intercepted by the
+ * slab layer, so the pass converges.
+ */
+
+/* items migrated per tick, so one pass never monopolises the cache lock */
+#define REPACK_MIGRATE_BUDGET 256
+
+/*
+ * Decide whether the chunk at a candidate position really is a live,
+ * movable item of the class. The chunk may just as well be free, sit
+ * on the limbo list, or hold a value chunk of a chunked item, so every
+ * header field read here may be garbage; only the authoritative hash
+ * table lookup at the end proves the chunk is the linked item it
+ * appears to be. Caller holds items.lock.
+ */
+static bool repack_candidate(struct default_engine *engine,
+                             const unsigned int id, hash_item *it) {
+    const hash_key *key = item_get_key(it);
+
+    if (it->slabs_clsid != id ||
+        (it->iflag & (ITEM_LINKED | ITEM_SLABBED)) != ITEM_LINKED ||
+        it->refcount != 0) {
+        return false;
+    }
+    /* a linked item's key lives in its own key_storage (this also
+       excludes the zero-length walk cursors and bounds the key compare
+       below against garbage lengths) */
+    if (key->header.full_key != (hash_key_data*)&key->key_storage ||
+        key->header.len == 0 ||
+        key->header.len > sizeof(hash_key_sized)) {
+        return false;
+    }
+    return assoc_find(engine, it->khash, key) == it;
+}
+
+/*
+ * Move a validated item into a fresh allocation and retire the old
+ * block so the page it sits in can drain. The caller holds items.lock;
+ * optimistic readers are fenced off by the odd seqno on both blocks
+ * while the hash table flips over to the copy.
+ */
+static bool do_item_repack(struct default_engine *engine, hash_item *it) {
+    const size_t ntotal = ITEM_ntotal(engine, it);
+    const unsigned int id = it->slabs_clsid;
+    hash_item *nit = slabs_alloc(engine, ntotal, id);
+    hash_key *nkey;
+
+    if (nit == NULL) {
+        return false;
+    }
+
+    item_seq_begin(it);       /* in-flight optimistic copies discard */
+    if (it->exptime != 0) {
+        expiry_unlink(engine, it);
+    }
+
+    memcpy(nit, it, ntotal);
+    nkey = item_get_key(nit);
+    nkey->header.full_key = (hash_key_data*)&nkey->key_storage;
+    if ((it->iflag & ITEM_CHUNKED) != 0) {
+        /* the copy owns the value chunk chain now; the old block must
+           not free it when it goes through the limbo drain */
+        *(item_chunk**)item_get_data(it) = NULL;
+    } else if ((it->iflag & ITEM_SHARED) != 0) {
+        /* likewise: the copy owns the shared block reference now */
+        *(dedup_block**)item_get_data(it) = NULL;
+    }
+
+    /* flip the hash table over to the copy; published odd, so readers
+       back off until the item_seq_end below */
+    nit->seqno = (engine->items.seq_epoch += 2) - 1;
+    SEQ_BARRIER();
+    assoc_delete(engine, it->khash, item_get_key(it));
+    assoc_insert(engine, nit->khash, nit);
+
+    /* splice the copy into the LRU in the old block's place */
+    if (nit->prev != NULL) {
+        nit->prev->next = nit;
+    } else {
+        cb_assert(engine->items.heads[id] == it);
+        engine->items.heads[id] = nit;
+    }
+    if (nit->next != NULL) {
+        nit->next->prev = nit;
+    } else {
+        cb_assert(engine->items.tails[id] == it);
+        engine->items.tails[id] = nit;
+    }
+    if (engine->items.warm_tails[id] == it) {
+        engine->items.warm_tails[id] = nit;
+    }
+    if (nit->exptime != 0) {
+        /* expiry_unlink above cleared the links the memcpy carried over */
+        expiry_link(engine, nit);
+    }
+
+    /* retire the old block; it reaches the freelist through the limbo
+       list and the slab layer diverts it into the repack hold there */
+    it->iflag &= ~ITEM_LINKED;
+    it->next = it->prev = it->h_next = NULL;
+    item_free(engine, it);
+
+    item_seq_end(nit);        /* even: visible to optimistic readers */
+    return true;
+}
+
+/*
+ * One tick of the consolidation pass: poll the slab layer for the page
+ * being vacated (starting a new one when warranted) and migrate a
+ * bounded number of live items out of it.
+ */
+static void item_repack_tick(struct default_engine *engine) {
+    unsigned int id;
+    void *start;
+    size_t len;
+    size_t chunk_size;
+    char *ptr;
+    char *end;
+    int budget = REPACK_MIGRATE_BUDGET;
+
+    /* collect chunks freed since the last pass first, so a finished
+       page is released before any budget is burned re-scanning it */
+    slabs_repack_tick(engine);
+
+    if (!slabs_repack_begin(engine, &id, &start, &len)) {
+        return;
+    }
+
+    chunk_size = slabs_class_size(engine, id);
+    end = (char*)start + len;
+
+    cb_mutex_enter(&engine->items.lock);
+    for (ptr = start; ptr + chunk_size <= end && budget > 0;
+         ptr += chunk_size) {
+        hash_item *it = (hash_item*)ptr;
+        if (repack_candidate(engine, id, it)) {
+            --budget;
+            if (!do_item_repack(engine, it)) {
+                /* no memory for copies right now; try again next tick */
+                break;
+            }
+        }
+    }
+    cb_mutex_exit(&engine->items.lock);
+}
+
+/*
+ * Process one due level-0 bucket of the expiry wheel. A slot is shared
+ * by every wrap generation of the wheel, so only items whose time has
+ * actually come are unlinked; referenced items are left for the lazy
+ * expiry on release/access (or the next wrap).
+ */
+static void expiry_process_bucket(struct default_engine *engine,
+                                  rel_time_t second, int *budget) {
+    struct expiry_bucket *bucket =
+        &engine->items.expiry_seconds[second % EXPIRY_WHEEL_SECONDS];
+    hash_item *it = bucket->head;
+    while (it != NULL) {
+        hash_item *next = it->exp_next;
+        item_prefetch(next);
+        (*budget)--;
+        engine->reaper.visited++;
+        if (it->exptime <= second && it->refcount == 0) {
+            size_t freed = ITEM_memory(engine, it);
+            do_item_unlink(engine, it);
+            engine->reaper.reaped++;
+            engine->reaper.reaped_bytes += freed;
+        }
+        it = next;
+    }
+}
+
+void item_reaper_tick(struct default_engine *engine, int steplength)
+{
+    int budget = steplength;
+    rel_time_t now;
+
+    cb_mutex_enter(&engine->items.lock);
+    now = engine->server.core->get_current_time();
+    while (engine->items.expiry_current < now && budget > 0) {
+        /* advance before touching any list so expiry_bucket_for agrees
+           with where the cascade is about to put things */
+        rel_time_t second = ++engine->items.expiry_current;
+        if (second % EXPIRY_WHEEL_SECONDS == 0) {
+            expiry_redistribute(engine,
+                &engine->items.expiry_coarse[(second / EXPIRY_WHEEL_SECONDS) %
+                                             EXPIRY_WHEEL_COARSE]);
+            expiry_redistribute(engine, &engine->items.expiry_overflow);
+        }
+        /* a bucket is always drained completely (the budget only caps
+           how many seconds one tick catches up on) */
+        expiry_process_bucket(engine, second, &budget);
+    }
+    /* reclaim parked blocks even on an engine which sees no traffic */
+    if (engine->items.limbo_head != NULL) {
+        item_limbo_drain(engine);
+    }
+    cb_mutex_exit(&engine->items.lock);
+
+    /* cold-page consolidation rides the same cadence (a no-op unless a
+       resident-memory target is set; see slabs_repack_begin) */
+    item_repack_tick(engine);
+}
+
+void item_stats_expiry(struct default_engine *engine,
+                       ADD_STAT add_stat, const void *cookie)
+{
+    /* histogram edges, in seconds from now */
+    static const rel_time_t edges[] = { 60, 300, 1800, 3600, 21600 };
+    static const char* const names[] = {
+        "within_1m", "within_5m", "within_30m", "within_1h", "within_6h"
+    };
+    const int nedges = 5;
+    uint64_t counts[5 + 1];
+    uint64_t overdue = 0;
+    uint64_t total = 0;
+    rel_time_t now;
+    int ii;
+
+    memset(counts, 0, sizeof(counts));
+
+    cb_mutex_enter(&engine->items.lock);
+    now = engine->server.core->get_current_time();
+    for (ii = -1; ii < EXPIRY_WHEEL_SECONDS + EXPIRY_WHEEL_COARSE; ++ii) {
+        const struct expiry_bucket *bucket;
+        const hash_item *it;
+        if (ii < 0) {
+            bucket = &engine->items.expiry_overflow;
+        } else if (ii < EXPIRY_WHEEL_SECONDS) {
+            bucket = &engine->items.expiry_seconds[ii];
+        } else {
+            bucket = &engine->items.expiry_coarse[ii - EXPIRY_WHEEL_SECONDS];
+        }
+        for (it = bucket->head; it != NULL; it = it->exp_next) {
+            total++;
+            if (it->exptime <= now) {
+                overdue++;
+            } else {
+                rel_time_t delta = it->exptime - now;
+                int jj;
+                for (jj = 0; jj < nedges && delta >= edges[jj]; ++jj) {
+                }
+                counts[jj]++;
+            }
+        }
+    }
+    cb_mutex_exit(&engine->items.lock);
+
+    add_statistics(cookie, add_stat, "expiry", -1, "with_ttl",
+                   "%" PRIu64, total);
+    add_statistics(cookie, add_stat, "expiry", -1, "overdue",
+                   "%" PRIu64, overdue);
+    for (ii = 0; ii < nedges; ++ii) {
+        add_statistics(cookie, add_stat, "expiry", -1, names[ii],
+                       "%" PRIu64, counts[ii]);
+    }
+    add_statistics(cookie, add_stat, "expiry", -1, "later",
+                   "%" PRIu64, counts[nedges]);
+}
+
 struct tap_client {
     hash_item cursor;
     hash_item *it;
+    /* the point-in-time boundary for the lock domain the cursor is
+       in: items stamped after it postdate the export and aren't
+       shipped. Captured when the cursor enters the domain. */
+    uint32_t snap_seqno;
+    /* the engine the cursor currently walks - a shard under
+       shards=N, otherwise the engine itself - and how far through
+       the shard array the export has come */
+    struct default_engine *target;
+    size_t shard_idx;
 };
 
 static ENGINE_ERROR_CODE item_tap_iterfunc(struct default_engine *engine,
                                     hash_item *item,
                                     void *cookie) {
     struct tap_client *client = cookie;
+    rel_time_t current_time = engine->server.core->get_current_time();
+
+    /* Ship only the captured view. An item whose sequence stamp has
+       moved past the boundary was created or replaced after the
+       export started (the stamp always advances; see do_item_link),
+       and dead documents aren't part of the view either. */
+    if ((int32_t)(item->seqno - client->snap_seqno) > 0 ||
+        item_is_flushed(engine, item) ||
+        (item->exptime != 0 && item->exptime < current_time)) {
+        return ENGINE_SUCCESS;
+    }
+
     client->it = item;
     ++client->it->refcount;
     return ENGINE_SUCCESS;
 }
 
+/*
+ * Capture the snapshot boundary of (and link the walk cursor into)
+ * the given cache-lock domain. Linking the cursor and reading the
+ * epoch under the same lock acquisition is what makes the captured
+ * view exact: everything linked before this point carries an older
+ * stamp and ships, everything after a newer one and doesn't.
+ */
+static void item_tap_link_cursor(struct default_engine *engine,
+                                 struct tap_client *client)
+{
+    int ii;
+    cb_mutex_enter(&engine->items.lock);
+    client->snap_seqno = engine->items.seq_epoch;
+    client->cursor.slabs_clsid = 0;
+    for (ii = 0; ii < POWER_LARGEST; ++ii) {
+        if (engine->items.heads[ii] != NULL) {
+            /* add the cursor at the tail */
+            do_item_link_cursor(engine, &client->cursor, ii);
+            break;
+        }
+    }
+    cb_mutex_exit(&engine->items.lock);
+}
+
 static tap_event_t do_item_tap_walker(struct default_engine *engine,
-                                         const void *cookie, item **itm,
+                                         struct tap_client *client, item **itm,
                                          void **es, uint16_t *nes, uint8_t *ttl,
                                          uint16_t *flags, uint32_t *seqno,
                                          uint16_t *vbucket)
 {
     ENGINE_ERROR_CODE r;
-    struct tap_client *client = engine->server.cookie->get_engine_specific(cookie);
-    if (client == NULL) {
-        return TAP_DISCONNECT;
-    }
 
     *es = NULL;
     *nes = 0;
@@ -1141,9 +3346,29 @@ tap_event_t item_tap_walker(ENGINE_HANDLE* handle,
 {
     tap_event_t ret;
     struct default_engine *engine = (struct default_engine*)handle;
-    cb_mutex_enter(&engine->items.lock);
-    ret = do_item_tap_walker(engine, cookie, itm, es, nes, ttl, flags, seqno, vbucket);
-    cb_mutex_exit(&engine->items.lock);
+    struct tap_client *client =
+        engine->server.cookie->get_engine_specific(cookie);
+
+    if (client == NULL) {
+        return TAP_DISCONNECT;
+    }
+
+    for (;;) {
+        struct default_engine *target = client->target;
+        cb_mutex_enter(&target->items.lock);
+        ret = do_item_tap_walker(target, client, itm, es, nes, ttl,
+                                 flags, seqno, vbucket);
+        cb_mutex_exit(&target->items.lock);
+        if (ret != TAP_DISCONNECT || engine->nshards == 0 ||
+            client->shard_idx + 1 == engine->nshards) {
+            break;
+        }
+        /* this shard is fully exported; move the cursor on to the
+           next one, capturing its boundary as we enter */
+        client->shard_idx++;
+        client->target = engine->shard[client->shard_idx];
+        item_tap_link_cursor(client->target, client);
+    }
 
     return ret;
 }
@@ -1151,29 +3376,40 @@ tap_event_t item_tap_walker(ENGINE_HANDLE* handle,
 bool initialize_item_tap_walker(struct default_engine *engine,
                                 const void* cookie)
 {
-    bool linked = false;
-    int ii;
     struct tap_client *client = cb_calloc(1, sizeof(*client));
     if (client == NULL) {
         return false;
     }
     client->cursor.refcount = 1;
-
-    /* Link the cursor! */
-    for (ii = 0; ii < POWER_LARGEST && !linked; ++ii) {
-        cb_mutex_enter(&engine->items.lock);
-        if (engine->items.heads[ii] != NULL) {
-            /* add the item at the tail */
-            do_item_link_cursor(engine, &client->cursor, ii);
-            linked = true;
-        }
-        cb_mutex_exit(&engine->items.lock);
-    }
-
+    client->target = engine->nshards > 0 ? engine->shard[0] : engine;
+    item_tap_link_cursor(client->target, client);
     engine->server.cookie->store_engine_specific(cookie, client);
     return true;
 }
 
+void cleanup_item_tap_walker(struct default_engine *engine,
+                             const void *cookie)
+{
+    struct tap_client *client =
+        engine->server.cookie->get_engine_specific(cookie);
+    struct default_engine *target;
+
+    if (client == NULL) {
+        return;
+    }
+    /* if the client went away mid-export the cursor is still spliced
+       into the LRU of whichever domain it got to */
+    target = client->target;
+    cb_mutex_enter(&target->items.lock);
+    if (client->cursor.prev != NULL) {
+        item_unlink_q(target, &client->cursor);
+        client->cursor.prev = NULL;
+    }
+    cb_mutex_exit(&target->items.lock);
+    engine->server.cookie->store_engine_specific(cookie, NULL);
+    cb_free(client);
+}
+
 void link_dcp_walker(struct default_engine *engine,
                      struct dcp_connection *connection)
 {
@@ -1270,40 +3506,15 @@ ENGINE_ERROR_CODE item_dcp_step(struct default_engine *engine,
     return ret;
 }
 
-static bool hash_key_create(hash_key* hkey,
-                            const void* key,
-                            const size_t nkey,
-                            struct default_engine* engine,
-                            const void* cookie) {
-
-    int hash_key_len = sizeof(bucket_id_t) + nkey;
-    if (nkey > sizeof(hkey->key_storage.client_key)) {
-        hkey->header.full_key = cb_malloc(hash_key_len);
-        if (hkey->header.full_key == NULL) {
-            return false;
-        }
-    } else {
-        hkey->header.full_key = (hash_key_data*)&hkey->key_storage;
-    }
-    hash_key_set_len(hkey, hash_key_len);
-    hash_key_set_bucket_index(hkey, engine->bucket_id);
-    hash_key_set_client_key(hkey, key, nkey);
-    return true;
-}
-
-static void hash_key_destroy(hash_key* hkey) {
-    if ((void*)hkey->header.full_key != (void*)&hkey->key_storage) {
-       cb_free(hkey->header.full_key);
-    }
-}
-
 /*
- * The item object stores a hash_key in a contiguous allocation
- * This method ensures correct copying into a contiguous hash_key
+ * The item object stores its hash_key in a contiguous allocation; this
+ * is the single place a client key is copied on its way into the cache.
+ * Everything upstream of item creation works on non-owning views.
  */
-static void hash_key_copy_to_item(hash_item* dst, const hash_key* src) {
+static void hash_key_view_copy_to_item(hash_item* dst, const hash_key_view* src) {
     hash_key* key = item_get_key(dst);
-    memcpy(key, src, sizeof(hash_key_header));
+    key->header.len = (uint16_t)(sizeof(bucket_id_t) + src->client_len);
     key->header.full_key = (hash_key_data*)&key->key_storage;
-    memcpy(hash_key_get_key(key), hash_key_get_key(src), hash_key_get_key_len(src));
+    key->header.full_key->bucket_index = src->bucket_index;
+    memcpy(key->header.full_key->client_key, src->client_key, src->client_len);
 }
@@ -1,6 +1,8 @@
 #include "memcached/types.h"
 #include <string.h>
 #include <stddef.h>
+#include <platform/crc32c.h>
+#include <utilities/vector_compare.h>
 #include "default_engine_internal.h"
 
 #ifndef ITEMS_H
@@ -14,6 +16,16 @@ extern "C" {
  * You should not try to aquire any of the item locks before calling these
  * functions.
  */
+
+/*
+ * Layout note: everything a metadata-only scan needs (the queue links,
+ * time/exptime, nbytes, khash, iflag, refcount, slabs_clsid) is kept in
+ * the leading cache line of the header, ahead of the key and value bytes
+ * which follow the struct in the same slab chunk. The scrubber, the
+ * expiry reaper and the eviction search therefore touch one line per
+ * item and never pull value pages through the cache; keep new scan
+ * fields up front and push anything scans don't read towards the end.
+ */
 typedef struct _hash_item {
     struct _hash_item *next;
     struct _hash_item *prev;
@@ -23,14 +35,77 @@ typedef struct _hash_item {
                          * startup) */
     uint32_t nbytes; /**< The total size of the data (in bytes) */
     uint32_t flags; /**< Flags associated with the item (in network byte order)*/
+    uint32_t khash; /**< Hash of the item's key. Kept in the same cache line
+                     * as h_next so a chain probe can reject a non-matching
+                     * entry without touching the key bytes, and so unlink
+                     * and table migration don't have to rehash the key. */
     uint16_t iflag; /**< Intermal flags. lower 8 bit is reserved for the core
                      * server, the upper 8 bits is reserved for engine
                      * implementation. */
     unsigned short refcount;
     uint8_t slabs_clsid;/* which slab class we're in */
     uint8_t datatype;/* to identify the type of the data */
+    /* Sequence stamp for optimistic (lock-free) readers. Stamped with a
+     * fresh even value when the item is linked, bumped to odd while the
+     * value or metadata is mutated in place and when the item is
+     * unlinked; a reader which observes the same even value before and
+     * after copying the item out knows the copy is consistent (see
+     * item_get_copy). Only written under items.lock. */
+    uint32_t seqno;
+    /* The flush epoch the item was linked under. item_flush_expired()
+     * bumps the engine's epoch in O(1) instead of walking the LRU
+     * queues; an item whose stamp differs from the current epoch
+     * predates the last flush and is dead (fits in what used to be
+     * struct padding, so the header doesn't grow). */
+    uint32_t fepoch;
+    /* CRC32C over the item's key and value bytes, stamped when the
+     * item is linked (and refreshed by the in-place incr/decr path);
+     * only maintained when the integrity_check config item is set.
+     * Verified when the item is served - see item_check_integrity().
+     * Fits in what used to be struct padding ahead of exp_next. */
+    uint32_t vcrc;
+    /* membership in the expiry wheel bucket for this item's exptime;
+     * NULL/unused when exptime is 0 (see struct items) */
+    struct _hash_item *exp_next;
+    struct _hash_item *exp_prev;
 } hash_item;
 
+/*
+ * Values above config.chunk_threshold are not stored inline in the
+ * hash_item; the item's body holds a single pointer to a chain of
+ * fixed-size chunks instead (and the item carries ITEM_CHUNKED). All
+ * chunks of a value are allocated from the same slab class, so a large
+ * value costs at most one partially used chunk in overhead instead of
+ * the power-of-N rounding of the huge classes. The frontend scatter-
+ * gathers the chain straight out of get_item_info's iovecs.
+ */
+typedef struct _item_chunk {
+    struct _item_chunk *next;
+    uint32_t used;  /* bytes of data[] holding value bytes */
+    uint32_t size;  /* capacity of data[] */
+    uint8_t clsid;  /* slab class the chunk was allocated from */
+    char data[1];
+} item_chunk;
+
+/*
+ * When value dedup is enabled (config.dedup) identical values stored
+ * under different keys share a single refcounted value block; the
+ * item's body holds one pointer to the block (and the item carries
+ * ITEM_SHARED), just like a chunked item holds its chain pointer. The
+ * blocks are indexed by a content hash table (see do_item_share_maybe
+ * in items.c) so a store can find the block an identical value already
+ * lives in. Shared values are copy-on-write: every in-place mutation
+ * path refuses ITEM_SHARED items and the frontend falls back to its
+ * copy path, which builds an ordinary replacement item.
+ */
+typedef struct _dedup_block {
+    struct _dedup_block *h_next; /* dedup table chain */
+    uint32_t vhash;    /* content hash (crc32c over the value bytes) */
+    uint32_t nbytes;   /* number of value bytes in data[] */
+    uint32_t refcount; /* items (linked or in limbo) referencing us */
+    char data[1];
+} dedup_block;
+
 /*
     The structure of the key we hash with.
 
@@ -98,6 +173,17 @@ static CB_INLINE void hash_key_set_client_key(hash_key* key,
     memcpy(key->header.full_key->client_key, client_key, client_key_len);
 }
 
+/*
+ * The hash kernel used by the assoc layer. crc32c is provided by platform,
+ * which picks the SSE4.2 / ARMv8 CRC instruction at load time when the CPU
+ * has it and falls back to the software slice-by-8 implementation
+ * otherwise; routing every key hash through this helper keeps that choice
+ * in exactly one place.
+ */
+static CB_INLINE uint32_t hash_key_hash(const hash_key* key) {
+    return crc32c(hash_key_get_key(key), hash_key_get_key_len(key), 0);
+}
+
 /*
  * return the bytes needed to store the hash_key structure
  * in a single contiguous allocation.
@@ -106,6 +192,68 @@ static CB_INLINE size_t hash_key_get_alloc_size(const hash_key* key) {
     return offsetof(hash_key, key_storage) + hash_key_get_key_len(key);
 }
 
+/*
+ * A non-owning view of a key as presented by the frontend. The lookup
+ * and allocation paths carry one of these straight over the daemon's
+ * read buffer instead of first copying the key bytes (plus the bucket
+ * index prefix) into a stack hash_key; the bytes are copied exactly
+ * once - into the item - at creation time.
+ */
+typedef struct _hash_key_view {
+    bucket_id_t bucket_index;
+    const uint8_t* client_key;
+    uint16_t client_len;
+} hash_key_view;
+
+static CB_INLINE void hash_key_view_init(hash_key_view* view,
+                                         const void* client_key,
+                                         size_t client_len,
+                                         bucket_id_t bucket_index) {
+    view->bucket_index = bucket_index;
+    view->client_key = (const uint8_t*)client_key;
+    view->client_len = (uint16_t)client_len;
+}
+
+/* View of the key stored in an item (or another hash_key) */
+static CB_INLINE void hash_key_view_from_key(hash_key_view* view,
+                                             const hash_key* key) {
+    view->bucket_index = hash_key_get_bucket_index(key);
+    view->client_key = hash_key_get_client_key(key);
+    view->client_len = hash_key_get_client_key_len(key);
+}
+
+static CB_INLINE uint16_t hash_key_view_total_len(const hash_key_view* view) {
+    return (uint16_t)(sizeof(view->bucket_index) + view->client_len);
+}
+
+/*
+ * crc32c streams (the third argument seeds the next block), so hashing
+ * the bucket index and the client key in two passes yields exactly the
+ * same value as hashing the contiguous hash_key layout.
+ */
+static CB_INLINE uint32_t hash_key_view_hash(const hash_key_view* view) {
+    uint32_t crc = crc32c((const uint8_t*)&view->bucket_index,
+                          sizeof(view->bucket_index), 0);
+    return crc32c(view->client_key, view->client_len, crc);
+}
+
+/* Compare a view against the key stored in an item */
+static CB_INLINE bool hash_key_view_equals(const hash_key_view* view,
+                                           const hash_key* key) {
+    return hash_key_view_total_len(view) == hash_key_get_key_len(key) &&
+           view->bucket_index == hash_key_get_bucket_index(key) &&
+           cb_memeq(view->client_key, hash_key_get_client_key(key),
+                    view->client_len);
+}
+
+/*
+ * the bytes needed to store the key described by the view inline in an
+ * item (see hash_key_get_alloc_size).
+ */
+static CB_INLINE size_t hash_key_view_alloc_size(const hash_key_view* view) {
+    return offsetof(hash_key, key_storage) + hash_key_view_total_len(view);
+}
+
 typedef struct {
     unsigned int evicted;
     unsigned int evicted_nonzero;
@@ -115,11 +263,118 @@ typedef struct {
     unsigned int reclaimed;
 } itemstats_t;
 
+/*
+ * The expiry wheel: a two-level timer wheel ordering items with a
+ * non-zero exptime by when they expire. Level 0 has one bucket per
+ * second for the next EXPIRY_WHEEL_SECONDS seconds; level 1 covers the
+ * next EXPIRY_WHEEL_SECONDS * EXPIRY_WHEEL_COARSE seconds in coarse
+ * buckets which are redistributed into level 0 as the wheel turns;
+ * everything farther out sits in the overflow bucket. Membership is
+ * maintained by do_item_link/do_item_unlink so the reaper can free the
+ * items expiring each second directly instead of scanning the LRU
+ * queues for them. Protected by items.lock like everything else here.
+ */
+#define EXPIRY_WHEEL_SECONDS 256
+#define EXPIRY_WHEEL_COARSE 64
+
+struct expiry_bucket {
+    hash_item *head;
+    unsigned int count;
+};
+
+/*
+ * Eviction policies. The classic policy is a plain LRU per slab class
+ * (with the deferred ITEM_ACTIVE bump). The tinylfu policy keeps the
+ * same queues but splits each into a protected segment at the head and
+ * a probationary segment at the tail: new items enter the probationary
+ * segment, items re-referenced there get promoted across the boundary,
+ * and eviction only ever takes from the probationary tail, so a scan
+ * over cold keys can no longer flush the hot set. Admission into the
+ * cache at the expense of an established victim is additionally judged
+ * by a TinyLFU frequency sketch (see sketch_* in items.c); candidates
+ * judged colder than their victim enter at the eviction end of the
+ * queue.
+ */
+enum eviction_policy {
+    EVICTION_POLICY_LRU = 0,
+    EVICTION_POLICY_TINYLFU
+};
+
 struct items {
    hash_item *heads[POWER_LARGEST];
    hash_item *tails[POWER_LARGEST];
    itemstats_t itemstats[POWER_LARGEST];
    unsigned int sizes[POWER_LARGEST];
+   /* the boundary of the protected segment: the coldest protected item
+      in each class's queue (NULL = the segment is empty). The segment
+      occupies the head side of the boundary. */
+   hash_item *warm_tails[POWER_LARGEST];
+   unsigned int warm_sizes[POWER_LARGEST];
+   enum eviction_policy policy;
+   /* TinyLFU frequency sketch: packed 4 bit counters, two slots per
+      key; NULL unless the tinylfu policy is selected */
+   uint8_t *sketch;
+   uint32_t sketch_mask;
+   uint64_t sketch_window;
+   /* Counting bloom filter over the linked keys (see exist_filter_*
+      in items.c); NULL unless exists_filter is configured. Updated
+      under items.lock, probed without it. */
+   uint8_t *exist_filter;
+   uint32_t exist_filter_mask;
+   /* Content-addressed table over the shared value blocks (see
+      dedup_block above); NULL unless dedup is configured. Protected
+      by items.lock. */
+   dedup_block **dedup_table;
+   uint32_t dedup_mask;
+   /* gauges: blocks in the table and the memory they hold */
+   uint64_t dedup_blocks;
+   uint64_t dedup_bytes;
+   /* stores which reused an existing block, and the value bytes that
+      sharing saved us from duplicating */
+   uint64_t dedup_hits;
+   uint64_t dedup_saved;
+   /* existence probes answered by the filter alone (no cache lock);
+      bumped without the lock, so the count is approximate */
+   uint64_t exist_filter_fastpath;
+   /* hit-rate counters for A/B-ing eviction policies across runs */
+   uint64_t lookup_hits;
+   uint64_t lookup_misses;
+   uint64_t promotions;
+   uint64_t demotions;
+   uint64_t cold_admissions;
+   /* touches resolved by storing the new exptime in place vs. having
+      to move the item to a different expiry-wheel bucket */
+   uint64_t touch_inplace;
+   uint64_t touch_relink;
+   /* source of the even per-item sequence stamps handed out by
+      do_item_link; advancing it on every link makes a reused item
+      block distinguishable from the item which used to live there */
+   uint32_t seq_epoch;
+   /* The current flush epoch; bumped by item_flush_expired so a flush
+      is constant time regardless of the number of items held. Items
+      stamped under an older epoch are treated as misses and their
+      memory is reclaimed lazily (scrubber, expiry reaper and the
+      allocation-time steal path). */
+   uint32_t flush_epoch;
+   /* Epoch-based reclamation for the optimistic readers: freed item
+      blocks are parked here (chained through their dead next pointer,
+      reclaim stamp in the dead time fields) until every reader which
+      might still reach them has left its epoch. See the comment above
+      epoch_reader_enter() in items.c */
+   hash_item *limbo_head;
+   hash_item *limbo_tail;
+   uint64_t limbo_count;
+   uint64_t limbo_bytes;
+   uint64_t deferred_frees;
+   /* reads which failed the CRC32C integrity check (the items were
+      quarantined); only grows when integrity_check is enabled */
+   uint64_t crc_failures;
+   struct expiry_bucket expiry_seconds[EXPIRY_WHEEL_SECONDS];
+   struct expiry_bucket expiry_coarse[EXPIRY_WHEEL_COARSE];
+   struct expiry_bucket expiry_overflow;
+   /* the wheel has been advanced (buckets processed/cascaded) up to
+      and including this second */
+   rel_time_t expiry_current;
    /*
     * serialise access to the items data
    */
@@ -142,6 +397,22 @@ hash_item *item_alloc(struct default_engine *engine,
                       rel_time_t exptime, int nbytes, const void *cookie,
                       uint8_t datatype);
 
+/**
+ * Allocate a batch of items, taking the cache lock once for the whole
+ * batch. Entries whose status is not ENGINE_SUCCESS on entry are skipped
+ * (the caller has already failed their validation); for the rest the
+ * item and status members are filled out.
+ *
+ * @param engine handle to the storage engine
+ * @param entries the batch to allocate
+ * @param count number of entries in the batch
+ * @param cookie connection cookie
+ */
+void item_alloc_bulk(struct default_engine *engine,
+                     item_batch_entry *entries,
+                     size_t count,
+                     const void *cookie);
+
 /**
  * Get an item from the cache
  *
@@ -156,6 +427,146 @@ hash_item *item_get(struct default_engine *engine,
                     const void *key,
                     const size_t nkey);
 
+/**
+ * Optimistic read: copy an item's metadata and value out of the cache
+ * without taking any lock or touching the item's refcount, using the
+ * per-item sequence stamp to detect a concurrent mutation (in which
+ * case the copy is retried a few times before giving up). Returns
+ * false whenever a consistent copy couldn't be produced - a miss, a
+ * conflict, a chunked or too-large value, an expired item or an
+ * in-flight hash table expansion - and the caller falls back to the
+ * locked item_get path; false is therefore NOT an authoritative miss.
+ *
+ * @param engine handle to the storage engine
+ * @param key the key to look up
+ * @param nkey the number of bytes in the key
+ * @param buffer where to copy the value
+ * @param buffsize size of buffer (values larger than this fail)
+ * @param info filled out on success; info->value[0] points at buffer
+ * @return true if a consistent copy was produced
+ */
+bool item_get_copy(struct default_engine *engine,
+                   const void *key, const size_t nkey,
+                   void *buffer, const size_t buffsize,
+                   item_info *info);
+
+/**
+ * Get a whole batch of items from the cache, hashing every key up
+ * front and amortizing the cache lock (and the hash stripe locks) over
+ * the batch. Fills out each entry's item and status.
+ *
+ * @param engine handle to the storage engine
+ * @param cookie connection cookie
+ * @param entries the batch of keys to look up
+ * @param count the number of entries in the batch
+ */
+void item_get_multi(struct default_engine *engine,
+                    const void *cookie,
+                    item_get_entry *entries,
+                    size_t count);
+
+/**
+ * Batched delete. Hashes every key up front, prefetches the hash
+ * buckets and resolves each stride with a single acquisition of the
+ * cache lock (and at most one acquisition of each hash stripe lock),
+ * where deleting the keys one DELETE at a time pays the full locking
+ * cost per key. Each entry's status is set to ENGINE_SUCCESS,
+ * ENGINE_KEY_ENOENT or ENGINE_KEY_EEXISTS (CAS mismatch).
+ *
+ * @param engine handle to the storage engine
+ * @param entries the batch of keys to delete
+ * @param count number of entries in the batch
+ */
+void item_remove_multi(struct default_engine *engine,
+                       item_remove_entry *entries,
+                       size_t count);
+
+/**
+ * Existence probe for a single key: hit or miss plus the CAS of the
+ * hit, without referencing the item, materializing the value or
+ * promoting the item in its LRU queue. When the existence filter is
+ * configured a miss is usually answered without taking the cache
+ * lock at all.
+ *
+ * @param engine handle to the storage engine
+ * @param key the key to probe for
+ * @param nkey the length of the key
+ * @param cas receives the item's CAS (0 on a miss)
+ * @return ENGINE_SUCCESS or ENGINE_KEY_ENOENT
+ */
+ENGINE_ERROR_CODE item_exists(struct default_engine *engine,
+                              const void *key,
+                              const size_t nkey,
+                              uint64_t *cas);
+
+/**
+ * Batched existence probe; the same stride/prefetch scheme as
+ * item_get_multi, but nothing is referenced or promoted. Keys the
+ * existence filter rules out never reach the hash table, so a
+ * negative-heavy batch may resolve without the cache lock entirely.
+ * Each entry's status is set to ENGINE_SUCCESS (cas filled out) or
+ * ENGINE_KEY_ENOENT.
+ *
+ * @param engine handle to the storage engine
+ * @param entries the batch of keys to probe
+ * @param count number of entries in the batch
+ */
+void item_exists_multi(struct default_engine *engine,
+                       item_exist_entry *entries,
+                       size_t count);
+
+/**
+ * Allocate the counting existence filter (when config.exists_filter
+ * is set; a no-op otherwise). Must be called during engine
+ * initialization, before any item is linked.
+ *
+ * @param engine handle to the storage engine
+ * @return ENGINE_SUCCESS or ENGINE_ENOMEM
+ */
+ENGINE_ERROR_CODE item_exists_filter_init(struct default_engine *engine);
+
+/**
+ * Release the existence filter allocated by item_exists_filter_init.
+ * @param engine handle to the storage engine
+ */
+void item_exists_filter_destroy(struct default_engine *engine);
+
+/**
+ * Allocate the content-addressed value dedup table (when config.dedup
+ * is set; a no-op otherwise). Must be called during engine
+ * initialization, before any item is linked.
+ *
+ * @param engine handle to the storage engine
+ * @return ENGINE_SUCCESS or ENGINE_ENOMEM
+ */
+ENGINE_ERROR_CODE item_dedup_init(struct default_engine *engine);
+
+/**
+ * Release the dedup table (and any blocks still in it) allocated by
+ * item_dedup_init.
+ * @param engine handle to the storage engine
+ */
+void item_dedup_destroy(struct default_engine *engine);
+
+/**
+ * Resolve the configured eviction policy name (config.eviction_policy)
+ * and set up whatever state it needs (the TinyLFU frequency sketch is
+ * sized off config.maxbytes). Must be called during engine
+ * initialization, before any item is linked.
+ *
+ * @param engine handle to the storage engine
+ * @return ENGINE_SUCCESS, ENGINE_EINVAL for an unknown policy name or
+ *         ENGINE_ENOMEM if the sketch couldn't be allocated
+ */
+ENGINE_ERROR_CODE item_eviction_policy_init(struct default_engine *engine);
+
+/**
+ * Release the eviction policy state allocated by
+ * item_eviction_policy_init.
+ * @param engine handle to the storage engine
+ */
+void item_eviction_policy_destroy(struct default_engine *engine);
+
 /**
  * Reset the item statistics
  * @param engine handle to the storage engine
@@ -235,6 +646,77 @@ ENGINE_ERROR_CODE store_item(struct default_engine *engine,
                              ENGINE_STORE_OPERATION operation,
                              const void *cookie);
 
+/**
+ * Store a batch of items under one acquisition of the cache lock. Each
+ * entry's cas and status members receive the per-item result; entries
+ * whose status is not ENGINE_SUCCESS on entry are skipped.
+ *
+ * @param engine handle to the storage engine
+ * @param entries the batch to store (the item members must be set)
+ * @param count number of entries in the batch
+ * @param operation what kind of store operation this is (ADD/SET etc)
+ * @param cookie connection cookie
+ */
+void store_item_bulk(struct default_engine *engine,
+                     item_batch_entry *entries,
+                     size_t count,
+                     ENGINE_STORE_OPERATION operation,
+                     const void *cookie);
+
+/**
+ * Append data to an existing item's value in place when that can be
+ * done without copying the value (slack in the item's slab chunk, or
+ * the tail of a chunked item's chain). Returns ENGINE_ENOTSUP whenever
+ * in-place isn't possible (including prepend) so the frontend can fall
+ * back to its copy path.
+ *
+ * @param engine handle to the storage engine
+ * @param cookie connection cookie
+ * @param key the key of the item to extend
+ * @param nkey the number of bytes in the key
+ * @param data the bytes to append
+ * @param ndata the number of bytes to append
+ * @param cas IN: expected cas (0 = any); OUT: the new cas
+ * @param prepend requested prepend instead of append
+ */
+ENGINE_ERROR_CODE item_append(struct default_engine *engine,
+                              const void *cookie,
+                              const void *key, size_t nkey,
+                              const void *data, size_t ndata,
+                              uint64_t *cas, bool prepend);
+
+/**
+ * Overwrite a byte range of an existing item's value in place. The
+ * range must lie entirely within the current value (a patch never
+ * resizes the item), and the item's size class, datatype and expiry
+ * are untouched. Returns ENGINE_ENOTSUP whenever in-place isn't safe
+ * (compressed value, or another connection holds a reference) so the
+ * frontend can fall back to its copy path.
+ *
+ * @param engine handle to the storage engine
+ * @param cookie connection cookie
+ * @param key the key of the item to patch
+ * @param nkey the number of bytes in the key
+ * @param data the replacement bytes
+ * @param ndata the number of bytes to overwrite
+ * @param offset byte offset into the value to patch at
+ * @param cas IN: expected cas (0 = any); OUT: the new cas
+ */
+ENGINE_ERROR_CODE item_patch(struct default_engine *engine,
+                             const void *cookie,
+                             const void *key, size_t nkey,
+                             const void *data, size_t ndata,
+                             uint32_t offset, uint64_t *cas);
+
+/**
+ * Copy an item's value into a contiguous buffer, following the chunk
+ * chain if the item is chunked. The buffer must hold it->nbytes bytes.
+ *
+ * @param it the item to copy from
+ * @param buf the destination buffer
+ */
+void item_copy_data(const hash_item *it, void *buf);
+
 ENGINE_ERROR_CODE arithmetic(struct default_engine *engine,
                              const void* cookie,
                              const void* key,
@@ -249,6 +731,34 @@ ENGINE_ERROR_CODE arithmetic(struct default_engine *engine,
                              uint64_t *result);
 
 
+/**
+ * Function called for each item visited by do_item_walk_cursor
+ */
+typedef ENGINE_ERROR_CODE (*ITERFUNC)(struct default_engine *engine,
+                                      hash_item *item, void *cookie);
+
+/**
+ * Link a walk cursor at the tail of the given slab class queue.
+ * The caller must hold items.lock.
+ */
+void do_item_link_cursor(struct default_engine *engine,
+                         hash_item *cursor, int ii);
+
+/**
+ * Advance a walk cursor at most steplength items towards the head of
+ * its queue, calling itemfunc for every (non-cursor) item passed. The
+ * caller must hold items.lock; visitors which need to bound the time
+ * the lock is held should walk in batches (see the scrubber).
+ *
+ * @return true if the cursor is still linked (more items to walk)
+ */
+bool do_item_walk_cursor(struct default_engine *engine,
+                         hash_item *cursor,
+                         int steplength,
+                         ITERFUNC itemfunc,
+                         void* itemdata,
+                         ENGINE_ERROR_CODE *error);
+
 /**
  * Run a single scrub loop for the engine.
  * @param engine handle to the storage engine
@@ -263,7 +773,52 @@ void item_scrubber_main(struct default_engine *engine);
 bool item_start_scrub(struct default_engine *engine);
 
 /**
- * The tap walker to walk the hashtables
+ * Run one bounded pass of the background expiry reaper. Advances the
+ * expiry wheel up to the current second, unlinking the items whose
+ * buckets have come due so their memory is reclaimed without waiting
+ * for a client access. At most steplength items are visited per tick;
+ * if the budget runs out the wheel resumes where it stopped on the
+ * next tick. Called at a fixed cadence by the reaper thread.
+ *
+ * @param engine handle to the storage engine
+ * @param steplength maximum number of items to visit this tick
+ */
+void item_reaper_tick(struct default_engine *engine, int steplength);
+
+/**
+ * Verify the CRC32C integrity stamp of an item about to be served (a
+ * no-op returning true unless integrity_check is enabled). On a
+ * mismatch the corruption counter is bumped and the item is
+ * quarantined: unlinked from the hash table so it can never be served
+ * again. The caller must hold a reference on the item.
+ *
+ * @param engine handle to the storage engine
+ * @param item the item about to be served
+ * @return false if the item's bytes no longer match its stamp
+ */
+bool item_check_integrity(struct default_engine *engine, hash_item *item);
+
+/**
+ * Report a histogram of when the currently held items expire, bucketed
+ * by horizon from now. Walks the expiry wheel under items.lock.
+ *
+ * @param engine handle to the storage engine
+ * @param add_stat callback provided by the core used to
+ *                 push statistics into the response
+ * @param cookie cookie provided by the core to identify the client
+ */
+void item_stats_expiry(struct default_engine *engine,
+                       ADD_STAT add_stat, const void *cookie);
+
+/**
+ * The tap walker behind the TAP dump export (get_tap_iterator). It
+ * streams the point-in-time view captured by
+ * initialize_item_tap_walker: every item which existed when the
+ * capture was taken ships with the value it had then (or, for items
+ * mutated in place afterwards, their latest value); items created or
+ * replaced after the capture are left out. Under shards=N the shards
+ * are exported one after the other, each against the boundary
+ * captured when the cursor enters it.
  */
 tap_event_t item_tap_walker(ENGINE_HANDLE* handle,
                             const void *cookie, item **itm,
@@ -274,6 +829,14 @@ tap_event_t item_tap_walker(ENGINE_HANDLE* handle,
 bool initialize_item_tap_walker(struct default_engine *engine,
                                 const void* cookie);
 
+/**
+ * Unlink the walk cursor and free the per-connection walker state.
+ * Called when the exporting connection goes away (ON_DISCONNECT); a
+ * no-op for cookies without a walker.
+ */
+void cleanup_item_tap_walker(struct default_engine *engine,
+                             const void *cookie);
+
 
 struct dcp_connection {
     void *gid;
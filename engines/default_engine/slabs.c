@@ -18,18 +18,33 @@
 #include <inttypes.h>
 #include <stdarg.h>
 
+#ifndef WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
 #ifdef VALGRIND
 // switch to malloc if VALGRIND so we can get some useful insight.
 #define USE_SYSTEM_MALLOC (1)
 #endif
 
 #include "default_engine_internal.h"
+#include "hugepages.h"
 
 /*
  * Forward Declarations
  */
 static int do_slabs_newslab(struct default_engine *engine, const unsigned int id);
+static int do_slabs_rebalance(struct default_engine *engine,
+                              const unsigned int dst_id);
 static void *memory_allocate(struct default_engine *engine, size_t size);
+static void flush_magazine_delta(slabclass_t *p, slab_magazine_t *mag);
+static void do_slabs_put_chunk(struct default_engine *engine, void *ptr,
+                               const unsigned int id);
 
 #ifndef DONT_PREALLOC_SLABS
 /* Preallocate as many slab pages as possible (called from slabs_init)
@@ -95,8 +110,38 @@ ENGINE_ERROR_CODE slabs_init(struct default_engine *engine,
     engine->slabs.mem_limit = limit;
 
     if (prealloc) {
+        /* Try to back the chunk with explicit huge pages when
+           configured; hash chains walked by assoc_find touch items
+           spread over the whole preallocation, and larger pages keep
+           those accesses from thrashing the TLB. */
+        enum hugepage_size request = hugepage_parse(engine->config.huge_pages);
+        if (request != HUGEPAGE_NONE) {
+            enum hugepage_size obtained;
+            engine->slabs.mem_base = hugepage_alloc(engine->slabs.mem_limit,
+                                                    request,
+                                                    &obtained,
+                                                    &engine->slabs.mem_base_mapped);
+            EXTENSION_LOGGER_DESCRIPTOR *logger;
+            logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+            if (engine->slabs.mem_base != NULL) {
+                logger->log(EXTENSION_LOG_NOTICE, NULL,
+                            "Slab preallocation of %" PRIu64 " bytes backed "
+                            "by %s\n",
+                            (uint64_t)engine->slabs.mem_base_mapped,
+                            hugepage_size_text(obtained));
+            } else {
+                logger->log(EXTENSION_LOG_WARNING, NULL,
+                            "Unable to back the slab preallocation with %s;"
+                            " falling back to normal pages\n",
+                            hugepage_size_text(request));
+            }
+        }
+
         /* Allocate everything in a big chunk with malloc */
-        engine->slabs.mem_base = my_allocate(engine, engine->slabs.mem_limit);
+        if (engine->slabs.mem_base == NULL) {
+            engine->slabs.mem_base = my_allocate(engine,
+                                                 engine->slabs.mem_limit);
+        }
         if (engine->slabs.mem_base != NULL) {
             engine->slabs.mem_current = engine->slabs.mem_base;
             engine->slabs.mem_avail = engine->slabs.mem_limit;
@@ -191,6 +236,28 @@ static int grow_slab_list (struct default_engine *engine, const unsigned int id)
     return 1;
 }
 
+#ifdef HAVE_LIBNUMA
+/*
+ * The daemon sets the process memory policy to interleave across all
+ * nodes at startup (unless MEMCACHED_NUMA_MEM_POLICY=disable), which
+ * is the right default for the code and the shared structures but
+ * defeats first-touch placement of cache memory. Exempt the OS pages
+ * fully contained in a new slab from the interleave so the first
+ * touch places them on the node of the allocating thread. Slab pages
+ * are only chunk-aligned, so the unaligned edges keep the process
+ * policy; mbind() would refuse them anyway.
+ */
+static void slab_set_node_local(void *ptr, size_t len) {
+    uintptr_t pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ptr + pagesize - 1) & ~(pagesize - 1);
+    uintptr_t end = ((uintptr_t)ptr + len) & ~(pagesize - 1);
+
+    if (numa_available() == 0 && end > start) {
+        numa_setlocal_memory((void *)start, end - start);
+    }
+}
+#endif
+
 static int do_slabs_newslab(struct default_engine *engine, const unsigned int id) {
     slabclass_t *p = &engine->slabs.slabclass[id];
     int len = p->size * p->perslab;
@@ -204,6 +271,22 @@ static int do_slabs_newslab(struct default_engine *engine, const unsigned int id
         return 0;
     }
 
+#ifdef HAVE_LIBNUMA
+    slab_set_node_local(ptr, (size_t)len);
+#endif
+
+    /*
+     * This memset is also the first touch of the page (cb_malloc and the
+     * preallocated mem_base region hand out untouched virtual memory), so
+     * the kernel places the page on the node of the worker thread that
+     * first needed it - because the slab was just exempted from the
+     * daemon's default interleave policy above (without libnuma the same
+     * holds only when the interleave is disabled with
+     * MEMCACHED_NUMA_MEM_POLICY=disable). Together with the magazine
+     * layer keeping freed chunks with the thread stripe that freed them,
+     * this is what keeps slab memory node-local; don't "optimize" the
+     * zeroing into slabs_init on the startup thread.
+     */
     memset(ptr, 0, (size_t)len);
     p->end_page_ptr = ptr;
     p->end_page_free = p->perslab;
@@ -215,33 +298,98 @@ static int do_slabs_newslab(struct default_engine *engine, const unsigned int id
     return 1;
 }
 
-/*@null@*/
-static void *do_slabs_alloc(struct default_engine *engine, const size_t size, unsigned int id) {
-    slabclass_t *p;
-    void *ret = NULL;
+/* remember a page whose memory was handed back to the OS.
+   slabs.lock is assumed to be held by the caller. */
+static int vacant_push(slabclass_t *p, void *page) {
+    if (p->vacant == p->vacant_size) {
+        unsigned int new_size = (p->vacant_size != 0) ? p->vacant_size * 2 : 8;
+        void **new_list = cb_realloc(p->vacant_list, new_size * sizeof(void *));
+        if (new_list == NULL) {
+            return 0;
+        }
+        p->vacant_list = new_list;
+        p->vacant_size = new_size;
+    }
+    p->vacant_list[p->vacant++] = page;
+    return 1;
+}
 
-    if (id < POWER_SMALLEST || id > engine->slabs.power_largest) {
-        MEMCACHED_SLABS_ALLOCATE_FAILED(size, 0);
-        return NULL;
+/*
+ * Hand the physical memory backing a fully idle page back to the OS
+ * while keeping the virtual range. Slab pages are only chunk-aligned,
+ * so just the OS-page-aligned interior is released; the edges stay
+ * resident. MADV_FREE lets the kernel take the pages lazily (which is
+ * nearly free when memory pressure never materialises), with
+ * MADV_DONTNEED as the fallback on older kernels. On platforms without
+ * madvise this is a no-op and the consolidation still helps by packing
+ * the live items densely.
+ */
+static void release_page_to_os(void *start, size_t len) {
+#ifndef WIN32
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = ((uintptr_t)start + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t)start + len) & ~(page - 1);
+    if (hi > lo) {
+#if defined(MADV_FREE)
+        if (madvise((void*)lo, hi - lo, MADV_FREE) == 0) {
+            return;
+        }
+#endif
+#if defined(MADV_DONTNEED)
+        madvise((void*)lo, hi - lo, MADV_DONTNEED);
+#endif
     }
+#else
+    (void)start;
+    (void)len;
+#endif
+}
 
-    p = &engine->slabs.slabclass[id];
+/*
+    re-carve a previously released page instead of allocating fresh
+    memory. slabs.lock is assumed to be held by the caller.
+    Returns nonzero if a page was revived (and end_page_ptr set).
+*/
+static int do_slabs_revive_page(struct default_engine *engine,
+                                const unsigned int id) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+    size_t len = (size_t)p->size * p->perslab;
+    char *ptr;
 
-#ifdef USE_SYSTEM_MALLOC
-    if (engine->slabs.mem_limit && engine->slabs.mem_malloced + size > engine->slabs.mem_limit) {
-        MEMCACHED_SLABS_ALLOCATE_FAILED(size, id);
+    if (p->vacant == 0 || grow_slab_list(engine, id) == 0) {
         return 0;
     }
-    engine->slabs.mem_malloced += size;
-    ret = cb_calloc(1, size);
-    MEMCACHED_SLABS_ALLOCATE(size, id, 0, ret);
-    return ret;
-#endif
+    ptr = p->vacant_list[--p->vacant];
+
+    /* MADV_FREE may have left stale data behind; zero the page like a
+       fresh one (this is also the NUMA re-touch, see do_slabs_newslab) */
+    memset(ptr, 0, len);
+    p->end_page_ptr = ptr;
+    p->end_page_free = p->perslab;
+    p->slab_list[p->slabs++] = ptr;
+    engine->slabs.mem_released -= len;
+
+    return 1;
+}
+
+/*
+    grab one raw chunk from the shared pool (freelist, open page or a new
+    page), without touching the requested-bytes accounting.
+    slabs.lock is assumed to be held by the caller.
+*/
+static void *do_slabs_get_chunk(struct default_engine *engine,
+                                const unsigned int id) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+    void *ret;
 
     /* fail unless we have space at the end of a recently allocated page,
-       we have something on our freelist, or we could allocate a new page */
+       we have something on our freelist, we can revive a page we gave
+       back to the OS, we could allocate a new page, or we can steal an
+       idle page from another class */
     if (! (p->end_page_ptr != 0 || p->sl_curr != 0 ||
-           do_slabs_newslab(engine, id) != 0)) {
+           do_slabs_revive_page(engine, id) != 0 ||
+           do_slabs_newslab(engine, id) != 0 ||
+           do_slabs_rebalance(engine, id) != 0)) {
         /* We don't have more memory available */
         ret = NULL;
     } else if (p->sl_curr != 0) {
@@ -258,6 +406,65 @@ static void *do_slabs_alloc(struct default_engine *engine, const size_t size, un
         }
     }
 
+    return ret;
+}
+
+/*
+    push one raw chunk back on the shared freelist, without touching the
+    requested-bytes accounting.
+    slabs.lock is assumed to be held by the caller.
+*/
+static void do_slabs_put_chunk(struct default_engine *engine, void *ptr,
+                               const unsigned int id) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+
+    /* chunks of the page being vacated are parked in the repack hold
+       instead of re-entering circulation (see slabs_repack_begin) */
+    if (engine->slabs.repack_page != NULL && id == engine->slabs.repack_id &&
+        (char*)ptr >= (char*)engine->slabs.repack_page &&
+        (char*)ptr < (char*)engine->slabs.repack_page +
+                     (size_t)p->size * p->perslab) {
+        cb_assert(engine->slabs.repack_held < p->perslab);
+        engine->slabs.repack_hold[engine->slabs.repack_held++] = ptr;
+        return;
+    }
+
+    if (p->sl_curr == p->sl_total) { /* need more space on the free list */
+        int new_size = (p->sl_total != 0) ? p->sl_total * 2 : 16;  /* 16 is arbitrary */
+        void **new_slots = cb_realloc(p->slots, new_size * sizeof(void *));
+        if (new_slots == 0)
+            return;
+        p->slots = new_slots;
+        p->sl_total = new_size;
+    }
+    p->slots[p->sl_curr++] = ptr;
+}
+
+/*@null@*/
+static void *do_slabs_alloc(struct default_engine *engine, const size_t size, unsigned int id) {
+    slabclass_t *p;
+    void *ret = NULL;
+
+    if (id < POWER_SMALLEST || id > engine->slabs.power_largest) {
+        MEMCACHED_SLABS_ALLOCATE_FAILED(size, 0);
+        return NULL;
+    }
+
+    p = &engine->slabs.slabclass[id];
+
+#ifdef USE_SYSTEM_MALLOC
+    if (engine->slabs.mem_limit && engine->slabs.mem_malloced + size > engine->slabs.mem_limit) {
+        MEMCACHED_SLABS_ALLOCATE_FAILED(size, id);
+        return 0;
+    }
+    engine->slabs.mem_malloced += size;
+    ret = cb_calloc(1, size);
+    MEMCACHED_SLABS_ALLOCATE(size, id, 0, ret);
+    return ret;
+#endif
+
+    ret = do_slabs_get_chunk(engine, id);
+
     if (ret) {
         p->requested += size;
         MEMCACHED_SLABS_ALLOCATE(size, id, p->size, ret);
@@ -283,15 +490,7 @@ static void do_slabs_free(struct default_engine *engine, void *ptr, const size_t
     return;
 #endif
 
-    if (p->sl_curr == p->sl_total) { /* need more space on the free list */
-        int new_size = (p->sl_total != 0) ? p->sl_total * 2 : 16;  /* 16 is arbitrary */
-        void **new_slots = cb_realloc(p->slots, new_size * sizeof(void *));
-        if (new_slots == 0)
-            return;
-        p->slots = new_slots;
-        p->sl_total = new_size;
-    }
-    p->slots[p->sl_curr++] = ptr;
+    do_slabs_put_chunk(engine, ptr, id);
     p->requested -= size;
     return;
 }
@@ -352,9 +551,22 @@ static void do_slabs_stats(struct default_engine *engine, ADD_STAT add_stats, co
         slabclass_t *p = &engine->slabs.slabclass[i];
         if (p->slabs != 0) {
             uint32_t perslab, slabs;
+            unsigned int cached = 0;
             slabs = p->slabs;
             perslab = p->perslab;
 
+            /* chunks parked in magazines are free, not used */
+            if (p->magazines != NULL) {
+                int jj;
+                for (jj = 0; jj < SLAB_MAGAZINE_STRIPES; ++jj) {
+                    slab_magazine_t *mag = &p->magazines[jj];
+                    cb_mutex_enter(&mag->lock);
+                    cached += mag->nrounds;
+                    flush_magazine_delta(p, mag);
+                    cb_mutex_exit(&mag->lock);
+                }
+            }
+
             add_statistics(cookie, add_stats, NULL, i, "chunk_size", "%u",
                            p->size);
             add_statistics(cookie, add_stats, NULL, i, "chunks_per_page", "%u",
@@ -364,13 +576,21 @@ static void do_slabs_stats(struct default_engine *engine, ADD_STAT add_stats, co
             add_statistics(cookie, add_stats, NULL, i, "total_chunks", "%u",
                            slabs * perslab);
             add_statistics(cookie, add_stats, NULL, i, "used_chunks", "%u",
-                           slabs*perslab - p->sl_curr - p->end_page_free);
+                           slabs*perslab - p->sl_curr - p->end_page_free -
+                           cached);
             add_statistics(cookie, add_stats, NULL, i, "free_chunks", "%u",
-                           p->sl_curr);
+                           p->sl_curr + cached);
             add_statistics(cookie, add_stats, NULL, i, "free_chunks_end", "%u",
                            p->end_page_free);
             add_statistics(cookie, add_stats, NULL, i, "mem_requested", "%"PRIu64,
                            (uint64_t)p->requested);
+            if (p->compressed_items != 0) {
+                add_statistics(cookie, add_stats, NULL, i, "compressed_items",
+                               "%"PRIu64, p->compressed_items);
+                add_statistics(cookie, add_stats, NULL, i,
+                               "compressed_bytes_saved", "%"PRIu64,
+                               p->compressed_bytes_saved);
+            }
             total++;
         }
     }
@@ -380,6 +600,10 @@ static void do_slabs_stats(struct default_engine *engine, ADD_STAT add_stats, co
     add_statistics(cookie, add_stats, NULL, -1, "active_slabs", "%d", total);
     add_statistics(cookie, add_stats, NULL, -1, "total_malloced", "%"PRIu64,
                    (uint64_t)engine->slabs.mem_malloced);
+    add_statistics(cookie, add_stats, NULL, -1, "mem_released", "%"PRIu64,
+                   (uint64_t)engine->slabs.mem_released);
+    add_statistics(cookie, add_stats, NULL, -1, "rss_target", "%"PRIu64,
+                   (uint64_t)engine->slabs.rss_target);
 }
 
 static void *memory_allocate(struct default_engine *engine, size_t size) {
@@ -411,19 +635,558 @@ static void *memory_allocate(struct default_engine *engine, size_t size) {
     return ret;
 }
 
+/*
+ * Find the calling thread's magazine for the given class, creating the
+ * magazine array for the class the first time it's needed. Returns NULL
+ * (caller falls back to the shared path) if the array can't be allocated.
+ *
+ * Lock ordering: slabs.lock is always taken before a magazine lock, never
+ * the other way around.
+ */
+static slab_magazine_t *get_magazine(struct default_engine *engine,
+                                     const unsigned int id) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+    slab_magazine_t *mags = p->magazines;
+
+    if (mags == NULL) {
+        cb_mutex_enter(&engine->slabs.lock);
+        if (p->magazines == NULL) {
+            mags = cb_calloc(SLAB_MAGAZINE_STRIPES, sizeof(slab_magazine_t));
+            if (mags != NULL) {
+                int ii;
+                for (ii = 0; ii < SLAB_MAGAZINE_STRIPES; ++ii) {
+                    cb_mutex_initialize(&mags[ii].lock);
+                }
+                p->magazines = mags;
+            }
+        }
+        mags = p->magazines;
+        cb_mutex_exit(&engine->slabs.lock);
+        if (mags == NULL) {
+            return NULL;
+        }
+    }
+
+    return &mags[(unsigned long)cb_thread_self() % SLAB_MAGAZINE_STRIPES];
+}
+
+/* fold a magazine's pending requested-bytes accounting into its class.
+   slabs.lock and the magazine lock are assumed to be held by the caller. */
+static void flush_magazine_delta(slabclass_t *p, slab_magazine_t *mag) {
+    p->requested += mag->requested_delta;
+    mag->requested_delta = 0;
+}
+
+/* push every chunk parked in a class's magazines back to the shared
+   freelist, so a full scan of the freelist sees them.
+   slabs.lock is assumed to be held by the caller. */
+static void drain_class_magazines(struct default_engine *engine,
+                                  const unsigned int id) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+    if (p->magazines != NULL) {
+        int jj;
+        for (jj = 0; jj < SLAB_MAGAZINE_STRIPES; ++jj) {
+            slab_magazine_t *mag = &p->magazines[jj];
+            cb_mutex_enter(&mag->lock);
+            while (mag->nrounds != 0) {
+                do_slabs_put_chunk(engine, mag->rounds[--mag->nrounds], id);
+            }
+            flush_magazine_delta(p, mag);
+            cb_mutex_exit(&mag->lock);
+        }
+    }
+}
+
+/*
+    Online slab page rebalancer. When a class can neither satisfy an
+    allocation nor grow (mem_limit reached), scan the other classes for a
+    page whose every chunk is sitting idle on the freelist, reclaim it and
+    re-carve it for the starved class. This lets the bucket adapt when the
+    value-size distribution shifts instead of evicting hot items while
+    other classes hold dead pages.
+    slabs.lock is assumed to be held by the caller.
+    Returns nonzero if a page was moved (and dst's freelist populated).
+*/
+static int do_slabs_rebalance(struct default_engine *engine,
+                              const unsigned int dst_id) {
+    slabclass_t *dst = &engine->slabs.slabclass[dst_id];
+    unsigned int src_id;
+
+    /* make room in dst's page list up front so the move can't fail half
+       way through */
+    if (grow_slab_list(engine, dst_id) == 0) {
+        return 0;
+    }
+
+    for (src_id = POWER_SMALLEST;
+         src_id <= engine->slabs.power_largest;
+         src_id++) {
+        slabclass_t *src = &engine->slabs.slabclass[src_id];
+        size_t len = (size_t)src->size * src->perslab;
+        unsigned int page, slot;
+
+        if (src_id == dst_id || (src->slabs == 0 && src->vacant == 0) ||
+            len < dst->size) {
+            continue;
+        }
+
+        /* a page already released to the OS is the cheapest donation of
+           all: its chunks left circulation when it was vacated, so no
+           freelist scan is needed */
+        if (src->vacant != 0) {
+            char *start = src->vacant_list[--src->vacant];
+            size_t nchunks = len / dst->size;
+
+            engine->slabs.mem_released -= len;
+            memset(start, 0, len);
+            dst->slab_list[dst->slabs++] = start;
+            for (slot = 0; slot < nchunks; ++slot) {
+                do_slabs_put_chunk(engine, start + (size_t)slot * dst->size,
+                                   dst_id);
+            }
+            return 1;
+        }
+
+        /* chunks parked in magazines hide from the freelist scan below */
+        drain_class_magazines(engine, src_id);
+
+        if (src->sl_curr < src->perslab) {
+            /* can't possibly contain a fully free page */
+            continue;
+        }
+
+        for (page = 0; page < src->slabs; ++page) {
+            char *start = src->slab_list[page];
+            unsigned int nfree = 0;
+            unsigned int out;
+            size_t nchunks;
+
+            /* skip the page we're still carving fresh chunks from */
+            if (src->end_page_ptr != NULL &&
+                (char*)src->end_page_ptr >= start &&
+                (char*)src->end_page_ptr < start + len) {
+                continue;
+            }
+
+            for (slot = 0; slot < src->sl_curr; ++slot) {
+                char *chunk = src->slots[slot];
+                if (chunk >= start && chunk < start + len) {
+                    ++nfree;
+                }
+            }
+            if (nfree != src->perslab) {
+                continue;
+            }
+
+            /* the page is completely idle: pull its chunks off the
+               freelist and hand the raw page to the starved class */
+            out = 0;
+            for (slot = 0; slot < src->sl_curr; ++slot) {
+                char *chunk = src->slots[slot];
+                if (!(chunk >= start && chunk < start + len)) {
+                    src->slots[out++] = chunk;
+                }
+            }
+            src->sl_curr = out;
+            src->slab_list[page] = src->slab_list[--src->slabs];
+
+            memset(start, 0, len);
+            dst->slab_list[dst->slabs++] = start;
+            nchunks = len / dst->size;
+            for (slot = 0; slot < nchunks; ++slot) {
+                do_slabs_put_chunk(engine, start + (size_t)slot * dst->size,
+                                   dst_id);
+            }
+
+            if (engine->config.verbose > 1) {
+                EXTENSION_LOGGER_DESCRIPTOR *logger;
+                logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+                logger->log(EXTENSION_LOG_INFO, NULL,
+                            "Slab rebalance: moved a %"PRIu64" byte page "
+                            "from class %u to class %u (%"PRIu64" chunks)\n",
+                            (uint64_t)len, src_id, dst_id, (uint64_t)nchunks);
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Cold-page consolidation ("repack"). When an rss target is set and
+    the resident slab memory exceeds it, a mostly-idle page is picked
+    and its free chunks pulled out of allocation reach; the item layer
+    (item_repack_tick) then migrates the remaining live items out of
+    the page, and once every chunk has drained back the page's memory
+    is handed to the OS with madvise. The virtual range stays owned by
+    the class and is re-carved on demand (do_slabs_revive_page), so
+    riding a daily load cycle costs a memset per page instead of a
+    permanently overprovisioned resident set.
+*/
+
+/* qsort/bsearch ordering for the page-address array below */
+static int compare_page_ptr(const void *a, const void *b) {
+    const char *pa = *(const char* const*)a;
+    const char *pb = *(const char* const*)b;
+    if (pa < pb) {
+        return -1;
+    }
+    return (pa > pb) ? 1 : 0;
+}
+
+/* index (into the sorted page array) of the page containing the chunk,
+   or npages if it belongs to none of them */
+static unsigned int page_index_for(char **pages, unsigned int npages,
+                                   const char *chunk, size_t len) {
+    unsigned int lo = 0;
+    unsigned int hi = npages;
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (pages[mid] <= chunk) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (npages != 0 && chunk >= pages[lo] && chunk < pages[lo] + len) {
+        return lo;
+    }
+    return npages;
+}
+
+/* move every freelist chunk belonging to the repack page into the hold.
+   slabs.lock is assumed to be held by the caller. */
+static void repack_sweep_freelist(struct default_engine *engine) {
+    struct slabs *s = &engine->slabs;
+    slabclass_t *p = &s->slabclass[s->repack_id];
+    size_t len = (size_t)p->size * p->perslab;
+    char *start = s->repack_page;
+    unsigned int slot, out = 0;
+
+    for (slot = 0; slot < p->sl_curr; ++slot) {
+        char *chunk = p->slots[slot];
+        if (chunk >= start && chunk < start + len) {
+            cb_assert(s->repack_held < p->perslab);
+            s->repack_hold[s->repack_held++] = chunk;
+        } else {
+            p->slots[out++] = chunk;
+        }
+    }
+    p->sl_curr = out;
+}
+
+/* release a page whose every chunk sits on the freelist.
+   slabs.lock is assumed to be held by the caller. */
+static int release_idle_page(struct default_engine *engine,
+                             const unsigned int id, char *start) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+    size_t len = (size_t)p->size * p->perslab;
+    unsigned int slot, out = 0;
+
+    if (vacant_push(p, start) == 0) {
+        return 0;
+    }
+    for (slot = 0; slot < p->sl_curr; ++slot) {
+        char *chunk = p->slots[slot];
+        if (!(chunk >= start && chunk < start + len)) {
+            p->slots[out++] = chunk;
+        }
+    }
+    p->sl_curr = out;
+    for (slot = 0; slot < p->slabs; ++slot) {
+        if (p->slab_list[slot] == (void*)start) {
+            p->slab_list[slot] = p->slab_list[--p->slabs];
+            break;
+        }
+    }
+    release_page_to_os(start, len);
+    engine->slabs.mem_released += len;
+    return 1;
+}
+
+/* the in-flight repack page has fully drained; hand it to the OS (or,
+   if we can't track it as vacant, put its chunks back).
+   slabs.lock is assumed to be held by the caller. */
+static void do_slabs_repack_finish(struct default_engine *engine) {
+    struct slabs *s = &engine->slabs;
+    slabclass_t *p = &s->slabclass[s->repack_id];
+    size_t len = (size_t)p->size * p->perslab;
+    void **hold = s->repack_hold;
+    unsigned int held = s->repack_held;
+    unsigned int id = s->repack_id;
+    char *start = s->repack_page;
+    unsigned int slot;
+
+    s->repack_page = NULL;
+    s->repack_hold = NULL;
+    s->repack_held = 0;
+
+    if (vacant_push(p, start)) {
+        for (slot = 0; slot < p->slabs; ++slot) {
+            if (p->slab_list[slot] == (void*)start) {
+                p->slab_list[slot] = p->slab_list[--p->slabs];
+                break;
+            }
+        }
+        release_page_to_os(start, len);
+        s->mem_released += len;
+        if (engine->config.verbose > 1) {
+            EXTENSION_LOGGER_DESCRIPTOR *logger;
+            logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+            logger->log(EXTENSION_LOG_INFO, NULL,
+                        "Repack: released a %"PRIu64" byte page from "
+                        "class %u (%"PRIu64" bytes now vacant)\n",
+                        (uint64_t)len, id, (uint64_t)s->mem_released);
+        }
+    } else {
+        while (held != 0) {
+            do_slabs_put_chunk(engine, hold[--held], id);
+        }
+    }
+    cb_free(hold);
+}
+
+/* poll an in-flight repack: collect chunks which have come home since
+   the migration pass, and finish once the page has fully drained.
+   slabs.lock is assumed to be held by the caller. */
+static void do_slabs_repack_poll(struct default_engine *engine) {
+    struct slabs *s = &engine->slabs;
+    slabclass_t *p;
+
+    if (s->repack_page == NULL) {
+        return;
+    }
+    p = &s->slabclass[s->repack_id];
+
+    /* freed chunks may be parked in a magazine (the unsynchronized
+       range check in slabs_free can miss a freshly started repack);
+       push them through do_slabs_put_chunk, which diverts the in-range
+       ones into the hold */
+    drain_class_magazines(engine, s->repack_id);
+    repack_sweep_freelist(engine);
+
+    if (s->repack_held == p->perslab) {
+        do_slabs_repack_finish(engine);
+    }
+}
+
+/* pick the page to vacate next: the page with the fewest live chunks
+   in the class with the most idle bytes. Completely idle pages found
+   during the scan are released on the spot (a couple per call).
+   slabs.lock is assumed to be held by the caller. */
+static bool do_slabs_repack_start(struct default_engine *engine) {
+    struct slabs *s = &engine->slabs;
+    unsigned int id, best_id = 0;
+    unsigned int page, slot, npages, thresh;
+    unsigned int best, best_free, released = 0;
+    slabclass_t *p;
+    char **pages;
+    unsigned int *counts;
+    size_t len;
+    bool started = false;
+
+    /* a class can only contain a page worth vacating when at least
+       three quarters of a page's chunks are idle */
+    for (id = POWER_SMALLEST; id <= s->power_largest; id++) {
+        p = &s->slabclass[id];
+        if (p->slabs < 2) {
+            continue;
+        }
+        drain_class_magazines(engine, id);
+        if (p->sl_curr < (p->perslab * 3) / 4) {
+            continue;
+        }
+        if (best_id == 0 ||
+            (uint64_t)p->sl_curr * p->size >
+            (uint64_t)s->slabclass[best_id].sl_curr *
+            s->slabclass[best_id].size) {
+            best_id = id;
+        }
+    }
+    if (best_id == 0) {
+        return false;
+    }
+
+    p = &s->slabclass[best_id];
+    len = (size_t)p->size * p->perslab;
+    npages = p->slabs;
+
+    pages = cb_malloc(npages * sizeof(char *));
+    counts = cb_calloc(npages, sizeof(unsigned int));
+    if (pages == NULL || counts == NULL) {
+        cb_free(pages);
+        cb_free(counts);
+        return false;
+    }
+    memcpy(pages, p->slab_list, npages * sizeof(char *));
+    qsort(pages, npages, sizeof(char *), compare_page_ptr);
+
+    for (slot = 0; slot < p->sl_curr; ++slot) {
+        unsigned int idx = page_index_for(pages, npages, p->slots[slot], len);
+        if (idx != npages) {
+            counts[idx]++;
+        }
+    }
+
+    /* a page is only worth a migration pass when at least three
+       quarters of it is already dead (never for perslab == 1: there a
+       migration just moves the single item to another page) */
+    thresh = (p->perslab * 3) / 4;
+    if (thresh == 0) {
+        thresh = p->perslab;
+    }
+
+    best = npages;
+    best_free = 0;
+    for (page = 0; page < npages; ++page) {
+        char *start = pages[page];
+        /* never touch the page fresh chunks are still carved from */
+        if (p->end_page_ptr != NULL &&
+            (char*)p->end_page_ptr >= start &&
+            (char*)p->end_page_ptr < start + len) {
+            continue;
+        }
+        if (counts[page] == p->perslab) {
+            /* completely idle; no migration needed at all */
+            if (released < 2 && release_idle_page(engine, best_id, start)) {
+                released++;
+            }
+            continue;
+        }
+        if (counts[page] >= thresh && counts[page] > best_free) {
+            best = page;
+            best_free = counts[page];
+        }
+    }
+
+    if (best != npages) {
+        s->repack_hold = cb_malloc(p->perslab * sizeof(void *));
+        if (s->repack_hold != NULL) {
+            s->repack_id = best_id;
+            s->repack_page = pages[best];
+            s->repack_held = 0;
+            repack_sweep_freelist(engine);
+            if (engine->config.verbose > 1) {
+                EXTENSION_LOGGER_DESCRIPTOR *logger;
+                logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+                logger->log(EXTENSION_LOG_INFO, NULL,
+                            "Repack: vacating a %"PRIu64" byte page in "
+                            "class %u (%u live chunks)\n",
+                            (uint64_t)len, best_id,
+                            p->perslab - best_free);
+            }
+            started = true;
+        }
+    }
+
+    cb_free(pages);
+    cb_free(counts);
+    return started || released != 0;
+}
+
 void *slabs_alloc(struct default_engine *engine, size_t size, unsigned int id) {
-    void *ret;
+    slab_magazine_t *mag;
+    void *ret = NULL;
+
+    if (id < POWER_SMALLEST || id > engine->slabs.power_largest) {
+        MEMCACHED_SLABS_ALLOCATE_FAILED(size, 0);
+        return NULL;
+    }
+
+#ifdef USE_SYSTEM_MALLOC
+    mag = NULL;
+#else
+    mag = get_magazine(engine, id);
+#endif
+    if (mag == NULL) {
+        cb_mutex_enter(&engine->slabs.lock);
+        ret = do_slabs_alloc(engine, size, id);
+        cb_mutex_exit(&engine->slabs.lock);
+        return ret;
+    }
+
+    cb_mutex_enter(&mag->lock);
+    if (mag->nrounds == 0) {
+        /* refill a batch from the shared pool; drop and re-take the
+           magazine lock to respect the slabs-before-magazine order */
+        cb_mutex_exit(&mag->lock);
+        cb_mutex_enter(&engine->slabs.lock);
+        cb_mutex_enter(&mag->lock);
+        while (mag->nrounds < SLAB_MAGAZINE_ROUNDS) {
+            void *chunk = do_slabs_get_chunk(engine, id);
+            if (chunk == NULL) {
+                break;
+            }
+            mag->rounds[mag->nrounds++] = chunk;
+        }
+        flush_magazine_delta(&engine->slabs.slabclass[id], mag);
+        cb_mutex_exit(&engine->slabs.lock);
+    }
+
+    if (mag->nrounds != 0) {
+        ret = mag->rounds[--mag->nrounds];
+        mag->requested_delta += size;
+        MEMCACHED_SLABS_ALLOCATE(size, id, engine->slabs.slabclass[id].size, ret);
+    } else {
+        MEMCACHED_SLABS_ALLOCATE_FAILED(size, id);
+    }
+    cb_mutex_exit(&mag->lock);
 
-    cb_mutex_enter(&engine->slabs.lock);
-    ret = do_slabs_alloc(engine, size, id);
-    cb_mutex_exit(&engine->slabs.lock);
     return ret;
 }
 
 void slabs_free(struct default_engine *engine, void *ptr, size_t size, unsigned int id) {
-    cb_mutex_enter(&engine->slabs.lock);
-    do_slabs_free(engine, ptr, size, id);
-    cb_mutex_exit(&engine->slabs.lock);
+    slab_magazine_t *mag;
+
+    if (id < POWER_SMALLEST || id > engine->slabs.power_largest) {
+        return;
+    }
+
+#ifdef USE_SYSTEM_MALLOC
+    mag = NULL;
+#else
+    mag = get_magazine(engine, id);
+#endif
+
+    /* Chunks inside a page being vacated must skip the magazine so the
+       locked path can divert them into the repack hold. The peek at the
+       repack range is unsynchronized; a stale read just means the chunk
+       parks in a magazine once more, and the repack poll sweeps the
+       magazines anyway. */
+    if (mag != NULL && engine->slabs.repack_page != NULL &&
+        id == engine->slabs.repack_id &&
+        (char*)ptr >= (char*)engine->slabs.repack_page &&
+        (char*)ptr < (char*)engine->slabs.repack_page +
+                     (size_t)engine->slabs.slabclass[id].size *
+                     engine->slabs.slabclass[id].perslab) {
+        mag = NULL;
+    }
+
+    if (mag == NULL) {
+        cb_mutex_enter(&engine->slabs.lock);
+        do_slabs_free(engine, ptr, size, id);
+        cb_mutex_exit(&engine->slabs.lock);
+        return;
+    }
+
+    MEMCACHED_SLABS_DEALLOCATE(size, id, ptr);
+    cb_mutex_enter(&mag->lock);
+    if (mag->nrounds == SLAB_MAGAZINE_ROUNDS) {
+        /* drain half of the magazine back to the shared freelist */
+        cb_mutex_exit(&mag->lock);
+        cb_mutex_enter(&engine->slabs.lock);
+        cb_mutex_enter(&mag->lock);
+        while (mag->nrounds > SLAB_MAGAZINE_ROUNDS / 2) {
+            do_slabs_put_chunk(engine, mag->rounds[--mag->nrounds], id);
+        }
+        flush_magazine_delta(&engine->slabs.slabclass[id], mag);
+        cb_mutex_exit(&engine->slabs.lock);
+    }
+
+    mag->rounds[mag->nrounds++] = ptr;
+    mag->requested_delta -= size;
+    cb_mutex_exit(&mag->lock);
 }
 
 void slabs_stats(struct default_engine *engine, ADD_STAT add_stats, const void *c) {
@@ -432,6 +1195,45 @@ void slabs_stats(struct default_engine *engine, ADD_STAT add_stats, const void *
     cb_mutex_exit(&engine->slabs.lock);
 }
 
+void slabs_set_rss_target(struct default_engine *engine, size_t target) {
+    cb_mutex_enter(&engine->slabs.lock);
+    engine->slabs.rss_target = target;
+    cb_mutex_exit(&engine->slabs.lock);
+}
+
+bool slabs_repack_begin(struct default_engine *engine, unsigned int *id,
+                        void **start, size_t *len) {
+    struct slabs *s = &engine->slabs;
+    bool ret = false;
+
+    cb_mutex_enter(&s->lock);
+    do_slabs_repack_poll(engine);
+    if (s->repack_page == NULL &&
+        s->rss_target != 0 &&
+        /* a huge-page backed preallocation can't be given back with
+           madvise, so never bother vacating pages there */
+        s->mem_base_mapped == 0 &&
+        s->mem_malloced - s->mem_released > s->rss_target) {
+        do_slabs_repack_start(engine);
+    }
+    if (s->repack_page != NULL) {
+        slabclass_t *p = &s->slabclass[s->repack_id];
+        *id = s->repack_id;
+        *start = s->repack_page;
+        *len = (size_t)p->size * p->perslab;
+        ret = true;
+    }
+    cb_mutex_exit(&s->lock);
+
+    return ret;
+}
+
+void slabs_repack_tick(struct default_engine *engine) {
+    cb_mutex_enter(&engine->slabs.lock);
+    do_slabs_repack_poll(engine);
+    cb_mutex_exit(&engine->slabs.lock);
+}
+
 void slabs_adjust_mem_requested(struct default_engine *engine, unsigned int id, size_t old, size_t ntotal)
 {
     slabclass_t *p;
@@ -449,6 +1251,23 @@ void slabs_adjust_mem_requested(struct default_engine *engine, unsigned int id,
     cb_mutex_exit(&engine->slabs.lock);
 }
 
+void slabs_record_compression(struct default_engine *engine, unsigned int id,
+                              size_t saved)
+{
+    slabclass_t *p;
+    cb_mutex_enter(&engine->slabs.lock);
+    p = &engine->slabs.slabclass[id];
+    p->compressed_items++;
+    p->compressed_bytes_saved += saved;
+    cb_mutex_exit(&engine->slabs.lock);
+}
+
+size_t slabs_class_size(struct default_engine *engine, unsigned int id)
+{
+    /* class sizes are fixed at slabs_init time; no lock needed */
+    return engine->slabs.slabclass[id].size;
+}
+
 void slabs_destroy(struct default_engine *e)
 {
     /* Release the allocated backing store */
@@ -460,10 +1279,22 @@ void slabs_destroy(struct default_engine *e)
     }
     cb_free(e->slabs.allocs.ptrs);
 
+    /* A huge-page backed preallocation isn't in the allocs list */
+    if (e->slabs.mem_base_mapped != 0) {
+        hugepage_free(e->slabs.mem_base, e->slabs.mem_base_mapped);
+        e->slabs.mem_base = NULL;
+        e->slabs.mem_base_mapped = 0;
+    }
+
     /* Release the freelists */
     for (jj = POWER_SMALLEST; jj <= e->slabs.power_largest; jj++) {
         slabclass_t *p = &e->slabs.slabclass[jj];
         cb_free(p->slots);
         cb_free(p->slab_list);
+        cb_free(p->vacant_list);
+        /* chunks parked in the magazines live in the backing store
+           released above; only the magazine array itself is ours */
+        cb_free(p->magazines);
     }
+    cb_free(e->slabs.repack_hold);
 }
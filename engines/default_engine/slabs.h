@@ -6,6 +6,24 @@
 
 /* powers-of-N allocation structures */
 
+/*
+ * Magazine layer in front of the shared per-class free lists. Threads are
+ * spread over a small set of magazines by thread id; the common alloc/free
+ * path only touches its magazine's lock and falls back to the shared pool
+ * (under the slabs lock) in batches when a magazine runs empty or full.
+ */
+#define SLAB_MAGAZINE_STRIPES 8
+#define SLAB_MAGAZINE_ROUNDS 64
+
+typedef struct {
+    cb_mutex_t lock;
+    void *rounds[SLAB_MAGAZINE_ROUNDS];
+    unsigned int nrounds;
+    /* requested-bytes accounting not yet folded into the class; flushed
+       to slabclass_t::requested whenever the slabs lock is next taken */
+    ssize_t requested_delta;
+} slab_magazine_t;
+
 typedef struct {
     unsigned int size;      /* sizes of items */
     unsigned int perslab;   /* how many items per slab */
@@ -24,6 +42,24 @@ typedef struct {
 
     unsigned int killing;  /* index+1 of dying slab, or zero if none */
     size_t requested; /* The number of requested bytes */
+
+    /* transparent value compression bookkeeping: how many stores
+       landed in this class in compressed form, and the
+       raw-minus-compressed bytes those stores saved */
+    uint64_t compressed_items;
+    uint64_t compressed_bytes_saved;
+
+    /* lazily allocated array of SLAB_MAGAZINE_STRIPES magazines, or NULL
+       if no allocation has hit this class yet */
+    slab_magazine_t *magazines;
+
+    /* pages whose backing memory has been handed back to the OS with
+       madvise (see slabs_repack_begin). Still owned by the class; they
+       are re-carved - ahead of allocating fresh memory - when the class
+       needs chunks again. */
+    void **vacant_list;
+    unsigned int vacant;
+    unsigned int vacant_size;
 } slabclass_t;
 
 struct slabs {
@@ -36,12 +72,43 @@ struct slabs {
    void *mem_current;
    size_t mem_avail;
 
+   /**
+    * When mem_base is backed by explicit huge pages this holds the
+    * length of the mapping (so it can be munmap'ed rather than freed);
+    * 0 when mem_base came from the normal heap. See hugepages.h.
+    */
+   size_t mem_base_mapped;
+
    struct {
       void **ptrs;
       size_t next;
       size_t size;
    } allocs;
 
+   /**
+    * Advisory resident-memory target in bytes (0 = no target). While
+    * the slab memory still resident (mem_malloced - mem_released)
+    * exceeds the target, the repack tick consolidates mostly-idle
+    * pages and releases them to the OS. Set at runtime through the
+    * bucket.rss_target ioctl.
+    */
+   size_t rss_target;
+
+   /** Bytes currently released to the OS (the vacant pages). */
+   size_t mem_released;
+
+   /*
+    * At most one page consolidation ("repack") is in flight at a time:
+    * the page being vacated and its class, plus the free chunks pulled
+    * aside so allocations can't land in the page while the item layer
+    * migrates the live ones out. repack_page is NULL when no repack is
+    * in flight. See slabs_repack_begin in slabs.c.
+    */
+   unsigned int repack_id;
+   void *repack_page;
+   void **repack_hold;
+   unsigned int repack_held;
+
    /**
     * Access to the slab allocator is protected by this lock
     */
@@ -80,6 +147,39 @@ void slabs_free(struct default_engine *engine, void *ptr, size_t size, unsigned
 /** Adjust the stats for memory requested */
 void slabs_adjust_mem_requested(struct default_engine *engine, unsigned int id, size_t old, size_t ntotal);
 
+/** The chunk size handed out by the given class (immutable after init) */
+size_t slabs_class_size(struct default_engine *engine, unsigned int id);
+
+/** Account an item stored in compressed form in the given class */
+void slabs_record_compression(struct default_engine *engine, unsigned int id,
+                              size_t saved);
+
+/**
+ * Set the advisory resident-memory target (in bytes; 0 removes the
+ * target). The repack tick keeps releasing cold pages until the slab
+ * memory still resident is back under the target.
+ */
+void slabs_set_rss_target(struct default_engine *engine, size_t target);
+
+/**
+ * Make sure a page consolidation is in flight when the resident slab
+ * memory exceeds the rss target: picks a mostly-idle page, parks its
+ * free chunks out of allocation reach and reports the page's class and
+ * address range so the caller can migrate the remaining live items out
+ * of it. Completely idle pages found along the way are released right
+ * away. Returns true while a page is being vacated.
+ */
+bool slabs_repack_begin(struct default_engine *engine, unsigned int *id,
+                        void **start, size_t *len);
+
+/**
+ * Bookkeeping step for an in-flight repack: collect the chunks that
+ * have come home (through the magazines and the freelist) since the
+ * last migration pass, and release the page to the OS once every chunk
+ * is accounted for.
+ */
+void slabs_repack_tick(struct default_engine *engine);
+
 /** Fill buffer with stats */ /*@null@*/
 void slabs_stats(struct default_engine *engine, ADD_STAT add_stats, const void *c);
 
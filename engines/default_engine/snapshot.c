@@ -0,0 +1,593 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <platform/cb_malloc.h>
+#include <platform/crc32c.h>
+#include "default_engine_internal.h"
+#include "snapshot.h"
+
+/* The first eight bytes of a segment file */
+static const uint8_t snapshot_magic[8] = { 'D', 'E', 'S', 'N', 'A', 'P', 1, 0 };
+
+#define SNAPSHOT_VERSION 1
+
+/**
+ * The fixed header at the start of a segment file. The item count and
+ * the payload checksum are filled in after the walk has completed, so
+ * a segment from a crashed snapshot (all zeroes) never validates.
+ */
+struct snapshot_header {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t num_items;
+    uint64_t payload_bytes;
+    uint32_t payload_crc;
+    uint32_t unused;
+};
+
+/**
+ * A single serialized item: this struct followed by nkey key bytes and
+ * nbytes data bytes. The expiry is converted to an absolute wall-clock
+ * time on save (rel_time_t is relative to process startup and would be
+ * meaningless in the next process).
+ */
+struct snapshot_record {
+    uint64_t exptime; /* absolute unix time; 0 = never expires */
+    uint32_t nbytes;
+    uint32_t flags;   /* client flags, stored verbatim */
+    uint16_t nkey;
+    uint8_t datatype;
+    uint8_t unused[5];
+};
+
+static EXTENSION_LOGGER_DESCRIPTOR* get_logger(struct default_engine *engine) {
+    return (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+}
+
+/**
+ * State threaded through the item walk while writing a segment.
+ */
+struct snapshot_writer {
+    FILE *fp;
+    uint64_t items;
+    uint64_t payload_bytes;
+    uint32_t crc;
+    /* The walk can't be aborted without leaking the cursor, so a write
+       error just flips this flag and the rest of the walk is a no-op */
+    bool failed;
+    rel_time_t current_time;
+    time_t wall_now;
+};
+
+static bool writer_append(struct snapshot_writer *writer,
+                          const void *data, size_t len) {
+    if (fwrite(data, 1, len, writer->fp) != len) {
+        writer->failed = true;
+        return false;
+    }
+    writer->crc = crc32c(data, len, writer->crc);
+    writer->payload_bytes += len;
+    return true;
+}
+
+static ENGINE_ERROR_CODE item_snapshot_write(struct default_engine *engine,
+                                             hash_item *item,
+                                             void *cookie) {
+    struct snapshot_writer *writer = cookie;
+    const hash_key* key = item_get_key(item);
+    struct snapshot_record record;
+
+    if (writer->failed) {
+        return ENGINE_SUCCESS;
+    }
+
+    /* Don't persist items which are already dead (same checks as the
+       lazy expiry in do_item_get) */
+    if (item->exptime != 0 && item->exptime < writer->current_time) {
+        return ENGINE_SUCCESS;
+    }
+    if (item->fepoch != engine->items.flush_epoch) {
+        /* predates the last flush */
+        return ENGINE_SUCCESS;
+    }
+
+    memset(&record, 0, sizeof(record));
+    if (item->exptime == 0) {
+        record.exptime = 0;
+    } else {
+        record.exptime = (uint64_t)writer->wall_now +
+                         (item->exptime - writer->current_time);
+    }
+    record.nbytes = item->nbytes;
+    record.flags = item->flags;
+    record.nkey = hash_key_get_client_key_len(key);
+    record.datatype = item->datatype;
+
+    if (writer_append(writer, &record, sizeof(record)) &&
+        writer_append(writer, hash_key_get_client_key(key), record.nkey)) {
+        bool ok = true;
+        if ((item->iflag & ITEM_CHUNKED) != 0) {
+            const item_chunk *chunk = item_get_chunk(item);
+            while (ok && chunk != NULL) {
+                ok = writer_append(writer, chunk->data, chunk->used);
+                chunk = chunk->next;
+            }
+        } else if ((item->iflag & ITEM_SHARED) != 0) {
+            ok = writer_append(writer, item_get_shared(item)->data,
+                               item->nbytes);
+        } else {
+            ok = writer_append(writer, item_get_data(item), item->nbytes);
+        }
+        if (ok) {
+            writer->items++;
+        }
+    }
+
+    return ENGINE_SUCCESS;
+}
+
+static void item_snapshot_class(struct default_engine *engine,
+                                hash_item *cursor,
+                                struct snapshot_writer *writer) {
+    ENGINE_ERROR_CODE ret;
+    bool more;
+    do {
+        cb_mutex_enter(&engine->items.lock);
+        more = do_item_walk_cursor(engine, cursor, 50, item_snapshot_write,
+                                   writer, &ret);
+        cb_mutex_exit(&engine->items.lock);
+        if (ret != ENGINE_SUCCESS) {
+            break;
+        }
+    } while (more);
+}
+
+bool item_snapshot_save(struct default_engine *engine) {
+    EXTENSION_LOGGER_DESCRIPTOR *logger = get_logger(engine);
+    struct snapshot_header header;
+    struct snapshot_writer writer;
+    hash_item cursor;
+    char *tmpfile;
+    size_t tmplen;
+    int ii;
+    bool ok = false;
+
+    if (engine->config.snapshot_file == NULL) {
+        return false;
+    }
+
+    cb_mutex_enter(&engine->snapshot.lock);
+    if (engine->snapshot.running) {
+        cb_mutex_exit(&engine->snapshot.lock);
+        return false;
+    }
+    engine->snapshot.running = true;
+    engine->snapshot.last_start = time(NULL);
+    cb_mutex_exit(&engine->snapshot.lock);
+
+    tmplen = strlen(engine->config.snapshot_file) + sizeof(".tmp");
+    tmpfile = cb_malloc(tmplen);
+    if (tmpfile == NULL) {
+        goto done;
+    }
+    snprintf(tmpfile, tmplen, "%s.tmp", engine->config.snapshot_file);
+
+    memset(&writer, 0, sizeof(writer));
+    writer.fp = fopen(tmpfile, "wb");
+    if (writer.fp == NULL) {
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Snapshot: failed to create %s: %s",
+                    tmpfile, strerror(errno));
+        cb_free(tmpfile);
+        goto done;
+    }
+
+    /* Reserve room for the header; it is rewritten once the item count
+       and the checksum are known */
+    memset(&header, 0, sizeof(header));
+    if (fwrite(&header, 1, sizeof(header), writer.fp) != sizeof(header)) {
+        writer.failed = true;
+    }
+
+    writer.current_time = engine->server.core->get_current_time();
+    writer.wall_now = time(NULL);
+
+    memset(&cursor, 0, sizeof(cursor));
+    cursor.refcount = 1;
+    for (ii = 0; ii < POWER_LARGEST && !writer.failed; ++ii) {
+        bool skip = false;
+        cb_mutex_enter(&engine->items.lock);
+        if (engine->items.heads[ii] == NULL) {
+            skip = true;
+        } else {
+            /* add the item at the tail */
+            do_item_link_cursor(engine, &cursor, ii);
+        }
+        cb_mutex_exit(&engine->items.lock);
+
+        if (!skip) {
+            item_snapshot_class(engine, &cursor, &writer);
+        }
+    }
+
+    if (!writer.failed) {
+        memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.header_size = sizeof(header);
+        header.num_items = writer.items;
+        header.payload_bytes = writer.payload_bytes;
+        header.payload_crc = writer.crc;
+        if (fseek(writer.fp, 0, SEEK_SET) != 0 ||
+            fwrite(&header, 1, sizeof(header), writer.fp) != sizeof(header)) {
+            writer.failed = true;
+        }
+    }
+
+    if (fclose(writer.fp) != 0) {
+        writer.failed = true;
+    }
+
+    if (writer.failed) {
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Snapshot: write to %s failed; keeping the previous "
+                    "segment", tmpfile);
+        remove(tmpfile);
+    } else if (rename(tmpfile, engine->config.snapshot_file) != 0) {
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Snapshot: failed to rename %s: %s",
+                    tmpfile, strerror(errno));
+        remove(tmpfile);
+    } else {
+        logger->log(EXTENSION_LOG_INFO, NULL,
+                    "Snapshot: wrote %" PRIu64 " item(s) (%" PRIu64
+                    " bytes) to %s",
+                    writer.items, writer.payload_bytes,
+                    engine->config.snapshot_file);
+        ok = true;
+    }
+    cb_free(tmpfile);
+
+done:
+    cb_mutex_enter(&engine->snapshot.lock);
+    engine->snapshot.running = false;
+    engine->snapshot.last_stop = time(NULL);
+    if (ok) {
+        engine->snapshot.saved = writer.items;
+    }
+    cb_mutex_exit(&engine->snapshot.lock);
+    return ok;
+}
+
+/**
+ * A read-only mapping of a segment file. On platforms without mmap the
+ * file is slurped into an anonymous allocation instead; the restore
+ * loop doesn't care which it got.
+ */
+struct snapshot_mapping {
+    uint8_t *base;
+    size_t size;
+#ifndef WIN32
+    bool mapped;
+#endif
+};
+
+static bool snapshot_map(const char *file, struct snapshot_mapping *mapping,
+                         bool *missing) {
+    FILE *fp;
+    long size;
+
+    *missing = false;
+    memset(mapping, 0, sizeof(*mapping));
+
+    fp = fopen(file, "rb");
+    if (fp == NULL) {
+        *missing = (errno == ENOENT);
+        return false;
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+        fclose(fp);
+        return false;
+    }
+    mapping->size = (size_t)size;
+
+#ifndef WIN32
+    mapping->base = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE,
+                         fileno(fp), 0);
+    if (mapping->base == MAP_FAILED) {
+        mapping->base = NULL;
+    } else {
+        mapping->mapped = true;
+    }
+#endif
+
+    if (mapping->base == NULL) {
+        mapping->base = cb_malloc(mapping->size);
+        if (mapping->base == NULL ||
+            fseek(fp, 0, SEEK_SET) != 0 ||
+            fread(mapping->base, 1, mapping->size, fp) != mapping->size) {
+            cb_free(mapping->base);
+            mapping->base = NULL;
+        }
+    }
+
+    fclose(fp);
+    return mapping->base != NULL;
+}
+
+static void snapshot_unmap(struct snapshot_mapping *mapping) {
+#ifndef WIN32
+    if (mapping->mapped) {
+        munmap(mapping->base, mapping->size);
+        return;
+    }
+#endif
+    cb_free(mapping->base);
+}
+
+bool item_snapshot_restore(struct default_engine *engine) {
+    EXTENSION_LOGGER_DESCRIPTOR *logger = get_logger(engine);
+    struct snapshot_mapping mapping;
+    struct snapshot_header header;
+    const uint8_t *ptr;
+    const uint8_t *end;
+    uint64_t restored = 0;
+    uint64_t skipped = 0;
+    uint64_t ii;
+    time_t wall_now;
+    bool missing;
+
+    if (engine->config.snapshot_file == NULL) {
+        return true;
+    }
+
+    if (!snapshot_map(engine->config.snapshot_file, &mapping, &missing)) {
+        if (missing) {
+            /* Nothing to warm up from; a cold start */
+            return true;
+        }
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Snapshot: failed to read %s",
+                    engine->config.snapshot_file);
+        return false;
+    }
+
+    if (mapping.size < sizeof(header)) {
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Snapshot: %s is truncated; ignoring it",
+                    engine->config.snapshot_file);
+        snapshot_unmap(&mapping);
+        return false;
+    }
+
+    memcpy(&header, mapping.base, sizeof(header));
+    if (memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION ||
+        header.header_size != sizeof(header) ||
+        header.payload_bytes != mapping.size - sizeof(header) ||
+        crc32c(mapping.base + sizeof(header), header.payload_bytes, 0) !=
+        header.payload_crc) {
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Snapshot: %s failed validation; ignoring it",
+                    engine->config.snapshot_file);
+        snapshot_unmap(&mapping);
+        return false;
+    }
+
+    wall_now = time(NULL);
+    ptr = mapping.base + sizeof(header);
+    end = mapping.base + mapping.size;
+
+    for (ii = 0; ii < header.num_items; ++ii) {
+        struct snapshot_record record;
+        const uint8_t *key;
+        const uint8_t *data;
+        rel_time_t exptime;
+        hash_item *it;
+        uint64_t cas;
+
+        if ((size_t)(end - ptr) < sizeof(record)) {
+            break;
+        }
+        memcpy(&record, ptr, sizeof(record));
+        if ((size_t)(end - ptr) < sizeof(record) + record.nkey + record.nbytes) {
+            break;
+        }
+        key = ptr + sizeof(record);
+        data = key + record.nkey;
+        ptr = data + record.nbytes;
+
+        /* Expired while we were down */
+        if (record.exptime != 0 && record.exptime <= (uint64_t)wall_now) {
+            skipped++;
+            continue;
+        }
+
+        exptime = record.exptime == 0 ?
+            0 : engine->server.core->realtime((time_t)record.exptime);
+
+        it = item_alloc(engine, key, record.nkey, record.flags, exptime,
+                        record.nbytes, NULL, record.datatype);
+        if (it == NULL) {
+            /* The cache is full (the configuration may have shrunk);
+               whatever we got this far is still a warmer start */
+            logger->log(EXTENSION_LOG_WARNING, NULL,
+                        "Snapshot: out of memory after restoring %" PRIu64
+                        " item(s); the remainder of %s is skipped",
+                        restored, engine->config.snapshot_file);
+            break;
+        }
+        memcpy(item_get_data(it), data, record.nbytes);
+
+        if (store_item(engine, it, &cas, OPERATION_ADD, NULL) ==
+            ENGINE_SUCCESS) {
+            restored++;
+        }
+        item_release(engine, it);
+    }
+
+    snapshot_unmap(&mapping);
+
+    cb_mutex_enter(&engine->snapshot.lock);
+    engine->snapshot.restored = restored;
+    cb_mutex_exit(&engine->snapshot.lock);
+
+    logger->log(EXTENSION_LOG_NOTICE, NULL,
+                "Snapshot: restored %" PRIu64 " item(s) from %s (%" PRIu64
+                " expired while down)",
+                restored, engine->config.snapshot_file, skipped);
+    return true;
+}
+
+/*
+ * A batch of records on their way into one cache-lock domain. The
+ * import admits IMPORT_BATCH records at a time through the bulk
+ * allocation and store paths, so it pays for the cache lock (and the
+ * hash table insertions behind it) once per batch instead of once per
+ * document.
+ */
+#define IMPORT_BATCH 64
+
+struct import_batch {
+    item_batch_entry entries[IMPORT_BATCH];
+    const uint8_t *data[IMPORT_BATCH];
+    size_t count;
+};
+
+static void import_flush(struct default_engine *target,
+                         struct import_batch *batch,
+                         const void *cookie,
+                         uint64_t *loaded, uint64_t *skipped) {
+    size_t ii;
+
+    if (batch->count == 0) {
+        return;
+    }
+
+    item_alloc_bulk(target, batch->entries, batch->count, cookie);
+    for (ii = 0; ii < batch->count; ++ii) {
+        item_batch_entry *entry = &batch->entries[ii];
+        if (entry->item != NULL) {
+            memcpy(item_get_data(entry->item), batch->data[ii],
+                   entry->nbytes);
+        }
+    }
+    store_item_bulk(target, batch->entries, batch->count, OPERATION_ADD,
+                    cookie);
+
+    for (ii = 0; ii < batch->count; ++ii) {
+        item_batch_entry *entry = &batch->entries[ii];
+        if (entry->item == NULL) {
+            /* allocation failed (the cache is full); later records
+               may still fit elsewhere, so keep going */
+            (*skipped)++;
+        } else {
+            if (entry->status == ENGINE_SUCCESS) {
+                (*loaded)++;
+            } else {
+                /* the key already exists; the live value wins */
+                (*skipped)++;
+            }
+            item_release(target, entry->item);
+        }
+    }
+    batch->count = 0;
+}
+
+ENGINE_ERROR_CODE item_snapshot_import(struct default_engine *engine,
+                                       const void *data, size_t ndata,
+                                       const void *cookie,
+                                       uint64_t *loaded, uint64_t *skipped) {
+    const uint8_t *ptr = data;
+    const uint8_t *end = ptr + ndata;
+    const size_t ntargets = engine->nshards > 0 ? engine->nshards : 1;
+    struct import_batch *batches;
+    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+    time_t wall_now = time(NULL);
+    size_t ii;
+
+    *loaded = 0;
+    *skipped = 0;
+
+    batches = cb_calloc(ntargets, sizeof(*batches));
+    if (batches == NULL) {
+        return ENGINE_ENOMEM;
+    }
+
+    while (ptr != end) {
+        struct snapshot_record record;
+        const uint8_t *key;
+        struct default_engine *target;
+        struct import_batch *batch;
+        item_batch_entry *entry;
+        size_t idx;
+
+        if ((size_t)(end - ptr) < sizeof(record)) {
+            ret = ENGINE_EINVAL;
+            break;
+        }
+        memcpy(&record, ptr, sizeof(record));
+        if ((size_t)(end - ptr) < sizeof(record) + record.nkey + record.nbytes) {
+            ret = ENGINE_EINVAL;
+            break;
+        }
+        key = ptr + sizeof(record);
+        ptr = key + record.nkey + record.nbytes;
+
+        if (record.nkey == 0 ||
+            (record.exptime != 0 && record.exptime <= (uint64_t)wall_now)) {
+            /* a keyless record can't be stored and an expired one
+               isn't worth storing */
+            (*skipped)++;
+            continue;
+        }
+
+        idx = default_engine_shard_index(engine, key, record.nkey);
+        target = engine->nshards > 0 ? engine->shard[idx] : engine;
+        batch = &batches[idx];
+
+        entry = &batch->entries[batch->count];
+        entry->key = key;
+        entry->nkey = record.nkey;
+        entry->nbytes = record.nbytes;
+        entry->flags = (int)record.flags;
+        entry->exptime = record.exptime == 0 ?
+            0 : engine->server.core->realtime((time_t)record.exptime);
+        entry->datatype = record.datatype;
+        entry->item = NULL;
+        entry->cas = 0;
+        entry->status = ENGINE_SUCCESS;
+        batch->data[batch->count] = key + record.nkey;
+
+        if (++batch->count == IMPORT_BATCH) {
+            import_flush(target, batch, cookie, loaded, skipped);
+        }
+    }
+
+    for (ii = 0; ii < ntargets; ++ii) {
+        struct default_engine *target =
+            engine->nshards > 0 ? engine->shard[ii] : engine;
+        import_flush(target, &batches[ii], cookie, loaded, skipped);
+    }
+    cb_free(batches);
+
+    cb_mutex_enter(&engine->snapshot.lock);
+    engine->snapshot.imported += *loaded;
+    cb_mutex_exit(&engine->snapshot.lock);
+
+    return ret;
+}
@@ -0,0 +1,81 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+    Persistent warm-cache snapshots for the default engine.
+
+    When a snapshot file is configured (snapshot_file=...) a background
+    thread periodically serializes the linked items into a compact
+    segment file, and the warmup path in default_initialize() restores
+    the items at startup so a restarted node doesn't come up cold.
+
+    The segment is written by walking the LRU queues with the same
+    cursor machinery the scrubber uses, a bounded batch of items per
+    acquisition of the cache lock. It is restored by mapping the file
+    read-only and replaying the records through the normal allocation
+    and store paths; a record that has expired on the wall clock while
+    the process was down is skipped. The file is written to a temporary
+    name and renamed into place, so a crash mid-snapshot leaves the
+    previous segment intact.
+
+    The format is private to this engine and makes no attempt at being
+    portable between hosts (native endianness and struct layout); a
+    checksum over the payload rejects torn or foreign files.
+
+    The record format doubles as the wire format of the bulk-import
+    command (PROTOCOL_BINARY_CMD_ITEM_IMPORT), which replays a chunk
+    of records through the batched allocation and store paths so a new
+    node can be prewarmed from a peer's snapshot stream without paying
+    per-document command overhead.
+**/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Serialize the engine's items into the configured snapshot file.
+ * Called from the snapshot background thread.
+ * Returns true if a segment was written successfully.
+ */
+bool item_snapshot_save(struct default_engine *engine);
+
+/*
+ * Restore items from the configured snapshot file (if one exists).
+ * Called from default_initialize() once the hash table and the slab
+ * allocator are up. A missing file is not an error.
+ * Returns false only if a segment existed but could not be restored.
+ */
+bool item_snapshot_restore(struct default_engine *engine);
+
+/*
+ * Bulk-load records in the snapshot payload format from a command
+ * body (PROTOCOL_BINARY_CMD_ITEM_IMPORT). Records are admitted with
+ * ADD semantics in batches through the bulk allocation and store
+ * paths, routed per key-hash shard when sharding is enabled; loaded
+ * and skipped receive the per-record outcome. Returns ENGINE_EINVAL
+ * on a stream which is truncated mid-record (records ahead of the
+ * truncation may already have been admitted).
+ */
+ENGINE_ERROR_CODE item_snapshot_import(struct default_engine *engine,
+                                       const void *data, size_t ndata,
+                                       const void *cookie,
+                                       uint64_t *loaded, uint64_t *skipped);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,310 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <platform/cb_malloc.h>
+#include "default_engine_internal.h"
+#include "tier.h"
+
+enum tier_request_type {
+    TIER_FETCH,     /* read-through: a missed key and its waiting cookie */
+    TIER_WRITEBACK  /* write-behind: an evicted item (by reference) */
+};
+
+/*
+ * One queued unit of work for the tier thread. Fetch requests carry a
+ * copy of the key (the request packet the key pointed into is gone by
+ * the time the thread runs) and a reserved cookie; write-backs carry
+ * a referenced item instead.
+ */
+struct tier_request {
+    struct tier_request *next;
+    enum tier_request_type type;
+    const void *cookie;
+    hash_item *it;
+    size_t nkey;
+    char key[1];
+};
+
+/*
+ * Consult the external store for a missed key. A fetched document is
+ * admitted through the normal store path with OPERATION_ADD, so a
+ * client store which raced the fetch wins over the (by definition no
+ * fresher) external copy. The waiting connection is then woken up
+ * with the outcome: ENGINE_SUCCESS makes the core re-run the get
+ * (which now hits), a miss is final, and anything else is surfaced
+ * as a temporary failure rather than risking a fetch/miss loop.
+ */
+static void tier_run_fetch(struct default_engine *engine,
+                           const engine_tier_config *config,
+                           struct tier_request *req) {
+    engine_tier_item titem;
+    ENGINE_ERROR_CODE status;
+
+    memset(&titem, 0, sizeof(titem));
+    status = config->fetch(config->ctx, req->key, req->nkey, &titem);
+
+    if (status == ENGINE_SUCCESS) {
+        rel_time_t exptime = titem.ttl == 0 ?
+            0 : engine->server.core->realtime((time_t)titem.ttl);
+        hash_item *it = item_alloc(engine, req->key, req->nkey,
+                                   (int)titem.flags, exptime,
+                                   (int)titem.ndata, NULL, titem.datatype);
+        if (it == NULL) {
+            status = ENGINE_TMPFAIL;
+        } else {
+            uint64_t cas = 0;
+            ENGINE_ERROR_CODE stored;
+            memcpy(item_get_data(it), titem.data, titem.ndata);
+            stored = store_item(engine, it, &cas, OPERATION_ADD, NULL);
+            item_release(engine, it);
+            if (stored != ENGINE_SUCCESS && stored != ENGINE_NOT_STORED &&
+                stored != ENGINE_KEY_EEXISTS) {
+                status = ENGINE_TMPFAIL;
+            }
+        }
+        cb_free(titem.data);
+    } else if (status != ENGINE_KEY_ENOENT) {
+        status = ENGINE_TMPFAIL;
+    }
+
+    cb_mutex_enter(&engine->tier.lock);
+    engine->tier.fetches++;
+    if (status == ENGINE_SUCCESS) {
+        engine->tier.fetch_hits++;
+    } else if (status == ENGINE_KEY_ENOENT) {
+        engine->tier.fetch_misses++;
+    } else {
+        engine->tier.fetch_errors++;
+    }
+    cb_mutex_exit(&engine->tier.lock);
+
+    engine->server.cookie->notify_io_complete(req->cookie, status);
+    engine->server.cookie->release(req->cookie);
+}
+
+/*
+ * Hand an evicted item's document to the write-behind callback. The
+ * reference taken at eviction time keeps the item's memory (and any
+ * chunk chain or shared block) intact; values which aren't contiguous
+ * are gathered into a temporary buffer first.
+ */
+static void tier_run_writeback(struct default_engine *engine,
+                               const engine_tier_config *config,
+                               struct tier_request *req) {
+    hash_item *it = req->it;
+    const hash_key *key = item_get_key(it);
+    const void *data;
+    char *buf = NULL;
+    uint32_t ttl = 0;
+
+    if (it->exptime != 0) {
+        rel_time_t now = engine->server.core->get_current_time();
+        ttl = it->exptime > now ? it->exptime - now : 1;
+    }
+
+    if ((it->iflag & (ITEM_CHUNKED | ITEM_SHARED)) != 0) {
+        buf = cb_malloc(it->nbytes);
+        if (buf == NULL) {
+            item_release(engine, it);
+            return;
+        }
+        item_copy_data(it, buf);
+        data = buf;
+    } else {
+        data = item_get_data(it);
+    }
+
+    config->evict(config->ctx, hash_key_get_client_key(key),
+                  hash_key_get_client_key_len(key),
+                  data, it->nbytes, it->flags, ttl, it->datatype);
+    cb_free(buf);
+
+    cb_mutex_enter(&engine->tier.lock);
+    engine->tier.writebacks++;
+    cb_mutex_exit(&engine->tier.lock);
+
+    item_release(engine, it);
+}
+
+static void tier_thread_main(void *arg) {
+    struct default_engine *engine = arg;
+
+    cb_mutex_enter(&engine->tier.lock);
+    while (!engine->tier.shutdown) {
+        struct tier_request *req = engine->tier.head;
+        engine_tier_config config;
+        if (req == NULL) {
+            cb_cond_wait(&engine->tier.cond, &engine->tier.lock);
+            continue;
+        }
+        engine->tier.head = req->next;
+        if (engine->tier.head == NULL) {
+            engine->tier.tail = NULL;
+        }
+        /* run the callback outside the lock (it may block on I/O) */
+        config = engine->tier.config;
+        cb_mutex_exit(&engine->tier.lock);
+
+        if (req->type == TIER_FETCH) {
+            tier_run_fetch(engine, &config, req);
+        } else {
+            tier_run_writeback(engine, &config, req);
+        }
+        cb_free(req);
+
+        cb_mutex_enter(&engine->tier.lock);
+    }
+    cb_mutex_exit(&engine->tier.lock);
+}
+
+ENGINE_ERROR_CODE item_tier_set_config(struct default_engine *engine,
+                                       const engine_tier_config *config) {
+    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+
+    cb_mutex_enter(&engine->tier.lock);
+    engine->tier.config = *config;
+    if (!engine->tier.running &&
+        (config->fetch != NULL || config->evict != NULL)) {
+        if (cb_create_named_thread(&engine->tier.thread, tier_thread_main,
+                                   engine, 0, "mc:tier_io") != 0) {
+            memset(&engine->tier.config, 0, sizeof(engine->tier.config));
+            ret = ENGINE_FAILED;
+        } else {
+            engine->tier.running = true;
+        }
+    }
+    cb_mutex_exit(&engine->tier.lock);
+    return ret;
+}
+
+void item_tier_destroy(struct default_engine *engine) {
+    struct tier_request *req;
+
+    cb_mutex_enter(&engine->tier.lock);
+    if (!engine->tier.running) {
+        cb_mutex_exit(&engine->tier.lock);
+        return;
+    }
+    engine->tier.shutdown = true;
+    cb_cond_signal(&engine->tier.cond);
+    cb_mutex_exit(&engine->tier.lock);
+    cb_join_thread(engine->tier.thread);
+
+    /* Drain whatever the thread didn't get to. Waiting connections
+       are failed back rather than left hanging; write-backs are
+       simply dropped (the external store misses some warmth). */
+    while ((req = engine->tier.head) != NULL) {
+        engine->tier.head = req->next;
+        if (req->type == TIER_FETCH) {
+            engine->server.cookie->notify_io_complete(req->cookie,
+                                                      ENGINE_TMPFAIL);
+            engine->server.cookie->release(req->cookie);
+        } else {
+            item_release(engine, req->it);
+        }
+        cb_free(req);
+    }
+    engine->tier.tail = NULL;
+    engine->tier.running = false;
+}
+
+bool item_tier_fetch(struct default_engine *engine,
+                     const void *cookie,
+                     const void *key,
+                     size_t nkey) {
+    struct tier_request *req;
+
+    /* unlocked pre-check; registration is a one-time administrative
+       action and a racing miss just takes the plain-miss path */
+    if (!engine->tier.running || engine->tier.config.fetch == NULL) {
+        return false;
+    }
+
+    req = cb_malloc(offsetof(struct tier_request, key) + nkey);
+    if (req == NULL) {
+        return false;
+    }
+    if (engine->server.cookie->reserve(cookie) != ENGINE_SUCCESS) {
+        cb_free(req);
+        return false;
+    }
+    req->next = NULL;
+    req->type = TIER_FETCH;
+    req->cookie = cookie;
+    req->it = NULL;
+    req->nkey = nkey;
+    memcpy(req->key, key, nkey);
+
+    cb_mutex_enter(&engine->tier.lock);
+    if (engine->tier.shutdown || engine->tier.config.fetch == NULL) {
+        cb_mutex_exit(&engine->tier.lock);
+        engine->server.cookie->release(cookie);
+        cb_free(req);
+        return false;
+    }
+    if (engine->tier.tail != NULL) {
+        engine->tier.tail->next = req;
+    } else {
+        engine->tier.head = req;
+    }
+    engine->tier.tail = req;
+    cb_cond_signal(&engine->tier.cond);
+    cb_mutex_exit(&engine->tier.lock);
+    return true;
+}
+
+void item_tier_evict_notify(struct default_engine *engine,
+                            hash_item *it) {
+    struct tier_request *req;
+
+    if (!engine->tier.running || engine->tier.config.evict == NULL) {
+        return;
+    }
+
+    req = cb_malloc(offsetof(struct tier_request, key));
+    if (req == NULL) {
+        /* the eviction proceeds; this document just isn't written back */
+        return;
+    }
+    req->next = NULL;
+    req->type = TIER_WRITEBACK;
+    req->cookie = NULL;
+    req->it = it;
+    req->nkey = 0;
+
+    cb_mutex_enter(&engine->tier.lock);
+    if (engine->tier.shutdown) {
+        cb_mutex_exit(&engine->tier.lock);
+        cb_free(req);
+        return;
+    }
+    /* the caller holds items.lock, so bump the refcount directly; the
+       tier thread's item_release gives it back once the write-back
+       has run */
+    it->refcount++;
+    if (engine->tier.tail != NULL) {
+        engine->tier.tail->next = req;
+    } else {
+        engine->tier.head = req;
+    }
+    engine->tier.tail = req;
+    cb_cond_signal(&engine->tier.cond);
+    cb_mutex_exit(&engine->tier.lock);
+}
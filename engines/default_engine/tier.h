@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+    External-store tier for the default engine (set_tier_config).
+
+    With a fetch callback registered the engine acts as the memory
+    tier of a tiered cache: a miss in get() queues the key for the
+    tier thread and returns ENGINE_EWOULDBLOCK; the thread consults
+    the external store, admits a fetched document through the normal
+    store path and wakes the waiting connection up again through
+    notify_io_complete with the outcome. With an evict callback
+    registered, every item evicted for memory pressure is handed to
+    the thread (by reference, before its memory is reused) and written
+    back to the external store, so the slower tier stays warm.
+
+    The callbacks run exclusively on the tier thread - never on a
+    frontend worker and never under the cache lock - so they are free
+    to block on I/O. The cost of that simplicity is that one slow
+    fetch delays the fetches queued behind it; the external store is
+    assumed to be the bottleneck either way.
+**/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Register the external-store callbacks and start the tier thread
+ * (on first registration). Called from set_tier_config.
+ */
+ENGINE_ERROR_CODE item_tier_set_config(struct default_engine *engine,
+                                       const engine_tier_config *config);
+
+/*
+ * Stop and join the tier thread and drain the queue. Pending fetches
+ * are failed back to their connections so nobody is left waiting.
+ * Called from destroy_engine_instance before the engine is torn down.
+ */
+void item_tier_destroy(struct default_engine *engine);
+
+/*
+ * Queue a missed key for a read-through fetch. Returns true if the
+ * fetch was queued (the caller returns ENGINE_EWOULDBLOCK and the
+ * connection is woken up by the tier thread), false if no fetch
+ * callback is registered or the queue entry couldn't be allocated
+ * (the miss stands).
+ */
+bool item_tier_fetch(struct default_engine *engine,
+                     const void *cookie,
+                     const void *key,
+                     size_t nkey);
+
+/*
+ * Hand an item which is about to be evicted to the tier thread for
+ * write-behind. Called under items.lock, before the eviction unlinks
+ * the item; on success a reference is taken so the item's memory
+ * survives until the write-back has run. A no-op without an evict
+ * callback.
+ */
+void item_tier_evict_notify(struct default_engine *engine,
+                            hash_item *it);
+
+#ifdef __cplusplus
+}
+#endif
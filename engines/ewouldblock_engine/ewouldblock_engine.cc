@@ -60,6 +60,8 @@
 #include "ewouldblock_engine.h"
 
 #include <atomic>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
 #include <cstring>
 #include <map>
@@ -69,6 +71,7 @@
 #include <random>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <memcached/engine.h>
 #include <memcached/extension.h>
@@ -193,7 +196,8 @@ public:
                 // The server expects that if EWOULDBLOCK is returned then the
                 // server should be notified in the future when the operation is
                 // ready - so add this op to the pending IO queue.
-                schedule_notification(iter->second.first);
+                schedule_notification(iter->second.first,
+                                      iter->second.second->next_delay_usec());
             }
         }
 
@@ -370,6 +374,21 @@ public:
                                        const void* cookie, const char* stat_key,
                                        int nkey, ADD_STAT add_stat) {
         EWB_Engine* ewb = to_engine(handle);
+
+        // "stats ewb" reports the injection bookkeeping. It bypasses the
+        // error injection so the counters can be polled while a chaos
+        // mode is active.
+        if (stat_key != nullptr && nkey == 3 &&
+            memcmp(stat_key, "ewb", 3) == 0) {
+            ewb->add_ewb_stat("ewb_in_flight", ewb->in_flight.load(),
+                              add_stat, cookie);
+            ewb->add_ewb_stat("ewb_in_flight_hwm", ewb->in_flight_hwm.load(),
+                              add_stat, cookie);
+            ewb->add_ewb_stat("ewb_completions", ewb->completions.load(),
+                              add_stat, cookie);
+            return ENGINE_SUCCESS;
+        }
+
         ENGINE_ERROR_CODE err = ENGINE_SUCCESS;
         if (ewb->should_inject_error(Cmd::GET_STATS, cookie, err)) {
             return err;
@@ -379,6 +398,13 @@ public:
         }
     }
 
+    void add_ewb_stat(const char* key, uint64_t value, ADD_STAT add_stat,
+                      const void* cookie) {
+        const std::string val = std::to_string(value);
+        add_stat(key, uint16_t(strlen(key)), val.c_str(),
+                 uint32_t(val.size()), cookie);
+    }
+
     static void reset_stats(ENGINE_HANDLE* handle, const void* cookie) {
         EWB_Engine* ewb = to_engine(handle);
         return ewb->real_engine->reset_stats(ewb->real_handle, cookie);
@@ -448,6 +474,15 @@ public:
                     return ewb->handleBlockMonitorFile(cookie, value, key,
                                                        response);
 
+                case EWBEngineMode::Latency: {
+                    ErrWithLatency::Distribution dist;
+                    if (ErrWithLatency::parse_distribution(key, dist)) {
+                        new_mode = std::make_shared<ErrWithLatency>(
+                                injected_error, value, dist);
+                    }
+                    break;
+                }
+
                 case EWBEngineMode::Suspend:
                     return ewb->handleSuspend(cookie, value, response);
 
@@ -574,11 +609,19 @@ public:
 
     /**
      * The method responsible for pushing all of the notify_io_complete
-     * to the frontend. It is run by notify_io_thread and not intended to
-     * be called by anyone else!.
+     * to the frontend. It is run by the notify_io_threads pool and not
+     * intended to be called by anyone else!.
      */
     void process_notifications();
-    std::unique_ptr<Couchbase::Thread> notify_io_thread;
+
+    /**
+     * Pool of notifier threads delivering the completions. Using more
+     * than one mimics ep-engine (where completions arrive from the
+     * flusher, the bg-fetchers and the notifier concurrently) and makes
+     * sure the daemon copes with notify storms from several sources.
+     */
+    static const size_t NOTIFIER_POOL_SIZE = 4;
+    std::vector<std::unique_ptr<Couchbase::Thread> > notify_io_threads;
 
 protected:
     /**
@@ -623,11 +666,24 @@ protected:
 
 private:
     // Shared state between the main thread of execution and the background
-    // thread processing pending io ops.
+    // threads processing pending io ops.
     std::mutex mutex;
     std::condition_variable condvar;
     std::queue<const void*> pending_io_ops;
 
+    // Completions which may not be delivered before their deadline
+    // (min-heap ordered on the deadline); used by the Latency mode.
+    typedef std::pair<std::chrono::steady_clock::time_point,
+                      const void*> DelayedOp;
+    std::priority_queue<DelayedOp, std::vector<DelayedOp>,
+                        std::greater<DelayedOp> > delayed_io_ops;
+
+    // Depth accounting for the outstanding (EWOULDBLOCK'ed but not yet
+    // notified) engine ops; exposed through "stats ewb".
+    std::atomic<uint64_t> in_flight;
+    std::atomic<uint64_t> in_flight_hwm;
+    std::atomic<uint64_t> completions;
+
     std::atomic<bool> stop_notification_thread;
 
 
@@ -662,6 +718,13 @@ private:
         }
         virtual bool should_inject_error(Cmd cmd, ENGINE_ERROR_CODE& err) = 0;
 
+        /* How long the completion notification for the error just
+         * injected should be delayed. Only consulted when the injected
+         * error was EWOULDBLOCK; most modes notify immediately. */
+        virtual uint32_t next_delay_usec() {
+            return 0;
+        }
+
         virtual std::string to_string() const = 0;
 
     protected:
@@ -839,6 +902,86 @@ private:
         uint32_t count;
     };
 
+    class ErrWithLatency : public FaultInjectMode {
+    public:
+        enum class Distribution { Fixed, Lognormal, Pareto };
+
+        static bool parse_distribution(const std::string& name,
+                                       Distribution& dist) {
+            if (name.empty() || name == "fixed") {
+                dist = Distribution::Fixed;
+            } else if (name == "lognormal") {
+                dist = Distribution::Lognormal;
+            } else if (name == "pareto") {
+                dist = Distribution::Pareto;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        ErrWithLatency(ENGINE_ERROR_CODE injected_error_, uint32_t latency_,
+                       Distribution distribution_)
+          : FaultInjectMode(injected_error_),
+            latency(latency_),
+            distribution(distribution_),
+            pending(false),
+            gen(std::random_device()()) {}
+
+        bool should_inject_error(Cmd cmd, ENGINE_ERROR_CODE& err) {
+            // Inject on the initial call; the retry (issued once the
+            // delayed notification arrives) goes through to the real
+            // engine, so each command pays the sampled latency once.
+            if (pending) {
+                pending = false;
+                return false;
+            }
+            pending = true;
+            err = injected_error;
+            return true;
+        }
+
+        uint32_t next_delay_usec() {
+            double delay;
+            switch (distribution) {
+            case Distribution::Lognormal: {
+                // Median at 'latency'; sigma 0.5 gives a tail roughly
+                // matching a lightly loaded disk backend.
+                std::lognormal_distribution<double> dis(std::log(latency), 0.5);
+                delay = dis(gen);
+                break;
+            }
+            case Distribution::Pareto: {
+                // Scale 'latency', shape 2 (finite mean, heavy tail).
+                std::uniform_real_distribution<double> dis(0.0, 1.0);
+                delay = latency / std::sqrt(1.0 - dis(gen));
+                break;
+            }
+            default:
+                return latency;
+            }
+
+            // Keep the tail bounded so a single unlucky sample can't
+            // wedge a test run.
+            return uint32_t(std::min(delay, latency * 100.0));
+        }
+
+        std::string to_string() const {
+            const char* names[] = { "fixed", "lognormal", "pareto" };
+            return std::string("ErrWithLatency") +
+                   " inject_error=" + std::to_string(injected_error) +
+                   " latency_usec=" + std::to_string(latency) +
+                   " distribution=" + names[int(distribution)];
+        }
+
+    private:
+        const uint32_t latency;
+        const Distribution distribution;
+        // Is a delayed completion outstanding for this connection?
+        bool pending;
+        std::mt19937 gen;
+    };
+
     // Map of connections (aka cookies) to their current mode.
     std::map<uint64_t, std::pair<const void*, std::shared_ptr<FaultInjectMode> > > connection_map;
     // Mutex for above map.
@@ -902,15 +1045,29 @@ private:
         return false;
     }
 
-    void schedule_notification(const void* cookie) {
+    void schedule_notification(const void* cookie, uint32_t delay_usec = 0) {
         {
             std::lock_guard<std::mutex> guard(mutex);
-            pending_io_ops.push(cookie);
+            if (delay_usec == 0) {
+                pending_io_ops.push(cookie);
+            } else {
+                delayed_io_ops.emplace(std::chrono::steady_clock::now() +
+                                       std::chrono::microseconds(delay_usec),
+                                       cookie);
+            }
         }
         auto logger = gsa()->log->get_logger();
-        logger->log(EXTENSION_LOG_WARNING, nullptr,
+        logger->log(EXTENSION_LOG_DEBUG, nullptr,
                     "EWB_Engine: connection %p should be resumed for engine %p", cookie, this);
 
+        // Track the outstanding depth so tests can verify the daemon's
+        // behavior with a large number of in-flight engine ops.
+        const uint64_t depth = ++in_flight;
+        uint64_t hwm = in_flight_hwm.load();
+        while (depth > hwm && !in_flight_hwm.compare_exchange_weak(hwm, depth)) {
+            // Retry with the updated watermark
+        }
+
         condvar.notify_one();
     }
 
@@ -923,8 +1080,7 @@ private:
 EWB_Engine::EWB_Engine(GET_SERVER_API gsa_)
   : gsa(gsa_),
     real_engine(NULL),
-    real_engine_ref(nullptr),
-    notify_io_thread(new NotificationThread(*this))
+    real_engine_ref(nullptr)
 {
     interface.interface = 1;
     ENGINE_HANDLE_V1::get_info = get_info;
@@ -949,6 +1105,14 @@ EWB_Engine::EWB_Engine(GET_SERVER_API gsa_)
     ENGINE_HANDLE_V1::get_engine_vb_map = get_engine_vb_map;
     ENGINE_HANDLE_V1::get_stats_struct = NULL;
     ENGINE_HANDLE_V1::set_log_level = NULL;
+    // Not proxied; the core falls back to the single-item entry points
+    // (and hence to our error injection on those).
+    ENGINE_HANDLE_V1::allocate_bulk = NULL;
+    ENGINE_HANDLE_V1::store_bulk = NULL;
+    ENGINE_HANDLE_V1::append = NULL;
+    ENGINE_HANDLE_V1::get_multi = NULL;
+    ENGINE_HANDLE_V1::get_copy = NULL;
+    ENGINE_HANDLE_V1::remove_multi = NULL;
 
     ENGINE_HANDLE_V1::dcp = {};
     ENGINE_HANDLE_V1::dcp.step = dcp_step;
@@ -964,15 +1128,24 @@ EWB_Engine::EWB_Engine(GET_SERVER_API gsa_)
 
     get_connection_id = gsa()->cookie->get_connection_id;
 
+    in_flight = 0;
+    in_flight_hwm = 0;
+    completions = 0;
+
     stop_notification_thread.store(false);
-    notify_io_thread->start();
+    for (size_t ii = 0; ii < NOTIFIER_POOL_SIZE; ++ii) {
+        notify_io_threads.emplace_back(new NotificationThread(*this));
+        notify_io_threads.back()->start();
+    }
 }
 
 EWB_Engine::~EWB_Engine() {
     cb_free(real_engine_ref);
     stop_notification_thread = true;
     condvar.notify_all();
-    notify_io_thread->waitForState(Couchbase::ThreadState::Zombie);
+    for (auto& thread : notify_io_threads) {
+        thread->waitForState(Couchbase::ThreadState::Zombie);
+    }
 }
 
 ENGINE_ERROR_CODE EWB_Engine::dcp_step(ENGINE_HANDLE* handle, const void* cookie,
@@ -1071,13 +1244,31 @@ void EWB_Engine::process_notifications() {
                 "EWB_Engine: notification thread running for engine %p", this);
     std::unique_lock<std::mutex> lk(mutex);
     while (!stop_notification_thread) {
-        condvar.wait(lk);
+        if (pending_io_ops.empty()) {
+            if (delayed_io_ops.empty()) {
+                condvar.wait(lk);
+            } else {
+                // Sleep until the next deadline; everything which has
+                // become due by then is delivered as one batch, giving
+                // the bursty completion cadence of a real flusher.
+                condvar.wait_until(lk, delayed_io_ops.top().first);
+            }
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        while (!delayed_io_ops.empty() && delayed_io_ops.top().first <= now) {
+            pending_io_ops.push(delayed_io_ops.top().second);
+            delayed_io_ops.pop();
+        }
+
         while (!pending_io_ops.empty()) {
             const void* cookie = pending_io_ops.front();
             pending_io_ops.pop();
             lk.unlock();
             logger->log(EXTENSION_LOG_DEBUG, nullptr, "EWB_Engine: notify %p");
             server->cookie->notify_io_complete(cookie, ENGINE_SUCCESS);
+            completions++;
+            in_flight--;
             lk.lock();
         }
     }
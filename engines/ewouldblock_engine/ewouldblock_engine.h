@@ -107,6 +107,18 @@ enum class EWBEngineMode : uint32_t {
     // while a bucket is deleted. Given that we're not instructing the
     // ewouldblock engine on a special channel there is no way to send
     // commmands to the engine whlie it is being deleted ;-)
-    BlockMonitorFile = 9
+    BlockMonitorFile = 9,
+
+    // Model backend latency: every call returns {inject_error} (normally
+    // EWOULDBLOCK) and the completion notification is delivered by the
+    // notifier pool once a sampled delay has passed; the retry of the
+    // command then goes through to the real engine. The {value} field is
+    // the latency parameter in microseconds and the key selects the
+    // distribution: "" or "fixed" (constant delay), "lognormal" (median
+    // {value}) or "pareto" (scale {value}, heavy tail). The engine keeps
+    // in-flight depth counters, available via "stats ewb", so tests can
+    // verify the daemon's behavior with tens of thousands of outstanding
+    // engine ops without a real ep-engine.
+    Latency = 10
 
 };
@@ -834,7 +834,7 @@ private:
 
 
 struct EngineGlue {
-    EngineGlue(SERVER_HANDLE_V1 *api): me(api) {
+    EngineGlue(SERVER_HANDLE_V1 *api): interface(), me(api) {
         interface.interface.interface = 1;
         interface.get_info = get_info;
         interface.initialize = initialize;
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <iostream>
+#include <vector>
 
 #ifdef WIN32
 #include <io.h>
@@ -54,20 +55,63 @@ static EXTENSION_LOG_LEVEL output_level = EXTENSION_LOG_NOTICE;
 static size_t cyclesz = 100 * 1024 * 1024;
 
 /*
- * We're using two buffers for logging. We'll be inserting data into one,
- * while we're working on writing the other one to disk. Given that the disk
- * is way slower than our CPU, we might end up in a situation that we'll be
- * blocking the frontend threads if you're logging too much.
+ * Each thread stages its formatted log messages in a buffer of its
+ * own which is drained by the flusher thread. The only
+ * synchronization on the logging path is the per-thread mutex, which
+ * is uncontended unless the flusher happens to be draining that
+ * particular buffer. If a buffer fills up faster than the flusher can
+ * drain it the owning thread drops the message (and the drops are
+ * accounted for in the log) instead of blocking.
  */
-static struct logbuffer {
+struct thread_logbuffer {
+    /* Protects all of the fields in this structure */
+    cb_mutex_t mutex;
+    /* Signalled by the flusher thread when it has drained the buffer */
+    cb_cond_t space_cond;
     /* Pointer to beginning of the datasegment of this buffer */
     char *data;
+    /* The size of the datasegment (the buffersize when it was created) */
+    size_t capacity;
     /* The current offset of the buffer */
     size_t offset;
-} buffers[2];
-
-/* The index in the buffers where we're currently inserting more data */
-static int currbuffer = 0;
+    /* The number of messages thrown away because the buffer was full */
+    uint32_t dropped;
+    /* Set when the owning thread is gone. The flusher thread releases
+     * the buffer once it has been fully drained */
+    bool retired;
+
+    /* To avoid the logs beeing flooded by the same log messages we try
+     * to de-duplicate the messages and instead print out:
+     *   "message repeated xxx times"
+     */
+    struct {
+        /* The last message being added to the log */
+        char buffer[2048];
+        /* The number of times we've seen this message */
+        int count;
+        /* The offset into the buffer for where the text start (after the
+         * timestamp)
+         */
+        int offset;
+        /* The sec when the entry was added (used for flushing of the
+         * dedupe log)
+         */
+        time_t created;
+    } lastlog;
+};
+
+/* All of the thread buffers currently alive (protected by mutex) */
+static std::vector<struct thread_logbuffer *> buffers;
+
+/* The scratch buffer the flusher thread swaps with a thread buffer so
+ * that the file IO can be performed without holding the thread's lock */
+static char *drain_buffer;
+static size_t drain_capacity;
+
+/* The number of times a thread waits for the flusher thread to drain
+ * its buffer (100 ms at a time) before it gives up and drops the
+ * message */
+static const int max_space_retries = 50;
 
 /* Are we running in a unit test (don't print warnings to stderr) */
 static bool unit_test = false;
@@ -79,8 +123,8 @@ static size_t buffersz = 2048 * 1024;
 /* The sleeptime between each forced flush of the buffer */
 static size_t sleeptime = 60;
 
-/* To avoid race condition we're protecting our shared resources with a
- * single mutex. */
+/* The mutex protecting the registry of thread buffers and the
+ * wakeup of the flusher thread */
 static cb_mutex_t mutex;
 
 /* The thread performing the disk IO will be waiting for the input buffers
@@ -90,106 +134,165 @@ static cb_mutex_t mutex;
  */
 static cb_cond_t cond;
 
-/* In the "worst case scenarios" we're logging so much that the disk thread
- * can't keep up with the the frontend threads. In these rare situations
- * the frontend threads will block and wait for the flusher to free up log
- * space
- */
-static cb_cond_t space_cond;
-
 static char hostname[256];
 static pid_t pid;
 
-/* To avoid the logs beeing flooded by the same log messages we try to
- * de-duplicate the messages and instead print out:
- *   "message repeated xxx times"
+/**
+ * Allocate and register the logbuffer for the calling thread
  */
-static struct {
-    /* The last message being added to the log */
-    char buffer[2048];
-    /* The number of times we've seen this message */
-    int count;
-    /* The offset into the buffer for where the text start (after the
-     * timestamp)
-     */
-    int offset;
-    /* The sec when the entry was added (used for flushing of the
-     * dedupe log)
-     */
-    time_t created;
-} lastlog;
-
-static void do_add_log_entry(const char *msg, size_t size) {
-    /* wait until there is room in the current buffer */
-    while ((buffers[currbuffer].offset + size) >= buffersz) {
-        if (!unit_test) {
-            fprintf(stderr, "WARNING: waiting for log space to be available\n");
+static struct thread_logbuffer *create_thread_logbuffer(void) {
+    auto *lb = reinterpret_cast<struct thread_logbuffer*>(
+        cb_calloc(1, sizeof(struct thread_logbuffer)));
+    if (lb == NULL) {
+        return NULL;
+    }
+    lb->data = reinterpret_cast<char*>(cb_malloc(buffersz));
+    if (lb->data == NULL) {
+        cb_free(lb);
+        return NULL;
+    }
+    lb->capacity = buffersz;
+    cb_mutex_initialize(&lb->mutex);
+    cb_cond_initialize(&lb->space_cond);
+
+    cb_mutex_enter(&mutex);
+    buffers.push_back(lb);
+    cb_mutex_exit(&mutex);
+    return lb;
+}
+
+/**
+ * The holder of a threads logbuffer. When the thread dies the buffer
+ * is marked retired, and the flusher thread releases it once it is
+ * fully drained.
+ */
+class ThreadLogbuffer {
+public:
+    ThreadLogbuffer() : lb(create_thread_logbuffer()) {
+    }
+
+    ~ThreadLogbuffer() {
+        if (lb != NULL) {
+            cb_mutex_enter(&lb->mutex);
+            lb->retired = true;
+            cb_mutex_exit(&lb->mutex);
         }
-        cb_cond_wait(&space_cond, &mutex);
     }
 
-    /* We could have performed the memcpy outside the locked region,
-     * but then we would need to handle the situation where we're
-     * flipping the ownership of the buffer (otherwise we could be
-     * writing rubbish to the file) */
-    memcpy(buffers[currbuffer].data + buffers[currbuffer].offset,
-           msg, size);
-    buffers[currbuffer].offset += size;
-    if (buffers[currbuffer].offset > (buffersz * 0.75)) {
-        /* we're getting full.. time get the logger to start doing stuff! */
+    struct thread_logbuffer *get(void) {
+        return lb;
+    }
+
+private:
+    struct thread_logbuffer * const lb;
+};
+
+static struct thread_logbuffer *get_thread_logbuffer(void) {
+    static thread_local ThreadLogbuffer holder;
+    return holder.get();
+}
+
+/* The caller must hold lb->mutex */
+static void do_add_log_entry(struct thread_logbuffer *lb,
+                             const char *msg, size_t size) {
+    int retries = 0;
+
+    /* wait (for a bounded period of time) for room in the buffer */
+    while ((lb->offset + size) >= lb->capacity) {
+        if (retries++ == max_space_retries) {
+            /* The flusher thread can't keep up with us. Drop the
+             * message instead of blocking the worker; the flusher
+             * logs the number of dropped messages when it drains
+             * the buffer. */
+            lb->dropped++;
+            if (!unit_test) {
+                fprintf(stderr, "WARNING: log buffer full, dropping message\n");
+            }
+            return;
+        }
+        /* Wake up the flusher thread. Taking the global mutex here is
+         * safe (the flusher never waits for a thread buffer while
+         * holding it), and this is already the slow path. */
+        cb_mutex_enter(&mutex);
         cb_cond_signal(&cond);
+        cb_mutex_exit(&mutex);
+        cb_cond_timedwait(&lb->space_cond, &lb->mutex, 100);
     }
+
+    memcpy(lb->data + lb->offset, msg, size);
+    lb->offset += size;
 }
 
-static void flush_last_log(bool timebased) {
-    if (lastlog.count > 1) {
+/* The caller must hold lb->mutex */
+static void flush_last_log(struct thread_logbuffer *lb) {
+    if (lb->lastlog.count > 1) {
         ISOTime::ISO8601String timestamp;
         ISOTime::generatetimestamp(timestamp);
 
         char buffer[512];
         int offset = snprintf(buffer, sizeof(buffer),
                               "%s Message repeated %u times\n",
-                              timestamp.data(), lastlog.count);
+                              timestamp.data(), lb->lastlog.count);
 
         if (offset < 0 || offset >= sizeof(buffer)) {
             // Failed to format... ignore for now..
             return;
         }
 
-        // Only try to flush if there is enough free space, otherwise
-        // we'll be causing a deadlock
-        if (timebased && ((buffers[currbuffer].offset + offset) >= buffersz)) {
-            return ;
+        // Only flush if there is enough free space; otherwise we'll
+        // retry after the buffer has been drained (waiting for space
+        // here could deadlock the flusher thread with itself)
+        if ((lb->offset + offset) >= lb->capacity) {
+            return;
         }
 
-        do_add_log_entry(buffer, offset);
-        lastlog.buffer[0] = '\0';
-        lastlog.count = 0;
-        lastlog.offset = 0;
-        lastlog.created = 0;
+        memcpy(lb->data + lb->offset, buffer, offset);
+        lb->offset += offset;
+        lb->lastlog.buffer[0] = '\0';
+        lb->lastlog.count = 0;
+        lb->lastlog.offset = 0;
+        lb->lastlog.created = 0;
     }
 }
 
 static void add_log_entry(time_t now, const char *msg, int prefixlen, size_t size)
 {
-    cb_mutex_enter(&mutex);
+    struct thread_logbuffer *lb = get_thread_logbuffer();
+    bool need_flush;
 
-    if (size < sizeof(lastlog.buffer)) {
-        if (memcmp(lastlog.buffer + lastlog.offset, msg + prefixlen, size-prefixlen) == 0) {
-            ++lastlog.count;
+    if (lb == NULL) {
+        /* Failed to allocate a buffer for this thread. Messages at
+         * output_level have already been sent to stderr. */
+        return;
+    }
+
+    cb_mutex_enter(&lb->mutex);
+
+    if (size < sizeof(lb->lastlog.buffer)) {
+        if (memcmp(lb->lastlog.buffer + lb->lastlog.offset,
+                   msg + prefixlen, size - prefixlen) == 0) {
+            ++lb->lastlog.count;
         } else {
-            flush_last_log(false);
-            do_add_log_entry(msg, size);
-            memcpy(lastlog.buffer, msg, size);
-            lastlog.offset = prefixlen;
-            lastlog.created = now;
+            flush_last_log(lb);
+            do_add_log_entry(lb, msg, size);
+            memcpy(lb->lastlog.buffer, msg, size);
+            lb->lastlog.offset = prefixlen;
+            lb->lastlog.created = now;
         }
     } else {
-        flush_last_log(false);
-        do_add_log_entry(msg, size);
+        flush_last_log(lb);
+        do_add_log_entry(lb, msg, size);
     }
 
-    cb_mutex_exit(&mutex);
+    need_flush = lb->offset > (lb->capacity * 0.75);
+    cb_mutex_exit(&lb->mutex);
+
+    if (need_flush) {
+        /* we're getting full.. time get the logger to start doing stuff! */
+        cb_mutex_enter(&mutex);
+        cb_cond_signal(&cond);
+        cb_mutex_exit(&mutex);
+    }
 }
 
 static const char *severity2string(EXTENSION_LOG_LEVEL sev) {
@@ -439,48 +542,163 @@ static FILE *rotate_logfile(FILE *old, const char *fnm) {
     return new_log;
 }
 
-static size_t flush_pending_io(FILE *file, struct logbuffer *lb) {
+static size_t write_to_file(FILE *file, const char *ptr, size_t size) {
+    size_t towrite = size;
+    while (towrite > 0) {
+        auto nw = fwrite(ptr, 1, towrite, file);
+        if (nw > 0) {
+            ptr += nw;
+            towrite -= nw;
+        }
+    }
+    return size;
+}
+
+/**
+ * Drain a single thread buffer to the file.
+ *
+ * The buffer is swapped with the flusher's scratch buffer so that the
+ * file IO is performed without holding the thread's lock. The buffers
+ * may differ in size if the logger has been re-initialized with a new
+ * buffersize (only happens in the unit tests); in that rare case the
+ * write is performed while holding the lock instead.
+ *
+ * @param file the file to write to (may be NULL, see below)
+ * @param lb the thread buffer to drain
+ * @param now the current time (used for flushing of the dedupe log)
+ * @param final set to true to flush the dedupe log unconditionally
+ *              (used on shutdown)
+ * @param freeable set to true if the buffer is retired and fully
+ *                 drained so that the caller may release it
+ * @return the number of bytes written to the file
+ */
+static size_t drain_thread_buffer(FILE *file, struct thread_logbuffer *lb,
+                                  time_t now, bool final, bool *freeable) {
     size_t ret = 0;
+    size_t size = 0;
+    uint32_t dropped;
+    bool swapped = false;
+
+    cb_mutex_enter(&lb->mutex);
+
+    // Only run dedupe for ~5 seconds (or unconditionally when the
+    // buffer is going away)
+    if (lb->lastlog.count > 0 &&
+        (final || lb->retired || (lb->lastlog.created + 4 < now))) {
+        flush_last_log(lb);
+    }
+
     if (lb->offset > 0) {
-        if (file) {
-            char *ptr = lb->data;
-            size_t towrite = ret = lb->offset;
-            while (towrite > 0) {
-                auto nw = fwrite(ptr, 1, towrite, file);
-                if (nw > 0) {
-                    ptr += nw;
-                    towrite -= nw;
-                }
-            }
-            lb->offset = 0;
-            fflush(file);
-        } else {
+        if (file == NULL) {
             // Cannot write as have no FD, however we also don't want
             // to leave the logbuffer as-is as that would result in it
-            // filling up and producers being deadlocked. Therefore
+            // filling up and producers dropping everything. Therefore
             // discard the logbuffer contents.
             // Note that any message at output_level is always logged
             // to stderr (for babysitter) so those messages will not
             // be lost.
             lb->offset = 0;
+        } else if (lb->capacity == drain_capacity) {
+            char *tmp = lb->data;
+            lb->data = drain_buffer;
+            drain_buffer = tmp;
+            size = lb->offset;
+            lb->offset = 0;
+            swapped = true;
+        } else {
+            ret = write_to_file(file, lb->data, lb->offset);
+            lb->offset = 0;
         }
     }
+    dropped = lb->dropped;
+    lb->dropped = 0;
+    *freeable = lb->retired && lb->offset == 0 && lb->lastlog.count <= 1;
 
-    return ret;
-}
+    /* Let the owner continue if it ran out of space */
+    cb_cond_broadcast(&lb->space_cond);
+    cb_mutex_exit(&lb->mutex);
+
+    if (swapped) {
+        ret = write_to_file(file, drain_buffer, size);
+    }
 
-static void flush_all_buffers_to_file(FILE *file) {
-    while (buffers[currbuffer].offset) {
-        int curr  = currbuffer;
-        currbuffer = (currbuffer == 0) ? 1 : 0;
-        flush_pending_io(file, buffers + curr);
+    if (dropped > 0 && file != NULL) {
+        struct timeval tv;
+        cb_get_timeofday(&tv);
+        char log_entry[512];
+        char msg[128];
+        snprintf(msg, sizeof(msg),
+                 "Dropped %u log messages (buffer full)\n", dropped);
+        format_log_entry(log_entry, sizeof(log_entry), tv.tv_sec, tv.tv_usec,
+                         EXTENSION_LOG_WARNING, msg);
+        ret += write_to_file(file, log_entry, strlen(log_entry));
     }
+
+    if (ret > 0) {
+        fflush(file);
+    }
+
+    return ret;
 }
 
 static volatile int run = 1;
 static cb_thread_t tid;
 static FILE *fp;
 
+/**
+ * Drain all of the thread buffers (rotating the logfile as the
+ * cyclesize is reached) and release the buffers whose owner thread is
+ * gone. Called from the flusher thread without any locks held.
+ *
+ * @param now the current time
+ * @param final set to true to flush the dedupe logs unconditionally
+ * @param fnm the basename for the logfile (used for rotation)
+ * @param currsize the number of bytes written to the current logfile
+ */
+static void drain_all_buffers(time_t now, bool final, const char *fnm,
+                              size_t *currsize) {
+    std::vector<struct thread_logbuffer *> snapshot;
+    std::vector<struct thread_logbuffer *> freelist;
+
+    cb_mutex_enter(&mutex);
+    snapshot = buffers;
+    cb_mutex_exit(&mutex);
+
+    for (auto *lb : snapshot) {
+        bool freeable = false;
+        *currsize += drain_thread_buffer(fp, lb, now, final, &freeable);
+        if (freeable) {
+            freelist.push_back(lb);
+        }
+        if (*currsize > cyclesz) {
+            fp = rotate_logfile(fp, fnm);
+            *currsize = 0;
+        }
+    }
+
+    if (!freelist.empty()) {
+        cb_mutex_enter(&mutex);
+        for (auto *lb : freelist) {
+            for (auto iter = buffers.begin(); iter != buffers.end(); ++iter) {
+                if (*iter == lb) {
+                    buffers.erase(iter);
+                    break;
+                }
+            }
+        }
+        cb_mutex_exit(&mutex);
+
+        /* The owner thread is gone and the buffer is unregistered, so
+         * no one else can touch it anymore */
+        for (auto *lb : freelist) {
+            cb_mutex_destroy(&lb->mutex);
+            cb_cond_destroy(&lb->space_cond);
+            cb_free(lb->data);
+            cb_free(lb);
+        }
+    }
+}
+
 static void logger_thread_main(void* arg)
 {
     size_t currsize = 0;
@@ -491,21 +709,14 @@ static void logger_thread_main(void* arg)
 
     cb_mutex_enter(&mutex);
     while (run) {
+        cb_mutex_exit(&mutex);
         cb_get_timeofday(&tp);
 
-        while ((time_t)tp.tv_sec >= next  ||
-               buffers[currbuffer].offset > (buffersz * 0.75)) {
-            int curr  = currbuffer;
-            next = (time_t)tp.tv_sec + 1;
-            currbuffer = (currbuffer == 0) ? 1 : 0;
-            /* Let people who is blocked for space continue */
-            cb_cond_broadcast(&space_cond);
-
-            /* Perform file IO without the lock */
-            cb_mutex_exit(&mutex);
+        if ((time_t)tp.tv_sec >= next) {
+            next = (time_t)tp.tv_sec + (time_t)sleeptime;
 
-            /* In case we failed to open the log file last time (e.g. EMFILE),
-               re-attempt now. */
+            /* In case we failed to open the log file last time
+               (e.g. EMFILE), re-attempt now. */
             if (fp == NULL) {
                 fp = open_logfile(reinterpret_cast<const char*>(arg));
                 if (fp != NULL) {
@@ -523,45 +734,55 @@ static void logger_thread_main(void* arg)
                     (void)fwrite(log_entry, sizeof(char), strlen(log_entry), stderr);
                 }
             }
-
-            currsize += flush_pending_io(fp, buffers + curr);
-            if (currsize > cyclesz) {
-                fp = rotate_logfile(fp, reinterpret_cast<const char*>(arg));
-                currsize = 0;
-            }
-            cb_mutex_enter(&mutex);
-        }
-
-        // Only run dedupe for ~5 seconds
-        if (lastlog.count > 0 && (lastlog.created + 4 < tp.tv_sec)) {
-            flush_last_log(true);
         }
 
-        cb_get_timeofday(&tp);
-        next = (time_t)tp.tv_sec + (time_t)sleeptime;
+        drain_all_buffers(tp.tv_sec, false,
+                          reinterpret_cast<const char*>(arg), &currsize);
 
-        if (unit_test) {
-            cb_cond_timedwait(&cond, &mutex, 100);
-        } else {
-            cb_cond_timedwait(&cond, &mutex, (unsigned int)(1000 * sleeptime));
+        cb_mutex_enter(&mutex);
+        if (run) {
+            if (unit_test) {
+                cb_cond_timedwait(&cond, &mutex, 100);
+            } else {
+                cb_cond_timedwait(&cond, &mutex, (unsigned int)(1000 * sleeptime));
+            }
         }
     }
+    cb_mutex_exit(&mutex);
 
     /* The log file might not be open, however we may have
-     * an event in the buffer that needs flushing to a file.
+     * events in the buffers that need flushing to a file.
      */
-    if (buffers[currbuffer].offset != 0 && !fp) {
-        fp = open_logfile(reinterpret_cast<const char*>(arg));
+    if (fp == NULL) {
+        bool pending = false;
+        std::vector<struct thread_logbuffer *> snapshot;
+        cb_mutex_enter(&mutex);
+        snapshot = buffers;
+        cb_mutex_exit(&mutex);
+        /* Don't take a thread buffer lock while holding the global
+         * mutex; the producers take them in the opposite order */
+        for (auto *lb : snapshot) {
+            cb_mutex_enter(&lb->mutex);
+            if (lb->offset > 0 || lb->lastlog.count > 1 || lb->dropped > 0) {
+                pending = true;
+            }
+            cb_mutex_exit(&lb->mutex);
+        }
+        if (pending) {
+            fp = open_logfile(reinterpret_cast<const char*>(arg));
+        }
     }
     if (fp) {
-        flush_all_buffers_to_file(fp);
+        cb_get_timeofday(&tp);
+        drain_all_buffers(tp.tv_sec, true,
+                          reinterpret_cast<const char*>(arg), &currsize);
         close_logfile(fp);
+        fp = NULL;
     }
 
-    cb_mutex_exit(&mutex);
     cb_free(arg);
-    cb_free(buffers[0].data);
-    cb_free(buffers[1].data);
+    cb_free(drain_buffer);
+    drain_buffer = NULL;
 }
 
 static void exit_handler(void) {
@@ -598,7 +819,12 @@ static void logger_shutdown(bool force) {
         // Don't bother attempting to take any mutexes - other threads may
         // never run again. Just flush the buffers asap.
         if (fp) {
-            flush_all_buffers_to_file(fp);
+            for (auto *lb : buffers) {
+                if (lb->offset > 0) {
+                    write_to_file(fp, lb->data, lb->offset);
+                    lb->offset = 0;
+                }
+            }
             close_logfile(fp);
             fp = NULL;
         }
@@ -607,7 +833,6 @@ static void logger_shutdown(bool force) {
 
     int running;
     cb_mutex_enter(&mutex);
-    flush_last_log(false);
     running = run;
     run = 0;
     cb_cond_signal(&cond);
@@ -628,16 +853,11 @@ EXTENSION_ERROR_CODE memcached_extensions_initialize(const char *config,
      */
     run = 1;
     fp = nullptr;
-    lastlog.buffer[0] = '\0';
-    lastlog.count = 0;
-    lastlog.offset = 0;
-    lastlog.created = 0;
 
     char *fname = NULL;
 
     cb_mutex_initialize(&mutex);
     cb_cond_initialize(&cond);
-    cb_cond_initialize(&space_cond);
 
     descriptor.get_name = get_name;
     descriptor.log = logger_log_wrapper;
@@ -725,25 +945,38 @@ EXTENSION_ERROR_CODE memcached_extensions_initialize(const char *config,
         fname = cb_strdup("memcached");
     }
 
-    buffers[0].data = reinterpret_cast<char*>(cb_malloc(buffersz));
-    buffers[1].data = reinterpret_cast<char*>(cb_malloc(buffersz));
+    drain_buffer = reinterpret_cast<char*>(cb_malloc(buffersz));
+    drain_capacity = buffersz;
 
-    if (buffers[0].data == NULL || buffers[1].data == NULL || fname == NULL) {
+    if (drain_buffer == NULL || fname == NULL) {
         fprintf(stderr, "Failed to allocate memory for the logger\n");
         cb_free(fname);
-        cb_free(buffers[0].data);
-        cb_free(buffers[1].data);
+        cb_free(drain_buffer);
+        drain_buffer = NULL;
         return EXTENSION_FATAL;
     }
 
+    /* memcached_logger_test invokes memcached_extensions_initialize for
+     * each test, and the calling thread keeps its logbuffer across the
+     * runs. Reset the dedupe state so it doesn't leak between runs. */
+    struct thread_logbuffer *lb = get_thread_logbuffer();
+    if (lb != NULL) {
+        cb_mutex_enter(&lb->mutex);
+        lb->lastlog.buffer[0] = '\0';
+        lb->lastlog.count = 0;
+        lb->lastlog.offset = 0;
+        lb->lastlog.created = 0;
+        cb_mutex_exit(&lb->mutex);
+    }
+
     next_file_id = find_first_logfile_id(fname);
 
     if (cb_create_named_thread(&tid, logger_thread_main, fname, 0,
                                "mc:file_logger") < 0) {
         fprintf(stderr, "Failed to initialize the logger\n");
         cb_free(fname);
-        cb_free(buffers[0].data);
-        cb_free(buffers[1].data);
+        cb_free(drain_buffer);
+        drain_buffer = NULL;
         return EXTENSION_FATAL;
     }
     atexit(exit_handler);
@@ -0,0 +1,67 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cbcrypto/visibility.h>
+
+#include <cstddef>
+#include <string>
+
+namespace cb {
+namespace codec {
+
+/**
+ * Base64 codec (RFC 4648, padded, no line breaks) with SIMD kernels
+ * used for the bulk of the data when the CPU supports them (selected
+ * once at runtime); the head/tail and any malformed input go through
+ * the scalar path. SCRAM runs these on every authentication exchange,
+ * which is why they're hand-tuned.
+ */
+CBCRYPTO_PUBLIC_API
+std::string base64Encode(const std::string& source);
+
+/**
+ * Decode a base64 encoded string
+ *
+ * @throws std::invalid_argument if the input is not valid base64
+ */
+CBCRYPTO_PUBLIC_API
+std::string base64Decode(const std::string& source);
+
+/**
+ * Hex encode a blob of data (lowercase, table driven - the stringstream
+ * way of doing this costs more than the hash being printed).
+ */
+CBCRYPTO_PUBLIC_API
+std::string hexEncode(const void* data, size_t size);
+
+/**
+ * Is a SIMD base64 kernel available on this CPU?
+ */
+CBCRYPTO_PUBLIC_API
+bool isBase64SimdAvailable();
+
+/**
+ * Turn the SIMD base64 kernels off (or back on). Only intended for the
+ * unit tests, which use it to compare the scalar and vector paths on
+ * the same input.
+ */
+CBCRYPTO_PUBLIC_API
+void setBase64SimdEnabled(bool enabled);
+
+} // namespace codec
+} // namespace cb
@@ -50,6 +50,17 @@ namespace Greenstack {
          */
         static FlexHeader create(Reader& reader);
 
+        /**
+         * Create a flex header from the next <code>nbytes</code> bytes of
+         * the requested stream. Unlike the variant above this decodes the
+         * header in place from a frame without requiring the caller to
+         * copy the header bytes out to a separate buffer first.
+         *
+         * @param reader where to read the data from
+         * @param nbytes the number of bytes the encoded header occupies
+         */
+        static FlexHeader create(Reader& reader, size_t nbytes);
+
         /**
          * Is this header empty or not
          */
@@ -116,6 +127,8 @@ namespace Greenstack {
 
         void insertField(uint16_t opcode, const uint8_t* value, size_t length);
 
+        void insertField(uint16_t opcode, std::vector<uint8_t>&& value);
+
         std::map<uint16_t, std::vector<uint8_t> > header;
     };
 }
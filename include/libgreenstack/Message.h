@@ -143,6 +143,14 @@ namespace Greenstack {
          */
         void setPayload(std::vector<uint8_t>& data);
 
+        /**
+         * Set the payload for the message by taking over the provided
+         * buffer, avoiding a copy of the data.
+         *
+         * @param data the payload to move into the message
+         */
+        void setPayload(std::vector<uint8_t>&& data);
+
         /**
          * Encode the content of this Request into the provided
          * vector at the given offset. Encode may call resize() in
@@ -25,5 +25,45 @@
 namespace Couchbase {
     namespace MCBP {
         void dump(const uint8_t* packet, std::ostream &out);
+
+        /**
+         * A dumper which may be fed data incrementally (for instance
+         * while walking a packet capture) rather than one complete
+         * frame at a time.
+         *
+         * Each time a complete frame has been received it is dumped to
+         * the output stream; a trailing partial frame is stashed away
+         * until the rest of it arrives. The data does not have to be
+         * fed on frame boundaries, so a capture file may be processed
+         * in fixed size chunks without being loaded into memory first.
+         */
+        class StreamingDumper {
+        public:
+            StreamingDumper(std::ostream& stream)
+                : out(stream) {
+            }
+
+            /**
+             * Feed the next chunk of data to the dumper
+             *
+             * @param data pointer to the first byte in the chunk
+             * @param nbytes the number of bytes in the chunk
+             * @throws std::invalid_argument if the stream contains a
+             *         frame with an invalid magic
+             */
+            void feed(const uint8_t* data, size_t nbytes);
+
+            /**
+             * Get the number of bytes stashed away waiting for the
+             * remainder of a partial frame
+             */
+            size_t remaining() const {
+                return stash.size();
+            }
+
+        private:
+            std::ostream& out;
+            std::vector<uint8_t> stash;
+        };
     }
 }
@@ -113,6 +113,23 @@ AUDIT_ERROR_CODE put_audit_event(Audit* handle,
                                  const void* payload,
                                  const size_t length);
 
+/**
+ * Check if the given event is currently put into the audit trail
+ *
+ * This is a cheap, lock-free check against a precompiled filter which
+ * is rebuilt every time the audit daemon is (re)configured, allowing
+ * the caller to skip building the event payload for events which
+ * would be thrown away anyway. The filter is advisory; an event put
+ * into the audit trail is still subject to the authoritative
+ * filtering performed by the audit daemon itself.
+ *
+ * @param handle the audit daemon handle (may be nullptr)
+ * @param id the event id to check
+ * @return true if the event should be built and submitted
+ */
+MEMCACHED_PUBLIC_API
+bool audit_event_enabled(Audit* handle, const uint32_t id);
+
 /**
  * Shut down the audit daemon
  *
@@ -193,6 +193,139 @@ extern "C" {
         feature_info features[1];
     } engine_info;
 
+    /**
+     * One entry of a bulk item operation (see allocate_bulk / store_bulk).
+     *
+     * The key/nbytes/flags/exptime/datatype members describe the item to
+     * create for allocate_bulk; item is filled out by allocate_bulk and
+     * consumed by store_bulk, which fills out cas. Each entry carries its
+     * own status so one failing entry doesn't abort the batch.
+     */
+    typedef struct item_batch_entry {
+        const void* key;
+        size_t nkey;
+        size_t nbytes;
+        int flags;
+        rel_time_t exptime;
+        uint8_t datatype;
+        item* item;
+        uint64_t cas;
+        ENGINE_ERROR_CODE status;
+    } item_batch_entry;
+
+    /**
+     * One entry of a batched lookup (see get_multi). key/nkey describe
+     * the document to look up; item and status are filled out by the
+     * engine. Each entry carries its own status so one miss doesn't
+     * abort the batch.
+     */
+    typedef struct item_get_entry {
+        const void* key;
+        size_t nkey;
+        item* item;
+        ENGINE_ERROR_CODE status;
+    } item_get_entry;
+
+    /**
+     * One entry of a batched delete (see remove_multi). key/nkey
+     * describe the document to delete; cas may carry a compare-and-
+     * swap value (0 deletes unconditionally). status is filled out by
+     * the engine; each entry carries its own so one missing key
+     * doesn't abort the batch.
+     */
+    typedef struct item_remove_entry {
+        const void* key;
+        size_t nkey;
+        uint64_t cas;
+        ENGINE_ERROR_CODE status;
+    } item_remove_entry;
+
+    /**
+     * One entry of a batched existence probe (see exists_multi).
+     * key/nkey describe the document to look for. status is filled
+     * out by the engine (ENGINE_SUCCESS or ENGINE_KEY_ENOENT) along
+     * with cas for the hits; each entry carries its own status so one
+     * missing key doesn't abort the batch.
+     */
+    typedef struct item_exist_entry {
+        const void* key;
+        size_t nkey;
+        uint64_t cas;
+        ENGINE_ERROR_CODE status;
+    } item_exist_entry;
+
+    /**
+     * A document fetched from an external store by a tier fetch
+     * callback (see engine_tier_config). The callback allocates the
+     * value bytes with cb_malloc; ownership passes to the engine,
+     * which frees them once the document has been admitted.
+     */
+    typedef struct engine_tier_item {
+        void* data;
+        size_t ndata;
+        uint32_t flags;
+        /** seconds until the admitted copy expires (0 = never) */
+        uint32_t ttl;
+        uint8_t datatype;
+    } engine_tier_item;
+
+    /**
+     * Fetch a missing document from the external store. Runs on the
+     * engine's tier thread, never on a frontend worker, so it may
+     * block on I/O.
+     *
+     * @param ctx the context pointer from engine_tier_config
+     * @param key the key which missed
+     * @param nkey the length of the key
+     * @param item receives the fetched document on success
+     * @return ENGINE_SUCCESS if the document was fetched,
+     *         ENGINE_KEY_ENOENT if the external store doesn't have it
+     *         either, or any other code for a failure (surfaced to
+     *         the waiting client as a temporary failure)
+     */
+    typedef ENGINE_ERROR_CODE (*ENGINE_TIER_FETCH_CALLBACK)(
+        void* ctx,
+        const void* key,
+        size_t nkey,
+        engine_tier_item* item);
+
+    /**
+     * Write a document evicted from memory back to the external
+     * store. Runs on the engine's tier thread with a private copy of
+     * the document, so it may block on I/O; the pointers are only
+     * valid for the duration of the call.
+     *
+     * @param ctx the context pointer from engine_tier_config
+     * @param key the evicted key
+     * @param nkey the length of the key
+     * @param data the value bytes
+     * @param ndata the number of value bytes
+     * @param flags the opaque client flags, as stored
+     * @param ttl seconds the document had left to live (0 = no expiry)
+     * @param datatype the document's datatype
+     */
+    typedef void (*ENGINE_TIER_EVICT_CALLBACK)(void* ctx,
+                                               const void* key,
+                                               size_t nkey,
+                                               const void* data,
+                                               size_t ndata,
+                                               uint32_t flags,
+                                               uint32_t ttl,
+                                               uint8_t datatype);
+
+    /**
+     * External-store hooks for a tiered deployment (see
+     * set_tier_config). Either callback may be NULL to use only half
+     * of the machinery (read-through without write-behind, or the
+     * other way around).
+     */
+    typedef struct engine_tier_config {
+        ENGINE_TIER_FETCH_CALLBACK fetch;
+        ENGINE_TIER_EVICT_CALLBACK evict;
+        /** passed verbatim as the first argument of both callbacks */
+        void* ctx;
+    } engine_tier_config;
+
     /**
      * Definition of the first version of the engine interface
      */
@@ -585,6 +718,256 @@ extern "C" {
          * @param level the current log level
          */
         void (*set_log_level)(ENGINE_HANDLE* handle, EXTENSION_LOG_LEVEL level);
+
+        /**
+         * Optional batched variant of allocate. May be NULL, in which
+         * case the core falls back to calling allocate per item; engines
+         * implementing it can amortize internal locking over the batch.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param entries the batch; each entry's item and status is
+         *                filled out
+         * @param count number of entries in the batch
+         * @return ENGINE_SUCCESS if the batch was processed (individual
+         *         entries may still have failed; check their status)
+         */
+        ENGINE_ERROR_CODE (*allocate_bulk)(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           item_batch_entry* entries,
+                                           size_t count);
+
+        /**
+         * Optional batched variant of store, with the same fallback
+         * contract as allocate_bulk. Every entry is stored with the same
+         * operation against the same vbucket; per-entry results are
+         * written to the entries' cas and status members.
+         */
+        ENGINE_ERROR_CODE (*store_bulk)(ENGINE_HANDLE* handle,
+                                        const void* cookie,
+                                        item_batch_entry* entries,
+                                        size_t count,
+                                        ENGINE_STORE_OPERATION operation,
+                                        uint16_t vbucket);
+
+        /**
+         * Optional in-place append/prepend to an existing document.
+         * May be NULL, and may return ENGINE_ENOTSUP for documents the
+         * engine cannot extend in place; in both cases the core falls
+         * back to the classic fetch + copy into a combined document +
+         * CAS store sequence. Engines which can extend a value without
+         * copying it make the operation O(bytes added) instead of
+         * O(document size).
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param key the key of the document to extend
+         * @param nkey the length of the key
+         * @param data the bytes to add
+         * @param ndata the number of bytes to add
+         * @param cas IN: expected cas (0 means any),
+         *            OUT: the document's new cas on success
+         * @param prepend if true, add the bytes in front of the value
+         *                instead of after it
+         * @param vbucket the virtual bucket id
+         * @return ENGINE_SUCCESS if the document was extended,
+         *         ENGINE_KEY_ENOENT if it doesn't exist,
+         *         ENGINE_KEY_EEXISTS on cas mismatch or
+         *         ENGINE_ENOTSUP to make the core fall back
+         */
+        ENGINE_ERROR_CODE (*append)(ENGINE_HANDLE* handle,
+                                    const void* cookie,
+                                    const void* key,
+                                    const size_t nkey,
+                                    const void* data,
+                                    const size_t ndata,
+                                    uint64_t* cas,
+                                    bool prepend,
+                                    uint16_t vbucket);
+
+        /**
+         * Optional batched variant of get. May be NULL, in which case
+         * the core calls get once per key; engines implementing it can
+         * hash the whole batch up front, prefetch the hash buckets and
+         * amortize internal locking over the batch.
+         *
+         * The call must resolve the batch synchronously: a return value
+         * other than ENGINE_SUCCESS (including ENGINE_EWOULDBLOCK)
+         * makes the core fall back to per-key get for every entry, with
+         * no entry resolved. On ENGINE_SUCCESS each entry carries its
+         * own status (ENGINE_SUCCESS with a referenced item, or
+         * ENGINE_KEY_ENOENT) and the caller owns the returned item
+         * references.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param entries the batch; each entry's item and status is
+         *                filled out
+         * @param count number of entries in the batch
+         * @param vbucket the virtual bucket id (all entries are looked
+         *                up in the same vbucket)
+         * @return ENGINE_SUCCESS if the batch was processed
+         */
+        ENGINE_ERROR_CODE (*get_multi)(ENGINE_HANDLE* handle,
+                                       const void* cookie,
+                                       item_get_entry* entries,
+                                       size_t count,
+                                       uint16_t vbucket);
+
+        /**
+         * Optional batched delete; may be NULL. Engines implementing
+         * it can amortize internal locking over the batch instead of
+         * paying it once per key (mass invalidation deletes keys by
+         * the thousands).
+         *
+         * The call must resolve the whole batch synchronously: a
+         * return value other than ENGINE_SUCCESS (including
+         * ENGINE_EWOULDBLOCK) means no entry was processed. On
+         * ENGINE_SUCCESS each entry carries its own status:
+         * ENGINE_SUCCESS, ENGINE_KEY_ENOENT, or ENGINE_KEY_EEXISTS
+         * for a CAS mismatch.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param entries the batch; each entry's status is filled out
+         * @param count number of entries in the batch
+         * @param vbucket the virtual bucket id (all entries are
+         *                deleted from the same vbucket)
+         * @return ENGINE_SUCCESS if the batch was processed
+         */
+        ENGINE_ERROR_CODE (*remove_multi)(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          item_remove_entry* entries,
+                                          size_t count,
+                                          uint16_t vbucket);
+
+        /**
+         * Optional optimistic read: copy a document's value and metadata
+         * into a caller-supplied buffer without pinning the item (no
+         * reference is handed out, so no release is needed). Must
+         * resolve synchronously. Engines which can't serve the request
+         * lock-free (or at all) return a non-success code and the core
+         * falls back to get(); because of that this call must never
+         * return ENGINE_KEY_ENOENT - a lock-free walk that doesn't find
+         * the key is not an authoritative miss. May be NULL.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param key the key to look up
+         * @param nkey the length of the key
+         * @param buffer where to copy the value
+         * @param buffsize the size of the buffer
+         * @param info receives the item metadata; value[0] is pointed
+         *             at the caller's buffer
+         * @param vbucket the virtual bucket id
+         * @return ENGINE_SUCCESS if the copy is complete and consistent
+         */
+        ENGINE_ERROR_CODE (*get_copy)(ENGINE_HANDLE* handle,
+                                      const void* cookie,
+                                      const void* key,
+                                      size_t nkey,
+                                      void* buffer,
+                                      size_t buffsize,
+                                      item_info* info,
+                                      uint16_t vbucket);
+
+        /**
+         * Optional: set an advisory resident-memory target for the
+         * engine (in bytes; 0 removes the target). While the engine's
+         * resident memory exceeds the target it should consolidate and
+         * release idle memory to the OS in the background; unlike a
+         * lower mem_limit nothing is evicted to get there. May be NULL
+         * for engines without such a mechanism.
+         *
+         * @param handle the engine handle
+         * @param target the resident-memory target in bytes
+         * @return ENGINE_SUCCESS if the target was accepted
+         */
+        ENGINE_ERROR_CODE (*set_memory_target)(ENGINE_HANDLE* handle,
+                                               size_t target);
+
+        /**
+         * Optional batched existence probe: resolve hit or miss (and
+         * the CAS of the hits) for a batch of keys without
+         * materializing any values or handing out references. The
+         * call must resolve the whole batch synchronously: a return
+         * value other than ENGINE_SUCCESS (including
+         * ENGINE_EWOULDBLOCK) means no entry was processed. On
+         * ENGINE_SUCCESS each entry carries its own status:
+         * ENGINE_SUCCESS with the cas field filled out, or
+         * ENGINE_KEY_ENOENT. May be NULL, in which case the core
+         * falls back to get()/release() per key.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param entries the batch; status and cas are filled out
+         * @param count number of entries in the batch
+         * @param vbucket the virtual bucket id (all entries address
+         *                the same vbucket)
+         * @return ENGINE_SUCCESS if the batch was processed
+         */
+        ENGINE_ERROR_CODE (*exists_multi)(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          item_exist_entry* entries,
+                                          size_t count,
+                                          uint16_t vbucket);
+
+        /**
+         * Optional in-place byte-range patch of an existing document.
+         * Overwrites ndata bytes of the value starting at offset; the
+         * patch must lie entirely within the current value (a patch
+         * never changes the document's size). May be NULL, and may
+         * return ENGINE_ENOTSUP for documents the engine cannot patch
+         * in place; in both cases the core falls back to the classic
+         * fetch + copy + CAS store sequence. Engines which can write
+         * into the stored value make the operation O(bytes patched)
+         * instead of O(document size).
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param key the key of the document to patch
+         * @param nkey the length of the key
+         * @param data the replacement bytes
+         * @param ndata the number of bytes to overwrite
+         * @param offset byte offset into the value to patch at
+         * @param cas IN: expected cas (0 means any),
+         *            OUT: the document's new cas on success
+         * @param vbucket the virtual bucket id
+         * @return ENGINE_SUCCESS if the document was patched,
+         *         ENGINE_KEY_ENOENT if it doesn't exist,
+         *         ENGINE_KEY_EEXISTS on cas mismatch,
+         *         ENGINE_ERANGE if the range falls outside the value
+         *         or ENGINE_ENOTSUP to make the core fall back
+         */
+        ENGINE_ERROR_CODE (*patch)(ENGINE_HANDLE* handle,
+                                   const void* cookie,
+                                   const void* key,
+                                   const size_t nkey,
+                                   const void* data,
+                                   const size_t ndata,
+                                   uint32_t offset,
+                                   uint64_t* cas,
+                                   uint16_t vbucket);
+
+        /**
+         * Optional: register external-store hooks, turning the engine
+         * into the memory tier of a tiered cache. Once a fetch
+         * callback is registered a miss in get() may return
+         * ENGINE_EWOULDBLOCK while the engine consults the external
+         * store from a background thread; the connection is woken
+         * back up through notify_io_complete with the outcome. An
+         * evict callback receives a copy of every document evicted
+         * for memory pressure (not expired or deleted ones), so a
+         * slower store behind the cache can be kept warm without
+         * teaching clients any fallback logic. May be NULL for
+         * engines without such a mechanism.
+         *
+         * @param handle the engine handle
+         * @param config the callbacks to install
+         * @return ENGINE_SUCCESS if the hooks were accepted
+         */
+        ENGINE_ERROR_CODE (*set_tier_config)(ENGINE_HANDLE* handle,
+                                             const engine_tier_config* config);
     } ENGINE_HANDLE_V1;
 
     /**
@@ -80,6 +80,9 @@ private:
     /*
      * generatetimestamp makes use of mktime which is not thread-safe
      * and therefore we must protect the mktime call with a mutex.
+     * Only the refill of the per-thread second-granularity format
+     * cache pays for the lock (see isotime.cc); records within the
+     * same second are formatted lock-free.
      */
     static std::mutex mutex;
 };
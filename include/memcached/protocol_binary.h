@@ -136,6 +136,12 @@ extern "C"
          * etc).
          */
         PROTOCOL_BINARY_RESPONSE_ETMPFAIL = 0x86,
+        /** The command sat on the server past the deadline the client
+         * put on it (see PROTOCOL_BINARY_CMD_SET_OP_DEADLINE), so the
+         * server dropped it instead of doing work whose result the
+         * client has already given up on. The operation may or may
+         * not have been performed. */
+        PROTOCOL_BINARY_RESPONSE_DEADLINE_EXCEEDED = 0x87,
 
         /*
          * Sub-document specific responses.
@@ -445,6 +451,110 @@ extern "C"
         /* Subdoc additions for Spock: */
         PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT = 0xd2,
 
+        /**
+         * Session resumption. GET_SESSION_TOKEN returns an opaque token
+         * sealing the connection's authenticated state (user, bucket,
+         * negotiated features) under a process-local key. Presenting
+         * the token on a new connection with RESUME_SESSION restores
+         * that state in a single round trip instead of redoing HELLO,
+         * SASL and SELECT_BUCKET.
+         */
+        PROTOCOL_BINARY_CMD_GET_SESSION_TOKEN = 0xd8,
+        PROTOCOL_BINARY_CMD_RESUME_SESSION = 0xd9,
+
+        /**
+         * Planned-failover handoff: an administrator may submit a plain
+         * JSON state description (user, bucket, features) and receive a
+         * resumption token sealed under this node's key, which a client
+         * can then present via RESUME_SESSION without renegotiating.
+         */
+        PROTOCOL_BINARY_CMD_SEAL_SESSION_TOKEN = 0xda,
+
+        /**
+         * Delete a batch of keys in one command. The request body is a
+         * sequence of entries, each a two byte key length (network
+         * order) followed by the key bytes; all keys address the
+         * vbucket in the header. The response body is the number of
+         * keys actually deleted (four bytes, network order) - keys
+         * which didn't exist are not an error, mass invalidation just
+         * wants them gone.
+         */
+        PROTOCOL_BINARY_CMD_DELETE_MULTI = 0xdb,
+
+        /**
+         * Probe a batch of keys for existence in one command. The
+         * request body uses the same layout as DELETE_MULTI: a
+         * sequence of entries, each a two byte key length (network
+         * order) followed by the key bytes; all keys address the
+         * vbucket in the header. The response body holds nine bytes
+         * per key, in request order: one byte (0 = miss, 1 = hit)
+         * followed by the item's CAS (eight bytes, network order;
+         * zero for a miss). No values are transferred, so a
+         * cache-aside layer can learn existence for thousands of
+         * keys without paying for the documents themselves.
+         */
+        PROTOCOL_BINARY_CMD_EXIST_MULTI = 0xdc,
+
+        /**
+         * Read a fragment of a value. The request carries eight bytes
+         * of extras: the byte offset into the value and the number of
+         * bytes wanted (both four bytes, network order). A length of
+         * zero means "to the end of the value". The response looks
+         * like a GET response (four bytes of flags followed by the
+         * fragment), but only the requested byte range is
+         * transferred, so a client needing just the header region of
+         * a large serialized blob doesn't pay for the whole document.
+         * An offset at or beyond the end of the value fails with
+         * ERANGE; a fragment of a Snappy-compressed value would be
+         * useless, so those fail with NOT_SUPPORTED.
+         */
+        PROTOCOL_BINARY_CMD_GET_RANGE = 0xdd,
+
+        /**
+         * Overwrite a fragment of a value in place. The request
+         * carries four bytes of extras: the byte offset into the
+         * value (network order); the body is the key followed by the
+         * replacement bytes, and the header cas (if non-zero) is the
+         * expected cas. The patched range must lie entirely within
+         * the current value - a patch never grows or shrinks the
+         * document - otherwise the command fails with ERANGE. On
+         * success the response carries the document's new cas, so a
+         * read-modify-write loop over a small region of a large value
+         * becomes one round trip transferring only the delta.
+         */
+        PROTOCOL_BINARY_CMD_SET_RANGE = 0xde,
+
+        /**
+         * Set the operation deadline for the connection. The request
+         * carries four bytes of extras: the deadline in milliseconds
+         * (network order; 0 removes the deadline) and no key or value.
+         * Subsequent commands on the connection which are still
+         * waiting to be dispatched (or to be resumed after blocking
+         * in the engine) when their age exceeds the deadline are
+         * dropped with DEADLINE_EXCEEDED instead of doing work whose
+         * result the client has already timed out on. Advertised by
+         * the "Command deadlines" HELLO feature.
+         */
+        PROTOCOL_BINARY_CMD_SET_OP_DEADLINE = 0xdf,
+
+        /**
+         * Bulk-load a stream of serialized items into the selected
+         * bucket. The request has no extras and no key; the value is
+         * a sequence of records in the engine's snapshot segment
+         * payload format (a fixed record header followed by the key
+         * and data bytes - see engines/default_engine/snapshot.c), so
+         * a new node can be prewarmed by replaying a peer's snapshot
+         * in large chunks instead of one SET per document. Records
+         * are admitted with ADD semantics: a key which already exists
+         * keeps its live value. The response body is two four byte
+         * counters (network order): records loaded and records
+         * skipped (expired, already present or out of memory). A
+         * malformed stream fails with EINVAL; records ahead of the
+         * malformation may already have been admitted. Like the
+         * snapshot file itself the record format is native-endian,
+         * so import only from a same-architecture peer.
+         */
+        PROTOCOL_BINARY_CMD_ITEM_IMPORT = 0xe0,
 
         /* Scrub the data */
         PROTOCOL_BINARY_CMD_SCRUB = 0xf0,
@@ -509,6 +619,9 @@ extern "C"
 #else
     // The old style versions will go away as we move over to C++ everywhere
     #define PROTOCOL_BINARY_RAW_BYTES ((uint8_t)0)
+    #define PROTOCOL_BINARY_DATATYPE_JSON ((uint8_t)1)
+    #define PROTOCOL_BINARY_DATATYPE_COMPRESSED ((uint8_t)2)
+    #define PROTOCOL_BINARY_DATATYPE_XATTR ((uint8_t)4)
 #endif
 
     /**
@@ -852,6 +965,61 @@ extern "C"
      * Definition of the packet returned from the GAT(Q)
      */
     typedef protocol_binary_response_get protocol_binary_response_gat;
+
+    /**
+     * Definition of the packet used by the GET_RANGE command.
+     */
+    typedef union {
+        struct {
+            protocol_binary_request_header header;
+            struct {
+                uint32_t offset;
+                uint32_t length;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_request_header) + 8];
+    } protocol_binary_request_get_range;
+
+    /**
+     * Definition of the packet returned from the GET_RANGE command
+     */
+    typedef protocol_binary_response_get protocol_binary_response_get_range;
+
+    /**
+     * Definition of the packet used by the SET_RANGE command.
+     */
+    typedef union {
+        struct {
+            protocol_binary_request_header header;
+            struct {
+                uint32_t offset;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_request_header) + 4];
+    } protocol_binary_request_set_range;
+
+    /**
+     * Definition of the packet returned from the SET_RANGE command
+     */
+    typedef protocol_binary_response_no_extras protocol_binary_response_set_range;
+
+    /**
+     * Definition of the packet used by the SET_OP_DEADLINE command.
+     */
+    typedef union {
+        struct {
+            protocol_binary_request_header header;
+            struct {
+                uint32_t deadline_ms;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_request_header) + 4];
+    } protocol_binary_request_set_op_deadline;
+
+    /**
+     * Definition of the packet returned from the SET_OP_DEADLINE command
+     */
+    typedef protocol_binary_response_no_extras protocol_binary_response_set_op_deadline;
     typedef protocol_binary_response_get protocol_binary_response_gatq;
 
     /**
@@ -1295,18 +1463,58 @@ extern "C"
         PROTOCOL_BINARY_FEATURE_TLS = 0x2,
         PROTOCOL_BINARY_FEATURE_TCPNODELAY = 0x03,
         PROTOCOL_BINARY_FEATURE_MUTATION_SEQNO = 0x04,
-        PROTOCOL_BINARY_FEATURE_TCPDELAY = 0x05
+        PROTOCOL_BINARY_FEATURE_TCPDELAY = 0x05,
+        /**
+         * The server processes pipelined connection bootstrap commands
+         * (HELLO, SASL_LIST_MECHS, SASL_AUTH, SASL_STEP, SELECT_BUCKET)
+         * back to back from a single read, in order, without requiring
+         * the client to wait for the individual responses. A client
+         * seeing this feature in the HELLO response may send the entire
+         * bootstrap sequence in one write and then read all of the
+         * responses.
+         */
+        PROTOCOL_BINARY_FEATURE_PIPELINED_BOOTSTRAP = 0x06,
+        /**
+         * The server stamps its processing timestamps into the response
+         * extras of sampled commands: two extra 32 bit fields (network
+         * byte order) are prepended to the response extras, holding the
+         * time the command was picked up for processing and the time
+         * the response was queued for transmission, both in
+         * microseconds on the server's monotonic clock (truncated to
+         * 32 bits). A client detects a stamped response by the extras
+         * length exceeding the opcode's normal length by 8 and computes
+         * the server residency as the difference of the two fields,
+         * separating server time from network time in its own
+         * end-to-end latency.
+         */
+        PROTOCOL_BINARY_FEATURE_SERVER_TIMINGS = 0x07,
+        /**
+         * The server understands SET_OP_DEADLINE and drops commands
+         * which are past the deadline the client put on them with
+         * DEADLINE_EXCEEDED (checked before the command is handed to
+         * the engine and again when a blocked command is resumed).
+         * Pure capability advertisement; a client seeing this feature
+         * may set its per-operation timeout on the connection instead
+         * of letting the server finish work it no longer wants.
+         */
+        PROTOCOL_BINARY_FEATURE_OP_DEADLINE = 0x08
     } protocol_binary_hello_features;
 
     #define MEMCACHED_FIRST_HELLO_FEATURE 0x01
-    #define MEMCACHED_TOTAL_HELLO_FEATURES 0x05
+    #define MEMCACHED_TOTAL_HELLO_FEATURES 0x08
 
 #define protocol_feature_2_text(a) \
     (a == PROTOCOL_BINARY_FEATURE_DATATYPE) ? "Datatype" : \
     (a == PROTOCOL_BINARY_FEATURE_TLS) ? "TLS" : \
     (a == PROTOCOL_BINARY_FEATURE_TCPNODELAY) ? "TCP NODELAY" : \
     (a == PROTOCOL_BINARY_FEATURE_MUTATION_SEQNO) ? "Mutation seqno" : \
-    (a == PROTOCOL_BINARY_FEATURE_TCPDELAY) ? "TCP DELAY" : "Unknown"
+    (a == PROTOCOL_BINARY_FEATURE_TCPDELAY) ? "TCP DELAY" : \
+    (a == PROTOCOL_BINARY_FEATURE_PIPELINED_BOOTSTRAP) ? \
+        "Pipelined bootstrap" : \
+    (a == PROTOCOL_BINARY_FEATURE_SERVER_TIMINGS) ? \
+        "Server timings" : \
+    (a == PROTOCOL_BINARY_FEATURE_OP_DEADLINE) ? \
+        "Command deadlines" : "Unknown"
 
     /**
      * The HELLO command is used by the client and the server to agree
@@ -2025,8 +2233,8 @@ extern "C"
      * @}
      */
 #ifdef __cplusplus
-    inline protocol_binary_subdoc_flag operator|(protocol_binary_subdoc_flag a,
-                                                 protocol_binary_subdoc_flag b)
+    constexpr protocol_binary_subdoc_flag operator|(protocol_binary_subdoc_flag a,
+                                                    protocol_binary_subdoc_flag b)
     {
         return protocol_binary_subdoc_flag(static_cast<uint8_t>(a)|
                                            static_cast<uint8_t>(b));
@@ -132,6 +132,24 @@ extern "C" {
         void (*notify_io_complete)(const void *cookie,
                                    ENGINE_ERROR_CODE status);
 
+        /**
+         * Let a batch of connections know that IO has completed.
+         *
+         * This is the bulk variant of notify_io_complete. The cookies
+         * are grouped by the worker thread owning each connection, so
+         * every thread mutex is taken (and every worker woken) at most
+         * once for the whole batch instead of once per cookie. Engines
+         * completing many operations at the same time (a disk fetch or
+         * flush batch) should prefer this call.
+         *
+         * @param cookies array of cookies representing the connections
+         * @param count the number of entries in the array
+         * @param status the status for the io operations
+         */
+        void (*notify_io_complete_batch)(const void* const* cookies,
+                                         size_t count,
+                                         ENGINE_ERROR_CODE status);
+
         /**
          * Notify the core that we're holding on to this cookie for
          * future use. (The core guarantees it will not invalidate the
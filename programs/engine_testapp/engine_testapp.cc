@@ -3,9 +3,12 @@
 
 #include <memcached/engine_testapp.h>
 
+#include <chrono>
+#include <cinttypes>
 #include <cstdlib>
 #include <getopt.h>
 #include <map>
+#include <mutex>
 #include <regex>
 #include <string>
 #include <vector>
@@ -38,6 +41,68 @@ static void alarm_handler(int sig) {
 #endif
 
 
+/*
+ * Perf mode (-P): time every call made through the mock engine wrappers
+ * and print a per-operation cost table when the test is done, so that
+ * engine interface changes can be benchmarked with the same testsuites
+ * used for the functional testing.
+ */
+static bool time_api_calls = false;
+
+struct ApiCallStats {
+    ApiCallStats() : calls(0), total_ns(0), max_ns(0) {}
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+static std::mutex api_call_mutex;
+static std::map<std::string, ApiCallStats> api_call_stats;
+
+/** Measure the wall time of an engine API call (when perf mode is on) */
+class ScopedApiTimer {
+public:
+    ScopedApiTimer(const char* name_) : name(name_) {
+        if (time_api_calls) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedApiTimer() {
+        if (!time_api_calls) {
+            return;
+        }
+        const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> guard(api_call_mutex);
+        ApiCallStats& st = api_call_stats[name];
+        st.calls++;
+        st.total_ns += ns;
+        if (ns > st.max_ns) {
+            st.max_ns = ns;
+        }
+    }
+
+private:
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
+
+static void report_api_call_times(void) {
+    std::lock_guard<std::mutex> guard(api_call_mutex);
+    if (api_call_stats.empty()) {
+        return;
+    }
+    printf("Engine API call cost:\n");
+    printf("  %-16s %10s %12s %12s\n", "operation", "calls", "avg ns", "max ns");
+    for (const auto& entry : api_call_stats) {
+        printf("  %-16s %10" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+               entry.first.c_str(), entry.second.calls,
+               entry.second.total_ns / entry.second.calls,
+               entry.second.max_ns);
+    }
+}
+
 // The handles for the 'current' engine, as used by
 // execute_test. These are global as the testcase may call reload_engine() and that
 // needs to update the pointers the new engine, so when execute_test is
@@ -146,6 +211,7 @@ static ENGINE_ERROR_CODE mock_allocate(ENGINE_HANDLE* handle,
                                        const int flags,
                                        const rel_time_t exptime,
                                        uint8_t datatype) {
+    ScopedApiTimer timer("allocate");
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->allocate,
                                get_engine_from_handle(handle),
@@ -167,6 +233,7 @@ static ENGINE_ERROR_CODE mock_remove(ENGINE_HANDLE* handle,
                                      uint16_t vbucket,
                                      mutation_descr_t* mut_info)
 {
+    ScopedApiTimer timer("remove");
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->remove,
                                get_engine_from_handle(handle),
@@ -183,6 +250,7 @@ static ENGINE_ERROR_CODE mock_remove(ENGINE_HANDLE* handle,
 static void mock_release(ENGINE_HANDLE* handle,
                          const void *cookie,
                          item* item) {
+    ScopedApiTimer timer("release");
     struct mock_engine *me = get_handle(handle);
     me->the_engine->release((ENGINE_HANDLE*)me->the_engine, cookie, item);
 }
@@ -193,6 +261,7 @@ static ENGINE_ERROR_CODE mock_get(ENGINE_HANDLE* handle,
                                   const void* key,
                                   const int nkey,
                                   uint16_t vbucket) {
+    ScopedApiTimer timer("get");
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->get,
                                get_engine_from_handle(handle),
@@ -211,6 +280,7 @@ static ENGINE_ERROR_CODE mock_get_stats(ENGINE_HANDLE* handle,
                                         int nkey,
                                         ADD_STAT add_stat)
 {
+    ScopedApiTimer timer("get_stats");
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->get_stats,
                                get_engine_from_handle(handle),
@@ -229,6 +299,7 @@ static ENGINE_ERROR_CODE mock_store(ENGINE_HANDLE* handle,
                                     uint64_t *cas,
                                     ENGINE_STORE_OPERATION operation,
                                     uint16_t vbucket) {
+    ScopedApiTimer timer("store");
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->store,
                                get_engine_from_handle(handle),
@@ -254,6 +325,7 @@ static ENGINE_ERROR_CODE mock_arithmetic(ENGINE_HANDLE* handle,
                                          uint8_t datatype,
                                          uint64_t *result,
                                          uint16_t vbucket) {
+    ScopedApiTimer timer("arithmetic");
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->arithmetic,
                                get_engine_from_handle(handle),
@@ -270,6 +342,7 @@ static ENGINE_ERROR_CODE mock_arithmetic(ENGINE_HANDLE* handle,
 
 static ENGINE_ERROR_CODE mock_flush(ENGINE_HANDLE* handle,
                                     const void* cookie, time_t when) {
+    ScopedApiTimer timer("flush");
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->flush,
                                get_engine_from_handle(handle),
@@ -292,6 +365,7 @@ static ENGINE_ERROR_CODE mock_unknown_command(ENGINE_HANDLE* handle,
                                               protocol_binary_request_header *request,
                                               ADD_RESPONSE response)
 {
+    ScopedApiTimer timer("unknown_command");
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->unknown_command,
                                get_engine_from_handle(handle),
@@ -307,6 +381,7 @@ static ENGINE_ERROR_CODE mock_unknown_command(ENGINE_HANDLE* handle,
 static void mock_item_set_cas(ENGINE_HANDLE *handle, const void *cookie,
                               item* item, uint64_t val)
 {
+    ScopedApiTimer timer("item_set_cas");
     struct mock_engine *me = get_handle(handle);
     me->the_engine->item_set_cas((ENGINE_HANDLE*)me->the_engine, cookie, item, val);
 }
@@ -315,6 +390,7 @@ static void mock_item_set_cas(ENGINE_HANDLE *handle, const void *cookie,
 static bool mock_get_item_info(ENGINE_HANDLE *handle, const void *cookie,
                                const item* item, item_info *item_info)
 {
+    ScopedApiTimer timer("get_item_info");
     struct mock_engine *me = get_handle(handle);
     return me->the_engine->get_item_info((ENGINE_HANDLE*)me->the_engine,
                                          cookie, item, item_info);
@@ -337,6 +413,7 @@ static ENGINE_ERROR_CODE mock_tap_notify(ENGINE_HANDLE* handle,
                                         const void *data,
                                         size_t ndata,
                                         uint16_t vbucket) {
+    ScopedApiTimer timer("tap_notify");
 
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->tap_notify,
@@ -367,6 +444,7 @@ static TAP_ITERATOR mock_get_tap_iterator(ENGINE_HANDLE* handle, const void* coo
 static ENGINE_ERROR_CODE mock_dcp_step(ENGINE_HANDLE* handle,
                                        const void* cookie,
                                        struct dcp_message_producers *producers) {
+    ScopedApiTimer timer("dcp.step");
     struct mock_engine *me = get_handle(handle);
     return me->the_engine->dcp.step((ENGINE_HANDLE*)me->the_engine, cookie,
                                     producers);
@@ -482,6 +560,7 @@ static ENGINE_ERROR_CODE mock_dcp_mutation(ENGINE_HANDLE* handle,
                                            const void *meta,
                                            uint16_t nmeta,
                                            uint8_t nru) {
+    ScopedApiTimer timer("dcp.mutation");
 
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->dcp.mutation,
@@ -509,6 +588,7 @@ static ENGINE_ERROR_CODE mock_dcp_deletion(ENGINE_HANDLE* handle,
                                            uint64_t revSeqno,
                                            const void *meta,
                                            uint16_t nmeta) {
+    ScopedApiTimer timer("dcp.deletion");
 
     struct mock_connstruct *c = get_or_create_mock_connstruct(cookie);
     auto engine_fn = std::bind(get_engine_v1_from_handle(handle)->dcp.deletion,
@@ -645,6 +725,15 @@ static void usage(void) {
     printf("-v                           verbose output\n");
     printf("-X                           Use stderr logger instead of /dev/zero\n");
     printf("-n                           Regex specifying name(s) of test(s) to run\n");
+    printf("-j <jobs>                    Number of testcases to run in parallel\n");
+    printf("                             (not supported on Windows)\n");
+    printf("-I                           Run the testcases inside this process,\n");
+    printf("                             reusing one engine instance between\n");
+    printf("                             tests where possible (much faster for\n");
+    printf("                             big generated suites, but a crashing\n");
+    printf("                             test takes the whole run with it)\n");
+    printf("-P                           Time each engine API call and print a\n");
+    printf("                             per-operation cost table for every test\n");
 }
 
 static int report_test(const char *name, time_t duration, enum test_result r, bool quiet, bool compact) {
@@ -1020,6 +1109,115 @@ static void clear_test_timeout() {
 #endif
 }
 
+/**
+ * Run every testcase matching the regex inside this process, reusing one
+ * engine instance (and one bucket) across consecutive tests instead of
+ * paying a fork/exec plus an engine create/destroy per test. The bucket
+ * is wiped between tests with the engine's own flush + reset_stats,
+ * which is only a valid substitute for a fresh bucket when the test
+ * doesn't bring its own configuration or prepare/cleanup hooks - tests
+ * which do fall back to the full per-test engine cycle. Crash isolation
+ * is lost (one bad test takes the whole run with it), so this mode is
+ * aimed at huge generated suites like breakdancer where the per-test
+ * setup otherwise dominates the runtime.
+ *
+ * @return the number of failed tests
+ */
+static int execute_tests_in_process(engine_test_t* testcases,
+                                    const std::regex& test_case_regex,
+                                    const char* engine,
+                                    const char* default_cfg,
+                                    int timeout, bool quiet, bool verbose) {
+    int failures = 0;
+    bool engine_running = false;
+
+    init_mock_server(log_to_stderr);
+    if (memcached_initialize_stderr_logger(get_mock_server_api) != EXTENSION_SUCCESS) {
+        fprintf(stderr, "Failed to initialize log system\n");
+        return 1;
+    }
+
+    for (int ii = 0; testcases[ii].name; ii++) {
+        engine_test_t test = testcases[ii];
+        enum test_result ret;
+        time_t start;
+
+        if (!std::regex_search(test.name, test_case_regex)) {
+            continue;
+        }
+
+        /* Only tests without private configuration or prepare/cleanup
+           hooks can be handed a recycled bucket. */
+        const bool reusable = test.tfun != NULL && test.cfg == NULL &&
+                              test.prepare == NULL && test.cleanup == NULL;
+
+        if (!quiet) {
+            printf("Running %s...", test.name);
+            fflush(stdout);
+        }
+
+        start = time(NULL);
+        set_test_timeout(timeout);
+        if (reusable) {
+            if (!engine_running) {
+                if (!start_your_engine(engine)) {
+                    fprintf(stderr, "Failed to start engine %s\n", engine);
+                    return failures + 1;
+                }
+                handle_v1 = create_bucket(true, default_cfg);
+                handle = (ENGINE_HANDLE*)handle_v1;
+                engine_running = true;
+            }
+
+            current_testcase = &testcases[ii];
+            ret = FAIL;
+            if (test.test_setup == NULL || test.test_setup(handle, handle_v1)) {
+                ret = test.tfun(handle, handle_v1);
+                if (test.test_teardown != NULL &&
+                    !test.test_teardown(handle, handle_v1)) {
+                    fprintf(stderr,
+                            "WARNING: Failed to run teardown for test %s\n",
+                            test.name);
+                }
+            }
+
+            /* Wipe the bucket for the next test. A test may have
+               replaced the engine under us via reload_engine(), which
+               updates the globals, so they are authoritative here. */
+            disconnect_all_mock_connections();
+            handle_v1->flush(handle, NULL, 0);
+            handle_v1->reset_stats(handle, NULL);
+        } else {
+            if (engine_running) {
+                destroy_bucket(handle, handle_v1, false);
+                handle = NULL;
+                handle_v1 = NULL;
+                destroy_mock_event_callbacks();
+                stop_your_engine();
+                engine_running = false;
+            }
+            ret = (enum test_result)execute_test(test, engine, default_cfg);
+        }
+        clear_test_timeout();
+
+        if (report_test(test.name, time(NULL) - start, ret, quiet,
+                        !verbose) != 0) {
+            ++failures;
+        }
+    }
+
+    if (engine_running) {
+        destroy_bucket(handle, handle_v1, false);
+        handle = NULL;
+        handle_v1 = NULL;
+        destroy_mock_event_callbacks();
+        stop_your_engine();
+    }
+
+    return failures;
+}
+
+
 /* Spawn a new process, wait for it to exit and return it's exit code.
  * @param argc Number of elements in argv; must be at least 1 (argv[0]
  *             specifies the name of the executable to run).
@@ -1097,6 +1295,110 @@ static int spawn_and_wait(int argc, char* const argv[]) {
 #endif // !WIN32
 }
 
+#ifndef WIN32
+/**
+ * Run the matching testcases as up to 'jobs' concurrent child processes.
+ * Every child creates its own engine instance (that's how the one-test-
+ * per-process model already works), so the tests don't share any state
+ * and can safely run in parallel. Results are reported in completion
+ * order.
+ *
+ * @return the number of failed tests
+ */
+static int run_tests_parallel(engine_test_t* testcases,
+                              const std::regex& test_case_regex,
+                              std::vector<std::string>& child_args,
+                              int argc, int jobs, int attempts,
+                              bool quiet, bool verbose) {
+    struct running_test {
+        int index;
+        int attempt;
+        time_t start;
+    };
+
+    std::vector<int> to_run;
+    for (int ii = 0; testcases[ii].name; ii++) {
+        if (std::regex_search(testcases[ii].name, test_case_regex)) {
+            to_run.push_back(ii);
+        }
+    }
+
+    std::map<pid_t, running_test> running;
+    size_t next = 0;
+    size_t done = 0;
+    int failures = 0;
+
+    auto spawn = [&child_args, &running, &testcases, argc](int index,
+                                                           int attempt) {
+        child_args[argc + 1] = std::to_string(index);
+        std::vector<char*> child_argv(child_args.size() + 1);
+        for (size_t ii = 0; ii < child_args.size(); ii++) {
+            child_argv[ii] = &child_args[ii][0];
+        }
+
+        pid_t pid = fork();
+        cb_assert(pid != -1);
+        if (pid == 0) {
+            /* Child */
+            cb_assert(execvp(child_argv[0], child_argv.data()) != -1);
+        }
+        running_test entry = { index, attempt, time(NULL) };
+        running[pid] = entry;
+    };
+
+    while (next < to_run.size() || !running.empty()) {
+        while (running.size() < size_t(jobs) && next < to_run.size()) {
+            spawn(to_run[next++], 0);
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid == -1) {
+            continue;
+        }
+        std::map<pid_t, running_test>::iterator iter = running.find(pid);
+        if (iter == running.end()) {
+            continue;
+        }
+        running_test finished = iter->second;
+        running.erase(iter);
+
+        enum test_result ecode;
+        if (WIFEXITED(status)) {
+            ecode = (enum test_result)WEXITSTATUS(status);
+#ifdef WCOREDUMP
+        } else if (WIFSIGNALED(status) && WCOREDUMP(status)) {
+            ecode = CORE;
+#endif
+        } else {
+            ecode = DIED;
+        }
+
+        if (ecode != SUCCESS && (finished.attempt + 1) < attempts) {
+            spawn(finished.index, finished.attempt + 1);
+            continue;
+        }
+        if (ecode == SUCCESS && finished.attempt > 0) {
+            ecode = SUCCESS_AFTER_RETRY;
+        }
+
+        ++done;
+        if (!quiet) {
+            printf("Completed [%04zu/%04zu]: %s...",
+                   done, to_run.size(), testcases[finished.index].name);
+            fflush(stdout);
+        }
+        if (report_test(testcases[finished.index].name,
+                        time(NULL) - finished.start,
+                        ecode, quiet, !verbose) != 0) {
+            ++failures;
+        }
+    }
+
+    return failures;
+}
+#endif // !WIN32
+
 static void teardown_testsuite(cb_dlhandle_t handle, const char* test_suite) {
     /* Hack to remove the warning from C99 */
     union {
@@ -1120,6 +1422,8 @@ static void teardown_testsuite(cb_dlhandle_t handle, const char* test_suite) {
 
 int main(int argc, char **argv) {
     int c, exitcode = 0, num_cases = 0, timeout = 0, loop_count = 0;
+    int jobs = 1;
+    bool in_process = false;
     bool verbose = false;
     bool quiet = false;
     bool dot = false;
@@ -1199,6 +1503,9 @@ int main(int argc, char **argv) {
                        "s" /* spinlock the program */
                        "X" /* Use stderr logger */
                        "f:" /* output format. Valid values are: 'text' and 'xml' */
+                       "j:" /* Number of testcases to run in parallel */
+                       "I"  /* Run tests in-process, reusing the engine */
+                       "P" /* Perf mode: time engine API calls */
                        )) != -1) {
         switch (c) {
         case 'a':
@@ -1261,6 +1568,18 @@ int main(int argc, char **argv) {
         case 'X':
             log_to_stderr = true;
             break;
+        case 'j':
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+                jobs = 1;
+            }
+            break;
+        case 'I':
+            in_process = true;
+            break;
+        case 'P':
+            time_api_calls = true;
+            break;
         default:
             fprintf(stderr, "Illegal argument \"%c\"\n", c);
             return 1;
@@ -1363,6 +1682,9 @@ int main(int argc, char **argv) {
         disconnect_all_mock_connections();
         teardown_testsuite(handle, test_suite);
         cb_dlclose(handle);
+        if (time_api_calls) {
+            report_api_call_times();
+        }
         exit(exit_code);
     }
 
@@ -1375,9 +1697,42 @@ int main(int argc, char **argv) {
     // Expand the child_args to contain space for the numeric argument to '-C'
     child_args.push_back("X");
 
+#ifdef WIN32
+    if (jobs > 1) {
+        fprintf(stderr, "Parallel test execution is not supported on "
+                "Windows; running serially\n");
+        jobs = 1;
+    }
+#endif
+
     do {
         int i;
         bool need_newline = false;
+
+        if (in_process) {
+            exitcode += execute_tests_in_process(testcases, test_case_regex,
+                                                 engine, engine_args, timeout,
+                                                 quiet, verbose);
+            if (exitcode != 0 && terminate_on_error) {
+                exit(EXIT_FAILURE);
+            }
+            ++loop_count;
+            continue;
+        }
+
+#ifndef WIN32
+        if (jobs > 1) {
+            exitcode += run_tests_parallel(testcases, test_case_regex,
+                                           child_args, argc, jobs, attempts,
+                                           quiet, verbose);
+            if (exitcode != 0 && terminate_on_error) {
+                exit(EXIT_FAILURE);
+            }
+            ++loop_count;
+            continue;
+        }
+#endif
+
         for (i = 0; testcases[i].name; i++) {
             int error;
             if (!std::regex_search(testcases[i].name, test_case_regex)) {
@@ -4,6 +4,18 @@
 // the correctness of the response it gets, because it's inteded to be used
 // with different mock engines and all we care about is if we're able to
 // run the commands or not.
+//
+// The probe packets are built once into preallocated template arenas which
+// all connections replay, and each worker thread drives a whole group of
+// pipelined nonblocking sockets through a single poll loop so that the
+// packet validators see traffic at line rate rather than at allocation
+// rate.
+//
+// In addition to the traditional "bash" mode the program has a coverage
+// mode (-C) which sweeps the entire 0x00-0xff opcode space. Every opcode
+// is probed with a minimal packet and the response status and latency is
+// recorded per opcode, giving a quick robustness *and* performance picture
+// of the validator / execution path for each entry of the command table.
 
 #include "config.h"
 
@@ -15,21 +27,62 @@
 #include <string>
 #include <string.h>
 #include <list>
+#include <vector>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <cerrno>
+#include <chrono>
+#include <cinttypes>
 #include <platform/platform.h>
 
+#include "utilities/protocol2text.h"
+
 using namespace std;
 
+/**
+ * A PacketArena is a preallocated buffer holding a stream of request
+ * packets. The arena is built once at startup and then shared (read-only)
+ * by all of the connections replaying it, so the send path never touches
+ * the allocator.
+ */
+class PacketArena {
+public:
+    PacketArena(size_t capacity_) : buffer(capacity_), used(0) {
+        memset(buffer.data(), 0, buffer.size());
+    }
+
+    char* wptr(void) {
+        return buffer.data() + used;
+    }
+
+    size_t room(void) const {
+        return buffer.size() - used;
+    }
+
+    void commit(size_t nbytes) {
+        used += nbytes;
+    }
+
+    const char* data(void) const {
+        return buffer.data();
+    }
+
+    size_t length(void) const {
+        return used;
+    }
+
+private:
+    std::vector<char> buffer;
+    size_t used;
+};
 
 class Connection {
 public:
     Connection(const string &_host, const string &_port,
-               char *sndbuf, size_t sndbufsz, bool loop) :
-        sendBuffer(sndbuf), sendBufferSize(sndbufsz), loopSendBuffer(loop),
+               const PacketArena& _arena, bool loop) :
+        arena(_arena), loopSendBuffer(loop), toSend(0),
         sendBufferOffset(0), devZeroSize(8192), devZero(new char[devZeroSize]),
         sock(INVALID_SOCKET), host(_host), port(_port)
     {
@@ -43,32 +96,34 @@ public:
         delete []devZero;
     }
 
+    /**
+     * Ensure that the connection is established, (re)connecting if the
+     * previous probe caused the server to hang up on us.
+     */
+    void ensureConnected(void) {
+        while (sock == INVALID_SOCKET) {
+            connect();
+        }
+    }
 
-    void main(void) {
-        while (true) {
-            if (sock == INVALID_SOCKET) {
-                connect();
-            }
+    SOCKET getSocket(void) const {
+        return sock;
+    }
 
-            while (sock != INVALID_SOCKET) {
-                struct pollfd fds[1];
-                fds[0].fd = sock;
-                if (toSend == 0) {
-                    fds[0].events = POLLIN;
-                } else {
-                    fds[0].events = POLLIN | POLLOUT;
-                }
-                cb_assert(poll(fds, 1, -1) != -1);
+    short interest(void) const {
+        return (toSend == 0) ? POLLIN : short(POLLIN | POLLOUT);
+    }
 
-                if (fds[0].revents & POLLIN) {
-                    drainInput();
-                } else if (fds[0].revents & POLLOUT) {
-                    doSendData();
-                } else {
-                    // what is this?
-                    abort();
-                }
-            }
+    /** Handle the poll events for this connection */
+    void step(short revents) {
+        if (revents & POLLIN) {
+            drainInput();
+        } else if (revents & POLLOUT) {
+            doSendData();
+        } else if (revents != 0) {
+            // POLLERR / POLLHUP; tear the socket down and reconnect
+            close(sock);
+            sock = INVALID_SOCKET;
         }
     }
 
@@ -112,7 +167,7 @@ protected:
         freeaddrinfo(ai);
 
         sendBufferOffset = 0;
-        toSend = sendBufferSize - sendBufferOffset;
+        toSend = arena.length();
         return true;
     }
 
@@ -133,13 +188,14 @@ protected:
         ssize_t nw;
         cb_assert(toSend > 0);
 
-        while ((nw = send(sock, sendBuffer+sendBufferOffset, toSend, 0)) > 0) {
+        while ((nw = send(sock, arena.data() + sendBufferOffset,
+                          toSend, 0)) > 0) {
             sendBufferOffset += nw;
-            toSend = sendBufferSize - sendBufferOffset;
+            toSend = arena.length() - sendBufferOffset;
             if (toSend == 0) {
                 if (loopSendBuffer) {
                     sendBufferOffset = 0;
-                    toSend = sendBufferSize - sendBufferOffset;
+                    toSend = arena.length();
                 } else {
                     return;
                 }
@@ -152,10 +208,9 @@ protected:
         }
     }
 
-    char *sendBuffer;
-    size_t toSend;
-    size_t sendBufferSize;
+    const PacketArena& arena;
     bool loopSendBuffer;
+    size_t toSend;
     size_t sendBufferOffset;
 
     size_t devZeroSize;
@@ -165,24 +220,61 @@ protected:
     const string port;
 };
 
+/**
+ * A worker thread drives all of its connections through a single poll
+ * loop; the number of threads is independent of the number of
+ * connections.
+ */
+class Worker {
+public:
+    void add(Connection* c) {
+        connections.push_back(c);
+    }
+
+    void main(void) {
+        std::vector<struct pollfd> fds(connections.size());
+
+        while (true) {
+            for (size_t ii = 0; ii < connections.size(); ++ii) {
+                connections[ii]->ensureConnected();
+                fds[ii].fd = connections[ii]->getSocket();
+                fds[ii].events = connections[ii]->interest();
+                fds[ii].revents = 0;
+            }
 
+            cb_assert(poll(fds.data(), nfds_t(fds.size()), -1) != -1);
+
+            for (size_t ii = 0; ii < connections.size(); ++ii) {
+                connections[ii]->step(fds[ii].revents);
+            }
+        }
+    }
+
+private:
+    std::vector<Connection*> connections;
+};
 
 extern "C" {
-    static void connection_main(void *arg) {
-        Connection *c = reinterpret_cast<Connection*>(arg);
-        c->main();
+    static void worker_main(void *arg) {
+        Worker *w = reinterpret_cast<Worker*>(arg);
+        w->main();
     }
 }
 
-static void bangit(list<Connection*> conn)
+static void bangit(list<Connection*> conn, int threads)
 {
-    // @todo rewrite to use libevent and async io ;)
+    std::vector<Worker> workers(threads);
+    int idx = 0;
+    for (list<Connection*>::iterator iter = conn.begin();
+         iter != conn.end(); ++iter) {
+        workers[idx++ % threads].add(*iter);
+    }
+
     list<cb_thread_t> tids;
-    list<Connection*>::iterator iter;
-    for (iter = conn.begin(); iter != conn.end(); ++iter) {
+    for (int ii = 0; ii < threads; ++ii) {
         cb_thread_t tid;
-        void *arg = reinterpret_cast<void*>(*iter);
-        cb_assert(cb_create_thread(&tid, connection_main, arg, 0) == 0);
+        void *arg = reinterpret_cast<void*>(&workers[ii]);
+        cb_assert(cb_create_thread(&tid, worker_main, arg, 0) == 0);
         tids.push_back(tid);
     }
 
@@ -192,13 +284,11 @@ static void bangit(list<Connection*> conn)
     }
 }
 
-static Connection *createTapConnection(const char *host, const char *port)
+static void buildTapConnectArena(PacketArena& arena)
 {
     protocol_binary_request_tap_connect *req;
-    char *message = new char[sizeof(req->bytes)];
-    size_t messagesize = sizeof(req->bytes);
-    req = reinterpret_cast<protocol_binary_request_tap_connect *>(message);
-    memset(req->bytes, 0, sizeof(req->bytes));
+    cb_assert(arena.room() >= sizeof(req->bytes));
+    req = reinterpret_cast<protocol_binary_request_tap_connect *>(arena.wptr());
 
     req->message.header.request.magic = PROTOCOL_BINARY_REQ;
     req->message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_CONNECT;
@@ -206,8 +296,7 @@ static Connection *createTapConnection(const char *host, const char *port)
     req->message.header.request.extlen = 4;
     req->message.header.request.bodylen = htonl(4);
     req->message.body.flags = ntohl(TAP_CONNECT_FLAG_DUMP);
-
-    return new Connection(host, port, message, messagesize, false);
+    arena.commit(sizeof(req->bytes));
 }
 
 static size_t insertRandomGet(char *ptr, size_t buffsz)
@@ -355,55 +444,274 @@ static size_t insertRandomVersion(char *ptr, size_t buffsz)
     return sizeof(req->bytes);
 }
 
-static Connection *createGetSetConnection(const char *host, const char *port)
+static void buildGetSetArena(PacketArena& arena)
 {
-    const size_t buffersize = 1024*1024;
-    char *message = new char[buffersize];
-    memset(message, 0, buffersize);
-    size_t msgsize = 0;
-    char *curr = message;
-    while (msgsize < buffersize) {
+    while (true) {
         long id = random() % 10;
         size_t size;
         switch (id) {
         case 0:
-            size = insertRandomGet(curr, buffersize - msgsize);
+            size = insertRandomGet(arena.wptr(), arena.room());
             break;
         case 1:
-            size = insertRandomAdd(curr, buffersize - msgsize);
+            size = insertRandomAdd(arena.wptr(), arena.room());
             break;
         case 2:
-            size = insertRandomReplace(curr, buffersize - msgsize);
+            size = insertRandomReplace(arena.wptr(), arena.room());
             break;
         case 3:
-            size = insertRandomDelete(curr, buffersize - msgsize);
+            size = insertRandomDelete(arena.wptr(), arena.room());
             break;
         case 4:
-            size = insertRandomFlush(curr, buffersize - msgsize);
+            size = insertRandomFlush(arena.wptr(), arena.room());
             break;
         case 5:
-            size = insertRandomNoop(curr, buffersize - msgsize);
+            size = insertRandomNoop(arena.wptr(), arena.room());
             break;
         case 6:
-            size = insertRandomVersion(curr, buffersize - msgsize);
+            size = insertRandomVersion(arena.wptr(), arena.room());
             break;
         default:
-            size = insertRandomSet(curr, buffersize - msgsize);
+            size = insertRandomSet(arena.wptr(), arena.room());
         }
-        curr += size;
-        msgsize += size;
         if (size == 0) {
-            break;
+            return;
+        }
+        arena.commit(size);
+    }
+}
+
+/*
+ * Coverage mode: sweep the entire opcode space with a minimal probe
+ * packet per opcode, recording the response status and the latency of
+ * each probe. An opcode with no direct response (the quiet commands)
+ * is detected by chasing the probe with a NOOP.
+ */
+
+struct OpcodeStats {
+    OpcodeStats() : probes(0), total_usec(0), max_usec(0),
+                    status(0xffff), responded(false), disconnected(false) {}
+
+    uint32_t probes;
+    uint64_t total_usec;
+    uint64_t max_usec;
+    uint16_t status;
+    bool responded;
+    bool disconnected;
+};
+
+static int coverage_connect(const char* host, const char* port)
+{
+    struct addrinfo *ai = NULL;
+    struct addrinfo hints;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, port, &hints, &ai) != 0) {
+        return -1;
+    }
+
+    int sock = -1;
+    for (struct addrinfo *e = ai; e != NULL; e = e->ai_next) {
+        if ((sock = socket(e->ai_family, e->ai_socktype,
+                           e->ai_protocol)) != -1) {
+            if (::connect(sock, e->ai_addr, e->ai_addrlen) == 0) {
+                break;
+            }
+            close(sock);
+            sock = -1;
+        }
+    }
+
+    freeaddrinfo(ai);
+    return sock;
+}
+
+/**
+ * Read a single complete response frame (header + body) from the socket.
+ * @return true on success, false if the server hung up / timed out
+ */
+static bool coverage_read_response(int sock,
+                                   protocol_binary_response_header& header)
+{
+    size_t offset = 0;
+    char* ptr = reinterpret_cast<char*>(header.bytes);
+
+    while (offset < sizeof(header.bytes)) {
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 2000) != 1) {
+            return false;
+        }
+        ssize_t nr = recv(sock, ptr + offset, sizeof(header.bytes) - offset, 0);
+        if (nr <= 0) {
+            return false;
+        }
+        offset += nr;
+    }
+
+    uint32_t bodylen = ntohl(header.response.bodylen);
+    char chunk[8192];
+    while (bodylen > 0) {
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 2000) != 1) {
+            return false;
         }
+        size_t nbytes = (bodylen < sizeof(chunk)) ? bodylen : sizeof(chunk);
+        ssize_t nr = recv(sock, chunk, nbytes, 0);
+        if (nr <= 0) {
+            return false;
+        }
+        bodylen -= nr;
     }
 
-    return new Connection(host, port, message, msgsize, true);
+    return true;
 }
 
+static void coverage_probe(int& sock, const char* host, const char* port,
+                           uint8_t opcode, OpcodeStats& stats)
+{
+    if (sock == -1) {
+        sock = coverage_connect(host, port);
+        if (sock == -1) {
+            fprintf(stderr, "Failed to connect to %s:%s\n", host, port);
+            exit(1);
+        }
+    }
+
+    const uint32_t probe_opaque = 0xdead0000 | opcode;
+    const uint32_t noop_opaque = 0xbeef0000 | opcode;
+
+    // A minimal probe: one byte of key, no extras. The point is to poke
+    // the validator / command table entry, not to perform a well-formed
+    // operation.
+    union {
+        protocol_binary_request_no_extras request;
+        char bytes[sizeof(protocol_binary_request_no_extras) + 1];
+    } probe;
+    memset(probe.bytes, 0, sizeof(probe.bytes));
+    probe.request.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    probe.request.message.header.request.opcode = opcode;
+    probe.request.message.header.request.keylen = htons(1);
+    probe.request.message.header.request.bodylen = htonl(1);
+    probe.request.message.header.request.opaque = probe_opaque;
+    probe.bytes[sizeof(probe.request.bytes)] = 'a';
+
+    protocol_binary_request_noop noop;
+    memset(noop.bytes, 0, sizeof(noop.bytes));
+    noop.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    noop.message.header.request.opcode = PROTOCOL_BINARY_CMD_NOOP;
+    noop.message.header.request.opaque = noop_opaque;
+
+    char packet[sizeof(probe.bytes) + sizeof(noop.bytes)];
+    memcpy(packet, probe.bytes, sizeof(probe.bytes));
+    memcpy(packet + sizeof(probe.bytes), noop.bytes, sizeof(noop.bytes));
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t offset = 0;
+    while (offset < sizeof(packet)) {
+        ssize_t nw = send(sock, packet + offset, sizeof(packet) - offset, 0);
+        if (nw <= 0) {
+            close(sock);
+            sock = -1;
+            stats.disconnected = true;
+            return;
+        }
+        offset += nw;
+    }
+
+    // Read responses until we've seen the answer to the trailing NOOP
+    // (or the server hung up on us). The first response - whatever it
+    // belongs to - defines the latency of the probe.
+    bool first = true;
+    while (true) {
+        protocol_binary_response_header header;
+        if (!coverage_read_response(sock, header)) {
+            close(sock);
+            sock = -1;
+            stats.disconnected = true;
+            return;
+        }
+
+        if (first) {
+            const auto stop = std::chrono::steady_clock::now();
+            uint64_t usec =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    stop - start).count();
+            stats.probes++;
+            stats.total_usec += usec;
+            if (usec > stats.max_usec) {
+                stats.max_usec = usec;
+            }
+            first = false;
+        }
+
+        if (header.response.opaque == probe_opaque) {
+            stats.responded = true;
+            stats.status = ntohs(header.response.status);
+        } else if (header.response.opaque == noop_opaque) {
+            return;
+        }
+    }
+}
+
+static int coverage(const char* host, const char* port, int rounds)
+{
+    std::vector<OpcodeStats> stats(0x100);
+    int sock = -1;
+
+    for (int round = 0; round < rounds; ++round) {
+        for (int opcode = 0; opcode < 0x100; ++opcode) {
+            coverage_probe(sock, host, port, uint8_t(opcode), stats[opcode]);
+        }
+    }
+
+    if (sock != -1) {
+        close(sock);
+    }
+
+    printf("%-6s %-30s %-22s %10s %10s\n",
+           "opcode", "name", "status", "avg usec", "max usec");
+    for (int opcode = 0; opcode < 0x100; ++opcode) {
+        const OpcodeStats& st = stats[opcode];
+        const char* name = memcached_opcode_2_text(uint8_t(opcode));
+        const char* status;
+        if (st.disconnected) {
+            status = "(disconnect)";
+        } else if (!st.responded) {
+            status = "(no response)";
+        } else {
+            status = memcached_status_2_text(
+                protocol_binary_response_status(st.status));
+            if (status == NULL) {
+                status = "(unknown status)";
+            }
+        }
+
+        if (st.probes == 0) {
+            printf("0x%02x   %-30s %-22s %10s %10s\n", opcode,
+                   name ? name : "", status, "-", "-");
+        } else {
+            printf("0x%02x   %-30s %-22s %10" PRIu64 " %10" PRIu64 "\n",
+                   opcode, name ? name : "", status,
+                   st.total_usec / st.probes, st.max_usec);
+        }
+    }
+
+    return 0;
+}
 
 /**
- * Program entry point. Connect to a memcached server and use the binary
- * protocol to retrieve a given set of stats.
+ * Program entry point. In the default mode, connect a number of
+ * connections to a memcached server and replay streams of request
+ * packets as fast as the server accepts them. With -C, sweep the
+ * opcode space and report per-opcode response status and latency.
  *
  * @param argc argument count
  * @param argv argument vector
@@ -415,12 +723,15 @@ int main(int argc, char **argv)
     const char *port = "11211";
     const char *host = NULL;
     int connections = 10;
+    int threads = 4;
+    int rounds = 10;
+    bool coverage_mode = false;
     char *ptr;
 
     /* Initialize the socket subsystem */
     cb_initialize_sockets();
 
-    while ((cmd = getopt(argc, argv, "h:p:c:")) != EOF) {
+    while ((cmd = getopt(argc, argv, "h:p:c:t:Cr:")) != EOF) {
         switch (cmd) {
         case 'h' :
             host = optarg;
@@ -436,9 +747,23 @@ int main(int argc, char **argv)
         case 'c' :
             connections = atoi(optarg);
             break;
+        case 't' :
+            threads = atoi(optarg);
+            break;
+        case 'C' :
+            coverage_mode = true;
+            break;
+        case 'r' :
+            rounds = atoi(optarg);
+            break;
         default:
             fprintf(stderr,
-                    "Usage mcbasher [-h host[:port]] [-p port] [-c connections]*\n");
+                    "Usage mcbasher [-h host[:port]] [-p port] [-c connections]\n"
+                    "               [-t threads] [-C] [-r rounds]\n"
+                    "\n"
+                    "  -C   coverage mode: probe every opcode and report the\n"
+                    "       response status and latency per opcode\n"
+                    "  -r   number of sweeps over the opcode space in -C mode\n");
             return 1;
         }
     }
@@ -447,19 +772,36 @@ int main(int argc, char **argv)
         host = "localhost";
     }
 
+    if (coverage_mode) {
+        return coverage(host, port, rounds);
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > connections) {
+        threads = connections;
+    }
+
+    // Build the packet template arenas shared by all of the connections
+    PacketArena tapArena(sizeof(protocol_binary_request_tap_connect));
+    buildTapConnectArena(tapArena);
+    PacketArena getsetArena(1024*1024);
+    buildGetSetArena(getsetArena);
+
     list<Connection*> conns;
     for (int ii = 0; ii < connections; ++ii) {
         Connection *c;
         if ((ii & 1) == 0) {
-            c = createTapConnection(host, port);
+            c = new Connection(host, port, tapArena, false);
         } else {
-            c = createGetSetConnection(host, port);
+            c = new Connection(host, port, getsetArena, true);
         }
 
         conns.push_back(c);
     }
 
-    bangit(conns);
+    bangit(conns, threads);
 
     return 0;
 }
@@ -16,21 +16,52 @@
  */
 
 /*
- * mcbench is a program used to test the single frontend thread performance
- * on a memcached service
+ * mcbench is a multi-threaded load generator for the memcached binary
+ * protocol. It runs a configurable number of worker threads, each
+ * driving a number of pipelined connections with a configurable
+ * get/set mix, key popularity distribution (uniform or zipfian) and
+ * value sizes.
+ *
+ * It supports two modes of operation:
+ *
+ *   - closed loop (the default): each connection keeps a fixed number
+ *     of requests in flight, measuring the latency from the moment a
+ *     request is put on the wire.
+ *
+ *   - open loop (-R rate): requests are issued on a fixed schedule
+ *     regardless of how fast the server responds, and the latency is
+ *     measured from the _scheduled_ send time. This includes the time
+ *     a request spent queued behind a slow server and thus doesn't
+ *     suffer from coordinated omission.
+ *
+ * Latencies are recorded into high dynamic range histograms (the same
+ * implementation backing the server's own timing stats) so that the
+ * reported percentiles can be compared against the numbers reported
+ * by mctimings.
+ *
+ * With -G the same workload is spoken over the Greenstack protocol
+ * (Hello handshake followed by Get/Mutation frames) instead of the
+ * binary protocol, so the two protocol stacks can be benchmarked
+ * side by side against the same server build.
  */
 #include "config.h"
 
 #include <memcached/protocol_binary.h>
+#include <libgreenstack/Greenstack.h>
+#include <daemon/hdr_histogram.h>
 
 #include <getopt.h>
+#include <cinttypes>
+#include <cmath>
 #include <cstdlib>
 #include <cstdio>
 #include <string>
 #include <string.h>
-#include <list>
+#include <deque>
+#include <memory>
 #include <vector>
 #include <iostream>
+#include <random>
 #include <stdint.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -42,61 +73,98 @@
 #include <atomic>
 #include <platform/platform.h>
 
+using steady_clock = std::chrono::steady_clock;
 
+/**
+ * The workload configuration shared (read-only) by all of the worker
+ * threads.
+ */
+struct Workload {
+    std::string host{"localhost"};
+    std::string port{"12000"};
+    int threads{1};
+    int connections{1};
+    int duration{60};
+    int pipeline{1};
+    /** percentage of operations which are GETs (the rest are SETs) */
+    int get_ratio{90};
+    /** the number of distinct keys */
+    uint64_t keys{10000};
+    /** zipfian skew; 0 means uniform key selection */
+    double zipf_theta{0.0};
+    size_t value_size_min{256};
+    size_t value_size_max{256};
+    /**
+     * The target rate in operations per second over all threads.
+     * 0 means closed loop.
+     */
+    uint64_t rate{0};
+    /** speak Greenstack instead of the binary protocol */
+    bool greenstack{false};
+};
 
-class Connection;
-static void thread_main(Connection *c);
-
-
-class Connection {
+/**
+ * Generator for a zipfian distribution over [0, items) using the
+ * approximation from Gray et al., "Quickly Generating Billion-Record
+ * Synthetic Databases". The (one-off) setup cost is O(items).
+ */
+class ZipfGenerator {
 public:
-    Connection(const std::string &_host, const std::string &_port,
-               uint8_t *sndbuf, size_t sndbufsz) :
-        sendBuffer(sndbuf), sendBufferSize(sndbufsz),
-        sendBufferOffset(0),
-        sock(INVALID_SOCKET), host(_host), port(_port), currentOps(0)
-    {
-        currentOps.store(0, std::memory_order_release);
-        recvBuffer.reserve(2 * 1024 * 1024);
-    }
-
-    void start() {
-        running.store(true, std::memory_order_release);
-        tid = std::thread(thread_main, this);
-    }
-
-
-    void stop() {
-        running.store(false, std::memory_order_release);
-        tid.join();
-
+    ZipfGenerator(uint64_t items, double theta_)
+        : count(items), theta(theta_) {
+        for (uint64_t ii = 1; ii <= count; ++ii) {
+            zetan += 1.0 / std::pow(double(ii), theta);
+        }
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / double(count), 1.0 - theta)) /
+              (1.0 - (1.0 + std::pow(0.5, theta)) / zetan);
     }
 
-    size_t getOpsPerSec() const {
-        using namespace std::chrono;
-
-        std::chrono::time_point<std::chrono::steady_clock> now;
-        if (running) {
-            now = steady_clock::now();
-        } else {
-            now = stopTime;
+    uint64_t next(std::mt19937_64& engine) const {
+        const double u = std::uniform_real_distribution<double>(0, 1)(engine);
+        const double uz = u * zetan;
+        if (uz < 1.0) {
+            return 0;
         }
-
-        auto delta = duration_cast<seconds>(now - startTime).count();
-        if (delta == 0) {
-            return currentOps.load(std::memory_order_acquire);
-        } else {
-            return currentOps.load(std::memory_order_acquire) / delta;
+        if (uz < 1.0 + std::pow(0.5, theta)) {
+            return 1;
         }
+        auto rv = uint64_t(double(count) *
+                           std::pow(eta * u - eta + 1.0, alpha));
+        return rv < count ? rv : count - 1;
     }
 
-    size_t getDuration() const {
-        using namespace std::chrono;
-        return duration_cast<seconds>(stopTime - startTime).count();
-    }
+private:
+    const uint64_t count;
+    const double theta;
+    double zetan{0.0};
+    double alpha{0.0};
+    double eta{0.0};
+};
 
-    size_t getTotalOps() const {
-        return currentOps.load(std::memory_order_acquire);
+/**
+ * The per-thread result counters and latency histograms. Only touched
+ * by the owning thread while the benchmark runs; aggregated by the
+ * main thread once every worker has been joined.
+ */
+struct ThreadStats {
+    HdrHistogram get_latency{2};
+    HdrHistogram set_latency{2};
+    uint64_t ops{0};
+    uint64_t errors{0};
+    /** open loop only: ops dropped because a connection was down */
+    uint64_t dropped{0};
+};
+
+/**
+ * A single pipelined connection (owned and driven by one worker
+ * thread; nothing in here is thread-safe).
+ */
+class Connection {
+public:
+    Connection(const Workload& config_, ThreadStats& stats_)
+        : config(config_), stats(stats_) {
+        recvBuffer.reserve(64 * 1024);
     }
 
     ~Connection() {
@@ -105,50 +173,12 @@ public:
         }
     }
 
-protected:
-    friend void thread_main(Connection *c);
-
-
-    void run(void) {
-        startTime = std::chrono::steady_clock::now();
-
-        while (running.load(std::memory_order_acquire)) {
-            if (sock == INVALID_SOCKET) {
-                connect();
-            }
-
-            while (sock != INVALID_SOCKET && running.load(std::memory_order_acquire)) {
-                struct pollfd fds[1];
-                fds[0].fd = sock;
-                if (toSend == 0) {
-                    fds[0].events = POLLIN;
-                } else {
-                    fds[0].events = POLLIN | POLLOUT;
-                }
-                cb_assert(poll(fds, 1, -1) != -1);
-
-                if (fds[0].revents & POLLIN) {
-                    drainInput();
-                } else if (fds[0].revents & POLLOUT) {
-                    doSendData();
-                } else {
-                    // what is this?
-                    abort();
-                }
-            }
-        }
-        stopTime = std::chrono::steady_clock::now();
-    }
-
-
-
     /**
-     * Try to connect to the server
+     * Try to connect to the server (nonblocking once established).
      * @return false if we failed to connect to the server
      */
-    bool connect(void)
-    {
-        struct addrinfo *ai = NULL;
+    bool connect(void) {
+        struct addrinfo* ai = NULL;
         struct addrinfo hints;
 
         memset(&hints, 0, sizeof(hints));
@@ -156,177 +186,475 @@ protected:
         hints.ai_protocol = IPPROTO_TCP;
         hints.ai_socktype = SOCK_STREAM;
 
-        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &ai) != 0) {
+        if (getaddrinfo(config.host.c_str(), config.port.c_str(),
+                        &hints, &ai) != 0) {
             return false;
         }
 
-        struct addrinfo *e = ai;
-        do {
+        for (struct addrinfo* e = ai; e != NULL; e = e->ai_next) {
             if ((sock = socket(e->ai_family, e->ai_socktype,
                                e->ai_protocol)) != -1) {
-                if (::connect(sock, ai->ai_addr, ai->ai_addrlen) == -1) {
+                if (::connect(sock, e->ai_addr, e->ai_addrlen) == -1) {
                     close(sock);
                     sock = -1;
+                } else {
+                    break;
                 }
             }
-            if (sock == -1) {
-                e = e->ai_next;
-            } else {
-                break;
-            }
-        } while (e) ;
+        }
+        freeaddrinfo(ai);
+
+        if (sock == -1) {
+            return false;
+        }
 
         fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        sendBuffer.clear();
+        sendOffset = 0;
+        recvBuffer.clear();
+        pending.clear();
+
+        if (config.greenstack) {
+            /* every Greenstack connection must open with HELLO; the
+             * response is consumed without being counted */
+            Greenstack::HelloRequest hello("mcbench", "1.0");
+            frameBuffer.clear();
+            Greenstack::Frame::encode(&hello, frameBuffer);
+            append(frameBuffer.data(), frameBuffer.size());
+            helloPending = true;
+        }
+        return true;
+    }
 
-        freeaddrinfo(ai);
+    bool isConnected(void) const {
+        return sock != INVALID_SOCKET;
+    }
+
+    size_t numPending(void) const {
+        return pending.size();
+    }
+
+    bool wantsWrite(void) const {
+        return sendOffset < sendBuffer.size();
+    }
+
+    SOCKET getSocket(void) const {
+        return sock;
+    }
+
+    /**
+     * Append a GET or SET for the given key to the send buffer and
+     * remember when it was (scheduled to be) issued so that the
+     * response handler can compute the latency.
+     */
+    void issue(bool is_get, uint64_t key,
+               steady_clock::time_point start,
+               std::mt19937_64& engine) {
+        char keybuf[32];
+        int keylen = snprintf(keybuf, sizeof(keybuf),
+                              "key-%020" PRIu64, key);
+
+        if (config.greenstack) {
+            issueGreenstack(is_get, keybuf, size_t(keylen), engine);
+            pending.push_back(PendingOp{is_get, start});
+            return;
+        }
 
-        sendBufferOffset = 0;
-        toSend = sendBufferSize - sendBufferOffset;
+        if (is_get) {
+            protocol_binary_request_get req;
+            memset(&req, 0, sizeof(req));
+            req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+            req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GET;
+            req.message.header.request.keylen = htons(uint16_t(keylen));
+            req.message.header.request.bodylen = htonl(uint32_t(keylen));
+            append(req.bytes, sizeof(req.bytes));
+            append(keybuf, keylen);
+        } else {
+            size_t valuesize = config.value_size_min;
+            if (config.value_size_max > config.value_size_min) {
+                valuesize = std::uniform_int_distribution<size_t>(
+                    config.value_size_min, config.value_size_max)(engine);
+            }
+            protocol_binary_request_set req;
+            memset(&req, 0, sizeof(req));
+            req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+            req.message.header.request.opcode = PROTOCOL_BINARY_CMD_SET;
+            req.message.header.request.keylen = htons(uint16_t(keylen));
+            req.message.header.request.extlen = 8;
+            req.message.header.request.bodylen =
+                htonl(uint32_t(keylen + valuesize + 8));
+            append(req.bytes, sizeof(req.bytes));
+            append(keybuf, keylen);
+            const size_t offset = sendBuffer.size();
+            sendBuffer.resize(offset + valuesize, uint8_t('x'));
+        }
+
+        pending.push_back(PendingOp{is_get, start});
+    }
+
+    /**
+     * Write as much of the send buffer as the socket accepts.
+     * @return false if the connection died
+     */
+    bool drainOutput(void) {
+        while (sendOffset < sendBuffer.size()) {
+            ssize_t nw = send(sock, sendBuffer.data() + sendOffset,
+                              sendBuffer.size() - sendOffset, 0);
+            if (nw > 0) {
+                sendOffset += size_t(nw);
+            } else if (nw == -1 && (errno == EWOULDBLOCK ||
+                                    errno == EAGAIN)) {
+                break;
+            } else {
+                return abort_connection();
+            }
+        }
+        if (sendOffset == sendBuffer.size()) {
+            sendBuffer.clear();
+            sendOffset = 0;
+        }
         return true;
     }
 
-    void drainInput(void) {
+    /**
+     * Read the available responses, match them (in order) against the
+     * issued requests and record the latencies.
+     * @return false if the connection died
+     */
+    bool drainInput(void) {
+        char chunk[64 * 1024];
         ssize_t nr;
-        size_t currsize = recvBuffer.size();
-        recvBuffer.resize(2 * 1024 * 1024);
-        while ((nr = recv(sock, recvBuffer.data() + currsize,
-                          (2 * 1024 * 1024) - currsize, 0)) > 0) {
-            /* Parse packets */
-            recvBuffer.resize(currsize + nr);
-            size_t size = recvBuffer.size();
-            uint8_t *curr = recvBuffer.data();
-
-            while (size > 24) {
-                protocol_binary_response_no_extras *res;
-                res = reinterpret_cast<protocol_binary_response_no_extras *>(curr);
-                cb_assert(res->message.header.response.magic == 0x81);
-                uint32_t bodylen = ntohl(res->message.header.response.bodylen);
-
-                if (size < (24 + bodylen)) {
-                    break;
+        while ((nr = recv(sock, chunk, sizeof(chunk), 0)) > 0) {
+            recvBuffer.insert(recvBuffer.end(), chunk, chunk + nr);
+
+            const auto now = steady_clock::now();
+            size_t avail = recvBuffer.size();
+            const uint8_t* curr =
+                reinterpret_cast<const uint8_t*>(recvBuffer.data());
+
+            while (avail > 0) {
+                size_t frame;
+                bool failed;
+
+                if (config.greenstack) {
+                    if (avail < 4) {
+                        break;
+                    }
+                    uint32_t length;
+                    memcpy(&length, curr, sizeof(length));
+                    frame = 4 + ntohl(length);
+                    if (avail < frame) {
+                        break;
+                    }
+                    if (helloPending) {
+                        /* the handshake isn't part of the workload */
+                        helloPending = false;
+                        curr += frame;
+                        avail -= frame;
+                        continue;
+                    }
+                    /* the status field follows the frame length, opaque,
+                     * opcode and flags fields */
+                    uint16_t raw = 0;
+                    if (frame >= 13) {
+                        memcpy(&raw, curr + 11, sizeof(raw));
+                        raw = ntohs(raw);
+                    }
+                    const auto status = Greenstack::to_status(raw);
+                    /* a miss on a key we've not written yet isn't an
+                     * error */
+                    failed = status != Greenstack::Status::Success &&
+                             status != Greenstack::Status::NotFound;
+                } else {
+                    if (avail < sizeof(protocol_binary_response_header)) {
+                        break;
+                    }
+                    auto* res = reinterpret_cast<
+                        const protocol_binary_response_no_extras*>(curr);
+                    cb_assert(res->message.header.response.magic ==
+                              PROTOCOL_BINARY_RES);
+                    frame = sizeof(res->bytes) +
+                        ntohl(res->message.header.response.bodylen);
+                    if (avail < frame) {
+                        break;
+                    }
+                    const auto status =
+                        ntohs(res->message.header.response.status);
+                    /* a miss on a key we've not written yet isn't an
+                     * error */
+                    failed = status != PROTOCOL_BINARY_RESPONSE_SUCCESS &&
+                             status != PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
                 }
 
-                size -= (24 + bodylen);
-                currentOps.fetch_add(1, std::memory_order_release);;
-                curr += 24 + bodylen;
+                cb_assert(!pending.empty());
+                const PendingOp op = pending.front();
+                pending.pop_front();
+
+                const auto delta =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        now - op.start).count();
+                if (op.is_get) {
+                    stats.get_latency.add(delta);
+                } else {
+                    stats.set_latency.add(delta);
+                }
+                stats.ops++;
+                if (failed) {
+                    stats.errors++;
+                }
+
+                curr += frame;
+                avail -= frame;
             }
 
-            /* repack the buffer */
-            memmove(recvBuffer.data(), curr, size);
-            currsize = size;
-            recvBuffer.resize(2 * 1024 * 1024);
+            recvBuffer.erase(recvBuffer.begin(),
+                             recvBuffer.end() - avail);
         }
 
-        recvBuffer.resize(currsize);
-
-        if ((nr == -1 && errno != EWOULDBLOCK) || nr == 0) {
-            close(sock);
-            sock = -1;
+        if (nr == 0 || (nr == -1 && errno != EWOULDBLOCK &&
+                        errno != EAGAIN)) {
+            return abort_connection();
         }
+        return true;
     }
 
-    void doSendData(void) {
-        ssize_t nw;
-        cb_assert(toSend > 0);
+private:
+    struct PendingOp {
+        bool is_get;
+        steady_clock::time_point start;
+    };
+
+    void append(const void* data, size_t size) {
+        const auto* ptr = reinterpret_cast<const uint8_t*>(data);
+        sendBuffer.insert(sendBuffer.end(), ptr, ptr + size);
+    }
 
-        while ((nw = send(sock, sendBuffer+sendBufferOffset, toSend, 0)) > 0) {
-            sendBufferOffset += nw;
-            toSend = sendBufferSize - sendBufferOffset;
-            if (toSend == 0) {
-                sendBufferOffset = 0;
-                toSend = sendBufferSize - sendBufferOffset;
+    /**
+     * Encode a Greenstack Get or Mutation(Set) frame for the key and
+     * append it to the send buffer. The frame is encoded into a scratch
+     * buffer which keeps its allocation from request to request
+     * (mirroring the server side encode buffer).
+     */
+    void issueGreenstack(bool is_get, const char* keybuf, size_t keylen,
+                         std::mt19937_64& engine) {
+        frameBuffer.clear();
+        if (is_get) {
+            Greenstack::GetRequest req(std::string(keybuf, keylen));
+            Greenstack::Frame::encode(&req, frameBuffer);
+        } else {
+            size_t valuesize = config.value_size_min;
+            if (config.value_size_max > config.value_size_min) {
+                valuesize = std::uniform_int_distribution<size_t>(
+                    config.value_size_min, config.value_size_max)(engine);
+            }
+            if (valueBlob.size() < valuesize) {
+                valueBlob.resize(valuesize, uint8_t('x'));
             }
-        }
 
-        if (nw == -1 && errno != EWOULDBLOCK) {
-            close(sock);
-            sock = -1;
+            Greenstack::MutationRequest req;
+            req.setMutationType(Greenstack::MutationType::Set);
+            auto info = std::make_shared<Greenstack::DocumentInfo>();
+            info->setId(std::string(keybuf, keylen));
+            req.setDocumentInfo(info);
+            req.setValue(std::make_shared<Greenstack::FixedByteArrayBuffer>(
+                valueBlob.data(), valuesize));
+            req.assemble();
+            Greenstack::Frame::encode(&req, frameBuffer);
         }
+        append(frameBuffer.data(), frameBuffer.size());
     }
 
-    uint8_t *sendBuffer;
-    size_t toSend;
-    size_t sendBufferSize;
-    size_t sendBufferOffset;
-
-    std::vector<uint8_t> recvBuffer;
-    int sock;
-    const std::string host;
-    const std::string port;
-    std::chrono::time_point<std::chrono::steady_clock> startTime;
-    std::chrono::time_point<std::chrono::steady_clock> stopTime;
-    std::atomic<size_t> currentOps;
-    std::thread tid;
-    std::atomic<bool> running;
+    bool abort_connection(void) {
+        /* Requests lost in flight never complete; in open loop mode
+         * that would leave a hole in the histogram, so account for
+         * them separately */
+        stats.dropped += pending.size();
+        pending.clear();
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+        return false;
+    }
+
+    const Workload& config;
+    ThreadStats& stats;
+
+    std::vector<uint8_t> sendBuffer;
+    size_t sendOffset{0};
+    std::vector<char> recvBuffer;
+    std::deque<PendingOp> pending;
+    SOCKET sock{INVALID_SOCKET};
+
+    /* Greenstack mode only */
+    std::vector<uint8_t> frameBuffer;
+    std::vector<uint8_t> valueBlob;
+    bool helloPending{false};
 };
 
-static void thread_main(Connection *c)
-{
-    c->run();
-}
+static std::atomic<bool> stop_requested;
 
-static void buildSetStream(std::vector<uint8_t> &vector, size_t size) {
-    /* preformat a buffer that's roughly 2MB big */
-    vector.reserve(2 * 1024 * 1024);
-    while (vector.size() < (2 * 1024 * 1024)) {
-        protocol_binary_request_set req;
-        memset(&req, 0, sizeof(req));
-
-        req.message.header.request.magic = PROTOCOL_BINARY_REQ;
-        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_SET;
-        req.message.header.request.keylen = htons(3);
-        req.message.header.request.extlen = 8;
-        req.message.header.request.bodylen = htonl(11 + size);
-        req.message.body.flags = 0;
-        req.message.body.expiration = 0;
-
-        for (size_t ii = 0; ii < sizeof(req.bytes); ++ii) {
-            vector.push_back(req.bytes[ii]);
+/**
+ * A worker thread driving `connections` pipelined connections with
+ * poll(). In closed loop mode each connection is kept topped up to
+ * the configured pipeline depth; in open loop mode requests are
+ * issued round-robin over the connections on a fixed schedule.
+ */
+static void worker_main(const Workload* config, ThreadStats* stats,
+                        size_t thread_index) {
+    std::mt19937_64 engine(0x6d636265 + thread_index);
+    std::unique_ptr<ZipfGenerator> zipf;
+    if (config->zipf_theta > 0.0) {
+        zipf.reset(new ZipfGenerator(config->keys, config->zipf_theta));
+    }
+
+    std::vector<std::unique_ptr<Connection>> conns;
+    for (int ii = 0; ii < config->connections; ++ii) {
+        conns.emplace_back(new Connection(*config, *stats));
+    }
+
+    auto pick_key = [&](void) -> uint64_t {
+        if (zipf) {
+            return zipf->next(engine);
         }
+        return std::uniform_int_distribution<uint64_t>(
+            0, config->keys - 1)(engine);
+    };
+    auto pick_is_get = [&](void) -> bool {
+        return int(std::uniform_int_distribution<int>(0, 99)(engine)) <
+               config->get_ratio;
+    };
+
+    /* Open loop schedule: this thread issues its share of the total
+     * rate, one request every `interval` */
+    const bool open_loop = config->rate > 0;
+    const auto interval = open_loop ?
+        std::chrono::nanoseconds(uint64_t(1000000000) * config->threads /
+                                 config->rate) :
+        std::chrono::nanoseconds(0);
+    auto next_send = steady_clock::now();
+    size_t next_conn = 0;
+
+    while (!stop_requested.load(std::memory_order_acquire)) {
+        const auto now = steady_clock::now();
+
+        for (auto& c : conns) {
+            if (!c->isConnected() && !c->connect()) {
+                continue;
+            }
 
-        vector.push_back('f');
-        vector.push_back('o');
-        vector.push_back('o');
+            if (!open_loop) {
+                /* top up the pipeline */
+                while (c->numPending() < size_t(config->pipeline)) {
+                    c->issue(pick_is_get(), pick_key(), now, engine);
+                }
+            }
+        }
 
-        vector.resize(vector.size() + size, ' ');
-    }
-}
+        if (open_loop) {
+            /* Issue every request whose scheduled time has passed,
+             * stamping it with the _scheduled_ time so that the
+             * latency includes any backlog we've built up */
+            while (next_send <= now) {
+                auto& c = *conns[next_conn];
+                next_conn = (next_conn + 1) % conns.size();
+                if (c.isConnected()) {
+                    c.issue(pick_is_get(), pick_key(), next_send, engine);
+                } else {
+                    stats->dropped++;
+                }
+                next_send += interval;
+            }
+        }
 
-static void set_test(const std::string &host, const std::string &port, int duration) {
-    std::list<int> sizes;
-    sizes.push_back(256);
-    sizes.push_back(512);
-    sizes.push_back(1 * 1024);
-    sizes.push_back(2 * 1024);
-    sizes.push_back(4 * 1024);
-    sizes.push_back(8 * 1024);
-    sizes.push_back(16 * 1024);
-    sizes.push_back(512 * 1024);
-
-    for (auto iter = sizes.begin(); iter != sizes.end(); ++iter) {
-        std::vector<uint8_t> message;
-        buildSetStream(message, *iter);
-        Connection c(host, port, message.data(), message.size());
-
-        int end = time(NULL) + duration;
-        c.start();
-
-        while (time(NULL) < (end)) {
-            std::cout << "\rSet test with objects of " << *iter << " bytes: "
-                      << c.getOpsPerSec() << " set/sec";
-            std::cout.flush();
-            sleep(1);
+        std::vector<struct pollfd> fds;
+        for (auto& c : conns) {
+            if (!c->isConnected()) {
+                continue;
+            }
+            struct pollfd pfd;
+            pfd.fd = c->getSocket();
+            pfd.events = POLLIN;
+            if (c->wantsWrite()) {
+                pfd.events |= POLLOUT;
+            }
+            pfd.revents = 0;
+            fds.push_back(pfd);
         }
 
-        // Loop and print stats for the duration
-        c.stop();
+        int timeout = 100;
+        if (open_loop) {
+            const auto until =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    next_send - steady_clock::now()).count();
+            if (until < timeout) {
+                timeout = until > 0 ? int(until) : 0;
+            }
+        }
 
-        std::cout << "\r " << *iter << " bytes: "
-                  << "Duration " << c.getDuration()
-                  << "s Total ops " << c.getTotalOps()
-                  << " avg: " << c.getOpsPerSec() << std::endl;
-        std::cout.flush();
+        if (fds.empty()) {
+            /* all connections down; back off before reconnecting */
+            usleep(timeout * 1000);
+            continue;
+        }
+        if (poll(fds.data(), nfds_t(fds.size()), timeout) == -1) {
+            cb_assert(errno == EINTR);
+            continue;
+        }
+
+        size_t idx = 0;
+        for (auto& c : conns) {
+            if (!c->isConnected()) {
+                continue;
+            }
+            const auto revents = fds[idx++].revents;
+            if ((revents & POLLIN) && !c->drainInput()) {
+                continue;
+            }
+            if ((revents & (POLLOUT | POLLHUP | POLLERR)) ||
+                c->wantsWrite()) {
+                c->drainOutput();
+            }
+        }
+    }
+}
+
+/**
+ * Print the report for one half of the workload mix in a layout
+ * comparable with `mctimings`: the sample count and the p50 / p90 /
+ * p99 / p99.9 / max latencies in microseconds, plus the raw JSON for
+ * consumption by scripts.
+ */
+static void report_histogram(const char* name, HdrHistogram& hist) {
+    if (hist.get_total() == 0) {
+        return;
     }
+    std::cout << name << ": " << hist.get_total() << " ops" << std::endl
+              << "    p50: " << hist.get_percentile(50.0) << "us"
+              << "  p90: " << hist.get_percentile(90.0) << "us"
+              << "  p99: " << hist.get_percentile(99.0) << "us"
+              << "  p99.9: " << hist.get_percentile(99.9) << "us"
+              << "  max: " << hist.get_max() << "us" << std::endl
+              << "    " << hist.to_string() << std::endl;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage mcbench [options]\n\n"
+            "  -h host[:port]  the host to connect to (localhost)\n"
+            "  -p port         the port to connect to (12000)\n"
+            "  -t threads      the number of worker threads (1)\n"
+            "  -c connections  connections per worker thread (1)\n"
+            "  -d duration     the duration of the test in seconds (60)\n"
+            "  -P depth        pipeline depth per connection (1)\n"
+            "  -g ratio        percentage of gets in the mix (90)\n"
+            "  -k keys         the number of distinct keys (10000)\n"
+            "  -z theta        zipfian key skew, 0 < theta < 1 "
+            "(0 = uniform)\n"
+            "  -s min[:max]    value size in bytes (256)\n"
+            "  -R rate         open loop mode: issue `rate` ops/s over\n"
+            "                  all threads and measure latency from the\n"
+            "                  scheduled send time (0 = closed loop)\n"
+            "  -G              speak Greenstack instead of the binary\n"
+            "                  protocol (for side-by-side comparison)\n");
 }
 
 /**
@@ -336,41 +664,132 @@ static void set_test(const std::string &host, const std::string &port, int durat
  * @param argv argument vector
  * @return 0 if success, error code otherwise
  */
-int main(int argc, char **argv)
+int main(int argc, char** argv)
 {
+    Workload config;
     int cmd;
-    std::string host("localhost");
-    std::string port("12000");
-    int duration = 60;
-    char *ptr;
+    char* ptr;
 
     /* Initialize the socket subsystem */
     cb_initialize_sockets();
 
-    while ((cmd = getopt(argc, argv, "h:p:d:")) != EOF) {
+    while ((cmd = getopt(argc, argv, "h:p:t:c:d:P:g:k:z:s:R:G")) != EOF) {
         switch (cmd) {
         case 'h' :
             ptr = strchr(optarg, ':');
             if (ptr != NULL) {
                 *ptr = '\0';
-                port.assign(ptr + 1);
+                config.port.assign(ptr + 1);
             }
-            host.assign(optarg);
+            config.host.assign(optarg);
             break;
         case 'p' :
-            port.assign(optarg);
+            config.port.assign(optarg);
+            break;
+        case 't':
+            config.threads = atoi(optarg);
+            break;
+        case 'c':
+            config.connections = atoi(optarg);
             break;
         case 'd':
-            duration = atoi(optarg);
+            config.duration = atoi(optarg);
+            break;
+        case 'P':
+            config.pipeline = atoi(optarg);
+            break;
+        case 'g':
+            config.get_ratio = atoi(optarg);
+            break;
+        case 'k':
+            config.keys = strtoull(optarg, NULL, 10);
+            break;
+        case 'z':
+            config.zipf_theta = atof(optarg);
+            break;
+        case 's':
+            ptr = strchr(optarg, ':');
+            if (ptr != NULL) {
+                *ptr = '\0';
+                config.value_size_max = strtoull(ptr + 1, NULL, 10);
+            }
+            config.value_size_min = strtoull(optarg, NULL, 10);
+            if (ptr == NULL) {
+                config.value_size_max = config.value_size_min;
+            }
+            break;
+        case 'R':
+            config.rate = strtoull(optarg, NULL, 10);
+            break;
+        case 'G':
+            config.greenstack = true;
             break;
         default:
-            fprintf(stderr,
-                    "Usage mcbench [-h host[:port]] [-p port] [-d duration]\n");
+            usage();
             return 1;
         }
     }
 
-    set_test(host, port, duration);
+    if (config.threads < 1 || config.connections < 1 ||
+        config.pipeline < 1 || config.keys < 1 ||
+        config.get_ratio < 0 || config.get_ratio > 100 ||
+        config.zipf_theta < 0.0 || config.zipf_theta >= 1.0 ||
+        config.value_size_max < config.value_size_min) {
+        usage();
+        return 1;
+    }
+
+    stop_requested.store(false);
+
+    std::vector<ThreadStats> stats(config.threads);
+    std::vector<std::thread> workers;
+    const auto start = steady_clock::now();
+    for (int ii = 0; ii < config.threads; ++ii) {
+        workers.emplace_back(worker_main, &config, &stats[ii],
+                             size_t(ii));
+    }
+
+    for (int elapsed = 0; elapsed < config.duration; ++elapsed) {
+        sleep(1);
+        uint64_t ops = 0;
+        for (const auto& ts : stats) {
+            ops += ts.ops;
+        }
+        std::cout << "\r" << (elapsed + 1) << "s: ~"
+                  << ops / uint64_t(elapsed + 1) << " ops/sec";
+        std::cout.flush();
+    }
+
+    stop_requested.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const auto wall = std::chrono::duration_cast<std::chrono::milliseconds>(
+        steady_clock::now() - start).count();
+
+    ThreadStats total;
+    for (const auto& ts : stats) {
+        total.get_latency += ts.get_latency;
+        total.set_latency += ts.set_latency;
+        total.ops += ts.ops;
+        total.errors += ts.errors;
+        total.dropped += ts.dropped;
+    }
+
+    std::cout << "\r" << config.threads << " threads x "
+              << config.connections << " connections, "
+              << total.ops << " ops in " << wall << "ms ("
+              << (wall ? total.ops * 1000 / uint64_t(wall) : total.ops)
+              << " ops/sec)" << std::endl;
+    if (total.errors) {
+        std::cout << "errors: " << total.errors << std::endl;
+    }
+    if (total.dropped) {
+        std::cout << "dropped (connection failures): " << total.dropped
+                  << std::endl;
+    }
+    report_histogram("get", total.get_latency);
+    report_histogram("set", total.set_latency);
 
     return 0;
 }
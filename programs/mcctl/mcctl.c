@@ -333,12 +333,62 @@ static int ioctl_get(BIO *bio, const char *property)
     return result;
 }
 
+/**
+ * Reads a property script from a file and applies it on the server as
+ * a single batch (one round trip, one change-notification sweep).
+ *
+ * The script holds one `property [value]` per line; blank lines and
+ * lines starting with '#' are skipped (by the server, so the file can
+ * be sent verbatim). The server validates every property name before
+ * applying anything.
+ *
+ * @param bio connection to the server.
+ * @param file the script to read.
+ */
+static int ioctl_run(BIO *bio, const char *file)
+{
+    FILE *fp = fopen(file, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s\n", file);
+        return EXIT_FAILURE;
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Failed to determine the size of %s\n", file);
+        fclose(fp);
+        return EXIT_FAILURE;
+    }
+    long size = ftell(fp);
+    rewind(fp);
+
+    char *script = allocate(size > 0 ? (size_t)size : 0);
+    if (script == NULL) {
+        fprintf(stderr, "%s is empty\n", file);
+        fclose(fp);
+        return EXIT_FAILURE;
+    }
+
+    if (fread(script, 1, (size_t)size, fp) != (size_t)size) {
+        fprintf(stderr, "Failed to read %s\n", file);
+        fclose(fp);
+        cb_free(script);
+        return EXIT_FAILURE;
+    }
+    fclose(fp);
+
+    int result = ioctl_set(bio, "batch.apply", script);
+    cb_free(script);
+    return result;
+}
+
 static int usage() {
     fprintf(stderr,
-            "Usage: mcctl [-h host[:port]] [-p port] [-u user] [-P pass] [-s] <get|set> property [value]\n"
+            "Usage: mcctl [-h host[:port]] [-p port] [-u user] [-P pass] [-s] <get|set|run> <property|file> [value]\n"
             "\n"
             "    get <property>           Returns the value of the given property.\n"
-            "    set <property> [value]   Sets `property` to the given value.\n");
+            "    set <property> [value]   Sets `property` to the given value.\n"
+            "    run <file>               Applies the property script in `file`\n"
+            "                             as a single batch.\n");
     return EXIT_FAILURE;
 }
 
@@ -388,7 +438,9 @@ int main(int argc, char** argv) {
     if (optind + 1 >= argc) {
         return usage();
     } else {
-        if (strcmp(argv[optind], "get") == 0 || strcmp(argv[optind], "set") == 0) {
+        if (strcmp(argv[optind], "get") == 0 ||
+            strcmp(argv[optind], "set") == 0 ||
+            strcmp(argv[optind], "run") == 0) {
             const char* property = argv[optind+1];
             if (create_ssl_connection(&ctx, &bio, host, port, user,
                                       pass, secure) != 0) {
@@ -415,6 +467,8 @@ int main(int argc, char** argv) {
                 } else {
                     result = ioctl_set(bio, property, value);
                 }
+            } else {
+                result = ioctl_run(bio, property);
             }
 
             BIO_free_all(bio);
@@ -0,0 +1,491 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * mcreplay replays the traffic from a packet capture against a live
+ * memcached server.
+ *
+ * It operates on the ".cache" directory produced by cbtrace (run
+ * cbtrace on the pcap file first); every stream in the capture becomes
+ * one connection to the target server, and the request packets are
+ * replayed on that connection preserving the original inter-arrival
+ * timing (optionally compressed with -x). The responses are matched
+ * back to the requests by opaque, and at the end the tool prints a
+ * per-opcode table comparing the latency observed in the capture with
+ * the latency observed during the replay - which is the only honest
+ * way of evaluating server changes against a real workload.
+ *
+ * Like cbtrace this tool has rough edges (tcp retransmits etc in the
+ * capture confuse it), but it gets the job done.
+ */
+
+#include "config.h"
+
+#include <memcached/protocol_binary.h>
+#include <platform/platform.h>
+#include <platform/dirutils.h>
+#include <utilities/protocol2text.h>
+
+#include <getopt.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "pcap.h"
+#include "channel.h"
+
+/** Latency accounting for a single opcode, for capture and replay */
+struct OpcodeTimings {
+    OpcodeTimings() : capture_ops(0), capture_usec(0),
+                      replay_ops(0), replay_usec(0) { }
+
+    uint64_t capture_ops;
+    uint64_t capture_usec;
+    uint64_t replay_ops;
+    uint64_t replay_usec;
+};
+
+static std::mutex timings_mutex;
+static std::vector<OpcodeTimings> timings(0x100);
+static uint64_t replay_errors = 0;
+
+static void record_capture(uint8_t opcode, uint64_t usec) {
+    std::lock_guard<std::mutex> guard(timings_mutex);
+    timings[opcode].capture_ops++;
+    timings[opcode].capture_usec += usec;
+}
+
+static void record_replay(uint8_t opcode, uint64_t usec) {
+    std::lock_guard<std::mutex> guard(timings_mutex);
+    timings[opcode].replay_ops++;
+    timings[opcode].replay_usec += usec;
+}
+
+/** Convert a packet capture timestamp to microseconds */
+static uint64_t to_usec(const Channel::MetaInfo& meta) {
+    return uint64_t(meta.sec) * 1000000 + meta.usec;
+}
+
+/**
+ * One stream (connection) from the capture: the client->server request
+ * packets and the server->client response packets.
+ */
+class CapturedStream {
+public:
+    /**
+     * Load the two channel files from the stream directory. Throws
+     * std::runtime_error if the stream doesn't contain both directions.
+     */
+    CapturedStream(const std::string& dir) {
+        MemcachedPacketChannel* channels[2] = { NULL, NULL };
+
+        std::vector<std::string> files;
+        files = CouchbaseDirectoryUtilities::findFilesWithPrefix(dir, "");
+        int ii = 0;
+        for (std::vector<std::string>::iterator iter = files.begin();
+             iter != files.end();
+             ++iter) {
+            size_t idx = iter->rfind(".pcap");
+            if (idx != std::string::npos && (idx + 5) == iter->size()) {
+                if (ii == 2) {
+                    throw std::runtime_error(
+                        "More than two channels in stream " + dir);
+                }
+                iter->resize(idx);
+                channels[ii] = new MemcachedPacketChannel();
+                channels[ii]->load(*iter);
+                ++ii;
+            }
+        }
+
+        if (ii != 2) {
+            while (ii > 0) {
+                delete channels[--ii];
+            }
+            throw std::runtime_error("Missing a direction in stream " + dir);
+        }
+
+        requestChannel.reset(channels[0]);
+        responseChannel.reset(channels[1]);
+        requestChannel->seek();
+        responseChannel->seek();
+
+        if (*requestChannel->getPackets().front().root != 0x80) {
+            requestChannel.swap(responseChannel);
+        }
+
+        requests = requestChannel->getPackets();
+        responses = responseChannel->getPackets();
+    }
+
+    /**
+     * Walk the request / response streams (paired up by opaque, the
+     * same way cbtrace does) and record the latencies observed in the
+     * capture itself.
+     */
+    void collectCaptureTimings(void) {
+        std::list<MemcachedPacket>::iterator a = requests.begin();
+        std::list<MemcachedPacket>::iterator b = responses.begin();
+
+        while (a != requests.end() && b != responses.end() &&
+               a->getOpaque() != b->getOpaque()) {
+            ++b;
+        }
+
+        while (a != requests.end() && b != responses.end()) {
+            uint64_t start = to_usec(a->last);
+            uint64_t end = to_usec(b->last);
+            if (end >= start) {
+                record_capture(a->root[1], end - start);
+            }
+            ++a;
+            ++b;
+        }
+    }
+
+    std::list<MemcachedPacket> requests;
+    std::list<MemcachedPacket> responses;
+
+private:
+    std::unique_ptr<MemcachedPacketChannel> requestChannel;
+    std::unique_ptr<MemcachedPacketChannel> responseChannel;
+};
+
+/**
+ * Replays the requests from a captured stream over a single connection,
+ * preserving the captured inter-arrival timing (divided by the speedup
+ * factor) and timing the responses as they come back.
+ */
+class ReplayConnection {
+public:
+    ReplayConnection(const std::string& _host, const std::string& _port,
+                     double _speedup, CapturedStream& _stream)
+        : host(_host), port(_port), speedup(_speedup), stream(_stream),
+          sock(INVALID_SOCKET) { }
+
+    ~ReplayConnection() {
+        if (sock != INVALID_SOCKET) {
+            closesocket(sock);
+        }
+    }
+
+    void run(void) {
+        if (!connect()) {
+            std::lock_guard<std::mutex> guard(timings_mutex);
+            ++replay_errors;
+            return;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t first_ts = to_usec(stream.requests.front().last);
+
+        for (std::list<MemcachedPacket>::iterator iter =
+                 stream.requests.begin();
+             iter != stream.requests.end(); ++iter) {
+            // Wait until this request is due (original offset from the
+            // start of the stream, compressed by the speedup factor),
+            // draining responses while we wait so that the latency is
+            // attributed to the right request
+            const uint64_t offset =
+                uint64_t((to_usec(iter->last) - first_ts) / speedup);
+            const auto deadline = start + std::chrono::microseconds(offset);
+
+            while (true) {
+                const auto now = std::chrono::steady_clock::now();
+                if (now >= deadline) {
+                    break;
+                }
+                const int wait_ms = int(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - now).count());
+                if (drainResponses(wait_ms > 0 ? wait_ms : 1) == Drain::Closed) {
+                    std::lock_guard<std::mutex> guard(timings_mutex);
+                    ++replay_errors;
+                    return;
+                }
+            }
+
+            if (!sendPacket(*iter)) {
+                std::lock_guard<std::mutex> guard(timings_mutex);
+                ++replay_errors;
+                return;
+            }
+            outstanding[iter->getOpaque()] =
+                std::make_pair(iter->root[1],
+                               std::chrono::steady_clock::now());
+
+            drainResponses(0);
+        }
+
+        // Wait (with an idle timeout) for the tail of the responses
+        while (!outstanding.empty()) {
+            if (drainResponses(2000) != Drain::Data) {
+                break;
+            }
+        }
+    }
+
+private:
+    bool connect(void) {
+        struct addrinfo *ai = NULL;
+        struct addrinfo hints;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_protocol = IPPROTO_TCP;
+        hints.ai_socktype = SOCK_STREAM;
+
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &ai) != 0) {
+            return false;
+        }
+
+        for (struct addrinfo *e = ai; e != NULL; e = e->ai_next) {
+            if ((sock = socket(e->ai_family, e->ai_socktype,
+                               e->ai_protocol)) != -1) {
+                if (::connect(sock, e->ai_addr, e->ai_addrlen) == 0) {
+                    break;
+                }
+                closesocket(sock);
+                sock = INVALID_SOCKET;
+            }
+        }
+
+        freeaddrinfo(ai);
+        return sock != INVALID_SOCKET;
+    }
+
+    bool sendPacket(const MemcachedPacket& packet) {
+        const char* ptr = reinterpret_cast<const char*>(packet.root);
+        size_t nbytes = packet.bodylen + 24;
+
+        while (nbytes > 0) {
+            ssize_t nw = send(sock, ptr, nbytes, 0);
+            if (nw <= 0) {
+                return false;
+            }
+            ptr += nw;
+            nbytes -= nw;
+        }
+        return true;
+    }
+
+    enum class Drain { Data, Idle, Closed };
+
+    /**
+     * Read whatever responses are available (waiting up to timeout_ms
+     * for the first byte) and record the latency of each one.
+     */
+    Drain drainResponses(int timeout_ms) {
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout_ms) != 1) {
+            return Drain::Idle;
+        }
+
+        char chunk[8192];
+        ssize_t nr = recv(sock, chunk, sizeof(chunk), 0);
+        if (nr <= 0) {
+            return Drain::Closed;
+        }
+        buffer.insert(buffer.end(), chunk, chunk + nr);
+
+        while (buffer.size() >= sizeof(protocol_binary_response_header)) {
+            protocol_binary_response_header header;
+            memcpy(header.bytes, buffer.data(), sizeof(header.bytes));
+            const size_t framelen =
+                sizeof(header.bytes) + ntohl(header.response.bodylen);
+            if (buffer.size() < framelen) {
+                break;
+            }
+
+            std::map<uint32_t, Outstanding>::iterator iter =
+                outstanding.find(header.response.opaque);
+            if (iter != outstanding.end()) {
+                const uint64_t usec =
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() -
+                        iter->second.second).count();
+                record_replay(iter->second.first, usec);
+                outstanding.erase(iter);
+            }
+
+            buffer.erase(buffer.begin(), buffer.begin() + framelen);
+        }
+
+        return Drain::Data;
+    }
+
+    typedef std::pair<uint8_t, std::chrono::steady_clock::time_point>
+        Outstanding;
+
+    const std::string host;
+    const std::string port;
+    const double speedup;
+    CapturedStream& stream;
+    SOCKET sock;
+    std::vector<char> buffer;
+    std::map<uint32_t, Outstanding> outstanding;
+};
+
+static void replay_stream(const std::string& dir, const std::string& host,
+                          const std::string& port, double speedup) {
+    try {
+        CapturedStream stream(dir);
+        stream.collectCaptureTimings();
+        if (stream.requests.empty()) {
+            return;
+        }
+        ReplayConnection conn(host, port, speedup, stream);
+        conn.run();
+    } catch (std::runtime_error& e) {
+        std::cerr << "Skipping " << dir << ": " << e.what() << std::endl;
+    }
+}
+
+static void report(void) {
+    printf("%-6s %-30s %10s %12s %12s %8s\n",
+           "opcode", "name", "ops", "capture us", "replay us", "delta");
+    for (int ii = 0; ii < 0x100; ++ii) {
+        const OpcodeTimings& t = timings[ii];
+        if (t.capture_ops == 0 && t.replay_ops == 0) {
+            continue;
+        }
+
+        const char* name = memcached_opcode_2_text(uint8_t(ii));
+        char capture[32] = "-";
+        char replay[32] = "-";
+        char delta[32] = "-";
+
+        if (t.capture_ops > 0) {
+            snprintf(capture, sizeof(capture), "%" PRIu64,
+                     t.capture_usec / t.capture_ops);
+        }
+        if (t.replay_ops > 0) {
+            snprintf(replay, sizeof(replay), "%" PRIu64,
+                     t.replay_usec / t.replay_ops);
+        }
+        if (t.capture_ops > 0 && t.replay_ops > 0 && t.capture_usec > 0) {
+            const double cap = double(t.capture_usec) / t.capture_ops;
+            const double rep = double(t.replay_usec) / t.replay_ops;
+            snprintf(delta, sizeof(delta), "%+.1f%%",
+                     ((rep - cap) / cap) * 100.0);
+        }
+
+        printf("0x%02x   %-30s %10" PRIu64 " %12s %12s %8s\n",
+               ii, name ? name : "", t.replay_ops, capture, replay, delta);
+    }
+
+    if (replay_errors > 0) {
+        printf("\n%" PRIu64 " stream(s) aborted due to connection errors\n",
+               replay_errors);
+    }
+}
+
+int main(int argc, char** argv) {
+    int cmd;
+    const char* port = "11211";
+    const char* host = NULL;
+    double speedup = 1.0;
+    char* ptr;
+
+    cb_initialize_sockets();
+
+    while ((cmd = getopt(argc, argv, "h:p:x:")) != -1) {
+        switch (cmd) {
+        case 'h':
+            host = optarg;
+            ptr = strchr(optarg, ':');
+            if (ptr != NULL) {
+                *ptr = '\0';
+                port = ptr + 1;
+            }
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        case 'x':
+            speedup = atof(optarg);
+            if (speedup <= 0) {
+                fprintf(stderr, "Speedup factor must be > 0\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: mcreplay [-h host[:port]] [-p port] [-x factor] "
+                    "capture.cache\n"
+                    "\n"
+                    "  -x   compress the captured inter-arrival timing by\n"
+                    "       the given factor (2 = replay twice as fast)\n"
+                    "\n"
+                    "The capture.cache directory is created by running\n"
+                    "cbtrace on the pcap file.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (host == NULL) {
+        host = "localhost";
+    }
+
+    if (optind == argc) {
+        fprintf(stderr, "Usage: mcreplay [options] capture.cache\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> streams;
+    streams = CouchbaseDirectoryUtilities::findFilesWithPrefix(argv[optind],
+                                                               "");
+    if (streams.empty()) {
+        std::cerr << "No streams found in " << argv[optind] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // One thread per captured connection; they all share the same
+    // start time reference through their own stream offsets
+    std::vector<std::thread> threads;
+    for (std::vector<std::string>::iterator iter = streams.begin();
+         iter != streams.end(); ++iter) {
+        threads.emplace_back(replay_stream, *iter, std::string(host),
+                             std::string(port), speedup);
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    report();
+    return EXIT_SUCCESS;
+}
@@ -21,6 +21,14 @@
  *         increase the size by one byte until it fails to store the
  *         object. This program was developed to track down MB-14288
  *         in moxi, and may be useful at a later time.
+ *
+ *         It also has a batch mode (-B) for operational bulk loads:
+ *         tab-separated key/value lines are read from standard input
+ *         and stored over the single authenticated connection with a
+ *         configurable number of requests in flight, with progress
+ *         reporting and a per-status error summary. A runbook which
+ *         used to shell-loop one mcset invocation per key can pipe
+ *         its whole fix-up list through one process instead.
  */
 #include "config.h"
 
@@ -32,6 +40,7 @@
 #include <memcached/util.h>
 
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <strings.h>
@@ -136,6 +145,175 @@ static int set_binary(BIO *bio, const char *key, size_t size) {
     return EXIT_SUCCESS;
 }
 
+/**
+ * The number of batch mode failures which are reported with their key
+ * before further per-key reports are suppressed (the per-status summary
+ * printed at the end always covers every failure).
+ */
+#define BATCH_FAILURE_REPORT_LIMIT 20
+
+/**
+ * Statistics accumulated while draining batch mode responses.
+ * The server may (in theory) return any 16 bit status code, but all of
+ * the codes in use fit in a byte so they are counted in a small array
+ * and everything else ends up in the "other" bucket.
+ */
+struct batch_stats {
+    uint64_t stored;
+    uint64_t failed;
+    uint64_t status_counts[256];
+    uint64_t status_other;
+    int failures_reported;
+};
+
+/**
+ * Stream a single SET request without waiting for the response. The
+ * response is reaped later by recv_batch_response() so that multiple
+ * requests may be in flight on the connection.
+ */
+static void send_batch_set(BIO *bio, const char *key, size_t nkey,
+                           const char *value, size_t nvalue) {
+    protocol_binary_request_set request = {
+        .message.header.request.magic = PROTOCOL_BINARY_REQ,
+        .message.header.request.opcode = PROTOCOL_BINARY_CMD_SET,
+        .message.header.request.extlen = 8,
+        .message.header.request.keylen = htons((uint16_t)nkey),
+        .message.header.request.bodylen = htonl((uint32_t)(8 + nkey + nvalue)),
+        .message.body.flags = 0,
+        .message.body.expiration = 0
+    };
+    ensure_send(bio, &request, (int)sizeof(request.bytes));
+    ensure_send(bio, key, (int)nkey);
+    if (nvalue > 0) {
+        ensure_send(bio, value, (int)nvalue);
+    }
+}
+
+/**
+ * Reap the oldest outstanding response for the batch. The binary
+ * protocol guarantees responses in request order on a connection, so
+ * the key ring buffer tells us which key a failure belongs to.
+ */
+static void recv_batch_response(BIO *bio, char **pending, size_t depth,
+                                uint64_t *received,
+                                struct batch_stats *stats) {
+    protocol_binary_response_no_extras response;
+    ensure_recv(bio, &response, sizeof(response.bytes));
+    uint32_t bodylen = ntohl(response.message.header.response.bodylen);
+    while (bodylen > 0) {
+        char sink[1024];
+        uint32_t chunk = bodylen > sizeof(sink) ? (uint32_t)sizeof(sink)
+                                                : bodylen;
+        ensure_recv(bio, sink, (int)chunk);
+        bodylen -= chunk;
+    }
+
+    const uint16_t status = ntohs(response.message.header.response.status);
+    char *key = pending[*received % depth];
+    if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        ++stats->stored;
+    } else {
+        ++stats->failed;
+        if (status < 256) {
+            ++stats->status_counts[status];
+        } else {
+            ++stats->status_other;
+        }
+        if (stats->failures_reported < BATCH_FAILURE_REPORT_LIMIT) {
+            fprintf(stderr, "\rFAILED %s: %s\n", key,
+                    memcached_status_2_text(status));
+            ++stats->failures_reported;
+            if (stats->failures_reported == BATCH_FAILURE_REPORT_LIMIT) {
+                fprintf(stderr, "(suppressing further per-key failure "
+                        "reports; see the summary)\n");
+            }
+        }
+    }
+    cb_free(key);
+    pending[*received % depth] = NULL;
+    ++(*received);
+}
+
+/**
+ * Batch mode: read tab-separated key/value lines from stdin and store
+ * them over the (already authenticated) connection, keeping up to
+ * "depth" requests in flight. A line without a tab stores an empty
+ * value. Returns EXIT_FAILURE if any set failed.
+ */
+static int set_batch(BIO *bio, size_t depth) {
+    const size_t line_max = 1024 * 1024;
+    char *line = cb_malloc(line_max);
+    char **pending = cb_calloc(depth, sizeof(char*));
+    struct batch_stats stats;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+
+    if (line == NULL || pending == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&stats, 0, sizeof(stats));
+
+    while (fgets(line, (int)line_max, stdin) != NULL) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+
+        char *value = "";
+        size_t nvalue = 0;
+        char *tab = strchr(line, '\t');
+        if (tab != NULL) {
+            *tab = '\0';
+            value = tab + 1;
+            nvalue = len - (size_t)(value - line);
+        }
+
+        const size_t nkey = strlen(line);
+        if (nkey == 0) {
+            continue;
+        }
+
+        if (sent - received == depth) {
+            recv_batch_response(bio, pending, depth, &received, &stats);
+        }
+
+        send_batch_set(bio, line, nkey, value, nvalue);
+        pending[sent % depth] = cb_strdup(line);
+        ++sent;
+
+        if (sent % 10000 == 0) {
+            fprintf(stderr, "\r%" PRIu64 " sent, %" PRIu64 " stored, %"
+                    PRIu64 " failed", sent, stats.stored, stats.failed);
+            fflush(stderr);
+        }
+    }
+
+    while (received < sent) {
+        recv_batch_response(bio, pending, depth, &received, &stats);
+    }
+
+    fprintf(stderr, "\r");
+    fprintf(stdout, "Batch complete: %" PRIu64 " sets, %" PRIu64 " stored, %"
+            PRIu64 " failed\n", sent, stats.stored, stats.failed);
+    for (int ii = 0; ii < 256; ++ii) {
+        if (stats.status_counts[ii] > 0) {
+            fprintf(stdout, "  %s: %" PRIu64 "\n",
+                    memcached_status_2_text((uint16_t)ii),
+                    stats.status_counts[ii]);
+        }
+    }
+    if (stats.status_other > 0) {
+        fprintf(stdout, "  (other status codes): %" PRIu64 "\n",
+                stats.status_other);
+    }
+
+    cb_free(line);
+    cb_free(pending);
+
+    return stats.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char** argv) {
     int cmd;
     const char *port = "11210";
@@ -148,16 +326,29 @@ int main(int argc, char** argv) {
     BIO* bio;
     bool tcp_nodelay = false;
     bool ascii = false;
+    bool batch = false;
     size_t size = 0;
+    size_t depth = 64;
 
     /* Initialize the socket subsystem */
     cb_initialize_sockets();
 
-    while ((cmd = getopt(argc, argv, "Th:p:u:b:P:sAS:")) != EOF) {
+    while ((cmd = getopt(argc, argv, "Th:p:u:b:P:sAS:Bd:")) != EOF) {
         switch (cmd) {
         case 'A':
             ascii = true;
             break;
+        case 'B':
+            batch = true;
+            break;
+        case 'd':
+            cb_assert(optarg != NULL);
+            depth = atoi(optarg);
+            if (depth == 0) {
+                fprintf(stderr, "Pipeline depth must be at least 1\n");
+                return EXIT_FAILURE;
+            }
+            break;
         case 'S':
             /* getopt() guarantees optarg is non-null on a successful call, however
                Clang Static Analyzer is not aware of this. */
@@ -198,6 +389,7 @@ int main(int argc, char** argv) {
         default:
             fprintf(stderr,
                     "Usage: mcset [-h host[:port]] [-p port] [-b bucket] [-u user] [-P pass] [-s] [-T] [-A] [-S size] key\n"
+                    "       mcset -B [-d depth] [connection options] < keyvalues\n"
                     "\n"
                     "  -h hostname[:port]  Host (and optional port number) to store key to\n"
                     "  -p port             Port number\n"
@@ -208,12 +400,19 @@ int main(int argc, char** argv) {
                     "  -T                  Request TCP_NODELAY from the server\n"
                     "  -A                  Use ASCII protocol (will not work if -u/-b/-P is used)\n"
                     "  -S size             The size to start setting (and then grow with 1b until it fails\n"
+                    "  -B                  Batch mode; read tab-separated key/value lines from stdin\n"
+                    "  -d depth            Number of batch requests to keep in flight (default: 64)\n"
                     "  key                 The name of the key to set\n");
             return 1;
         }
     }
 
-    if (optind == argc) {
+    if (batch && ascii) {
+        fprintf(stderr, "Batch mode requires the binary protocol\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!batch && optind == argc) {
         fprintf(stderr, "You need to specify a key\n");
         return EXIT_FAILURE;
     }
@@ -227,14 +426,18 @@ int main(int argc, char** argv) {
     }
 
     int ret = EXIT_FAILURE;
-    do {
-        if (ascii) {
-            ret = set_ascii(bio, argv[optind], size);
-        } else {
-            ret = set_binary(bio, argv[optind], size);
-        }
-        ++size;
-    } while (ret == EXIT_SUCCESS);
+    if (batch) {
+        ret = set_batch(bio, depth);
+    } else {
+        do {
+            if (ascii) {
+                ret = set_ascii(bio, argv[optind], size);
+            } else {
+                ret = set_binary(bio, argv[optind], size);
+            }
+            ++size;
+        } while (ret == EXIT_SUCCESS);
+    }
 
     BIO_free_all(bio);
     if (secure) {
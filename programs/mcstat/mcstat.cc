@@ -0,0 +1,406 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * mcstat - request statistics from one or more memcached nodes.
+ *
+ * Multiple nodes (repeated -h options) are scraped in parallel, one
+ * thread per node. With -i the nodes are scraped repeatedly over the
+ * same connections, so the (potentially expensive) SASL authentication
+ * is paid once per node instead of once per scrape; a broken
+ * connection is re-established on the next scrape without taking the
+ * other nodes down with it.
+ *
+ * With -j every scrape is printed as a single line of JSON for direct
+ * ingestion into a monitoring pipeline. Combine with the server's
+ * "select" stat group (e.g. "mcstat -j 'select memory,worker'") to
+ * fetch exactly the stat groups the dashboard needs in one request.
+ */
+#include "config.h"
+
+#include <memcached/protocol_binary.h>
+#include <memcached/openssl.h>
+#include <memcached/util.h>
+#include <platform/platform.h>
+
+#include <getopt.h>
+#include <cJSON.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <utilities/protocol2text.h>
+
+#include "programs/utilities.h"
+
+/** A node to scrape */
+struct Node {
+    std::string host;
+    std::string port;
+};
+
+/* Command line configuration, read only once the workers are running */
+static const char* user = nullptr;
+static const char* pass = nullptr;
+static int secure = 0;
+static bool tcp_nodelay = false;
+static bool json_output = false;
+static int interval = 0; /* seconds between scrapes */
+static int count = 1;    /* number of scrapes per node (0 = forever) */
+static std::vector<std::string> statkeys;
+static bool many_nodes = false;
+
+/* stdout is shared by the workers; every scrape is printed in one go */
+static std::mutex output_mutex;
+
+/* Set when a scrape of any node failed; becomes the exit code */
+static std::atomic<int> exit_code(0);
+
+/**
+ * Send to / receive from the server without exiting the process on
+ * failure (one node being down must not abort the scrape of the
+ * others, which is what the shared ensure_send/ensure_recv would do).
+ *
+ * @return false when the connection is broken
+ */
+static bool try_send(BIO* bio, const void* data, int nbytes) {
+    int total = 0;
+
+    while (total < nbytes) {
+        int nw = BIO_write(bio, (const char*)data + total, nbytes - total);
+        if (nw <= 0) {
+            if (BIO_should_retry(bio) == 0) {
+                return false;
+            }
+        } else {
+            total += nw;
+        }
+    }
+    return true;
+}
+
+static bool try_recv(BIO* bio, void* data, int nbytes) {
+    int total = 0;
+
+    while (total < nbytes) {
+        int nr = BIO_read(bio, (char*)data + total, nbytes - total);
+        if (nr <= 0) {
+            if (BIO_should_retry(bio) == 0) {
+                return false;
+            }
+        } else {
+            total += nr;
+        }
+    }
+    return true;
+}
+
+typedef std::vector<std::pair<std::string, std::string> > StatPairs;
+
+/**
+ * Request a stat group from the server
+ *
+ * @param node the node being scraped (for error messages)
+ * @param bio socket connected to the server
+ * @param key the name of the stat group to receive (empty == the
+ *            default set)
+ * @param stats where to append the returned key/value pairs
+ * @return false when the connection is broken (a server side error is
+ *         reported to stderr but doesn't invalidate the connection)
+ */
+static bool request_stat(const Node& node, BIO* bio, const std::string& key,
+                         StatPairs& stats) {
+    protocol_binary_request_stats request;
+    protocol_binary_response_no_extras response;
+
+    memset(&request, 0, sizeof(request));
+    request.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    request.message.header.request.opcode = PROTOCOL_BINARY_CMD_STAT;
+    request.message.header.request.keylen = htons(uint16_t(key.size()));
+    request.message.header.request.bodylen = htonl(uint32_t(key.size()));
+
+    if (!try_send(bio, &request, sizeof(request)) ||
+        (!key.empty() && !try_send(bio, key.data(), int(key.size())))) {
+        return false;
+    }
+
+    std::vector<char> buffer;
+    do {
+        if (!try_recv(bio, &response, sizeof(response.bytes))) {
+            return false;
+        }
+        const uint16_t keylen = ntohs(response.message.header.response.keylen);
+        const uint32_t bodylen = ntohl(response.message.header.response.bodylen);
+
+        buffer.resize(bodylen);
+        if (bodylen > 0 && !try_recv(bio, buffer.data(), int(bodylen))) {
+            return false;
+        }
+
+        const uint16_t err = ntohs(response.message.header.response.status);
+        if (err != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            fprintf(stderr, "%s:%s: error requesting stat%s%s%s: %s\n",
+                    node.host.c_str(), node.port.c_str(),
+                    key.empty() ? "s" : " '", key.c_str(),
+                    key.empty() ? "" : "'",
+                    memcached_status_2_text(
+                        protocol_binary_response_status(err)));
+            exit_code.store(EXIT_FAILURE);
+            /* An error response isn't followed by a terminator */
+            return true;
+        }
+
+        if (bodylen > 0) {
+            stats.push_back(std::make_pair(
+                std::string(buffer.data(), keylen),
+                std::string(buffer.data() + keylen, bodylen - keylen)));
+        }
+    } while (response.message.header.response.bodylen != 0);
+
+    return true;
+}
+
+/**
+ * Print a scrape the classic way: one "key value" line per stat,
+ * prefixed with the node when more than one is being scraped
+ */
+static void print_text(const Node& node, const StatPairs& stats) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    for (const auto& stat : stats) {
+        if (many_nodes) {
+            printf("%s:%s ", node.host.c_str(), node.port.c_str());
+        }
+        if (!stat.first.empty()) {
+            printf("%s ", stat.first.c_str());
+        }
+        printf("%s\n", stat.second.c_str());
+    }
+    fflush(stdout);
+}
+
+/**
+ * Print a scrape as a single line of JSON: the node, the scrape time
+ * and an object with all of the stats (values which look like numbers
+ * are emitted as numbers)
+ */
+static void print_json(const Node& node, const StatPairs& stats) {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "host", node.host.c_str());
+    cJSON_AddStringToObject(root, "port", node.port.c_str());
+    cJSON_AddNumberToObject(root, "ts", double(time(NULL)));
+
+    cJSON* obj = cJSON_CreateObject();
+    for (const auto& stat : stats) {
+        uint64_t numeric;
+        if (!stat.second.empty() &&
+            safe_strtoull(stat.second.c_str(), &numeric) &&
+            numeric < (uint64_t(1) << 53)) {
+            /* Doubles hold integers up to 2^53 exactly; bigger values
+               stay strings rather than getting silently rounded */
+            cJSON_AddNumberToObject(obj, stat.first.c_str(), double(numeric));
+        } else {
+            cJSON_AddStringToObject(obj, stat.first.c_str(),
+                                    stat.second.c_str());
+        }
+    }
+    cJSON_AddItemToObject(root, "stats", obj);
+
+    char* text = cJSON_PrintUnformatted(root);
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        printf("%s\n", text);
+        fflush(stdout);
+    }
+    cJSON_Free(text);
+    cJSON_Delete(root);
+}
+
+/**
+ * Scrape a single node 'count' times, 'interval' seconds apart,
+ * keeping the authenticated connection alive between the scrapes and
+ * re-establishing it when it breaks
+ */
+static void scrape_node(const Node& node) {
+    SSL_CTX* ctx = nullptr;
+    BIO* bio = nullptr;
+
+    for (int scrape = 0; count == 0 || scrape < count; ++scrape) {
+        if (scrape > 0) {
+            std::this_thread::sleep_for(std::chrono::seconds(interval));
+        }
+
+        if (bio == nullptr) {
+            if (create_ssl_connection(&ctx, &bio, node.host.c_str(),
+                                      node.port.c_str(), user, pass,
+                                      secure) != 0) {
+                exit_code.store(EXIT_FAILURE);
+                continue;
+            }
+            if (tcp_nodelay && !enable_tcp_nodelay(bio)) {
+                exit_code.store(EXIT_FAILURE);
+            }
+        }
+
+        StatPairs stats;
+        bool ok;
+        if (statkeys.empty()) {
+            ok = request_stat(node, bio, "", stats);
+        } else {
+            ok = true;
+            for (const auto& key : statkeys) {
+                if (!(ok = request_stat(node, bio, key, stats))) {
+                    break;
+                }
+            }
+        }
+
+        if (!ok) {
+            fprintf(stderr, "%s:%s: connection broken\n",
+                    node.host.c_str(), node.port.c_str());
+            exit_code.store(EXIT_FAILURE);
+            BIO_free_all(bio);
+            bio = nullptr;
+            if (secure && ctx != nullptr) {
+                SSL_CTX_free(ctx);
+                ctx = nullptr;
+            }
+            continue;
+        }
+
+        if (json_output) {
+            print_json(node, stats);
+        } else {
+            print_text(node, stats);
+        }
+    }
+
+    if (bio != nullptr) {
+        BIO_free_all(bio);
+    }
+    if (secure && ctx != nullptr) {
+        SSL_CTX_free(ctx);
+    }
+}
+
+int main(int argc, char** argv) {
+    int cmd;
+    const char* port = "11210";
+    std::vector<Node> nodes;
+    bool count_given = false;
+    char* ptr;
+
+    /* Initialize the socket subsystem */
+    cb_initialize_sockets();
+
+    while ((cmd = getopt(argc, argv, "Tjh:p:u:b:P:si:c:")) != EOF) {
+        switch (cmd) {
+        case 'T' :
+            tcp_nodelay = true;
+            break;
+        case 'j':
+            json_output = true;
+            break;
+        case 'h' :
+            {
+                Node node;
+                node.host = optarg;
+                ptr = strchr(optarg, ':');
+                if (ptr != NULL) {
+                    node.host.resize(ptr - optarg);
+                    node.port = ptr + 1;
+                }
+                nodes.push_back(node);
+            }
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        case 'b' :
+        case 'u' :
+            /* Currently -u and -b are synonymous - only allow the user to
+             * specify one. */
+            if (user == NULL) {
+                user = optarg;
+            } else {
+                fprintf(stderr, "Error: cannot specify both -u (user) and -b (bucket).\n");
+                return 1;
+            }
+            break;
+        case 'P':
+            pass = optarg;
+            break;
+        case 's':
+            secure = 1;
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            if (interval < 1) {
+                fprintf(stderr, "Error: interval must be at least 1 second.\n");
+                return 1;
+            }
+            break;
+        case 'c':
+            count = atoi(optarg);
+            count_given = true;
+            if (count < 0) {
+                fprintf(stderr, "Error: invalid scrape count.\n");
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: mcstat [-h host[:port]]... [-p port] [-b bucket] [-u user] [-P pass]\n"
+                    "              [-s] [-T] [-j] [-i interval [-c count]] statkey ...\n"
+                    "\n"
+                    "  -h hostname[:port]  Host (and optional port number) to retrieve stats from;\n"
+                    "                      may be repeated to scrape several nodes in parallel\n"
+                    "  -p port             Port number for hosts given without one\n"
+                    "  -u username         Username (currently synonymous with -b)\n"
+                    "  -b bucket           Bucket name\n"
+                    "  -P password         Password (if bucket is password-protected)\n"
+                    "  -s                  Connect to node securely (using SSL)\n"
+                    "  -T                  Request TCP_NODELAY from the server\n"
+                    "  -j                  Print each scrape as a single line of JSON\n"
+                    "  -i interval         Scrape repeatedly, interval seconds apart, reusing\n"
+                    "                      the authenticated connections\n"
+                    "  -c count            Stop after count scrapes (with -i; default forever)\n"
+                    "  statkey ...         Statistic(s) to request\n");
+            return 1;
+        }
+    }
+
+    if (nodes.empty()) {
+        Node node;
+        node.host = "localhost";
+        nodes.push_back(node);
+    }
+    for (auto& node : nodes) {
+        if (node.port.empty()) {
+            node.port = port;
+        }
+    }
+    many_nodes = nodes.size() > 1;
+
+    if (interval > 0 && !count_given) {
+        count = 0; /* scrape forever */
+    }
+
+    for (int ii = optind; ii < argc; ++ii) {
+        statkeys.push_back(argv[ii]);
+    }
+
+    std::vector<std::thread> workers;
+    for (const auto& node : nodes) {
+        workers.push_back(std::thread(scrape_node, node));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    return exit_code.load() == 0 ? EXIT_SUCCESS : exit_code.load();
+}
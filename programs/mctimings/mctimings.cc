@@ -18,6 +18,7 @@
 #include "config.h"
 
 #include <array>
+#include <map>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -109,6 +110,45 @@ public:
         return total;
     }
 
+    /**
+     * Approximate a percentile from the histogram: the upper bound (in
+     * usec) of the first bin where the cumulative count reaches the
+     * requested fraction of the total.
+     */
+    uint64_t getPercentile(double pct) const {
+        if (total == 0) {
+            return 0;
+        }
+        const uint64_t goal = uint64_t(pct * double(total));
+
+        if (ns.cumulative_count >= goal) {
+            return 1;
+        }
+        for (size_t ii = 0; ii < us.size(); ++ii) {
+            if (us[ii].cumulative_count >= goal) {
+                return (ii + 1) * 10;
+            }
+        }
+        for (size_t ii = 1; ii < ms.size(); ++ii) {
+            if (ms[ii].cumulative_count >= goal) {
+                return ii * 1000;
+            }
+        }
+        for (size_t ii = 0; ii < halfsec.size(); ++ii) {
+            if (halfsec[ii].cumulative_count >= goal) {
+                return (ii + 1) * 500 * 1000;
+            }
+        }
+        // [5-9], [10-19], [20-39], [40-79], [80-inf] seconds
+        static const uint64_t wayout_high[5] = {10, 20, 40, 80, 80};
+        for (size_t ii = 0; ii < wayout.size(); ++ii) {
+            if (wayout[ii].cumulative_count >= goal) {
+                return wayout_high[ii] * 1000000;
+            }
+        }
+        return wayout_high[4] * 1000000;
+    }
+
     void dumpHistogram(const std::string &opcode)
     {
         std::cout << "The following data is collected for \""
@@ -352,6 +392,83 @@ static void request_cmd_timings(BIO *bio, const char *bucket, uint8_t opcode,
 
 }
 
+/**
+ * Fetch the delta histogram for an opcode: only the samples recorded
+ * since our previous delta request. Uses the second extras byte of
+ * CMD_GET_CMD_TIMER; the server keeps the cursor per connection, so
+ * each response only carries what's new.
+ */
+static void request_cmd_timings_delta(BIO *bio, const char *bucket,
+                                      uint8_t opcode, Timings &timings) {
+    protocol_binary_request_header request;
+    protocol_binary_response_no_extras response;
+
+    uint16_t keylen = (bucket == NULL) ? 0 : strlen(bucket);
+    uint8_t extras[2] = {opcode, 1};
+
+    memset(&request, 0, sizeof(request));
+    request.request.magic = PROTOCOL_BINARY_REQ;
+    request.request.opcode = PROTOCOL_BINARY_CMD_GET_CMD_TIMER;
+    request.request.keylen = htons(keylen);
+    request.request.extlen = 2;
+    request.request.bodylen = htonl((uint32_t)(keylen + 2));
+
+    ensure_send(bio, &request, sizeof(request.bytes));
+    ensure_send(bio, extras, sizeof(extras));
+    ensure_send(bio, bucket, keylen);
+
+    ensure_recv(bio, &response, sizeof(response.bytes));
+    uint32_t buffsize = ntohl(response.message.header.response.bodylen);
+    std::vector<char> buffer(buffsize + 1, 0);
+
+    ensure_recv(bio, buffer.data(), buffsize);
+
+    protocol_binary_response_status status;
+    status = (protocol_binary_response_status)ntohs(response.message.header.response.status);
+    if (status != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        if (status == PROTOCOL_BINARY_RESPONSE_EINVAL) {
+            std::cerr << "The server does not support delta timings"
+                      << std::endl;
+        } else {
+            std::cerr << "Command failed: "
+                      << memcached_status_2_text(status)
+                      << std::endl;
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    try {
+        timings.initialize(buffer);
+    } catch (std::string &msg) {
+        std::cerr << "Fatal error: " << msg << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Render rolling per-second percentiles for the given opcodes using
+ * delta requests, so only the histogram changes cross the wire on
+ * every tick. Runs until interrupted.
+ */
+static void watch_cmd_timings(BIO *bio, const char *bucket,
+                              const std::vector<uint8_t> &opcodes) {
+    while (true) {
+        for (auto opcode : opcodes) {
+            Timings timings;
+            request_cmd_timings_delta(bio, bucket, opcode, timings);
+            std::cout << opcode2string(opcode) << ": "
+                      << timings.getTotal() << " ops";
+            if (timings.getTotal() > 0) {
+                std::cout << " p50=" << timings.getPercentile(0.5) << "us"
+                          << " p99=" << timings.getPercentile(0.99) << "us";
+            }
+            std::cout << "   ";
+        }
+        std::cout << std::endl;
+        sleep(1);
+    }
+}
+
 static void request_stat_timings(BIO *bio, const char* key, int verbose) {
     protocol_binary_request_stats request;
     protocol_binary_response_stats response;
@@ -405,6 +522,156 @@ static void request_stat_timings(BIO *bio, const char* key, int verbose) {
     }
 }
 
+/**
+ * Read a number out of a percentile JSON object, or 0 when the key
+ * is absent.
+ */
+static uint64_t getLaneValue(cJSON *root, const char *key) {
+    cJSON *obj = cJSON_GetObjectItem(root, key);
+    if (obj == nullptr) {
+        return 0;
+    }
+    return uint64_t(obj->valuedouble);
+}
+
+/**
+ * Dump the traffic-lane timings: the latency percentiles the server
+ * records per (transport, priority class, opcode) triple (see "stats
+ * class-timings"; the group needs node management privileges).
+ *
+ * The filter is a colon separated list of dimension values - a
+ * transport ("ssl" or "plain"), a priority class and/or an opcode,
+ * e.g. "ssl:High" or "plain:GET" - and only the lanes matching every
+ * token are printed; "all" prints everything. After the per-opcode
+ * rows each matching lane gets a summary line aggregating its total
+ * operation count and its worst per-opcode p99, which is the number a
+ * per-lane SLO should be checked against.
+ */
+static void request_lane_timings(BIO *bio, const char *filter) {
+    const char *key = "class-timings";
+    const uint16_t keylen = (uint16_t)strlen(key);
+    protocol_binary_request_stats request;
+
+    memset(&request, 0, sizeof(request));
+    request.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    request.message.header.request.opcode = PROTOCOL_BINARY_CMD_STAT;
+    request.message.header.request.keylen = htons(keylen);
+    request.message.header.request.bodylen = htonl(keylen);
+
+    ensure_send(bio, &request, sizeof(request.bytes));
+    ensure_send(bio, key, keylen);
+
+    std::vector<std::string> tokens;
+    if (filter != nullptr && strcmp(filter, "all") != 0) {
+        std::string text(filter);
+        size_t pos = 0;
+        while (pos < text.size()) {
+            auto next = text.find(':', pos);
+            if (next == std::string::npos) {
+                next = text.size();
+            }
+            if (next > pos) {
+                tokens.push_back(text.substr(pos, next - pos));
+            }
+            pos = next + 1;
+        }
+    }
+
+    struct LaneSummary {
+        uint64_t total;
+        uint64_t worst_p99;
+        std::string worst_opcode;
+    };
+    std::map<std::string, LaneSummary> summary;
+
+    while (true) {
+        protocol_binary_response_no_extras response;
+        ensure_recv(bio, &response, sizeof(response.bytes));
+
+        auto status = (protocol_binary_response_status)
+            ntohs(response.message.header.response.status);
+        if (status != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            if (status == PROTOCOL_BINARY_RESPONSE_EACCESS) {
+                std::cerr << "Not authorized to access timings data"
+                          << std::endl;
+            } else {
+                std::cerr << "Command failed: "
+                          << memcached_status_2_text(status)
+                          << std::endl;
+            }
+            exit(EXIT_FAILURE);
+        }
+
+        uint16_t klen = ntohs(response.message.header.response.keylen);
+        uint32_t vlen = ntohl(response.message.header.response.bodylen) - klen;
+        if (klen == 0 && vlen == 0) {
+            // the terminating packet of the stats response
+            break;
+        }
+
+        std::vector<char> kbuf(klen + 1, 0);
+        std::vector<char> vbuf(vlen + 1, 0);
+        ensure_recv(bio, kbuf.data(), klen);
+        ensure_recv(bio, vbuf.data(), vlen);
+
+        // The key is "transport:priority:opcode"
+        const std::string statkey(kbuf.data());
+        const auto first = statkey.find(':');
+        const auto second = statkey.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos) {
+            continue;
+        }
+        const std::string transport = statkey.substr(0, first);
+        const std::string priority = statkey.substr(first + 1,
+                                                    second - first - 1);
+        const std::string opcode = statkey.substr(second + 1);
+
+        bool match = true;
+        for (const auto& token : tokens) {
+            if (token != transport && token != priority && token != opcode) {
+                match = false;
+                break;
+            }
+        }
+        if (!match) {
+            continue;
+        }
+
+        auto *json = cJSON_Parse(vbuf.data());
+        if (json == nullptr) {
+            std::cerr << "Failed to decode json: \"" << vbuf.data() << "\""
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        const uint64_t total = getLaneValue(json, "total");
+        const uint64_t p50 = getLaneValue(json, "p50");
+        const uint64_t p99 = getLaneValue(json, "p99");
+        const uint64_t p999 = getLaneValue(json, "p99.9");
+        const uint64_t max = getLaneValue(json, "max");
+        cJSON_Delete(json);
+
+        std::cout << transport << ":" << priority << " " << opcode << " "
+                  << total << " ops"
+                  << " p50=" << p50 << "us"
+                  << " p99=" << p99 << "us"
+                  << " p99.9=" << p999 << "us"
+                  << " max=" << max << "us" << std::endl;
+
+        auto& lane = summary[transport + ":" + priority];
+        lane.total += total;
+        if (p99 >= lane.worst_p99) {
+            lane.worst_p99 = p99;
+            lane.worst_opcode = opcode;
+        }
+    }
+
+    for (const auto& entry : summary) {
+        std::cout << entry.first << ": " << entry.second.total
+                  << " ops total, worst p99 " << entry.second.worst_p99
+                  << "us (" << entry.second.worst_opcode << ")" << std::endl;
+    }
+}
+
 int main(int argc, char** argv) {
     int cmd;
     const char *port = "11210";
@@ -414,6 +681,8 @@ int main(int argc, char** argv) {
     const char *bucket = NULL;
     int verbose = 0;
     int secure = 0;
+    int watch = 0;
+    const char *lanefilter = NULL;
     char *ptr;
     SSL_CTX* ctx;
     BIO* bio;
@@ -421,7 +690,7 @@ int main(int argc, char** argv) {
     /* Initialize the socket subsystem */
     cb_initialize_sockets();
 
-    while ((cmd = getopt(argc, argv, "h:p:u:P:b:sv")) != EOF) {
+    while ((cmd = getopt(argc, argv, "h:p:u:P:b:l:svw")) != EOF) {
         switch (cmd) {
         case 'h' :
             host = optarg;
@@ -443,18 +712,29 @@ int main(int argc, char** argv) {
         case 'b':
             bucket = optarg;
             break;
+        case 'l':
+            lanefilter = optarg;
+            break;
         case 's':
             secure = 1;
             break;
         case 'v':
             verbose = 1;
             break;
+        case 'w':
+            watch = 1;
+            break;
         default:
             std::cerr << "Usage mctimings [-h host[:port]] [-p port] [-u user]"
-                      << " [-P pass] [-b bucket] [-s] -v [opcode / stat_name]*" << std::endl
+                      << " [-P pass] [-b bucket] [-s] [-w] [-l lane-filter] -v [opcode / stat_name]*" << std::endl
+                      << std::endl
+                      << "The lane filter is a colon separated list of a transport (ssl/plain)," << std::endl
+                      << "a priority class and/or an opcode; \"all\" matches every lane." << std::endl
                       << std::endl
                       << "Example:" << std::endl
-                      << "    mctimings -h localhost:11210 -v GET SET";
+                      << "    mctimings -h localhost:11210 -v GET SET" << std::endl
+                      << "    mctimings -h localhost:11210 -w GET SET" << std::endl
+                      << "    mctimings -h localhost:11210 -l ssl:High";
             exit(EXIT_FAILURE);
         }
     }
@@ -463,6 +743,42 @@ int main(int argc, char** argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (lanefilter != NULL) {
+        request_lane_timings(bio, lanefilter);
+        BIO_free_all(bio);
+        if (secure) {
+            SSL_CTX_free(ctx);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (watch) {
+        if (optind == argc) {
+            std::cerr << "Watch mode needs an explicit list of opcodes"
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (bucket != NULL && strcmp(bucket, "/all/") != 0) {
+            // The server side cursor follows the connected bucket (or
+            // the aggregated histogram); by-name lookups can't be
+            // watched.
+            std::cerr << "Watch mode can't be combined with -b "
+                      << "(except -b /all/)" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::vector<uint8_t> opcodes;
+        for (int ii = optind; ii < argc; ++ii) {
+            const uint8_t opcode = memcached_text_2_opcode(argv[ii]);
+            if (opcode == PROTOCOL_BINARY_CMD_INVALID) {
+                std::cerr << "Unknown opcode: " << argv[ii] << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            opcodes.push_back(opcode);
+        }
+        watch_cmd_timings(bio, bucket, opcodes);
+        // Not reached (watch runs until interrupted)
+    }
+
     if (optind == argc) {
         for (int ii = 0; ii < 256; ++ii) {
             request_cmd_timings(bio, bucket, (uint8_t)ii, verbose, 1);
@@ -59,20 +59,35 @@ size_t Greenstack::FlexHeader::encode(Greenstack::Writer& writer) const {
 
 Greenstack::FlexHeader Greenstack::FlexHeader::create(
     Greenstack::Reader& reader) {
+    return create(reader, reader.getRemainder());
+}
+
+Greenstack::FlexHeader Greenstack::FlexHeader::create(
+    Greenstack::Reader& reader, size_t nbytes) {
     FlexHeader ret;
+    const size_t endOffset = reader.getOffset() + nbytes;
 
-    while (reader.getRemainder() > 0) {
+    while (reader.getOffset() < endOffset) {
         try {
             // each field is at least 2 byte key, 2 byte length
+            if (reader.getOffset() + 4 > endOffset) {
+                throw std::out_of_range("truncated field header");
+            }
             uint16_t opcode;
             uint16_t length;
             reader.read(opcode);
             reader.read(length);
-            std::vector<uint8_t> value;
-            value.resize(length);
-            reader.read(value.data(), length);
 
-            ret.insertField(opcode, value.data(), value.size());
+            if (reader.getOffset() + length > endOffset) {
+                throw std::out_of_range("field extends beyond the header");
+            }
+
+            // Read the value bytes directly into the vector that ends up
+            // in the header map so each byte is only copied once off the
+            // wire.
+            std::vector<uint8_t> value(length);
+            reader.read(value.data(), length);
+            ret.insertField(opcode, std::move(value));
         } catch (std::out_of_range&) {
             throw std::runtime_error("Incorrect encoding of Flex Header");
         }
@@ -281,13 +296,16 @@ std::string Greenstack::FlexHeader::getCommandTimings() const {
 
 void Greenstack::FlexHeader::insertField(uint16_t opcode, const uint8_t* value,
                                          size_t length) {
-    if (header.find(opcode) != header.end()) {
+    insertField(opcode, std::vector<uint8_t>(value, value + length));
+}
+
+void Greenstack::FlexHeader::insertField(uint16_t opcode,
+                                         std::vector<uint8_t>&& value) {
+    // @todo insert validation of the different keys (length etc)
+    auto result = header.emplace(opcode, std::move(value));
+    if (!result.second) {
         std::stringstream ss;
         ss << "Header " << headerIdToString(opcode) << " already specified";
         throw std::runtime_error(ss.str());
     }
-
-    // @todo insert validation of the different keys (length etc)
-    header[opcode].resize(length);
-    memcpy(header[opcode].data(), value, length);
 }
@@ -27,7 +27,6 @@
 
 #include <iostream>
 #include <iomanip>
-#include <cassert>
 #include <stdexcept>
 #include <libgreenstack/memcached/Mutation.h>
 #include <libgreenstack/memcached/AssumeRole.h>
@@ -100,6 +99,10 @@ void Greenstack::Message::setPayload(std::vector<uint8_t>& data) {
     payload.assign(data.begin(), data.end());
 }
 
+void Greenstack::Message::setPayload(std::vector<uint8_t>&& data) {
+    payload = std::move(data);
+}
+
 void Greenstack::Message::validate() {
     // Empty
 }
@@ -138,6 +141,11 @@ void Greenstack::Message::validate() {
 */
 size_t Greenstack::Message::encode(std::vector<uint8_t>& vector,
                                    size_t offset) const {
+    // Reserve room for the fixed size header, status, flex header
+    // length field and payload in one go so the writer's incremental
+    // resizes don't reallocate midway through the encode.
+    vector.reserve(offset + 13 + payload.size());
+
     VectorWriter writer(vector, offset);
 
     writer.write(opaque);
@@ -153,8 +161,9 @@ size_t Greenstack::Message::encode(std::vector<uint8_t>& vector,
     offset += 7;
 
     if (flags.response) {
-        const Response* r = dynamic_cast<const Response*>(this);
-        assert(r);
+        // The response bit is only ever set by the Response constructor,
+        // so the downcast is safe without consulting RTTI.
+        const Response* r = static_cast<const Response*>(this);
         writer.write(uint16_t(r->getStatus()));
         offset += 2;
     }
@@ -208,7 +217,11 @@ Greenstack::Message* Greenstack::Message::create(Greenstack::Reader& reader,
     ret->flags = flags;
 
     if (flags.response) {
-        Response* r = dynamic_cast<Response*>(ret);
+        // createInstance dispatches on the numeric opcode and returns a
+        // Response subclass whenever the response bit is set, so the
+        // downcast is a plain pointer adjustment - no RTTI on the
+        // per-frame decode path.
+        Response* r = static_cast<Response*>(ret);
         uint16_t status;
         reader.read(status);
         r->setStatus(to_status(status));
@@ -223,12 +236,9 @@ Greenstack::Message* Greenstack::Message::create(Greenstack::Reader& reader,
         uint32_t nbytes;
         reader.read(nbytes);
 
-        std::vector<uint8_t> data;
-        data.resize(nbytes);
-        reader.read(data.data(), nbytes);
-        ByteArrayReader in(data);
-        auto flex = FlexHeader::create(in);
-        ret->flexHeader = flex;
+        // Decode the flex header in a single pass directly from the
+        // frame instead of staging the header bytes in a separate buffer.
+        ret->flexHeader = FlexHeader::create(reader, nbytes);
     }
 
     // Set the content
@@ -160,5 +160,5 @@ void Greenstack::HelloRequestBuilder::setPayload(Greenstack::Message& message) {
     std::vector<uint8_t> payload;
     payload.resize(fbb.GetSize());
     memcpy(payload.data(), fbb.GetBufferPointer(), fbb.GetSize());
-    message.setPayload(payload);
+    message.setPayload(std::move(payload));
 }
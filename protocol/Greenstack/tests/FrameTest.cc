@@ -17,6 +17,9 @@
 #include <libgreenstack/Greenstack.h>
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <iostream>
+
 namespace Greenstack {
     class FrameTest : public ::testing::Test {
     };
@@ -379,4 +382,50 @@ namespace Greenstack {
         EXPECT_TRUE(decoded->isMoreBitSet());
         EXPECT_TRUE(decoded->isQuietBitSet());
     }
+
+    TEST_F(FrameTest, FlexHeaderDecodeThroughput) {
+        // Build a frame carrying a well populated flex header and decode
+        // it repeatedly. The test asserts correctness of the decoded
+        // header; the elapsed time is printed so decoder changes can be
+        // compared by rerunning the test.
+        Greenstack::Request request;
+        request.setOpaque(0xdeadbeef);
+        request.setOpcode(Opcode::Noop);
+        auto& flex = request.getFlexHeader();
+        flex.setLaneId("benchmark-lane");
+        flex.setTXID("0123456789abcdef");
+        flex.setPriority(1);
+        flex.setDcpId("benchmark-dcp-stream");
+        flex.setVbucketId(1023);
+        flex.setHash(0xcafefeed);
+        flex.setTimeout(2500);
+
+        std::vector<uint8_t> data;
+        Greenstack::Frame::encode(request, data);
+
+        const int iterations = 10000;
+        auto start = std::chrono::steady_clock::now();
+        for (int ii = 0; ii < iterations; ++ii) {
+            ByteArrayReader reader(data);
+            auto msg = Frame::createUnique(reader);
+            ASSERT_NE(nullptr, msg.get());
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+
+        ByteArrayReader reader(data);
+        auto decoded = Frame::createUnique(reader);
+        ASSERT_NE(nullptr, decoded.get());
+        auto& header = decoded->getFlexHeader();
+        EXPECT_EQ("benchmark-lane", header.getLaneId());
+        EXPECT_EQ("0123456789abcdef", header.getTXID());
+        EXPECT_EQ(1, header.getPriority());
+        EXPECT_EQ("benchmark-dcp-stream", header.getDcpId());
+        EXPECT_EQ(1023, header.getVbucketId());
+        EXPECT_EQ(0xcafefeed, header.getHash());
+        EXPECT_EQ(2500, header.getTimeout());
+
+        std::cout << "Decoded " << iterations << " flex header frames in "
+                  << duration.count() << "us" << std::endl;
+    }
 }
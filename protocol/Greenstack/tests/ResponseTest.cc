@@ -175,6 +175,21 @@ namespace Greenstack {
         EXPECT_TRUE(equal(iterator, data.end(), payload.begin()));
     }
 
+    TEST_F(ResponseTest, PayloadMove) {
+        Response res;
+        std::vector<uint8_t> data;
+
+        std::vector<uint8_t> payload(20, 0xaa);
+        res.setPayload(std::move(payload));
+        res.encode(data);
+
+        EXPECT_EQ(29, data.size());
+        const std::vector<uint8_t> expected(20, 0xaa);
+        auto iterator = data.begin();
+        iterator += 9;
+        EXPECT_TRUE(equal(iterator, data.end(), expected.begin()));
+    }
+
     TEST_F(ResponseTest, Decode) {
         // We've already tested the encode functionality, so
         // we can just create a new one and encode it and see
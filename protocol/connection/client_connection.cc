@@ -28,6 +28,17 @@
 #include <stdexcept>
 #include <string>
 #include <limits>
+#include <limits.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/**
+ * The size of the internal read buffer. A single receive call may pick
+ * up this much pipelined response data in one go.
+ */
+static const size_t READ_BUFFER_SIZE = 1024 * 1024;
 
 /////////////////////////////////////////////////////////////////////////
 // Implementation of the ConnectionMap class
@@ -153,7 +164,9 @@ MemcachedConnection::MemcachedConnection(const std::string& host, in_port_t port
       context(nullptr),
       bio(nullptr),
       sock(INVALID_SOCKET),
-      synchronous(false) {
+      synchronous(false),
+      readStart(0),
+      readEnd(0) {
     connect();
 }
 
@@ -167,6 +180,9 @@ void MemcachedConnection::reconnect() {
 }
 
 void MemcachedConnection::close() {
+    // Any buffered data belongs to the connection being torn down
+    readStart = readEnd = 0;
+
     if (ssl) {
         // the socket is closed by the underlying BIO stuctures
         if (bio != nullptr) {
@@ -319,11 +335,8 @@ void MemcachedConnection::sendFramePlain(const Frame& frame) {
     }
 }
 
-void MemcachedConnection::readSsl(Frame& frame, size_t bytes) {
-    Frame::size_type offset = frame.payload.size();
-    frame.payload.resize(bytes + offset);
-    char* data = reinterpret_cast<char*>(frame.payload.data()) + offset;
-
+void MemcachedConnection::readDirectSsl(uint8_t* dest, size_t bytes) {
+    char* data = reinterpret_cast<char*>(dest);
     size_t total = 0;
 
     while (total < bytes) {
@@ -338,11 +351,8 @@ void MemcachedConnection::readSsl(Frame& frame, size_t bytes) {
     }
 }
 
-void MemcachedConnection::readPlain(Frame& frame, size_t bytes) {
-    Frame::size_type offset = frame.payload.size();
-    frame.payload.resize(bytes + offset);
-    char* data = reinterpret_cast<char*>(frame.payload.data()) + offset;
-
+void MemcachedConnection::readDirectPlain(uint8_t* dest, size_t bytes) {
+    char* data = reinterpret_cast<char*>(dest);
     size_t total = 0;
 
     while (total < bytes) {
@@ -357,6 +367,101 @@ void MemcachedConnection::readPlain(Frame& frame, size_t bytes) {
     }
 }
 
+void MemcachedConnection::fillReadBuffer() {
+    if (readBuffer.size() != READ_BUFFER_SIZE) {
+        readBuffer.resize(READ_BUFFER_SIZE);
+    }
+
+    if (readEnd == readBuffer.size()) {
+        // The tail is full; slide the unconsumed bytes to the front
+        memmove(readBuffer.data(), readBuffer.data() + readStart,
+                readEnd - readStart);
+        readEnd -= readStart;
+        readStart = 0;
+    }
+
+    char* data = reinterpret_cast<char*>(readBuffer.data()) + readEnd;
+    const size_t room = readBuffer.size() - readEnd;
+
+    while (true) {
+        if (ssl) {
+            int nr = BIO_read(bio, data, room);
+            if (nr < 0) {
+                if (BIO_should_retry(bio) == 0) {
+                    throw std::runtime_error("Failed to read data");
+                }
+            } else if (nr > 0) {
+                readEnd += nr;
+                return;
+            }
+        } else {
+            auto nr = recv(sock, data, room, 0);
+            if (nr <= 0) {
+                std::string msg("Failed to read data: ");
+                msg.append(cb_strerror());
+                throw std::runtime_error(msg);
+            }
+            readEnd += nr;
+            return;
+        }
+    }
+}
+
+const uint8_t* MemcachedConnection::peekBuffered(size_t bytes) {
+    if (bytes > READ_BUFFER_SIZE) {
+        throw std::logic_error(
+            "MemcachedConnection::peekBuffered: request exceeds buffer");
+    }
+
+    while (readEnd - readStart < bytes) {
+        // fillReadBuffer compacts the buffer when the tail fills up,
+        // so the requested range always ends up contiguous
+        fillReadBuffer();
+    }
+
+    return readBuffer.data() + readStart;
+}
+
+void MemcachedConnection::readBuffered(void* dest, size_t nbytes) {
+    auto* dst = static_cast<uint8_t*>(dest);
+
+    // Drain whatever is already buffered
+    const size_t avail = readEnd - readStart;
+    const size_t chunk = avail < nbytes ? avail : nbytes;
+    if (chunk > 0) {
+        memcpy(dst, readBuffer.data() + readStart, chunk);
+        readStart += chunk;
+        dst += chunk;
+        nbytes -= chunk;
+    }
+    if (readStart == readEnd) {
+        readStart = readEnd = 0;
+    }
+
+    while (nbytes > 0) {
+        if (nbytes >= READ_BUFFER_SIZE) {
+            // No point in staging a huge remainder; receive it in place
+            if (ssl) {
+                readDirectSsl(dst, nbytes);
+            } else {
+                readDirectPlain(dst, nbytes);
+            }
+            return;
+        }
+
+        fillReadBuffer();
+        const size_t have = readEnd - readStart;
+        const size_t piece = have < nbytes ? have : nbytes;
+        memcpy(dst, readBuffer.data() + readStart, piece);
+        readStart += piece;
+        dst += piece;
+        nbytes -= piece;
+        if (readStart == readEnd) {
+            readStart = readEnd = 0;
+        }
+    }
+}
+
 void MemcachedConnection::sendFrame(const Frame& frame) {
     if (ssl) {
         sendFrameSsl(frame);
@@ -365,6 +470,60 @@ void MemcachedConnection::sendFrame(const Frame& frame) {
     }
 }
 
+void MemcachedConnection::sendFrames(const std::vector<Frame>& frames) {
+    if (ssl) {
+        // OpenSSL has no scatter-gather write; send back to back and
+        // let the BIO coalesce what it can
+        for (const auto& frame : frames) {
+            sendFrameSsl(frame);
+        }
+        return;
+    }
+
+    std::vector<struct iovec> iov;
+    iov.reserve(frames.size());
+    for (const auto& frame : frames) {
+        if (!frame.payload.empty()) {
+            struct iovec entry;
+            entry.iov_base = const_cast<uint8_t*>(frame.payload.data());
+            entry.iov_len = frame.payload.size();
+            iov.push_back(entry);
+        }
+    }
+
+    size_t idx = 0;
+    while (idx < iov.size()) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov.data() + idx;
+        size_t count = iov.size() - idx;
+        if (count > IOV_MAX) {
+            count = IOV_MAX;
+        }
+        msg.msg_iovlen = count;
+
+        auto nw = sendmsg(sock, &msg, 0);
+        if (nw <= 0) {
+            std::string msg_text("Failed to send data: ");
+            msg_text.append(cb_strerror());
+            throw std::runtime_error(msg_text);
+        }
+
+        // Skip the iovec entries (and any partial entry) covered by
+        // this send
+        size_t sent = static_cast<size_t>(nw);
+        while (idx < iov.size() && sent >= iov[idx].iov_len) {
+            sent -= iov[idx].iov_len;
+            ++idx;
+        }
+        if (sent > 0) {
+            iov[idx].iov_base = static_cast<uint8_t*>(iov[idx].iov_base) +
+                                sent;
+            iov[idx].iov_len -= sent;
+        }
+    }
+}
+
 void MemcachedConnection::sendPartialFrame(Frame& frame,
                                            Frame::size_type length) {
     // Move the remainder to a new frame.
@@ -382,9 +541,7 @@ void MemcachedConnection::sendPartialFrame(Frame& frame,
 }
 
 void MemcachedConnection::read(Frame& frame, size_t bytes) {
-    if (ssl) {
-        readSsl(frame, bytes);
-    } else {
-        readPlain(frame, bytes);
-    }
+    Frame::size_type offset = frame.payload.size();
+    frame.payload.resize(bytes + offset);
+    readBuffered(frame.payload.data() + offset, bytes);
 }
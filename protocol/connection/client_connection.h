@@ -50,6 +50,17 @@ public:
         payload.resize(0);
     }
 
+    /**
+     * Hand the payload over to the caller, leaving this frame empty.
+     * Allows receive loops to take ownership of a frame without
+     * copying the bytes.
+     */
+    std::vector<uint8_t> takePayload() {
+        std::vector<uint8_t> ret;
+        ret.swap(payload);
+        return ret;
+    }
+
     std::vector<uint8_t> payload;
     typedef std::vector<uint8_t>::size_type size_type;
 };
@@ -248,6 +259,16 @@ public:
      */
     virtual void sendFrame(const Frame& frame);
 
+    /**
+     * Send all of the given frames over this connection with as few
+     * write calls as possible (a single scatter-gather send on a plain
+     * socket). The frames may be queued into the vector by move, so a
+     * pipelined sender never has to copy a payload.
+     *
+     * @param frames the frames to send, in order
+     */
+    virtual void sendFrames(const std::vector<Frame>& frames);
+
     /** Send part of the given frame over this connection. Upon success,
      * the frame's payload will be modified such that the sent bytes are
      * deleted - i.e. after a successful call the frame object will only have
@@ -350,9 +371,31 @@ protected:
 
     void read(Frame& frame, size_t bytes);
 
-    void readPlain(Frame& frame, size_t bytes);
+    /**
+     * Consume the given number of received bytes into the destination,
+     * draining the read buffer before going back to the socket. Large
+     * remainders are received directly into the destination instead of
+     * being staged in the buffer first.
+     */
+    void readBuffered(void* dest, size_t nbytes);
+
+    /**
+     * Ensure that at least the given number of received bytes are
+     * available contiguously in the read buffer and return a view of
+     * them. The bytes are not consumed; the next readBuffered() starts
+     * at the same position. The number of bytes must fit in the buffer.
+     */
+    const uint8_t* peekBuffered(size_t bytes);
+
+    /**
+     * Grow the read buffer contents with a single receive call,
+     * compacting the buffer first if the tail is full.
+     */
+    void fillReadBuffer();
+
+    void readDirectPlain(uint8_t* dest, size_t bytes);
 
-    void readSsl(Frame& frame, size_t bytes);
+    void readDirectSsl(uint8_t* dest, size_t bytes);
 
     void sendFramePlain(const Frame& frame);
 
@@ -368,6 +411,16 @@ protected:
     SOCKET sock;
     bool synchronous;
     std::string saslMechanisms;
+
+    /**
+     * Received data is staged in a buffer (sized lazily to 1MB) and
+     * frames are extracted from it, so a pipelined response stream is
+     * consumed with a handful of receive calls rather than two per
+     * frame. The valid bytes live in [readStart, readEnd).
+     */
+    std::vector<uint8_t> readBuffer;
+    size_t readStart;
+    size_t readEnd;
 };
 
 class ConnectionMap {
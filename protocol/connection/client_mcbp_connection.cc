@@ -138,17 +138,26 @@ void MemcachedBinprotConnection::sendFrame(const Frame& frame) {
 }
 
 
+void MemcachedBinprotConnection::sendFrames(const std::vector<Frame>& frames) {
+    MemcachedConnection::sendFrames(frames);
+    if (packet_dump) {
+        for (const auto& frame : frames) {
+            Couchbase::MCBP::dump(frame.payload.data(), std::cerr);
+        }
+    }
+}
+
 void MemcachedBinprotConnection::recvFrame(Frame& frame) {
     frame.reset();
-    // A memcached packet starts with a 24 byte fixed header
-    MemcachedConnection::read(frame, 24);
-
-    // Following the header is the full payload specified in the field
-    // bodylen. Luckily for us the bodylen is located at the same offset in
-    // both a request and a response message..
-    auto* req = reinterpret_cast<protocol_binary_request_header*>(frame.payload.data());
-    const uint32_t bodylen = ntohl(req->request.bodylen);
-    const uint8_t magic = frame.payload.at(0);
+    // A memcached packet starts with a 24 byte fixed header. Peek at it
+    // in the connections read buffer so that the payload vector may be
+    // sized exactly once for the entire frame. Luckily for us the
+    // bodylen is located at the same offset in both a request and a
+    // response message..
+    const auto* header = reinterpret_cast<const protocol_binary_request_header*>(
+        peekBuffered(sizeof(protocol_binary_request_header)));
+    const uint32_t bodylen = ntohl(header->request.bodylen);
+    const uint8_t magic = header->bytes[0];
     const uint8_t REQUEST = uint8_t(PROTOCOL_BINARY_REQ);
     const uint8_t RESPONSE = uint8_t(PROTOCOL_BINARY_RES);
 
@@ -157,19 +166,18 @@ void MemcachedBinprotConnection::recvFrame(Frame& frame) {
                                  std::to_string(magic));
     }
 
-    MemcachedConnection::read(frame, bodylen);
+    MemcachedConnection::read(frame,
+                              sizeof(protocol_binary_request_header) + bodylen);
     if (packet_dump) {
         Couchbase::MCBP::dump(frame.payload.data(), std::cerr);
     }
 
     // fixup the length bits in the header to be in host local order:
     if (magic == REQUEST) {
-        // The underlying buffer may hage been reallocated as part of read
-        req = reinterpret_cast<protocol_binary_request_header*>(frame.payload.data());
+        auto* req = reinterpret_cast<protocol_binary_request_header*>(frame.payload.data());
         req->request.keylen = ntohs(req->request.keylen);
         req->request.bodylen = bodylen;
     } else {
-        // The underlying buffer may hage been reallocated as part of read
         auto* res = reinterpret_cast<protocol_binary_response_header*>(frame.payload.data());
         res->response.keylen = ntohs(res->response.keylen);
         res->response.bodylen = bodylen;
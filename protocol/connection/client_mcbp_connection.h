@@ -128,6 +128,8 @@ public:
 
     virtual void sendFrame(const Frame& frame) override;
 
+    virtual void sendFrames(const std::vector<Frame>& frames) override;
+
     virtual void recvFrame(Frame& frame) override;
 
     virtual void hello(const std::string& userAgent,
@@ -16,6 +16,7 @@
  */
 #include "config.h"
 
+#include <cstdio>
 #include <cstring>
 #include <stdexcept>
 #include <string>
@@ -27,6 +28,38 @@
 // This file contains the functionality to generate a packet dump
 // of a memcached frame
 
+/**
+ * Table of preformatted dump cells. Entry [b] holds the complete 16
+ * character wide text emitted for byte value b in the frame dump, so
+ * the per-byte loop is reduced to appending a preformatted string
+ * instead of running each byte through the ostream formatting
+ * machinery (which makes dumping large captures impractical).
+ */
+class ByteCellTable {
+public:
+    ByteCellTable(bool body) {
+        for (int ii = 0; ii < 256; ++ii) {
+            char cell[20];
+            if (body && isprint(ii)) {
+                snprintf(cell, sizeof(cell), " 0x%02x ('%c')    |", ii, ii);
+            } else {
+                snprintf(cell, sizeof(cell), " 0x%02x          |", ii);
+            }
+            cells[ii].assign(cell);
+        }
+    }
+
+    const std::string& operator[](uint8_t b) const {
+        return cells[b];
+    }
+
+private:
+    std::string cells[256];
+};
+
+static const char frame_separator[] =
+    "        +---------------+---------------+---------------+---------------+\n";
+
 /**
  * The Frame class represents a complete frame as it is being sent on the
  * wire in the Memcached Binary Protocol.
@@ -40,7 +73,12 @@ public:
     }
 
     void dump(std::ostream& out) const {
-        dumpFrame(out);
+        // The frame dump is built up in a string buffer and written to
+        // the stream in a single chunk; the byte loop dominates the
+        // cost for big values.
+        std::string buffer;
+        dumpFrame(buffer);
+        out.write(buffer.data(), buffer.size());
         dumpPacketInfo(out);
         dumpExtras(out);
         dumpKey(out);
@@ -85,61 +123,43 @@ protected:
 
 
 private:
-    void printByte(uint8_t b, bool inBody, std::ostream& out) const {
-        uint32_t val = b & 0xff;
-        if (b < 0x10) {
-            out << " 0x0";
-        } else {
-            out << " 0x";
-        }
+    void dumpFrame(std::string& out) const {
+        static const ByteCellTable headerCells(false);
+        static const ByteCellTable bodyCells(true);
 
-        out.flags(std::ios::hex);
-        out << val;
-        out.flags(std::ios::dec);
+        // 16 characters per byte plus a separator and row prefix for
+        // every four bytes; reserving up front keeps the append loop
+        // free from reallocations.
+        out.reserve(out.size() + 256 + (length * 16) +
+                    ((length / 4) + 2) * (sizeof(frame_separator) + 9));
 
-        if (inBody && isprint((int)b)) {
-            out << " ('" << (char)b << "')";
-        } else {
-            out << "      ";
-        }
-        out << "    |";
-    }
-
-    void dumpFrame(std::ostream& out) const {
-        out << std::endl;
-        out <<
-        "      Byte/     0       |       1       |       2       |       3       |" <<
-        std::endl;
-        out <<
-        "         /              |               |               |               |" <<
-        std::endl;
-        out <<
-        "        |0 1 2 3 4 5 6 7|0 1 2 3 4 5 6 7|0 1 2 3 4 5 6 7|0 1 2 3 4 5 6 7|";
+        out.append("\n"
+        "      Byte/     0       |       1       |       2       |       3       |\n"
+        "         /              |               |               |               |\n"
+        "        |0 1 2 3 4 5 6 7|0 1 2 3 4 5 6 7|0 1 2 3 4 5 6 7|0 1 2 3 4 5 6 7|");
 
         size_t ii = 0;
         for (; ii < length; ++ii) {
             if (ii % 4 == 0) {
-                out << std::endl;
-                out <<
-                "        +---------------+---------------+---------------+---------------+" <<
-                std::endl;
-                out.setf(std::ios::right);
-                out << std::setw(8) << ii << "|";
-                out.setf(std::ios::fixed);
+                out.push_back('\n');
+                out.append(frame_separator);
+                char prefix[16];
+                snprintf(prefix, sizeof(prefix), "%8u|",
+                         static_cast<unsigned int>(ii));
+                out.append(prefix);
             }
-            printByte(root[ii], ii > 23, out);
+            out.append((ii > 23 ? bodyCells : headerCells)[root[ii]]);
         }
 
-        out << std::endl;
+        out.push_back('\n');
         if (ii % 4 != 0) {
-            out << "        ";
+            out.append("        ");
             for (size_t jj = 0; jj < ii % 4; ++jj) {
-                out << "+---------------";
+                out.append("+---------------");
             }
-            out << "+" << std::endl;
+            out.append("+\n");
         } else {
-            out << "        +---------------+---------------+---------------+---------------+"
-            << std::endl;
+            out.append(frame_separator);
         }
     }
 
@@ -422,3 +442,50 @@ void Couchbase::MCBP::dump(const uint8_t* packet, std::ostream& out) {
         throw std::invalid_argument("Couchbase::MCBP::dump: Invalid magic");
     }
 }
+
+/**
+ * Get the total number of bytes occupied by the frame starting at the
+ * given location. The body length field lives at the same offset for
+ * requests and responses so it doesn't matter which direction the
+ * frame is going.
+ */
+static size_t frame_length(const uint8_t* data) {
+    auto* req = reinterpret_cast<const protocol_binary_request_header*>(data);
+    return sizeof(req->bytes) + ntohl(req->request.bodylen);
+}
+
+void Couchbase::MCBP::StreamingDumper::feed(const uint8_t* data,
+                                            size_t nbytes) {
+    if (stash.empty()) {
+        // Fast path: dump complete frames directly from the caller's
+        // chunk without copying them into the stash first.
+        while (nbytes >= sizeof(protocol_binary_request_header)) {
+            const size_t frame = frame_length(data);
+            if (nbytes < frame) {
+                break;
+            }
+            dump(data, out);
+            data += frame;
+            nbytes -= frame;
+        }
+
+        if (nbytes > 0) {
+            stash.insert(stash.end(), data, data + nbytes);
+        }
+        return;
+    }
+
+    stash.insert(stash.end(), data, data + nbytes);
+
+    size_t offset = 0;
+    while (stash.size() - offset >= sizeof(protocol_binary_request_header)) {
+        const size_t frame = frame_length(stash.data() + offset);
+        if (stash.size() - offset < frame) {
+            break;
+        }
+        dump(stash.data() + offset, out);
+        offset += frame;
+    }
+
+    stash.erase(stash.begin(), stash.begin() + offset);
+}
@@ -21,6 +21,8 @@
  */
 
 #include <gtest/gtest.h>
+#include <chrono>
+#include <iostream>
 #include <openssl/evp.h>
 #include <platform/base64.h>
 #include <platform/platform.h>
@@ -28,6 +30,7 @@
 #include <string>
 
 #include <cbcrypto/cbcrypto.h>
+#include <cbcrypto/codec.h>
 
 std::vector<uint8_t> string2vector(const std::string& str) {
     std::vector<uint8_t> ret(str.size());
@@ -557,3 +560,125 @@ TEST(Crypt, InvalidAlgorithm) {
                                  key, ivec, data),
                  std::invalid_argument);
 }
+
+/*
+ * The base64/hex codec carries SIMD kernels with a scalar fallback;
+ * exercise both paths on the same inputs (setBase64SimdEnabled) and
+ * cross check against the platform codec.
+ */
+
+TEST(Codec, Base64Rfc4648Vectors) {
+    EXPECT_EQ("", codec::base64Encode(""));
+    EXPECT_EQ("Zg==", codec::base64Encode("f"));
+    EXPECT_EQ("Zm8=", codec::base64Encode("fo"));
+    EXPECT_EQ("Zm9v", codec::base64Encode("foo"));
+    EXPECT_EQ("Zm9vYg==", codec::base64Encode("foob"));
+    EXPECT_EQ("Zm9vYmE=", codec::base64Encode("fooba"));
+    EXPECT_EQ("Zm9vYmFy", codec::base64Encode("foobar"));
+
+    EXPECT_EQ("", codec::base64Decode(""));
+    EXPECT_EQ("f", codec::base64Decode("Zg=="));
+    EXPECT_EQ("fo", codec::base64Decode("Zm8="));
+    EXPECT_EQ("foo", codec::base64Decode("Zm9v"));
+    EXPECT_EQ("foob", codec::base64Decode("Zm9vYg=="));
+    EXPECT_EQ("fooba", codec::base64Decode("Zm9vYmE="));
+    EXPECT_EQ("foobar", codec::base64Decode("Zm9vYmFy"));
+}
+
+TEST(Codec, Base64Roundtrip) {
+    // cover every tail length well past the SIMD block size, with all
+    // byte values present
+    std::string blob;
+    for (int ii = 0; ii < 512; ++ii) {
+        blob.push_back(char(ii * 7));
+        const auto encoded = codec::base64Encode(blob);
+        EXPECT_EQ(blob, codec::base64Decode(encoded));
+        // and it should agree with the platform codec
+        EXPECT_EQ(Couchbase::Base64::encode(blob), encoded);
+    }
+}
+
+TEST(Codec, Base64ScalarVsSimd) {
+    if (!codec::isBase64SimdAvailable()) {
+        return;
+    }
+
+    std::string blob;
+    for (int ii = 0; ii < 512; ++ii) {
+        blob.push_back(char(255 - ii));
+        codec::setBase64SimdEnabled(true);
+        const auto vec_enc = codec::base64Encode(blob);
+        const auto vec_dec = codec::base64Decode(vec_enc);
+        codec::setBase64SimdEnabled(false);
+        const auto scalar_enc = codec::base64Encode(blob);
+        const auto scalar_dec = codec::base64Decode(vec_enc);
+        codec::setBase64SimdEnabled(true);
+
+        EXPECT_EQ(scalar_enc, vec_enc);
+        EXPECT_EQ(blob, vec_dec);
+        EXPECT_EQ(blob, scalar_dec);
+    }
+}
+
+TEST(Codec, Base64InvalidInput) {
+    EXPECT_THROW(codec::base64Decode("Zm9vY"), std::invalid_argument);
+    EXPECT_THROW(codec::base64Decode("Zm9v!mFy"), std::invalid_argument);
+    EXPECT_THROW(codec::base64Decode("Zm=vYmFy"), std::invalid_argument);
+    // an invalid character deep enough in to be hit by the SIMD kernel
+    std::string input(64, 'A');
+    input[40] = '\n';
+    EXPECT_THROW(codec::base64Decode(input), std::invalid_argument);
+}
+
+TEST(Codec, HexEncode) {
+    const uint8_t blob[] = {0x00, 0x01, 0x0f, 0x10, 0xab, 0xff};
+    EXPECT_EQ("00010f10abff", codec::hexEncode(blob, sizeof(blob)));
+    EXPECT_EQ("", codec::hexEncode(blob, 0));
+}
+
+TEST(Crypto, ContextReuseConsistency) {
+    // The implementation keeps per-thread contexts which are
+    // reinitialized in place; interleave all of the algorithms and
+    // verify that every round produces the same answer as a fresh
+    // context did on the first round.
+    using namespace cb::crypto;
+    const std::vector<uint8_t> key{{'s', 'e', 'c', 'r', 'e', 't'}};
+    const std::vector<uint8_t> data{{'d', 'a', 't', 'a'}};
+
+    const std::vector<Algorithm> algorithms{
+        {Algorithm::MD5, Algorithm::SHA1, Algorithm::SHA256,
+         Algorithm::SHA512}};
+
+    std::vector<std::vector<uint8_t>> first_digest;
+    std::vector<std::vector<uint8_t>> first_hmac;
+    for (const auto& algorithm : algorithms) {
+        first_digest.push_back(digest(algorithm, data));
+        first_hmac.push_back(HMAC(algorithm, key, data));
+    }
+
+    for (int ii = 0; ii < 100; ++ii) {
+        for (size_t idx = 0; idx < algorithms.size(); ++idx) {
+            EXPECT_EQ(first_digest[idx], digest(algorithms[idx], data));
+            EXPECT_EQ(first_hmac[idx], HMAC(algorithms[idx], key, data));
+        }
+    }
+}
+
+TEST(Crypto, HmacThroughput) {
+    // Not a pass/fail criteria; print the achieved rate so that the
+    // effect of the context reuse can be eyeballed from the test log
+    using namespace cb::crypto;
+    const std::vector<uint8_t> key{{'s', 'e', 'c', 'r', 'e', 't'}};
+    const std::vector<uint8_t> data(64, uint8_t('x'));
+    const int iterations = 100000;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int ii = 0; ii < iterations; ++ii) {
+        HMAC(Algorithm::SHA256, key, data);
+    }
+    const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    std::cout << "HMAC(SHA256, 64b): "
+              << duration.count() / iterations << " ns/op" << std::endl;
+}
@@ -26,6 +26,7 @@
 #include <platform/checked_snprintf.h>
 #include <platform/dirutils.h>
 #include <platform/platform.h>
+#include <fstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -400,3 +401,97 @@ TEST_F(EncryptedDatabaseTest, WriteReadFileEncrypted) {
     auto content = cbsasl_read_password_file(filename);
     EXPECT_EQ(input, content);
 }
+
+class PrecompiledDatabaseTest : public PasswordDatabaseTest {
+public:
+    void SetUp() override {
+        PasswordDatabaseTest::SetUp();
+        filename = generateTempFile("./pwcompiled.XXXXXX");
+    }
+
+    void TearDown() override {
+        EXPECT_TRUE(CouchbaseDirectoryUtilities::rmrf(filename));
+    }
+
+protected:
+    std::string filename;
+
+    std::string generateTempFile(const char* pattern) {
+        char* file_pattern = strdup(pattern);
+        if (file_pattern == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        if (cb_mktemp(file_pattern) == nullptr) {
+            throw std::runtime_error(
+                std::string("Failed to create temporary file with pattern: ") +
+                std::string(pattern));
+        }
+
+        std::string ret(file_pattern);
+        free(file_pattern);
+
+        return ret;
+    }
+
+    void writeFile(const std::string& content) {
+        std::ofstream of(filename, std::ios::binary | std::ios::trunc);
+        of.write(content.data(), content.size());
+        of.close();
+        ASSERT_TRUE(of.good());
+    }
+};
+
+TEST_F(PrecompiledDatabaseTest, CompileAndFind) {
+    Couchbase::PasswordDatabase db(json, false);
+    writeFile(db.to_compiled());
+
+    EXPECT_TRUE(Couchbase::PrecompiledPasswordDatabase::isPrecompiled(
+        filename));
+
+    Couchbase::PrecompiledPasswordDatabase compiled(filename);
+    for (const auto& name : {"trond", "mike", "anne", "will", "dave"}) {
+        auto expected = db.find(name);
+        auto user = compiled.find(name);
+        EXPECT_FALSE(user.isDummy());
+        EXPECT_EQ(expected.getUsername(), user.getUsername());
+        EXPECT_EQ(expected.getPassword(Mechanism::PLAIN).getPassword(),
+                  user.getPassword(Mechanism::PLAIN).getPassword());
+    }
+    EXPECT_TRUE(compiled.find("unknown").isDummy());
+    EXPECT_TRUE(compiled.find("").isDummy());
+}
+
+TEST_F(PrecompiledDatabaseTest, JsonIsNotPrecompiled) {
+    writeFile(json);
+    EXPECT_FALSE(Couchbase::PrecompiledPasswordDatabase::isPrecompiled(
+        filename));
+}
+
+TEST_F(PrecompiledDatabaseTest, DetectTruncatedFile) {
+    Couchbase::PasswordDatabase db(json, false);
+    auto blob = db.to_compiled();
+    blob.resize(blob.size() / 2);
+    writeFile(blob);
+
+    EXPECT_THROW(Couchbase::PrecompiledPasswordDatabase compiled(filename),
+                 std::runtime_error);
+}
+
+TEST_F(PrecompiledDatabaseTest, PwCompile) {
+    auto source = generateTempFile("./pwdb.XXXXXX");
+    try {
+        std::ofstream of(source, std::ios::trunc);
+        of << json;
+        of.close();
+
+        cbsasl_pwcompile(source, filename);
+        Couchbase::PrecompiledPasswordDatabase compiled(filename);
+        EXPECT_FALSE(compiled.find("trond").isDummy());
+        EXPECT_TRUE(compiled.find("unknown").isDummy());
+    } catch (...) {
+        CouchbaseDirectoryUtilities::rmrf(source);
+        throw;
+    }
+    EXPECT_TRUE(CouchbaseDirectoryUtilities::rmrf(source));
+}
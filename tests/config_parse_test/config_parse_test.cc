@@ -303,6 +303,7 @@ TEST_F(SettingsTest, Interfaces) {
     cJSON_AddStringToObject(obj.get(), "host", "*");
     cJSON_AddStringToObject(obj.get(), "protocol", "memcached");
     cJSON_AddTrueToObject(obj.get(), "management");
+    cJSON_AddNumberToObject(obj.get(), "busy_poll_usec", 50);
 
     unique_cJSON_ptr ssl(cJSON_CreateObject());
     cJSON_AddStringToObject(ssl.get(), "key", key_pattern);
@@ -340,6 +341,7 @@ TEST_F(SettingsTest, Interfaces) {
         EXPECT_EQ("*", ifc0.host);
         EXPECT_EQ(Protocol::Memcached, ifc0.protocol);
         EXPECT_TRUE(ifc0.management);
+        EXPECT_EQ(50, ifc0.busy_poll_usec);
 
         const auto& ifc1 = settings.getInterfaces()[1];
         EXPECT_EQ(0, ifc1.port);
@@ -350,6 +352,7 @@ TEST_F(SettingsTest, Interfaces) {
         EXPECT_EQ("*", ifc1.host);
         EXPECT_EQ(Protocol::Greenstack, ifc1.protocol);
         EXPECT_TRUE(ifc1.management);
+        EXPECT_EQ(0, ifc1.busy_poll_usec);
 
 
     } catch (std::exception& exception) {
@@ -594,6 +597,62 @@ TEST_F(SettingsTest, LowPriorityReqsPerEvent) {
     }
 }
 
+TEST_F(SettingsTest, DefaultEventTimeBudget) {
+    nonNumericValuesShouldFail("default_event_time_budget");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "default_event_time_budget", 500);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(500, settings.getEventTimeBudget(EventPriority::Default));
+        EXPECT_TRUE(settings.has.default_event_time_budget);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, HighPriorityEventTimeBudget) {
+    nonNumericValuesShouldFail("event_time_budget_high_priority");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "event_time_budget_high_priority", 500);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(500, settings.getEventTimeBudget(EventPriority::High));
+        EXPECT_TRUE(settings.has.event_time_budget_high_priority);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, MediumPriorityEventTimeBudget) {
+    nonNumericValuesShouldFail("event_time_budget_med_priority");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "event_time_budget_med_priority", 500);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(500, settings.getEventTimeBudget(EventPriority::Medium));
+        EXPECT_TRUE(settings.has.event_time_budget_med_priority);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, LowPriorityEventTimeBudget) {
+    nonNumericValuesShouldFail("event_time_budget_low_priority");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "event_time_budget_low_priority", 500);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(500, settings.getEventTimeBudget(EventPriority::Low));
+        EXPECT_TRUE(settings.has.event_time_budget_low_priority);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
 TEST_F(SettingsTest, Verbosity) {
     nonNumericValuesShouldFail("verbosity");
 
@@ -636,6 +695,36 @@ TEST_F(SettingsTest, BioDrainBufferSize) {
     }
 }
 
+TEST_F(SettingsTest, GreedyReadBudget) {
+    nonNumericValuesShouldFail("greedy_read_budget");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "greedy_read_budget", 262144);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(262144, settings.getGreedyReadBudget());
+        EXPECT_TRUE(settings.has.greedy_read_budget);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    // 0 disables greedy reads and is a legal value
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "greedy_read_budget", 0);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(0, settings.getGreedyReadBudget());
+        EXPECT_TRUE(settings.has.greedy_read_budget);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    // Negative values should not be accepted
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "greedy_read_budget", -1);
+    expectFail(obj);
+}
+
 TEST_F(SettingsTest, DatatypeSupport) {
     nonBooleanValuesShouldFail("datatype_support");
 
@@ -660,6 +749,78 @@ TEST_F(SettingsTest, DatatypeSupport) {
     }
 }
 
+TEST_F(SettingsTest, ReuseportListeners) {
+    nonBooleanValuesShouldFail("reuseport_listeners");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddTrueToObject(obj.get(), "reuseport_listeners");
+    try {
+        Settings settings(obj);
+        EXPECT_TRUE(settings.isReuseportListeners());
+        EXPECT_TRUE(settings.has.reuseport_listeners);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddFalseToObject(obj.get(), "reuseport_listeners");
+    try {
+        Settings settings(obj);
+        EXPECT_FALSE(settings.isReuseportListeners());
+        EXPECT_TRUE(settings.has.reuseport_listeners);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, ConnectionRebalance) {
+    nonBooleanValuesShouldFail("connection_rebalance");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddTrueToObject(obj.get(), "connection_rebalance");
+    try {
+        Settings settings(obj);
+        EXPECT_TRUE(settings.isConnectionRebalance());
+        EXPECT_TRUE(settings.has.connection_rebalance);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddFalseToObject(obj.get(), "connection_rebalance");
+    try {
+        Settings settings(obj);
+        EXPECT_FALSE(settings.isConnectionRebalance());
+        EXPECT_TRUE(settings.has.connection_rebalance);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, ThreadAffinity) {
+    nonBooleanValuesShouldFail("thread_affinity");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddTrueToObject(obj.get(), "thread_affinity");
+    try {
+        Settings settings(obj);
+        EXPECT_TRUE(settings.isThreadAffinity());
+        EXPECT_TRUE(settings.has.thread_affinity);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddFalseToObject(obj.get(), "thread_affinity");
+    try {
+        Settings settings(obj);
+        EXPECT_FALSE(settings.isThreadAffinity());
+        EXPECT_TRUE(settings.has.thread_affinity);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
 TEST_F(SettingsTest, Root) {
     // Ensure that we detect non-string values for admin
     nonStringValuesShouldFail("root");
@@ -744,6 +905,36 @@ TEST_F(SettingsTest, SslMinimumProtocol) {
     expectFail(obj);
 }
 
+TEST_F(SettingsTest, SslSessionCacheSize) {
+    nonNumericValuesShouldFail("ssl_session_cache_size");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "ssl_session_cache_size", 256);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(256u, settings.getSslSessionCacheSize());
+        EXPECT_TRUE(settings.has.ssl_session_cache_size);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    // 0 disables session resumption
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "ssl_session_cache_size", 0);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(0u, settings.getSslSessionCacheSize());
+        EXPECT_TRUE(settings.has.ssl_session_cache_size);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    // But negative values are not allowed
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "ssl_session_cache_size", -1);
+    expectFail(obj);
+}
+
 TEST_F(SettingsTest, Breakpad) {
     nonObjectValuesShouldFail("breakpad");
 
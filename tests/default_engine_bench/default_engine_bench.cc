@@ -0,0 +1,369 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * In-process microbenchmark for the default engine item store. The
+ * engine sources are compiled straight into this binary (on top of the
+ * mock server from engine_testapp) so that item_alloc / store_item /
+ * item_get / assoc_find can be driven directly, without a network or a
+ * full server in between. That makes it possible to see the effect of
+ * changes to items.c / assoc.c / slabs.c in isolation.
+ *
+ * Each phase runs the operation from a configurable number of threads
+ * with a zipfian (or uniform) key popularity distribution for a fixed
+ * amount of time and reports ops/sec, ns/op and (where the platform
+ * provides a cycle counter) cycles/op.
+ *
+ * With the default (small) parameters it doubles as a smoke test and
+ * is registered with CTest; for real measurements bump the duration,
+ * thread count and key count from the command line.
+ */
+#include "config.h"
+
+#include <memcached/engine.h>
+
+/* The engine internals are C; only some of the headers carry their own
+ * linkage guards */
+extern "C" {
+#include "default_engine_internal.h"
+#include "items.h"
+#include "assoc.h"
+}
+
+#include <programs/engine_testapp/mock_server.h>
+
+#include <getopt.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+extern "C" ENGINE_ERROR_CODE create_instance(uint64_t interface,
+                                             GET_SERVER_API get_server_api,
+                                             ENGINE_HANDLE** handle);
+
+/**
+ * Read the CPU cycle counter (0 if the platform doesn't have one we
+ * know how to read; the cycles/op column is omitted in that case).
+ */
+static inline uint64_t rdcycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return (uint64_t(hi) << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Generator for a zipfian distribution over [0, items) using the
+ * approximation from Gray et al., "Quickly Generating Billion-Record
+ * Synthetic Databases". The (one-off) setup cost is O(items).
+ */
+class ZipfGenerator {
+public:
+    ZipfGenerator(uint64_t items, double theta_)
+        : count(items), theta(theta_) {
+        for (uint64_t ii = 1; ii <= count; ++ii) {
+            zetan += 1.0 / std::pow(double(ii), theta);
+        }
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / double(count), 1.0 - theta)) /
+              (1.0 - (1.0 + std::pow(0.5, theta)) / zetan);
+    }
+
+    uint64_t next(std::mt19937_64& engine) const {
+        const double u = std::uniform_real_distribution<double>(0, 1)(engine);
+        const double uz = u * zetan;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        auto rv = uint64_t(double(count) *
+                           std::pow(eta * u - eta + 1.0, alpha));
+        return rv < count ? rv : count - 1;
+    }
+
+private:
+    const uint64_t count;
+    const double theta;
+    double zetan{0.0};
+    double alpha{0.0};
+    double eta{0.0};
+};
+
+struct BenchConfig {
+    int threads{4};
+    int duration{1};
+    uint64_t keys{10000};
+    double zipf_theta{0.99};
+    size_t value_size{128};
+};
+
+static struct default_engine* engine;
+static BenchConfig config;
+static std::atomic<bool> phase_running;
+
+static int make_key(char* buffer, size_t size, uint64_t key) {
+    return snprintf(buffer, size, "key-%016" PRIx64, key);
+}
+
+struct WorkerResult {
+    uint64_t ops{0};
+    uint64_t misses{0};
+    uint64_t cycles{0};
+};
+
+typedef void (* PhaseOp)(const char* key, int nkey, const void* cookie,
+                         WorkerResult& result);
+
+static void op_store(const char* key, int nkey, const void* cookie,
+                     WorkerResult& result) {
+    hash_item* it = item_alloc(engine, key, size_t(nkey), 0, 0,
+                               int(config.value_size), cookie,
+                               PROTOCOL_BINARY_RAW_BYTES);
+    if (it == NULL) {
+        result.misses++;
+        return;
+    }
+    memset(item_get_data(it), 'x', config.value_size);
+    uint64_t cas = 0;
+    if (store_item(engine, it, &cas, OPERATION_SET,
+                   cookie) != ENGINE_SUCCESS) {
+        result.misses++;
+    }
+    item_release(engine, it);
+}
+
+static void op_get(const char* key, int nkey, const void* cookie,
+                   WorkerResult& result) {
+    hash_item* it = item_get(engine, cookie, key, size_t(nkey));
+    if (it == NULL) {
+        result.misses++;
+    } else {
+        item_release(engine, it);
+    }
+}
+
+static void op_assoc_find(const char* key, int nkey, const void* cookie,
+                          WorkerResult& result) {
+    /* Build the hash key the same way the engine does internally
+     * (bench keys always fit in the stack storage) */
+    hash_key hkey;
+    hkey.header.full_key = (hash_key_data*)&hkey.key_storage;
+    hash_key_set_len(&hkey, uint16_t(sizeof(bucket_id_t) + nkey));
+    hash_key_set_bucket_index(&hkey, engine->bucket_id);
+    hash_key_set_client_key(&hkey, key, nkey);
+
+    /* Raw probe cost: this phase runs without concurrent mutators, so
+     * reading the chains without the stripe locks is safe */
+    if (assoc_find(engine, hash_key_hash(&hkey), &hkey) == NULL) {
+        result.misses++;
+    }
+    (void)cookie;
+}
+
+static void worker_main(PhaseOp op, size_t thread_index,
+                        WorkerResult* result) {
+    std::mt19937_64 rng(0x64656265 + thread_index);
+    std::unique_ptr<ZipfGenerator> zipf;
+    if (config.zipf_theta > 0.0) {
+        zipf.reset(new ZipfGenerator(config.keys, config.zipf_theta));
+    }
+    const void* cookie = create_mock_cookie();
+    char key[64];
+
+    while (!phase_running.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    const uint64_t start_cycles = rdcycles();
+    while (phase_running.load(std::memory_order_relaxed)) {
+        /* check the stop flag once per small batch so that the load
+         * on the flag's cache line doesn't disturb the measurement */
+        for (int ii = 0; ii < 64; ++ii) {
+            uint64_t id;
+            if (zipf) {
+                id = zipf->next(rng);
+            } else {
+                id = std::uniform_int_distribution<uint64_t>(
+                    0, config.keys - 1)(rng);
+            }
+            const int nkey = make_key(key, sizeof(key), id);
+            op(key, nkey, cookie, *result);
+            result->ops++;
+        }
+    }
+    result->cycles = rdcycles() - start_cycles;
+
+    destroy_mock_cookie(cookie);
+}
+
+static void run_phase(const char* name, PhaseOp op) {
+    std::vector<WorkerResult> results(config.threads);
+    std::vector<std::thread> workers;
+
+    phase_running.store(false);
+    for (int ii = 0; ii < config.threads; ++ii) {
+        workers.emplace_back(worker_main, op, size_t(ii), &results[ii]);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    phase_running.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::seconds(config.duration));
+    phase_running.store(false, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const auto wall_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    WorkerResult total;
+    for (const auto& result : results) {
+        total.ops += result.ops;
+        total.misses += result.misses;
+        total.cycles += result.cycles;
+    }
+
+    /* every thread ran for the full wall time, so the per-op cost is
+     * the aggregated thread time over the aggregated ops */
+    const double ns_per_op = total.ops ?
+        double(wall_ns) * config.threads / double(total.ops) : 0.0;
+    const uint64_t ops_per_sec = wall_ns ?
+        total.ops * uint64_t(1000000000) / uint64_t(wall_ns) : 0;
+
+    printf("%-12s %2d threads: %10" PRIu64 " ops, %9" PRIu64 " ops/sec, "
+           "%8.0f ns/op",
+           name, config.threads, total.ops, ops_per_sec, ns_per_op);
+    if (total.cycles != 0 && total.ops != 0) {
+        printf(", %6" PRIu64 " cycles/op", total.cycles / total.ops);
+    }
+    if (total.misses != 0) {
+        printf(", %" PRIu64 " misses", total.misses);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/** Store every key once so the read phases (mostly) hit */
+static void preload(void) {
+    const void* cookie = create_mock_cookie();
+    WorkerResult result;
+    char key[64];
+    for (uint64_t ii = 0; ii < config.keys; ++ii) {
+        const int nkey = make_key(key, sizeof(key), ii);
+        op_store(key, nkey, cookie, result);
+    }
+    destroy_mock_cookie(cookie);
+    if (result.misses != 0) {
+        fprintf(stderr, "Fatal: failed to preload %" PRIu64 " of the %"
+                PRIu64 " keys (cache too small?)\n",
+                result.misses, config.keys);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: memcached_default_engine_bench [options]\n\n"
+            "  -t threads   the number of worker threads (4)\n"
+            "  -d duration  seconds to run each phase for (1)\n"
+            "  -k keys      the number of distinct keys (10000)\n"
+            "  -z theta     zipfian key skew, 0 < theta < 1 "
+            "(0.99; 0 = uniform)\n"
+            "  -s size      value size in bytes (128)\n");
+}
+
+int main(int argc, char** argv) {
+    int cmd;
+
+    while ((cmd = getopt(argc, argv, "t:d:k:z:s:")) != EOF) {
+        switch (cmd) {
+        case 't':
+            config.threads = atoi(optarg);
+            break;
+        case 'd':
+            config.duration = atoi(optarg);
+            break;
+        case 'k':
+            config.keys = strtoull(optarg, NULL, 10);
+            break;
+        case 'z':
+            config.zipf_theta = atof(optarg);
+            break;
+        case 's':
+            config.value_size = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (config.threads < 1 || config.duration < 1 || config.keys < 1 ||
+        config.zipf_theta < 0.0 || config.zipf_theta >= 1.0) {
+        usage();
+        return 1;
+    }
+
+    putenv(const_cast<char*>("MEMCACHED_UNIT_TESTS=true"));
+    init_mock_server(false);
+
+    ENGINE_HANDLE* handle = NULL;
+    if (create_instance(1, get_mock_server_api, &handle) != ENGINE_SUCCESS) {
+        fprintf(stderr, "Fatal: failed to create the engine instance\n");
+        return EXIT_FAILURE;
+    }
+    auto* v1 = reinterpret_cast<ENGINE_HANDLE_V1*>(handle);
+    /* size the cache so the configured key count fits without evictions */
+    char engine_config[128];
+    snprintf(engine_config, sizeof(engine_config), "cache_size=%" PRIu64,
+             std::max(uint64_t(64 * 1024 * 1024),
+                      config.keys * (config.value_size + 256) * 2));
+    if (v1->initialize(handle, engine_config) != ENGINE_SUCCESS) {
+        fprintf(stderr, "Fatal: failed to initialize the engine\n");
+        return EXIT_FAILURE;
+    }
+    engine = reinterpret_cast<struct default_engine*>(handle);
+
+    printf("default_engine bench: %" PRIu64 " keys, %zu byte values, "
+           "zipf theta %.2f, %ds per phase\n",
+           config.keys, config.value_size, config.zipf_theta,
+           config.duration);
+
+    preload();
+
+    run_phase("store", op_store);
+    run_phase("get", op_get);
+    run_phase("assoc_find", op_assoc_find);
+
+    v1->destroy(handle, false);
+    destroy_engine();
+    return EXIT_SUCCESS;
+}
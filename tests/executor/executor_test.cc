@@ -20,6 +20,7 @@
 #include <gtest/gtest.h>
 #include <memory>
 #include <platform/backtrace.h>
+#include <vector>
 
 class ExecutorTest : public ::testing::Test {
 protected:
@@ -130,6 +131,164 @@ TEST_F(ExecutorTest, RescheduleMissingLock) {
     EXPECT_TRUE(cmd->executionComplete);
 }
 
+/**
+ * A task which blocks inside execute() until the test opens the gate.
+ * It is used to keep an executor thread busy so that we can control
+ * when the tasks queued up behind it get to run.
+ */
+class GateTestTask : public Task {
+public:
+    GateTestTask()
+        : Task(),
+          started(false),
+          open(false) {
+    }
+
+    virtual bool execute() override {
+        std::unique_lock<std::mutex> lock(gate_mutex);
+        started = true;
+        gate_cond.notify_all();
+        while (!open) {
+            gate_cond.wait(lock);
+        }
+        return true;
+    }
+
+    void waitUntilStarted() {
+        std::unique_lock<std::mutex> lock(gate_mutex);
+        while (!started) {
+            gate_cond.wait(lock);
+        }
+    }
+
+    void openGate() {
+        std::lock_guard<std::mutex> guard(gate_mutex);
+        open = true;
+        gate_cond.notify_all();
+    }
+
+    bool started;
+    bool open;
+    std::mutex gate_mutex;
+    std::condition_variable gate_cond;
+};
+
+/**
+ * A task which appends itself to a list when executed so that the test
+ * can verify the order the tasks ran in.
+ */
+class OrderTestTask : public Task {
+public:
+    OrderTestTask(TaskPriority priority_,
+                  std::vector<OrderTestTask*>& order_,
+                  std::mutex& order_mutex_,
+                  std::condition_variable& order_cond_)
+        : Task(priority_),
+          order(order_),
+          order_mutex(order_mutex_),
+          order_cond(order_cond_) {
+    }
+
+    virtual bool execute() override {
+        std::lock_guard<std::mutex> guard(order_mutex);
+        order.push_back(this);
+        order_cond.notify_all();
+        return true;
+    }
+
+    std::vector<OrderTestTask*>& order;
+    std::mutex& order_mutex;
+    std::condition_variable& order_cond;
+};
+
+static void scheduleTask(ExecutorPool& pool, std::shared_ptr<Task>& task) {
+    std::lock_guard<std::mutex> guard(task->getMutex());
+    pool.schedule(task);
+}
+
+TEST_F(ExecutorTest, HighPriorityRunsFirst) {
+    // Use a pool with a single executor so that all of the tasks end
+    // up queued behind the gate task.
+    ExecutorPool pool(1);
+
+    auto* gate = new GateTestTask;
+    std::shared_ptr<Task> gatetask(gate);
+    scheduleTask(pool, gatetask);
+    gate->waitUntilStarted();
+
+    std::vector<OrderTestTask*> order;
+    std::mutex order_mutex;
+    std::condition_variable order_cond;
+
+    auto* low1 = new OrderTestTask(TaskPriority::Low, order,
+                                   order_mutex, order_cond);
+    std::shared_ptr<Task> lowtask1(low1);
+    auto* low2 = new OrderTestTask(TaskPriority::Low, order,
+                                   order_mutex, order_cond);
+    std::shared_ptr<Task> lowtask2(low2);
+    auto* high = new OrderTestTask(TaskPriority::High, order,
+                                   order_mutex, order_cond);
+    std::shared_ptr<Task> hightask(high);
+
+    scheduleTask(pool, lowtask1);
+    scheduleTask(pool, lowtask2);
+    scheduleTask(pool, hightask);
+
+    gate->openGate();
+
+    std::unique_lock<std::mutex> lock(order_mutex);
+    while (order.size() < 3) {
+        order_cond.wait(lock);
+    }
+
+    // Even though the high priority task was scheduled last it should
+    // have been executed before the low priority ones
+    EXPECT_EQ(high, order[0]);
+    EXPECT_EQ(low1, order[1]);
+    EXPECT_EQ(low2, order[2]);
+}
+
+TEST_F(ExecutorTest, WorkStealing) {
+    // Block both executors in a two-worker pool with gate tasks and
+    // queue a batch of work up behind them. Open just one of the
+    // gates; the executor running idle should steal the tasks queued
+    // on the still-blocked sibling so that everything completes.
+    ExecutorPool pool(2);
+
+    auto* gate1 = new GateTestTask;
+    std::shared_ptr<Task> gatetask1(gate1);
+    scheduleTask(pool, gatetask1);
+    gate1->waitUntilStarted();
+
+    auto* gate2 = new GateTestTask;
+    std::shared_ptr<Task> gatetask2(gate2);
+    scheduleTask(pool, gatetask2);
+    gate2->waitUntilStarted();
+
+    std::vector<OrderTestTask*> order;
+    std::mutex order_mutex;
+    std::condition_variable order_cond;
+
+    std::vector<std::shared_ptr<Task> > tasks;
+    for (int ii = 0; ii < 4; ++ii) {
+        tasks.emplace_back(new OrderTestTask(TaskPriority::Low, order,
+                                             order_mutex, order_cond));
+        scheduleTask(pool, tasks.back());
+    }
+
+    gate1->openGate();
+
+    {
+        std::unique_lock<std::mutex> lock(order_mutex);
+        while (order.size() < tasks.size()) {
+            order_cond.wait(lock);
+        }
+    }
+
+    // Let the other executor go so that the pool may shut down
+    gate2->openGate();
+}
+
 static std::terminate_handler default_terminate_handler;
 
 static void my_terminate_handler() {
@@ -0,0 +1,99 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <daemon/hdr_histogram.h>
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+// The histogram records in usec; samples are handed to add() in nsec
+static hrtime_t usec(uint64_t value) {
+    return hrtime_t(value * 1000);
+}
+
+TEST(HdrHistogram, InvalidPrecision) {
+    EXPECT_THROW(HdrHistogram(0), std::invalid_argument);
+    EXPECT_THROW(HdrHistogram(4), std::invalid_argument);
+    EXPECT_NO_THROW(HdrHistogram(1));
+    EXPECT_NO_THROW(HdrHistogram(3));
+}
+
+TEST(HdrHistogram, TotalAndMax) {
+    HdrHistogram hist;
+    EXPECT_EQ(0u, hist.get_total());
+    EXPECT_EQ(0u, hist.get_max());
+
+    hist.add(usec(100));
+    hist.add(usec(200));
+    hist.add(usec(150));
+    EXPECT_EQ(3u, hist.get_total());
+    EXPECT_EQ(200u, hist.get_max());
+
+    hist.reset();
+    EXPECT_EQ(0u, hist.get_total());
+    EXPECT_EQ(0u, hist.get_max());
+}
+
+TEST(HdrHistogram, PercentilePrecision) {
+    // With two significant digits the reported percentile should be
+    // within 1% of the recorded value
+    HdrHistogram hist(2);
+    for (uint64_t ii = 1; ii <= 10000; ++ii) {
+        hist.add(usec(ii));
+    }
+
+    EXPECT_NEAR(5000.0, double(hist.get_percentile(50)), 50.0);
+    EXPECT_NEAR(9000.0, double(hist.get_percentile(90)), 90.0);
+    EXPECT_NEAR(9900.0, double(hist.get_percentile(99)), 99.0);
+    EXPECT_NEAR(9990.0, double(hist.get_percentile(99.9)), 100.0);
+}
+
+TEST(HdrHistogram, WideRange) {
+    // Values from 1us to beyond the trackable range (100s) must all
+    // land in a valid counter slot
+    HdrHistogram hist;
+    for (uint64_t value = 1; value < 400000000; value *= 2) {
+        hist.add(usec(value));
+    }
+    EXPECT_EQ(29u, hist.get_total());
+    EXPECT_LE(hist.get_percentile(100), hist.get_max());
+}
+
+TEST(HdrHistogram, Merge) {
+    HdrHistogram a;
+    HdrHistogram b;
+    a.add(usec(100));
+    b.add(usec(5000));
+    b.add(usec(5000));
+
+    a += b;
+    EXPECT_EQ(3u, a.get_total());
+    EXPECT_EQ(5000u, a.get_max());
+
+    // Merging histograms of different precision is a programming error
+    HdrHistogram c(3);
+    EXPECT_THROW(a += c, std::logic_error);
+}
+
+TEST(HdrHistogram, ToString) {
+    HdrHistogram hist;
+    hist.add(usec(42));
+    const auto json = hist.to_string();
+    EXPECT_NE(std::string::npos, json.find("\"total\":1"));
+    EXPECT_NE(std::string::npos, json.find("\"max\":"));
+    EXPECT_NE(std::string::npos, json.find("\"p99.9\":"));
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <daemon/json_validator.h>
+#include <gtest/gtest.h>
+
+#include <string>
+
+static bool validate(const std::string& value) {
+    return is_valid_json(reinterpret_cast<const uint8_t*>(value.data()),
+                         value.size());
+}
+
+TEST(JsonValidator, SimpleDocuments) {
+    EXPECT_TRUE(validate("{}"));
+    EXPECT_TRUE(validate("[]"));
+    EXPECT_TRUE(validate("{\"a\":1}"));
+    EXPECT_TRUE(validate("[1, 2.5e-3, true, false, null, \"x\"]"));
+    EXPECT_TRUE(validate("  { \"key\" : [ \"value\" ] }  "));
+}
+
+TEST(JsonValidator, TopLevelScalars) {
+    // RFC 7159 permits any value at top level.
+    EXPECT_TRUE(validate("123"));
+    EXPECT_TRUE(validate("-0.5e+10"));
+    EXPECT_TRUE(validate("\"string\""));
+    EXPECT_TRUE(validate("true"));
+    EXPECT_TRUE(validate("false"));
+    EXPECT_TRUE(validate("null"));
+}
+
+TEST(JsonValidator, Invalid) {
+    EXPECT_FALSE(validate(""));
+    EXPECT_FALSE(validate("{"));
+    EXPECT_FALSE(validate("{}}"));
+    EXPECT_FALSE(validate("{\"a\":}"));
+    EXPECT_FALSE(validate("{\"a\" 1}"));
+    EXPECT_FALSE(validate("{\"a\":1,}"));
+    EXPECT_FALSE(validate("{1:2}"));
+    EXPECT_FALSE(validate("[1,]"));
+    EXPECT_FALSE(validate("not json"));
+    EXPECT_FALSE(validate("nul"));
+    EXPECT_FALSE(validate("trueish"));
+}
+
+TEST(JsonValidator, Numbers) {
+    EXPECT_TRUE(validate("0"));
+    EXPECT_TRUE(validate("-1"));
+    EXPECT_TRUE(validate("1.25"));
+    EXPECT_TRUE(validate("1e10"));
+    EXPECT_TRUE(validate("1.5E-3"));
+    EXPECT_FALSE(validate("01"));
+    EXPECT_FALSE(validate("1."));
+    EXPECT_FALSE(validate("1e"));
+    EXPECT_FALSE(validate("1e+"));
+    EXPECT_FALSE(validate("-"));
+    EXPECT_FALSE(validate("+1"));
+}
+
+TEST(JsonValidator, Strings) {
+    EXPECT_TRUE(validate("\"escapes \\\" \\\\ \\/ \\b \\f \\n \\r \\t\""));
+    EXPECT_TRUE(validate("\"unicode \\u00e9 \\u0041\""));
+    EXPECT_FALSE(validate("\"unterminated"));
+    EXPECT_FALSE(validate("\"bad escape \\q\""));
+    EXPECT_FALSE(validate("\"bad unicode \\u12g4\""));
+    EXPECT_FALSE(validate(std::string("\"control \x01 char\"")));
+}
+
+TEST(JsonValidator, Utf8) {
+    EXPECT_TRUE(validate(std::string("\"caf\xc3\xa9\"")));
+    EXPECT_TRUE(validate(std::string("\"\xe2\x82\xac\"")));
+    EXPECT_TRUE(validate(std::string("\"\xf0\x9f\x98\x80\"")));
+    // Stray continuation byte.
+    EXPECT_FALSE(validate(std::string("\"\x80\"")));
+    // Truncated sequence.
+    EXPECT_FALSE(validate(std::string("\"\xc3\"")));
+    // Overlong encodings.
+    EXPECT_FALSE(validate(std::string("\"\xc0\xaf\"")));
+    EXPECT_FALSE(validate(std::string("\"\xe0\x80\xaf\"")));
+    // UTF-16 surrogate.
+    EXPECT_FALSE(validate(std::string("\"\xed\xa0\x80\"")));
+    // Beyond the Unicode range.
+    EXPECT_FALSE(validate(std::string("\"\xf4\x90\x80\x80\"")));
+}
+
+TEST(JsonValidator, LongStrings) {
+    // Strings long enough to exercise the SIMD scanning loops,
+    // including special characters at various offsets within a vector.
+    const std::string filler(1000, 'a');
+    EXPECT_TRUE(validate("\"" + filler + "\""));
+    EXPECT_TRUE(validate("\"" + filler + "\\n\""));
+    EXPECT_TRUE(validate("{\"key\":\"" + filler + "\"}"));
+    for (int offset = 0; offset < 40; offset++) {
+        const std::string prefix(offset, 'x');
+        EXPECT_TRUE(validate("\"" + prefix + "\\t" + filler + "\""));
+        EXPECT_FALSE(validate("\"" + prefix + "\x02" + filler + "\""));
+    }
+}
+
+TEST(JsonValidator, Nesting) {
+    std::string nested;
+    for (int depth = 0; depth < 50; depth++) {
+        nested = "[" + nested + "]";
+    }
+    EXPECT_TRUE(validate(nested));
+
+    // Deeper than the validator's recursion bound.
+    const std::string deep = std::string(200, '[') + std::string(200, ']');
+    EXPECT_FALSE(validate(deep));
+}
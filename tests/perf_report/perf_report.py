@@ -0,0 +1,412 @@
+#!/usr/bin/python
+
+#     Copyright 2016 Couchbase, Inc
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+
+# Runs the performance harnesses of this repository against the current
+# build and renders the results as a trend report:
+#
+#  * memcached_default_engine_bench - in-process engine microbenchmark
+#  * mcbench against a freshly spawned memcached - end-to-end
+#    throughput and latency over the wire
+#  * the LatencyPerfTest workloads of memcached_testapp - fixed
+#    per-operation latency probes (plain/ssl/subdoc/pipelined)
+#
+# Every run appends one JSON line (metrics plus hardware and revision
+# metadata) to docs/perf/history.jsonl and re-renders the trend tables
+# in docs/perf/index.md from the accumulated history, so a change to
+# the hot paths lands with a visible throughput/latency delta instead
+# of guesswork. See docs/PerformanceTracking.md for the workflow.
+#
+# Invoked by the memcached-perf-report build target; can also be run by
+# hand against any build directory.
+
+from __future__ import print_function
+import argparse
+import datetime
+import json
+import os
+import platform
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+verbose = False
+
+
+def log(msg):
+    if verbose:
+        print("perf_report: " + msg, file=sys.stderr)
+
+
+def run(args, env=None):
+    """Run a child process and return (returncode, stdout as a string)."""
+    log("running: " + " ".join(args))
+    process = subprocess.Popen(args, stdout=subprocess.PIPE,
+                               stderr=subprocess.STDOUT, env=env)
+    stdout = process.communicate()[0]
+    if not isinstance(stdout, str):
+        stdout = stdout.decode("utf-8", "replace")
+    return (process.returncode, stdout)
+
+
+def hardware_metadata():
+    """Collect the metadata needed to tell results from different
+    machines apart. Numbers from a laptop and from the perf rig must
+    never end up in the same trend column."""
+    meta = {"hostname": platform.node(),
+            "os": platform.platform(),
+            "cpu_model": platform.processor(),
+            "cpu_count": None,
+            "memory_mb": None}
+    try:
+        import multiprocessing
+        meta["cpu_count"] = multiprocessing.cpu_count()
+    except Exception:
+        pass
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    meta["cpu_model"] = line.split(":", 1)[1].strip()
+                    break
+    except IOError:
+        pass
+    try:
+        with open("/proc/meminfo") as f:
+            for line in f:
+                if line.startswith("MemTotal"):
+                    meta["memory_mb"] = int(line.split()[1]) // 1024
+                    break
+    except IOError:
+        pass
+    return meta
+
+
+def git_revision(source_dir):
+    (status, stdout) = run(["git", "-C", source_dir,
+                            "rev-parse", "--short", "HEAD"])
+    return stdout.strip() if status == 0 else "unknown"
+
+
+def run_engine_bench(opts, metrics):
+    """Run the in-process engine microbenchmark and record ops/sec and
+    ns/op per phase (store / get / assoc_find)."""
+    exe = os.path.join(opts.build_dir, "memcached_default_engine_bench")
+    (status, stdout) = run([exe,
+                            "-t", str(opts.engine_threads),
+                            "-d", str(opts.duration),
+                            "-k", str(opts.keys)])
+    if status != 0:
+        print("perf_report: engine benchmark failed:\n" + stdout,
+              file=sys.stderr)
+        return False
+    pattern = re.compile(r"^(\S+)\s+\d+ threads:\s+(\d+) ops,"
+                         r"\s+(\d+) ops/sec,\s+(\d+) ns/op")
+    for line in stdout.splitlines():
+        m = pattern.match(line)
+        if m:
+            metrics["engine." + m.group(1) + ".ops_per_sec"] = int(m.group(3))
+            metrics["engine." + m.group(1) + ".ns_per_op"] = int(m.group(4))
+    return True
+
+
+class MemcachedServer(object):
+    """Spawn a memcached from the build directory on an ephemeral port
+    for the over-the-wire suite, with the test SASL password database
+    so the admin user can create the default bucket."""
+
+    def __init__(self, opts):
+        self.opts = opts
+        self.process = None
+        self.config_file = None
+        self.port_file = os.path.join(tempfile.gettempdir(),
+                                      "perf_report_ports.%d" % os.getpid())
+        self.port = None
+
+    def start(self):
+        config = {"interfaces": [{"port": 0,
+                                  "ipv4": True,
+                                  "ipv6": False,
+                                  "maxconn": 1000,
+                                  "backlog": 1024,
+                                  "host": "*"}],
+                  "admin": "_admin",
+                  "threads": self.opts.server_threads}
+        self.config_file = tempfile.NamedTemporaryFile(delete=False,
+                                                       mode="w")
+        self.config_file.write(json.dumps(config))
+        self.config_file.close()
+
+        if os.path.exists(self.port_file):
+            os.remove(self.port_file)
+
+        env = os.environ.copy()
+        env["MEMCACHED_PORT_FILENAME"] = self.port_file
+        env["CBSASL_PWFILE"] = self.opts.pwfile
+
+        exe = os.path.join(self.opts.build_dir, "memcached")
+        log("spawning " + exe)
+        self.process = subprocess.Popen(
+            [exe, "-C", self.config_file.name],
+            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, env=env)
+
+        # Wait for the server to publish its port numbers
+        deadline = time.time() + 30
+        while not os.path.exists(self.port_file):
+            if time.time() > deadline or self.process.poll() is not None:
+                raise RuntimeError("memcached failed to start")
+            time.sleep(0.1)
+
+        with open(self.port_file) as f:
+            ports = json.load(f)
+        for entry in ports["ports"]:
+            if not entry.get("ssl", False) and entry.get("port", 0) > 0:
+                self.port = entry["port"]
+                break
+        if self.port is None:
+            raise RuntimeError("no plain port found in " + self.port_file)
+        log("memcached listening on port %d" % self.port)
+
+    def create_default_bucket(self):
+        exe = os.path.join(self.opts.build_dir, "mcbucket")
+        (status, stdout) = run([exe, "-h", "127.0.0.1:%d" % self.port,
+                                "-u", "_admin", "-P", "password",
+                                "create", "default",
+                                "default_engine.so", ""])
+        if status != 0:
+            raise RuntimeError("failed to create bucket:\n" + stdout)
+
+    def stop(self):
+        if self.process is not None and self.process.poll() is None:
+            self.process.terminate()
+            self.process.wait()
+        if self.config_file is not None:
+            os.remove(self.config_file.name)
+        if os.path.exists(self.port_file):
+            os.remove(self.port_file)
+
+
+def run_mcbench(opts, metrics):
+    """Run mcbench against a spawned server and record the aggregate
+    throughput and the get/set latency percentiles."""
+    server = MemcachedServer(opts)
+    try:
+        server.start()
+        server.create_default_bucket()
+        exe = os.path.join(opts.build_dir, "mcbench")
+        (status, stdout) = run([exe, "-h", "127.0.0.1",
+                                "-p", str(server.port),
+                                "-t", str(opts.mcbench_threads),
+                                "-c", str(opts.mcbench_connections),
+                                "-d", str(opts.duration),
+                                "-k", str(opts.keys)])
+    finally:
+        server.stop()
+
+    if status != 0:
+        print("perf_report: mcbench failed:\n" + stdout, file=sys.stderr)
+        return False
+
+    m = re.search(r"\((\d+) ops/sec\)", stdout)
+    if m:
+        metrics["mcbench.ops_per_sec"] = int(m.group(1))
+
+    op = None
+    for line in stdout.splitlines():
+        m = re.match(r"^(get|set): (\d+) ops", line)
+        if m:
+            op = m.group(1)
+            continue
+        m = re.match(r"^\s+p50: ([\d.]+)us\s+p90: [\d.]+us"
+                     r"\s+p99: ([\d.]+)us", line)
+        if m and op is not None:
+            metrics["mcbench." + op + ".p50_us"] = float(m.group(1))
+            metrics["mcbench." + op + ".p99_us"] = float(m.group(2))
+            op = None
+    return True
+
+
+def run_latency_tests(opts, metrics):
+    """Run the LatencyPerfTest workloads of memcached_testapp (in
+    report-only mode; the baseline gate stays a CBNT concern) and
+    record the reported percentiles."""
+    exe = os.path.join(opts.build_dir, "memcached_testapp")
+    (status, stdout) = run([exe, "-e", "--gtest_filter=LatencyPerfTest.*"])
+    if status != 0:
+        print("perf_report: latency tests failed:\n" + stdout,
+              file=sys.stderr)
+        return False
+    pattern = re.compile(r"^\s+(\S+): p50 ([\d.]+) usec,"
+                         r" p99 ([\d.]+) usec")
+    for line in stdout.splitlines():
+        m = pattern.match(line)
+        if m:
+            metrics["latency." + m.group(1) + ".p50_us"] = float(m.group(2))
+            metrics["latency." + m.group(1) + ".p99_us"] = float(m.group(3))
+    return True
+
+
+def load_history(path):
+    history = []
+    if os.path.exists(path):
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+                if line:
+                    history.append(json.loads(line))
+    return history
+
+
+def format_delta(current, previous):
+    """Render the relative change against the previous run; for
+    latency metrics lower is better, but the sign convention (positive
+    = the number went up) is the same everywhere."""
+    if previous in (None, 0):
+        return ""
+    delta = 100.0 * (current - previous) / previous
+    return " (%+.1f%%)" % delta
+
+
+def render_report(history, path):
+    """Render the accumulated history as one markdown trend table per
+    suite, newest run last so the bottom row is always 'this change'."""
+    suites = {}
+    for entry in history:
+        for name in entry["metrics"]:
+            suites.setdefault(name.split(".")[0], set()).add(name)
+
+    recent = history[-20:]
+    with open(path, "w") as f:
+        f.write("# Performance trend report\n\n")
+        f.write("Generated by tests/perf_report/perf_report.py; see\n")
+        f.write("docs/PerformanceTracking.md for the workflow. Deltas are\n")
+        f.write("relative to the previous recorded run.\n")
+
+        latest = history[-1]
+        hw = latest.get("hardware", {})
+        f.write("\nLast run: %s at revision %s on %s (%s, %s cores, "
+                "%s MB)\n" % (latest["timestamp"], latest["rev"],
+                              hw.get("hostname", "?"),
+                              hw.get("cpu_model", "?"),
+                              hw.get("cpu_count", "?"),
+                              hw.get("memory_mb", "?")))
+
+        for suite in sorted(suites):
+            columns = sorted(suites[suite])
+            f.write("\n## %s\n\n" % suite)
+            f.write("| run | revision | " +
+                    " | ".join(c.split(".", 1)[1] for c in columns) +
+                    " |\n")
+            f.write("| --- | --- | " +
+                    " | ".join("---" for c in columns) + " |\n")
+            previous = None
+            for entry in recent:
+                cells = []
+                for c in columns:
+                    value = entry["metrics"].get(c)
+                    if value is None:
+                        cells.append("-")
+                        continue
+                    prev_value = None
+                    if previous is not None:
+                        prev_value = previous["metrics"].get(c)
+                    cells.append("%g%s" % (value,
+                                           format_delta(value, prev_value)))
+                f.write("| %s | %s | %s |\n" % (entry["timestamp"],
+                                                entry["rev"],
+                                                " | ".join(cells)))
+                previous = entry
+    print("perf_report: report rendered to " + path)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run the memcached performance harnesses and "
+                    "render a trend report")
+    parser.add_argument("--build-dir", required=True,
+                        help="the build directory holding the binaries")
+    parser.add_argument("--source-dir", required=True,
+                        help="the memcached source directory")
+    parser.add_argument("--output-dir", default=None,
+                        help="where to keep the history and the report "
+                             "(default: <source-dir>/docs/perf)")
+    parser.add_argument("--json-out", default=None,
+                        help="also write this run's results to the given "
+                             "file (for CBNT)")
+    parser.add_argument("--pwfile", default=None,
+                        help="SASL password database for the admin user "
+                             "(default: the testapp one)")
+    parser.add_argument("--duration", type=int, default=10,
+                        help="seconds per benchmark phase (default 10)")
+    parser.add_argument("--keys", type=int, default=100000,
+                        help="distinct keys per workload (default 100000)")
+    parser.add_argument("--engine-threads", type=int, default=4)
+    parser.add_argument("--mcbench-threads", type=int, default=2)
+    parser.add_argument("--mcbench-connections", type=int, default=10)
+    parser.add_argument("--server-threads", type=int, default=4)
+    parser.add_argument("--skip", action="append", default=[],
+                        choices=["engine", "mcbench", "latency"],
+                        help="skip the given suite (may be repeated)")
+    parser.add_argument("--verbose", action="store_true")
+    opts = parser.parse_args()
+
+    global verbose
+    verbose = opts.verbose
+
+    if opts.output_dir is None:
+        opts.output_dir = os.path.join(opts.source_dir, "docs", "perf")
+    if opts.pwfile is None:
+        opts.pwfile = os.path.join(opts.source_dir, "tests", "testapp",
+                                   "cbsaslpw.json")
+
+    metrics = {}
+    ok = True
+    if "engine" not in opts.skip:
+        ok = run_engine_bench(opts, metrics) and ok
+    if "mcbench" not in opts.skip:
+        ok = run_mcbench(opts, metrics) and ok
+    if "latency" not in opts.skip:
+        ok = run_latency_tests(opts, metrics) and ok
+
+    if not metrics:
+        print("perf_report: no metrics collected", file=sys.stderr)
+        return 1
+
+    entry = {"timestamp":
+             datetime.datetime.utcnow().strftime("%Y-%m-%d %H:%M"),
+             "rev": git_revision(opts.source_dir),
+             "hardware": hardware_metadata(),
+             "metrics": metrics}
+
+    if opts.json_out:
+        with open(opts.json_out, "w") as f:
+            json.dump(entry, f, indent=2, sort_keys=True)
+
+    if not os.path.isdir(opts.output_dir):
+        os.makedirs(opts.output_dir)
+    history_path = os.path.join(opts.output_dir, "history.jsonl")
+    with open(history_path, "a") as f:
+        f.write(json.dumps(entry, sort_keys=True) + "\n")
+
+    history = load_history(history_path)
+    render_report(history, os.path.join(opts.output_dir, "index.md"))
+
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,146 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Functional tests for PROTOCOL_BINARY_CMD_GET_RANGE.
+ *
+ * GET_RANGE returns [offset, offset + length) of a document's value in
+ * a GET-shaped response (4 byte flags extras followed by the fragment).
+ * length == 0 means "to the end of the value" and an overshooting
+ * length is clamped; only the offset can be out of range.
+ */
+
+#include "testapp.h"
+
+#include <platform/cb_malloc.h>
+
+#include <string>
+
+class GetRangeTest : public TestappTest {
+protected:
+    // Send a GET_RANGE and validate the response status. On success the
+    // returned fragment must equal 'expected' and the response must be
+    // GET-shaped (flags extras, item cas in the header).
+    void get_range(const std::string& key, uint32_t offset, uint32_t length,
+                   protocol_binary_response_status expected_status,
+                   const std::string& expected = "") {
+        union {
+            protocol_binary_request_get_range request;
+            protocol_binary_response_get response;
+            char bytes[1024];
+        } buffer;
+
+        memset(buffer.bytes, 0, sizeof(buffer.request.bytes));
+        buffer.request.message.header.request.magic = PROTOCOL_BINARY_REQ;
+        buffer.request.message.header.request.opcode =
+            PROTOCOL_BINARY_CMD_GET_RANGE;
+        buffer.request.message.header.request.extlen = 8;
+        buffer.request.message.header.request.keylen =
+            htons((uint16_t)key.length());
+        buffer.request.message.header.request.bodylen =
+            htonl((uint32_t)(8 + key.length()));
+        buffer.request.message.header.request.datatype =
+            PROTOCOL_BINARY_RAW_BYTES;
+        buffer.request.message.header.request.opaque = 0xdeadbeef;
+        buffer.request.message.body.offset = htonl(offset);
+        buffer.request.message.body.length = htonl(length);
+
+        size_t len = sizeof(buffer.request.bytes);
+        memcpy(buffer.bytes + len, key.data(), key.length());
+        len += key.length();
+
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        mcbp_validate_response_header(
+            (protocol_binary_response_no_extras*)&buffer.response,
+            PROTOCOL_BINARY_CMD_GET_RANGE, expected_status);
+
+        if (expected_status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            const auto& header = buffer.response.message.header.response;
+            ASSERT_EQ(4u, header.extlen);
+            /* safe_recv_packet has already converted bodylen */
+            ASSERT_EQ(4u + expected.length(), header.bodylen);
+            EXPECT_NE(0u, ntohll(header.cas));
+            std::string fragment(buffer.bytes +
+                                 sizeof(protocol_binary_response_header) + 4,
+                                 expected.length());
+            EXPECT_EQ(expected, fragment);
+        }
+    }
+};
+
+// Fragments from the middle, start and end of the value.
+TEST_F(GetRangeTest, Fragment) {
+    store_object("get_range", "0123456789");
+
+    get_range("get_range", 2, 5, PROTOCOL_BINARY_RESPONSE_SUCCESS, "23456");
+    get_range("get_range", 0, 1, PROTOCOL_BINARY_RESPONSE_SUCCESS, "0");
+    get_range("get_range", 9, 1, PROTOCOL_BINARY_RESPONSE_SUCCESS, "9");
+
+    delete_object("get_range");
+}
+
+// length == 0 means "to the end", and a length overshooting the value
+// is clamped rather than rejected.
+TEST_F(GetRangeTest, LengthClamping) {
+    store_object("get_range", "0123456789");
+
+    get_range("get_range", 4, 0, PROTOCOL_BINARY_RESPONSE_SUCCESS, "456789");
+    get_range("get_range", 0, 0, PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              "0123456789");
+    get_range("get_range", 8, 1000, PROTOCOL_BINARY_RESPONSE_SUCCESS, "89");
+    get_range("get_range", 0, 0xffffffff, PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              "0123456789");
+
+    delete_object("get_range");
+}
+
+// The offset must land inside the value; at or past the end is ERANGE.
+TEST_F(GetRangeTest, OffsetPastEnd) {
+    store_object("get_range", "0123456789");
+
+    get_range("get_range", 10, 1, PROTOCOL_BINARY_RESPONSE_ERANGE);
+    get_range("get_range", 0xffffffff, 0, PROTOCOL_BINARY_RESPONSE_ERANGE);
+
+    delete_object("get_range");
+}
+
+// A nonexistent key fails with KEY_ENOENT.
+TEST_F(GetRangeTest, MissingKey) {
+    delete_object("get_range", true);
+    get_range("get_range", 0, 0, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+}
+
+// A byte range of a Snappy stream is useless to the client, so a
+// compressed value is refused with NOT_SUPPORTED instead of inflated.
+TEST_F(GetRangeTest, CompressedValue) {
+    const char inflated[] = "aaaaaaaaabbbbbbbccccccdddddd";
+    char* deflated;
+    size_t deflated_len = compress_document(inflated, strlen(inflated),
+                                            &deflated);
+
+    set_datatype_feature(true);
+    store_object_w_datatype("get_range_compressed", deflated, deflated_len,
+                            /*compressed*/true, /*JSON*/false);
+    set_datatype_feature(false);
+
+    get_range("get_range_compressed", 0, 4,
+              PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED);
+
+    cb_free(deflated);
+    delete_object("get_range_compressed");
+}
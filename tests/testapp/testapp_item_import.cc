@@ -0,0 +1,177 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Functional tests for PROTOCOL_BINARY_CMD_ITEM_IMPORT.
+ *
+ * The request value is a stream of records in the default engine's
+ * snapshot segment payload format; the response value is two uint32_t
+ * counters (loaded, skipped) in network byte order.
+ */
+
+#include "testapp.h"
+
+#include <string>
+#include <vector>
+
+/*
+ * Mirror of the record header used by the default engine's snapshot
+ * payload (engines/default_engine/snapshot.c). The stream is written and
+ * read with memcpy of this struct, so the fields are native-endian and
+ * the layout is padding-free by construction (24 bytes).
+ */
+struct import_record_header {
+    uint64_t exptime; /* absolute unix time; 0 = never expires */
+    uint32_t nbytes;
+    uint32_t flags;
+    uint16_t nkey;
+    uint8_t datatype;
+    uint8_t unused[5];
+};
+
+class ItemImportTest : public TestappTest {
+protected:
+    // Append a single record for key/value to the stream.
+    void add_record(std::vector<char>& stream,
+                    const std::string& key,
+                    const std::string& value,
+                    uint32_t flags = 0,
+                    uint64_t exptime = 0) {
+        import_record_header header;
+        memset(&header, 0, sizeof(header));
+        header.exptime = exptime;
+        header.nbytes = (uint32_t)value.size();
+        header.flags = flags;
+        header.nkey = (uint16_t)key.size();
+        header.datatype = PROTOCOL_BINARY_RAW_BYTES;
+
+        stream.insert(stream.end(), (char*)&header,
+                      (char*)&header + sizeof(header));
+        stream.insert(stream.end(), key.begin(), key.end());
+        stream.insert(stream.end(), value.begin(), value.end());
+    }
+
+    // Send the stream as an ITEM_IMPORT command and validate the
+    // response status. On success the (loaded, skipped) counters from
+    // the response value are checked as well.
+    void import(const std::vector<char>& stream,
+                protocol_binary_response_status expected_status,
+                uint32_t expected_loaded = 0,
+                uint32_t expected_skipped = 0) {
+        union {
+            protocol_binary_request_no_extras request;
+            protocol_binary_response_no_extras response;
+            char bytes[8192];
+        } buffer;
+
+        size_t len = mcbp_raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                      PROTOCOL_BINARY_CMD_ITEM_IMPORT,
+                                      NULL, 0,
+                                      stream.data(), stream.size());
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        mcbp_validate_response_header(&buffer.response,
+                                      PROTOCOL_BINARY_CMD_ITEM_IMPORT,
+                                      expected_status);
+
+        if (expected_status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            /* safe_recv_packet has already converted bodylen */
+            ASSERT_EQ(8u, buffer.response.message.header.response.bodylen);
+            uint32_t counters[2];
+            memcpy(counters, buffer.bytes + sizeof(buffer.response.bytes),
+                   sizeof(counters));
+            EXPECT_EQ(expected_loaded, ntohl(counters[0]));
+            EXPECT_EQ(expected_skipped, ntohl(counters[1]));
+        }
+    }
+};
+
+// Import a small stream and read every key back through GET.
+TEST_F(ItemImportTest, RoundTrip) {
+    std::vector<char> stream;
+    add_record(stream, "import_a", "value_a", 0xcafef00d);
+    add_record(stream, "import_b", "value_b");
+    add_record(stream, "import_c", std::string(1000, 'c'));
+
+    import(stream, PROTOCOL_BINARY_RESPONSE_SUCCESS, 3, 0);
+
+    validate_object("import_a", "value_a");
+    validate_flags("import_a", 0xcafef00d);
+    validate_object("import_b", "value_b");
+    validate_object("import_c", std::string(1000, 'c'));
+
+    delete_object("import_a");
+    delete_object("import_b");
+    delete_object("import_c");
+}
+
+// Records are admitted with ADD semantics: live data wins over the
+// imported copy and the loser is reported in the skipped counter.
+TEST_F(ItemImportTest, AddSemantics) {
+    store_object("import_live", "original");
+
+    std::vector<char> stream;
+    add_record(stream, "import_live", "imported");
+    import(stream, PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, 1);
+
+    validate_object("import_live", "original");
+    delete_object("import_live");
+}
+
+// Keyless and already-expired records are counted as skipped without
+// failing the rest of the stream.
+TEST_F(ItemImportTest, SkipsExpiredAndKeyless) {
+    std::vector<char> stream;
+    add_record(stream, "", "orphan value");
+    add_record(stream, "import_expired", "stale", 0, 1); /* 1970 */
+    add_record(stream, "import_fresh", "fresh");
+
+    import(stream, PROTOCOL_BINARY_RESPONSE_SUCCESS, 1, 2);
+
+    validate_object("import_fresh", "fresh");
+    delete_object("import_fresh");
+}
+
+// A stream which ends in the middle of a record header fails with
+// EINVAL (records ahead of the damage may already have been admitted).
+TEST_F(ItemImportTest, TruncatedHeader) {
+    std::vector<char> stream;
+    add_record(stream, "import_trunc1", "value");
+    stream.resize(stream.size() - 2);
+
+    import(stream, PROTOCOL_BINARY_RESPONSE_EINVAL);
+    delete_object("import_trunc1", true);
+}
+
+// A record header whose nbytes overruns the end of the stream fails
+// with EINVAL as well.
+TEST_F(ItemImportTest, TruncatedBody) {
+    std::vector<char> stream;
+    add_record(stream, "import_trunc2", "intact");
+    add_record(stream, "import_trunc3", "this value is cut short");
+    stream.resize(stream.size() - 4);
+
+    import(stream, PROTOCOL_BINARY_RESPONSE_EINVAL);
+    delete_object("import_trunc2", true);
+    delete_object("import_trunc3", true);
+}
+
+// An empty stream has nothing to import and is rejected.
+TEST_F(ItemImportTest, EmptyStream) {
+    std::vector<char> stream;
+    import(stream, PROTOCOL_BINARY_RESPONSE_EINVAL);
+}
@@ -0,0 +1,232 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Latency regression tests.
+ *
+ * Each test runs a fixed workload (plain GET, GET over SSL, sub-document
+ * GET, pipelined GET) against the server started by TestappTest and
+ * reports the observed p50 / p99 latency. When the environment variable
+ * MEMCACHED_LATENCY_BASELINE names a JSON baseline file (see
+ * testapp_latency_baseline.json) the percentiles are additionally gated
+ * against the recorded values with the tolerance given in the file, so
+ * that a latency regression fails the test instead of silently merging.
+ *
+ * Without the environment variable the tests are report-only; the
+ * baseline gate is intended for the controlled performance machines
+ * driven through tests/cbnt_tests/cbnt_test_list.yml.
+ */
+
+#include "testapp_subdoc.h"
+
+#include <protocol/connection/client_mcbp_connection.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+class LatencyPerfTest : public TestappTest {
+public:
+    void SetUp() {
+        TestappTest::SetUp();
+        // Performance test - disable ewouldblock_engine.
+        ewouldblock_engine_disable();
+        iterations = 2000;
+    }
+
+protected:
+    struct Percentiles {
+        double p50;
+        double p99;
+    };
+
+    /**
+     * Compute the p50 / p99 percentiles (in microseconds) of the
+     * individual samples. The vector is sorted as a side effect.
+     */
+    static Percentiles summarize(std::vector<uint64_t>& usec) {
+        Percentiles ret;
+        std::sort(usec.begin(), usec.end());
+        ret.p50 = double(usec[usec.size() / 2]);
+        ret.p99 = double(usec[(usec.size() * 99) / 100]);
+        return ret;
+    }
+
+    /**
+     * Report the measured percentiles for the named workload and - if a
+     * baseline file is configured - verify that they are within the
+     * allowed tolerance of the recorded values.
+     */
+    void verify(const std::string& workload, const Percentiles& measured) {
+        std::cout << "  " << workload << ": p50 " << measured.p50
+                  << " usec, p99 " << measured.p99 << " usec" << std::endl;
+
+        char* env = getenv("MEMCACHED_LATENCY_BASELINE");
+        if (env == nullptr) {
+            return;
+        }
+
+        std::ifstream file(env);
+        ASSERT_TRUE(file.good()) << "Failed to open latency baseline file: "
+                                 << env;
+        std::stringstream content;
+        content << file.rdbuf();
+        unique_cJSON_ptr root(cJSON_Parse(content.str().c_str()));
+        ASSERT_NE(nullptr, root.get())
+            << "Failed to parse latency baseline file: " << env;
+
+        double tolerance = 0.2;
+        cJSON* tol = cJSON_GetObjectItem(root.get(), "tolerance");
+        if (tol != nullptr) {
+            tolerance = tol->valuedouble;
+        }
+
+        cJSON* entry = cJSON_GetObjectItem(root.get(), workload.c_str());
+        if (entry == nullptr) {
+            // No baseline recorded for this workload (yet); report-only.
+            return;
+        }
+
+        cJSON* p50 = cJSON_GetObjectItem(entry, "p50");
+        cJSON* p99 = cJSON_GetObjectItem(entry, "p99");
+        ASSERT_NE(nullptr, p50) << "Baseline for " << workload
+                                << " is missing \"p50\"";
+        ASSERT_NE(nullptr, p99) << "Baseline for " << workload
+                                << " is missing \"p99\"";
+
+        EXPECT_LE(measured.p50, p50->valuedouble * (1.0 + tolerance))
+            << workload << " p50 latency regressed beyond the baseline ("
+            << p50->valuedouble << " usec +" << (tolerance * 100) << "%)";
+        EXPECT_LE(measured.p99, p99->valuedouble * (1.0 + tolerance))
+            << workload << " p99 latency regressed beyond the baseline ("
+            << p99->valuedouble << " usec +" << (tolerance * 100) << "%)";
+    }
+
+    /**
+     * Fetch the MCBP connection to use for the workload and store the
+     * document the GET workloads operate on.
+     */
+    MemcachedBinprotConnection& prepare(bool ssl, const std::string& key) {
+        auto& conn = dynamic_cast<MemcachedBinprotConnection&>(
+            connectionMap.getConnection(Protocol::Memcached, ssl, AF_INET));
+        conn.reconnect();
+
+        Document doc;
+        doc.info.cas = Greenstack::CAS::Wildcard;
+        doc.info.compression = Greenstack::Compression::None;
+        doc.info.datatype = Greenstack::Datatype::Raw;
+        doc.info.flags = 0;
+        doc.info.id = key;
+        doc.value.resize(256);
+        std::fill(doc.value.begin(), doc.value.end(), 'x');
+        conn.mutate(doc, 0, Greenstack::MutationType::Set);
+
+        return conn;
+    }
+
+    /**
+     * Time `iterations` individual GETs of the given document, one at a
+     * time (a full round-trip per sample).
+     */
+    void run_get_workload(const std::string& workload, bool ssl) {
+        const std::string key("latency." + workload);
+        auto& conn = prepare(ssl, key);
+
+        std::vector<uint64_t> usec;
+        usec.reserve(iterations);
+        for (size_t ii = 0; ii < iterations; ii++) {
+            const auto start = std::chrono::steady_clock::now();
+            conn.get(key, 0);
+            const auto stop = std::chrono::steady_clock::now();
+            usec.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                               stop - start).count());
+        }
+
+        verify(workload, summarize(usec));
+    }
+
+    size_t iterations;
+};
+
+TEST_F(LatencyPerfTest, PlainGet) {
+    run_get_workload("plain_get", false);
+}
+
+TEST_F(LatencyPerfTest, SslGet) {
+    run_get_workload("ssl_get", true);
+}
+
+TEST_F(LatencyPerfTest, SubdocGet) {
+    store_object("latency.subdoc", "{\"field\":\"value\"}");
+
+    std::vector<uint64_t> usec;
+    usec.reserve(iterations);
+    for (size_t ii = 0; ii < iterations; ii++) {
+        const auto start = std::chrono::steady_clock::now();
+        EXPECT_TRUE(subdoc_verify_cmd(
+            SubdocCmd(PROTOCOL_BINARY_CMD_SUBDOC_GET, "latency.subdoc",
+                      "field"),
+            PROTOCOL_BINARY_RESPONSE_SUCCESS, "\"value\""));
+        const auto stop = std::chrono::steady_clock::now();
+        usec.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                           stop - start).count());
+    }
+
+    delete_object("latency.subdoc");
+    verify("subdoc_get", summarize(usec));
+}
+
+TEST_F(LatencyPerfTest, PipelinedGet) {
+    const std::string key("latency.pipelined_get");
+    auto& conn = prepare(false, key);
+
+    // Send `depth` GETs back-to-back before reading any of the responses,
+    // and record the average per-operation latency of each batch.
+    const size_t depth = 32;
+    const size_t batches = iterations / depth;
+
+    Frame request = conn.encodeCmdGet(key, 0);
+    Frame batch;
+    for (size_t ii = 0; ii < depth; ii++) {
+        std::copy(request.payload.begin(), request.payload.end(),
+                  std::back_inserter(batch.payload));
+    }
+
+    std::vector<uint64_t> usec;
+    usec.reserve(batches);
+    Frame response;
+    for (size_t ii = 0; ii < batches; ii++) {
+        const auto start = std::chrono::steady_clock::now();
+        conn.sendFrame(batch);
+        for (size_t jj = 0; jj < depth; jj++) {
+            response.reset();
+            conn.recvFrame(response);
+            const auto* rsp =
+                reinterpret_cast<const protocol_binary_response_no_extras*>(
+                    response.payload.data());
+            ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                      ntohs(rsp->message.header.response.status));
+        }
+        const auto stop = std::chrono::steady_clock::now();
+        usec.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                           stop - start).count() / depth);
+    }
+
+    verify("pipelined_get", summarize(usec));
+}
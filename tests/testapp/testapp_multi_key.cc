@@ -0,0 +1,248 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Functional tests for the batched multi-key commands EXIST_MULTI and
+ * DELETE_MULTI.
+ *
+ * Both take the same request body: a sequence of [keylen][key] entries
+ * with the length in network byte order. The validator only checks the
+ * frame, so the per-entry length checks live in the executor and are
+ * exercised here with hand-damaged bodies. EXIST_MULTI answers with
+ * nine bytes per key in request order (hit flag + CAS); DELETE_MULTI
+ * answers with the number of keys actually deleted.
+ */
+
+#include "testapp.h"
+
+#include <string>
+#include <vector>
+
+class MultiKeyTest : public TestappTest {
+protected:
+    // Append a [keylen][key] entry to the request body.
+    void add_key(std::vector<char>& body, const std::string& key) {
+        add_raw_entry(body, (uint16_t)key.size(), key);
+    }
+
+    // Append an entry whose length field need not match the key bytes;
+    // used to build the malformed bodies.
+    void add_raw_entry(std::vector<char>& body, uint16_t klen,
+                       const std::string& key) {
+        uint16_t wire = htons(klen);
+        body.insert(body.end(), (char*)&wire, (char*)&wire + sizeof(wire));
+        body.insert(body.end(), key.begin(), key.end());
+    }
+
+    // Send the body as the given command and validate the response
+    // status; on success the response value is returned.
+    std::vector<char> execute(uint8_t cmd, const std::vector<char>& body,
+                              protocol_binary_response_status expected_status) {
+        union {
+            protocol_binary_request_no_extras request;
+            protocol_binary_response_no_extras response;
+            char bytes[8192];
+        } buffer;
+
+        size_t len = mcbp_raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                      cmd, NULL, 0,
+                                      body.data(), body.size());
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        mcbp_validate_response_header(&buffer.response, cmd, expected_status);
+
+        /* safe_recv_packet has already converted bodylen */
+        uint32_t bodylen = buffer.response.message.header.response.bodylen;
+        const char* value = buffer.bytes + sizeof(buffer.response.bytes);
+        return std::vector<char>(value, value + bodylen);
+    }
+
+    // Decode one 9 byte EXIST_MULTI result entry.
+    void decode_exist_entry(const std::vector<char>& payload, size_t index,
+                            bool& hit, uint64_t& cas) {
+        const char* entry = payload.data() + index * 9;
+        hit = entry[0] != 0;
+        memcpy(&cas, entry + 1, sizeof(cas));
+        cas = ntohll(cas);
+    }
+};
+
+// Probe a mix of present and missing keys; the 9 byte entries must
+// come back in request order with a CAS for every hit and 0 for every
+// miss.
+TEST_F(MultiKeyTest, ExistMultiMixed) {
+    store_object("multi_a", "value");
+    store_object("multi_b", "value");
+
+    std::vector<char> body;
+    add_key(body, "multi_a");
+    add_key(body, "multi_missing");
+    add_key(body, "multi_b");
+
+    std::vector<char> payload = execute(PROTOCOL_BINARY_CMD_EXIST_MULTI, body,
+                                        PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    ASSERT_EQ(3u * 9u, payload.size());
+
+    bool hit;
+    uint64_t cas;
+    decode_exist_entry(payload, 0, hit, cas);
+    EXPECT_TRUE(hit);
+    EXPECT_NE(0u, cas);
+
+    decode_exist_entry(payload, 1, hit, cas);
+    EXPECT_FALSE(hit);
+    EXPECT_EQ(0u, cas);
+
+    decode_exist_entry(payload, 2, hit, cas);
+    EXPECT_TRUE(hit);
+    EXPECT_NE(0u, cas);
+
+    delete_object("multi_a");
+    delete_object("multi_b");
+}
+
+// The CAS returned by EXIST_MULTI is the item's real CAS, usable for
+// a subsequent CAS-checked mutation.
+TEST_F(MultiKeyTest, ExistMultiReturnsItemCas) {
+    store_object("multi_cas", "value");
+
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    size_t len = mcbp_raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                  PROTOCOL_BINARY_CMD_GET,
+                                  "multi_cas", 9, NULL, 0);
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    mcbp_validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_GET,
+                                  PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    uint64_t expected = ntohll(buffer.response.message.header.response.cas);
+
+    std::vector<char> body;
+    add_key(body, "multi_cas");
+    std::vector<char> payload = execute(PROTOCOL_BINARY_CMD_EXIST_MULTI, body,
+                                        PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    ASSERT_EQ(9u, payload.size());
+
+    bool hit;
+    uint64_t cas;
+    decode_exist_entry(payload, 0, hit, cas);
+    EXPECT_TRUE(hit);
+    EXPECT_EQ(expected, cas);
+
+    delete_object("multi_cas");
+}
+
+// Malformed entries are caught by the executor (the validator only
+// checks the frame): a truncated length field, a zero-length key and a
+// length running past the end of the body all fail with EINVAL.
+TEST_F(MultiKeyTest, ExistMultiMalformedEntries) {
+    // a single stray byte can't hold a length field
+    std::vector<char> body(1, 'x');
+    execute(PROTOCOL_BINARY_CMD_EXIST_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    // a valid entry followed by a truncated length field
+    body.clear();
+    add_key(body, "multi_a");
+    body.push_back('x');
+    execute(PROTOCOL_BINARY_CMD_EXIST_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    // zero-length key
+    body.clear();
+    add_raw_entry(body, 0, "");
+    execute(PROTOCOL_BINARY_CMD_EXIST_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    // length field runs past the end of the body
+    body.clear();
+    add_raw_entry(body, 100, "short");
+    execute(PROTOCOL_BINARY_CMD_EXIST_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    // length field larger than a legal key (KEY_MAX_LENGTH)
+    body.clear();
+    add_raw_entry(body, 300, std::string(300, 'k'));
+    execute(PROTOCOL_BINARY_CMD_EXIST_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+}
+
+// Delete a batch where some keys exist and some don't: the response
+// counts the keys actually removed and the missing ones aren't an
+// error.
+TEST_F(MultiKeyTest, DeleteMultiMixed) {
+    store_object("multi_a", "value");
+    store_object("multi_b", "value");
+
+    std::vector<char> body;
+    add_key(body, "multi_a");
+    add_key(body, "multi_missing");
+    add_key(body, "multi_b");
+
+    std::vector<char> payload = execute(PROTOCOL_BINARY_CMD_DELETE_MULTI, body,
+                                        PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    ASSERT_EQ(sizeof(uint32_t), payload.size());
+    uint32_t deleted;
+    memcpy(&deleted, payload.data(), sizeof(deleted));
+    EXPECT_EQ(2u, ntohl(deleted));
+
+    // and they really are gone
+    delete_object("multi_a", true);
+    delete_object("multi_b", true);
+    std::vector<char> probe = execute(PROTOCOL_BINARY_CMD_EXIST_MULTI, body,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    ASSERT_EQ(3u * 9u, probe.size());
+    for (size_t ii = 0; ii < 3; ++ii) {
+        bool hit;
+        uint64_t cas;
+        decode_exist_entry(probe, ii, hit, cas);
+        EXPECT_FALSE(hit);
+    }
+}
+
+// DELETE_MULTI shares the body layout and the executor-side length
+// checks with EXIST_MULTI.
+TEST_F(MultiKeyTest, DeleteMultiMalformedEntries) {
+    store_object("multi_a", "value");
+
+    std::vector<char> body(1, 'x');
+    execute(PROTOCOL_BINARY_CMD_DELETE_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    body.clear();
+    add_raw_entry(body, 0, "");
+    execute(PROTOCOL_BINARY_CMD_DELETE_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    body.clear();
+    add_raw_entry(body, 100, "short");
+    execute(PROTOCOL_BINARY_CMD_DELETE_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    // a malformed body must not delete the keys ahead of the damage
+    body.clear();
+    add_key(body, "multi_a");
+    body.push_back('x');
+    execute(PROTOCOL_BINARY_CMD_DELETE_MULTI, body,
+            PROTOCOL_BINARY_RESPONSE_EINVAL);
+    validate_object("multi_a", "value");
+
+    delete_object("multi_a");
+}
@@ -0,0 +1,155 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Functional tests for PROTOCOL_BINARY_CMD_SET_RANGE.
+ *
+ * SET_RANGE overwrites [offset, offset + patch length) of an existing
+ * document without changing its size. The header cas field carries the
+ * expected cas (0 = don't care), so it is applied by the executor
+ * rather than validated up front.
+ */
+
+#include "testapp.h"
+
+#include <string>
+
+class SetRangeTest : public TestappTest {
+protected:
+    // Fetch the current cas of the given key through GET.
+    uint64_t get_cas(const std::string& key) {
+        union {
+            protocol_binary_request_no_extras request;
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } buffer;
+
+        size_t len = mcbp_raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                      PROTOCOL_BINARY_CMD_GET,
+                                      key.c_str(), key.length(), NULL, 0);
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        mcbp_validate_response_header(&buffer.response,
+                                      PROTOCOL_BINARY_CMD_GET,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        return ntohll(buffer.response.message.header.response.cas);
+    }
+
+    // Send a SET_RANGE and validate the response status. On success the
+    // response header must carry the document's new cas.
+    void set_range(const std::string& key, uint32_t offset,
+                   const std::string& patch, uint64_t cas,
+                   protocol_binary_response_status expected_status) {
+        union {
+            protocol_binary_request_set_range request;
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } buffer;
+
+        memset(buffer.bytes, 0, sizeof(buffer.request.bytes));
+        buffer.request.message.header.request.magic = PROTOCOL_BINARY_REQ;
+        buffer.request.message.header.request.opcode =
+            PROTOCOL_BINARY_CMD_SET_RANGE;
+        buffer.request.message.header.request.extlen = 4;
+        buffer.request.message.header.request.keylen =
+            htons((uint16_t)key.length());
+        buffer.request.message.header.request.bodylen =
+            htonl((uint32_t)(4 + key.length() + patch.length()));
+        buffer.request.message.header.request.datatype =
+            PROTOCOL_BINARY_RAW_BYTES;
+        buffer.request.message.header.request.opaque = 0xdeadbeef;
+        buffer.request.message.header.request.cas = htonll(cas);
+        buffer.request.message.body.offset = htonl(offset);
+
+        size_t len = sizeof(buffer.request.bytes);
+        memcpy(buffer.bytes + len, key.data(), key.length());
+        len += key.length();
+        memcpy(buffer.bytes + len, patch.data(), patch.length());
+        len += patch.length();
+
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        mcbp_validate_response_header(&buffer.response,
+                                      PROTOCOL_BINARY_CMD_SET_RANGE,
+                                      expected_status);
+        if (expected_status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            EXPECT_NE(0u,
+                      ntohll(buffer.response.message.header.response.cas));
+        }
+    }
+};
+
+// Patch within the bounds of the document and read the result back.
+TEST_F(SetRangeTest, PatchWithinBounds) {
+    store_object("set_range", "0123456789");
+
+    set_range("set_range", 3, "xyz", 0, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    validate_object("set_range", "012xyz6789");
+
+    // patching the first and last bytes stays in bounds as well
+    set_range("set_range", 0, "A", 0, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    set_range("set_range", 9, "Z", 0, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    validate_object("set_range", "A12xyz678Z");
+
+    delete_object("set_range");
+}
+
+// A patch never changes the document's size; writing past the end
+// fails with ERANGE and leaves the value untouched.
+TEST_F(SetRangeTest, OffsetPastEnd) {
+    store_object("set_range", "0123456789");
+
+    set_range("set_range", 10, "x", 0, PROTOCOL_BINARY_RESPONSE_ERANGE);
+    set_range("set_range", 8, "xyz", 0, PROTOCOL_BINARY_RESPONSE_ERANGE);
+    set_range("set_range", 0xffffffff, "x", 0,
+              PROTOCOL_BINARY_RESPONSE_ERANGE);
+    validate_object("set_range", "0123456789");
+
+    delete_object("set_range");
+}
+
+// A non-zero cas must match the document; a stale cas fails with
+// KEY_EEXISTS while the current one succeeds.
+TEST_F(SetRangeTest, CasMismatch) {
+    store_object("set_range", "0123456789");
+    uint64_t cas = get_cas("set_range");
+
+    set_range("set_range", 0, "x", cas + 1,
+              PROTOCOL_BINARY_RESPONSE_KEY_EEXISTS);
+    validate_object("set_range", "0123456789");
+
+    set_range("set_range", 0, "x", cas, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    validate_object("set_range", "x123456789");
+
+    delete_object("set_range");
+}
+
+// A zero-length patch is a no-op and is rejected by the validator.
+TEST_F(SetRangeTest, ZeroLengthPatch) {
+    store_object("set_range", "0123456789");
+
+    set_range("set_range", 0, "", 0, PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    delete_object("set_range");
+}
+
+// Patching a nonexistent document fails with KEY_ENOENT.
+TEST_F(SetRangeTest, MissingKey) {
+    delete_object("set_range", true);
+    set_range("set_range", 0, "x", 0,
+              PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+}
@@ -36,6 +36,28 @@ static void dump_key(const char* key, const uint16_t klen,
     (*count)++;
 }
 
+TEST_F(TopKeysTest, Sketch) {
+    topkeys.reset(new TopKeys(10, true));
+
+    // A few hot keys accessed from several "workers", plus a long
+    // tail of cold keys
+    for (int jj = 0; jj < 1000; jj++) {
+        for (int ii = 0; ii < 5; ii++) {
+            std::string key("hot_key_" + std::to_string(ii));
+            topkeys->updateKey(key.c_str(), key.size(), jj, jj % 4);
+        }
+        std::string cold("cold_key_" + std::to_string(jj));
+        topkeys->updateKey(cold.c_str(), cold.size(), jj, jj % 4);
+    }
+
+    size_t count = 0;
+    topkeys->stats(&count, 0, dump_key);
+    // The hot keys must have survived in the candidate tables
+    EXPECT_GE(count, 5);
+    // ... and the output is bounded by the exact mode capacity
+    EXPECT_LE(count, 80);
+}
+
 TEST_F(TopKeysTest, Basic) {
     // build list of keys
     std::vector<std::string> keys;
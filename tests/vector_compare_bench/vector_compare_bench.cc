@@ -0,0 +1,153 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Microbenchmark (and correctness check) for the compare / find
+ * primitives in utilities/vector_compare.h, pitted against their libc
+ * counterparts at the buffer sizes the protocol layer actually sees:
+ * keys of a few bytes up to a couple of hundred. The correctness part
+ * exhaustively walks every length up to 128 with the differing byte at
+ * every position, so with the (fast) default iteration count the
+ * binary doubles as a unit test and is registered with CTest.
+ */
+#include "config.h"
+
+#include <utilities/vector_compare.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static const size_t max_len = 256;
+
+/*
+ * Exhaustive equality check: for every length, equal buffers must
+ * compare equal and flipping any single byte must be detected.
+ */
+static bool check_memeq(void) {
+    uint8_t a[max_len];
+    uint8_t b[max_len];
+    std::mt19937 gen(42);
+
+    for (size_t len = 0; len <= 128; ++len) {
+        for (size_t ii = 0; ii < len; ++ii) {
+            a[ii] = uint8_t(gen());
+        }
+        memcpy(b, a, len);
+        if (!cb_memeq(a, b, len)) {
+            fprintf(stderr, "cb_memeq: false negative at len %zu\n", len);
+            return false;
+        }
+        for (size_t pos = 0; pos < len; ++pos) {
+            b[pos] ^= 0x80;
+            if (cb_memeq(a, b, len)) {
+                fprintf(stderr, "cb_memeq: false positive at len %zu "
+                        "pos %zu\n", len, pos);
+                return false;
+            }
+            b[pos] ^= 0x80;
+        }
+    }
+    return true;
+}
+
+/*
+ * cb_memfind8 must agree with memchr for every (length, position)
+ * combination, including "not present".
+ */
+static bool check_memfind(void) {
+    uint8_t buf[max_len];
+
+    for (size_t len = 0; len <= 128; ++len) {
+        memset(buf, 'x', sizeof(buf));
+        if (cb_memfind8(buf, len, '\0') != NULL) {
+            fprintf(stderr, "cb_memfind8: phantom hit at len %zu\n", len);
+            return false;
+        }
+        for (size_t pos = 0; pos < len; ++pos) {
+            buf[pos] = '\0';
+            const void* found = cb_memfind8(buf, len, '\0');
+            if (found != buf + pos) {
+                fprintf(stderr, "cb_memfind8: wrong hit at len %zu "
+                        "pos %zu\n", len, pos);
+                return false;
+            }
+            buf[pos] = 'x';
+        }
+    }
+    return true;
+}
+
+typedef bool (*compare_fn)(const void*, const void*, size_t);
+
+static bool wrap_cb_memeq(const void* a, const void* b, size_t len) {
+    return cb_memeq(a, b, len);
+}
+
+static bool wrap_memcmp(const void* a, const void* b, size_t len) {
+    return memcmp(a, b, len) == 0;
+}
+
+/*
+ * Time `iterations` equality compares of `len`-byte buffers which are
+ * identical except (half of the time) in the last byte — the common
+ * case for a hash chain walk, where the stored hash has already
+ * filtered out most mismatches and surviving compares mostly match.
+ */
+static void bench_compare(const char* name, compare_fn fn, size_t len,
+                          size_t iterations) {
+    std::vector<uint8_t> a(len + 1, 'k');
+    std::vector<uint8_t> b(len + 1, 'k');
+    size_t matches = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t ii = 0; ii < iterations; ++ii) {
+        b[len - 1] = uint8_t('k' + (ii & 1));
+        if (fn(a.data(), b.data(), len)) {
+            matches++;
+        }
+    }
+    const auto stop = std::chrono::steady_clock::now();
+    const double ns = double(std::chrono::duration_cast<
+                                 std::chrono::nanoseconds>(stop - start)
+                                 .count());
+
+    printf("%-10s len %3zu: %6.2f ns/op (%zu matches)\n",
+           name, len, ns / double(iterations), matches);
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = 1000000;
+    if (argc > 1) {
+        iterations = size_t(strtoul(argv[1], NULL, 10));
+    }
+
+    if (!check_memeq() || !check_memfind()) {
+        return EXIT_FAILURE;
+    }
+
+    const size_t lengths[] = {4, 8, 12, 16, 24, 32, 48, 64, 128, 250};
+    for (size_t len : lengths) {
+        bench_compare("cb_memeq", wrap_cb_memeq, len, iterations);
+        bench_compare("memcmp", wrap_memcmp, len, iterations);
+    }
+
+    return EXIT_SUCCESS;
+}
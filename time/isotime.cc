@@ -27,60 +27,98 @@
 
 std::mutex ISOTime::mutex;
 
+/**
+ * The formatted timestamp only changes up to second granularity, but
+ * the calendar math to get there (gmtime/localtime and two mktime
+ * calls under a global mutex - mktime isn't thread-safe) is by far
+ * the most expensive part of formatting. Logging and auditing format
+ * many records within the same second, so each thread caches the
+ * formatted prefix ("YYYY-MM-DDThh:mm:ss.") and the timezone suffix
+ * for the second it last saw, and only the fraction in between has to
+ * be formatted per record. Records within the same second on a thread
+ * are thereby timestamped without taking any lock.
+ */
+struct SecondCache {
+    /** The second the cached strings describe ((time_t)-1: none) */
+    time_t second;
+    int prefix_len;
+    int suffix_len;
+    /** "YYYY-MM-DDThh:mm:ss." and a trailing '\0' */
+    char prefix[24];
+    /** "Z" or "[+-]hh:mm" and a trailing '\0' */
+    char suffix[8];
+};
+
+static thread_local SecondCache second_cache = {(time_t)-1, 0, 0, {0}, {0}};
+
 int ISOTime::generatetimestamp(ISO8601String &destination,
                                time_t now, uint32_t frac_of_second)
 {
-    struct tm utc_time;
-    struct tm local_time;
+    SecondCache& cache = second_cache;
+
+    if (cache.second != now) {
+        struct tm utc_time;
+        struct tm local_time;
 #ifdef WIN32
-    gmtime_s(&utc_time, &now);
-    localtime_s(&local_time, &now);
+        gmtime_s(&utc_time, &now);
+        localtime_s(&local_time, &now);
 #else
-    gmtime_r(&now, &utc_time);
-    localtime_r(&now, &local_time);
+        gmtime_r(&now, &utc_time);
+        localtime_r(&now, &local_time);
 #endif
-    time_t utc;
-    time_t local;
+        time_t utc;
+        time_t local;
 
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        utc = mktime(&utc_time);
-        local = mktime(&local_time);
-    }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            utc = mktime(&utc_time);
+            local = mktime(&local_time);
+        }
 
-    if (utc_time.tm_isdst != 0) {
-        // UTC should not be adjusted to daylight savings
-        utc -= 3600;
-    }
+        if (utc_time.tm_isdst != 0) {
+            // UTC should not be adjusted to daylight savings
+            utc -= 3600;
+        }
+
+        double total_seconds_diff = difftime(local, utc);
+        double total_minutes_diff = total_seconds_diff / 60;
+        int32_t hours = (int32_t)(total_minutes_diff / 60);
+        int32_t minutes = (int32_t)(total_minutes_diff) % 60;
+
+        cache.prefix_len = checked_snprintf(cache.prefix, sizeof(cache.prefix),
+                                            "%04u-%02u-%02uT%02u:%02u:%02u.",
+                                            local_time.tm_year + 1900,
+                                            local_time.tm_mon + 1,
+                                            local_time.tm_mday,
+                                            local_time.tm_hour,
+                                            local_time.tm_min,
+                                            local_time.tm_sec);
 
-    double total_seconds_diff = difftime(local, utc);
-    double total_minutes_diff = total_seconds_diff / 60;
-    int32_t hours = (int32_t)(total_minutes_diff / 60);
-    int32_t minutes = (int32_t)(total_minutes_diff) % 60;
-
-    int offset = checked_snprintf(destination.data(), destination.size(),
-                                  "%04u-%02u-%02uT%02u:%02u:%02u.%06u",
-                                  local_time.tm_year + 1900,
-                                  local_time.tm_mon + 1,
-                                  local_time.tm_mday,
-                                  local_time.tm_hour,
-                                  local_time.tm_min,
-                                  local_time.tm_sec,
-                                  frac_of_second);
-
-    if (total_seconds_diff == 0.0) {
-        strcat(destination.data(), "Z");
-        ++offset;
-    } else if (total_seconds_diff < 0.0) {
-        offset += checked_snprintf(destination.data() + offset,
-                                   destination.size() - offset,
-                                   "-%02u:%02u", abs(hours), abs(minutes));
-    } else {
-        offset += checked_snprintf(destination.data() + offset,
-                                   destination.size() - offset,
-                                   "+%02u:%02u", hours, minutes);
+        if (total_seconds_diff == 0.0) {
+            cache.suffix_len = checked_snprintf(cache.suffix,
+                                                sizeof(cache.suffix), "Z");
+        } else if (total_seconds_diff < 0.0) {
+            cache.suffix_len = checked_snprintf(cache.suffix,
+                                                sizeof(cache.suffix),
+                                                "-%02u:%02u",
+                                                abs(hours), abs(minutes));
+        } else {
+            cache.suffix_len = checked_snprintf(cache.suffix,
+                                                sizeof(cache.suffix),
+                                                "+%02u:%02u", hours, minutes);
+        }
+
+        cache.second = now;
     }
-    return offset;
+
+    int offset = cache.prefix_len;
+    memcpy(destination.data(), cache.prefix, offset);
+    offset += checked_snprintf(destination.data() + offset,
+                               destination.size() - offset,
+                               "%06u", frac_of_second);
+    // include the '\0'
+    memcpy(destination.data() + offset, cache.suffix, cache.suffix_len + 1);
+    return offset + cache.suffix_len;
 }
 
 int ISOTime::generatetimestamp(ISO8601String &destination) {
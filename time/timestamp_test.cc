@@ -47,5 +47,26 @@ int main(void)
         return EXIT_FAILURE;
     }
 
+    /* A second call within the same second is served from the cached
+       prefix/suffix; only the fraction may differ */
+    expected.assign("2015-03-13T02:36:00.999999-07:00");
+    timestamp = ISOTime::generatetimestamp(now, 999999);
+    if (timestamp != expected) {
+        std::cerr << "Comparison failed (cached second)" << std::endl
+                  << "  Expected [" << expected << "]" << std::endl
+                  << "  got      [" << timestamp << "]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    /* Crossing into another second must refresh the cache */
+    expected.assign("2015-03-13T02:36:01.000001-07:00");
+    timestamp = ISOTime::generatetimestamp(now + 1, 1);
+    if (timestamp != expected) {
+        std::cerr << "Comparison failed (next second)" << std::endl
+                  << "  Expected [" << expected << "]" << std::endl
+                  << "  got      [" << timestamp << "]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     return EXIT_SUCCESS;
 }
@@ -1,4 +1,10 @@
 /* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* dl_iterate_phdr (used by warm_engine_modules to page in the module
+ * text) is a GNU extension; ask for it before the first libc header */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "config.h"
 #include <ctype.h>
 #include <stdio.h>
@@ -8,6 +14,12 @@
 #include <platform/cb_malloc.h>
 #include <platform/platform.h>
 
+#ifdef __linux__
+#include <link.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 static const char * const feature_descriptions[] = {
     "compare and swap",
     "persistent storage",
@@ -19,7 +31,26 @@ static const char * const feature_descriptions[] = {
     "datatype",
 };
 
-struct engine_reference {
+/*
+ * A loaded engine module. The shared object is opened and its symbols
+ * are resolved once per (module, create function) pair; every
+ * engine_reference handed out for the pair shares this entry. The
+ * module stays cached even when the last reference goes away so that
+ * re-creating a bucket of the type doesn't pay for dlopen again; the
+ * cached modules are destroyed by shutdown_engine_loader().
+ *
+ * The cache inherits the MT contract of its users: load_engine and
+ * unload_engine are only called during initialize_engine_map and
+ * shutdown_engine_map, which are documented as not MT safe.
+ */
+struct engine_module {
+    /* The module name as given to load_engine */
+    char* soname;
+
+    /* The requested create function ("" when the caller asked for the
+       default list), part of the cache key as one module may export
+       several create functions */
+    char* create_name;
 
     /* Union hack to remove a warning from C99 */
     union my_create_u {
@@ -33,15 +64,56 @@ struct engine_reference {
     } my_destroy_engine;
 
     cb_dlhandle_t *handle;
+
+    /* Number of live engine_references sharing the module */
+    int refcount;
+
+    struct engine_module* next;
+};
+
+/* The cached modules (a handful of entries; a list is fine) */
+static struct engine_module* modules;
+
+struct engine_reference {
+    struct engine_module* module;
 };
 
+static struct engine_module* find_module(const char* soname,
+                                         const char* create_name) {
+    struct engine_module* module = modules;
+    while (module != NULL) {
+        if (strcmp(module->soname, soname) == 0 &&
+            strcmp(module->create_name, create_name) == 0) {
+            return module;
+        }
+        module = module->next;
+    }
+    return NULL;
+}
+
 void unload_engine(engine_reference* engine)
 {
-    if (engine->handle != NULL) {
-        (*engine->my_destroy_engine.destroy)();
-        cb_dlclose(engine->handle);
-        cb_free(engine);
+    /* The module itself is kept warm in the cache (no destroy_engine,
+       no dlclose) for the next user; see shutdown_engine_loader. */
+    if (engine->module != NULL) {
+        engine->module->refcount--;
+    }
+    cb_free(engine);
+}
+
+void shutdown_engine_loader(void)
+{
+    struct engine_module* module = modules;
+    while (module != NULL) {
+        struct engine_module* next = module->next;
+        (*module->my_destroy_engine.destroy)();
+        cb_dlclose(module->handle);
+        cb_free(module->soname);
+        cb_free(module->create_name);
+        cb_free(module);
+        module = next;
     }
+    modules = NULL;
 }
 
 static void* find_symbol(cb_dlhandle_t *handle, const char* function, char** errmsg) {
@@ -61,58 +133,186 @@ engine_reference* load_engine(const char* soname,
                                              "create_ep_engine_instance",
                                              NULL };
     const char* const destroy_functions[] = { "destroy_engine", NULL };
+    struct engine_module* module;
+    engine_reference* engine_ref;
+    cb_dlhandle_t* handle;
 
-    cb_dlhandle_t* handle = cb_dlopen(soname, &errmsg);
+    module = find_module(soname, create_function ? create_function : "");
+    if (module == NULL) {
+        handle = cb_dlopen(soname, &errmsg);
 
-    if (handle == NULL) {
-        logger->log(EXTENSION_LOG_WARNING, NULL,
-                    "Failed to open library \"%s\": %s\n", soname, errmsg);
-        cb_free(errmsg);
-        return NULL;
-    }
+        if (handle == NULL) {
+            logger->log(EXTENSION_LOG_WARNING, NULL,
+                        "Failed to open library \"%s\": %s\n", soname, errmsg);
+            cb_free(errmsg);
+            return NULL;
+        }
 
-    if (create_function) {
-        create_symbol = find_symbol(handle, create_function, &create_errmsg);
-    } else {
-        int ii = 0;
-        while (create_functions[ii] != NULL && create_symbol == NULL) {
-            create_symbol = find_symbol(handle, create_functions[ii], &create_errmsg);
+        if (create_function) {
+            create_symbol = find_symbol(handle, create_function, &create_errmsg);
+        } else {
+            int ii = 0;
+            while (create_functions[ii] != NULL && create_symbol == NULL) {
+                cb_free(create_errmsg);
+                create_errmsg = NULL;
+                create_symbol = find_symbol(handle, create_functions[ii], &create_errmsg);
+                ++ii;
+            }
         }
+
+        if (destroy_function) {
+            destroy_symbol = find_symbol(handle, destroy_function, &destroy_errmsg);
+        } else {
+            int ii = 0;
+            while (destroy_functions[ii] != NULL && destroy_symbol == NULL) {
+                cb_free(destroy_errmsg);
+                destroy_errmsg = NULL;
+                destroy_symbol = find_symbol(handle, destroy_functions[ii], &destroy_errmsg);
+                ++ii;
+            }
+        }
+
+        if (create_symbol == NULL) {
+            logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Could not find the function to create an engine instance in %s: %s\n",
+                    soname, create_errmsg);
+            cb_free(create_errmsg);
+            cb_free(destroy_errmsg);
+            cb_dlclose(handle);
+            return NULL;
+        }
+
+        if (destroy_symbol == NULL) {
+            logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Could not find the function to destroy the engine in %s: %s\n",
+                    soname, destroy_errmsg);
+            cb_free(destroy_errmsg);
+            cb_dlclose(handle);
+            return NULL;
+        }
+
+        /* dlopen is success and we found all required symbols; cache
+           the module so further references are free. */
+        module = cb_calloc(1, sizeof(struct engine_module));
+        module->soname = cb_strdup(soname);
+        module->create_name = cb_strdup(create_function ? create_function : "");
+        module->handle = handle;
+        module->my_create_instance.voidptr = create_symbol;
+        module->my_destroy_engine.voidptr = destroy_symbol;
+        module->next = modules;
+        modules = module;
     }
 
-    if (destroy_function) {
-        destroy_symbol = find_symbol(handle, destroy_function, &destroy_errmsg);
-    } else {
-        int ii = 0;
-        while (destroy_functions[ii] != NULL && destroy_symbol == NULL) {
-            destroy_symbol = find_symbol(handle, destroy_functions[ii], &destroy_errmsg);
+    module->refcount++;
+    engine_ref = cb_calloc(1, sizeof(engine_reference));
+    engine_ref->module = module;
+    return engine_ref;
+}
+
+#ifdef __linux__
+
+struct warm_module_state {
+    bool lock;
+    EXTENSION_LOGGER_DESCRIPTOR *logger;
+};
+
+/*
+ * Does the path of a loaded object refer to one of the cached engine
+ * modules? The dynamic loader reports the full path; the cache holds
+ * the soname handed to load_engine, so match on the trailing path
+ * component.
+ */
+static bool is_cached_module(const char *objname) {
+    size_t objlen = strlen(objname);
+    struct engine_module* module = modules;
+
+    while (module != NULL) {
+        size_t solen = strlen(module->soname);
+        if (objlen >= solen &&
+            strcmp(objname + objlen - solen, module->soname) == 0 &&
+            (objlen == solen || objname[objlen - solen - 1] == '/')) {
+            return true;
         }
+        module = module->next;
     }
+    return false;
+}
 
-    if (create_symbol == NULL) {
-        logger->log(EXTENSION_LOG_WARNING, NULL,
-                "Could not find the function to create an engine instance in %s: %s\n",
-                soname, create_errmsg);
-        cb_free(create_errmsg);
-        return NULL;
+static int warm_module_callback(struct dl_phdr_info *info, size_t size,
+                                void *ctx) {
+    struct warm_module_state *state = ctx;
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    size_t total = 0;
+    int jj;
+
+    if (info->dlpi_name == NULL || info->dlpi_name[0] == '\0' ||
+        !is_cached_module(info->dlpi_name)) {
+        return 0;
     }
 
-    if (destroy_symbol == NULL) {
-        logger->log(EXTENSION_LOG_WARNING, NULL,
-                "Could not find the function to destroy the engine in %s: %s\n",
-                soname, destroy_errmsg);
-        cb_free(destroy_errmsg);
-        return NULL;
+    for (jj = 0; jj < info->dlpi_phnum; ++jj) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[jj];
+        char *addr;
+        char *base;
+        size_t len;
+        size_t off;
+        volatile char sink = 0;
+
+        /* Only the executable segments; the data segments are written
+           (and thus faulted in) by the engine initialization anyway */
+        if (phdr->p_type != PT_LOAD || (phdr->p_flags & PF_X) == 0) {
+            continue;
+        }
+
+        addr = (char*)(info->dlpi_addr + phdr->p_vaddr);
+        base = (char*)((uintptr_t)addr & ~(page - 1));
+        len = (size_t)(addr - base) + phdr->p_memsz;
+
+        /* Kick off the readahead in bulk, then touch every page so
+           the faults are taken here and not on the first commands */
+        (void)madvise(base, len, MADV_WILLNEED);
+        for (off = 0; off < len; off += page) {
+            sink ^= base[off];
+        }
+        (void)sink;
+
+        if (state->lock && mlock(base, len) != 0) {
+            state->logger->log(EXTENSION_LOG_WARNING, NULL,
+                               "Failed to lock %lu kB of text from %s "
+                               "into memory",
+                               (unsigned long)(len / 1024), info->dlpi_name);
+        }
+        total += len;
     }
 
-    // dlopen is success and we found all required symbols.
-    engine_reference* engine_ref = cb_calloc(1, sizeof(engine_reference));
-    engine_ref->handle = handle;
-    engine_ref->my_create_instance.voidptr = create_symbol;
-    engine_ref->my_destroy_engine.voidptr = destroy_symbol;
-    return engine_ref;
+    if (total > 0) {
+        state->logger->log(EXTENSION_LOG_NOTICE, NULL,
+                           "%s %lu kB of text from %s",
+                           state->lock ? "Paged in and locked" : "Paged in",
+                           (unsigned long)(total / 1024), info->dlpi_name);
+    }
+    return 0;
 }
 
+void warm_engine_modules(bool lock, EXTENSION_LOGGER_DESCRIPTOR *logger)
+{
+    struct warm_module_state state;
+    state.lock = lock;
+    state.logger = logger;
+    dl_iterate_phdr(warm_module_callback, &state);
+}
+
+#else
+
+void warm_engine_modules(bool lock, EXTENSION_LOGGER_DESCRIPTOR *logger)
+{
+    (void)lock;
+    logger->log(EXTENSION_LOG_NOTICE, NULL,
+                "Engine module warming is not supported on this platform");
+}
+
+#endif
+
 bool create_engine_instance(engine_reference* engine_ref,
                             SERVER_HANDLE_V1 *(*get_server_api)(void),
                             EXTENSION_LOGGER_DESCRIPTOR *logger,
@@ -120,7 +320,7 @@ bool create_engine_instance(engine_reference* engine_ref,
     ENGINE_HANDLE* engine = NULL;
 
     /* request a instance with protocol version 1 */
-    ENGINE_ERROR_CODE error = (*engine_ref->my_create_instance.create)(1, get_server_api, &engine);
+    ENGINE_ERROR_CODE error = (*engine_ref->module->my_create_instance.create)(1, get_server_api, &engine);
 
     if (error != ENGINE_SUCCESS || engine == NULL) {
         logger->log(EXTENSION_LOG_WARNING, NULL,
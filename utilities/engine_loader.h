@@ -18,11 +18,19 @@ extern "C" {
 typedef struct engine_reference engine_reference;
 
 /*
-    Unload the engine.
-    Triggers destroy_engine then closes the shared object finally freeing the reference.
+    Release the reference to the engine module. The module itself stays
+    cached (and warm) for the next load_engine of the same module; see
+    shutdown_engine_loader.
 */
 MEMCACHED_PUBLIC_API void unload_engine(engine_reference* engine);
 
+/*
+    Tear down the module cache: triggers destroy_engine and closes the
+    shared object of every cached module. Only legal once all
+    engine_references have been unloaded.
+*/
+MEMCACHED_PUBLIC_API void shutdown_engine_loader(void);
+
 /**
  * Load the specified engine shared object.
  *
@@ -42,6 +50,20 @@ MEMCACHED_PUBLIC_API engine_reference* load_engine(const char* soname,
                                                    EXTENSION_LOGGER_DESCRIPTOR* logger)
    CB_ATTR_NONNULL(1, 4);
 
+/**
+ * Page the text segments of every cached engine module into memory,
+ * so the first commands after a restart don't stall on lazy page-in
+ * of the shared objects. With lock set the pages are additionally
+ * mlocked so they can't be evicted again. Only implemented on Linux;
+ * elsewhere the call logs a notice and does nothing.
+ *
+ * @param lock also lock the paged-in text into memory
+ * @param logger Where to report progress and failures (cannot be NULL)
+ */
+MEMCACHED_PUBLIC_API void warm_engine_modules(bool lock,
+                                              EXTENSION_LOGGER_DESCRIPTOR* logger)
+    CB_ATTR_NONNULL(2);
+
 /*
     Create an engine instance.
 */
@@ -160,6 +160,14 @@ static const std::map<uint8_t, std::string> commandmap {
     {PROTOCOL_BINARY_CMD_SUBDOC_MULTI_LOOKUP,"SUBDOC_MULTI_LOOKUP"},
     {PROTOCOL_BINARY_CMD_SUBDOC_MULTI_MUTATION,"SUBDOC_MULTI_MUTATION"},
     {PROTOCOL_BINARY_CMD_SUBDOC_GET_COUNT, "SUBDOC_GET_COUNT"},
+    {PROTOCOL_BINARY_CMD_GET_SESSION_TOKEN,"GET_SESSION_TOKEN"},
+    {PROTOCOL_BINARY_CMD_RESUME_SESSION,"RESUME_SESSION"},
+    {PROTOCOL_BINARY_CMD_SEAL_SESSION_TOKEN,"SEAL_SESSION_TOKEN"},
+    {PROTOCOL_BINARY_CMD_DELETE_MULTI,"DELETE_MULTI"},
+    {PROTOCOL_BINARY_CMD_EXIST_MULTI,"EXIST_MULTI"},
+    {PROTOCOL_BINARY_CMD_GET_RANGE,"GET_RANGE"},
+    {PROTOCOL_BINARY_CMD_SET_RANGE,"SET_RANGE"},
+    {PROTOCOL_BINARY_CMD_SET_OP_DEADLINE,"SET_OP_DEADLINE"},
     {PROTOCOL_BINARY_CMD_SCRUB,"SCRUB"},
     {PROTOCOL_BINARY_CMD_ISASL_REFRESH,"ISASL_REFRESH"},
     {PROTOCOL_BINARY_CMD_SSL_CERTS_REFRESH,"SSL_CERTS_REFRESH"},
@@ -237,6 +245,8 @@ static const std::map<protocol_binary_response_status, std::string> statusmap {
         "Server too busy"},
     {PROTOCOL_BINARY_RESPONSE_ETMPFAIL,
         "Temporary failure"},
+    {PROTOCOL_BINARY_RESPONSE_DEADLINE_EXCEEDED,
+        "Deadline exceeded"},
 
     /* Sub-document responses */
     {PROTOCOL_BINARY_RESPONSE_SUBDOC_PATH_ENOENT,
@@ -0,0 +1,249 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * On-disk / shared-memory layout of the statistics segment exported by
+ * memcached when the "stats_shm_path" setting is set, plus a small
+ * header-only reader for node-local scrapers (see docs/StatsShm.md for
+ * the full description of the format and its consistency rules).
+ *
+ * The segment is a file the daemon maps MAP_SHARED and updates in
+ * place: the per-worker counter slices in the segment *are* the live
+ * counters the worker threads increment, so scraping costs the daemon
+ * nothing. The file starts with a stats_shm_header followed by
+ * header.record_count bucket records. Each record starts with a
+ * stats_shm_record and is followed (at header.slice_offset bytes into
+ * the record) by header.slice_count counter slices of
+ * header.slice_stride bytes each, one per front-end thread.
+ *
+ * Consistency:
+ *
+ *   - Individual counters are 8 (or 4) byte naturally aligned values
+ *     written with relaxed atomic stores; a reader sees each counter
+ *     torn-free but counters are not consistent with each other.
+ *     They are monotonic between rebinds, which is what rate scrapers
+ *     need.
+ *
+ *   - The per-record sequence number is a seqlock guarding the record
+ *     *binding*: it is bumped (to odd, then back to even) when the
+ *     record is bound to a newly created bucket or released when the
+ *     bucket is deleted (which also zeroes the slices). A reader which
+ *     sees the same even seq before and after reading the record knows
+ *     the name and the counters belong to the same bucket incarnation.
+ *
+ *   - Readers never write to the segment (map it PROT_READ).
+ */
+#ifndef UTILITIES_STATS_SHM_H
+#define UTILITIES_STATS_SHM_H 1
+
+#include <memcached/types.h> /* CB_INLINE */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 'M' 'C' 'S' 'T' when read as a little-endian uint32_t. The segment is
+ * only meant for node-local readers, so all fields are host endian and
+ * a magic mismatch just means "not for me". */
+#define STATS_SHM_MAGIC 0x5453434du
+
+/* Bumped whenever the layout of the header, the record header or the
+ * counter slice changes incompatibly. Readers must check it. */
+#define STATS_SHM_VERSION 1
+
+/* Matches MAX_BUCKET_NAME_LENGTH in the daemon */
+#define STATS_SHM_MAX_NAME 100
+
+typedef struct {
+    uint32_t magic;        /* STATS_SHM_MAGIC */
+    uint32_t version;      /* STATS_SHM_VERSION */
+    uint32_t header_size;  /* offset of the first record */
+    uint32_t record_stride; /* distance between consecutive records */
+    uint32_t record_count; /* number of bucket records (max_buckets) */
+    uint32_t slice_offset; /* offset of the first slice within a record */
+    uint32_t slice_count;  /* slices per record (worker threads + 1) */
+    uint32_t slice_stride; /* distance between consecutive slices */
+    uint64_t boot_time;    /* epoch seconds the daemon (re)created the
+                              segment; lets a scraper spot restarts */
+} stats_shm_header;
+
+typedef struct {
+    /* Seqlock over the binding; see the file comment. Odd while the
+     * record is being (re)bound. */
+    uint32_t seq;
+    /* Non-zero when the record is bound to a bucket */
+    uint32_t in_use;
+    /* The bucket name (NUL terminated). Record 0 is the "no bucket"
+     * serving unauthenticated connections and has an empty name. */
+    char name[STATS_SHM_MAX_NAME + 1];
+} stats_shm_record;
+
+/*
+ * One per-thread counter slice. This mirrors struct thread_stats in
+ * daemon/stats.h field for field (the daemon static_asserts the
+ * correspondence); see that file for the meaning of each counter.
+ * All of the uint64_t counters are monotonic; the trailing int32_t
+ * values are high watermarks.
+ */
+typedef struct {
+    uint64_t cmd_get;
+    uint64_t get_hits;
+    uint64_t get_misses;
+    uint64_t cmd_set;
+    uint64_t delete_hits;
+    uint64_t cas_hits;
+    uint64_t cas_badval;
+    uint64_t delete_misses;
+    uint64_t incr_misses;
+    uint64_t decr_misses;
+    uint64_t incr_hits;
+    uint64_t decr_hits;
+    uint64_t cas_misses;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t bytes_sent_zerocopy;
+    uint64_t bytes_sent_copied;
+    uint64_t sendmsg_calls;
+    uint64_t responses_corked;
+    uint64_t cmd_flush;
+    uint64_t conn_yields;
+    uint64_t auth_cmds;
+    uint64_t auth_errors;
+    uint64_t cmd_subdoc_lookup;
+    uint64_t cmd_subdoc_mutation;
+    uint64_t bytes_subdoc_lookup_total;
+    uint64_t bytes_subdoc_lookup_extracted;
+    uint64_t bytes_subdoc_mutation_total;
+    uint64_t bytes_subdoc_mutation_inserted;
+    uint64_t rbufs_allocated;
+    uint64_t rbufs_loaned;
+    uint64_t rbufs_existing;
+    uint64_t wbufs_allocated;
+    uint64_t wbufs_loaned;
+    int32_t iovused_high_watermark;
+    int32_t msgused_high_watermark;
+    int32_t scratch_arena_high_watermark;
+} stats_shm_counters;
+
+/* The number of uint64_t counters at the start of a slice (handy for
+ * readers which just want to sum or diff everything) */
+#define STATS_SHM_NUM_COUNTERS 34
+
+/**
+ * Validate a mapped segment header. Returns 0 if the segment can't be
+ * interpreted by this version of the reader.
+ */
+static CB_INLINE int stats_shm_check(const stats_shm_header* header,
+                                     size_t mapped_size) {
+    if (mapped_size < sizeof(*header) ||
+        header->magic != STATS_SHM_MAGIC ||
+        header->version != STATS_SHM_VERSION) {
+        return 0;
+    }
+    if (header->slice_stride < sizeof(stats_shm_counters) ||
+        header->slice_offset < sizeof(stats_shm_record) ||
+        header->record_stride <
+            header->slice_offset +
+            (size_t)header->slice_count * header->slice_stride) {
+        return 0;
+    }
+    if (mapped_size < (size_t)header->header_size +
+                      (size_t)header->record_count * header->record_stride) {
+        return 0;
+    }
+    return 1;
+}
+
+static CB_INLINE const stats_shm_record*
+stats_shm_get_record(const stats_shm_header* header, uint32_t idx) {
+    const char* base = (const char*)header;
+    return (const stats_shm_record*)(base + header->header_size +
+                                     (size_t)idx * header->record_stride);
+}
+
+static CB_INLINE const stats_shm_counters*
+stats_shm_get_slice(const stats_shm_header* header,
+                    const stats_shm_record* record,
+                    uint32_t slice) {
+    const char* base = (const char*)record;
+    return (const stats_shm_counters*)(base + header->slice_offset +
+                                       (size_t)slice * header->slice_stride);
+}
+
+/**
+ * Read one bucket record: copy out the name and the sum of all of its
+ * per-thread slices, retrying while the record is being rebound.
+ *
+ * Returns 1 on success, 0 if the record isn't bound to a bucket (the
+ * outputs are untouched in that case).
+ */
+static CB_INLINE int stats_shm_read_record(const stats_shm_header* header,
+                                           uint32_t idx,
+                                           char name[STATS_SHM_MAX_NAME + 1],
+                                           stats_shm_counters* sum) {
+    const stats_shm_record* record = stats_shm_get_record(header, idx);
+    const volatile uint32_t* seqp = &record->seq;
+
+    for (;;) {
+        uint32_t ii, seq = *seqp;
+        if (seq & 1) {
+            continue; /* rebind in progress */
+        }
+        if (!record->in_use) {
+            return 0;
+        }
+
+        memcpy(name, record->name, STATS_SHM_MAX_NAME + 1);
+        memset(sum, 0, sizeof(*sum));
+        for (ii = 0; ii < header->slice_count; ++ii) {
+            const stats_shm_counters* s =
+                stats_shm_get_slice(header, record, ii);
+            const uint64_t* src = (const uint64_t*)s;
+            uint64_t* dst = (uint64_t*)sum;
+            uint32_t jj;
+            for (jj = 0; jj < STATS_SHM_NUM_COUNTERS; ++jj) {
+                dst[jj] += src[jj];
+            }
+            if (s->iovused_high_watermark > sum->iovused_high_watermark) {
+                sum->iovused_high_watermark = s->iovused_high_watermark;
+            }
+            if (s->msgused_high_watermark > sum->msgused_high_watermark) {
+                sum->msgused_high_watermark = s->msgused_high_watermark;
+            }
+            if (s->scratch_arena_high_watermark >
+                sum->scratch_arena_high_watermark) {
+                sum->scratch_arena_high_watermark =
+                    s->scratch_arena_high_watermark;
+            }
+        }
+
+        if (*seqp == seq) {
+            return 1;
+        }
+        /* The record was rebound under us; go again */
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILITIES_STATS_SHM_H */
@@ -0,0 +1,168 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Size-specialized compare / find primitives for the short buffers the
+ * protocol layer deals in (keys, stat group names, prefixes). libc's
+ * memcmp is tuned for large buffers and its three-way result forces it
+ * to find the *first* differing byte; the hot paths here only ever ask
+ * "equal or not", which lets us compare word- and vector-sized chunks
+ * in any order and with overlapping loads instead of a byte loop.
+ *
+ * Everything is a static inline so a compile-time-known length
+ * constant-folds the size dispatch away and the caller is left with a
+ * couple of straight-line loads and compares. Unaligned access is done
+ * through memcpy, which the compilers we care about lower to a plain
+ * load on the platforms that allow it.
+ *
+ * The header is usable from both C (engine internals) and C++ (the
+ * daemon).
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <memcached/types.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CB_VECTOR_COMPARE_SSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+static CB_INLINE uint32_t cb_load_u32(const void* p) {
+    uint32_t val;
+    memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+static CB_INLINE uint64_t cb_load_u64(const void* p) {
+    uint64_t val;
+    memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+/**
+ * Compare two buffers of the same (caller-checked) length for
+ * equality. Returns true if the len bytes at a and b are identical.
+ *
+ * Buffers of 4 bytes and up are compared as two (possibly overlapping)
+ * words or 16-byte vectors covering the whole range, so the cost is a
+ * function of the length only, not of where the first difference is.
+ */
+static CB_INLINE bool cb_memeq(const void* a, const void* b, size_t len) {
+    const uint8_t* aa = (const uint8_t*)a;
+    const uint8_t* bb = (const uint8_t*)b;
+
+    if (len < 4) {
+        /* 0 - 3 bytes; too short for an overlapping word */
+        size_t ii;
+        for (ii = 0; ii < len; ii++) {
+            if (aa[ii] != bb[ii]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (len <= 8) {
+        /* two overlapping 32-bit words cover 4 - 8 bytes */
+        return ((cb_load_u32(aa) ^ cb_load_u32(bb)) |
+                (cb_load_u32(aa + len - 4) ^ cb_load_u32(bb + len - 4))) == 0;
+    }
+
+    if (len <= 16) {
+        /* two overlapping 64-bit words cover 9 - 16 bytes */
+        return ((cb_load_u64(aa) ^ cb_load_u64(bb)) |
+                (cb_load_u64(aa + len - 8) ^ cb_load_u64(bb + len - 8))) == 0;
+    }
+
+#if defined(CB_VECTOR_COMPARE_SSE2)
+    {
+        /* full 16-byte vectors, with the final vector overlapping the
+         * previous one rather than falling back to a scalar tail */
+        size_t offset = 0;
+        while (len - offset > 16) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(aa + offset));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(bb + offset));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff) {
+                return false;
+            }
+            offset += 16;
+        }
+        {
+            __m128i va = _mm_loadu_si128((const __m128i*)(aa + len - 16));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(bb + len - 16));
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) == 0xffff;
+        }
+    }
+#else
+    return memcmp(aa, bb, len) == 0;
+#endif
+}
+
+/**
+ * Locate the first occurrence of a byte, as memchr. Scans a vector at
+ * a time when SSE2 is available; returns NULL if the byte isn't
+ * present.
+ */
+static CB_INLINE const void* cb_memfind8(const void* haystack, size_t len,
+                                         uint8_t needle) {
+#if defined(CB_VECTOR_COMPARE_SSE2)
+    const uint8_t* hh = (const uint8_t*)haystack;
+    const __m128i vneedle = _mm_set1_epi8((char)needle);
+    size_t offset = 0;
+
+    while (len - offset >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(hh + offset));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, vneedle));
+        if (mask != 0) {
+#if defined(_MSC_VER)
+            unsigned long first;
+            _BitScanForward(&first, (unsigned long)mask);
+            return hh + offset + first;
+#else
+            return hh + offset + __builtin_ctz((unsigned)mask);
+#endif
+        }
+        offset += 16;
+    }
+    if (offset < len) {
+        return memchr(hh + offset, needle, len - offset);
+    }
+    return NULL;
+#else
+    return memchr(haystack, needle, len);
+#endif
+}
+
+#ifdef __cplusplus
+/**
+ * Equality compare with the length fixed at compile time; the length
+ * propagates through cb_memeq as a constant so the size dispatch and
+ * the chunk loop disappear entirely.
+ */
+template <size_t N>
+bool cb_memeq_fixed(const void* a, const void* b) {
+    return cb_memeq(a, b, N);
+}
+#endif /* __cplusplus */